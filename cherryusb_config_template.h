@@ -80,6 +80,13 @@
 #define CONFIG_USBDEV_MSC_MAX_BUFSIZE 512
 #endif
 
+/* data phase buffers of CONFIG_USBDEV_MSC_MAX_BUFSIZE, storage access overlaps with usb transfer when more than 1.
+ * With CONFIG_USBDEV_MSC_THREAD or CONFIG_USBDEV_MSC_POLLING all of them are filled ahead, otherwise one.
+ */
+#ifndef CONFIG_USBDEV_MSC_BUFNUM
+#define CONFIG_USBDEV_MSC_BUFNUM 2
+#endif
+
 #ifndef CONFIG_USBDEV_MSC_MANUFACTURER_STRING
 #define CONFIG_USBDEV_MSC_MANUFACTURER_STRING ""
 #endif
@@ -98,6 +105,11 @@
 /* move msc read & write from isr to thread */
 // #define CONFIG_USBDEV_MSC_THREAD
 
+/* storage completes sector i/o from its own isr through usbd_msc_sector_read_async/usbd_msc_sector_write_async
+ * and usbd_msc_sector_done, no thread needed. Can not be used with CONFIG_USBDEV_MSC_POLLING or CONFIG_USBDEV_MSC_THREAD
+ */
+// #define CONFIG_USBDEV_MSC_ASYNC
+
 #ifndef CONFIG_USBDEV_MSC_PRIO
 #define CONFIG_USBDEV_MSC_PRIO 4
 #endif
@@ -132,11 +144,20 @@
 #define CONFIG_USBDEV_RNDIS_RESP_BUFFER_SIZE 156
 #endif
 
-/* rndis transfer buffer size, must be a multiple of (1536 + 44)*/
+/* rndis transfer buffer size, must be a multiple of (1536 + 44), up to 16384.
+ * a bigger one lets several packets share one bulk transfer.
+ */
 #ifndef CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE
 #define CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE 1580
 #endif
 
+/* packets the host may put in one transfer, up to 32. small packets such as tcp acks
+ * are batched even with the default frame size above.
+ */
+#ifndef CONFIG_USBDEV_RNDIS_MAX_PACKETS_PER_TRANSFER
+#define CONFIG_USBDEV_RNDIS_MAX_PACKETS_PER_TRANSFER 8
+#endif
+
 #ifndef CONFIG_USBDEV_RNDIS_VENDOR_ID
 #define CONFIG_USBDEV_RNDIS_VENDOR_ID 0x0000ffff
 #endif
@@ -145,8 +166,57 @@
 #define CONFIG_USBDEV_RNDIS_VENDOR_DESC "CherryUSB"
 #endif
 
+/* cdc ncm ntb size, must be at least 2048 and a multiple of bulk mps */
+#ifndef CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE
+#define CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE 8192
+#endif
+
+#ifndef CONFIG_USBDEV_CDC_NCM_NTB_OUT_MAX_SIZE
+#define CONFIG_USBDEV_CDC_NCM_NTB_OUT_MAX_SIZE 8192
+#endif
+
+#ifndef CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_DATAGRAMS
+#define CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_DATAGRAMS 32
+#endif
+
+/* network functions of each class over all buses, every one has its own buffers */
+#ifndef CONFIG_USBDEV_MAX_RNDIS_CLASS
+#define CONFIG_USBDEV_MAX_RNDIS_CLASS 1
+#endif
+
+#ifndef CONFIG_USBDEV_MAX_CDC_ECM_CLASS
+#define CONFIG_USBDEV_MAX_CDC_ECM_CLASS 1
+#endif
+
+#ifndef CONFIG_USBDEV_MAX_CDC_NCM_CLASS
+#define CONFIG_USBDEV_MAX_CDC_NCM_CLASS 1
+#endif
+
 #define CONFIG_USBDEV_RNDIS_USING_LWIP
 #define CONFIG_USBDEV_CDC_ECM_USING_LWIP
+#define CONFIG_USBDEV_CDC_NCM_USING_LWIP
+
+/* pass rx buffers to lwip as custom pbufs and dma tx from lwip pbufs, needs LWIP_SUPPORT_CUSTOM_PBUF.
+ * rndis tx also needs PBUF_LINK_ENCAPSULATION_HLEN >= 44 for the message header, otherwise it copies.
+ */
+// #define CONFIG_USBDEV_RNDIS_ZERO_COPY
+// #define CONFIG_USBDEV_CDC_ECM_ZERO_COPY
+
+#ifndef CONFIG_USBDEV_RNDIS_RX_POOL_NUM
+#define CONFIG_USBDEV_RNDIS_RX_POOL_NUM 4
+#endif
+
+#ifndef CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM
+#define CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM 8
+#endif
+
+#ifndef CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM
+#define CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM 4
+#endif
+
+#ifndef CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM
+#define CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM 8
+#endif
 
 /* ================ USB HOST Stack Configuration ================== */
 
@@ -192,6 +262,69 @@
 #define CONFIG_USBHOST_MSC_TIMEOUT 5000
 #endif
 
+/* aligned bounce buffers for unaligned msc host glue requests, used with CONFIG_USB_DCACHE_ENABLE */
+#ifndef CONFIG_USBHOST_MSC_BOUNCE_NUM
+#define CONFIG_USBHOST_MSC_BOUNCE_NUM 2
+#endif
+#ifndef CONFIG_USBHOST_MSC_BOUNCE_BUFSIZE
+#define CONFIG_USBHOST_MSC_BOUNCE_BUFSIZE 4096
+#endif
+
+/* write-back sector cache for msc host glue (fatfs/dfs/zephyr/filex), 512 bytes sector only.
+ * Small writes stay in cache until sync, adjacent dirty sectors are merged into one WRITE(10),
+ * sequential reads fetch CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS at once.
+ */
+// #define CONFIG_USBHOST_MSC_CACHE
+#ifndef CONFIG_USBHOST_MSC_CACHE_LINES
+#define CONFIG_USBHOST_MSC_CACHE_LINES 8
+#endif
+#ifndef CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS
+#define CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS 4
+#endif
+#ifndef CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS
+#define CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS 16
+#endif
+
+/* allow several async urbs in flight on one bulk/intr endpoint, hcd chains them back-to-back.
+ * Supported by ehci(forces CONFIG_USB_EHCI_QH_CACHE), dwc2 and loopback, musb fails to build with it.
+ * dwc2 keeps the data toggle per endpoint in hport->ep_toggle, reset by set configuration/interface and clear halt.
+ * rndis and cdc ncm rx use it.
+ */
+// #define CONFIG_USBHOST_URB_QUEUE
+#ifndef CONFIG_USBHOST_URB_QUEUE_DEPTH
+#define CONFIG_USBHOST_URB_QUEUE_DEPTH 2
+#endif
+
+/* video streaming urbs kept in flight, each one has a buffer of CONFIG_USBHOST_VIDEO_URB_BUFSIZE,
+ * an iso urb carries at most CONFIG_USBHOST_VIDEO_ISO_PACKETS packets of wMaxPacketSize * mult.
+ */
+#ifndef CONFIG_USBHOST_VIDEO_URB_NUM
+#define CONFIG_USBHOST_VIDEO_URB_NUM 2
+#endif
+#ifndef CONFIG_USBHOST_VIDEO_ISO_PACKETS
+#define CONFIG_USBHOST_VIDEO_ISO_PACKETS 8
+#endif
+#ifndef CONFIG_USBHOST_VIDEO_URB_BUFSIZE
+#define CONFIG_USBHOST_VIDEO_URB_BUFSIZE (8 * 1024)
+#endif
+/* max frame buffers given to usbh_video_stream_start */
+#ifndef CONFIG_USBHOST_VIDEO_FRAME_NUM
+#define CONFIG_USBHOST_VIDEO_FRAME_NUM 3
+#endif
+
+/* audio streaming urbs kept in flight per direction, each one has a buffer of CONFIG_USBHOST_AUDIO_URB_BUFSIZE
+ * and carries at most CONFIG_USBHOST_AUDIO_ISO_PACKETS packets, more packets give more latency but less irqs.
+ */
+#ifndef CONFIG_USBHOST_AUDIO_URB_NUM
+#define CONFIG_USBHOST_AUDIO_URB_NUM 2
+#endif
+#ifndef CONFIG_USBHOST_AUDIO_ISO_PACKETS
+#define CONFIG_USBHOST_AUDIO_ISO_PACKETS 8
+#endif
+#ifndef CONFIG_USBHOST_AUDIO_URB_BUFSIZE
+#define CONFIG_USBHOST_AUDIO_URB_BUFSIZE (4 * 1024)
+#endif
+
 /* This parameter affects usb performance, and depends on (TCP_WND)tcp eceive windows size,
  * you can change to 2K ~ 16K and must be larger than TCP RX windows size in order to avoid being overflow.
  */
@@ -205,16 +338,28 @@
 #endif
 
 /* This parameter affects usb performance, and depends on (TCP_WND)tcp eceive windows size,
- * you can change to 2K ~ 16K and must be larger than TCP RX windows size in order to avoid being overflow.
+ * you can change to 2K ~ 16K, device ntbs are limited to this size with SET_NTB_INPUT_SIZE.
  */
 #ifndef CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE
 #define CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE (2048)
 #endif
-/* Because lwip do not support multi pbuf at a time, so increasing this variable has no performance improvement */
+/* Size of each of the two tx ntbs, frames are packed into one ntb while the other is on the bus.
+ * 8K ~ 16K lets several full size frames share one transfer, the device's dwNtbOutMaxSize still applies.
+ */
 #ifndef CONFIG_USBHOST_CDC_NCM_ETH_MAX_TX_SIZE
 #define CONFIG_USBHOST_CDC_NCM_ETH_MAX_TX_SIZE (2048)
 #endif
 
+/* datagrams packed into one tx ntb, the device's wNtbOutMaxDatagrams still applies */
+#ifndef CONFIG_USBHOST_CDC_NCM_TX_MAX_DATAGRAMS
+#define CONFIG_USBHOST_CDC_NCM_TX_MAX_DATAGRAMS 16
+#endif
+
+/* ms a partly filled tx ntb waits for more frames when bulk out is idle, 0 sends it at once */
+#ifndef CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT
+#define CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT 0
+#endif
+
 /* This parameter affects usb performance, and depends on (TCP_WND)tcp eceive windows size,
  * you can change to 2K ~ 16K and must be larger than TCP RX windows size in order to avoid being overflow.
  */
@@ -263,6 +408,15 @@
  * in xxx32 chips, only pb14/pb15 can support dma mode, pa11/pa12 is not supported(only a few supports, but we ignore them)
 */
 // #define CONFIG_USB_DWC2_DMA_ENABLE
+/* enable dwc2 descriptor dma mode for device, needs CONFIG_USB_DWC2_DMA_ENABLE and GHWCFG4 support,
+ * every endpoint owns a descriptor ring so several transfers can be queued without waiting for completion.
+ */
+// #define CONFIG_USB_DWC2_DMA_DESC_ENABLE
+// #define CONFIG_USB_DWC2_DMA_DESC_NUM 8
+/* size dwc2 device rx/tx fifos from the configuration descriptor at SET_CONFIGURATION,
+ * instead of the fixed device_rx_fifo_size/device_tx_fifo_size in user params.
+ */
+// #define CONFIG_USB_DWC2_AUTO_FIFO
 
 /* ---------------- MUSB Configuration ---------------- */
 #define CONFIG_USB_MUSB_EP_NUM 8
@@ -279,12 +433,19 @@
 #define CONFIG_USB_EHCI_FRAME_LIST_SIZE 1024
 #define CONFIG_USB_EHCI_QH_NUM          10
 #define CONFIG_USB_EHCI_QTD_NUM         (CONFIG_USB_EHCI_QH_NUM * 3)
-#define CONFIG_USB_EHCI_ITD_NUM         4
+#define CONFIG_USB_EHCI_ITD_NUM         16 /* itd/sitd ring of each iso endpoint, covers all urbs in flight */
+#define CONFIG_USB_EHCI_ISO_NUM         2  /* iso endpoints opened at the same time */
+// #define CONFIG_USB_EHCI_PERIODIC_TREE_SIZE 8 /* longest interrupt poll period in frames, power of 2 */
+// #define CONFIG_USB_EHCI_TT_NUM 4             /* hub tts tracked for fs/ls interrupt bandwidth */
 // #define CONFIG_USB_EHCI_HCOR_RESERVED_DISABLE
 // #define CONFIG_USB_EHCI_CONFIGFLAG
 // #define CONFIG_USB_EHCI_ISO
 // #define CONFIG_USB_EHCI_WITH_OHCI
 // #define CONFIG_USB_EHCI_DESC_DCACHE_ENABLE
+/* keep one qh per bulk/intr endpoint linked in schedule and only append qtds on submit,
+ * every opened endpoint holds one qh and one dummy qtd until its urb is killed.
+ */
+// #define CONFIG_USB_EHCI_QH_CACHE
 
 /* ---------------- OHCI Configuration ---------------- */
 #define CONFIG_USB_OHCI_HCOR_OFFSET (0x0)
@@ -294,14 +455,29 @@
 
 /* ---------------- XHCI Configuration ---------------- */
 #define CONFIG_USB_XHCI_HCCR_OFFSET (0x0)
+// #define CONFIG_USB_XHCI_MAX_SLOTS 16
+// #define CONFIG_USB_XHCI_RING_SIZE 256    /* trbs per transfer ring, power of two */
+// #define CONFIG_USB_XHCI_TD_NUM 16        /* urbs in flight per endpoint */
+// #define CONFIG_USB_XHCI_IMOD_INTERVAL 160 /* interrupt moderation in 250ns, 0 to disable */
 
 /* ---------------- DWC2 Configuration ---------------- */
-// nothing to define
+// #define CONFIG_USB_DWC2_NAK_RETRY 8   /* naks a bulk in channel takes before holdoff, 0 to disable */
+// #define CONFIG_USB_DWC2_NAK_HOLDOFF 1 /* frames a bulk in channel waits after nak retries */
+// #define CONFIG_USB_DWC2_TT_NUM 4      /* hub transaction translators tracked for periodic splits */
 
 /* ---------------- MUSB Configuration ---------------- */
 #define CONFIG_USB_MUSB_PIPE_NUM 8
 // #define CONFIG_USB_MUSB_SUNXI
 
+/* ---------------- KINETIS Configuration ---------------- */
+// #define CONFIG_USB_KINETIS_PIPE_NUM 8     /* host urbs queued at the same time */
+// #define CONFIG_USB_KINETIS_NAK_HOLDOFF 1  /* frames a control/bulk pipe waits after nak */
+
+/* ---------------- LOOPBACK Configuration ---------------- */
+/* software controller, device bus n is plugged into roothub of host bus n in the same process */
+// #define CONFIG_USB_LOOPBACK_MAX_LINK 1
+// #define CONFIG_USB_LOOPBACK_SPEED USB_SPEED_HIGH
+
 /* When your chip hardware supports high-speed and wants to initialize it in high-speed mode,
  * the relevant IP will configure the internal or external high-speed PHY according to CONFIG_USB_HS.
  *
@@ -22,6 +22,10 @@
 #define INTF_DESC_bAlternateSetting 3 /** Alternate setting offset */
 
 USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_audio_buf[USB_ALIGN_UP(128, CONFIG_USB_ALIGN_SIZE)];
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_audio_stream_buf[CONFIG_USBHOST_MAX_AUDIO_CLASS][2][CONFIG_USBHOST_AUDIO_URB_NUM][USB_ALIGN_UP(CONFIG_USBHOST_AUDIO_URB_BUFSIZE, CONFIG_USB_ALIGN_SIZE)];
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_audio_fb_buf[CONFIG_USBHOST_MAX_AUDIO_CLASS][USB_ALIGN_UP(4, CONFIG_USB_ALIGN_SIZE)];
+
+static void usbh_audio_stream_complete(void *arg, int nbytes);
 
 static struct usbh_audio g_audio_class[CONFIG_USBHOST_MAX_AUDIO_CLASS];
 static uint32_t g_devinuse = 0;
@@ -51,6 +55,339 @@ static void usbh_audio_class_free(struct usbh_audio *audio_class)
     memset(audio_class, 0, sizeof(struct usbh_audio));
 }
 
+static uint32_t usbh_audio_stream_period(struct usbh_audio_stream *stream)
+{
+    /* iso interval is 2^(bInterval - 1) in micro-frames for hs, in frames for fs */
+    return 1 << (MIN(MAX(stream->ep->bInterval, 1), 16) - 1);
+}
+
+static void usbh_audio_stream_init(struct usbh_audio *audio_class, uint8_t intf, uint8_t altsetting, uint32_t samp_freq)
+{
+    struct usbh_interface_altsetting *alt = &audio_class->hport->config.intf[intf].altsetting[altsetting];
+    struct audio_cs_if_as_format_type_descriptor *format = &audio_class->as_msg_table[intf - audio_class->ctrl_intf - 1].as_format[altsetting];
+    struct usb_endpoint_descriptor *ep_desc = &alt->ep[0].ep_desc;
+    struct usbh_audio_stream *stream;
+    uint32_t packets_per_sec;
+
+    stream = &audio_class->stream[(ep_desc->bEndpointAddress & 0x80) ? USBH_AUDIO_STREAM_IN : USBH_AUDIO_STREAM_OUT];
+    memset(stream, 0, sizeof(struct usbh_audio_stream));
+
+    stream->audio_class = audio_class;
+    stream->ep = ep_desc;
+    stream->dir = (ep_desc->bEndpointAddress & 0x80) ? USBH_AUDIO_STREAM_IN : USBH_AUDIO_STREAM_OUT;
+    stream->mps = USB_GET_MAXPACKETSIZE(ep_desc->wMaxPacketSize) * (USB_GET_MULT(ep_desc->wMaxPacketSize) + 1);
+    stream->frame_bytes = format->bNrChannels * format->bSubframeSize;
+    stream->samp_freq = samp_freq;
+
+    /* async out endpoint comes with an iso in feedback endpoint in the same altsetting */
+    if ((stream->dir == USBH_AUDIO_STREAM_OUT) && (alt->intf_desc.bNumEndpoints > 1)) {
+        if ((alt->ep[1].ep_desc.bEndpointAddress & 0x80) &&
+            (USB_GET_ENDPOINT_TYPE(alt->ep[1].ep_desc.bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS)) {
+            stream->fb_ep = &alt->ep[1].ep_desc;
+        }
+    }
+
+    if (audio_class->hport->speed == USB_SPEED_HIGH) {
+        packets_per_sec = 8000 / usbh_audio_stream_period(stream);
+    } else {
+        packets_per_sec = 1000 / usbh_audio_stream_period(stream);
+    }
+    stream->nominal = (uint32_t)(((uint64_t)samp_freq << 16) / packets_per_sec);
+    stream->rate = stream->nominal;
+}
+
+static void usbh_audio_stream_feedback(struct usbh_audio_stream *stream, uint8_t *buf, uint32_t len)
+{
+    uint32_t value;
+    uint32_t rate[2];
+
+    if (len < 3) {
+        return;
+    }
+
+    value = buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16);
+    if (len >= 4) {
+        value |= ((uint32_t)buf[3] << 24);
+    }
+
+    /* fs feedback is 10.14 samples per frame, hs feedback is 16.16 samples per micro-frame,
+     * some hs devices still send 10.14, so take the one close to nominal rate.
+     */
+    if (stream->audio_class->hport->speed == USB_SPEED_HIGH) {
+        rate[0] = value;
+        rate[1] = (value & 0x00ffffff) << 2;
+    } else {
+        rate[0] = (value & 0x00ffffff) << 2;
+        rate[1] = value;
+    }
+
+    for (uint8_t i = 0; i < 2; i++) {
+        rate[i] *= usbh_audio_stream_period(stream);
+        if ((rate[i] > (stream->nominal - (stream->nominal >> 3))) && (rate[i] < (stream->nominal + (stream->nominal >> 3)))) {
+            stream->rate = rate[i];
+            stream->stat.feedback++;
+            return;
+        }
+    }
+}
+
+/* prepare out packets, number of samples per packet follows feedback rate */
+static void usbh_audio_stream_fill(struct usbh_audio_stream *stream, struct usbh_audio_urb *aurb, uint8_t *buf)
+{
+    struct usbh_iso_frame_packet *iso_packet;
+    uint32_t len;
+
+    for (uint8_t i = 0; i < stream->packets; i++) {
+        iso_packet = &aurb->urb.iso_packet[i];
+
+        stream->accum += stream->rate;
+        len = (stream->accum >> 16) * stream->frame_bytes;
+        stream->accum &= 0xffff;
+        if (len > stream->mps) {
+            len = stream->mps - (stream->mps % stream->frame_bytes);
+        }
+
+        iso_packet->transfer_buffer = &buf[i * stream->mps];
+        iso_packet->transfer_buffer_length = len;
+
+        if (!stream->prefilled && (chry_ringbuffer_get_used(&stream->rb) >= stream->latency)) {
+            stream->prefilled = true;
+        }
+
+        if (stream->prefilled && (chry_ringbuffer_get_used(&stream->rb) >= len)) {
+            chry_ringbuffer_read(&stream->rb, iso_packet->transfer_buffer, len);
+        } else {
+            /* send silence and buffer up to latency again */
+            memset(iso_packet->transfer_buffer, 0, len);
+            if (stream->prefilled) {
+                stream->stat.underrun++;
+                stream->prefilled = false;
+            }
+        }
+    }
+}
+
+static int usbh_audio_stream_submit(struct usbh_audio_stream *stream, struct usbh_audio_urb *aurb)
+{
+    struct usbh_audio *audio_class = stream->audio_class;
+    uint8_t *buf = g_audio_stream_buf[audio_class->minor][stream->dir][aurb - stream->urb];
+
+    usbh_iso_urb_fill(&aurb->urb, audio_class->hport, stream->ep, stream->packets, usbh_audio_stream_complete, aurb);
+#if defined(__ICCARM__) || defined(__ICCRISCV__) || defined(__ICCRX__)
+    aurb->urb.iso_packet = aurb->iso_packet;
+#endif
+
+    if (stream->dir == USBH_AUDIO_STREAM_OUT) {
+        usbh_audio_stream_fill(stream, aurb, buf);
+    } else {
+        for (uint8_t i = 0; i < stream->packets; i++) {
+            aurb->urb.iso_packet[i].transfer_buffer = &buf[i * stream->mps];
+            aurb->urb.iso_packet[i].transfer_buffer_length = stream->mps;
+        }
+    }
+
+    return usbh_submit_urb(&aurb->urb);
+}
+
+static void usbh_audio_stream_complete(void *arg, int nbytes)
+{
+    struct usbh_audio_urb *aurb = (struct usbh_audio_urb *)arg;
+    struct usbh_audio_stream *stream = aurb->stream;
+    struct usbh_iso_frame_packet *iso_packet;
+
+    if (!stream->running) {
+        return;
+    }
+
+    if ((nbytes == -USB_ERR_SHUTDOWN) || (nbytes == -USB_ERR_NODEV)) {
+        return;
+    }
+
+    if ((nbytes >= 0) && (stream->dir == USBH_AUDIO_STREAM_IN)) {
+        for (uint8_t i = 0; i < aurb->urb.num_of_iso_packets; i++) {
+            iso_packet = &aurb->urb.iso_packet[i];
+            if ((iso_packet->errorcode < 0) || (iso_packet->actual_length == 0)) {
+                continue;
+            }
+            if (chry_ringbuffer_get_free(&stream->rb) < iso_packet->actual_length) {
+                stream->stat.overrun++;
+                continue;
+            }
+            chry_ringbuffer_write(&stream->rb, iso_packet->transfer_buffer, iso_packet->actual_length);
+        }
+    }
+
+    usbh_audio_stream_submit(stream, aurb);
+}
+
+static void usbh_audio_stream_fb_complete(void *arg, int nbytes)
+{
+    struct usbh_audio_fb_urb *fb_urb = (struct usbh_audio_fb_urb *)arg;
+    struct usbh_audio_stream *stream = fb_urb->stream;
+
+    if (!stream->running) {
+        return;
+    }
+
+    if ((nbytes == -USB_ERR_SHUTDOWN) || (nbytes == -USB_ERR_NODEV)) {
+        return;
+    }
+
+    if ((nbytes >= 0) && (fb_urb->urb.iso_packet[0].errorcode == 0)) {
+        usbh_audio_stream_feedback(stream, fb_urb->urb.iso_packet[0].transfer_buffer, fb_urb->urb.iso_packet[0].actual_length);
+    }
+
+    usbh_submit_urb(&fb_urb->urb);
+}
+
+static void usbh_audio_stream_kill(struct usbh_audio_stream *stream)
+{
+    if (!stream->running) {
+        return;
+    }
+    stream->running = false;
+
+    for (uint8_t i = 0; i < CONFIG_USBHOST_AUDIO_URB_NUM; i++) {
+        usbh_kill_urb(&stream->urb[i].urb);
+    }
+
+    if (stream->fb_ep) {
+        usbh_kill_urb(&stream->fb_urb.urb);
+    }
+}
+
+static struct usbh_audio_stream *usbh_audio_stream_find(struct usbh_audio *audio_class, const char *name)
+{
+    struct usbh_interface_altsetting *alt;
+
+    for (uint8_t i = 0; i < audio_class->stream_intf_num; i++) {
+        if ((strcmp(name, audio_class->as_msg_table[i].stream_name) == 0) && audio_class->as_msg_table[i].cur_altsetting) {
+            alt = &audio_class->hport->config.intf[audio_class->as_msg_table[i].stream_intf].altsetting[audio_class->as_msg_table[i].cur_altsetting];
+            return &audio_class->stream[(alt->ep[0].ep_desc.bEndpointAddress & 0x80) ? USBH_AUDIO_STREAM_IN : USBH_AUDIO_STREAM_OUT];
+        }
+    }
+    return NULL;
+}
+
+int usbh_audio_stream_start(struct usbh_audio *audio_class, const char *name, uint8_t *rb_buf, uint32_t rb_size, uint32_t latency_ms)
+{
+    struct usbh_audio_stream *stream;
+    int ret;
+
+    if (!audio_class || !audio_class->hport || !rb_buf) {
+        return -USB_ERR_INVAL;
+    }
+
+    stream = usbh_audio_stream_find(audio_class, name);
+    if (stream == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    if (stream->running) {
+        return -USB_ERR_BUSY;
+    }
+
+    if (chry_ringbuffer_init(&stream->rb, rb_buf, rb_size) < 0) {
+        /* size must be power of 2 */
+        return -USB_ERR_INVAL;
+    }
+
+    stream->packets = MIN(CONFIG_USBHOST_AUDIO_ISO_PACKETS, CONFIG_USBHOST_AUDIO_URB_BUFSIZE / stream->mps);
+    if ((stream->packets == 0) || (stream->frame_bytes == 0)) {
+        return -USB_ERR_RANGE;
+    }
+
+    if (rb_size < (2 * (uint32_t)stream->mps)) {
+        return -USB_ERR_RANGE;
+    }
+
+    stream->latency = (stream->samp_freq * latency_ms / 1000) * stream->frame_bytes;
+    if (stream->latency > (rb_size - stream->mps)) {
+        stream->latency = rb_size - stream->mps;
+    }
+
+    stream->rate = stream->nominal;
+    stream->accum = 0;
+    stream->prefilled = false;
+    memset(&stream->stat, 0, sizeof(struct usbh_audio_stream_stat));
+    stream->running = true;
+
+    for (uint8_t i = 0; i < CONFIG_USBHOST_AUDIO_URB_NUM; i++) {
+        memset(&stream->urb[i], 0, sizeof(struct usbh_audio_urb));
+        stream->urb[i].stream = stream;
+        ret = usbh_audio_stream_submit(stream, &stream->urb[i]);
+        if (ret < 0) {
+            USB_LOG_ERR("Fail to submit audio urb, ret:%d\r\n", ret);
+            usbh_audio_stream_kill(stream);
+            return ret;
+        }
+    }
+
+    if (stream->fb_ep) {
+        memset(&stream->fb_urb, 0, sizeof(struct usbh_audio_fb_urb));
+        stream->fb_urb.stream = stream;
+        usbh_iso_urb_fill(&stream->fb_urb.urb, audio_class->hport, stream->fb_ep, 1, usbh_audio_stream_fb_complete, &stream->fb_urb);
+#if defined(__ICCARM__) || defined(__ICCRISCV__) || defined(__ICCRX__)
+        stream->fb_urb.urb.iso_packet = stream->fb_urb.iso_packet;
+#endif
+        stream->fb_urb.urb.iso_packet[0].transfer_buffer = g_audio_fb_buf[audio_class->minor];
+        stream->fb_urb.urb.iso_packet[0].transfer_buffer_length = MIN(USB_GET_MAXPACKETSIZE(stream->fb_ep->wMaxPacketSize), 4);
+        ret = usbh_submit_urb(&stream->fb_urb.urb);
+        if (ret < 0) {
+            /* keep streaming at nominal rate */
+            USB_LOG_WRN("Fail to submit audio feedback urb, ret:%d\r\n", ret);
+        }
+    }
+
+    return 0;
+}
+
+int usbh_audio_stream_stop(struct usbh_audio *audio_class, const char *name)
+{
+    struct usbh_audio_stream *stream;
+
+    if (!audio_class || !audio_class->hport) {
+        return -USB_ERR_INVAL;
+    }
+
+    stream = usbh_audio_stream_find(audio_class, name);
+    if (stream == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    usbh_audio_stream_kill(stream);
+    return 0;
+}
+
+uint32_t usbh_audio_stream_write(struct usbh_audio *audio_class, const uint8_t *buf, uint32_t len)
+{
+    struct usbh_audio_stream *stream = &audio_class->stream[USBH_AUDIO_STREAM_OUT];
+
+    if (!stream->running) {
+        return 0;
+    }
+    return chry_ringbuffer_write(&stream->rb, (void *)buf, len);
+}
+
+uint32_t usbh_audio_stream_read(struct usbh_audio *audio_class, uint8_t *buf, uint32_t len)
+{
+    struct usbh_audio_stream *stream = &audio_class->stream[USBH_AUDIO_STREAM_IN];
+
+    if (!stream->running) {
+        return 0;
+    }
+    return chry_ringbuffer_read(&stream->rb, buf, len);
+}
+
+void usbh_audio_stream_get_stat(struct usbh_audio *audio_class, uint8_t dir, struct usbh_audio_stream_stat *stat)
+{
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    memcpy(stat, &audio_class->stream[dir & 0x01].stat, sizeof(struct usbh_audio_stream_stat));
+    usb_osal_leave_critical_section(flags);
+}
+
 int usbh_audio_open(struct usbh_audio *audio_class, const char *name, uint32_t samp_freq, uint8_t bitresolution)
 {
     struct usb_setup_packet *setup;
@@ -66,12 +403,11 @@ int usbh_audio_open(struct usbh_audio *audio_class, const char *name, uint32_t s
     }
     setup = audio_class->hport->setup;
 
-    if (audio_class->is_opened) {
-        return 0;
-    }
-
     for (uint8_t i = 0; i < audio_class->stream_intf_num; i++) {
         if (strcmp(name, audio_class->as_msg_table[i].stream_name) == 0) {
+            if (audio_class->as_msg_table[i].cur_altsetting) {
+                return 0;
+            }
             intf = audio_class->as_msg_table[i].stream_intf;
             for (uint8_t j = 1; j < audio_class->as_msg_table[i].num_of_altsetting; j++) {
                 if (audio_class->as_msg_table[i].as_format[j].bBitResolution == bitresolution) {
@@ -92,6 +428,13 @@ int usbh_audio_open(struct usbh_audio *audio_class, const char *name, uint32_t s
 
 freq_found:
 
+    ep_desc = &audio_class->hport->config.intf[intf].altsetting[altsetting].ep[0].ep_desc;
+
+    /* one stream per direction */
+    if (((ep_desc->bEndpointAddress & 0x80) && audio_class->isoin) || (!(ep_desc->bEndpointAddress & 0x80) && audio_class->isoout)) {
+        return -USB_ERR_BUSY;
+    }
+
     setup->bmRequestType = USB_REQUEST_DIR_OUT | USB_REQUEST_STANDARD | USB_REQUEST_RECIPIENT_INTERFACE;
     setup->bRequest = USB_REQUEST_SET_INTERFACE;
     setup->wValue = altsetting;
@@ -103,8 +446,6 @@ freq_found:
         return ret;
     }
 
-    ep_desc = &audio_class->hport->config.intf[intf].altsetting[altsetting].ep[0].ep_desc;
-
     if (audio_class->as_msg_table[intf - audio_class->ctrl_intf - 1].ep_attr & AUDIO_EP_CONTROL_SAMPLING_FEQ) {
         setup->bmRequestType = USB_REQUEST_DIR_OUT | USB_REQUEST_CLASS | USB_REQUEST_RECIPIENT_ENDPOINT;
         setup->bRequest = AUDIO_REQUEST_SET_CUR;
@@ -129,7 +470,11 @@ freq_found:
         USBH_EP_INIT(audio_class->isoout, ep_desc);
     }
 
+    usbh_audio_stream_init(audio_class, intf, altsetting, samp_freq);
+
     USB_LOG_INFO("Open audio stream :%s, altsetting: %u\r\n", name, altsetting);
+    audio_class->as_msg_table[intf - audio_class->ctrl_intf - 1].cur_altsetting = altsetting;
+    audio_class->as_msg_table[intf - audio_class->ctrl_intf - 1].samp_freq = samp_freq;
     audio_class->is_opened = true;
     return ret;
 }
@@ -150,6 +495,9 @@ int usbh_audio_close(struct usbh_audio *audio_class, const char *name)
     for (uint8_t i = 0; i < audio_class->stream_intf_num; i++) {
         if (strcmp(name, audio_class->as_msg_table[i].stream_name) == 0) {
             intf = audio_class->as_msg_table[i].stream_intf;
+            if (audio_class->as_msg_table[i].cur_altsetting) {
+                altsetting = audio_class->as_msg_table[i].cur_altsetting;
+            }
         }
     }
 
@@ -157,6 +505,8 @@ int usbh_audio_close(struct usbh_audio *audio_class, const char *name)
         return -USB_ERR_NODEV;
     }
 
+    usbh_audio_stream_stop(audio_class, name);
+
     setup->bmRequestType = USB_REQUEST_DIR_OUT | USB_REQUEST_STANDARD | USB_REQUEST_RECIPIENT_INTERFACE;
     setup->bRequest = USB_REQUEST_SET_INTERFACE;
     setup->wValue = 0;
@@ -168,7 +518,13 @@ int usbh_audio_close(struct usbh_audio *audio_class, const char *name)
         return ret;
     }
     USB_LOG_INFO("Close audio stream :%s\r\n", name);
+    audio_class->as_msg_table[intf - audio_class->ctrl_intf - 1].cur_altsetting = 0;
     audio_class->is_opened = false;
+    for (uint8_t i = 0; i < audio_class->stream_intf_num; i++) {
+        if (audio_class->as_msg_table[i].cur_altsetting) {
+            audio_class->is_opened = true;
+        }
+    }
 
     ep_desc = &audio_class->hport->config.intf[intf].altsetting[altsetting].ep[0].ep_desc;
     if (ep_desc->bEndpointAddress & 0x80) {
@@ -588,9 +944,11 @@ static int usbh_audio_ctrl_disconnect(struct usbh_hubport *hport, uint8_t intf)
 
     if (audio_class) {
         if (audio_class->isoin) {
+            usbh_audio_stream_kill(&audio_class->stream[USBH_AUDIO_STREAM_IN]);
         }
 
         if (audio_class->isoout) {
+            usbh_audio_stream_kill(&audio_class->stream[USBH_AUDIO_STREAM_OUT]);
         }
 
         if (hport->config.intf[intf].devname[0] != '\0') {
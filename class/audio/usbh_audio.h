@@ -7,11 +7,25 @@
 #define USBH_AUDIO_H
 
 #include "usb_audio.h"
+#include "chry_ringbuffer.h"
 
 #ifndef CONFIG_USBHOST_AUDIO_MAX_STREAMS
 #define CONFIG_USBHOST_AUDIO_MAX_STREAMS 3
 #endif
 
+#ifndef CONFIG_USBHOST_AUDIO_URB_NUM
+#define CONFIG_USBHOST_AUDIO_URB_NUM 2
+#endif
+#ifndef CONFIG_USBHOST_AUDIO_ISO_PACKETS
+#define CONFIG_USBHOST_AUDIO_ISO_PACKETS 8
+#endif
+#ifndef CONFIG_USBHOST_AUDIO_URB_BUFSIZE
+#define CONFIG_USBHOST_AUDIO_URB_BUFSIZE (4 * 1024)
+#endif
+
+#define USBH_AUDIO_STREAM_OUT 0
+#define USBH_AUDIO_STREAM_IN  1
+
 struct usbh_audio_ac_msg {
     struct audio_cs_if_ac_input_terminal_descriptor ac_input;
     struct audio_cs_if_ac_feature_unit_descriptor ac_feature_unit;
@@ -31,10 +45,52 @@ struct usbh_audio_as_msg {
     uint16_t volume_res;
     uint16_t volume_cur;
     bool mute;
+    uint8_t cur_altsetting; /* 0 means stream is closed */
+    uint32_t samp_freq;
     struct audio_cs_if_as_general_descriptor as_general;
     struct audio_cs_if_as_format_type_descriptor as_format[CONFIG_USBHOST_MAX_INTF_ALTSETTINGS];
 };
 
+struct usbh_audio_stream_stat {
+    uint32_t underrun; /* out packets sent as silence because ring buffer is short of data */
+    uint32_t overrun;  /* in packets dropped because ring buffer is full */
+    uint32_t feedback; /* feedback values accepted */
+};
+
+/* urb with room for its iso packets, iso_packet[] must follow urb directly */
+struct usbh_audio_urb {
+    struct usbh_urb urb;
+    struct usbh_iso_frame_packet iso_packet[CONFIG_USBHOST_AUDIO_ISO_PACKETS];
+    struct usbh_audio_stream *stream;
+};
+
+struct usbh_audio_fb_urb {
+    struct usbh_urb urb;
+    struct usbh_iso_frame_packet iso_packet[1];
+    struct usbh_audio_stream *stream;
+};
+
+struct usbh_audio_stream {
+    struct usbh_audio *audio_class;
+    struct usb_endpoint_descriptor *ep;
+    struct usb_endpoint_descriptor *fb_ep; /* async feedback endpoint of out stream */
+    struct usbh_audio_urb urb[CONFIG_USBHOST_AUDIO_URB_NUM];
+    struct usbh_audio_fb_urb fb_urb;
+    chry_ringbuffer_t rb;
+    uint32_t nominal;  /* samples per packet, 16.16 */
+    uint32_t rate;     /* samples per packet from feedback, 16.16 */
+    uint32_t accum;    /* fraction of samples carried to next packet, 16.16 */
+    uint32_t latency;  /* bytes buffered before out stream leaves silence */
+    uint32_t samp_freq;
+    uint16_t mps;
+    uint16_t frame_bytes; /* bytes of one sample on all channels */
+    uint8_t packets;      /* iso packets per urb */
+    uint8_t dir;
+    bool running;
+    bool prefilled;
+    struct usbh_audio_stream_stat stat;
+};
+
 struct usbh_audio {
     struct usbh_hubport *hport;
     struct usb_endpoint_descriptor *isoin;  /* ISO IN endpoint */
@@ -49,6 +105,7 @@ struct usbh_audio {
     uint8_t bInCollection;
     uint8_t stream_intf_num;
     struct usbh_audio_as_msg as_msg_table[CONFIG_USBHOST_AUDIO_MAX_STREAMS];
+    struct usbh_audio_stream stream[2]; /* indexed by USBH_AUDIO_STREAM_OUT/USBH_AUDIO_STREAM_IN */
 
     void *user_data;
 };
@@ -62,6 +119,15 @@ int usbh_audio_close(struct usbh_audio *audio_class, const char *name);
 int usbh_audio_set_volume(struct usbh_audio *audio_class, const char *name, uint8_t ch, int volume_db);
 int usbh_audio_set_mute(struct usbh_audio *audio_class, const char *name, uint8_t ch, bool mute);
 
+/* streaming engine, call after usbh_audio_open. rb_buf is the ring buffer between application and urbs,
+ * its size must be power of 2. Out stream sends silence until latency_ms of data is buffered.
+ */
+int usbh_audio_stream_start(struct usbh_audio *audio_class, const char *name, uint8_t *rb_buf, uint32_t rb_size, uint32_t latency_ms);
+int usbh_audio_stream_stop(struct usbh_audio *audio_class, const char *name);
+uint32_t usbh_audio_stream_write(struct usbh_audio *audio_class, const uint8_t *buf, uint32_t len);
+uint32_t usbh_audio_stream_read(struct usbh_audio *audio_class, uint8_t *buf, uint32_t len);
+void usbh_audio_stream_get_stat(struct usbh_audio *audio_class, uint8_t dir, struct usbh_audio_stream_stat *stat);
+
 void usbh_audio_run(struct usbh_audio *audio_class);
 void usbh_audio_stop(struct usbh_audio *audio_class);
 
@@ -71,6 +71,7 @@
 
 /* Data interface class protocol codes */
 /* (usbcdc11.pdf, 4.7, Table 19) */
+#define CDC_DATA_PROTOCOL_NTB                 0x01 /* usbncm10.pdf, 4.3, Table 4-3 */
 #define CDC_DATA_PROTOCOL_ISDN_BRI            0x30
 #define CDC_DATA_PROTOCOL_HDLC                0x31
 #define CDC_DATA_PROTOCOL_TRANSPARENT         0x32
@@ -278,6 +279,28 @@
 #define CDC_NCM_NTH16_SIGNATURE             0x484D434E
 #define CDC_NCM_NDP16_SIGNATURE_NCM0        0x304D434E
 #define CDC_NCM_NDP16_SIGNATURE_NCM1        0x314D434E
+#define CDC_NCM_NTH32_SIGNATURE             0x686D636E
+#define CDC_NCM_NDP32_SIGNATURE_NCM0        0x306D636E
+#define CDC_NCM_NDP32_SIGNATURE_NCM1        0x316D636E
+
+/* bmNtbFormatsSupported */
+#define CDC_NCM_NTB16_SUPPORTED (1 << 0)
+#define CDC_NCM_NTB32_SUPPORTED (1 << 1)
+
+/* GET_NTB_FORMAT and SET_NTB_FORMAT */
+#define CDC_NCM_NTB16_FORMAT 0x00
+#define CDC_NCM_NTB32_FORMAT 0x01
+
+/* NCM functional descriptor bmNetworkCapabilities */
+#define CDC_NCM_NCAP_ETH_FILTER      (1 << 0)
+#define CDC_NCM_NCAP_NET_ADDRESS     (1 << 1)
+#define CDC_NCM_NCAP_ENCAP_COMMAND   (1 << 2)
+#define CDC_NCM_NCAP_MAX_DATAGRAM    (1 << 3)
+#define CDC_NCM_NCAP_CRC_MODE        (1 << 4)
+#define CDC_NCM_NCAP_NTB_INPUT_SIZE  (1 << 5)
+
+/* Minimum dwNtbInMaxSize and dwNtbOutMaxSize, usbncm10.pdf 6.2.1 */
+#define CDC_NCM_NTB_MIN_SIZE 2048
 
 /*------------------------------------------------------------------------------
  *      Structures  based on usbcdc11.pdf (www.usb.org)
@@ -410,6 +433,28 @@ struct cdc_ncm_ndp16 {
     struct cdc_ncm_ndp16_datagram datagram[];
 };
 
+struct cdc_ncm_nth32 {
+    uint32_t dwSignature;
+    uint16_t wHeaderLength;
+    uint16_t wSequence;
+    uint32_t dwBlockLength;
+    uint32_t dwNdpIndex;
+};
+
+struct cdc_ncm_ndp32_datagram {
+    uint32_t dwDatagramIndex;
+    uint32_t dwDatagramLength;
+};
+
+struct cdc_ncm_ndp32 {
+    uint32_t dwSignature;
+    uint16_t wLength;
+    uint16_t wReserved6;
+    uint32_t dwNextNdpIndex;
+    uint32_t dwReserved12;
+    struct cdc_ncm_ndp32_datagram datagram[];
+};
+
 /*Length of template descriptor: 66 bytes*/
 #define CDC_ACM_DESCRIPTOR_LEN (8 + 9 + 5 + 5 + 4 + 5 + 7 + 9 + 7 + 7)
 // clang-format off
@@ -620,8 +665,8 @@ eth_statistics, wMaxSegmentSize, wNumberMCFilters, bNumberPowerFilters, str_idx)
     0x00                                                   /* bInterval */
 // clang-format on
 
-/*Length of template descriptor: 77 bytes*/
-#define CDC_NCM_DESCRIPTOR_LEN   (8 + 9 + 5 + 5 + 13 + 6 + 7 + 9 + 7 + 7)
+/*Length of template descriptor: 85 bytes*/
+#define CDC_NCM_DESCRIPTOR_LEN   (8 + 9 + 5 + 5 + 13 + 6 + 7 + 9 + 9 + 7 + 7)
 // clang-format off
 #define CDC_NCM_DESCRIPTOR_INIT(bFirstInterface, int_ep, out_ep, in_ep, wMaxPacketSize, \
 eth_statistics, wMaxSegmentSize, wNumberMCFilters, bNumberPowerFilters, str_idx) \
@@ -658,28 +703,38 @@ eth_statistics, wMaxSegmentSize, wNumberMCFilters, bNumberPowerFilters, str_idx)
     CDC_FUNC_DESC_ETHERNET_NETWORKING, /* Ethernet Networking functional descriptor subtype  */\
     str_idx,                                                    /* Device's MAC string index */\
     DBVAL_BE(eth_statistics),                                /* Ethernet statistics (bitmap) */\
-    WBVAL(wMaxPacketSize),/* wMaxSegmentSize: Ethernet Maximum Segment size, typically 1514 bytes */\
+    WBVAL(wMaxSegmentSize),/* wMaxSegmentSize: Ethernet Maximum Segment size, typically 1514 bytes */\
     WBVAL(wNumberMCFilters),            /* wNumberMCFilters: the number of multicast filters */\
     bNumberPowerFilters,          /* bNumberPowerFilters: the number of wakeup power filters */\
-    0x06,                                                                                      \
-    CDC_CS_INTERFACE,                                                                          \
-    CDC_FUNC_DESC_NCM,                                                                         \
-    0x00, 0x01,                                                                                \
-    0x23,                                                                                      \
+    0x06,                                                  /* bFunctionLength */               \
+    CDC_CS_INTERFACE,                                      /* bDescriptorType */               \
+    CDC_FUNC_DESC_NCM,                                     /* bDescriptorSubtype */            \
+    WBVAL(0x0100),                                         /* bcdNcmVersion */                 \
+    (CDC_NCM_NCAP_ETH_FILTER | CDC_NCM_NCAP_NTB_INPUT_SIZE), /* bmNetworkCapabilities */       \
     0x07,                                                  /* bLength */                       \
     USB_DESCRIPTOR_TYPE_ENDPOINT,                          /* bDescriptorType */               \
     int_ep,                                                /* bEndpointAddress */              \
     0x03,                                                  /* bmAttributes */                  \
     0x10, 0x00,                                            /* wMaxPacketSize */                \
     0x10,                                                  /* bInterval */                     \
+    /* Data interface altsetting 1 carries the bulk endpoints, altsetting 0 has none */       \
     0x09,                                                  /* bLength */                       \
     USB_DESCRIPTOR_TYPE_INTERFACE,                         /* bDescriptorType */               \
     (uint8_t)(bFirstInterface + 1),                        /* bInterfaceNumber */              \
     0x00,                                                  /* bAlternateSetting */             \
+    0x00,                                                  /* bNumEndpoints */                 \
+    CDC_DATA_INTERFACE_CLASS,                              /* bInterfaceClass */               \
+    0x00,                                                  /* bInterfaceSubClass */            \
+    CDC_DATA_PROTOCOL_NTB,                                 /* bInterfaceProtocol */            \
+    0x00,                                                  /* iInterface */                    \
+    0x09,                                                  /* bLength */                       \
+    USB_DESCRIPTOR_TYPE_INTERFACE,                         /* bDescriptorType */               \
+    (uint8_t)(bFirstInterface + 1),                        /* bInterfaceNumber */              \
+    0x01,                                                  /* bAlternateSetting */             \
     0x02,                                                  /* bNumEndpoints */                 \
     CDC_DATA_INTERFACE_CLASS,                              /* bInterfaceClass */               \
     0x00,                                                  /* bInterfaceSubClass */            \
-    0x00,                                                  /* bInterfaceProtocol */            \
+    CDC_DATA_PROTOCOL_NTB,                                 /* bInterfaceProtocol */            \
     0x00,                                                  /* iInterface */                    \
     0x07,                                                  /* bLength */                       \
     USB_DESCRIPTOR_TYPE_ENDPOINT,                          /* bDescriptorType */               \
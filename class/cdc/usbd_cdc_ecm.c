@@ -13,27 +13,109 @@
 /* Ethernet Maximum Segment size, typically 1514 bytes */
 #define CONFIG_CDC_ECM_ETH_MAX_SEGSZE 1536U
 
-/* Describe EndPoints configuration */
-static struct usbd_endpoint cdc_ecm_ep_data[3];
+/* cdc ecm functions over all device buses */
+#ifndef CONFIG_USBDEV_MAX_CDC_ECM_CLASS
+#define CONFIG_USBDEV_MAX_CDC_ECM_CLASS 1
+#endif
 
-#ifdef CONFIG_USBDEV_CDC_ECM_USING_LWIP
-static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_cdc_ecm_rx_buffer[USB_ALIGN_UP(CONFIG_CDC_ECM_ETH_MAX_SEGSZE, CONFIG_USB_ALIGN_SIZE)];
-static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_cdc_ecm_tx_buffer[USB_ALIGN_UP(CONFIG_CDC_ECM_ETH_MAX_SEGSZE, CONFIG_USB_ALIGN_SIZE)];
+#if defined(CONFIG_USBDEV_CDC_ECM_ZERO_COPY) && !defined(CONFIG_USBDEV_CDC_ECM_USING_LWIP)
+#error "CONFIG_USBDEV_CDC_ECM_ZERO_COPY needs CONFIG_USBDEV_CDC_ECM_USING_LWIP"
+#endif
+
+#ifdef CONFIG_USBDEV_CDC_ECM_ZERO_COPY
+#if !LWIP_SUPPORT_CUSTOM_PBUF
+#error "cdc ecm zero copy needs LWIP_SUPPORT_CUSTOM_PBUF"
+#endif
+
+/* rx buffers handed to lwip as custom pbufs, at most 32 */
+#ifndef CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM
+#define CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM 4
+#endif
+
+/* tx pbufs queued for bulk in, power of 2 */
+#ifndef CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM
+#define CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM 8
+#endif
+
+#if (CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM > 32) || (CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM > 128) || \
+    (CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM & (CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM - 1))
+#error "invalid cdc ecm zero copy pool size"
 #endif
-static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_cdc_ecm_notify_buf[USB_ALIGN_UP(16, CONFIG_USB_ALIGN_SIZE)];
 
-volatile uint32_t g_cdc_ecm_rx_data_length = 0;
-volatile uint32_t g_cdc_ecm_tx_data_length = 0;
+struct cdc_ecm_rx_pbuf {
+    struct pbuf_custom pc;
+    struct usbd_cdc_ecm_priv *cdc_ecm;
+    uint32_t len;
+};
+
+struct cdc_ecm_zero_copy {
+    struct cdc_ecm_rx_pbuf rx_pbuf[CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM];
+    uint32_t rx_free;   /* bitmap of idle rx buffers */
+    int8_t rx_armed;    /* buffer owned by bulk out, -1 if none */
+    uint8_t rx_ready[CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM];
+    uint8_t rx_ready_head;
+    uint8_t rx_ready_num;
+    struct pbuf *tx_queue[CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM];
+    volatile uint8_t tx_done; /* next to free, moved under lock by rx and tx threads */
+    volatile uint8_t tx_head; /* next to send, moved by bulk in */
+    volatile uint8_t tx_tail; /* next to queue, moved by thread */
+    volatile bool tx_busy;
+};
+#endif
+
+/* Device data structure */
+USB_NOCACHE_RAM_SECTION struct usbd_cdc_ecm_priv {
+    uint8_t busid;
+    struct usbd_interface *intf; /* control interface, NULL if the instance is free */
+    struct usbd_endpoint ep_data[3];
+
+    volatile uint32_t rx_data_length;
+    volatile uint32_t tx_data_length;
+    volatile uint8_t net_status;
+    volatile uint8_t cmd_intf;
+    uint32_t speed_table[2];
+
+#if defined(CONFIG_USBDEV_CDC_ECM_ZERO_COPY)
+    struct cdc_ecm_zero_copy zc;
+    USB_MEM_ALIGNX uint8_t rx_pool[CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM][USB_ALIGN_UP(CONFIG_CDC_ECM_ETH_MAX_SEGSZE, CONFIG_USB_ALIGN_SIZE)];
+#elif defined(CONFIG_USBDEV_CDC_ECM_USING_LWIP)
+    USB_MEM_ALIGNX uint8_t rx_buffer[USB_ALIGN_UP(CONFIG_CDC_ECM_ETH_MAX_SEGSZE, CONFIG_USB_ALIGN_SIZE)];
+    USB_MEM_ALIGNX uint8_t tx_buffer[USB_ALIGN_UP(CONFIG_CDC_ECM_ETH_MAX_SEGSZE, CONFIG_USB_ALIGN_SIZE)];
+#endif
+    USB_MEM_ALIGNX uint8_t notify_buf[USB_ALIGN_UP(16, CONFIG_USB_ALIGN_SIZE)];
+} g_usbd_cdc_ecm[CONFIG_USBDEV_MAX_CDC_ECM_CLASS];
+
+/* Find the function by its control interface */
+static struct usbd_cdc_ecm_priv *cdc_ecm_get_priv(uint8_t busid, uint8_t intf)
+{
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_CDC_ECM_CLASS; i++) {
+        if (g_usbd_cdc_ecm[i].intf && (g_usbd_cdc_ecm[i].busid == busid) && (g_usbd_cdc_ecm[i].intf->intf_num == intf)) {
+            return &g_usbd_cdc_ecm[i];
+        }
+    }
+    return NULL;
+}
 
-static volatile uint8_t g_current_net_status = 0;
-static volatile uint8_t g_cmd_intf = 0;
+static struct usbd_cdc_ecm_priv *cdc_ecm_get_priv_by_ep(uint8_t busid, uint8_t ep)
+{
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_CDC_ECM_CLASS; i++) {
+        if (g_usbd_cdc_ecm[i].intf && (g_usbd_cdc_ecm[i].busid == busid)) {
+            for (uint8_t j = 0; j < 3; j++) {
+                if (g_usbd_cdc_ecm[i].ep_data[j].ep_addr == ep) {
+                    return &g_usbd_cdc_ecm[i];
+                }
+            }
+        }
+    }
+    return NULL;
+}
 
-static uint32_t g_connect_speed_table[2] = { CDC_ECM_CONNECT_SPEED_UPSTREAM,
-                                             CDC_ECM_CONNECT_SPEED_DOWNSTREAM };
+static int cdc_ecm_start_read(struct usbd_cdc_ecm_priv *cdc_ecm, uint8_t *buf, uint32_t len);
+static int cdc_ecm_set_connect(struct usbd_cdc_ecm_priv *cdc_ecm, bool connect, uint32_t speed[2]);
 
-void usbd_cdc_ecm_send_notify(uint8_t notifycode, uint8_t value, uint32_t *speed)
+static void cdc_ecm_send_notify(struct usbd_cdc_ecm_priv *cdc_ecm, uint8_t notifycode, uint8_t value, uint32_t *speed)
 {
-    struct cdc_eth_notification *notify = (struct cdc_eth_notification *)g_cdc_ecm_notify_buf;
+    struct cdc_eth_notification *notify = (struct cdc_eth_notification *)cdc_ecm->notify_buf;
     uint8_t bytes2send = 0;
 
     notify->bmRequestType = CDC_ECM_BMREQUEST_TYPE_ECM;
@@ -42,7 +124,7 @@ void usbd_cdc_ecm_send_notify(uint8_t notifycode, uint8_t value, uint32_t *speed
     switch (notifycode) {
         case CDC_ECM_NOTIFY_CODE_NETWORK_CONNECTION:
             notify->wValue = value;
-            notify->wIndex = g_cmd_intf;
+            notify->wIndex = cdc_ecm->cmd_intf;
             notify->wLength = 0U;
 
             for (uint8_t i = 0U; i < 8U; i++) {
@@ -52,7 +134,7 @@ void usbd_cdc_ecm_send_notify(uint8_t notifycode, uint8_t value, uint32_t *speed
             break;
         case CDC_ECM_NOTIFY_CODE_RESPONSE_AVAILABLE:
             notify->wValue = 0U;
-            notify->wIndex = g_cmd_intf;
+            notify->wIndex = cdc_ecm->cmd_intf;
             notify->wLength = 0U;
             for (uint8_t i = 0U; i < 8U; i++) {
                 notify->data[i] = 0U;
@@ -61,7 +143,7 @@ void usbd_cdc_ecm_send_notify(uint8_t notifycode, uint8_t value, uint32_t *speed
             break;
         case CDC_ECM_NOTIFY_CODE_CONNECTION_SPEED_CHANGE:
             notify->wValue = 0U;
-            notify->wIndex = g_cmd_intf;
+            notify->wIndex = cdc_ecm->cmd_intf;
             notify->wLength = 0x0008U;
             bytes2send = 16U;
 
@@ -72,9 +154,9 @@ void usbd_cdc_ecm_send_notify(uint8_t notifycode, uint8_t value, uint32_t *speed
             break;
     }
 
-    if (usb_device_is_configured(0)) {
+    if (usb_device_is_configured(cdc_ecm->busid)) {
         if (bytes2send) {
-            usbd_ep_start_write(0, cdc_ecm_ep_data[CDC_ECM_INT_EP_IDX].ep_addr, g_cdc_ecm_notify_buf, bytes2send);
+            usbd_ep_start_write(cdc_ecm->busid, cdc_ecm->ep_data[CDC_ECM_INT_EP_IDX].ep_addr, cdc_ecm->notify_buf, bytes2send);
         }
     }
 }
@@ -85,11 +167,16 @@ static int cdc_ecm_class_interface_request_handler(uint8_t busid, struct usb_set
                 "bRequest 0x%02x\r\n",
                 setup->bRequest);
 
-    (void)busid;
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv(busid, LO_BYTE(setup->wIndex));
+
     (void)data;
     (void)len;
 
-    g_cmd_intf = LO_BYTE(setup->wIndex);
+    if (cdc_ecm == NULL) {
+        return -1;
+    }
+
+    cdc_ecm->cmd_intf = LO_BYTE(setup->wIndex);
 
     switch (setup->bRequest) {
         case CDC_REQUEST_SET_ETHERNET_PACKET_FILTER:
@@ -100,9 +187,9 @@ static int cdc_ecm_class_interface_request_handler(uint8_t busid, struct usb_set
              * bit4 Multicast
             */
 #ifdef CONFIG_USBDEV_CDC_ECM_USING_LWIP
-            g_connect_speed_table[0] = 100000000; /* 100 Mbps */
-            g_connect_speed_table[1] = 100000000; /* 100 Mbps */
-            usbd_cdc_ecm_set_connect(true, g_connect_speed_table);
+            cdc_ecm->speed_table[0] = 100000000; /* 100 Mbps */
+            cdc_ecm->speed_table[1] = 100000000; /* 100 Mbps */
+            cdc_ecm_set_connect(cdc_ecm, true, cdc_ecm->speed_table);
 #endif
             break;
         default:
@@ -113,182 +200,493 @@ static int cdc_ecm_class_interface_request_handler(uint8_t busid, struct usb_set
     return 0;
 }
 
+#ifdef CONFIG_USBDEV_CDC_ECM_ZERO_COPY
+/* Give an idle pool buffer to bulk out, called with irq locked */
+static void cdc_ecm_rx_arm(struct usbd_cdc_ecm_priv *cdc_ecm)
+{
+    uint8_t i;
+
+    if ((cdc_ecm->zc.rx_armed >= 0) || (cdc_ecm->zc.rx_free == 0) || !usb_device_is_configured(cdc_ecm->busid)) {
+        return;
+    }
+
+    for (i = 0; i < CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM; i++) {
+        if (cdc_ecm->zc.rx_free & (1U << i)) {
+            break;
+        }
+    }
+
+    cdc_ecm->zc.rx_free &= ~(1U << i);
+    cdc_ecm->zc.rx_armed = i;
+    usbd_ep_start_read(cdc_ecm->busid, cdc_ecm->ep_data[CDC_ECM_OUT_EP_IDX].ep_addr, cdc_ecm->rx_pool[i], CONFIG_CDC_ECM_ETH_MAX_SEGSZE);
+}
+
+static void cdc_ecm_rx_pbuf_free(struct pbuf *p)
+{
+    struct cdc_ecm_rx_pbuf *rx = (struct cdc_ecm_rx_pbuf *)p;
+    struct usbd_cdc_ecm_priv *cdc_ecm = rx->cdc_ecm;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    cdc_ecm->zc.rx_free |= (1U << (rx - cdc_ecm->zc.rx_pbuf));
+    /* bulk out ran out of buffers, feed it again */
+    cdc_ecm_rx_arm(cdc_ecm);
+    usb_osal_leave_critical_section(flags);
+}
+
+static void cdc_ecm_zc_reset(struct usbd_cdc_ecm_priv *cdc_ecm)
+{
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    /* pbufs still held by lwip come back through cdc_ecm_rx_pbuf_free() */
+    if (cdc_ecm->zc.rx_armed >= 0) {
+        cdc_ecm->zc.rx_free |= (1U << cdc_ecm->zc.rx_armed);
+        cdc_ecm->zc.rx_armed = -1;
+    }
+    while (cdc_ecm->zc.rx_ready_num) {
+        cdc_ecm->zc.rx_free |= (1U << cdc_ecm->zc.rx_ready[cdc_ecm->zc.rx_ready_head]);
+        cdc_ecm->zc.rx_ready_head = (cdc_ecm->zc.rx_ready_head + 1) % CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM;
+        cdc_ecm->zc.rx_ready_num--;
+    }
+    /* queued pbufs are freed by the next usbd_cdc_ecm_eth_tx() */
+    cdc_ecm->zc.tx_head = cdc_ecm->zc.tx_tail;
+    cdc_ecm->zc.tx_busy = false;
+    usb_osal_leave_critical_section(flags);
+}
+
+/* Send the oldest queued pbuf, called with irq locked and in ep idle */
+static void cdc_ecm_tx_kick(struct usbd_cdc_ecm_priv *cdc_ecm)
+{
+    struct pbuf *p = cdc_ecm->zc.tx_queue[cdc_ecm->zc.tx_head % CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM];
+
+    cdc_ecm->zc.tx_busy = true;
+    cdc_ecm->tx_data_length = p->len;
+
+    USB_LOG_DBG("txlen:%d\r\n", p->len);
+    usbd_ep_start_write(cdc_ecm->busid, cdc_ecm->ep_data[CDC_ECM_IN_EP_IDX].ep_addr, p->payload, p->len);
+}
+
+/* Free pbufs sent by bulk in, pbuf_free() is not safe in irq.
+ * Called from both rx and tx threads, so each slot is claimed under the lock before it is freed.
+ */
+static void cdc_ecm_tx_reclaim(struct usbd_cdc_ecm_priv *cdc_ecm)
+{
+    struct pbuf *p;
+    size_t flags;
+
+    while (1) {
+        flags = usb_osal_enter_critical_section();
+        if (cdc_ecm->zc.tx_done == cdc_ecm->zc.tx_head) {
+            usb_osal_leave_critical_section(flags);
+            break;
+        }
+        p = cdc_ecm->zc.tx_queue[cdc_ecm->zc.tx_done % CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM];
+        cdc_ecm->zc.tx_done++;
+        usb_osal_leave_critical_section(flags);
+
+        pbuf_free(p);
+    }
+}
+#endif
+
 void cdc_ecm_notify_handler(uint8_t busid, uint8_t event, void *arg)
 {
-    (void)busid;
+    struct usbd_cdc_ecm_priv *cdc_ecm;
+
     (void)arg;
 
-    switch (event) {
-        case USBD_EVENT_RESET:
-            g_current_net_status = 0;
-            g_cdc_ecm_rx_data_length = 0;
-            g_cdc_ecm_tx_data_length = 0;
-            break;
-        case USBD_EVENT_CONFIGURED:
-#ifdef CONFIG_USBDEV_CDC_ECM_USING_LWIP
-            usbd_cdc_ecm_start_read(g_cdc_ecm_rx_buffer, CONFIG_CDC_ECM_ETH_MAX_SEGSZE);
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_CDC_ECM_CLASS; i++) {
+        cdc_ecm = &g_usbd_cdc_ecm[i];
+        if ((cdc_ecm->intf == NULL) || (cdc_ecm->busid != busid)) {
+            continue;
+        }
+
+        switch (event) {
+            case USBD_EVENT_RESET:
+                cdc_ecm->net_status = 0;
+                cdc_ecm->rx_data_length = 0;
+                cdc_ecm->tx_data_length = 0;
+#ifdef CONFIG_USBDEV_CDC_ECM_ZERO_COPY
+                cdc_ecm_zc_reset(cdc_ecm);
 #endif
-            break;
+                break;
+            case USBD_EVENT_CONFIGURED:
+#if defined(CONFIG_USBDEV_CDC_ECM_ZERO_COPY)
+                {
+                    size_t flags = usb_osal_enter_critical_section();
+                    cdc_ecm_rx_arm(cdc_ecm);
+                    usb_osal_leave_critical_section(flags);
+                }
+#elif defined(CONFIG_USBDEV_CDC_ECM_USING_LWIP)
+                cdc_ecm_start_read(cdc_ecm, cdc_ecm->rx_buffer, CONFIG_CDC_ECM_ETH_MAX_SEGSZE);
+#endif
+                break;
 
-        default:
-            break;
+            case USBD_EVENT_DEINIT:
+                /* usbd_deinitialize() drops interfaces and endpoints, init_intf sets them up again */
+                cdc_ecm->intf = NULL;
+                break;
+
+            default:
+                break;
+        }
     }
 }
 
 void cdc_ecm_bulk_out(uint8_t busid, uint8_t ep, uint32_t nbytes)
 {
-    (void)busid;
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv_by_ep(busid, ep);
+#ifdef CONFIG_USBDEV_CDC_ECM_ZERO_COPY
+    uint8_t index;
+    size_t flags;
+#endif
+
+    if (cdc_ecm == NULL) {
+        return;
+    }
+
+#ifdef CONFIG_USBDEV_CDC_ECM_ZERO_COPY
+    flags = usb_osal_enter_critical_section();
+    index = cdc_ecm->zc.rx_armed;
+    cdc_ecm->zc.rx_armed = -1;
+    if (nbytes) {
+        cdc_ecm->zc.rx_pbuf[index].len = nbytes;
+        cdc_ecm->zc.rx_ready[(cdc_ecm->zc.rx_ready_head + cdc_ecm->zc.rx_ready_num) % CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM] = index;
+        cdc_ecm->zc.rx_ready_num++;
+    } else {
+        cdc_ecm->zc.rx_free |= (1U << index);
+    }
+    /* receive the next frame while this one goes up the stack */
+    cdc_ecm_rx_arm(cdc_ecm);
+    usb_osal_leave_critical_section(flags);
+#endif
 
-    g_cdc_ecm_rx_data_length = nbytes;
-    usbd_cdc_ecm_data_recv_done(g_cdc_ecm_rx_data_length);
+    cdc_ecm->rx_data_length = nbytes;
+    usbd_cdc_ecm_data_recv_done(busid, cdc_ecm->intf->intf_num, cdc_ecm->rx_data_length);
 }
 
 void cdc_ecm_bulk_in(uint8_t busid, uint8_t ep, uint32_t nbytes)
 {
-    (void)busid;
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv_by_ep(busid, ep);
+    uint32_t tx_len;
+
+    if (cdc_ecm == NULL) {
+        return;
+    }
 
-    if ((nbytes % usbd_get_ep_mps(0, ep)) == 0 && nbytes) {
+    if ((nbytes % usbd_get_ep_mps(busid, ep)) == 0 && nbytes) {
         /* send zlp */
-        usbd_ep_start_write(0, ep, NULL, 0);
+        usbd_ep_start_write(busid, ep, NULL, 0);
     } else {
-        usbd_cdc_ecm_data_send_done(g_cdc_ecm_tx_data_length);
-        g_cdc_ecm_tx_data_length = 0;
+        tx_len = cdc_ecm->tx_data_length;
+        cdc_ecm->tx_data_length = 0;
+#ifdef CONFIG_USBDEV_CDC_ECM_ZERO_COPY
+        cdc_ecm->zc.tx_head++;
+        cdc_ecm->zc.tx_busy = false;
+        if (cdc_ecm->zc.tx_head != cdc_ecm->zc.tx_tail) {
+            cdc_ecm_tx_kick(cdc_ecm);
+        }
+#endif
+        usbd_cdc_ecm_data_send_done(busid, cdc_ecm->intf->intf_num, tx_len);
     }
 }
 
 void cdc_ecm_int_in(uint8_t busid, uint8_t ep, uint32_t nbytes)
 {
-    (void)busid;
-    (void)ep;
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv_by_ep(busid, ep);
+
     (void)nbytes;
 
-    if (g_current_net_status == 2) {
-        g_current_net_status = 3;
-        usbd_cdc_ecm_send_notify(CDC_ECM_NOTIFY_CODE_CONNECTION_SPEED_CHANGE, 0, g_connect_speed_table);
+    if (cdc_ecm == NULL) {
+        return;
+    }
+
+    if (cdc_ecm->net_status == 2) {
+        cdc_ecm->net_status = 3;
+        cdc_ecm_send_notify(cdc_ecm, CDC_ECM_NOTIFY_CODE_CONNECTION_SPEED_CHANGE, 0, cdc_ecm->speed_table);
     } else {
-        g_current_net_status = 0;
+        cdc_ecm->net_status = 0;
     }
 }
 
-int usbd_cdc_ecm_start_write(uint8_t *buf, uint32_t len)
+static int cdc_ecm_start_write(struct usbd_cdc_ecm_priv *cdc_ecm, uint8_t *buf, uint32_t len)
 {
-    if (!usb_device_is_configured(0)) {
+    if (!usb_device_is_configured(cdc_ecm->busid)) {
         return -USB_ERR_NOTCONN;
     }
 
-    if (g_cdc_ecm_tx_data_length > 0) {
+    if (cdc_ecm->tx_data_length > 0) {
         return -USB_ERR_BUSY;
     }
 
-    g_cdc_ecm_tx_data_length = len;
+    cdc_ecm->tx_data_length = len;
 
-    USB_LOG_DBG("txlen:%d\r\n", g_cdc_ecm_tx_data_length);
-    return usbd_ep_start_write(0, cdc_ecm_ep_data[CDC_ECM_IN_EP_IDX].ep_addr, buf, len);
+    USB_LOG_DBG("txlen:%d\r\n", cdc_ecm->tx_data_length);
+    return usbd_ep_start_write(cdc_ecm->busid, cdc_ecm->ep_data[CDC_ECM_IN_EP_IDX].ep_addr, buf, len);
 }
 
-int usbd_cdc_ecm_start_read(uint8_t *buf, uint32_t len)
+static int cdc_ecm_start_read(struct usbd_cdc_ecm_priv *cdc_ecm, uint8_t *buf, uint32_t len)
 {
-    if (!usb_device_is_configured(0)) {
+    if (!usb_device_is_configured(cdc_ecm->busid)) {
         return -USB_ERR_NOTCONN;
     }
 
-    g_cdc_ecm_rx_data_length = 0;
-    return usbd_ep_start_read(0, cdc_ecm_ep_data[CDC_ECM_OUT_EP_IDX].ep_addr, buf, len);
+    cdc_ecm->rx_data_length = 0;
+    return usbd_ep_start_read(cdc_ecm->busid, cdc_ecm->ep_data[CDC_ECM_OUT_EP_IDX].ep_addr, buf, len);
 }
 
-#ifdef CONFIG_USBDEV_CDC_ECM_USING_LWIP
-struct pbuf *usbd_cdc_ecm_eth_rx(void)
+int usbd_cdc_ecm_start_write(uint8_t busid, uint8_t intf, uint8_t *buf, uint32_t len)
+{
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv(busid, intf);
+
+    if (cdc_ecm == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    return cdc_ecm_start_write(cdc_ecm, buf, len);
+}
+
+int usbd_cdc_ecm_start_read(uint8_t busid, uint8_t intf, uint8_t *buf, uint32_t len)
+{
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv(busid, intf);
+
+    if (cdc_ecm == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    return cdc_ecm_start_read(cdc_ecm, buf, len);
+}
+
+#if defined(CONFIG_USBDEV_CDC_ECM_ZERO_COPY)
+struct pbuf *usbd_cdc_ecm_eth_rx(uint8_t busid, uint8_t intf)
+{
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv(busid, intf);
+    struct cdc_ecm_rx_pbuf *rx;
+    uint8_t index;
+    size_t flags;
+
+    if (cdc_ecm == NULL) {
+        return NULL;
+    }
+
+    cdc_ecm_tx_reclaim(cdc_ecm);
+
+    flags = usb_osal_enter_critical_section();
+    if (cdc_ecm->zc.rx_ready_num == 0) {
+        usb_osal_leave_critical_section(flags);
+        return NULL;
+    }
+    index = cdc_ecm->zc.rx_ready[cdc_ecm->zc.rx_ready_head];
+    cdc_ecm->zc.rx_ready_head = (cdc_ecm->zc.rx_ready_head + 1) % CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM;
+    cdc_ecm->zc.rx_ready_num--;
+    usb_osal_leave_critical_section(flags);
+
+    rx = &cdc_ecm->zc.rx_pbuf[index];
+    rx->pc.custom_free_function = cdc_ecm_rx_pbuf_free;
+
+    USB_LOG_DBG("rxlen:%d\r\n", rx->len);
+    return pbuf_alloced_custom(PBUF_RAW, rx->len, PBUF_REF, &rx->pc, cdc_ecm->rx_pool[index], sizeof(cdc_ecm->rx_pool[index]));
+}
+
+int usbd_cdc_ecm_eth_tx(uint8_t busid, uint8_t intf, struct pbuf *p)
 {
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv(busid, intf);
+    struct pbuf *q;
+    uintptr_t pad;
+    size_t flags;
+
+    if (cdc_ecm == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    if (!usb_device_is_configured(cdc_ecm->busid)) {
+        return -USB_ERR_NOTCONN;
+    }
+
+    cdc_ecm_tx_reclaim(cdc_ecm);
+
+    if (p->tot_len > CONFIG_CDC_ECM_ETH_MAX_SEGSZE) {
+        return -USB_ERR_RANGE;
+    }
+
+    if ((uint8_t)(cdc_ecm->zc.tx_tail - cdc_ecm->zc.tx_done) >= CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM) {
+        return -USB_ERR_BUSY;
+    }
+
+    if ((p->next == NULL) && (((uintptr_t)p->payload & (CONFIG_USB_ALIGN_SIZE - 1)) == 0)) {
+        /* dma straight from lwip's pbuf */
+        pbuf_ref(p);
+        q = p;
+    } else {
+        /* chained or unaligned, copy into one aligned pbuf */
+        q = pbuf_alloc(PBUF_RAW, p->tot_len + CONFIG_USB_ALIGN_SIZE, PBUF_RAM);
+        if (q == NULL) {
+            return -USB_ERR_NOMEM;
+        }
+        pad = USB_ALIGN_UP((uintptr_t)q->payload, CONFIG_USB_ALIGN_SIZE) - (uintptr_t)q->payload;
+        pbuf_remove_header(q, pad);
+        pbuf_realloc(q, p->tot_len);
+        pbuf_copy(q, p);
+    }
+
+    flags = usb_osal_enter_critical_section();
+    cdc_ecm->zc.tx_queue[cdc_ecm->zc.tx_tail % CONFIG_USBDEV_CDC_ECM_TX_QUEUE_NUM] = q;
+    cdc_ecm->zc.tx_tail++;
+    if (!cdc_ecm->zc.tx_busy) {
+        cdc_ecm_tx_kick(cdc_ecm);
+    }
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+#elif defined(CONFIG_USBDEV_CDC_ECM_USING_LWIP)
+struct pbuf *usbd_cdc_ecm_eth_rx(uint8_t busid, uint8_t intf)
+{
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv(busid, intf);
     struct pbuf *p;
 
-    if (g_cdc_ecm_rx_data_length == 0) {
+    if ((cdc_ecm == NULL) || (cdc_ecm->rx_data_length == 0)) {
         return NULL;
     }
-    p = pbuf_alloc(PBUF_RAW, g_cdc_ecm_rx_data_length, PBUF_POOL);
+    p = pbuf_alloc(PBUF_RAW, cdc_ecm->rx_data_length, PBUF_POOL);
     if (p == NULL) {
-        usbd_cdc_ecm_start_read(g_cdc_ecm_rx_buffer, CONFIG_CDC_ECM_ETH_MAX_SEGSZE);
+        cdc_ecm_start_read(cdc_ecm, cdc_ecm->rx_buffer, CONFIG_CDC_ECM_ETH_MAX_SEGSZE);
         return NULL;
     }
-    usb_memcpy(p->payload, (uint8_t *)g_cdc_ecm_rx_buffer, g_cdc_ecm_rx_data_length);
-    p->len = g_cdc_ecm_rx_data_length;
+    usb_memcpy(p->payload, (uint8_t *)cdc_ecm->rx_buffer, cdc_ecm->rx_data_length);
+    p->len = cdc_ecm->rx_data_length;
 
-    USB_LOG_DBG("rxlen:%d\r\n", g_cdc_ecm_rx_data_length);
-    usbd_cdc_ecm_start_read(g_cdc_ecm_rx_buffer, CONFIG_CDC_ECM_ETH_MAX_SEGSZE);
+    USB_LOG_DBG("rxlen:%d\r\n", cdc_ecm->rx_data_length);
+    cdc_ecm_start_read(cdc_ecm, cdc_ecm->rx_buffer, CONFIG_CDC_ECM_ETH_MAX_SEGSZE);
     return p;
 }
 
-int usbd_cdc_ecm_eth_tx(struct pbuf *p)
+int usbd_cdc_ecm_eth_tx(uint8_t busid, uint8_t intf, struct pbuf *p)
 {
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv(busid, intf);
     struct pbuf *q;
     uint8_t *buffer;
 
-    if (!usb_device_is_configured(0)) {
+    if (cdc_ecm == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    if (!usb_device_is_configured(cdc_ecm->busid)) {
         return -USB_ERR_NOTCONN;
     }
 
-    if (g_cdc_ecm_tx_data_length > 0) {
+    if (cdc_ecm->tx_data_length > 0) {
         return -USB_ERR_BUSY;
     }
 
-    if (p->tot_len > sizeof(g_cdc_ecm_tx_buffer)) {
-        p->tot_len = sizeof(g_cdc_ecm_tx_buffer);
+    if (p->tot_len > sizeof(cdc_ecm->tx_buffer)) {
+        p->tot_len = sizeof(cdc_ecm->tx_buffer);
     }
 
-    buffer = g_cdc_ecm_tx_buffer;
+    buffer = cdc_ecm->tx_buffer;
     for (q = p; q != NULL; q = q->next) {
         usb_memcpy(buffer, q->payload, q->len);
         buffer += q->len;
     }
 
-    return usbd_cdc_ecm_start_write(g_cdc_ecm_tx_buffer, p->tot_len);
+    return cdc_ecm_start_write(cdc_ecm, cdc_ecm->tx_buffer, p->tot_len);
 }
 #endif
 
-struct usbd_interface *usbd_cdc_ecm_init_intf(struct usbd_interface *intf, const uint8_t int_ep, const uint8_t out_ep, const uint8_t in_ep)
+struct usbd_interface *usbd_cdc_ecm_init_intf(uint8_t busid, struct usbd_interface *intf, const uint8_t int_ep, const uint8_t out_ep, const uint8_t in_ep)
 {
+    struct usbd_cdc_ecm_priv *cdc_ecm;
+
     intf->class_interface_handler = cdc_ecm_class_interface_request_handler;
     intf->class_endpoint_handler = NULL;
     intf->vendor_handler = NULL;
     intf->notify_handler = cdc_ecm_notify_handler;
 
-    cdc_ecm_ep_data[CDC_ECM_OUT_EP_IDX].ep_addr = out_ep;
-    cdc_ecm_ep_data[CDC_ECM_OUT_EP_IDX].ep_cb = cdc_ecm_bulk_out;
-    cdc_ecm_ep_data[CDC_ECM_IN_EP_IDX].ep_addr = in_ep;
-    cdc_ecm_ep_data[CDC_ECM_IN_EP_IDX].ep_cb = cdc_ecm_bulk_in;
-    cdc_ecm_ep_data[CDC_ECM_INT_EP_IDX].ep_addr = int_ep;
-    cdc_ecm_ep_data[CDC_ECM_INT_EP_IDX].ep_cb = cdc_ecm_int_in;
+    /* the data interface comes with the endpoints of its control interface */
+    if (cdc_ecm_get_priv_by_ep(busid, in_ep)) {
+        return intf;
+    }
+
+    cdc_ecm = NULL;
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_CDC_ECM_CLASS; i++) {
+        if (g_usbd_cdc_ecm[i].intf == NULL) {
+            cdc_ecm = &g_usbd_cdc_ecm[i];
+            break;
+        }
+    }
 
-    usbd_add_endpoint(0, &cdc_ecm_ep_data[CDC_ECM_OUT_EP_IDX]);
-    usbd_add_endpoint(0, &cdc_ecm_ep_data[CDC_ECM_IN_EP_IDX]);
-    usbd_add_endpoint(0, &cdc_ecm_ep_data[CDC_ECM_INT_EP_IDX]);
+    if (cdc_ecm == NULL) {
+        USB_LOG_ERR("No more cdc ecm instance, raise CONFIG_USBDEV_MAX_CDC_ECM_CLASS\r\n");
+        return NULL;
+    }
+
+    memset(cdc_ecm, 0, sizeof(struct usbd_cdc_ecm_priv));
+    cdc_ecm->busid = busid;
+    cdc_ecm->intf = intf;
+    cdc_ecm->speed_table[0] = CDC_ECM_CONNECT_SPEED_UPSTREAM;
+    cdc_ecm->speed_table[1] = CDC_ECM_CONNECT_SPEED_DOWNSTREAM;
+
+    cdc_ecm->ep_data[CDC_ECM_OUT_EP_IDX].ep_addr = out_ep;
+    cdc_ecm->ep_data[CDC_ECM_OUT_EP_IDX].ep_cb = cdc_ecm_bulk_out;
+    cdc_ecm->ep_data[CDC_ECM_IN_EP_IDX].ep_addr = in_ep;
+    cdc_ecm->ep_data[CDC_ECM_IN_EP_IDX].ep_cb = cdc_ecm_bulk_in;
+    cdc_ecm->ep_data[CDC_ECM_INT_EP_IDX].ep_addr = int_ep;
+    cdc_ecm->ep_data[CDC_ECM_INT_EP_IDX].ep_cb = cdc_ecm_int_in;
+
+    usbd_add_endpoint(busid, &cdc_ecm->ep_data[CDC_ECM_OUT_EP_IDX]);
+    usbd_add_endpoint(busid, &cdc_ecm->ep_data[CDC_ECM_IN_EP_IDX]);
+    usbd_add_endpoint(busid, &cdc_ecm->ep_data[CDC_ECM_INT_EP_IDX]);
+
+#ifdef CONFIG_USBDEV_CDC_ECM_ZERO_COPY
+    for (uint8_t i = 0; i < CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM; i++) {
+        cdc_ecm->zc.rx_pbuf[i].cdc_ecm = cdc_ecm;
+    }
+    cdc_ecm->zc.rx_free = 0xffffffffU >> (32 - CONFIG_USBDEV_CDC_ECM_RX_POOL_NUM);
+    cdc_ecm->zc.rx_armed = -1;
+#endif
 
     return intf;
 }
 
-int usbd_cdc_ecm_set_connect(bool connect, uint32_t speed[2])
+static int cdc_ecm_set_connect(struct usbd_cdc_ecm_priv *cdc_ecm, bool connect, uint32_t speed[2])
 {
-    if (!usb_device_is_configured(0)) {
+    if (!usb_device_is_configured(cdc_ecm->busid)) {
         return -USB_ERR_NOTCONN;
     }
 
     if (connect) {
-        g_current_net_status = 2;
-        memcpy(g_connect_speed_table, speed, 8);
-        usbd_cdc_ecm_send_notify(CDC_ECM_NOTIFY_CODE_NETWORK_CONNECTION, CDC_ECM_NET_CONNECTED, NULL);
+        cdc_ecm->net_status = 2;
+        memcpy(cdc_ecm->speed_table, speed, 8);
+        cdc_ecm_send_notify(cdc_ecm, CDC_ECM_NOTIFY_CODE_NETWORK_CONNECTION, CDC_ECM_NET_CONNECTED, NULL);
     } else {
-        g_current_net_status = 1;
-        usbd_cdc_ecm_send_notify(CDC_ECM_NOTIFY_CODE_NETWORK_CONNECTION, CDC_ECM_NET_DISCONNECTED, NULL);
+        cdc_ecm->net_status = 1;
+        cdc_ecm_send_notify(cdc_ecm, CDC_ECM_NOTIFY_CODE_NETWORK_CONNECTION, CDC_ECM_NET_DISCONNECTED, NULL);
     }
 
     return 0;
 }
 
-__WEAK void usbd_cdc_ecm_data_recv_done(uint32_t len)
+int usbd_cdc_ecm_set_connect(uint8_t busid, uint8_t intf, bool connect, uint32_t speed[2])
 {
+    struct usbd_cdc_ecm_priv *cdc_ecm = cdc_ecm_get_priv(busid, intf);
+
+    if (cdc_ecm == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    return cdc_ecm_set_connect(cdc_ecm, connect, speed);
+}
+
+__WEAK void usbd_cdc_ecm_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len)
+{
+    (void)busid;
+    (void)intf;
     (void)len;
 }
 
-__WEAK void usbd_cdc_ecm_data_send_done(uint32_t len)
+__WEAK void usbd_cdc_ecm_data_send_done(uint8_t busid, uint8_t intf, uint32_t len)
 {
+    (void)busid;
+    (void)intf;
     (void)len;
 }
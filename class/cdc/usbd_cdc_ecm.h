@@ -12,21 +12,22 @@
 extern "C" {
 #endif
 
-/* Init cdc ecm interface driver */
-struct usbd_interface *usbd_cdc_ecm_init_intf(struct usbd_interface *intf, const uint8_t int_ep, const uint8_t out_ep, const uint8_t in_ep);
+/* Init cdc ecm interface driver, call it for both interfaces of the function */
+struct usbd_interface *usbd_cdc_ecm_init_intf(uint8_t busid, struct usbd_interface *intf, const uint8_t int_ep, const uint8_t out_ep, const uint8_t in_ep);
 
-int usbd_cdc_ecm_set_connect(bool connect, uint32_t speed[2]);
+/* Functions below pick the instance by busid and its control interface number */
+int usbd_cdc_ecm_set_connect(uint8_t busid, uint8_t intf, bool connect, uint32_t speed[2]);
 
-void usbd_cdc_ecm_data_recv_done(uint32_t len);
-void usbd_cdc_ecm_data_send_done(uint32_t len);
-int usbd_cdc_ecm_start_write(uint8_t *buf, uint32_t len);
-int usbd_cdc_ecm_start_read(uint8_t *buf, uint32_t len);
+void usbd_cdc_ecm_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len);
+void usbd_cdc_ecm_data_send_done(uint8_t busid, uint8_t intf, uint32_t len);
+int usbd_cdc_ecm_start_write(uint8_t busid, uint8_t intf, uint8_t *buf, uint32_t len);
+int usbd_cdc_ecm_start_read(uint8_t busid, uint8_t intf, uint8_t *buf, uint32_t len);
 
 #ifdef CONFIG_USBDEV_CDC_ECM_USING_LWIP
 #include "lwip/netif.h"
 #include "lwip/pbuf.h"
-struct pbuf *usbd_cdc_ecm_eth_rx(void);
-int usbd_cdc_ecm_eth_tx(struct pbuf *p);
+struct pbuf *usbd_cdc_ecm_eth_rx(uint8_t busid, uint8_t intf);
+int usbd_cdc_ecm_eth_tx(uint8_t busid, uint8_t intf, struct pbuf *p);
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,803 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usbd_core.h"
+#include "usbd_cdc_ncm.h"
+
+#define CDC_NCM_OUT_EP_IDX 0
+#define CDC_NCM_IN_EP_IDX  1
+#define CDC_NCM_INT_EP_IDX 2
+
+/* ntb the device sends, host may lower it with SET_NTB_INPUT_SIZE */
+#ifndef CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE
+#define CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE 8192
+#endif
+
+/* ntb the host may send, must be a multiple of bulk out mps */
+#ifndef CONFIG_USBDEV_CDC_NCM_NTB_OUT_MAX_SIZE
+#define CONFIG_USBDEV_CDC_NCM_NTB_OUT_MAX_SIZE 8192
+#endif
+
+/* datagrams packed into one in ntb */
+#ifndef CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_DATAGRAMS
+#define CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_DATAGRAMS 32
+#endif
+
+#if (CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE < CDC_NCM_NTB_MIN_SIZE) || (CONFIG_USBDEV_CDC_NCM_NTB_OUT_MAX_SIZE < CDC_NCM_NTB_MIN_SIZE)
+#error "cdc ncm ntb size must be at least 2048"
+#endif
+
+/* Datagram divisor and ndp alignment, same for both directions */
+#define CDC_NCM_DATAGRAM_DIVISOR 4
+#define CDC_NCM_NDP_ALIGN        4
+
+#define CDC_NCM_MAX_NDP_CHAIN 8
+
+/* cdc ncm functions over all device buses */
+#ifndef CONFIG_USBDEV_MAX_CDC_NCM_CLASS
+#define CONFIG_USBDEV_MAX_CDC_NCM_CLASS 1
+#endif
+
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+/* One in ntb, ndp is written behind the datagrams when it is sent */
+struct cdc_ncm_tx_ntb {
+    uint8_t *buffer;
+    uint32_t len;              /* nth and datagrams */
+    uint16_t datagram_num;
+    volatile uint8_t writers;  /* usbd_cdc_ncm_eth_tx() still copying into it */
+    uint32_t datagram_index[CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_DATAGRAMS];
+    uint16_t datagram_len[CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_DATAGRAMS];
+};
+#endif
+
+/* Device data structure */
+USB_NOCACHE_RAM_SECTION struct usbd_cdc_ncm_priv {
+    uint8_t busid;
+    struct usbd_interface *intf;      /* control interface, NULL if the instance is free */
+    struct usbd_interface *data_intf;
+    struct usbd_endpoint ep_data[3];
+
+    volatile uint8_t net_status;
+    volatile uint8_t cmd_intf;
+    uint32_t speed_table[2];
+
+    uint8_t ntb_format;
+    uint32_t ntb_in_max_size;
+    uint16_t ntb_in_max_datagrams;
+    volatile bool data_active; /* data interface is in altsetting 1 */
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+    struct cdc_ncm_tx_ntb tx_ntb[2];
+    uint8_t tx_fill;
+    volatile bool tx_busy;
+    uint32_t tx_len;
+    uint16_t tx_sequence;
+    volatile uint32_t rx_len;
+    uint32_t rx_block_len;
+    uint32_t rx_ndp;
+    uint16_t rx_datagram;
+    uint8_t rx_ndp_count;
+    bool rx_ntb32;
+
+    USB_MEM_ALIGNX uint8_t rx_buffer[USB_ALIGN_UP(CONFIG_USBDEV_CDC_NCM_NTB_OUT_MAX_SIZE, CONFIG_USB_ALIGN_SIZE)];
+    USB_MEM_ALIGNX uint8_t tx_buffer[2][USB_ALIGN_UP(CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE, CONFIG_USB_ALIGN_SIZE)];
+#endif
+    USB_MEM_ALIGNX uint8_t notify_buf[USB_ALIGN_UP(16, CONFIG_USB_ALIGN_SIZE)];
+} g_usbd_cdc_ncm[CONFIG_USBDEV_MAX_CDC_NCM_CLASS];
+
+/* Find the function by its control interface */
+static struct usbd_cdc_ncm_priv *cdc_ncm_get_priv(uint8_t busid, uint8_t intf)
+{
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_CDC_NCM_CLASS; i++) {
+        if (g_usbd_cdc_ncm[i].intf && (g_usbd_cdc_ncm[i].busid == busid) && (g_usbd_cdc_ncm[i].intf->intf_num == intf)) {
+            return &g_usbd_cdc_ncm[i];
+        }
+    }
+    return NULL;
+}
+
+static struct usbd_cdc_ncm_priv *cdc_ncm_get_priv_by_ep(uint8_t busid, uint8_t ep)
+{
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_CDC_NCM_CLASS; i++) {
+        if (g_usbd_cdc_ncm[i].intf && (g_usbd_cdc_ncm[i].busid == busid)) {
+            for (uint8_t j = 0; j < 3; j++) {
+                if (g_usbd_cdc_ncm[i].ep_data[j].ep_addr == ep) {
+                    return &g_usbd_cdc_ncm[i];
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static int cdc_ncm_set_connect(struct usbd_cdc_ncm_priv *cdc_ncm, bool connect, uint32_t speed[2]);
+
+static void cdc_ncm_send_notify(struct usbd_cdc_ncm_priv *cdc_ncm, uint8_t notifycode, uint8_t value, uint32_t *speed)
+{
+    struct cdc_eth_notification *notify = (struct cdc_eth_notification *)cdc_ncm->notify_buf;
+    uint8_t bytes2send = 0;
+
+    notify->bmRequestType = CDC_ECM_BMREQUEST_TYPE_ECM;
+    notify->bNotificationType = notifycode;
+
+    switch (notifycode) {
+        case CDC_ECM_NOTIFY_CODE_NETWORK_CONNECTION:
+            notify->wValue = value;
+            notify->wIndex = cdc_ncm->cmd_intf;
+            notify->wLength = 0U;
+
+            for (uint8_t i = 0U; i < 8U; i++) {
+                notify->data[i] = 0U;
+            }
+            bytes2send = 8U;
+            break;
+        case CDC_ECM_NOTIFY_CODE_CONNECTION_SPEED_CHANGE:
+            notify->wValue = 0U;
+            notify->wIndex = cdc_ncm->cmd_intf;
+            notify->wLength = 0x0008U;
+            bytes2send = 16U;
+
+            memcpy(notify->data, speed, 8);
+            break;
+
+        default:
+            break;
+    }
+
+    if (usb_device_is_configured(cdc_ncm->busid)) {
+        if (bytes2send) {
+            usbd_ep_start_write(cdc_ncm->busid, cdc_ncm->ep_data[CDC_NCM_INT_EP_IDX].ep_addr, cdc_ncm->notify_buf, bytes2send);
+        }
+    }
+}
+
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+static inline uint32_t cdc_ncm_nth_size(struct usbd_cdc_ncm_priv *cdc_ncm)
+{
+    return (cdc_ncm->ntb_format == CDC_NCM_NTB32_FORMAT) ? sizeof(struct cdc_ncm_nth32) : sizeof(struct cdc_ncm_nth16);
+}
+
+/* ndp with datagram_num entries and the zero terminator */
+static inline uint32_t cdc_ncm_ndp_size(struct usbd_cdc_ncm_priv *cdc_ncm, uint16_t datagram_num)
+{
+    if (cdc_ncm->ntb_format == CDC_NCM_NTB32_FORMAT) {
+        return sizeof(struct cdc_ncm_ndp32) + (datagram_num + 1) * sizeof(struct cdc_ncm_ndp32_datagram);
+    }
+    return sizeof(struct cdc_ncm_ndp16) + (datagram_num + 1) * sizeof(struct cdc_ncm_ndp16_datagram);
+}
+
+static void cdc_ncm_tx_ntb_reset(struct usbd_cdc_ncm_priv *cdc_ncm, struct cdc_ncm_tx_ntb *ntb)
+{
+    ntb->len = cdc_ncm_nth_size(cdc_ncm);
+    ntb->datagram_num = 0;
+}
+
+static void cdc_ncm_data_reset(struct usbd_cdc_ncm_priv *cdc_ncm)
+{
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    for (uint8_t i = 0; i < 2; i++) {
+        cdc_ncm->tx_ntb[i].buffer = cdc_ncm->tx_buffer[i];
+        cdc_ncm->tx_ntb[i].writers = 0;
+        cdc_ncm_tx_ntb_reset(cdc_ncm, &cdc_ncm->tx_ntb[i]);
+    }
+    cdc_ncm->tx_fill = 0;
+    cdc_ncm->tx_busy = false;
+    cdc_ncm->tx_len = 0;
+    cdc_ncm->tx_sequence = 0;
+    cdc_ncm->rx_len = 0;
+    usb_osal_leave_critical_section(flags);
+}
+
+/* Reserve room for a datagram in the filling ntb, return its offset or 0 if the ntb is full */
+static uint32_t cdc_ncm_tx_reserve(struct usbd_cdc_ncm_priv *cdc_ncm, struct cdc_ncm_tx_ntb *ntb, uint32_t len)
+{
+    uint32_t offset;
+    uint32_t max_size;
+    uint16_t max_datagrams;
+
+    max_datagrams = CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_DATAGRAMS;
+    if (cdc_ncm->ntb_in_max_datagrams && (cdc_ncm->ntb_in_max_datagrams < max_datagrams)) {
+        max_datagrams = cdc_ncm->ntb_in_max_datagrams;
+    }
+
+    if (ntb->datagram_num >= max_datagrams) {
+        return 0;
+    }
+
+    max_size = cdc_ncm->ntb_in_max_size;
+    if (cdc_ncm->ntb_format == CDC_NCM_NTB16_FORMAT) {
+        max_size = MIN(max_size, 0xffff);
+    }
+
+    offset = USB_ALIGN_UP(ntb->len, CDC_NCM_DATAGRAM_DIVISOR);
+    if ((USB_ALIGN_UP(offset + len, CDC_NCM_NDP_ALIGN) + cdc_ncm_ndp_size(cdc_ncm, ntb->datagram_num + 1)) > max_size) {
+        return 0;
+    }
+
+    ntb->datagram_index[ntb->datagram_num] = offset;
+    ntb->datagram_len[ntb->datagram_num] = len;
+    ntb->datagram_num++;
+    ntb->len = offset + len;
+    return offset;
+}
+
+/* Finish nth and ndp of the filling ntb and send it, called with irq locked and in ep idle */
+static void cdc_ncm_tx_flush(struct usbd_cdc_ncm_priv *cdc_ncm)
+{
+    struct cdc_ncm_tx_ntb *ntb = &cdc_ncm->tx_ntb[cdc_ncm->tx_fill];
+    uint32_t ndp_index;
+    uint32_t block_len;
+
+    ndp_index = USB_ALIGN_UP(ntb->len, CDC_NCM_NDP_ALIGN);
+    block_len = ndp_index + cdc_ncm_ndp_size(cdc_ncm, ntb->datagram_num);
+
+    if (cdc_ncm->ntb_format == CDC_NCM_NTB32_FORMAT) {
+        struct cdc_ncm_nth32 *nth32 = (struct cdc_ncm_nth32 *)ntb->buffer;
+        struct cdc_ncm_ndp32 *ndp32 = (struct cdc_ncm_ndp32 *)&ntb->buffer[ndp_index];
+
+        nth32->dwSignature = CDC_NCM_NTH32_SIGNATURE;
+        nth32->wHeaderLength = sizeof(struct cdc_ncm_nth32);
+        nth32->wSequence = cdc_ncm->tx_sequence++;
+        nth32->dwBlockLength = block_len;
+        nth32->dwNdpIndex = ndp_index;
+
+        ndp32->dwSignature = CDC_NCM_NDP32_SIGNATURE_NCM0;
+        ndp32->wLength = cdc_ncm_ndp_size(cdc_ncm, ntb->datagram_num);
+        ndp32->wReserved6 = 0;
+        ndp32->dwNextNdpIndex = 0;
+        ndp32->dwReserved12 = 0;
+        for (uint16_t i = 0; i < ntb->datagram_num; i++) {
+            ndp32->datagram[i].dwDatagramIndex = ntb->datagram_index[i];
+            ndp32->datagram[i].dwDatagramLength = ntb->datagram_len[i];
+        }
+        ndp32->datagram[ntb->datagram_num].dwDatagramIndex = 0;
+        ndp32->datagram[ntb->datagram_num].dwDatagramLength = 0;
+    } else {
+        struct cdc_ncm_nth16 *nth16 = (struct cdc_ncm_nth16 *)ntb->buffer;
+        struct cdc_ncm_ndp16 *ndp16 = (struct cdc_ncm_ndp16 *)&ntb->buffer[ndp_index];
+
+        nth16->dwSignature = CDC_NCM_NTH16_SIGNATURE;
+        nth16->wHeaderLength = sizeof(struct cdc_ncm_nth16);
+        nth16->wSequence = cdc_ncm->tx_sequence++;
+        nth16->wBlockLength = block_len;
+        nth16->wNdpIndex = ndp_index;
+
+        ndp16->dwSignature = CDC_NCM_NDP16_SIGNATURE_NCM0;
+        ndp16->wLength = cdc_ncm_ndp_size(cdc_ncm, ntb->datagram_num);
+        ndp16->wNextNdpIndex = 0;
+        for (uint16_t i = 0; i < ntb->datagram_num; i++) {
+            ndp16->datagram[i].wDatagramIndex = ntb->datagram_index[i];
+            ndp16->datagram[i].wDatagramLength = ntb->datagram_len[i];
+        }
+        ndp16->datagram[ntb->datagram_num].wDatagramIndex = 0;
+        ndp16->datagram[ntb->datagram_num].wDatagramLength = 0;
+    }
+
+    cdc_ncm->tx_busy = true;
+    cdc_ncm->tx_len = block_len;
+    cdc_ncm->tx_fill ^= 1;
+    cdc_ncm_tx_ntb_reset(cdc_ncm, &cdc_ncm->tx_ntb[cdc_ncm->tx_fill]);
+
+    USB_LOG_DBG("ntb txlen:%d, datagrams:%d\r\n", (unsigned int)block_len, ntb->datagram_num);
+    usbd_ep_start_write(cdc_ncm->busid, cdc_ncm->ep_data[CDC_NCM_IN_EP_IDX].ep_addr, ntb->buffer, block_len);
+}
+
+static int cdc_ncm_start_read(struct usbd_cdc_ncm_priv *cdc_ncm)
+{
+    if (!usb_device_is_configured(cdc_ncm->busid)) {
+        return -USB_ERR_NOTCONN;
+    }
+
+    cdc_ncm->rx_len = 0;
+    return usbd_ep_start_read(cdc_ncm->busid, cdc_ncm->ep_data[CDC_NCM_OUT_EP_IDX].ep_addr, cdc_ncm->rx_buffer, CONFIG_USBDEV_CDC_NCM_NTB_OUT_MAX_SIZE);
+}
+
+static bool cdc_ncm_rx_parse_nth(struct usbd_cdc_ncm_priv *cdc_ncm)
+{
+    uint32_t rx_len = cdc_ncm->rx_len;
+    struct cdc_ncm_nth16 *nth16 = (struct cdc_ncm_nth16 *)cdc_ncm->rx_buffer;
+    struct cdc_ncm_nth32 *nth32 = (struct cdc_ncm_nth32 *)cdc_ncm->rx_buffer;
+
+    if ((rx_len >= sizeof(struct cdc_ncm_nth16)) && (nth16->dwSignature == CDC_NCM_NTH16_SIGNATURE) &&
+        (nth16->wHeaderLength == sizeof(struct cdc_ncm_nth16))) {
+        cdc_ncm->rx_ntb32 = false;
+        /* zero block length means the ntb ends with the transfer */
+        cdc_ncm->rx_block_len = nth16->wBlockLength ? nth16->wBlockLength : rx_len;
+        cdc_ncm->rx_ndp = nth16->wNdpIndex;
+    } else if ((rx_len >= sizeof(struct cdc_ncm_nth32)) && (nth32->dwSignature == CDC_NCM_NTH32_SIGNATURE) &&
+               (nth32->wHeaderLength == sizeof(struct cdc_ncm_nth32))) {
+        cdc_ncm->rx_ntb32 = true;
+        cdc_ncm->rx_block_len = nth32->dwBlockLength;
+        cdc_ncm->rx_ndp = nth32->dwNdpIndex;
+    } else {
+        USB_LOG_ERR("invalid rx nth\r\n");
+        return false;
+    }
+
+    if (cdc_ncm->rx_block_len > rx_len) {
+        USB_LOG_ERR("invalid rx ntb length %u > %u\r\n", (unsigned int)cdc_ncm->rx_block_len, (unsigned int)rx_len);
+        return false;
+    }
+
+    cdc_ncm->rx_datagram = 0;
+    cdc_ncm->rx_ndp_count = 0;
+    return true;
+}
+
+/* Walk to the next datagram of the received ntb, false when the ntb is done */
+static bool cdc_ncm_rx_next(struct usbd_cdc_ncm_priv *cdc_ncm, uint8_t **datagram, uint32_t *datagram_len)
+{
+    uint32_t ndp = cdc_ncm->rx_ndp;
+    uint32_t block_len = cdc_ncm->rx_block_len;
+    uint32_t hdr_size = cdc_ncm->rx_ntb32 ? sizeof(struct cdc_ncm_ndp32) : sizeof(struct cdc_ncm_ndp16);
+    uint32_t entry_size = cdc_ncm->rx_ntb32 ? sizeof(struct cdc_ncm_ndp32_datagram) : sizeof(struct cdc_ncm_ndp16_datagram);
+    uint32_t ndp_len;
+    uint32_t next_ndp;
+    uint32_t entry;
+    uint32_t index;
+    uint32_t len;
+
+    while (ndp) {
+        if ((ndp % CDC_NCM_NDP_ALIGN) || ((ndp + hdr_size) > block_len) || (cdc_ncm->rx_ndp_count >= CDC_NCM_MAX_NDP_CHAIN)) {
+            USB_LOG_ERR("invalid rx ndp index 0x%x\r\n", (unsigned int)ndp);
+            return false;
+        }
+
+        if (cdc_ncm->rx_ntb32) {
+            struct cdc_ncm_ndp32 *ndp32 = (struct cdc_ncm_ndp32 *)&cdc_ncm->rx_buffer[ndp];
+
+            if ((ndp32->dwSignature != CDC_NCM_NDP32_SIGNATURE_NCM0) && (ndp32->dwSignature != CDC_NCM_NDP32_SIGNATURE_NCM1)) {
+                USB_LOG_ERR("invalid rx ndp32\r\n");
+                return false;
+            }
+            ndp_len = ndp32->wLength;
+            next_ndp = ndp32->dwNextNdpIndex;
+        } else {
+            struct cdc_ncm_ndp16 *ndp16 = (struct cdc_ncm_ndp16 *)&cdc_ncm->rx_buffer[ndp];
+
+            if ((ndp16->dwSignature != CDC_NCM_NDP16_SIGNATURE_NCM0) && (ndp16->dwSignature != CDC_NCM_NDP16_SIGNATURE_NCM1)) {
+                USB_LOG_ERR("invalid rx ndp16\r\n");
+                return false;
+            }
+            ndp_len = ndp16->wLength;
+            next_ndp = ndp16->wNextNdpIndex;
+        }
+
+        if ((ndp + ndp_len) > block_len) {
+            USB_LOG_ERR("invalid rx ndp length\r\n");
+            return false;
+        }
+
+        while (1) {
+            entry = ndp + hdr_size + cdc_ncm->rx_datagram * entry_size;
+            if ((entry + entry_size) > (ndp + ndp_len)) {
+                break;
+            }
+
+            if (cdc_ncm->rx_ntb32) {
+                struct cdc_ncm_ndp32_datagram *datagram32 = (struct cdc_ncm_ndp32_datagram *)&cdc_ncm->rx_buffer[entry];
+                index = datagram32->dwDatagramIndex;
+                len = datagram32->dwDatagramLength;
+            } else {
+                struct cdc_ncm_ndp16_datagram *datagram16 = (struct cdc_ncm_ndp16_datagram *)&cdc_ncm->rx_buffer[entry];
+                index = datagram16->wDatagramIndex;
+                len = datagram16->wDatagramLength;
+            }
+
+            if ((index == 0) || (len == 0)) {
+                break;
+            }
+
+            cdc_ncm->rx_datagram++;
+            if ((index + len) > block_len) {
+                USB_LOG_ERR("invalid rx datagram 0x%x, len %u\r\n", (unsigned int)index, (unsigned int)len);
+                continue;
+            }
+
+            *datagram = &cdc_ncm->rx_buffer[index];
+            *datagram_len = len;
+            return true;
+        }
+
+        ndp = next_ndp;
+        cdc_ncm->rx_ndp = ndp;
+        cdc_ncm->rx_datagram = 0;
+        cdc_ncm->rx_ndp_count++;
+    }
+    return false;
+}
+#endif
+
+static int cdc_ncm_class_interface_request_handler(uint8_t busid, struct usb_setup_packet *setup, uint8_t **data, uint32_t *len)
+{
+    struct cdc_ncm_ntb_parameters *param;
+    uint32_t ntb_in_max_size;
+    uint16_t ntb_in_max_datagrams;
+
+    USB_LOG_DBG("CDC NCM Class request: "
+                "bRequest 0x%02x\r\n",
+                setup->bRequest);
+
+    struct usbd_cdc_ncm_priv *cdc_ncm = cdc_ncm_get_priv(busid, LO_BYTE(setup->wIndex));
+
+    if (cdc_ncm == NULL) {
+        return -1;
+    }
+
+    cdc_ncm->cmd_intf = LO_BYTE(setup->wIndex);
+
+    switch (setup->bRequest) {
+        case CDC_REQUEST_SET_ETHERNET_PACKET_FILTER:
+            /* filtering is left to the network stack */
+            break;
+        case CDC_REQUEST_GET_NTB_PARAMETERS:
+            param = (struct cdc_ncm_ntb_parameters *)*data;
+            param->wLength = sizeof(struct cdc_ncm_ntb_parameters);
+            param->bmNtbFormatsSupported = CDC_NCM_NTB16_SUPPORTED | CDC_NCM_NTB32_SUPPORTED;
+            param->dwNtbInMaxSize = CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE;
+            param->wNdbInDivisor = CDC_NCM_DATAGRAM_DIVISOR;
+            param->wNdbInPayloadRemainder = 0;
+            param->wNdbInAlignment = CDC_NCM_NDP_ALIGN;
+            param->wReserved = 0;
+            param->dwNtbOutMaxSize = CONFIG_USBDEV_CDC_NCM_NTB_OUT_MAX_SIZE;
+            param->wNdbOutDivisor = CDC_NCM_DATAGRAM_DIVISOR;
+            param->wNdbOutPayloadRemainder = 0;
+            param->wNdbOutAlignment = CDC_NCM_NDP_ALIGN;
+            param->wNtbOutMaxDatagrams = 0; /* no limit */
+            *len = MIN(setup->wLength, sizeof(struct cdc_ncm_ntb_parameters));
+            break;
+        case CDC_REQUEST_GET_NTB_FORMAT:
+            (*data)[0] = cdc_ncm->ntb_format;
+            (*data)[1] = 0;
+            *len = 2;
+            break;
+        case CDC_REQUEST_SET_NTB_FORMAT:
+            if (setup->wValue > CDC_NCM_NTB32_FORMAT) {
+                return -1;
+            }
+            cdc_ncm->ntb_format = setup->wValue;
+            break;
+        case CDC_REQUEST_GET_NTB_INPUT_SIZE:
+            memcpy(*data, &cdc_ncm->ntb_in_max_size, 4);
+            memcpy(*data + 4, &cdc_ncm->ntb_in_max_datagrams, 2);
+            (*data)[6] = 0;
+            (*data)[7] = 0;
+            *len = (setup->wLength >= 8) ? 8 : 4;
+            break;
+        case CDC_REQUEST_SET_NTB_INPUT_SIZE:
+            if (*len < 4) {
+                return -1;
+            }
+            memcpy(&ntb_in_max_size, *data, 4);
+            if (ntb_in_max_size < CDC_NCM_NTB_MIN_SIZE) {
+                return -1;
+            }
+            ntb_in_max_datagrams = 0;
+            if (*len >= 8) {
+                memcpy(&ntb_in_max_datagrams, *data + 4, 2);
+            }
+            cdc_ncm->ntb_in_max_size = MIN(ntb_in_max_size, CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE);
+            cdc_ncm->ntb_in_max_datagrams = ntb_in_max_datagrams;
+            USB_LOG_INFO("NCM ntb in max size %u, max datagrams %u\r\n", (unsigned int)cdc_ncm->ntb_in_max_size, ntb_in_max_datagrams);
+            break;
+        default:
+            USB_LOG_WRN("Unhandled CDC NCM Class bRequest 0x%02x\r\n", setup->bRequest);
+            return -1;
+    }
+
+    return 0;
+}
+
+void cdc_ncm_notify_handler(uint8_t busid, uint8_t event, void *arg)
+{
+    struct usb_interface_descriptor *desc = (struct usb_interface_descriptor *)arg;
+    struct usbd_cdc_ncm_priv *cdc_ncm;
+
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_CDC_NCM_CLASS; i++) {
+        cdc_ncm = &g_usbd_cdc_ncm[i];
+        if ((cdc_ncm->intf == NULL) || (cdc_ncm->busid != busid)) {
+            continue;
+        }
+
+        switch (event) {
+            case USBD_EVENT_RESET:
+                cdc_ncm->net_status = 0;
+                cdc_ncm->ntb_format = CDC_NCM_NTB16_FORMAT;
+                cdc_ncm->ntb_in_max_size = CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE;
+                cdc_ncm->ntb_in_max_datagrams = 0;
+                cdc_ncm->data_active = false;
+                break;
+            case USBD_EVENT_SET_INTERFACE:
+                if ((desc == NULL) || (desc->bInterfaceClass != CDC_DATA_INTERFACE_CLASS) ||
+                    (cdc_ncm->data_intf == NULL) || (desc->bInterfaceNumber != cdc_ncm->data_intf->intf_num)) {
+                    break;
+                }
+                /* endpoints only exist in altsetting 1, selecting it again restarts the data path */
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+                cdc_ncm_data_reset(cdc_ncm);
+#endif
+                if (desc->bAlternateSetting == 1) {
+                    cdc_ncm->data_active = true;
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+                    cdc_ncm_start_read(cdc_ncm);
+#endif
+                    if (usbd_get_port_speed(busid) == USB_SPEED_HIGH) {
+                        cdc_ncm->speed_table[0] = 480000000; /* 480 Mbps */
+                        cdc_ncm->speed_table[1] = 480000000;
+                    } else {
+                        cdc_ncm->speed_table[0] = 12000000; /* 12 Mbps */
+                        cdc_ncm->speed_table[1] = 12000000;
+                    }
+                    cdc_ncm_set_connect(cdc_ncm, true, cdc_ncm->speed_table);
+                } else {
+                    cdc_ncm->data_active = false;
+                }
+                break;
+
+            case USBD_EVENT_DEINIT:
+                /* usbd_deinitialize() drops interfaces and endpoints, init_intf sets them up again */
+                cdc_ncm->intf = NULL;
+                cdc_ncm->data_intf = NULL;
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+void cdc_ncm_bulk_out(uint8_t busid, uint8_t ep, uint32_t nbytes)
+{
+    struct usbd_cdc_ncm_priv *cdc_ncm = cdc_ncm_get_priv_by_ep(busid, ep);
+
+    if (cdc_ncm == NULL) {
+        return;
+    }
+
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+    cdc_ncm->rx_ndp = 0;
+    cdc_ncm->rx_len = nbytes;
+#endif
+    usbd_cdc_ncm_data_recv_done(busid, cdc_ncm->intf->intf_num, nbytes);
+}
+
+void cdc_ncm_bulk_in(uint8_t busid, uint8_t ep, uint32_t nbytes)
+{
+    struct usbd_cdc_ncm_priv *cdc_ncm = cdc_ncm_get_priv_by_ep(busid, ep);
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+    struct cdc_ncm_tx_ntb *ntb;
+    uint32_t tx_len;
+    size_t flags;
+#endif
+
+    if (cdc_ncm == NULL) {
+        return;
+    }
+
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+
+    /* a full size ntb ends by itself, a shorter one ending on a packet boundary needs zlp */
+    if ((nbytes % usbd_get_ep_mps(busid, ep)) == 0 && nbytes && (nbytes < cdc_ncm->ntb_in_max_size)) {
+        usbd_ep_start_write(cdc_ncm->busid, ep, NULL, 0);
+        return;
+    }
+
+    flags = usb_osal_enter_critical_section();
+    tx_len = cdc_ncm->tx_len;
+    cdc_ncm->tx_len = 0;
+    cdc_ncm->tx_busy = false;
+
+    /* frames queued while the last ntb was on the bus go out together */
+    ntb = &cdc_ncm->tx_ntb[cdc_ncm->tx_fill];
+    if (ntb->datagram_num && !ntb->writers) {
+        cdc_ncm_tx_flush(cdc_ncm);
+    }
+    usb_osal_leave_critical_section(flags);
+
+    usbd_cdc_ncm_data_send_done(busid, cdc_ncm->intf->intf_num, tx_len);
+#else
+    usbd_cdc_ncm_data_send_done(busid, cdc_ncm->intf->intf_num, nbytes);
+#endif
+}
+
+void cdc_ncm_int_in(uint8_t busid, uint8_t ep, uint32_t nbytes)
+{
+    struct usbd_cdc_ncm_priv *cdc_ncm = cdc_ncm_get_priv_by_ep(busid, ep);
+
+    (void)nbytes;
+
+    if (cdc_ncm == NULL) {
+        return;
+    }
+
+    if (cdc_ncm->net_status == 2) {
+        cdc_ncm->net_status = 3;
+        cdc_ncm_send_notify(cdc_ncm, CDC_ECM_NOTIFY_CODE_CONNECTION_SPEED_CHANGE, 0, cdc_ncm->speed_table);
+    } else {
+        cdc_ncm->net_status = 0;
+    }
+}
+
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+struct pbuf *usbd_cdc_ncm_eth_rx(uint8_t busid, uint8_t intf)
+{
+    struct usbd_cdc_ncm_priv *cdc_ncm = cdc_ncm_get_priv(busid, intf);
+    struct pbuf *p;
+    uint8_t *datagram;
+    uint32_t datagram_len;
+
+    if ((cdc_ncm == NULL) || (cdc_ncm->rx_len == 0)) {
+        return NULL;
+    }
+
+    if ((cdc_ncm->rx_ndp == 0) && !cdc_ncm_rx_parse_nth(cdc_ncm)) {
+        cdc_ncm_start_read(cdc_ncm);
+        return NULL;
+    }
+
+    if (!cdc_ncm_rx_next(cdc_ncm, &datagram, &datagram_len)) {
+        /* every datagram of this ntb is passed up */
+        cdc_ncm_start_read(cdc_ncm);
+        return NULL;
+    }
+
+    p = pbuf_alloc(PBUF_RAW, datagram_len, PBUF_POOL);
+    if (p == NULL) {
+        USB_LOG_ERR("No memory to alloc pbuf for ncm datagram\r\n");
+        return NULL;
+    }
+    pbuf_take(p, datagram, datagram_len);
+
+    USB_LOG_DBG("rxlen:%d\r\n", (unsigned int)datagram_len);
+    return p;
+}
+
+int usbd_cdc_ncm_eth_tx(uint8_t busid, uint8_t intf, struct pbuf *p)
+{
+    struct usbd_cdc_ncm_priv *cdc_ncm = cdc_ncm_get_priv(busid, intf);
+    struct cdc_ncm_tx_ntb *ntb;
+    struct pbuf *q;
+    uint8_t *buffer;
+    uint32_t offset;
+    size_t flags;
+
+    if (cdc_ncm == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    if (!usb_device_is_configured(cdc_ncm->busid) || !cdc_ncm->data_active) {
+        return -USB_ERR_NOTCONN;
+    }
+
+    flags = usb_osal_enter_critical_section();
+    ntb = &cdc_ncm->tx_ntb[cdc_ncm->tx_fill];
+    offset = cdc_ncm_tx_reserve(cdc_ncm, ntb, p->tot_len);
+    if (offset == 0) {
+        if (cdc_ncm->tx_busy || ntb->writers || (ntb->datagram_num == 0)) {
+            /* both ntbs are taken, or frame never fits */
+            usb_osal_leave_critical_section(flags);
+            return (ntb->datagram_num == 0) ? -USB_ERR_RANGE : -USB_ERR_BUSY;
+        }
+        cdc_ncm_tx_flush(cdc_ncm);
+        ntb = &cdc_ncm->tx_ntb[cdc_ncm->tx_fill];
+        offset = cdc_ncm_tx_reserve(cdc_ncm, ntb, p->tot_len);
+        if (offset == 0) {
+            usb_osal_leave_critical_section(flags);
+            return -USB_ERR_RANGE;
+        }
+    }
+    ntb->writers++;
+    usb_osal_leave_critical_section(flags);
+
+    buffer = &ntb->buffer[offset];
+    for (q = p; q != NULL; q = q->next) {
+        usb_memcpy(buffer, q->payload, q->len);
+        buffer += q->len;
+    }
+
+    flags = usb_osal_enter_critical_section();
+    ntb->writers--;
+    /* in ep idle: send now, otherwise bulk in completion sends everything queued so far */
+    if (!cdc_ncm->tx_busy && !ntb->writers) {
+        cdc_ncm_tx_flush(cdc_ncm);
+    }
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+#endif
+
+struct usbd_interface *usbd_cdc_ncm_init_intf(uint8_t busid, struct usbd_interface *intf, const uint8_t int_ep, const uint8_t out_ep, const uint8_t in_ep)
+{
+    struct usbd_cdc_ncm_priv *cdc_ncm;
+
+    intf->class_interface_handler = cdc_ncm_class_interface_request_handler;
+    intf->class_endpoint_handler = NULL;
+    intf->vendor_handler = NULL;
+    intf->notify_handler = cdc_ncm_notify_handler;
+
+    /* the data interface comes with the endpoints of its control interface */
+    cdc_ncm = cdc_ncm_get_priv_by_ep(busid, in_ep);
+    if (cdc_ncm) {
+        cdc_ncm->data_intf = intf;
+        return intf;
+    }
+
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_CDC_NCM_CLASS; i++) {
+        if (g_usbd_cdc_ncm[i].intf == NULL) {
+            cdc_ncm = &g_usbd_cdc_ncm[i];
+            break;
+        }
+    }
+
+    if (cdc_ncm == NULL) {
+        USB_LOG_ERR("No more cdc ncm instance, raise CONFIG_USBDEV_MAX_CDC_NCM_CLASS\r\n");
+        return NULL;
+    }
+
+    memset(cdc_ncm, 0, sizeof(struct usbd_cdc_ncm_priv));
+    cdc_ncm->busid = busid;
+    cdc_ncm->intf = intf;
+    cdc_ncm->speed_table[0] = CDC_ECM_CONNECT_SPEED_UPSTREAM;
+    cdc_ncm->speed_table[1] = CDC_ECM_CONNECT_SPEED_DOWNSTREAM;
+    cdc_ncm->ntb_format = CDC_NCM_NTB16_FORMAT;
+    cdc_ncm->ntb_in_max_size = CONFIG_USBDEV_CDC_NCM_NTB_IN_MAX_SIZE;
+
+    cdc_ncm->ep_data[CDC_NCM_OUT_EP_IDX].ep_addr = out_ep;
+    cdc_ncm->ep_data[CDC_NCM_OUT_EP_IDX].ep_cb = cdc_ncm_bulk_out;
+    cdc_ncm->ep_data[CDC_NCM_IN_EP_IDX].ep_addr = in_ep;
+    cdc_ncm->ep_data[CDC_NCM_IN_EP_IDX].ep_cb = cdc_ncm_bulk_in;
+    cdc_ncm->ep_data[CDC_NCM_INT_EP_IDX].ep_addr = int_ep;
+    cdc_ncm->ep_data[CDC_NCM_INT_EP_IDX].ep_cb = cdc_ncm_int_in;
+
+    usbd_add_endpoint(busid, &cdc_ncm->ep_data[CDC_NCM_OUT_EP_IDX]);
+    usbd_add_endpoint(busid, &cdc_ncm->ep_data[CDC_NCM_IN_EP_IDX]);
+    usbd_add_endpoint(busid, &cdc_ncm->ep_data[CDC_NCM_INT_EP_IDX]);
+
+    return intf;
+}
+
+static int cdc_ncm_set_connect(struct usbd_cdc_ncm_priv *cdc_ncm, bool connect, uint32_t speed[2])
+{
+    if (!usb_device_is_configured(cdc_ncm->busid)) {
+        return -USB_ERR_NOTCONN;
+    }
+
+    if (connect) {
+        cdc_ncm->net_status = 2;
+        memcpy(cdc_ncm->speed_table, speed, 8);
+        cdc_ncm_send_notify(cdc_ncm, CDC_ECM_NOTIFY_CODE_NETWORK_CONNECTION, CDC_ECM_NET_CONNECTED, NULL);
+    } else {
+        cdc_ncm->net_status = 1;
+        cdc_ncm_send_notify(cdc_ncm, CDC_ECM_NOTIFY_CODE_NETWORK_CONNECTION, CDC_ECM_NET_DISCONNECTED, NULL);
+    }
+
+    return 0;
+}
+
+int usbd_cdc_ncm_set_connect(uint8_t busid, uint8_t intf, bool connect, uint32_t speed[2])
+{
+    struct usbd_cdc_ncm_priv *cdc_ncm = cdc_ncm_get_priv(busid, intf);
+
+    if (cdc_ncm == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    return cdc_ncm_set_connect(cdc_ncm, connect, speed);
+}
+
+__WEAK void usbd_cdc_ncm_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len)
+{
+    (void)busid;
+    (void)intf;
+    (void)len;
+}
+
+__WEAK void usbd_cdc_ncm_data_send_done(uint8_t busid, uint8_t intf, uint32_t len)
+{
+    (void)busid;
+    (void)intf;
+    (void)len;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef USBD_CDC_NCM_H
+#define USBD_CDC_NCM_H
+
+#include "usb_cdc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Init cdc ncm interface driver, call it for both interfaces of the function */
+struct usbd_interface *usbd_cdc_ncm_init_intf(uint8_t busid, struct usbd_interface *intf, const uint8_t int_ep, const uint8_t out_ep, const uint8_t in_ep);
+
+/* Functions below pick the instance by busid and its control interface number */
+int usbd_cdc_ncm_set_connect(uint8_t busid, uint8_t intf, bool connect, uint32_t speed[2]);
+
+void usbd_cdc_ncm_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len);
+void usbd_cdc_ncm_data_send_done(uint8_t busid, uint8_t intf, uint32_t len);
+
+#ifdef CONFIG_USBDEV_CDC_NCM_USING_LWIP
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+struct pbuf *usbd_cdc_ncm_eth_rx(uint8_t busid, uint8_t intf);
+int usbd_cdc_ncm_eth_tx(uint8_t busid, uint8_t intf, struct pbuf *p);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* USBD_CDC_NCM_H */
@@ -23,14 +23,59 @@
 
 #define CONFIG_USBHOST_CDC_NCM_ETH_MAX_SEGSZE 1514U
 
+/* datagrams packed into one tx ntb */
+#ifndef CONFIG_USBHOST_CDC_NCM_TX_MAX_DATAGRAMS
+#define CONFIG_USBHOST_CDC_NCM_TX_MAX_DATAGRAMS 16
+#endif
+
+/* ms a partly filled tx ntb waits for more frames, 0 sends it once bulk out is idle */
+#ifndef CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT
+#define CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT 0
+#endif
+
+#if CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE < CDC_NCM_NTB_MIN_SIZE
+#error "CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE must be at least 2048"
+#endif
+
+#ifdef CONFIG_USBHOST_URB_QUEUE
+static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_cdc_ncm_rx_buffer[CONFIG_USBHOST_URB_QUEUE_DEPTH][USB_ALIGN_UP(CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE, CONFIG_USB_ALIGN_SIZE)];
+static usb_osal_sem_t g_cdc_ncm_rx_sem;
+#else
 static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_cdc_ncm_rx_buffer[CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE];
-static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_cdc_ncm_tx_buffer[CONFIG_USBHOST_CDC_NCM_ETH_MAX_TX_SIZE];
+#endif
+static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_cdc_ncm_tx_buffer[2][USB_ALIGN_UP(CONFIG_USBHOST_CDC_NCM_ETH_MAX_TX_SIZE, CONFIG_USB_ALIGN_SIZE)];
 static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_cdc_ncm_inttx_buffer[USB_ALIGN_UP(16, CONFIG_USB_ALIGN_SIZE)];
 
 static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_cdc_ncm_buf[USB_ALIGN_UP(32, CONFIG_USB_ALIGN_SIZE)];
 
 static struct usbh_cdc_ncm g_cdc_ncm_class;
 
+/* One tx ntb, ndp is written behind the datagrams when it is sent */
+struct usbh_cdc_ncm_tx_ntb {
+    uint32_t len; /* nth and datagrams */
+    uint16_t datagram_num;
+    uint16_t datagram_index[CONFIG_USBHOST_CDC_NCM_TX_MAX_DATAGRAMS];
+    uint16_t datagram_len[CONFIG_USBHOST_CDC_NCM_TX_MAX_DATAGRAMS];
+};
+
+static struct usbh_cdc_ncm_tx {
+    struct usbh_cdc_ncm_tx_ntb ntb[2];
+    uint8_t fill;         /* ntb taking frames */
+    volatile bool busy;   /* the other ntb is on the bus */
+    volatile bool writing; /* frame copy between get_eth_txbuf and eth_output */
+    bool timer_armed;
+    uint32_t max_size;
+    uint16_t max_datagrams;
+    uint16_t divisor;
+    uint16_t remainder;
+    uint16_t align;
+} g_cdc_ncm_tx;
+
+static usb_osal_sem_t g_cdc_ncm_tx_sem;
+#if CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT > 0
+static struct usb_osal_timer *g_cdc_ncm_tx_timer;
+#endif
+
 static int usbh_cdc_ncm_get_ntb_parameters(struct usbh_cdc_ncm *cdc_ncm_class, struct cdc_ncm_ntb_parameters *param)
 {
     struct usb_setup_packet *setup;
@@ -56,6 +101,25 @@ static int usbh_cdc_ncm_get_ntb_parameters(struct usbh_cdc_ncm *cdc_ncm_class, s
     return 0;
 }
 
+static int usbh_cdc_ncm_set_ntb_input_size(struct usbh_cdc_ncm *cdc_ncm_class, uint32_t size)
+{
+    struct usb_setup_packet *setup;
+
+    if (!cdc_ncm_class || !cdc_ncm_class->hport) {
+        return -USB_ERR_INVAL;
+    }
+    setup = cdc_ncm_class->hport->setup;
+
+    setup->bmRequestType = USB_REQUEST_DIR_OUT | USB_REQUEST_CLASS | USB_REQUEST_RECIPIENT_INTERFACE;
+    setup->bRequest = CDC_REQUEST_SET_NTB_INPUT_SIZE;
+    setup->wValue = 0;
+    setup->wIndex = cdc_ncm_class->ctrl_intf;
+    setup->wLength = 4;
+
+    memcpy(g_cdc_ncm_buf, &size, 4);
+    return usbh_control_transfer(cdc_ncm_class->hport, setup, g_cdc_ncm_buf);
+}
+
 static void print_ntb_parameters(struct cdc_ncm_ntb_parameters *param)
 {
     USB_LOG_RAW("CDC NCM ntb parameters:\r\n");
@@ -97,10 +161,203 @@ int usbh_cdc_ncm_get_connect_status(struct usbh_cdc_ncm *cdc_ncm_class)
     return 0;
 }
 
+/* Offset of the next datagram, (offset % divisor) must equal remainder */
+static uint32_t usbh_cdc_ncm_tx_offset(uint32_t len)
+{
+    uint32_t mod = len % g_cdc_ncm_tx.divisor;
+
+    if (mod != g_cdc_ncm_tx.remainder) {
+        len += (g_cdc_ncm_tx.remainder + g_cdc_ncm_tx.divisor - mod) % g_cdc_ncm_tx.divisor;
+    }
+    return len;
+}
+
+/* ndp16 with datagram_num entries and the zero terminator */
+static inline uint32_t usbh_cdc_ncm_tx_ndp_size(uint16_t datagram_num)
+{
+    return sizeof(struct cdc_ncm_ndp16) + (datagram_num + 1) * sizeof(struct cdc_ncm_ndp16_datagram);
+}
+
+/* No room left for a full size frame */
+static bool usbh_cdc_ncm_tx_full(struct usbh_cdc_ncm_tx_ntb *ntb)
+{
+    uint32_t end;
+
+    if (ntb->datagram_num >= g_cdc_ncm_tx.max_datagrams) {
+        return true;
+    }
+
+    end = usbh_cdc_ncm_tx_offset(ntb->len) + CONFIG_USBHOST_CDC_NCM_ETH_MAX_SEGSZE;
+    end = USB_ALIGN_UP(end, g_cdc_ncm_tx.align) + usbh_cdc_ncm_tx_ndp_size(ntb->datagram_num + 1);
+    return end > g_cdc_ncm_tx.max_size;
+}
+
+static int usbh_cdc_ncm_tx_init(struct usbh_cdc_ncm *cdc_ncm_class)
+{
+    struct cdc_ncm_ntb_parameters *param = &cdc_ncm_class->ntb_param;
+
+    memset(&g_cdc_ncm_tx, 0, sizeof(struct usbh_cdc_ncm_tx));
+
+    /* never bigger than the device accepts, nth16 limits it to 64K */
+    g_cdc_ncm_tx.max_size = MIN(param->dwNtbOutMaxSize, CONFIG_USBHOST_CDC_NCM_ETH_MAX_TX_SIZE);
+    g_cdc_ncm_tx.max_size = MIN(g_cdc_ncm_tx.max_size, 0xffff);
+
+    g_cdc_ncm_tx.max_datagrams = CONFIG_USBHOST_CDC_NCM_TX_MAX_DATAGRAMS;
+    if (param->wNtbOutMaxDatagrams && (param->wNtbOutMaxDatagrams < g_cdc_ncm_tx.max_datagrams)) {
+        g_cdc_ncm_tx.max_datagrams = param->wNtbOutMaxDatagrams;
+    }
+
+    g_cdc_ncm_tx.divisor = param->wNdbOutDivisor ? param->wNdbOutDivisor : 1;
+    g_cdc_ncm_tx.remainder = param->wNdbOutPayloadRemainder % g_cdc_ncm_tx.divisor;
+
+    /* ndp16 needs 4 bytes alignment at least */
+    g_cdc_ncm_tx.align = param->wNdbOutAlignment;
+    if ((g_cdc_ncm_tx.align < 4) || (g_cdc_ncm_tx.align & (g_cdc_ncm_tx.align - 1))) {
+        g_cdc_ncm_tx.align = 4;
+    }
+
+    g_cdc_ncm_tx.ntb[0].len = sizeof(struct cdc_ncm_nth16);
+    g_cdc_ncm_tx.ntb[1].len = sizeof(struct cdc_ncm_nth16);
+
+    if (usbh_cdc_ncm_tx_full(&g_cdc_ncm_tx.ntb[0])) {
+        USB_LOG_ERR("CDC NCM tx ntb size %u has no room for a full size frame\r\n", (unsigned int)g_cdc_ncm_tx.max_size);
+        return -USB_ERR_RANGE;
+    }
+
+    USB_LOG_INFO("CDC NCM tx ntb size %u, max datagrams %u\r\n", (unsigned int)g_cdc_ncm_tx.max_size, g_cdc_ncm_tx.max_datagrams);
+    return 0;
+}
+
+static void usbh_cdc_ncm_tx_complete(void *arg, int nbytes);
+
+/* Finish nth and ndp of the filling ntb and swap ntbs, called with irq locked and bulk out idle.
+ * Returns 0 when the caller must send it with usbh_cdc_ncm_tx_submit() after unlocking.
+ */
+static int usbh_cdc_ncm_tx_flush(void)
+{
+    struct usbh_cdc_ncm_tx_ntb *ntb = &g_cdc_ncm_tx.ntb[g_cdc_ncm_tx.fill];
+    uint8_t *buffer = g_cdc_ncm_tx_buffer[g_cdc_ncm_tx.fill];
+    struct cdc_ncm_nth16 *nth16;
+    struct cdc_ncm_ndp16 *ndp16;
+    uint32_t ndp_index;
+    uint32_t block_len;
+
+    if (g_cdc_ncm_class.bulkout == NULL) {
+        /* unplugged, drop the frames */
+        ntb->len = sizeof(struct cdc_ncm_nth16);
+        ntb->datagram_num = 0;
+        return -USB_ERR_NOTCONN;
+    }
+
+    ndp_index = USB_ALIGN_UP(ntb->len, g_cdc_ncm_tx.align);
+    block_len = ndp_index + usbh_cdc_ncm_tx_ndp_size(ntb->datagram_num);
+
+    /* no zlp here, end a short ntb with a short packet instead */
+    if ((block_len < g_cdc_ncm_tx.max_size) && ((block_len % USB_GET_MAXPACKETSIZE(g_cdc_ncm_class.bulkout->wMaxPacketSize)) == 0)) {
+        buffer[block_len] = 0;
+        block_len++;
+    }
+
+    nth16 = (struct cdc_ncm_nth16 *)buffer;
+    nth16->dwSignature = CDC_NCM_NTH16_SIGNATURE;
+    nth16->wHeaderLength = sizeof(struct cdc_ncm_nth16);
+    nth16->wSequence = g_cdc_ncm_class.bulkout_sequence++;
+    nth16->wBlockLength = block_len;
+    nth16->wNdpIndex = ndp_index;
+
+    ndp16 = (struct cdc_ncm_ndp16 *)&buffer[ndp_index];
+    ndp16->dwSignature = CDC_NCM_NDP16_SIGNATURE_NCM0;
+    ndp16->wLength = usbh_cdc_ncm_tx_ndp_size(ntb->datagram_num);
+    ndp16->wNextNdpIndex = 0;
+    for (uint16_t i = 0; i < ntb->datagram_num; i++) {
+        ndp16->datagram[i].wDatagramIndex = ntb->datagram_index[i];
+        ndp16->datagram[i].wDatagramLength = ntb->datagram_len[i];
+    }
+    ndp16->datagram[ntb->datagram_num].wDatagramIndex = 0;
+    ndp16->datagram[ntb->datagram_num].wDatagramLength = 0;
+
+    USB_LOG_DBG("txlen:%d, datagrams:%d\r\n", (unsigned int)block_len, ntb->datagram_num);
+
+    g_cdc_ncm_tx.busy = true;
+    g_cdc_ncm_tx.fill ^= 1;
+    ntb->len = sizeof(struct cdc_ncm_nth16);
+    ntb->datagram_num = 0;
+
+    usbh_bulk_urb_fill(&g_cdc_ncm_class.bulkout_urb, g_cdc_ncm_class.hport, g_cdc_ncm_class.bulkout, buffer, block_len, 0, usbh_cdc_ncm_tx_complete, NULL);
+    return 0;
+}
+
+/* Send the ntb finished by usbh_cdc_ncm_tx_flush(), busy keeps the urb ours until it completes */
+static int usbh_cdc_ncm_tx_submit(void)
+{
+    size_t flags;
+    int ret;
+
+    ret = usbh_submit_urb(&g_cdc_ncm_class.bulkout_urb);
+    if (ret < 0) {
+        /* frames in this ntb are dropped */
+        flags = usb_osal_enter_critical_section();
+        g_cdc_ncm_tx.busy = false;
+        usb_osal_leave_critical_section(flags);
+
+        usb_osal_sem_give(g_cdc_ncm_tx_sem);
+    }
+    return ret;
+}
+
+static void usbh_cdc_ncm_tx_complete(void *arg, int nbytes)
+{
+    struct usbh_cdc_ncm_tx_ntb *ntb;
+    size_t flags;
+    bool submit = false;
+
+    (void)arg;
+    (void)nbytes;
+
+    flags = usb_osal_enter_critical_section();
+    g_cdc_ncm_tx.busy = false;
+
+    /* frames queued while the last ntb was on the bus go out together */
+    ntb = &g_cdc_ncm_tx.ntb[g_cdc_ncm_tx.fill];
+    if (ntb->datagram_num && !g_cdc_ncm_tx.writing) {
+        submit = (usbh_cdc_ncm_tx_flush() == 0);
+    }
+    usb_osal_leave_critical_section(flags);
+
+    if (submit) {
+        usbh_cdc_ncm_tx_submit();
+    }
+
+    usb_osal_sem_give(g_cdc_ncm_tx_sem);
+}
+
+#if CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT > 0
+static void usbh_cdc_ncm_tx_timeout(void *arg)
+{
+    size_t flags;
+    bool submit = false;
+
+    (void)arg;
+
+    flags = usb_osal_enter_critical_section();
+    g_cdc_ncm_tx.timer_armed = false;
+    /* a frame being copied is sent by usbh_cdc_ncm_eth_output() */
+    if (!g_cdc_ncm_tx.busy && !g_cdc_ncm_tx.writing && g_cdc_ncm_tx.ntb[g_cdc_ncm_tx.fill].datagram_num) {
+        submit = (usbh_cdc_ncm_tx_flush() == 0);
+    }
+    usb_osal_leave_critical_section(flags);
+
+    if (submit) {
+        usbh_cdc_ncm_tx_submit();
+    }
+}
+#endif
+
 static int usbh_cdc_ncm_connect(struct usbh_hubport *hport, uint8_t intf)
 {
     struct usb_endpoint_descriptor *ep_desc;
     int ret;
+    uint32_t ntb_in_size;
     uint8_t altsetting = 0;
     char mac_buffer[12];
     uint8_t *p;
@@ -180,6 +437,37 @@ get_mac:
     usbh_cdc_ncm_get_ntb_parameters(cdc_ncm_class, &cdc_ncm_class->ntb_param);
     print_ntb_parameters(&cdc_ncm_class->ntb_param);
 
+    /* one rx ntb must fit the rx buffer, dwNtbInMaxSize is the negotiated size from here on */
+    ntb_in_size = cdc_ncm_class->ntb_param.dwNtbInMaxSize;
+    if ((ntb_in_size == 0) || (ntb_in_size > CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE)) {
+        ntb_in_size = CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE;
+    }
+    ret = usbh_cdc_ncm_set_ntb_input_size(cdc_ncm_class, ntb_in_size);
+    if ((ret < 0) && (cdc_ncm_class->ntb_param.dwNtbInMaxSize > CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE)) {
+        USB_LOG_ERR("CDC NCM dwNtbInMaxSize 0x%08x is bigger than rx buffer, please increase CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE\r\n",
+                    (unsigned int)cdc_ncm_class->ntb_param.dwNtbInMaxSize);
+        return ret;
+    }
+    cdc_ncm_class->ntb_param.dwNtbInMaxSize = ntb_in_size;
+    USB_LOG_INFO("CDC NCM rx ntb size %u\r\n", (unsigned int)ntb_in_size);
+
+    /* kept for later connections */
+    if (g_cdc_ncm_tx_sem == NULL) {
+        g_cdc_ncm_tx_sem = usb_osal_sem_create(0);
+        if (g_cdc_ncm_tx_sem == NULL) {
+            return -USB_ERR_NOMEM;
+        }
+    }
+#if CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT > 0
+    if (g_cdc_ncm_tx_timer == NULL) {
+        g_cdc_ncm_tx_timer = usb_osal_timer_create("cdc_ncm_tx", CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT, usbh_cdc_ncm_tx_timeout, NULL, false);
+    }
+#endif
+    ret = usbh_cdc_ncm_tx_init(cdc_ncm_class);
+    if (ret < 0) {
+        return ret;
+    }
+
     /* enable int ep */
     ep_desc = &hport->config.intf[intf].altsetting[0].ep[0].ep_desc;
     USBH_EP_INIT(cdc_ncm_class->intin, ep_desc);
@@ -228,10 +516,25 @@ static int usbh_cdc_ncm_disconnect(struct usbh_hubport *hport, uint8_t intf)
     if (cdc_ncm_class) {
         if (cdc_ncm_class->bulkin) {
             usbh_kill_urb(&cdc_ncm_class->bulkin_urb);
+#ifdef CONFIG_USBHOST_URB_QUEUE
+            for (uint8_t i = 0; i < CONFIG_USBHOST_URB_QUEUE_DEPTH; i++) {
+                usbh_kill_urb(&cdc_ncm_class->bulkin_queue_urb[i]);
+            }
+            /* killed urbs are given back without callback, wake up rx thread by hand */
+            if (g_cdc_ncm_rx_sem) {
+                usb_osal_sem_give(g_cdc_ncm_rx_sem);
+            }
+#endif
         }
 
         if (cdc_ncm_class->bulkout) {
             usbh_kill_urb(&cdc_ncm_class->bulkout_urb);
+#if CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT > 0
+            usb_osal_timer_stop(g_cdc_ncm_tx_timer);
+#endif
+            /* killed urb is given back without callback, release a waiting usbh_cdc_ncm_get_eth_txbuf() */
+            g_cdc_ncm_tx.busy = false;
+            usb_osal_sem_give(g_cdc_ncm_tx_sem);
         }
 
         if (cdc_ncm_class->intin) {
@@ -250,15 +553,133 @@ static int usbh_cdc_ncm_disconnect(struct usbh_hubport *hport, uint8_t intf)
     return ret;
 }
 
+static void usbh_cdc_ncm_rx_ntb(uint8_t *rx_buffer, uint32_t rx_length)
+{
+    USB_LOG_DBG("rxlen:%d\r\n", rx_length);
+
+    struct cdc_ncm_nth16 *nth16 = (struct cdc_ncm_nth16 *)&rx_buffer[0];
+    if ((nth16->dwSignature != CDC_NCM_NTH16_SIGNATURE) ||
+        (nth16->wHeaderLength != 12) ||
+        (nth16->wBlockLength != rx_length)) {
+        USB_LOG_ERR("invalid rx nth16\r\n");
+        return;
+    }
+
+    struct cdc_ncm_ndp16 *ndp16 = (struct cdc_ncm_ndp16 *)&rx_buffer[nth16->wNdpIndex];
+    if ((ndp16->dwSignature != CDC_NCM_NDP16_SIGNATURE_NCM0) && (ndp16->dwSignature != CDC_NCM_NDP16_SIGNATURE_NCM1)) {
+        USB_LOG_ERR("invalid rx ndp16\r\n");
+        return;
+    }
+
+    uint16_t datagram_num = (ndp16->wLength - 8) / 4;
+
+    USB_LOG_DBG("datagram num:%02x\r\n", datagram_num);
+    for (uint16_t i = 0; i < datagram_num; i++) {
+        struct cdc_ncm_ndp16_datagram *ndp16_datagram = (struct cdc_ncm_ndp16_datagram *)&rx_buffer[nth16->wNdpIndex + 8 + 4 * i];
+        if (ndp16_datagram->wDatagramIndex && ndp16_datagram->wDatagramLength) {
+            USB_LOG_DBG("ndp16_datagram index:%02x, length:%02x\r\n", ndp16_datagram->wDatagramIndex, ndp16_datagram->wDatagramLength);
+
+            uint8_t *buf = (uint8_t *)&rx_buffer[ndp16_datagram->wDatagramIndex];
+            usbh_cdc_ncm_eth_input(buf, ndp16_datagram->wDatagramLength);
+        }
+    }
+}
+
+#ifdef CONFIG_USBHOST_URB_QUEUE
+static void usbh_cdc_ncm_rx_complete(void *arg, int nbytes)
+{
+    (void)arg;
+    (void)nbytes;
+
+    usb_osal_sem_give(g_cdc_ncm_rx_sem);
+}
+
 void usbh_cdc_ncm_rx_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
 {
-    uint32_t g_cdc_ncm_rx_length;
+    struct usbh_urb *urb;
+    uint8_t rx_index;
     int ret;
-#if CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE <= (16 * 1024)
-    uint32_t transfer_size = CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE;
+
+    (void)CONFIG_USB_OSAL_THREAD_GET_ARGV;
+    USB_LOG_INFO("Create cdc ncm rx thread\r\n");
+
+    if (g_cdc_ncm_rx_sem == NULL) {
+        g_cdc_ncm_rx_sem = usb_osal_sem_create(0);
+        if (g_cdc_ncm_rx_sem == NULL) {
+            goto delete;
+        }
+    }
+    // clang-format off
+find_class:
+    // clang-format on
+    g_cdc_ncm_class.connect_status = false;
+    if (usbh_find_class_instance("/dev/cdc_ncm") == NULL) {
+        goto delete;
+    }
+
+    while (g_cdc_ncm_class.connect_status == false) {
+        ret = usbh_cdc_ncm_get_connect_status(&g_cdc_ncm_class);
+        if (ret < 0) {
+            usb_osal_msleep(100);
+            goto find_class;
+        }
+    }
+
+    /* every urb receives one whole ntb, a max size ntb has no zlp and ends the urb by length */
+    for (uint8_t i = 0; i < CONFIG_USBHOST_URB_QUEUE_DEPTH; i++) {
+        usbh_bulk_urb_fill(&g_cdc_ncm_class.bulkin_queue_urb[i], g_cdc_ncm_class.hport, g_cdc_ncm_class.bulkin, g_cdc_ncm_rx_buffer[i], g_cdc_ncm_class.ntb_param.dwNtbInMaxSize, 0, usbh_cdc_ncm_rx_complete, NULL);
+        ret = usbh_submit_urb(&g_cdc_ncm_class.bulkin_queue_urb[i]);
+        if (ret < 0) {
+            goto kill_urbs;
+        }
+    }
+
+    rx_index = 0;
+    while (1) {
+        usb_osal_sem_take(g_cdc_ncm_rx_sem, USB_OSAL_WAITING_FOREVER);
+
+        urb = &g_cdc_ncm_class.bulkin_queue_urb[rx_index];
+        if (urb->errorcode == -USB_ERR_BUSY) {
+            /* stale wakeup, urbs complete in order */
+            continue;
+        }
+
+        if ((g_cdc_ncm_class.hport == NULL) || (urb->errorcode < 0)) {
+            goto kill_urbs;
+        }
+
+        usbh_cdc_ncm_rx_ntb(g_cdc_ncm_rx_buffer[rx_index], urb->actual_length);
+
+        ret = usbh_submit_urb(urb);
+        if (ret < 0) {
+            goto kill_urbs;
+        }
+        rx_index = (rx_index + 1) % CONFIG_USBHOST_URB_QUEUE_DEPTH;
+    }
+    // clang-format off
+kill_urbs:
+    // clang-format on
+    for (uint8_t i = 0; i < CONFIG_USBHOST_URB_QUEUE_DEPTH; i++) {
+        usbh_kill_urb(&g_cdc_ncm_class.bulkin_queue_urb[i]);
+    }
+    goto find_class;
+    // clang-format off
+delete:
+    USB_LOG_INFO("Delete cdc ncm rx thread\r\n");
+    if (g_cdc_ncm_rx_sem) {
+        usb_osal_sem_delete(g_cdc_ncm_rx_sem);
+        g_cdc_ncm_rx_sem = NULL;
+    }
+    usb_osal_thread_delete(NULL);
+    // clang-format on
+}
 #else
-    uint32_t transfer_size = (16 * 1024);
-#endif
+void usbh_cdc_ncm_rx_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
+{
+    uint32_t g_cdc_ncm_rx_length;
+    uint32_t ntb_in_size;
+    uint32_t transfer_size;
+    int ret;
 
     (void)CONFIG_USB_OSAL_THREAD_GET_ARGV;
     USB_LOG_INFO("Create cdc ncm rx thread\r\n");
@@ -278,8 +699,10 @@ find_class:
         }
     }
 
+    ntb_in_size = g_cdc_ncm_class.ntb_param.dwNtbInMaxSize;
     g_cdc_ncm_rx_length = 0;
     while (1) {
+        transfer_size = MIN(ntb_in_size - g_cdc_ncm_rx_length, 16 * 1024);
         usbh_bulk_urb_fill(&g_cdc_ncm_class.bulkin_urb, g_cdc_ncm_class.hport, g_cdc_ncm_class.bulkin, &g_cdc_ncm_rx_buffer[g_cdc_ncm_rx_length], transfer_size, USB_OSAL_WAITING_FOREVER, NULL, NULL);
         ret = usbh_submit_urb(&g_cdc_ncm_class.bulkin_urb);
         if (ret < 0) {
@@ -291,51 +714,13 @@ find_class:
         /* A transfer is complete because last packet is a short packet.
          * Short packet is not zero, match g_cdc_ncm_rx_length % USB_GET_MAXPACKETSIZE(g_cdc_ncm_class.bulkin->wMaxPacketSize).
          * Short packet is zero, check if g_cdc_ncm_class.bulkin_urb.actual_length < transfer_size, for example transfer is complete with size is 1024 < 2048.
+         * A ntb of dwNtbInMaxSize is not followed by a zlp, it is complete when g_cdc_ncm_rx_length reaches that size.
         */
         if ((g_cdc_ncm_rx_length % USB_GET_MAXPACKETSIZE(g_cdc_ncm_class.bulkin->wMaxPacketSize)) ||
-            (g_cdc_ncm_class.bulkin_urb.actual_length < transfer_size)) {
-            USB_LOG_DBG("rxlen:%d\r\n", g_cdc_ncm_rx_length);
-
-            struct cdc_ncm_nth16 *nth16 = (struct cdc_ncm_nth16 *)&g_cdc_ncm_rx_buffer[0];
-            if ((nth16->dwSignature != CDC_NCM_NTH16_SIGNATURE) ||
-                (nth16->wHeaderLength != 12) ||
-                (nth16->wBlockLength != g_cdc_ncm_rx_length)) {
-                USB_LOG_ERR("invalid rx nth16\r\n");
-                g_cdc_ncm_rx_length = 0;
-                continue;
-            }
-
-            struct cdc_ncm_ndp16 *ndp16 = (struct cdc_ncm_ndp16 *)&g_cdc_ncm_rx_buffer[nth16->wNdpIndex];
-            if ((ndp16->dwSignature != CDC_NCM_NDP16_SIGNATURE_NCM0) && (ndp16->dwSignature != CDC_NCM_NDP16_SIGNATURE_NCM1)) {
-                USB_LOG_ERR("invalid rx ndp16\r\n");
-                g_cdc_ncm_rx_length = 0;
-                continue;
-            }
-
-            uint16_t datagram_num = (ndp16->wLength - 8) / 4;
-
-            USB_LOG_DBG("datagram num:%02x\r\n", datagram_num);
-            for (uint16_t i = 0; i < datagram_num; i++) {
-                struct cdc_ncm_ndp16_datagram *ndp16_datagram = (struct cdc_ncm_ndp16_datagram *)&g_cdc_ncm_rx_buffer[nth16->wNdpIndex + 8 + 4 * i];
-                if (ndp16_datagram->wDatagramIndex && ndp16_datagram->wDatagramLength) {
-                    USB_LOG_DBG("ndp16_datagram index:%02x, length:%02x\r\n", ndp16_datagram->wDatagramIndex, ndp16_datagram->wDatagramLength);
-
-                    uint8_t *buf = (uint8_t *)&g_cdc_ncm_rx_buffer[ndp16_datagram->wDatagramIndex];
-                    usbh_cdc_ncm_eth_input(buf, ndp16_datagram->wDatagramLength);
-                }
-            }
-
+            (g_cdc_ncm_class.bulkin_urb.actual_length < transfer_size) ||
+            (g_cdc_ncm_rx_length == ntb_in_size)) {
+            usbh_cdc_ncm_rx_ntb(g_cdc_ncm_rx_buffer, g_cdc_ncm_rx_length);
             g_cdc_ncm_rx_length = 0;
-        } else {
-#if CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE <= (16 * 1024)
-            if (g_cdc_ncm_rx_length == CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE) {
-#else
-            if ((g_cdc_ncm_rx_length + (16 * 1024)) > CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE) {
-#endif
-                USB_LOG_ERR("Rx packet is overflow, please reduce tcp window size or increase CONFIG_USBHOST_CDC_NCM_ETH_MAX_RX_SIZE\r\n");
-                while (1) {
-                }
-            }
         }
     }
     // clang-format off
@@ -344,46 +729,99 @@ delete:
     usb_osal_thread_delete(NULL);
     // clang-format on
 }
+#endif
 
+/* Room for the next frame in the filling ntb, waits while both ntbs are taken */
 uint8_t *usbh_cdc_ncm_get_eth_txbuf(void)
 {
-    return &g_cdc_ncm_tx_buffer[16];
+    struct usbh_cdc_ncm_tx_ntb *ntb;
+    size_t flags;
+    bool submit = false;
+
+    while (1) {
+        flags = usb_osal_enter_critical_section();
+        ntb = &g_cdc_ncm_tx.ntb[g_cdc_ncm_tx.fill];
+        if (!usbh_cdc_ncm_tx_full(ntb)) {
+            break;
+        }
+        if (!g_cdc_ncm_tx.busy) {
+            submit = (usbh_cdc_ncm_tx_flush() == 0);
+            ntb = &g_cdc_ncm_tx.ntb[g_cdc_ncm_tx.fill];
+            break;
+        }
+        usb_osal_leave_critical_section(flags);
+
+        usb_osal_sem_take(g_cdc_ncm_tx_sem, USB_OSAL_WAITING_FOREVER);
+    }
+    g_cdc_ncm_tx.writing = true;
+    usb_osal_leave_critical_section(flags);
+
+    if (submit) {
+        usbh_cdc_ncm_tx_submit();
+    }
+
+    return &g_cdc_ncm_tx_buffer[g_cdc_ncm_tx.fill][usbh_cdc_ncm_tx_offset(ntb->len)];
 }
 
+/* Queue the frame written to usbh_cdc_ncm_get_eth_txbuf(), it goes out with the next ntb */
 int usbh_cdc_ncm_eth_output(uint32_t buflen)
 {
-    struct cdc_ncm_ndp16_datagram *ndp16_datagram;
+    struct usbh_cdc_ncm_tx_ntb *ntb;
+    uint32_t offset;
+    size_t flags;
+    int ret = 0;
+    bool submit = false;
+#if CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT > 0
+    bool start_timer = false;
+#endif
+
+    flags = usb_osal_enter_critical_section();
+    g_cdc_ncm_tx.writing = false;
 
     if (g_cdc_ncm_class.connect_status == false) {
+        usb_osal_leave_critical_section(flags);
         return -USB_ERR_NOTCONN;
     }
 
-    struct cdc_ncm_nth16 *nth16 = (struct cdc_ncm_nth16 *)&g_cdc_ncm_tx_buffer[0];
-
-    nth16->dwSignature = CDC_NCM_NTH16_SIGNATURE;
-    nth16->wHeaderLength = 12;
-    nth16->wSequence = g_cdc_ncm_class.bulkout_sequence++;
-    nth16->wBlockLength = 16 + 16 + USB_ALIGN_UP(buflen, 4);
-    nth16->wNdpIndex = 16 + USB_ALIGN_UP(buflen, 4);
-
-    struct cdc_ncm_ndp16 *ndp16 = (struct cdc_ncm_ndp16 *)&g_cdc_ncm_tx_buffer[nth16->wNdpIndex];
-
-    ndp16->dwSignature = CDC_NCM_NDP16_SIGNATURE_NCM0;
-    ndp16->wLength = 16;
-    ndp16->wNextNdpIndex = 0;
-
-    ndp16_datagram = (struct cdc_ncm_ndp16_datagram *)&g_cdc_ncm_tx_buffer[nth16->wNdpIndex + 8 + 4 * 0];
-    ndp16_datagram->wDatagramIndex = 16;
-    ndp16_datagram->wDatagramLength = buflen;
+    if (buflen > CONFIG_USBHOST_CDC_NCM_ETH_MAX_SEGSZE) {
+        usb_osal_leave_critical_section(flags);
+        return -USB_ERR_RANGE;
+    }
 
-    ndp16_datagram = (struct cdc_ncm_ndp16_datagram *)&g_cdc_ncm_tx_buffer[nth16->wNdpIndex + 8 + 4 * 1];
-    ndp16_datagram->wDatagramIndex = 0;
-    ndp16_datagram->wDatagramLength = 0;
+    ntb = &g_cdc_ncm_tx.ntb[g_cdc_ncm_tx.fill];
+    offset = usbh_cdc_ncm_tx_offset(ntb->len);
+    ntb->datagram_index[ntb->datagram_num] = offset;
+    ntb->datagram_len[ntb->datagram_num] = buflen;
+    ntb->datagram_num++;
+    ntb->len = offset + buflen;
+
+    /* bulk out busy: the completion sends everything queued so far */
+    if (!g_cdc_ncm_tx.busy) {
+#if CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT > 0
+        if (usbh_cdc_ncm_tx_full(ntb)) {
+            ret = usbh_cdc_ncm_tx_flush();
+            submit = (ret == 0);
+        } else if (!g_cdc_ncm_tx.timer_armed) {
+            g_cdc_ncm_tx.timer_armed = true;
+            start_timer = true;
+        }
+#else
+        ret = usbh_cdc_ncm_tx_flush();
+        submit = (ret == 0);
+#endif
+    }
+    usb_osal_leave_critical_section(flags);
 
-    USB_LOG_DBG("txlen:%d\r\n", nth16->wBlockLength);
+    if (submit) {
+        ret = usbh_cdc_ncm_tx_submit();
+    }
 
-    usbh_bulk_urb_fill(&g_cdc_ncm_class.bulkout_urb, g_cdc_ncm_class.hport, g_cdc_ncm_class.bulkout, g_cdc_ncm_tx_buffer, nth16->wBlockLength, USB_OSAL_WAITING_FOREVER, NULL, NULL);
-    return usbh_submit_urb(&g_cdc_ncm_class.bulkout_urb);
+#if CONFIG_USBHOST_CDC_NCM_TX_TIMEOUT > 0
+    if (start_timer) {
+        usb_osal_timer_start(g_cdc_ncm_tx_timer);
+    }
+#endif
+    return ret;
 }
 
 __WEAK void usbh_cdc_ncm_run(struct usbh_cdc_ncm *cdc_ncm_class)
@@ -16,6 +16,9 @@ struct usbh_cdc_ncm {
     struct usbh_urb bulkout_urb;             /* Bulk out endpoint */
     struct usbh_urb bulkin_urb;              /* Bulk IN endpoint */
     struct usbh_urb intin_urb;               /* Interrupt IN endpoint */
+#ifdef CONFIG_USBHOST_URB_QUEUE
+    struct usbh_urb bulkin_queue_urb[CONFIG_USBHOST_URB_QUEUE_DEPTH]; /* Bulk IN urbs kept in flight */
+#endif
 
     uint8_t ctrl_intf; /* Control interface number */
     uint8_t data_intf; /* Data interface number */
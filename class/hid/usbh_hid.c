@@ -292,6 +292,7 @@ int usbh_hid_disconnect(struct usbh_hubport *hport, uint8_t intf)
     if (hid_class) {
         if (hid_class->intin) {
             usbh_kill_urb(&hid_class->intin_urb);
+            usbh_int_pipe_close(&hid_class->intin_pipe);
         }
 
         if (hid_class->intout) {
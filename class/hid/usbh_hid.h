@@ -14,6 +14,7 @@ struct usbh_hid {
     struct usb_endpoint_descriptor *intout; /* INTR OUT endpoint */
     struct usbh_urb intin_urb;              /* INTR IN urb */
     struct usbh_urb intout_urb;             /* INTR OUT urb */
+    struct usbh_int_pipe intin_pipe;        /* INTR IN persistent pipe */
 
     uint16_t report_size;
 
@@ -19,8 +19,12 @@
 
 #define EXTHUB_FIRST_INDEX 2
 
+/* status change bitmap, bit 0 for hub and bit n for port n */
+#define HUB_INT_REPORT_SIZE 2
+
 USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_hub_buf[CONFIG_USBHOST_MAX_BUS][USB_ALIGN_UP(32, CONFIG_USB_ALIGN_SIZE)];
-USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_hub_intbuf[CONFIG_USBHOST_MAX_BUS][CONFIG_USBHOST_MAX_EXTHUBS + 1][USB_ALIGN_UP(1, CONFIG_USB_ALIGN_SIZE)];
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_hub_intbuf[CONFIG_USBHOST_MAX_BUS][CONFIG_USBHOST_MAX_EXTHUBS + 1][USB_ALIGN_UP(HUB_INT_REPORT_SIZE, CONFIG_USB_ALIGN_SIZE)];
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_hub_intring[CONFIG_USBHOST_MAX_BUS][CONFIG_USBHOST_MAX_EXTHUBS + 1][USBH_INT_PIPE_BUFSIZE(HUB_INT_REPORT_SIZE, 1)];
 
 extern int usbh_enumerate(struct usbh_hubport *hport);
 extern void usbh_hubport_release(struct usbh_hubport *hport);
@@ -289,26 +293,23 @@ static int usbh_hub_set_depth(struct usbh_hub *hub, uint16_t depth)
     }
 }
 
-static void hub_int_complete_callback(void *arg, int nbytes)
+static void hub_int_report_callback(void *arg, uint8_t *buffer, int nbytes)
 {
     struct usbh_hub *hub = (struct usbh_hub *)arg;
+    bool wakeup;
 
-    if (nbytes > 0) {
-        usbh_hub_thread_wakeup(hub);
-    } else if (nbytes == -USB_ERR_NAK) {
-        /* Restart timer to submit urb again */
-        USB_LOG_DBG("Restart timer\r\n");
-        usb_osal_timer_start(hub->int_timer);
-    } else {
+    if (nbytes <= 0) {
+        return;
     }
-}
 
-static void hub_int_timeout(void *arg)
-{
-    struct usbh_hub *hub = (struct usbh_hub *)arg;
-
-    usbh_int_urb_fill(&hub->intin_urb, hub->parent, hub->intin, hub->int_buffer, 1, 0, hub_int_complete_callback, hub);
-    usbh_submit_urb(&hub->intin_urb);
+    /* pipe keeps polling, merge change bits until hub thread takes them */
+    wakeup = (hub->int_buffer[0] | hub->int_buffer[1]) == 0;
+    for (int i = 0; i < MIN(nbytes, 2); i++) {
+        hub->int_buffer[i] |= buffer[i];
+    }
+    if (wakeup) {
+        usbh_hub_thread_wakeup(hub);
+    }
 }
 
 static int usbh_hub_connect(struct usbh_hubport *hport, uint8_t intf)
@@ -415,14 +416,10 @@ static int usbh_hub_connect(struct usbh_hubport *hport, uint8_t intf)
     USB_LOG_INFO("Register HUB Class:%s\r\n", hport->config.intf[intf].devname);
 
     hub->int_buffer = g_hub_intbuf[hub->bus->busid][hub->index - 1];
+    memset(hub->int_buffer, 0, 2);
 
-    hub->int_timer = usb_osal_timer_create("hubint_tim", USBH_GET_URB_INTERVAL(hub->intin->bInterval, hport->speed) / 1000, hub_int_timeout, hub, 0);
-    if (hub->int_timer == NULL) {
-        USB_LOG_ERR("No memory to alloc int_timer\r\n");
-        return -USB_ERR_NOMEM;
-    }
-    usb_osal_timer_start(hub->int_timer);
-    return 0;
+    return usbh_int_pipe_open(&hub->intin_pipe, hport, hub->intin, g_hub_intring[hub->bus->busid][hub->index - 1],
+                              HUB_INT_REPORT_SIZE, 1, hub_int_report_callback, hub);
 }
 
 static int usbh_hub_disconnect(struct usbh_hubport *hport, uint8_t intf)
@@ -434,11 +431,7 @@ static int usbh_hub_disconnect(struct usbh_hubport *hport, uint8_t intf)
 
     if (hub) {
         if (hub->intin) {
-            usbh_kill_urb(&hub->intin_urb);
-        }
-
-        if (hub->int_timer) {
-            usb_osal_timer_delete(hub->int_timer);
+            usbh_int_pipe_close(&hub->intin_pipe);
         }
 
         for (uint8_t port = 0; port < hub->nports; port++) {
@@ -476,6 +469,9 @@ static void usbh_hub_events(struct usbh_hub *hub)
 
     flags = usb_osal_enter_critical_section();
     memcpy(&portchange_index, hub->int_buffer, 2);
+    if (!hub->is_roothub) {
+        memset(hub->int_buffer, 0, 2);
+    }
     usb_osal_leave_critical_section(flags);
 
     for (uint8_t port = 0; port < hub->nports; port++) {
@@ -645,11 +641,6 @@ static void usbh_hub_events(struct usbh_hub *hub)
             }
         }
     }
-
-    /* Start next hub int transfer */
-    if (!hub->is_roothub && hub->connected) {
-        usb_osal_timer_start(hub->int_timer);
-    }
 }
 
 static void usbh_hub_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
@@ -15,6 +15,21 @@
 #define MSD_OUT_EP_IDX 0
 #define MSD_IN_EP_IDX  1
 
+#ifndef CONFIG_USBDEV_MSC_BUFNUM
+#define CONFIG_USBDEV_MSC_BUFNUM 2
+#endif
+
+#if defined(CONFIG_USBDEV_MSC_ASYNC) && (defined(CONFIG_USBDEV_MSC_THREAD) || defined(CONFIG_USBDEV_MSC_POLLING))
+#error CONFIG_USBDEV_MSC_ASYNC can not be used with CONFIG_USBDEV_MSC_THREAD or CONFIG_USBDEV_MSC_POLLING
+#endif
+
+#if defined(CONFIG_USBDEV_MSC_THREAD) || defined(CONFIG_USBDEV_MSC_POLLING) || defined(CONFIG_USBDEV_MSC_ASYNC)
+#define USBD_MSC_READ_AHEAD_NUM CONFIG_USBDEV_MSC_BUFNUM
+#else
+/* storage is accessed in isr, read only one buffer ahead of usb */
+#define USBD_MSC_READ_AHEAD_NUM MIN(CONFIG_USBDEV_MSC_BUFNUM, 2)
+#endif
+
 /* Describe EndPoints configuration */
 static struct usbd_endpoint mass_ep_data[CONFIG_USBDEV_MAX_BUS][2];
 
@@ -45,20 +60,34 @@ USB_NOCACHE_RAM_SECTION struct usbd_msc_priv {
     uint32_t scsi_blk_size[CONFIG_USBDEV_MSC_MAX_LUN];
     uint32_t scsi_blk_nbr[CONFIG_USBDEV_MSC_MAX_LUN];
 
-    USB_MEM_ALIGNX uint8_t block_buffer[CONFIG_USBDEV_MSC_MAX_BUFSIZE];
+    /* data phase buffers, filled at buf_tail and drained at buf_head,
+     * by storage and usb for data in, by usb and storage for data out.
+     */
+    uint8_t buf_head;
+    uint8_t buf_tail;
+    uint8_t buf_count;
+    bool ep_busy;     /* data transfer on bulk ep in progress */
+    bool xfer_err;    /* storage failed while usb transfer was in progress */
+    uint32_t out_len; /* data out bytes not requested from host yet */
+#ifdef CONFIG_USBDEV_MSC_ASYNC
+    bool storage_busy; /* async storage request in flight */
+#endif
+    uint32_t buf_len[CONFIG_USBDEV_MSC_BUFNUM];
+
+    USB_MEM_ALIGNX uint8_t block_buffer[CONFIG_USBDEV_MSC_BUFNUM][CONFIG_USBDEV_MSC_MAX_BUFSIZE];
 
 #if defined(CONFIG_USBDEV_MSC_THREAD)
     usb_osal_mq_t usbd_msc_mq;
     usb_osal_thread_t usbd_msc_thread;
-    uint32_t nbytes;
+    bool thread_pending; /* wakeup sitting in usbd_msc_mq */
 #elif defined(CONFIG_USBDEV_MSC_POLLING)
     uint32_t event;
-    uint32_t nbytes;
 #endif
 } g_usbd_msc[CONFIG_USBDEV_MAX_BUS];
 
 #ifdef CONFIG_USBDEV_MSC_THREAD
 static void usbdev_msc_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV);
+static void usbd_msc_thread_wakeup(uint8_t busid);
 #endif
 
 static void usdb_msc_set_max_lun(uint8_t busid)
@@ -103,11 +132,12 @@ void msc_storage_notify_handler(uint8_t busid, uint8_t event, void *arg)
     switch (event) {
         case USBD_EVENT_INIT:
 #if defined(CONFIG_USBDEV_MSC_THREAD)
+            g_usbd_msc[busid].thread_pending = false;
             g_usbd_msc[busid].usbd_msc_mq = usb_osal_mq_create(1);
             if (g_usbd_msc[busid].usbd_msc_mq == NULL) {
                 USB_LOG_ERR("No memory to alloc for g_usbd_msc[busid].usbd_msc_mq\r\n");
             }
-            g_usbd_msc[busid].usbd_msc_thread = usb_osal_thread_create("usbd_msc", CONFIG_USBDEV_MSC_STACKSIZE, CONFIG_USBDEV_MSC_PRIO, usbdev_msc_thread, (void *)(uint32_t)busid);
+            g_usbd_msc[busid].usbd_msc_thread = usb_osal_thread_create("usbd_msc", CONFIG_USBDEV_MSC_STACKSIZE, CONFIG_USBDEV_MSC_PRIO, usbdev_msc_thread, (void *)(uintptr_t)busid);
             if (g_usbd_msc[busid].usbd_msc_thread == NULL) {
                 USB_LOG_ERR("No memory to alloc for g_usbd_msc[busid].usbd_msc_thread\r\n");
             }
@@ -117,11 +147,14 @@ void msc_storage_notify_handler(uint8_t busid, uint8_t event, void *arg)
             break;
         case USBD_EVENT_DEINIT:
 #if defined(CONFIG_USBDEV_MSC_THREAD)
-            if (g_usbd_msc[busid].usbd_msc_mq) {
-                usb_osal_mq_delete(g_usbd_msc[busid].usbd_msc_mq);
-            }
+            /* the thread waits on usbd_msc_mq, remove it first */
             if (g_usbd_msc[busid].usbd_msc_thread) {
                 usb_osal_thread_delete(g_usbd_msc[busid].usbd_msc_thread);
+                g_usbd_msc[busid].usbd_msc_thread = NULL;
+            }
+            if (g_usbd_msc[busid].usbd_msc_mq) {
+                usb_osal_mq_delete(g_usbd_msc[busid].usbd_msc_mq);
+                g_usbd_msc[busid].usbd_msc_mq = NULL;
             }
 #endif
             break;
@@ -176,7 +209,38 @@ static void usbd_msc_send_info(uint8_t busid, uint8_t *buffer, uint8_t size)
     g_usbd_msc[busid].csw.bStatus = CSW_STATUS_CMD_PASSED;
 }
 
-static bool SCSI_processWrite(uint8_t busid, uint32_t nbytes);
+static void usbd_msc_pipe_reset(uint8_t busid)
+{
+    g_usbd_msc[busid].buf_head = 0;
+    g_usbd_msc[busid].buf_tail = 0;
+    g_usbd_msc[busid].buf_count = 0;
+    g_usbd_msc[busid].ep_busy = false;
+    g_usbd_msc[busid].xfer_err = false;
+    g_usbd_msc[busid].out_len = 0;
+#ifdef CONFIG_USBDEV_MSC_ASYNC
+    g_usbd_msc[busid].storage_busy = false;
+#endif
+}
+
+/* send oldest filled buffer, ep_busy must be set by caller */
+static void usbd_msc_start_data_in(uint8_t busid)
+{
+    uint8_t idx = g_usbd_msc[busid].buf_head;
+
+    usbd_ep_start_write(busid, mass_ep_data[busid][MSD_IN_EP_IDX].ep_addr, g_usbd_msc[busid].block_buffer[idx], g_usbd_msc[busid].buf_len[idx]);
+}
+
+/* receive into next free buffer, ep_busy must be set by caller */
+static void usbd_msc_start_data_out(uint8_t busid)
+{
+    uint32_t data_len;
+
+    data_len = MIN(g_usbd_msc[busid].out_len, CONFIG_USBDEV_MSC_MAX_BUFSIZE);
+    g_usbd_msc[busid].out_len -= data_len;
+    usbd_ep_start_read(busid, mass_ep_data[busid][MSD_OUT_EP_IDX].ep_addr, g_usbd_msc[busid].block_buffer[g_usbd_msc[busid].buf_tail], data_len);
+}
+
+static bool SCSI_processWrite(uint8_t busid);
 static bool SCSI_processRead(uint8_t busid);
 
 /**
@@ -528,8 +592,9 @@ static bool SCSI_read10(uint8_t busid, uint8_t **data, uint32_t *len)
         return false;
     }
     g_usbd_msc[busid].stage = MSC_DATA_IN;
+    usbd_msc_pipe_reset(busid);
 #if defined(CONFIG_USBDEV_MSC_THREAD)
-    usb_osal_mq_send(g_usbd_msc[busid].usbd_msc_mq, MSC_DATA_IN);
+    usbd_msc_thread_wakeup(busid);
     return true;
 #elif defined(CONFIG_USBDEV_MSC_POLLING)
     g_usbd_msc[busid].event = MSC_DATA_IN;
@@ -561,8 +626,9 @@ static bool SCSI_read12(uint8_t busid, uint8_t **data, uint32_t *len)
         return false;
     }
     g_usbd_msc[busid].stage = MSC_DATA_IN;
+    usbd_msc_pipe_reset(busid);
 #if defined(CONFIG_USBDEV_MSC_THREAD)
-    usb_osal_mq_send(g_usbd_msc[busid].usbd_msc_mq, MSC_DATA_IN);
+    usbd_msc_thread_wakeup(busid);
     return true;
 #elif defined(CONFIG_USBDEV_MSC_POLLING)
     g_usbd_msc[busid].event = MSC_DATA_IN;
@@ -596,8 +662,10 @@ static bool SCSI_write10(uint8_t busid, uint8_t **data, uint32_t *len)
         return false;
     }
     g_usbd_msc[busid].stage = MSC_DATA_OUT;
-    data_len = MIN(data_len, CONFIG_USBDEV_MSC_MAX_BUFSIZE);
-    usbd_ep_start_read(busid, mass_ep_data[busid][MSD_OUT_EP_IDX].ep_addr, g_usbd_msc[busid].block_buffer, data_len);
+    usbd_msc_pipe_reset(busid);
+    g_usbd_msc[busid].out_len = data_len;
+    g_usbd_msc[busid].ep_busy = true;
+    usbd_msc_start_data_out(busid);
     return true;
 }
 
@@ -625,65 +693,203 @@ static bool SCSI_write12(uint8_t busid, uint8_t **data, uint32_t *len)
         return false;
     }
     g_usbd_msc[busid].stage = MSC_DATA_OUT;
-    data_len = MIN(data_len, CONFIG_USBDEV_MSC_MAX_BUFSIZE);
-    usbd_ep_start_read(busid, mass_ep_data[busid][MSD_OUT_EP_IDX].ep_addr, g_usbd_msc[busid].block_buffer, data_len);
+    usbd_msc_pipe_reset(busid);
+    g_usbd_msc[busid].out_len = data_len;
+    g_usbd_msc[busid].ep_busy = true;
+    usbd_msc_start_data_out(busid);
     return true;
 }
 
-static bool SCSI_processRead(uint8_t busid)
+/* storage filled buf_tail, returns false when caller should send failed csw */
+static bool usbd_msc_data_in_done(uint8_t busid, int status)
 {
-    uint32_t transfer_len;
-
-    USB_LOG_DBG("read lba:%d\r\n", g_usbd_msc[busid].start_sector);
+    uint32_t blk_size = g_usbd_msc[busid].scsi_blk_size[g_usbd_msc[busid].cbw.bLUN];
+    uint8_t idx = g_usbd_msc[busid].buf_tail;
+    size_t flags;
+    bool start;
 
-    transfer_len = MIN(g_usbd_msc[busid].nsectors * g_usbd_msc[busid].scsi_blk_size[g_usbd_msc[busid].cbw.bLUN], CONFIG_USBDEV_MSC_MAX_BUFSIZE);
-
-    if (usbd_msc_sector_read(busid, g_usbd_msc[busid].cbw.bLUN, g_usbd_msc[busid].start_sector, g_usbd_msc[busid].block_buffer, transfer_len) != 0) {
+    if (status != 0) {
         SCSI_SetSenseData(busid, SCSI_KCQHE_UREINRESERVEDAREA);
-        return false;
+
+        flags = usb_osal_enter_critical_section();
+        start = (g_usbd_msc[busid].buf_count == 0) && !g_usbd_msc[busid].ep_busy;
+        if (!start) {
+            /* let bulk in complete send csw after pending data */
+            g_usbd_msc[busid].xfer_err = true;
+        }
+        usb_osal_leave_critical_section(flags);
+        return !start;
     }
 
-    g_usbd_msc[busid].start_sector += (transfer_len / g_usbd_msc[busid].scsi_blk_size[g_usbd_msc[busid].cbw.bLUN]);
-    g_usbd_msc[busid].nsectors -= (transfer_len / g_usbd_msc[busid].scsi_blk_size[g_usbd_msc[busid].cbw.bLUN]);
-    g_usbd_msc[busid].csw.dDataResidue -= transfer_len;
+    g_usbd_msc[busid].buf_tail = (idx + 1) % CONFIG_USBDEV_MSC_BUFNUM;
 
-    if (g_usbd_msc[busid].nsectors == 0) {
-        g_usbd_msc[busid].stage = MSC_SEND_CSW;
+    flags = usb_osal_enter_critical_section();
+    g_usbd_msc[busid].start_sector += (g_usbd_msc[busid].buf_len[idx] / blk_size);
+    g_usbd_msc[busid].nsectors -= (g_usbd_msc[busid].buf_len[idx] / blk_size);
+    g_usbd_msc[busid].buf_count++;
+    start = !g_usbd_msc[busid].ep_busy;
+    if (start) {
+        g_usbd_msc[busid].ep_busy = true;
+        g_usbd_msc[busid].csw.dDataResidue -= g_usbd_msc[busid].buf_len[g_usbd_msc[busid].buf_head];
     }
+    usb_osal_leave_critical_section(flags);
 
-    usbd_ep_start_write(busid, mass_ep_data[busid][MSD_IN_EP_IDX].ep_addr, g_usbd_msc[busid].block_buffer, transfer_len);
-
+    if (start) {
+        usbd_msc_start_data_in(busid);
+    }
     return true;
 }
 
-static bool SCSI_processWrite(uint8_t busid, uint32_t nbytes)
+/* storage programmed buf_head, returns false when caller should send failed csw */
+static bool usbd_msc_data_out_done(uint8_t busid, int status)
 {
-    uint32_t data_len = 0;
-
-    USB_LOG_DBG("write lba:%d\r\n", g_usbd_msc[busid].start_sector);
+    uint32_t blk_size = g_usbd_msc[busid].scsi_blk_size[g_usbd_msc[busid].cbw.bLUN];
+    uint8_t idx = g_usbd_msc[busid].buf_head;
+    uint32_t nbytes = g_usbd_msc[busid].buf_len[idx];
+    size_t flags;
+    bool start;
 
-    if (usbd_msc_sector_write(busid, g_usbd_msc[busid].cbw.bLUN, g_usbd_msc[busid].start_sector, g_usbd_msc[busid].block_buffer, nbytes) != 0) {
+    if (status != 0) {
         SCSI_SetSenseData(busid, SCSI_KCQHE_WRITEFAULT);
-        return false;
+
+        flags = usb_osal_enter_critical_section();
+        start = !g_usbd_msc[busid].ep_busy;
+        if (!start) {
+            /* let bulk out complete send csw */
+            g_usbd_msc[busid].xfer_err = true;
+        }
+        usb_osal_leave_critical_section(flags);
+        return !start;
     }
 
-    g_usbd_msc[busid].start_sector += (nbytes / g_usbd_msc[busid].scsi_blk_size[g_usbd_msc[busid].cbw.bLUN]);
-    g_usbd_msc[busid].nsectors -= (nbytes / g_usbd_msc[busid].scsi_blk_size[g_usbd_msc[busid].cbw.bLUN]);
+    g_usbd_msc[busid].buf_head = (idx + 1) % CONFIG_USBDEV_MSC_BUFNUM;
+    g_usbd_msc[busid].start_sector += (nbytes / blk_size);
+    g_usbd_msc[busid].nsectors -= (nbytes / blk_size);
     g_usbd_msc[busid].csw.dDataResidue -= nbytes;
 
+    flags = usb_osal_enter_critical_section();
+    g_usbd_msc[busid].buf_count--;
+    start = !g_usbd_msc[busid].ep_busy && g_usbd_msc[busid].out_len;
+    if (start) {
+        g_usbd_msc[busid].ep_busy = true;
+    }
+    usb_osal_leave_critical_section(flags);
+
     if (g_usbd_msc[busid].nsectors == 0) {
         usbd_msc_send_csw(busid, CSW_STATUS_CMD_PASSED);
-    } else {
-        data_len = MIN(g_usbd_msc[busid].nsectors * g_usbd_msc[busid].scsi_blk_size[g_usbd_msc[busid].cbw.bLUN], CONFIG_USBDEV_MSC_MAX_BUFSIZE);
-        usbd_ep_start_read(busid, mass_ep_data[busid][MSD_OUT_EP_IDX].ep_addr, g_usbd_msc[busid].block_buffer, data_len);
+        return true;
     }
 
+    if (start) {
+        usbd_msc_start_data_out(busid);
+    }
     return true;
 }
 
+#ifdef CONFIG_USBDEV_MSC_ASYNC
+/* only one storage request in flight, returns false when one is already pending */
+static bool usbd_msc_storage_claim(uint8_t busid)
+{
+    size_t flags;
+    bool ret;
+
+    flags = usb_osal_enter_critical_section();
+    ret = !g_usbd_msc[busid].storage_busy;
+    g_usbd_msc[busid].storage_busy = true;
+    usb_osal_leave_critical_section(flags);
+    return ret;
+}
+#endif
+
+static bool SCSI_processRead(uint8_t busid)
+{
+    uint32_t transfer_len;
+    uint8_t idx;
+    int ret;
+
+    while ((g_usbd_msc[busid].stage == MSC_DATA_IN) && g_usbd_msc[busid].nsectors && !g_usbd_msc[busid].xfer_err &&
+           (g_usbd_msc[busid].buf_count < USBD_MSC_READ_AHEAD_NUM)) {
+        USB_LOG_DBG("read lba:%d\r\n", g_usbd_msc[busid].start_sector);
+
+        idx = g_usbd_msc[busid].buf_tail;
+        transfer_len = MIN(g_usbd_msc[busid].nsectors * g_usbd_msc[busid].scsi_blk_size[g_usbd_msc[busid].cbw.bLUN], CONFIG_USBDEV_MSC_MAX_BUFSIZE);
+#ifdef CONFIG_USBDEV_MSC_ASYNC
+        if (!usbd_msc_storage_claim(busid)) {
+            return true;
+        }
+        g_usbd_msc[busid].buf_len[idx] = transfer_len;
+        ret = usbd_msc_sector_read_async(busid, g_usbd_msc[busid].cbw.bLUN, g_usbd_msc[busid].start_sector, g_usbd_msc[busid].block_buffer[idx], transfer_len);
+        if (ret != 0) {
+            g_usbd_msc[busid].storage_busy = false;
+            return usbd_msc_data_in_done(busid, ret);
+        }
+        /* continued in usbd_msc_sector_done */
+        return true;
+#else
+        g_usbd_msc[busid].buf_len[idx] = transfer_len;
+        ret = usbd_msc_sector_read(busid, g_usbd_msc[busid].cbw.bLUN, g_usbd_msc[busid].start_sector, g_usbd_msc[busid].block_buffer[idx], transfer_len);
+        if (usbd_msc_data_in_done(busid, ret) == false) {
+            return false;
+        }
+#endif
+    }
+
+    return true;
+}
+
+static bool SCSI_processWrite(uint8_t busid)
+{
+    uint8_t idx;
+    int ret;
+
+    while ((g_usbd_msc[busid].stage == MSC_DATA_OUT) && g_usbd_msc[busid].buf_count && !g_usbd_msc[busid].xfer_err) {
+        USB_LOG_DBG("write lba:%d\r\n", g_usbd_msc[busid].start_sector);
+
+        idx = g_usbd_msc[busid].buf_head;
+#ifdef CONFIG_USBDEV_MSC_ASYNC
+        if (!usbd_msc_storage_claim(busid)) {
+            return true;
+        }
+        ret = usbd_msc_sector_write_async(busid, g_usbd_msc[busid].cbw.bLUN, g_usbd_msc[busid].start_sector, g_usbd_msc[busid].block_buffer[idx], g_usbd_msc[busid].buf_len[idx]);
+        if (ret != 0) {
+            g_usbd_msc[busid].storage_busy = false;
+            return usbd_msc_data_out_done(busid, ret);
+        }
+        /* continued in usbd_msc_sector_done */
+        return true;
+#else
+        ret = usbd_msc_sector_write(busid, g_usbd_msc[busid].cbw.bLUN, g_usbd_msc[busid].start_sector, g_usbd_msc[busid].block_buffer[idx], g_usbd_msc[busid].buf_len[idx]);
+        if (usbd_msc_data_out_done(busid, ret) == false) {
+            return false;
+        }
+#endif
+    }
+
+    return true;
+}
+
+#ifdef CONFIG_USBDEV_MSC_ASYNC
+void usbd_msc_sector_done(uint8_t busid, int status)
+{
+    bool ret = true;
+
+    g_usbd_msc[busid].storage_busy = false;
+
+    if (g_usbd_msc[busid].stage == MSC_DATA_IN) {
+        ret = usbd_msc_data_in_done(busid, status) && SCSI_processRead(busid);
+    } else if (g_usbd_msc[busid].stage == MSC_DATA_OUT) {
+        ret = usbd_msc_data_out_done(busid, status) && SCSI_processWrite(busid);
+    }
+
+    if (ret == false) {
+        usbd_msc_send_csw(busid, CSW_STATUS_CMD_FAILED); /* send fail status to host,and the host will retry*/
+    }
+}
+#endif
+
 static bool SCSI_CBWDecode(uint8_t busid, uint32_t nbytes)
 {
-    uint8_t *buf2send = g_usbd_msc[busid].block_buffer;
+    uint8_t *buf2send = g_usbd_msc[busid].block_buffer[0];
     uint32_t len2send = 0;
     bool ret = false;
 
@@ -768,6 +974,9 @@ static bool SCSI_CBWDecode(uint8_t busid, uint32_t nbytes)
 
 void mass_storage_bulk_out(uint8_t busid, uint8_t ep, uint32_t nbytes)
 {
+    size_t flags;
+    bool start;
+
     (void)ep;
 
     switch (g_usbd_msc[busid].stage) {
@@ -782,14 +991,32 @@ void mass_storage_bulk_out(uint8_t busid, uint8_t ep, uint32_t nbytes)
             switch (g_usbd_msc[busid].cbw.CB[0]) {
                 case SCSI_CMD_WRITE10:
                 case SCSI_CMD_WRITE12:
+                    flags = usb_osal_enter_critical_section();
+                    g_usbd_msc[busid].buf_len[g_usbd_msc[busid].buf_tail] = nbytes;
+                    g_usbd_msc[busid].buf_tail = (g_usbd_msc[busid].buf_tail + 1) % CONFIG_USBDEV_MSC_BUFNUM;
+                    g_usbd_msc[busid].buf_count++;
+                    g_usbd_msc[busid].ep_busy = false;
+                    /* receive next chunk while storage programs this one */
+                    start = !g_usbd_msc[busid].xfer_err && g_usbd_msc[busid].out_len && (g_usbd_msc[busid].buf_count < CONFIG_USBDEV_MSC_BUFNUM);
+                    if (start) {
+                        g_usbd_msc[busid].ep_busy = true;
+                    }
+                    usb_osal_leave_critical_section(flags);
+
+                    if (g_usbd_msc[busid].xfer_err) {
+                        usbd_msc_send_csw(busid, CSW_STATUS_CMD_FAILED);
+                        break;
+                    }
+
+                    if (start) {
+                        usbd_msc_start_data_out(busid);
+                    }
 #if defined(CONFIG_USBDEV_MSC_THREAD)
-                    g_usbd_msc[busid].nbytes = nbytes;
-                    usb_osal_mq_send(g_usbd_msc[busid].usbd_msc_mq, MSC_DATA_OUT);
+                    usbd_msc_thread_wakeup(busid);
 #elif defined(CONFIG_USBDEV_MSC_POLLING)
-                    g_usbd_msc[busid].nbytes = nbytes;
                     g_usbd_msc[busid].event = MSC_DATA_OUT;
 #else
-                    if (SCSI_processWrite(busid, nbytes) == false) {
+                    if (SCSI_processWrite(busid) == false) {
                         usbd_msc_send_csw(busid, CSW_STATUS_CMD_FAILED); /* send fail status to host,and the host will retry*/
                     }
 #endif
@@ -805,6 +1032,10 @@ void mass_storage_bulk_out(uint8_t busid, uint8_t ep, uint32_t nbytes)
 
 void mass_storage_bulk_in(uint8_t busid, uint8_t ep, uint32_t nbytes)
 {
+    size_t flags;
+    bool start;
+    bool done;
+
     (void)ep;
     (void)nbytes;
 
@@ -813,8 +1044,29 @@ void mass_storage_bulk_in(uint8_t busid, uint8_t ep, uint32_t nbytes)
             switch (g_usbd_msc[busid].cbw.CB[0]) {
                 case SCSI_CMD_READ10:
                 case SCSI_CMD_READ12:
+                    flags = usb_osal_enter_critical_section();
+                    g_usbd_msc[busid].buf_head = (g_usbd_msc[busid].buf_head + 1) % CONFIG_USBDEV_MSC_BUFNUM;
+                    g_usbd_msc[busid].buf_count--;
+                    /* next chunk may be already read from storage */
+                    start = (g_usbd_msc[busid].buf_count != 0);
+                    if (start) {
+                        g_usbd_msc[busid].csw.dDataResidue -= g_usbd_msc[busid].buf_len[g_usbd_msc[busid].buf_head];
+                    }
+                    g_usbd_msc[busid].ep_busy = start;
+                    done = (g_usbd_msc[busid].nsectors == 0) || g_usbd_msc[busid].xfer_err;
+                    usb_osal_leave_critical_section(flags);
+
+                    if (start) {
+                        usbd_msc_start_data_in(busid);
+                    } else if (done) {
+                        usbd_msc_send_csw(busid, g_usbd_msc[busid].xfer_err ? CSW_STATUS_CMD_FAILED : CSW_STATUS_CMD_PASSED);
+                    }
+
+                    if (done) {
+                        break;
+                    }
 #if defined(CONFIG_USBDEV_MSC_THREAD)
-                    usb_osal_mq_send(g_usbd_msc[busid].usbd_msc_mq, MSC_DATA_IN);
+                    usbd_msc_thread_wakeup(busid);
 #elif defined(CONFIG_USBDEV_MSC_POLLING)
                     g_usbd_msc[busid].event = MSC_DATA_IN;
 #else
@@ -845,10 +1097,50 @@ void mass_storage_bulk_in(uint8_t busid, uint8_t ep, uint32_t nbytes)
     }
 }
 
+#if defined(CONFIG_USBDEV_MSC_THREAD) || defined(CONFIG_USBDEV_MSC_POLLING)
+/* run storage for the current stage, a wakeup that is no longer needed does nothing */
+static void usbd_msc_process(uint8_t busid)
+{
+    bool ret = true;
+
+    if (g_usbd_msc[busid].stage == MSC_DATA_OUT) {
+        ret = SCSI_processWrite(busid);
+    } else if (g_usbd_msc[busid].stage == MSC_DATA_IN) {
+        ret = SCSI_processRead(busid);
+    }
+
+    if (ret == false) {
+        usbd_msc_send_csw(busid, CSW_STATUS_CMD_FAILED); /* send fail status to host,and the host will retry*/
+    }
+}
+#endif
+
 #if defined(CONFIG_USBDEV_MSC_THREAD)
+/* at most one wakeup is queued, so usbd_msc_mq never overflows */
+static void usbd_msc_thread_wakeup(uint8_t busid)
+{
+    size_t flags;
+    bool send;
+    int ret;
+
+    flags = usb_osal_enter_critical_section();
+    send = !g_usbd_msc[busid].thread_pending;
+    g_usbd_msc[busid].thread_pending = true;
+    usb_osal_leave_critical_section(flags);
+
+    if (send) {
+        ret = usb_osal_mq_send(g_usbd_msc[busid].usbd_msc_mq, 0);
+        if (ret < 0) {
+            g_usbd_msc[busid].thread_pending = false;
+            USB_LOG_ERR("msc thread wakeup failed %d\r\n", ret);
+        }
+    }
+}
+
 static void usbdev_msc_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
 {
     uintptr_t event;
+    size_t flags;
     int ret;
     uint8_t busid = (uint8_t)CONFIG_USB_OSAL_THREAD_GET_ARGV;
 
@@ -857,37 +1149,20 @@ static void usbdev_msc_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
         if (ret < 0) {
             continue;
         }
-        if (event == MSC_DATA_OUT) {
-            if (SCSI_processWrite(busid, g_usbd_msc[busid].nbytes) == false) {
-                usbd_msc_send_csw(busid, CSW_STATUS_CMD_FAILED); /* send fail status to host,and the host will retry*/
-            }
-        } else if (event == MSC_DATA_IN) {
-            if (SCSI_processRead(busid) == false) {
-                usbd_msc_send_csw(busid, CSW_STATUS_CMD_FAILED); /* send fail status to host,and the host will retry*/
-            }
-        } else {
-        }
+
+        flags = usb_osal_enter_critical_section();
+        g_usbd_msc[busid].thread_pending = false;
+        usb_osal_leave_critical_section(flags);
+
+        usbd_msc_process(busid);
     }
 }
 #elif defined(CONFIG_USBDEV_MSC_POLLING)
 void usbd_msc_polling(uint8_t busid)
 {
-    uint8_t event;
-
-    event = g_usbd_msc[busid].event;
-
-    if (event != 0) {
+    if (g_usbd_msc[busid].event != 0) {
         g_usbd_msc[busid].event = 0;
-        if (event == MSC_DATA_OUT) {
-            if (SCSI_processWrite(busid, g_usbd_msc[busid].nbytes) == false) {
-                usbd_msc_send_csw(busid, CSW_STATUS_CMD_FAILED); /* send fail status to host,and the host will retry*/
-            }
-        } else if (event == MSC_DATA_IN) {
-            if (SCSI_processRead(busid) == false) {
-                usbd_msc_send_csw(busid, CSW_STATUS_CMD_FAILED); /* send fail status to host,and the host will retry*/
-            }
-        } else {
-        }
+        usbd_msc_process(busid);
     }
 }
 #endif
@@ -962,4 +1237,18 @@ __WEAK int usbd_msc_sector_write(uint8_t busid, uint8_t lun, uint32_t sector, ui
     (void)length;
 
     return 0;
-}
\ No newline at end of file
+}
+
+#ifdef CONFIG_USBDEV_MSC_ASYNC
+__WEAK int usbd_msc_sector_read_async(uint8_t busid, uint8_t lun, uint32_t sector, uint8_t *buffer, uint32_t length)
+{
+    usbd_msc_sector_done(busid, usbd_msc_sector_read(busid, lun, sector, buffer, length));
+    return 0;
+}
+
+__WEAK int usbd_msc_sector_write_async(uint8_t busid, uint8_t lun, uint32_t sector, uint8_t *buffer, uint32_t length)
+{
+    usbd_msc_sector_done(busid, usbd_msc_sector_write(busid, lun, sector, buffer, length));
+    return 0;
+}
+#endif
@@ -22,6 +22,15 @@ void usbd_msc_get_cap(uint8_t busid, uint8_t lun, uint32_t *block_num, uint32_t
 int usbd_msc_sector_read(uint8_t busid, uint8_t lun, uint32_t sector, uint8_t *buffer, uint32_t length);
 int usbd_msc_sector_write(uint8_t busid, uint8_t lun, uint32_t sector, uint8_t *buffer, uint32_t length);
 
+#ifdef CONFIG_USBDEV_MSC_ASYNC
+/* Start sector i/o and return 0, call usbd_msc_sector_done when finished, isr context is allowed.
+ * Only one request is in flight per bus. Default ones call the sync api.
+ */
+int usbd_msc_sector_read_async(uint8_t busid, uint8_t lun, uint32_t sector, uint8_t *buffer, uint32_t length);
+int usbd_msc_sector_write_async(uint8_t busid, uint8_t lun, uint32_t sector, uint8_t *buffer, uint32_t length);
+void usbd_msc_sector_done(uint8_t busid, int status);
+#endif
+
 void usbd_msc_set_readonly(uint8_t busid, bool readonly);
 bool usbd_msc_get_popup(uint8_t busid);
 
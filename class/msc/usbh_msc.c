@@ -323,6 +323,12 @@ static int usbh_msc_connect(struct usbh_hubport *hport, uint8_t intf)
 
     USB_LOG_INFO("Register MSC Class:%s\r\n", hport->config.intf[intf].devname);
 
+#ifdef CONFIG_USB_DCACHE_ENABLE
+    usbh_msc_bounce_init();
+#endif
+#ifdef CONFIG_USBHOST_MSC_CACHE
+    usbh_msc_cache_attach(msc_class);
+#endif
     usbh_msc_run(msc_class);
     return ret;
 }
@@ -348,6 +354,9 @@ static int usbh_msc_disconnect(struct usbh_hubport *hport, uint8_t intf)
             usbh_msc_stop(msc_class);
         }
 
+#ifdef CONFIG_USBHOST_MSC_CACHE
+        usbh_msc_cache_detach(msc_class);
+#endif
         usbh_msc_class_free(msc_class);
     }
 
@@ -9,6 +9,31 @@
 #include "usb_msc.h"
 #include "usb_scsi.h"
 
+#ifdef CONFIG_USB_DCACHE_ENABLE
+#ifndef CONFIG_USBHOST_MSC_BOUNCE_NUM
+#define CONFIG_USBHOST_MSC_BOUNCE_NUM 2
+#endif
+
+#ifndef CONFIG_USBHOST_MSC_BOUNCE_BUFSIZE
+#define CONFIG_USBHOST_MSC_BOUNCE_BUFSIZE 4096
+#endif
+#endif
+
+#ifdef CONFIG_USBHOST_MSC_CACHE
+#ifndef CONFIG_USBHOST_MSC_CACHE_LINES
+#define CONFIG_USBHOST_MSC_CACHE_LINES 8
+#endif
+
+/* must be power of 2 and not larger than 32 */
+#ifndef CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS
+#define CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS 4
+#endif
+
+#ifndef CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS
+#define CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS 16
+#endif
+#endif
+
 struct usbh_msc {
     struct usbh_hubport *hport;
     struct usb_endpoint_descriptor *bulkin;  /* Bulk IN endpoint */
@@ -36,6 +61,48 @@ int usbh_msc_scsi_init(struct usbh_msc *msc_class);
 int usbh_msc_scsi_write10(struct usbh_msc *msc_class, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors);
 int usbh_msc_scsi_read10(struct usbh_msc *msc_class, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors);
 
+#ifdef CONFIG_USB_DCACHE_ENABLE
+/* unaligned buffers go through a fixed pool of aligned noncache buffers */
+void usbh_msc_bounce_init(void);
+int usbh_msc_bounce_read10(struct usbh_msc *msc_class, uint32_t start_sector, uint8_t *buffer, uint32_t nsectors);
+int usbh_msc_bounce_write10(struct usbh_msc *msc_class, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors);
+#else
+static inline int usbh_msc_bounce_read10(struct usbh_msc *msc_class, uint32_t start_sector, uint8_t *buffer, uint32_t nsectors)
+{
+    return usbh_msc_scsi_read10(msc_class, start_sector, buffer, nsectors);
+}
+
+static inline int usbh_msc_bounce_write10(struct usbh_msc *msc_class, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors)
+{
+    return usbh_msc_scsi_write10(msc_class, start_sector, buffer, nsectors);
+}
+#endif
+
+#ifdef CONFIG_USBHOST_MSC_CACHE
+/* sector cache for 512 bytes sector devices, other devices are passed through */
+int usbh_msc_cache_read(struct usbh_msc *msc_class, uint32_t start_sector, uint8_t *buffer, uint32_t nsectors);
+int usbh_msc_cache_write(struct usbh_msc *msc_class, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors);
+int usbh_msc_cache_flush(struct usbh_msc *msc_class);
+void usbh_msc_cache_attach(struct usbh_msc *msc_class);
+void usbh_msc_cache_detach(struct usbh_msc *msc_class);
+#else
+static inline int usbh_msc_cache_read(struct usbh_msc *msc_class, uint32_t start_sector, uint8_t *buffer, uint32_t nsectors)
+{
+    return usbh_msc_bounce_read10(msc_class, start_sector, buffer, nsectors);
+}
+
+static inline int usbh_msc_cache_write(struct usbh_msc *msc_class, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors)
+{
+    return usbh_msc_bounce_write10(msc_class, start_sector, buffer, nsectors);
+}
+
+static inline int usbh_msc_cache_flush(struct usbh_msc *msc_class)
+{
+    (void)msc_class;
+    return 0;
+}
+#endif
+
 void usbh_msc_run(struct usbh_msc *msc_class);
 void usbh_msc_stop(struct usbh_msc *msc_class);
 
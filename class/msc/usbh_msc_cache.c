@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2024, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usbh_core.h"
+#include "usbh_msc.h"
+
+#undef USB_DBG_TAG
+#define USB_DBG_TAG "usbh_msc_cache"
+#include "usb_log.h"
+
+#ifdef CONFIG_USB_DCACHE_ENABLE
+#if (CONFIG_USBHOST_MSC_BOUNCE_BUFSIZE % CONFIG_USB_ALIGN_SIZE) != 0
+#error CONFIG_USBHOST_MSC_BOUNCE_BUFSIZE must be multiple of CONFIG_USB_ALIGN_SIZE
+#endif
+
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_msc_bounce_buf[CONFIG_USBHOST_MSC_BOUNCE_NUM][CONFIG_USBHOST_MSC_BOUNCE_BUFSIZE];
+
+/* holds addresses of free bounce buffers */
+static usb_osal_mq_t g_msc_bounce_mq;
+
+void usbh_msc_bounce_init(void)
+{
+    if (g_msc_bounce_mq) {
+        return;
+    }
+
+    g_msc_bounce_mq = usb_osal_mq_create(CONFIG_USBHOST_MSC_BOUNCE_NUM);
+    if (g_msc_bounce_mq == NULL) {
+        USB_LOG_ERR("Fail to create msc bounce mq\r\n");
+        return;
+    }
+
+    for (uint8_t i = 0; i < CONFIG_USBHOST_MSC_BOUNCE_NUM; i++) {
+        usb_osal_mq_send(g_msc_bounce_mq, (uintptr_t)g_msc_bounce_buf[i]);
+    }
+}
+
+static int usbh_msc_bounce_xfer(struct usbh_msc *msc_class, uint32_t start_sector, uint8_t *buffer, uint32_t nsectors, bool is_write)
+{
+    uintptr_t addr;
+    uint32_t step;
+    uint32_t count;
+    int ret = 0;
+
+    step = CONFIG_USBHOST_MSC_BOUNCE_BUFSIZE / msc_class->blocksize;
+    if ((step == 0) || (g_msc_bounce_mq == NULL)) {
+        USB_LOG_ERR("No bounce buffer for block size %u\r\n", msc_class->blocksize);
+        return -USB_ERR_NOMEM;
+    }
+
+    ret = usb_osal_mq_recv(g_msc_bounce_mq, &addr, USB_OSAL_WAITING_FOREVER);
+    if (ret < 0) {
+        return ret;
+    }
+
+    while (nsectors) {
+        count = MIN(step, nsectors);
+        if (is_write) {
+            usb_memcpy((uint8_t *)addr, buffer, count * msc_class->blocksize);
+            ret = usbh_msc_scsi_write10(msc_class, start_sector, (uint8_t *)addr, count);
+        } else {
+            ret = usbh_msc_scsi_read10(msc_class, start_sector, (uint8_t *)addr, count);
+            if (ret >= 0) {
+                usb_memcpy(buffer, (uint8_t *)addr, count * msc_class->blocksize);
+            }
+        }
+        if (ret < 0) {
+            break;
+        }
+        start_sector += count;
+        buffer += count * msc_class->blocksize;
+        nsectors -= count;
+    }
+
+    usb_osal_mq_send(g_msc_bounce_mq, addr);
+    return ret;
+}
+
+int usbh_msc_bounce_read10(struct usbh_msc *msc_class, uint32_t start_sector, uint8_t *buffer, uint32_t nsectors)
+{
+    uint8_t *align_buf;
+    int ret;
+
+    if (((uintptr_t)buffer & (CONFIG_USB_ALIGN_SIZE - 1)) == 0) {
+        return usbh_msc_scsi_read10(msc_class, start_sector, buffer, nsectors);
+    }
+
+    if ((nsectors > 1) && ((msc_class->blocksize % CONFIG_USB_ALIGN_SIZE) == 0)) {
+        /* all sectors but head fit into aligned part of caller buffer, read them there and slide into place,
+         * dma and cache maintenance never touch cache lines shared with memory outside the buffer.
+         */
+        align_buf = (uint8_t *)USB_ALIGN_UP((uintptr_t)buffer, CONFIG_USB_ALIGN_SIZE);
+        ret = usbh_msc_scsi_read10(msc_class, start_sector + 1, align_buf, nsectors - 1);
+        if (ret < 0) {
+            return ret;
+        }
+        memmove(buffer + msc_class->blocksize, align_buf, (nsectors - 1) * msc_class->blocksize);
+        nsectors = 1;
+    }
+
+    return usbh_msc_bounce_xfer(msc_class, start_sector, buffer, nsectors, false);
+}
+
+int usbh_msc_bounce_write10(struct usbh_msc *msc_class, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors)
+{
+    if (((uintptr_t)buffer & (CONFIG_USB_ALIGN_SIZE - 1)) == 0) {
+        return usbh_msc_scsi_write10(msc_class, start_sector, buffer, nsectors);
+    }
+
+    return usbh_msc_bounce_xfer(msc_class, start_sector, (uint8_t *)buffer, nsectors, true);
+}
+#endif
+
+#ifdef CONFIG_USBHOST_MSC_CACHE
+
+#if CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS > 32
+#error CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS must not be larger than 32
+#endif
+
+#if CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS < CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS
+#error CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS must not be smaller than CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS
+#endif
+
+#define MSC_CACHE_SECTOR_SIZE 512
+#define MSC_CACHE_LINE_SIZE   (CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS * MSC_CACHE_SECTOR_SIZE)
+#define MSC_CACHE_MASK(n)     (((n) >= 32) ? 0xffffffffU : ((1U << (n)) - 1))
+
+struct usbh_msc_cache_line {
+    uint32_t sector; /* first sector of line, aligned to CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS */
+    uint32_t valid;  /* bit n for sector + n */
+    uint32_t dirty;  /* bit n for sector + n, always a subset of valid */
+    uint32_t lru;
+};
+
+struct usbh_msc_cache {
+    struct usbh_msc_cache_line line[CONFIG_USBHOST_MSC_CACHE_LINES];
+    usb_osal_mutex_t mutex;
+    uint32_t tick;
+    uint32_t ra_sector;   /* first sector of read-ahead window */
+    uint32_t ra_count;    /* sectors in read-ahead window, 0 means empty */
+    uint32_t next_sector; /* sector after the last one read, for sequential detection */
+};
+
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_msc_cache_buf[CONFIG_USBHOST_MAX_MSC_CLASS][CONFIG_USBHOST_MSC_CACHE_LINES][MSC_CACHE_LINE_SIZE];
+/* also used as staging buffer when dirty sectors of several lines are coalesced */
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_msc_cache_ra_buf[CONFIG_USBHOST_MAX_MSC_CLASS][CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS * MSC_CACHE_SECTOR_SIZE];
+
+static struct usbh_msc_cache g_msc_cache[CONFIG_USBHOST_MAX_MSC_CLASS];
+
+static inline uint8_t *usbh_msc_cache_line_buf(struct usbh_msc *msc_class, uint8_t idx, uint32_t offset)
+{
+    return &g_msc_cache_buf[msc_class->sdchar - 'a'][idx][offset * MSC_CACHE_SECTOR_SIZE];
+}
+
+static int usbh_msc_cache_find(struct usbh_msc_cache *cache, uint32_t base)
+{
+    for (uint8_t i = 0; i < CONFIG_USBHOST_MSC_CACHE_LINES; i++) {
+        if (cache->line[i].valid && (cache->line[i].sector == base)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* write back dirty runs of one line */
+static int usbh_msc_cache_line_flush(struct usbh_msc *msc_class, struct usbh_msc_cache *cache, uint8_t idx)
+{
+    struct usbh_msc_cache_line *line = &cache->line[idx];
+    uint32_t start;
+    uint32_t count;
+    int ret;
+
+    start = 0;
+    while (line->dirty && (start < CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS)) {
+        if ((line->dirty & (1U << start)) == 0) {
+            start++;
+            continue;
+        }
+
+        count = 0;
+        while (((start + count) < CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS) && (line->dirty & (1U << (start + count)))) {
+            count++;
+        }
+
+        ret = usbh_msc_scsi_write10(msc_class, line->sector + start, usbh_msc_cache_line_buf(msc_class, idx, start), count);
+        if (ret < 0) {
+            return ret;
+        }
+        line->dirty &= ~(MSC_CACHE_MASK(count) << start);
+        start += count;
+    }
+    return 0;
+}
+
+static int usbh_msc_cache_line_alloc(struct usbh_msc *msc_class, struct usbh_msc_cache *cache, uint32_t base)
+{
+    uint8_t victim = 0;
+    int ret;
+
+    for (uint8_t i = 0; i < CONFIG_USBHOST_MSC_CACHE_LINES; i++) {
+        if (cache->line[i].valid == 0) {
+            victim = i;
+            break;
+        }
+        if (cache->line[i].lru < cache->line[victim].lru) {
+            victim = i;
+        }
+    }
+
+    if (cache->line[victim].dirty) {
+        ret = usbh_msc_cache_line_flush(msc_class, cache, victim);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    cache->line[victim].sector = base;
+    cache->line[victim].valid = 0;
+    cache->line[victim].dirty = 0;
+    return victim;
+}
+
+/* read whole line from device, this is the read-ahead for random access */
+static int usbh_msc_cache_line_fill(struct usbh_msc *msc_class, struct usbh_msc_cache *cache, uint32_t base)
+{
+    uint32_t count;
+    int idx;
+    int ret;
+
+    idx = usbh_msc_cache_find(cache, base);
+    if (idx >= 0) {
+        /* line is partially valid, write back dirty sectors before reading it again */
+        ret = usbh_msc_cache_line_flush(msc_class, cache, idx);
+        if (ret < 0) {
+            return ret;
+        }
+        cache->line[idx].valid = 0;
+    } else {
+        idx = usbh_msc_cache_line_alloc(msc_class, cache, base);
+        if (idx < 0) {
+            return idx;
+        }
+    }
+
+    count = MIN(CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS, msc_class->blocknum - base);
+    ret = usbh_msc_scsi_read10(msc_class, base, usbh_msc_cache_line_buf(msc_class, idx, 0), count);
+    if (ret < 0) {
+        return ret;
+    }
+    cache->line[idx].valid = MSC_CACHE_MASK(count);
+    return idx;
+}
+
+/* data read from device is older than dirty sectors in cache */
+static void usbh_msc_cache_overlay(struct usbh_msc *msc_class, struct usbh_msc_cache *cache, uint32_t start_sector, uint8_t *buffer, uint32_t nsectors)
+{
+    struct usbh_msc_cache_line *line;
+    uint32_t sector;
+
+    for (uint8_t i = 0; i < CONFIG_USBHOST_MSC_CACHE_LINES; i++) {
+        line = &cache->line[i];
+        for (uint32_t j = 0; line->dirty && (j < CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS); j++) {
+            sector = line->sector + j;
+            if ((line->dirty & (1U << j)) && (sector >= start_sector) && (sector < (start_sector + nsectors))) {
+                memcpy(&buffer[(sector - start_sector) * MSC_CACHE_SECTOR_SIZE], usbh_msc_cache_line_buf(msc_class, i, j), MSC_CACHE_SECTOR_SIZE);
+            }
+        }
+    }
+}
+
+static int usbh_msc_cache_ra_fill(struct usbh_msc *msc_class, struct usbh_msc_cache *cache, uint32_t sector)
+{
+    uint32_t count;
+    int ret;
+
+    count = MIN(CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS, msc_class->blocknum - sector);
+
+    cache->ra_count = 0;
+    ret = usbh_msc_scsi_read10(msc_class, sector, g_msc_cache_ra_buf[msc_class->sdchar - 'a'], count);
+    if (ret < 0) {
+        return ret;
+    }
+    usbh_msc_cache_overlay(msc_class, cache, sector, g_msc_cache_ra_buf[msc_class->sdchar - 'a'], count);
+    cache->ra_sector = sector;
+    cache->ra_count = count;
+    return 0;
+}
+
+static int usbh_msc_cache_read_sector(struct usbh_msc *msc_class, struct usbh_msc_cache *cache, uint32_t sector, uint8_t *buffer)
+{
+    uint32_t base = sector & ~(CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS - 1);
+    uint32_t offset = sector - base;
+    int idx;
+    int ret;
+
+    /* lines first, they hold dirty sectors which are newer than read-ahead window */
+    idx = usbh_msc_cache_find(cache, base);
+    if ((idx >= 0) && (cache->line[idx].valid & (1U << offset))) {
+        cache->line[idx].lru = ++cache->tick;
+        memcpy(buffer, usbh_msc_cache_line_buf(msc_class, idx, offset), MSC_CACHE_SECTOR_SIZE);
+        return 0;
+    }
+
+    if (cache->ra_count && (sector >= cache->ra_sector) && (sector < (cache->ra_sector + cache->ra_count))) {
+        memcpy(buffer, &g_msc_cache_ra_buf[msc_class->sdchar - 'a'][(sector - cache->ra_sector) * MSC_CACHE_SECTOR_SIZE], MSC_CACHE_SECTOR_SIZE);
+        return 0;
+    }
+
+    if ((sector == cache->next_sector) && (idx < 0)) {
+        /* sequential access, fetch a whole window with one READ(10) */
+        ret = usbh_msc_cache_ra_fill(msc_class, cache, sector);
+        if (ret < 0) {
+            return ret;
+        }
+        memcpy(buffer, g_msc_cache_ra_buf[msc_class->sdchar - 'a'], MSC_CACHE_SECTOR_SIZE);
+        return 0;
+    }
+
+    idx = usbh_msc_cache_line_fill(msc_class, cache, base);
+    if (idx < 0) {
+        return idx;
+    }
+    cache->line[idx].lru = ++cache->tick;
+    memcpy(buffer, usbh_msc_cache_line_buf(msc_class, idx, offset), MSC_CACHE_SECTOR_SIZE);
+    return 0;
+}
+
+/* keep cached copies in step with data written straight to device */
+static void usbh_msc_cache_update(struct usbh_msc *msc_class, struct usbh_msc_cache *cache, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors)
+{
+    struct usbh_msc_cache_line *line;
+    uint32_t sector;
+
+    for (uint8_t i = 0; i < CONFIG_USBHOST_MSC_CACHE_LINES; i++) {
+        line = &cache->line[i];
+        if (!line->valid || ((line->sector + CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS) <= start_sector) || (line->sector >= (start_sector + nsectors))) {
+            continue;
+        }
+        for (uint32_t j = 0; j < CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS; j++) {
+            sector = line->sector + j;
+            if ((sector >= start_sector) && (sector < (start_sector + nsectors))) {
+                memcpy(usbh_msc_cache_line_buf(msc_class, i, j), &buffer[(sector - start_sector) * MSC_CACHE_SECTOR_SIZE], MSC_CACHE_SECTOR_SIZE);
+                line->valid |= (1U << j);
+                line->dirty &= ~(1U << j);
+            }
+        }
+    }
+}
+
+static void usbh_msc_cache_ra_update(struct usbh_msc *msc_class, struct usbh_msc_cache *cache, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors)
+{
+    uint32_t first;
+    uint32_t last;
+
+    if (cache->ra_count == 0) {
+        return;
+    }
+
+    first = MAX(start_sector, cache->ra_sector);
+    last = MIN(start_sector + nsectors, cache->ra_sector + cache->ra_count);
+    if (first >= last) {
+        return;
+    }
+
+    memcpy(&g_msc_cache_ra_buf[msc_class->sdchar - 'a'][(first - cache->ra_sector) * MSC_CACHE_SECTOR_SIZE],
+           &buffer[(first - start_sector) * MSC_CACHE_SECTOR_SIZE],
+           (last - first) * MSC_CACHE_SECTOR_SIZE);
+}
+
+int usbh_msc_cache_read(struct usbh_msc *msc_class, uint32_t start_sector, uint8_t *buffer, uint32_t nsectors)
+{
+    struct usbh_msc_cache *cache = &g_msc_cache[msc_class->sdchar - 'a'];
+    int ret = 0;
+
+    if ((msc_class->blocksize != MSC_CACHE_SECTOR_SIZE) || (cache->mutex == NULL)) {
+        return usbh_msc_bounce_read10(msc_class, start_sector, buffer, nsectors);
+    }
+
+    usb_osal_mutex_take(cache->mutex);
+
+    if (nsectors >= CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS) {
+        /* large read goes straight to buffer, then dirty sectors in cache overlay the old data */
+        ret = usbh_msc_bounce_read10(msc_class, start_sector, buffer, nsectors);
+        if (ret >= 0) {
+            usbh_msc_cache_overlay(msc_class, cache, start_sector, buffer, nsectors);
+            cache->next_sector = start_sector + nsectors;
+        }
+    } else {
+        for (uint32_t i = 0; i < nsectors; i++) {
+            ret = usbh_msc_cache_read_sector(msc_class, cache, start_sector + i, &buffer[i * MSC_CACHE_SECTOR_SIZE]);
+            if (ret < 0) {
+                break;
+            }
+            cache->next_sector = start_sector + i + 1;
+        }
+    }
+
+    usb_osal_mutex_give(cache->mutex);
+    return ret < 0 ? ret : 0;
+}
+
+int usbh_msc_cache_write(struct usbh_msc *msc_class, uint32_t start_sector, const uint8_t *buffer, uint32_t nsectors)
+{
+    struct usbh_msc_cache *cache = &g_msc_cache[msc_class->sdchar - 'a'];
+    uint32_t sector;
+    uint32_t base;
+    int idx;
+    int ret = 0;
+
+    if ((msc_class->blocksize != MSC_CACHE_SECTOR_SIZE) || (cache->mutex == NULL)) {
+        return usbh_msc_bounce_write10(msc_class, start_sector, buffer, nsectors);
+    }
+
+    usb_osal_mutex_take(cache->mutex);
+
+    usbh_msc_cache_ra_update(msc_class, cache, start_sector, buffer, nsectors);
+
+    if (nsectors >= CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS) {
+        /* large write goes through, cached copies take the new data and become clean */
+        ret = usbh_msc_bounce_write10(msc_class, start_sector, buffer, nsectors);
+        if (ret >= 0) {
+            usbh_msc_cache_update(msc_class, cache, start_sector, buffer, nsectors);
+        }
+    } else {
+        /* small write stays in cache until flush or eviction */
+        for (uint32_t i = 0; i < nsectors; i++) {
+            sector = start_sector + i;
+            base = sector & ~(CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS - 1);
+
+            idx = usbh_msc_cache_find(cache, base);
+            if (idx < 0) {
+                idx = usbh_msc_cache_line_alloc(msc_class, cache, base);
+                if (idx < 0) {
+                    ret = idx;
+                    break;
+                }
+            }
+
+            memcpy(usbh_msc_cache_line_buf(msc_class, idx, sector - base), &buffer[i * MSC_CACHE_SECTOR_SIZE], MSC_CACHE_SECTOR_SIZE);
+            cache->line[idx].valid |= (1U << (sector - base));
+            cache->line[idx].dirty |= (1U << (sector - base));
+            cache->line[idx].lru = ++cache->tick;
+        }
+    }
+
+    usb_osal_mutex_give(cache->mutex);
+    return ret < 0 ? ret : 0;
+}
+
+int usbh_msc_cache_flush(struct usbh_msc *msc_class)
+{
+    struct usbh_msc_cache *cache = &g_msc_cache[msc_class->sdchar - 'a'];
+    uint8_t *staging = g_msc_cache_ra_buf[msc_class->sdchar - 'a'];
+    uint8_t order[CONFIG_USBHOST_MSC_CACHE_LINES];
+    uint8_t num = 0;
+    uint8_t tmp;
+    uint32_t run_start = 0;
+    uint32_t run_len = 0;
+    uint32_t sector;
+    int ret = 0;
+
+    if (cache->mutex == NULL) {
+        return 0;
+    }
+
+    usb_osal_mutex_take(cache->mutex);
+
+    /* sort dirty lines by sector so that adjacent dirty sectors of different lines meet */
+    for (uint8_t i = 0; i < CONFIG_USBHOST_MSC_CACHE_LINES; i++) {
+        if (cache->line[i].dirty) {
+            order[num++] = i;
+            for (uint8_t j = num - 1; (j > 0) && (cache->line[order[j - 1]].sector > cache->line[order[j]].sector); j--) {
+                tmp = order[j];
+                order[j] = order[j - 1];
+                order[j - 1] = tmp;
+            }
+        }
+    }
+
+    if (num == 0) {
+        goto out;
+    }
+
+    /* staging buffer is shared with read-ahead window */
+    cache->ra_count = 0;
+
+    for (uint8_t i = 0; i < num; i++) {
+        for (uint32_t j = 0; j < CONFIG_USBHOST_MSC_CACHE_LINE_SECTORS; j++) {
+            if ((cache->line[order[i]].dirty & (1U << j)) == 0) {
+                continue;
+            }
+
+            sector = cache->line[order[i]].sector + j;
+            if (run_len && ((sector != (run_start + run_len)) || (run_len == CONFIG_USBHOST_MSC_CACHE_READAHEAD_SECTORS))) {
+                ret = usbh_msc_scsi_write10(msc_class, run_start, staging, run_len);
+                if (ret < 0) {
+                    goto out;
+                }
+                run_len = 0;
+            }
+
+            if (run_len == 0) {
+                run_start = sector;
+            }
+            memcpy(&staging[run_len * MSC_CACHE_SECTOR_SIZE], usbh_msc_cache_line_buf(msc_class, order[i], j), MSC_CACHE_SECTOR_SIZE);
+            run_len++;
+        }
+    }
+
+    if (run_len) {
+        ret = usbh_msc_scsi_write10(msc_class, run_start, staging, run_len);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    for (uint8_t i = 0; i < num; i++) {
+        cache->line[order[i]].dirty = 0;
+    }
+
+out:
+    usb_osal_mutex_give(cache->mutex);
+    return ret < 0 ? ret : 0;
+}
+
+void usbh_msc_cache_attach(struct usbh_msc *msc_class)
+{
+    struct usbh_msc_cache *cache = &g_msc_cache[msc_class->sdchar - 'a'];
+
+    memset(cache, 0, sizeof(struct usbh_msc_cache));
+    cache->next_sector = 0xffffffff;
+    cache->mutex = usb_osal_mutex_create();
+    if (cache->mutex == NULL) {
+        USB_LOG_WRN("Fail to create msc cache mutex, cache is bypassed\r\n");
+    }
+}
+
+void usbh_msc_cache_detach(struct usbh_msc *msc_class)
+{
+    struct usbh_msc_cache *cache = &g_msc_cache[msc_class->sdchar - 'a'];
+
+    for (uint8_t i = 0; i < CONFIG_USBHOST_MSC_CACHE_LINES; i++) {
+        if (cache->line[i].dirty) {
+            USB_LOG_WRN("Drop dirty sectors of disconnected msc device\r\n");
+            break;
+        }
+    }
+
+    if (cache->mutex) {
+        usb_osal_mutex_delete(cache->mutex);
+    }
+    memset(cache, 0, sizeof(struct usbh_msc_cache));
+}
+#endif
@@ -20,14 +20,20 @@
 #define DESC_bNumFrameDescriptors 4 /** Descriptor numframe offset */
 #define DESC_bFormatIndex         3 /** Descriptor format index offset */
 #define DESC_bFrameIndex          3 /** Descriptor frame index offset */
+#define DESC_guidFormat           5 /** Descriptor format guid offset */
+#define DESC_wWidth               5 /** Descriptor frame width offset */
+#define DESC_wHeight              7 /** Descriptor frame height offset */
 
 /* interface descriptor field offsets */
 #define INTF_DESC_bInterfaceNumber  2 /** Interface number offset */
 #define INTF_DESC_bAlternateSetting 3 /** Alternate setting offset */
 
 USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_video_buf[USB_ALIGN_UP(128, CONFIG_USB_ALIGN_SIZE)];
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_video_stream_buf[CONFIG_USBHOST_MAX_VIDEO_CLASS][CONFIG_USBHOST_VIDEO_URB_NUM][USB_ALIGN_UP(CONFIG_USBHOST_VIDEO_URB_BUFSIZE, CONFIG_USB_ALIGN_SIZE)];
 
-static const char *format_type[] = { "uncompressed", "mjpeg" };
+static void usbh_video_stream_complete(void *arg, int nbytes);
+
+static const char *format_type[] = { "uncompressed", "mjpeg", "h264" };
 
 static struct usbh_video g_video_class[CONFIG_USBHOST_MAX_VIDEO_CLASS];
 static uint32_t g_devinuse = 0;
@@ -271,6 +277,8 @@ int usbh_video_open(struct usbh_video *video_class,
     USB_LOG_INFO("Open video and select formatidx:%u, frameidx:%u, altsetting:%u\r\n", formatidx, frameidx, altsetting);
     video_class->is_opened = true;
     video_class->current_format = format_type;
+    video_class->current_width = wWidth;
+    video_class->current_height = wHeight;
     return ret;
 
 errout:
@@ -290,6 +298,8 @@ int usbh_video_close(struct usbh_video *video_class)
 
     USB_LOG_INFO("Close video device\r\n");
 
+    usbh_video_stream_stop(video_class);
+
     video_class->is_opened = false;
 
     if (video_class->isoin) {
@@ -359,6 +369,388 @@ void usbh_video_list_info(struct usbh_video *video_class)
     USB_LOG_INFO("============= Video device information ===================\r\n");
 }
 
+static struct usbh_videoframe *usbh_video_frame_alloc(struct usbh_video_stream *stream)
+{
+    struct usbh_videoframe *frame = NULL;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    if (stream->free_num) {
+        frame = stream->free_frame[--stream->free_num];
+    }
+    usb_osal_leave_critical_section(flags);
+    return frame;
+}
+
+static bool usbh_video_frame_check(struct usbh_video *video_class, struct usbh_videoframe *frame)
+{
+    uint32_t expect_size;
+
+    switch (video_class->current_format) {
+        case USBH_VIDEO_FORMAT_MJPEG:
+            /* frame must start with jpeg SOI, otherwise head of the frame is lost */
+            return (frame->frame_size >= 2) && (frame->frame_buf[0] == 0xff) && (frame->frame_buf[1] == 0xd8);
+        case USBH_VIDEO_FORMAT_UNCOMPRESSED:
+            for (uint8_t i = 0; i < video_class->num_of_formats; i++) {
+                if (video_class->format[i].format_type == USBH_VIDEO_FORMAT_UNCOMPRESSED) {
+                    expect_size = (uint32_t)video_class->current_width * video_class->current_height * video_class->format[i].bits_per_pixel / 8;
+                    return (expect_size == 0) || (frame->frame_size == expect_size);
+                }
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+static void usbh_video_frame_end(struct usbh_video *video_class)
+{
+    struct usbh_video_stream *stream = &video_class->stream;
+    struct usbh_videoframe *frame = stream->cur_frame;
+
+    stream->in_frame = false;
+
+    if (frame == NULL) {
+        if (stream->frame_lost) {
+            stream->stat.dropped++;
+            stream->frame_lost = false;
+        }
+        return;
+    }
+
+    if (frame->frame_size == 0) {
+        stream->frame_error = false;
+        return;
+    }
+
+    if (stream->frame_error || !usbh_video_frame_check(video_class, frame)) {
+        /* keep the buffer for next frame */
+        stream->stat.corrupt++;
+        stream->frame_error = false;
+        frame->frame_size = 0;
+        return;
+    }
+
+    stream->cur_frame = NULL;
+    if (usb_osal_mq_send(stream->frame_mq, (uintptr_t)frame) < 0) {
+        usbh_video_frame_put(video_class, frame);
+        stream->stat.dropped++;
+        return;
+    }
+    stream->stat.frames++;
+}
+
+static void usbh_video_frame_begin(struct usbh_video *video_class, uint8_t info)
+{
+    struct usbh_video_stream *stream = &video_class->stream;
+    struct usbh_videoframe *frame;
+
+    stream->in_frame = true;
+    stream->frame_error = false;
+
+    if (stream->cur_frame == NULL) {
+        stream->cur_frame = usbh_video_frame_alloc(stream);
+        if (stream->cur_frame == NULL) {
+            /* application holds all buffers, drop the whole frame */
+            stream->frame_lost = true;
+            return;
+        }
+    }
+
+    frame = stream->cur_frame;
+    frame->frame_format = video_class->current_format;
+    frame->frame_size = 0;
+    frame->pts = 0;
+    frame->scr_stc = 0;
+    frame->scr_sof = 0;
+    frame->flags = (info & USBH_VIDEO_PAYLOAD_STI) ? USBH_VIDEO_FRAME_FLAG_STILL : 0;
+}
+
+static void usbh_video_frame_append(struct usbh_video *video_class, uint8_t *buf, uint32_t len)
+{
+    struct usbh_video_stream *stream = &video_class->stream;
+    struct usbh_videoframe *frame = stream->cur_frame;
+
+    if (!stream->in_frame || (frame == NULL) || (len == 0)) {
+        return;
+    }
+
+    if ((frame->frame_size + len) > frame->frame_bufsize) {
+        stream->frame_error = true;
+        return;
+    }
+
+    memcpy(&frame->frame_buf[frame->frame_size], buf, len);
+    frame->frame_size += len;
+}
+
+/* parse one payload: header with FID/EOF/ERR/PTS/SCR followed by frame data */
+static void usbh_video_stream_payload(struct usbh_video *video_class, uint8_t *buf, uint32_t len)
+{
+    struct usbh_video_stream *stream = &video_class->stream;
+    struct usbh_videoframe *frame;
+    uint8_t header_len;
+    uint8_t info;
+    uint8_t offset;
+    uint8_t fid;
+
+    if (len < 2) {
+        return;
+    }
+
+    header_len = buf[0];
+    info = buf[1];
+    if ((header_len < 2) || (header_len > len)) {
+        stream->frame_error = true;
+        return;
+    }
+
+    fid = info & USBH_VIDEO_PAYLOAD_FID;
+
+    /* fid toggles on a new frame, some devices never set EOF */
+    if (stream->in_frame && (fid != stream->last_fid)) {
+        usbh_video_frame_end(video_class);
+    }
+    stream->last_fid = fid;
+
+    if (!stream->in_frame) {
+        usbh_video_frame_begin(video_class, info);
+    }
+
+    frame = stream->cur_frame;
+    if (info & USBH_VIDEO_PAYLOAD_ERR) {
+        stream->frame_error = true;
+    }
+
+    offset = 2;
+    if ((info & USBH_VIDEO_PAYLOAD_PTS) && ((offset + 4) <= header_len)) {
+        if (frame && !(frame->flags & USBH_VIDEO_FRAME_FLAG_PTS)) {
+            frame->pts = buf[offset] | ((uint32_t)buf[offset + 1] << 8) | ((uint32_t)buf[offset + 2] << 16) | ((uint32_t)buf[offset + 3] << 24);
+            frame->flags |= USBH_VIDEO_FRAME_FLAG_PTS;
+        }
+        offset += 4;
+    }
+    if ((info & USBH_VIDEO_PAYLOAD_SCR) && ((offset + 6) <= header_len)) {
+        if (frame) {
+            frame->scr_stc = buf[offset] | ((uint32_t)buf[offset + 1] << 8) | ((uint32_t)buf[offset + 2] << 16) | ((uint32_t)buf[offset + 3] << 24);
+            frame->scr_sof = (buf[offset + 4] | ((uint16_t)buf[offset + 5] << 8)) & 0x7ff;
+            frame->flags |= USBH_VIDEO_FRAME_FLAG_SCR;
+        }
+    }
+
+    usbh_video_frame_append(video_class, &buf[header_len], len - header_len);
+
+    if (info & USBH_VIDEO_PAYLOAD_EOF) {
+        usbh_video_frame_end(video_class);
+    }
+}
+
+static int usbh_video_stream_submit(struct usbh_video *video_class, struct usbh_video_urb *vurb, uint8_t index)
+{
+    struct usbh_video_stream *stream = &video_class->stream;
+    uint8_t *buf = g_video_stream_buf[video_class->minor][index];
+
+    if (USB_GET_ENDPOINT_TYPE(video_class->isoin->bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
+        usbh_iso_urb_fill(&vurb->urb, video_class->hport, video_class->isoin, stream->iso_packets, usbh_video_stream_complete, vurb);
+#if defined(__ICCARM__) || defined(__ICCRISCV__) || defined(__ICCRX__)
+        vurb->urb.iso_packet = vurb->iso_packet;
+#endif
+        for (uint8_t i = 0; i < stream->iso_packets; i++) {
+            vurb->urb.iso_packet[i].transfer_buffer = &buf[i * video_class->isoin_mps];
+            vurb->urb.iso_packet[i].transfer_buffer_length = video_class->isoin_mps;
+        }
+    } else {
+        usbh_bulk_urb_fill(&vurb->urb, video_class->hport, video_class->isoin, buf, stream->urb_len, 0, usbh_video_stream_complete, vurb);
+    }
+
+    return usbh_submit_urb(&vurb->urb);
+}
+
+static void usbh_video_stream_complete(void *arg, int nbytes)
+{
+    struct usbh_video_urb *vurb = (struct usbh_video_urb *)arg;
+    struct usbh_video *video_class = vurb->video_class;
+    struct usbh_video_stream *stream = &video_class->stream;
+    struct usbh_urb *urb = &vurb->urb;
+    uint32_t len;
+
+    if (!stream->running) {
+        return;
+    }
+
+    if (nbytes < 0) {
+        stream->frame_error = true;
+        if ((nbytes == -USB_ERR_SHUTDOWN) || (nbytes == -USB_ERR_NODEV) || (nbytes == -USB_ERR_STALL)) {
+            USB_LOG_ERR("video stream stopped, ret:%d\r\n", nbytes);
+            return;
+        }
+    } else if (USB_GET_ENDPOINT_TYPE(video_class->isoin->bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
+        /* every iso packet carries one payload with its own header */
+        for (uint32_t i = 0; i < urb->num_of_iso_packets; i++) {
+            if (urb->iso_packet[i].errorcode < 0) {
+                stream->frame_error = true;
+                continue;
+            }
+            usbh_video_stream_payload(video_class, urb->iso_packet[i].transfer_buffer, urb->iso_packet[i].actual_length);
+        }
+    } else {
+        len = (uint32_t)nbytes;
+        if (stream->payload_remain == 0) {
+            usbh_video_stream_payload(video_class, urb->transfer_buffer, len);
+            stream->payload_remain = (video_class->commit.dwMaxPayloadTransferSize > len) ? (video_class->commit.dwMaxPayloadTransferSize - len) : 0;
+        } else {
+            /* rest of a payload larger than urb buffer, no header */
+            usbh_video_frame_append(video_class, urb->transfer_buffer, len);
+            stream->payload_remain = (stream->payload_remain > len) ? (stream->payload_remain - len) : 0;
+        }
+        /* short packet ends the payload */
+        if (len < stream->urb_len) {
+            stream->payload_remain = 0;
+        }
+    }
+
+    usbh_video_stream_submit(video_class, vurb, vurb - stream->urb);
+}
+
+int usbh_video_stream_start(struct usbh_video *video_class, struct usbh_videoframe *frames, uint8_t frame_num)
+{
+    struct usbh_video_stream *stream;
+    uintptr_t addr;
+    int ret;
+
+    if (!video_class || !video_class->hport || !frames || (frame_num == 0)) {
+        return -USB_ERR_INVAL;
+    }
+    stream = &video_class->stream;
+
+    if (!video_class->is_opened || !video_class->isoin) {
+        return -USB_ERR_NODEV;
+    }
+
+    if (stream->running) {
+        return -USB_ERR_BUSY;
+    }
+
+    if (frame_num > CONFIG_USBHOST_VIDEO_FRAME_NUM) {
+        return -USB_ERR_RANGE;
+    }
+
+    if (USB_GET_ENDPOINT_TYPE(video_class->isoin->bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
+        stream->iso_packets = MIN(CONFIG_USBHOST_VIDEO_ISO_PACKETS, CONFIG_USBHOST_VIDEO_URB_BUFSIZE / video_class->isoin_mps);
+        if (stream->iso_packets == 0) {
+            USB_LOG_ERR("CONFIG_USBHOST_VIDEO_URB_BUFSIZE is smaller than iso mps %u\r\n", video_class->isoin_mps);
+            return -USB_ERR_RANGE;
+        }
+        stream->urb_num = CONFIG_USBHOST_VIDEO_URB_NUM;
+    } else {
+        stream->urb_len = CONFIG_USBHOST_VIDEO_URB_BUFSIZE - (CONFIG_USBHOST_VIDEO_URB_BUFSIZE % video_class->isoin_mps);
+        if (video_class->commit.dwMaxPayloadTransferSize && (video_class->commit.dwMaxPayloadTransferSize < stream->urb_len)) {
+            stream->urb_len = USB_ALIGN_UP(video_class->commit.dwMaxPayloadTransferSize, video_class->isoin_mps);
+            stream->urb_len = MIN(stream->urb_len, (uint32_t)(CONFIG_USBHOST_VIDEO_URB_BUFSIZE - (CONFIG_USBHOST_VIDEO_URB_BUFSIZE % video_class->isoin_mps)));
+        }
+#ifdef CONFIG_USBHOST_URB_QUEUE
+        stream->urb_num = CONFIG_USBHOST_VIDEO_URB_NUM;
+#else
+        /* bulk endpoint takes one urb at a time */
+        stream->urb_num = 1;
+#endif
+    }
+
+    /* drain frames left from last run */
+    while (usb_osal_mq_recv(stream->frame_mq, &addr, 0) == 0) {
+    }
+
+    stream->free_num = 0;
+    for (uint8_t i = 0; i < frame_num; i++) {
+        frames[i].frame_size = 0;
+        stream->free_frame[stream->free_num++] = &frames[i];
+    }
+    stream->cur_frame = NULL;
+    stream->payload_remain = 0;
+    stream->last_fid = 0xff;
+    stream->in_frame = false;
+    stream->frame_error = false;
+    stream->frame_lost = false;
+    memset(&stream->stat, 0, sizeof(struct usbh_video_stream_stat));
+    stream->running = true;
+
+    for (uint8_t i = 0; i < stream->urb_num; i++) {
+        memset(&stream->urb[i], 0, sizeof(struct usbh_video_urb));
+        stream->urb[i].video_class = video_class;
+        ret = usbh_video_stream_submit(video_class, &stream->urb[i], i);
+        if (ret < 0) {
+            USB_LOG_ERR("Fail to submit video urb, ret:%d\r\n", ret);
+            usbh_video_stream_stop(video_class);
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int usbh_video_stream_stop(struct usbh_video *video_class)
+{
+    struct usbh_video_stream *stream;
+
+    if (!video_class) {
+        return -USB_ERR_INVAL;
+    }
+    stream = &video_class->stream;
+
+    if (!stream->running) {
+        return 0;
+    }
+    stream->running = false;
+
+    for (uint8_t i = 0; i < stream->urb_num; i++) {
+        usbh_kill_urb(&stream->urb[i].urb);
+    }
+
+    /* frames already queued stay valid until application puts them back */
+    stream->cur_frame = NULL;
+    return 0;
+}
+
+int usbh_video_frame_get(struct usbh_video *video_class, struct usbh_videoframe **frame, uint32_t timeout)
+{
+    uintptr_t addr;
+    int ret;
+
+    if (!video_class || !video_class->stream.frame_mq || !frame) {
+        return -USB_ERR_INVAL;
+    }
+
+    ret = usb_osal_mq_recv(video_class->stream.frame_mq, &addr, timeout);
+    if (ret < 0) {
+        return ret;
+    }
+
+    *frame = (struct usbh_videoframe *)addr;
+    return 0;
+}
+
+void usbh_video_frame_put(struct usbh_video *video_class, struct usbh_videoframe *frame)
+{
+    struct usbh_video_stream *stream = &video_class->stream;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    if (stream->free_num < CONFIG_USBHOST_VIDEO_FRAME_NUM) {
+        frame->frame_size = 0;
+        stream->free_frame[stream->free_num++] = frame;
+    }
+    usb_osal_leave_critical_section(flags);
+}
+
+void usbh_video_stream_get_stat(struct usbh_video *video_class, struct usbh_video_stream_stat *stat)
+{
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    memcpy(stat, &video_class->stream.stat, sizeof(struct usbh_video_stream_stat));
+    usb_osal_leave_critical_section(flags);
+}
+
 static int usbh_video_ctrl_connect(struct usbh_hubport *hport, uint8_t intf)
 {
     int ret;
@@ -382,6 +774,12 @@ static int usbh_video_ctrl_connect(struct usbh_hubport *hport, uint8_t intf)
 
     hport->config.intf[intf].priv = video_class;
 
+    video_class->stream.frame_mq = usb_osal_mq_create(CONFIG_USBHOST_VIDEO_FRAME_NUM);
+    if (video_class->stream.frame_mq == NULL) {
+        USB_LOG_ERR("Fail to create video frame mq\r\n");
+        return -USB_ERR_NOMEM;
+    }
+
     ret = usbh_video_close(video_class);
     if (ret < 0) {
         USB_LOG_ERR("Fail to close video device\r\n");
@@ -425,6 +823,7 @@ static int usbh_video_ctrl_connect(struct usbh_hubport *hport, uint8_t intf)
 
                             video_class->format[format_index - 1].num_of_frames = num_of_frames;
                             video_class->format[format_index - 1].format_type = USBH_VIDEO_FORMAT_UNCOMPRESSED;
+                            video_class->format[format_index - 1].bits_per_pixel = ((struct video_cs_if_vs_format_uncompressed_descriptor *)p)->bBitsPerPixel;
                             break;
                         case VIDEO_VS_FORMAT_MJPEG_DESCRIPTOR_SUBTYPE:
                             format_index = p[DESC_bFormatIndex];
@@ -445,6 +844,22 @@ static int usbh_video_ctrl_connect(struct usbh_hubport *hport, uint8_t intf)
                             video_class->format[format_index - 1].frame[frame_index - 1].wWidth = ((struct video_cs_if_vs_frame_mjpeg_descriptor *)p)->wWidth;
                             video_class->format[format_index - 1].frame[frame_index - 1].wHeight = ((struct video_cs_if_vs_frame_mjpeg_descriptor *)p)->wHeight;
                             break;
+                        case VIDEO_VS_FORMAT_FRAME_BASED_DESCRIPTOR_SUBTYPE:
+                            format_index = p[DESC_bFormatIndex];
+                            num_of_frames = p[DESC_bNumFrameDescriptors];
+
+                            /* only h264 is handled among frame based formats */
+                            if (memcmp(&p[DESC_guidFormat], "H264", 4) == 0) {
+                                video_class->format[format_index - 1].num_of_frames = num_of_frames;
+                                video_class->format[format_index - 1].format_type = USBH_VIDEO_FORMAT_H264;
+                            }
+                            break;
+                        case VIDEO_VS_FRAME_FRAME_BASED_DESCRIPTOR_SUBTYPE:
+                            frame_index = p[DESC_bFrameIndex];
+
+                            video_class->format[format_index - 1].frame[frame_index - 1].wWidth = p[DESC_wWidth] | ((uint16_t)p[DESC_wWidth + 1] << 8);
+                            video_class->format[format_index - 1].frame[frame_index - 1].wHeight = p[DESC_wHeight] | ((uint16_t)p[DESC_wHeight + 1] << 8);
+                            break;
                         default:
                             break;
                     }
@@ -477,6 +892,7 @@ static int usbh_video_ctrl_disconnect(struct usbh_hubport *hport, uint8_t intf)
 
     if (video_class) {
         if (video_class->isoin) {
+            usbh_video_stream_stop(video_class);
         }
 
         if (video_class->isoout) {
@@ -488,6 +904,10 @@ static int usbh_video_ctrl_disconnect(struct usbh_hubport *hport, uint8_t intf)
             usbh_video_stop(video_class);
         }
 
+        if (video_class->stream.frame_mq) {
+            usb_osal_mq_delete(video_class->stream.frame_mq);
+        }
+
         usbh_video_class_free(video_class);
     }
 
@@ -10,6 +10,33 @@
 
 #define USBH_VIDEO_FORMAT_UNCOMPRESSED 0
 #define USBH_VIDEO_FORMAT_MJPEG        1
+#define USBH_VIDEO_FORMAT_H264         2
+
+#ifndef CONFIG_USBHOST_VIDEO_URB_NUM
+#define CONFIG_USBHOST_VIDEO_URB_NUM 2
+#endif
+#ifndef CONFIG_USBHOST_VIDEO_ISO_PACKETS
+#define CONFIG_USBHOST_VIDEO_ISO_PACKETS 8
+#endif
+#ifndef CONFIG_USBHOST_VIDEO_URB_BUFSIZE
+#define CONFIG_USBHOST_VIDEO_URB_BUFSIZE (8 * 1024)
+#endif
+#ifndef CONFIG_USBHOST_VIDEO_FRAME_NUM
+#define CONFIG_USBHOST_VIDEO_FRAME_NUM 3
+#endif
+
+/* payload header bmHeaderInfo */
+#define USBH_VIDEO_PAYLOAD_FID (1 << 0)
+#define USBH_VIDEO_PAYLOAD_EOF (1 << 1)
+#define USBH_VIDEO_PAYLOAD_PTS (1 << 2)
+#define USBH_VIDEO_PAYLOAD_SCR (1 << 3)
+#define USBH_VIDEO_PAYLOAD_STI (1 << 5)
+#define USBH_VIDEO_PAYLOAD_ERR (1 << 6)
+
+/* usbh_videoframe flags */
+#define USBH_VIDEO_FRAME_FLAG_PTS   (1 << 0) /* pts is valid */
+#define USBH_VIDEO_FRAME_FLAG_SCR   (1 << 1) /* scr_stc and scr_sof are valid */
+#define USBH_VIDEO_FRAME_FLAG_STILL (1 << 2) /* frame belongs to a still image */
 
 struct usbh_video_resolution {
     uint16_t wWidth;
@@ -20,6 +47,7 @@ struct usbh_video_format {
     struct usbh_video_resolution frame[12];
     uint8_t format_type;
     uint8_t num_of_frames;
+    uint8_t bits_per_pixel; /* uncompressed format only */
 };
 
 struct usbh_videoframe {
@@ -27,6 +55,41 @@ struct usbh_videoframe {
     uint32_t frame_bufsize;
     uint32_t frame_format;
     uint32_t frame_size;
+    uint32_t pts;
+    uint32_t scr_stc;
+    uint16_t scr_sof;
+    uint8_t flags;
+};
+
+struct usbh_video_stream_stat {
+    uint32_t frames;  /* frames handed to application */
+    uint32_t dropped; /* frames lost because no free frame buffer */
+    uint32_t corrupt; /* frames discarded for error bit, missing data or buffer overflow */
+};
+
+/* urb with room for its iso packets, iso_packet[] must follow urb directly */
+struct usbh_video_urb {
+    struct usbh_urb urb;
+    struct usbh_iso_frame_packet iso_packet[CONFIG_USBHOST_VIDEO_ISO_PACKETS];
+    struct usbh_video *video_class;
+};
+
+struct usbh_video_stream {
+    struct usbh_video_urb urb[CONFIG_USBHOST_VIDEO_URB_NUM];
+    struct usbh_videoframe *free_frame[CONFIG_USBHOST_VIDEO_FRAME_NUM];
+    struct usbh_videoframe *cur_frame;
+    usb_osal_mq_t frame_mq;
+    uint32_t payload_remain; /* bulk payload spanning several urbs */
+    uint32_t urb_len;
+    uint8_t urb_num;
+    uint8_t iso_packets;
+    uint8_t free_num;
+    uint8_t last_fid;
+    bool in_frame;
+    bool frame_error;
+    bool frame_lost;
+    bool running;
+    struct usbh_video_stream_stat stat;
 };
 
 struct usbh_videostreaming {
@@ -51,10 +114,13 @@ struct usbh_video {
     uint16_t isoout_mps;
     bool is_opened;
     uint8_t current_format;
+    uint16_t current_width;
+    uint16_t current_height;
     uint16_t bcdVDC;
     uint8_t num_of_intf_altsettings;
     uint8_t num_of_formats;
     struct usbh_video_format format[3];
+    struct usbh_video_stream stream;
 
     void *user_data;
 };
@@ -75,6 +141,15 @@ int usbh_video_close(struct usbh_video *video_class);
 
 void usbh_video_list_info(struct usbh_video *video_class);
 
+/* streaming engine, call after usbh_video_open. Finished frames are queued to application without copy,
+ * get them with usbh_video_frame_get and give them back with usbh_video_frame_put.
+ */
+int usbh_video_stream_start(struct usbh_video *video_class, struct usbh_videoframe *frames, uint8_t frame_num);
+int usbh_video_stream_stop(struct usbh_video *video_class);
+int usbh_video_frame_get(struct usbh_video *video_class, struct usbh_videoframe **frame, uint32_t timeout);
+void usbh_video_frame_put(struct usbh_video *video_class, struct usbh_videoframe *frame);
+void usbh_video_stream_get_stat(struct usbh_video *video_class, struct usbh_video_stream_stat *stat);
+
 void usbh_video_run(struct usbh_video *video_class);
 void usbh_video_stop(struct usbh_video *video_class);
 
@@ -11,22 +11,13 @@
 #define RNDIS_IN_EP_IDX  1
 #define RNDIS_INT_EP_IDX 2
 
-/* Describe EndPoints configuration */
-static struct usbd_endpoint rndis_ep_data[3];
-
 #define RNDIS_INQUIRY_PUT(src, len)   (memcpy(infomation_buffer, src, len))
 #define RNDIS_INQUIRY_PUT_LE32(value) (*(uint32_t *)infomation_buffer = (value))
 
-/* Device data structure */
-struct usbd_rndis_priv {
-    uint32_t drv_version;
-    uint32_t link_status;
-    uint32_t net_filter;
-    usb_eth_stat_t eth_state;
-    rndis_state_t init_state;
-    bool set_rsp_get;
-    uint8_t mac[6];
-} g_usbd_rndis;
+/* rndis functions over all device buses */
+#ifndef CONFIG_USBDEV_MAX_RNDIS_CLASS
+#define CONFIG_USBDEV_MAX_RNDIS_CLASS 1
+#endif
 
 #if CONFIG_USBDEV_RNDIS_RESP_BUFFER_SIZE < 140
 #undef CONFIG_USBDEV_RNDIS_RESP_BUFFER_SIZE
@@ -38,18 +29,145 @@ struct usbd_rndis_priv {
 #define CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE 1580
 #endif
 
+#if CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE > 16384
+#undef CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE
+#define CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE 16384
+#endif
+
+/* MaxPacketsPerTransfer reported to the host, small packets share one transfer
+ * even when it only holds one full size frame.
+ */
+#ifndef CONFIG_USBDEV_RNDIS_MAX_PACKETS_PER_TRANSFER
+#define CONFIG_USBDEV_RNDIS_MAX_PACKETS_PER_TRANSFER 8
+#endif
+
+#if (CONFIG_USBDEV_RNDIS_MAX_PACKETS_PER_TRANSFER < 1) || (CONFIG_USBDEV_RNDIS_MAX_PACKETS_PER_TRANSFER > 32)
+#error "CONFIG_USBDEV_RNDIS_MAX_PACKETS_PER_TRANSFER must be 1 ~ 32"
+#endif
+
+/* packet messages in one transfer start on 4 byte boundary */
+#define RNDIS_PACKET_ALIGNMENT_FACTOR 2
+#define RNDIS_PACKET_ALIGN            (1 << RNDIS_PACKET_ALIGNMENT_FACTOR)
+
+#if defined(CONFIG_USBDEV_RNDIS_ZERO_COPY) && !defined(CONFIG_USBDEV_RNDIS_USING_LWIP)
+#error "CONFIG_USBDEV_RNDIS_ZERO_COPY needs CONFIG_USBDEV_RNDIS_USING_LWIP"
+#endif
+
+#ifdef CONFIG_USBDEV_RNDIS_ZERO_COPY
+#include <lwip/pbuf.h>
+
+#if !LWIP_SUPPORT_CUSTOM_PBUF
+#error "rndis zero copy needs LWIP_SUPPORT_CUSTOM_PBUF"
+#endif
+
+/* rx transfer buffers handed to lwip as custom pbufs, at most 32 */
+#ifndef CONFIG_USBDEV_RNDIS_RX_POOL_NUM
+#define CONFIG_USBDEV_RNDIS_RX_POOL_NUM 4
+#endif
+
+/* tx pbufs queued for bulk in, power of 2 */
+#ifndef CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM
+#define CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM 8
+#endif
+
+#if (CONFIG_USBDEV_RNDIS_RX_POOL_NUM > 32) || (CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM > 128) || \
+    (CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM & (CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM - 1))
+#error "invalid rndis zero copy pool size"
+#endif
+
+/* same as MaxPacketsPerTransfer, packets beyond it are copied */
+#define RNDIS_RX_PBUF_NUM CONFIG_USBDEV_RNDIS_MAX_PACKETS_PER_TRANSFER
+
+struct rndis_rx_pbuf {
+    struct pbuf_custom pc;
+    struct usbd_rndis_priv *rndis;
+    uint8_t index; /* pool buffer the payload lives in */
+};
+
+struct rndis_zero_copy {
+    struct rndis_rx_pbuf rx_pbuf[CONFIG_USBDEV_RNDIS_RX_POOL_NUM][RNDIS_RX_PBUF_NUM];
+    uint32_t rx_len[CONFIG_USBDEV_RNDIS_RX_POOL_NUM];
+    uint8_t rx_refs[CONFIG_USBDEV_RNDIS_RX_POOL_NUM]; /* pbufs in lwip, +1 until parsed */
+    uint32_t rx_free;   /* bitmap of idle rx buffers */
+    int8_t rx_armed;    /* buffer owned by bulk out, -1 if none */
+    int8_t rx_parsing;  /* buffer walked by usbd_rndis_eth_rx(), -1 if none */
+    uint8_t rx_pbuf_num;
+    uint8_t rx_ready[CONFIG_USBDEV_RNDIS_RX_POOL_NUM];
+    uint8_t rx_ready_head;
+    uint8_t rx_ready_num;
+    struct pbuf *tx_queue[CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM];
+    volatile uint8_t tx_done; /* next to free, moved under lock by rx and tx threads */
+    volatile uint8_t tx_head; /* next to send, moved by bulk in */
+    volatile uint8_t tx_tail; /* next to queue, moved by thread */
+};
+#endif
+
+/* Device data structure */
+USB_NOCACHE_RAM_SECTION struct usbd_rndis_priv {
+    uint8_t busid;
+    struct usbd_interface *intf; /* control interface, NULL if the instance is free */
+    struct usbd_endpoint ep_data[3];
+
+    uint32_t drv_version;
+    uint32_t link_status;
+    uint32_t net_filter;
+    usb_eth_stat_t eth_state;
+    rndis_state_t init_state;
+    bool set_rsp_get;
+    uint8_t mac[6];
+
+    volatile uint8_t *rx_data_buffer;
+    volatile uint32_t rx_data_length;
+    volatile uint32_t rx_total_length;
+    volatile uint32_t tx_data_length;
+
+    /* one bulk out transfer may carry several packet messages */
+    uint8_t *rx_transfer_buffer;
+    uint32_t rx_transfer_length;
+    uint32_t rx_offset;
+
 #ifdef CONFIG_USBDEV_RNDIS_USING_LWIP
-static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_rndis_rx_buffer[USB_ALIGN_UP(CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE, CONFIG_USB_ALIGN_SIZE)];
-static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_rndis_tx_buffer[USB_ALIGN_UP(CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE, CONFIG_USB_ALIGN_SIZE)];
+    uint32_t tx_max_size;      /* MaxTransferSize from host */
+#endif
+#if defined(CONFIG_USBDEV_RNDIS_ZERO_COPY)
+    struct rndis_zero_copy zc;
+    USB_MEM_ALIGNX uint8_t rx_pool[CONFIG_USBDEV_RNDIS_RX_POOL_NUM][USB_ALIGN_UP(CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE, CONFIG_USB_ALIGN_SIZE)];
+#elif defined(CONFIG_USBDEV_RNDIS_USING_LWIP)
+    uint32_t tx_len[2];        /* queued packet messages */
+    volatile uint8_t tx_writers[2]; /* usbd_rndis_eth_tx() still copying into it */
+    uint8_t tx_fill;
+    USB_MEM_ALIGNX uint8_t rx_buffer[USB_ALIGN_UP(CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE, CONFIG_USB_ALIGN_SIZE)];
+    USB_MEM_ALIGNX uint8_t tx_buffer[2][USB_ALIGN_UP(CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE, CONFIG_USB_ALIGN_SIZE)];
 #endif
 
-static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t rndis_encapsulated_resp_buffer[USB_ALIGN_UP(CONFIG_USBDEV_RNDIS_RESP_BUFFER_SIZE, CONFIG_USB_ALIGN_SIZE)];
-static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t NOTIFY_RESPONSE_AVAILABLE[USB_ALIGN_UP(8, CONFIG_USB_ALIGN_SIZE)];
+    USB_MEM_ALIGNX uint8_t resp_buffer[USB_ALIGN_UP(CONFIG_USBDEV_RNDIS_RESP_BUFFER_SIZE, CONFIG_USB_ALIGN_SIZE)];
+    USB_MEM_ALIGNX uint8_t notify_buffer[USB_ALIGN_UP(8, CONFIG_USB_ALIGN_SIZE)];
+} g_usbd_rndis[CONFIG_USBDEV_MAX_RNDIS_CLASS];
+
+/* Find the function by its control interface */
+static struct usbd_rndis_priv *rndis_get_priv(uint8_t busid, uint8_t intf)
+{
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_RNDIS_CLASS; i++) {
+        if (g_usbd_rndis[i].intf && (g_usbd_rndis[i].busid == busid) && (g_usbd_rndis[i].intf->intf_num == intf)) {
+            return &g_usbd_rndis[i];
+        }
+    }
+    return NULL;
+}
 
-volatile uint8_t *g_rndis_rx_data_buffer;
-volatile uint32_t g_rndis_rx_data_length;
-volatile uint32_t g_rndis_rx_total_length;
-volatile uint32_t g_rndis_tx_data_length;
+static struct usbd_rndis_priv *rndis_get_priv_by_ep(uint8_t busid, uint8_t ep)
+{
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_RNDIS_CLASS; i++) {
+        if (g_usbd_rndis[i].intf && (g_usbd_rndis[i].busid == busid)) {
+            for (uint8_t j = 0; j < 3; j++) {
+                if (g_usbd_rndis[i].ep_data[j].ep_addr == ep) {
+                    return &g_usbd_rndis[i];
+                }
+            }
+        }
+    }
+    return NULL;
+}
 
 /* RNDIS options list */
 const uint32_t oid_supported_list[] = {
@@ -95,30 +213,35 @@ const uint32_t oid_supported_list[] = {
     OID_802_3_MAC_OPTIONS,
 };
 
-static int rndis_encapsulated_cmd_handler(uint8_t *data, uint32_t len);
+static int rndis_encapsulated_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len);
+static int rndis_start_read(struct usbd_rndis_priv *rndis, uint8_t *buf, uint32_t len);
 
-static void rndis_notify_rsp(void)
+static void rndis_notify_rsp(struct usbd_rndis_priv *rndis)
 {
-    memset(NOTIFY_RESPONSE_AVAILABLE, 0, 8);
-    NOTIFY_RESPONSE_AVAILABLE[0] = 0x01;
-    usbd_ep_start_write(0, rndis_ep_data[RNDIS_INT_EP_IDX].ep_addr, NOTIFY_RESPONSE_AVAILABLE, 8);
+    memset(rndis->notify_buffer, 0, 8);
+    rndis->notify_buffer[0] = 0x01;
+    usbd_ep_start_write(rndis->busid, rndis->ep_data[RNDIS_INT_EP_IDX].ep_addr, rndis->notify_buffer, 8);
 }
 
 static int rndis_class_interface_request_handler(uint8_t busid, struct usb_setup_packet *setup, uint8_t **data, uint32_t *len)
 {
-    (void)busid;
+    struct usbd_rndis_priv *rndis = rndis_get_priv(busid, LO_BYTE(setup->wIndex));
+
+    if (rndis == NULL) {
+        return -1;
+    }
 
     switch (setup->bRequest) {
         case CDC_REQUEST_SEND_ENCAPSULATED_COMMAND:
-            g_usbd_rndis.set_rsp_get = true;
+            rndis->set_rsp_get = true;
 
-            rndis_encapsulated_cmd_handler(*data, setup->wLength);
+            rndis_encapsulated_cmd_handler(rndis, *data, setup->wLength);
             break;
         case CDC_REQUEST_GET_ENCAPSULATED_RESPONSE:
-            g_usbd_rndis.set_rsp_get = false;
+            rndis->set_rsp_get = false;
 
-            *data = rndis_encapsulated_resp_buffer;
-            *len = ((rndis_generic_msg_t *)rndis_encapsulated_resp_buffer)->MessageLength;
+            *data = rndis->resp_buffer;
+            *len = ((rndis_generic_msg_t *)rndis->resp_buffer)->MessageLength;
             break;
 
         default:
@@ -128,28 +251,28 @@ static int rndis_class_interface_request_handler(uint8_t busid, struct usb_setup
     return 0;
 }
 
-static int rndis_init_cmd_handler(uint8_t *data, uint32_t len);
-static int rndis_halt_cmd_handler(uint8_t *data, uint32_t len);
-static int rndis_query_cmd_handler(uint8_t *data, uint32_t len);
-static int rndis_set_cmd_handler(uint8_t *data, uint32_t len);
-static int rndis_reset_cmd_handler(uint8_t *data, uint32_t len);
-static int rndis_keepalive_cmd_handler(uint8_t *data, uint32_t len);
+static int rndis_init_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len);
+static int rndis_halt_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len);
+static int rndis_query_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len);
+static int rndis_set_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len);
+static int rndis_reset_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len);
+static int rndis_keepalive_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len);
 
-static int rndis_encapsulated_cmd_handler(uint8_t *data, uint32_t len)
+static int rndis_encapsulated_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len)
 {
     switch (((rndis_generic_msg_t *)data)->MessageType) {
         case REMOTE_NDIS_INITIALIZE_MSG:
-            return rndis_init_cmd_handler(data, len);
+            return rndis_init_cmd_handler(rndis, data, len);
         case REMOTE_NDIS_HALT_MSG:
-            return rndis_halt_cmd_handler(data, len);
+            return rndis_halt_cmd_handler(rndis, data, len);
         case REMOTE_NDIS_QUERY_MSG:
-            return rndis_query_cmd_handler(data, len);
+            return rndis_query_cmd_handler(rndis, data, len);
         case REMOTE_NDIS_SET_MSG:
-            return rndis_set_cmd_handler(data, len);
+            return rndis_set_cmd_handler(rndis, data, len);
         case REMOTE_NDIS_RESET_MSG:
-            return rndis_reset_cmd_handler(data, len);
+            return rndis_reset_cmd_handler(rndis, data, len);
         case REMOTE_NDIS_KEEPALIVE_MSG:
-            return rndis_keepalive_cmd_handler(data, len);
+            return rndis_keepalive_cmd_handler(rndis, data, len);
 
         default:
             break;
@@ -157,14 +280,14 @@ static int rndis_encapsulated_cmd_handler(uint8_t *data, uint32_t len)
     return -1;
 }
 
-static int rndis_init_cmd_handler(uint8_t *data, uint32_t len)
+static int rndis_init_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len)
 {
     rndis_initialize_msg_t *cmd = (rndis_initialize_msg_t *)data;
     rndis_initialize_cmplt_t *resp;
 
     (void)len;
 
-    resp = ((rndis_initialize_cmplt_t *)rndis_encapsulated_resp_buffer);
+    resp = ((rndis_initialize_cmplt_t *)rndis->resp_buffer);
     resp->RequestId = cmd->RequestId;
     resp->MessageType = REMOTE_NDIS_INITIALIZE_CMPLT;
     resp->MessageLength = sizeof(rndis_initialize_cmplt_t);
@@ -173,34 +296,38 @@ static int rndis_init_cmd_handler(uint8_t *data, uint32_t len)
     resp->Status = RNDIS_STATUS_SUCCESS;
     resp->DeviceFlags = RNDIS_DF_CONNECTIONLESS;
     resp->Medium = RNDIS_MEDIUM_802_3;
-    resp->MaxPacketsPerTransfer = CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE / 1580;
+    resp->MaxPacketsPerTransfer = CONFIG_USBDEV_RNDIS_MAX_PACKETS_PER_TRANSFER;
     resp->MaxTransferSize = CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE;
-    resp->PacketAlignmentFactor = 0;
+    resp->PacketAlignmentFactor = RNDIS_PACKET_ALIGNMENT_FACTOR;
     resp->AfListOffset = 0;
     resp->AfListSize = 0;
 
-    g_usbd_rndis.init_state = rndis_initialized;
+    rndis->init_state = rndis_initialized;
+#ifdef CONFIG_USBDEV_RNDIS_USING_LWIP
+    /* host tells how much it can take in one bulk in transfer, bigger frames are refused by usbd_rndis_eth_tx() */
+    rndis->tx_max_size = MIN(cmd->MaxTransferSize, CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE);
+#endif
 
-    rndis_notify_rsp();
+    rndis_notify_rsp(rndis);
     return 0;
 }
 
-static int rndis_halt_cmd_handler(uint8_t *data, uint32_t len)
+static int rndis_halt_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len)
 {
     rndis_halt_msg_t *resp;
 
     (void)data;
     (void)len;
 
-    resp = ((rndis_halt_msg_t *)rndis_encapsulated_resp_buffer);
+    resp = ((rndis_halt_msg_t *)rndis->resp_buffer);
     resp->MessageLength = 0;
 
-    g_usbd_rndis.init_state = rndis_uninitialized;
+    rndis->init_state = rndis_uninitialized;
 
     return 0;
 }
 
-static int rndis_query_cmd_handler(uint8_t *data, uint32_t len)
+static int rndis_query_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len)
 {
     rndis_query_msg_t *cmd = (rndis_query_msg_t *)data;
     rndis_query_cmplt_t *resp;
@@ -209,7 +336,7 @@ static int rndis_query_cmd_handler(uint8_t *data, uint32_t len)
 
     (void)len;
 
-    resp = ((rndis_query_cmplt_t *)rndis_encapsulated_resp_buffer);
+    resp = ((rndis_query_cmplt_t *)rndis->resp_buffer);
     resp->MessageType = REMOTE_NDIS_QUERY_CMPLT;
     resp->RequestId = cmd->RequestId;
     resp->InformationBufferOffset = sizeof(rndis_query_cmplt_t) - sizeof(rndis_generic_msg_t);
@@ -251,7 +378,7 @@ static int rndis_query_cmd_handler(uint8_t *data, uint32_t len)
             break;
         case OID_802_3_CURRENT_ADDRESS:
         case OID_802_3_PERMANENT_ADDRESS:
-            RNDIS_INQUIRY_PUT(g_usbd_rndis.mac, 6);
+            RNDIS_INQUIRY_PUT(rndis->mac, 6);
             infomation_len = 6;
             break;
         case OID_GEN_PHYSICAL_MEDIUM:
@@ -259,7 +386,7 @@ static int rndis_query_cmd_handler(uint8_t *data, uint32_t len)
             infomation_len = 4;
             break;
         case OID_GEN_LINK_SPEED:
-            if (usbd_get_ep_mps(0, rndis_ep_data[RNDIS_OUT_EP_IDX].ep_addr) > 64) {
+            if (usbd_get_ep_mps(rndis->busid, rndis->ep_data[RNDIS_OUT_EP_IDX].ep_addr) > 64) {
                 RNDIS_INQUIRY_PUT_LE32(480000000 / 100);
             } else {
                 RNDIS_INQUIRY_PUT_LE32(12000000 / 100);
@@ -268,7 +395,7 @@ static int rndis_query_cmd_handler(uint8_t *data, uint32_t len)
             infomation_len = 4;
             break;
         case OID_GEN_CURRENT_PACKET_FILTER:
-            RNDIS_INQUIRY_PUT_LE32(g_usbd_rndis.net_filter);
+            RNDIS_INQUIRY_PUT_LE32(rndis->net_filter);
             infomation_len = 4;
             break;
         case OID_GEN_MAXIMUM_TOTAL_SIZE:
@@ -316,19 +443,19 @@ static int rndis_query_cmd_handler(uint8_t *data, uint32_t len)
             infomation_len = 4;
             break;
         case OID_GEN_XMIT_OK:
-            RNDIS_INQUIRY_PUT_LE32(g_usbd_rndis.eth_state.txok);
+            RNDIS_INQUIRY_PUT_LE32(rndis->eth_state.txok);
             infomation_len = 4;
             break;
         case OID_GEN_RCV_OK:
-            RNDIS_INQUIRY_PUT_LE32(g_usbd_rndis.eth_state.rxok);
+            RNDIS_INQUIRY_PUT_LE32(rndis->eth_state.rxok);
             infomation_len = 4;
             break;
         case OID_GEN_RCV_ERROR:
-            RNDIS_INQUIRY_PUT_LE32(g_usbd_rndis.eth_state.rxbad);
+            RNDIS_INQUIRY_PUT_LE32(rndis->eth_state.rxbad);
             infomation_len = 4;
             break;
         case OID_GEN_XMIT_ERROR:
-            RNDIS_INQUIRY_PUT_LE32(g_usbd_rndis.eth_state.txbad);
+            RNDIS_INQUIRY_PUT_LE32(rndis->eth_state.txbad);
             infomation_len = 4;
             break;
         case OID_GEN_RCV_NO_BUFFER:
@@ -345,11 +472,11 @@ static int rndis_query_cmd_handler(uint8_t *data, uint32_t len)
     resp->MessageLength = sizeof(rndis_query_cmplt_t) + infomation_len;
     resp->InformationBufferLength = infomation_len;
 
-    rndis_notify_rsp();
+    rndis_notify_rsp(rndis);
     return 0;
 }
 
-static int rndis_set_cmd_handler(uint8_t *data, uint32_t len)
+static int rndis_set_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len)
 {
     rndis_set_msg_t *cmd = (rndis_set_msg_t *)data;
     rndis_set_cmplt_t *resp;
@@ -357,7 +484,7 @@ static int rndis_set_cmd_handler(uint8_t *data, uint32_t len)
 
     (void)len;
 
-    resp = ((rndis_set_cmplt_t *)rndis_encapsulated_resp_buffer);
+    resp = ((rndis_set_cmplt_t *)rndis->resp_buffer);
     resp->RequestId = cmd->RequestId;
     resp->MessageType = REMOTE_NDIS_SET_CMPLT;
     resp->MessageLength = sizeof(rndis_set_cmplt_t);
@@ -371,7 +498,7 @@ static int rndis_set_cmd_handler(uint8_t *data, uint32_t len)
                         param->ParameterValueOffset, param->ParameterValueLength);
             break;
         case OID_GEN_CURRENT_PACKET_FILTER:
-            if (cmd->InformationBufferLength < sizeof(g_usbd_rndis.net_filter)) {
+            if (cmd->InformationBufferLength < sizeof(rndis->net_filter)) {
                 USB_LOG_WRN("PACKET_FILTER!\r\n");
                 resp->Status = RNDIS_STATUS_INVALID_DATA;
             } else {
@@ -379,12 +506,12 @@ static int rndis_set_cmd_handler(uint8_t *data, uint32_t len)
                 /* Parameter starts at offset buf_offset of the req_id field */
                 filter = (uint32_t *)((uint8_t *)&(cmd->RequestId) + cmd->InformationBufferOffset);
 
-                //g_usbd_rndis.net_filter = param->ParameterNameOffset;
-                g_usbd_rndis.net_filter = *(uint32_t *)filter;
-                if (g_usbd_rndis.net_filter) {
-                    g_usbd_rndis.init_state = rndis_data_initialized;
+                //rndis->net_filter = param->ParameterNameOffset;
+                rndis->net_filter = *(uint32_t *)filter;
+                if (rndis->net_filter) {
+                    rndis->init_state = rndis_data_initialized;
                 } else {
-                    g_usbd_rndis.init_state = rndis_initialized;
+                    rndis->init_state = rndis_initialized;
                 }
             }
             break;
@@ -403,12 +530,12 @@ static int rndis_set_cmd_handler(uint8_t *data, uint32_t len)
             break;
     }
 
-    rndis_notify_rsp();
+    rndis_notify_rsp(rndis);
 
     return 0;
 }
 
-static int rndis_reset_cmd_handler(uint8_t *data, uint32_t len)
+static int rndis_reset_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len)
 {
     // rndis_reset_msg_t *cmd = (rndis_reset_msg_t *)data;
     rndis_reset_cmplt_t *resp;
@@ -416,90 +543,327 @@ static int rndis_reset_cmd_handler(uint8_t *data, uint32_t len)
     (void)data;
     (void)len;
 
-    resp = ((rndis_reset_cmplt_t *)rndis_encapsulated_resp_buffer);
+    resp = ((rndis_reset_cmplt_t *)rndis->resp_buffer);
     resp->MessageType = REMOTE_NDIS_RESET_CMPLT;
     resp->MessageLength = sizeof(rndis_reset_cmplt_t);
     resp->Status = RNDIS_STATUS_SUCCESS;
     resp->AddressingReset = 1;
 
-    g_usbd_rndis.init_state = rndis_uninitialized;
+    rndis->init_state = rndis_uninitialized;
 
-    rndis_notify_rsp();
+    rndis_notify_rsp(rndis);
 
     return 0;
 }
 
-static int rndis_keepalive_cmd_handler(uint8_t *data, uint32_t len)
+static int rndis_keepalive_cmd_handler(struct usbd_rndis_priv *rndis, uint8_t *data, uint32_t len)
 {
     rndis_keepalive_msg_t *cmd = (rndis_keepalive_msg_t *)data;
     rndis_keepalive_cmplt_t *resp;
 
     (void)len;
 
-    resp = ((rndis_keepalive_cmplt_t *)rndis_encapsulated_resp_buffer);
+    resp = ((rndis_keepalive_cmplt_t *)rndis->resp_buffer);
     resp->RequestId = cmd->RequestId;
     resp->MessageType = REMOTE_NDIS_KEEPALIVE_CMPLT;
     resp->MessageLength = sizeof(rndis_keepalive_cmplt_t);
     resp->Status = RNDIS_STATUS_SUCCESS;
 
-    rndis_notify_rsp();
+    rndis_notify_rsp(rndis);
 
     return 0;
 }
 
+#ifdef CONFIG_USBDEV_RNDIS_ZERO_COPY
+/* Give an idle pool buffer to bulk out, called with irq locked */
+static void rndis_rx_arm(struct usbd_rndis_priv *rndis)
+{
+    uint8_t i;
+
+    if ((rndis->zc.rx_armed >= 0) || (rndis->zc.rx_free == 0) || !usb_device_is_configured(rndis->busid)) {
+        return;
+    }
+
+    for (i = 0; i < CONFIG_USBDEV_RNDIS_RX_POOL_NUM; i++) {
+        if (rndis->zc.rx_free & (1U << i)) {
+            break;
+        }
+    }
+
+    rndis->zc.rx_free &= ~(1U << i);
+    rndis->zc.rx_armed = i;
+    usbd_ep_start_read(rndis->busid, rndis->ep_data[RNDIS_OUT_EP_IDX].ep_addr, rndis->rx_pool[i], CONFIG_USBDEV_RNDIS_ETH_MAX_FRAME_SIZE);
+}
+
+/* Drop one reference of a pool buffer, called with irq locked */
+static void rndis_rx_put(struct usbd_rndis_priv *rndis, uint8_t index)
+{
+    if (--rndis->zc.rx_refs[index] == 0) {
+        rndis->zc.rx_free |= (1U << index);
+        /* bulk out ran out of buffers, feed it again */
+        rndis_rx_arm(rndis);
+    }
+}
+
+static void rndis_rx_pbuf_free(struct pbuf *p)
+{
+    struct rndis_rx_pbuf *rx = (struct rndis_rx_pbuf *)p;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    rndis_rx_put(rx->rndis, rx->index);
+    usb_osal_leave_critical_section(flags);
+}
+
+static void rndis_zc_reset(struct usbd_rndis_priv *rndis)
+{
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    /* the parsing buffer and pbufs held by lwip are given back by their owners */
+    if (rndis->zc.rx_armed >= 0) {
+        rndis->zc.rx_free |= (1U << rndis->zc.rx_armed);
+        rndis->zc.rx_armed = -1;
+    }
+    while (rndis->zc.rx_ready_num) {
+        rndis->zc.rx_free |= (1U << rndis->zc.rx_ready[rndis->zc.rx_ready_head]);
+        rndis->zc.rx_ready_head = (rndis->zc.rx_ready_head + 1) % CONFIG_USBDEV_RNDIS_RX_POOL_NUM;
+        rndis->zc.rx_ready_num--;
+    }
+    /* queued pbufs are freed by the next usbd_rndis_eth_tx() */
+    rndis->zc.tx_head = rndis->zc.tx_tail;
+    usb_osal_leave_critical_section(flags);
+}
+
+/* Send the oldest queued pbuf and its header in front, called with irq locked and in ep idle */
+static void rndis_tx_kick(struct usbd_rndis_priv *rndis)
+{
+    struct pbuf *p = rndis->zc.tx_queue[rndis->zc.tx_head % CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM];
+
+    rndis->tx_data_length = sizeof(rndis_data_packet_t) + p->len;
+
+    USB_LOG_DBG("txlen:%d\r\n", rndis->tx_data_length);
+    usbd_ep_start_write(rndis->busid, rndis->ep_data[RNDIS_IN_EP_IDX].ep_addr,
+                        (uint8_t *)p->payload - sizeof(rndis_data_packet_t), rndis->tx_data_length);
+}
+
+/* Free pbufs sent by bulk in, pbuf_free() is not safe in irq.
+ * Called from both rx and tx threads, so each slot is claimed under the lock before it is freed.
+ */
+static void rndis_tx_reclaim(struct usbd_rndis_priv *rndis)
+{
+    struct pbuf *p;
+    size_t flags;
+
+    while (1) {
+        flags = usb_osal_enter_critical_section();
+        if (rndis->zc.tx_done == rndis->zc.tx_head) {
+            usb_osal_leave_critical_section(flags);
+            break;
+        }
+        p = rndis->zc.tx_queue[rndis->zc.tx_done % CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM];
+        rndis->zc.tx_done++;
+        usb_osal_leave_critical_section(flags);
+
+        pbuf_free(p);
+    }
+}
+#endif
+
 static void rndis_notify_handler(uint8_t busid, uint8_t event, void *arg)
 {
-    (void)busid;
+    struct usbd_rndis_priv *rndis;
+
     (void)arg;
 
-    switch (event) {
-        case USBD_EVENT_RESET:
-            g_usbd_rndis.link_status = NDIS_MEDIA_STATE_DISCONNECTED;
-            g_rndis_rx_data_length = 0;
-            g_rndis_tx_data_length = 0;
-            break;
-        case USBD_EVENT_CONFIGURED:
-#ifdef CONFIG_USBDEV_RNDIS_USING_LWIP
-            g_usbd_rndis.link_status = NDIS_MEDIA_STATE_CONNECTED;
-            usbd_rndis_start_read(g_rndis_rx_buffer, sizeof(g_rndis_rx_buffer));
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_RNDIS_CLASS; i++) {
+        rndis = &g_usbd_rndis[i];
+        if ((rndis->intf == NULL) || (rndis->busid != busid)) {
+            continue;
+        }
+
+        switch (event) {
+            case USBD_EVENT_RESET:
+                rndis->link_status = NDIS_MEDIA_STATE_DISCONNECTED;
+                rndis->rx_data_length = 0;
+                rndis->tx_data_length = 0;
+#if defined(CONFIG_USBDEV_RNDIS_ZERO_COPY)
+                rndis->tx_max_size = 1580;
+                rndis_zc_reset(rndis);
+#elif defined(CONFIG_USBDEV_RNDIS_USING_LWIP)
+                rndis->tx_max_size = 1580;
+                rndis->tx_len[0] = 0;
+                rndis->tx_len[1] = 0;
+                rndis->tx_writers[0] = 0;
+                rndis->tx_writers[1] = 0;
+                rndis->tx_fill = 0;
 #endif
-            break;
+                break;
+            case USBD_EVENT_CONFIGURED:
+#if defined(CONFIG_USBDEV_RNDIS_ZERO_COPY)
+                rndis->link_status = NDIS_MEDIA_STATE_CONNECTED;
+                {
+                    size_t flags = usb_osal_enter_critical_section();
+                    rndis_rx_arm(rndis);
+                    usb_osal_leave_critical_section(flags);
+                }
+#elif defined(CONFIG_USBDEV_RNDIS_USING_LWIP)
+                rndis->link_status = NDIS_MEDIA_STATE_CONNECTED;
+                rndis_start_read(rndis, rndis->rx_buffer, sizeof(rndis->rx_buffer));
+#endif
+                break;
 
-        default:
+            case USBD_EVENT_DEINIT:
+                /* usbd_deinitialize() drops interfaces and endpoints, init_intf sets them up again */
+                rndis->intf = NULL;
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+/* Point rndis->rx_data_buffer to the payload of next packet message in the transfer */
+static bool rndis_rx_next_packet(struct usbd_rndis_priv *rndis)
+{
+    rndis_data_packet_t *hdr;
+    rndis_data_packet_t temp;
+    uint32_t offset;
+
+    while ((rndis->rx_offset + sizeof(rndis_data_packet_t)) <= rndis->rx_transfer_length) {
+        offset = rndis->rx_offset;
+        hdr = (rndis_data_packet_t *)(rndis->rx_transfer_buffer + offset);
+
+        /* Not word-aligned case */
+        if (offset & 0x3) {
+            memcpy(&temp, hdr, sizeof(rndis_data_packet_t));
+            hdr = &temp;
+        }
+
+        if ((hdr->MessageType != REMOTE_NDIS_PACKET_MSG) ||
+            (hdr->MessageLength < sizeof(rndis_data_packet_t)) ||
+            (hdr->MessageLength > (rndis->rx_transfer_length - offset))) {
+            /* the rest can not be trusted, a short packet byte also ends here */
             break;
+        }
+
+        rndis->rx_offset += hdr->MessageLength;
+
+        if ((hdr->DataOffset + sizeof(rndis_generic_msg_t) + hdr->DataLength) > hdr->MessageLength) {
+            rndis->eth_state.rxbad++;
+            continue;
+        }
+
+        /* Point to the payload and update the message length */
+        rndis->rx_data_buffer = rndis->rx_transfer_buffer + offset + hdr->DataOffset + sizeof(rndis_generic_msg_t);
+        rndis->rx_data_length = hdr->DataLength;
+        return true;
     }
+
+    rndis->rx_data_length = 0;
+    return false;
 }
 
 void rndis_bulk_out(uint8_t busid, uint8_t ep, uint32_t nbytes)
 {
-    rndis_data_packet_t *hdr;
+    struct usbd_rndis_priv *rndis = rndis_get_priv_by_ep(busid, ep);
+#ifdef CONFIG_USBDEV_RNDIS_ZERO_COPY
+    uint8_t index;
+    size_t flags;
+#endif
 
-    (void)busid;
-    (void)ep;
+    if (rndis == NULL) {
+        return;
+    }
 
-    hdr = (rndis_data_packet_t *)g_rndis_rx_data_buffer;
-    if ((hdr->MessageType != REMOTE_NDIS_PACKET_MSG) || (nbytes < hdr->MessageLength)) {
-        usbd_rndis_start_read((uint8_t *)g_rndis_rx_data_buffer, g_rndis_rx_total_length);
+#ifdef CONFIG_USBDEV_RNDIS_ZERO_COPY
+    flags = usb_osal_enter_critical_section();
+    index = rndis->zc.rx_armed;
+    rndis->zc.rx_armed = -1;
+    if (nbytes >= sizeof(rndis_data_packet_t)) {
+        rndis->zc.rx_len[index] = nbytes;
+        rndis->zc.rx_refs[index] = 1;
+        rndis->zc.rx_ready[(rndis->zc.rx_ready_head + rndis->zc.rx_ready_num) % CONFIG_USBDEV_RNDIS_RX_POOL_NUM] = index;
+        rndis->zc.rx_ready_num++;
+    } else {
+        rndis->zc.rx_free |= (1U << index);
+    }
+    /* receive the next transfer while this one goes up the stack */
+    rndis_rx_arm(rndis);
+    usb_osal_leave_critical_section(flags);
+
+    if (nbytes >= sizeof(rndis_data_packet_t)) {
+        usbd_rndis_data_recv_done(busid, rndis->intf->intf_num, nbytes);
+    }
+#else
+    rndis->rx_transfer_length = nbytes;
+    rndis->rx_offset = 0;
+
+    if (!rndis_rx_next_packet(rndis)) {
+        rndis_start_read(rndis, rndis->rx_transfer_buffer, rndis->rx_total_length);
         return;
     }
 
-    /* Point to the payload and update the message length */
-    g_rndis_rx_data_buffer += hdr->DataOffset + sizeof(rndis_generic_msg_t);
-    g_rndis_rx_data_length = hdr->DataLength;
+    usbd_rndis_data_recv_done(busid, rndis->intf->intf_num, rndis->rx_data_length);
+#endif
+}
 
-    usbd_rndis_data_recv_done(g_rndis_rx_data_length);
+#if defined(CONFIG_USBDEV_RNDIS_USING_LWIP) && !defined(CONFIG_USBDEV_RNDIS_ZERO_COPY)
+/* Send the filling transfer buffer, called with irq locked and in ep idle */
+static void rndis_tx_flush(struct usbd_rndis_priv *rndis)
+{
+    uint8_t fill = rndis->tx_fill;
+
+    rndis->tx_data_length = rndis->tx_len[fill];
+    rndis->tx_fill ^= 1;
+    rndis->tx_len[rndis->tx_fill] = 0;
+
+    USB_LOG_DBG("txlen:%d\r\n", rndis->tx_data_length);
+    usbd_ep_start_write(rndis->busid, rndis->ep_data[RNDIS_IN_EP_IDX].ep_addr, rndis->tx_buffer[fill], rndis->tx_data_length);
 }
+#endif
 
 void rndis_bulk_in(uint8_t busid, uint8_t ep, uint32_t nbytes)
 {
-    (void)busid;
+    struct usbd_rndis_priv *rndis = rndis_get_priv_by_ep(busid, ep);
+    uint32_t tx_len;
+#ifdef CONFIG_USBDEV_RNDIS_USING_LWIP
+    size_t flags;
+#endif
 
-    if ((nbytes % usbd_get_ep_mps(0, ep)) == 0 && nbytes) {
+    if (rndis == NULL) {
+        return;
+    }
+
+    if ((nbytes % usbd_get_ep_mps(busid, ep)) == 0 && nbytes) {
         /* send zlp */
-        usbd_ep_start_write(0, ep, NULL, 0);
+        usbd_ep_start_write(busid, ep, NULL, 0);
     } else {
-        usbd_rndis_data_send_done(g_rndis_tx_data_length);
-        g_rndis_tx_data_length = 0;
+#if defined(CONFIG_USBDEV_RNDIS_ZERO_COPY)
+        flags = usb_osal_enter_critical_section();
+        tx_len = rndis->tx_data_length;
+        rndis->tx_data_length = 0;
+        rndis->zc.tx_head++;
+        if (rndis->zc.tx_head != rndis->zc.tx_tail) {
+            rndis_tx_kick(rndis);
+        }
+        usb_osal_leave_critical_section(flags);
+#elif defined(CONFIG_USBDEV_RNDIS_USING_LWIP)
+        flags = usb_osal_enter_critical_section();
+        tx_len = rndis->tx_data_length;
+        rndis->tx_data_length = 0;
+
+        /* packets queued while the last transfer was on the bus go out together */
+        if (rndis->tx_len[rndis->tx_fill] && !rndis->tx_writers[rndis->tx_fill]) {
+            rndis_tx_flush(rndis);
+        }
+        usb_osal_leave_critical_section(flags);
+#else
+        tx_len = rndis->tx_data_length;
+        rndis->tx_data_length = 0;
+#endif
+        usbd_rndis_data_send_done(busid, rndis->intf->intf_num, tx_len);
     }
 }
 
@@ -512,156 +876,395 @@ void rndis_int_in(uint8_t busid, uint8_t ep, uint32_t nbytes)
     //USB_LOG_DBG("len:%d\r\n", nbytes);
 }
 
-int usbd_rndis_start_write(uint8_t *buf, uint32_t len)
+static int rndis_start_write(struct usbd_rndis_priv *rndis, uint8_t *buf, uint32_t len)
 {
-    if (!usb_device_is_configured(0)) {
+    if (!usb_device_is_configured(rndis->busid)) {
         return -USB_ERR_NOTCONN;
     }
 
-    if (g_rndis_tx_data_length > 0) {
+    if (rndis->tx_data_length > 0) {
         return -USB_ERR_BUSY;
     }
 
-    g_rndis_tx_data_length = len;
+    rndis->tx_data_length = len;
 
-    USB_LOG_DBG("txlen:%d\r\n", g_rndis_tx_data_length);
-    return usbd_ep_start_write(0, rndis_ep_data[RNDIS_IN_EP_IDX].ep_addr, buf, len);
+    USB_LOG_DBG("txlen:%d\r\n", rndis->tx_data_length);
+    return usbd_ep_start_write(rndis->busid, rndis->ep_data[RNDIS_IN_EP_IDX].ep_addr, buf, len);
 }
 
-int usbd_rndis_start_read(uint8_t *buf, uint32_t len)
+static int rndis_start_read(struct usbd_rndis_priv *rndis, uint8_t *buf, uint32_t len)
 {
-    if (!usb_device_is_configured(0)) {
+    if (!usb_device_is_configured(rndis->busid)) {
         return -USB_ERR_NOTCONN;
     }
 
-    g_rndis_rx_data_buffer = buf;
-    g_rndis_rx_total_length = len;
-    g_rndis_rx_data_length = 0;
-    return usbd_ep_start_read(0, rndis_ep_data[RNDIS_OUT_EP_IDX].ep_addr, buf, len);
+    rndis->rx_transfer_buffer = buf;
+    rndis->rx_data_buffer = buf;
+    rndis->rx_total_length = len;
+    rndis->rx_data_length = 0;
+    return usbd_ep_start_read(rndis->busid, rndis->ep_data[RNDIS_OUT_EP_IDX].ep_addr, buf, len);
 }
 
-#ifdef CONFIG_USBDEV_RNDIS_USING_LWIP
-#include <lwip/pbuf.h>
+int usbd_rndis_start_write(uint8_t busid, uint8_t intf, uint8_t *buf, uint32_t len)
+{
+    struct usbd_rndis_priv *rndis = rndis_get_priv(busid, intf);
+
+    if (rndis == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    return rndis_start_write(rndis, buf, len);
+}
 
-struct pbuf *usbd_rndis_eth_rx(void)
+int usbd_rndis_start_read(uint8_t busid, uint8_t intf, uint8_t *buf, uint32_t len)
 {
+    struct usbd_rndis_priv *rndis = rndis_get_priv(busid, intf);
+
+    if (rndis == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    return rndis_start_read(rndis, buf, len);
+}
+
+#if defined(CONFIG_USBDEV_RNDIS_ZERO_COPY)
+struct pbuf *usbd_rndis_eth_rx(uint8_t busid, uint8_t intf)
+{
+    struct usbd_rndis_priv *rndis = rndis_get_priv(busid, intf);
+    struct rndis_rx_pbuf *rx;
     struct pbuf *p;
+    uint8_t index;
+    size_t flags;
 
-    if (g_rndis_rx_data_length == 0) {
+    if (rndis == NULL) {
         return NULL;
     }
-    p = pbuf_alloc(PBUF_RAW, g_rndis_rx_data_length, PBUF_POOL);
-    if (p == NULL) {
-        usbd_rndis_start_read(g_rndis_rx_buffer, sizeof(g_rndis_rx_buffer));
+
+    rndis_tx_reclaim(rndis);
+
+    while (1) {
+        if (rndis->zc.rx_parsing < 0) {
+            flags = usb_osal_enter_critical_section();
+            if (rndis->zc.rx_ready_num == 0) {
+                usb_osal_leave_critical_section(flags);
+                return NULL;
+            }
+            index = rndis->zc.rx_ready[rndis->zc.rx_ready_head];
+            rndis->zc.rx_ready_head = (rndis->zc.rx_ready_head + 1) % CONFIG_USBDEV_RNDIS_RX_POOL_NUM;
+            rndis->zc.rx_ready_num--;
+            usb_osal_leave_critical_section(flags);
+
+            rndis->zc.rx_parsing = index;
+            rndis->zc.rx_pbuf_num = 0;
+            rndis->rx_transfer_buffer = rndis->rx_pool[index];
+            rndis->rx_transfer_length = rndis->zc.rx_len[index];
+            rndis->rx_offset = 0;
+        }
+
+        index = rndis->zc.rx_parsing;
+        if (rndis_rx_next_packet(rndis)) {
+            break;
+        }
+
+        /* every packet message of this transfer is passed up */
+        flags = usb_osal_enter_critical_section();
+        rndis_rx_put(rndis, index);
+        usb_osal_leave_critical_section(flags);
+        rndis->zc.rx_parsing = -1;
+    }
+
+    if (rndis->zc.rx_pbuf_num < RNDIS_RX_PBUF_NUM) {
+        rx = &rndis->zc.rx_pbuf[index][rndis->zc.rx_pbuf_num++];
+        rx->pc.custom_free_function = rndis_rx_pbuf_free;
+
+        flags = usb_osal_enter_critical_section();
+        rndis->zc.rx_refs[index]++;
+        usb_osal_leave_critical_section(flags);
+
+        p = pbuf_alloced_custom(PBUF_RAW, rndis->rx_data_length, PBUF_REF, &rx->pc,
+                                (uint8_t *)rndis->rx_data_buffer, rndis->rx_data_length);
+    } else {
+        p = pbuf_alloc(PBUF_RAW, rndis->rx_data_length, PBUF_POOL);
+        if (p != NULL) {
+            pbuf_take(p, (uint8_t *)rndis->rx_data_buffer, rndis->rx_data_length);
+        }
+    }
+
+    if (p != NULL) {
+        rndis->eth_state.rxok++;
+        USB_LOG_DBG("rxlen:%d\r\n", rndis->rx_data_length);
+    } else {
+        rndis->eth_state.rxbad++;
+    }
+    return p;
+}
+
+int usbd_rndis_eth_tx(uint8_t busid, uint8_t intf, struct pbuf *p)
+{
+    struct usbd_rndis_priv *rndis = rndis_get_priv(busid, intf);
+    struct pbuf *q = NULL;
+    rndis_data_packet_t *hdr;
+    uintptr_t pad;
+    size_t flags;
+
+    if (rndis == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    if (!usb_device_is_configured(busid)) {
+        return -USB_ERR_NOTCONN;
+    }
+
+    rndis_tx_reclaim(rndis);
+
+    if ((sizeof(rndis_data_packet_t) + p->tot_len) > rndis->tx_max_size) {
+        return -USB_ERR_RANGE;
+    }
+
+    if ((uint8_t)(rndis->zc.tx_tail - rndis->zc.tx_done) >= CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM) {
+        return -USB_ERR_BUSY;
+    }
+
+    /* the message header goes into lwip's link headroom, payload is left as it was */
+    if ((p->next == NULL) && (pbuf_add_header(p, sizeof(rndis_data_packet_t)) == 0)) {
+        pbuf_remove_header(p, sizeof(rndis_data_packet_t));
+        if ((((uintptr_t)p->payload - sizeof(rndis_data_packet_t)) & (CONFIG_USB_ALIGN_SIZE - 1)) == 0) {
+            pbuf_ref(p);
+            q = p;
+        }
+    }
+
+    if (q == NULL) {
+        /* chained, unaligned or no headroom, copy into one aligned pbuf */
+        q = pbuf_alloc(PBUF_RAW, sizeof(rndis_data_packet_t) + p->tot_len + CONFIG_USB_ALIGN_SIZE, PBUF_RAM);
+        if (q == NULL) {
+            return -USB_ERR_NOMEM;
+        }
+        pad = USB_ALIGN_UP((uintptr_t)q->payload, CONFIG_USB_ALIGN_SIZE) - (uintptr_t)q->payload;
+        pbuf_remove_header(q, pad + sizeof(rndis_data_packet_t));
+        pbuf_realloc(q, p->tot_len);
+        pbuf_copy(q, p);
+    }
+
+    hdr = (rndis_data_packet_t *)((uint8_t *)q->payload - sizeof(rndis_data_packet_t));
+
+    memset(hdr, 0, sizeof(rndis_data_packet_t));
+    hdr->MessageType = REMOTE_NDIS_PACKET_MSG;
+    hdr->MessageLength = sizeof(rndis_data_packet_t) + q->len;
+    hdr->DataOffset = sizeof(rndis_data_packet_t) - sizeof(rndis_generic_msg_t);
+    hdr->DataLength = q->len;
+
+    flags = usb_osal_enter_critical_section();
+    rndis->zc.tx_queue[rndis->zc.tx_tail % CONFIG_USBDEV_RNDIS_TX_QUEUE_NUM] = q;
+    rndis->zc.tx_tail++;
+    rndis->eth_state.txok++;
+    if (!rndis->tx_data_length) {
+        rndis_tx_kick(rndis);
+    }
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+#elif defined(CONFIG_USBDEV_RNDIS_USING_LWIP)
+#include <lwip/pbuf.h>
+
+struct pbuf *usbd_rndis_eth_rx(uint8_t busid, uint8_t intf)
+{
+    struct usbd_rndis_priv *rndis = rndis_get_priv(busid, intf);
+    struct pbuf *p;
+
+    if ((rndis == NULL) || (rndis->rx_data_length == 0)) {
         return NULL;
     }
-    usb_memcpy(p->payload, (uint8_t *)g_rndis_rx_data_buffer, g_rndis_rx_data_length);
-    p->len = g_rndis_rx_data_length;
+    p = pbuf_alloc(PBUF_RAW, rndis->rx_data_length, PBUF_POOL);
+    if (p != NULL) {
+        pbuf_take(p, (uint8_t *)rndis->rx_data_buffer, rndis->rx_data_length);
+        rndis->eth_state.rxok++;
+        USB_LOG_DBG("rxlen:%d\r\n", rndis->rx_data_length);
+    } else {
+        rndis->eth_state.rxbad++;
+    }
 
-    USB_LOG_DBG("rxlen:%d\r\n", g_rndis_rx_data_length);
-    usbd_rndis_start_read(g_rndis_rx_buffer, sizeof(g_rndis_rx_buffer));
+    /* read again after every packet message of this transfer is passed up */
+    if (!rndis_rx_next_packet(rndis)) {
+        rndis_start_read(rndis, rndis->rx_buffer, sizeof(rndis->rx_buffer));
+    }
     return p;
 }
 
-int usbd_rndis_eth_tx(struct pbuf *p)
+int usbd_rndis_eth_tx(uint8_t busid, uint8_t intf, struct pbuf *p)
 {
+    struct usbd_rndis_priv *rndis = rndis_get_priv(busid, intf);
     struct pbuf *q;
     uint8_t *buffer;
     rndis_data_packet_t *hdr;
+    uint32_t msg_len;
+    uint32_t offset;
+    uint8_t fill;
+    size_t flags;
+
+    if (rndis == NULL) {
+        return -USB_ERR_NODEV;
+    }
 
-    if (!usb_device_is_configured(0)) {
+    if (!usb_device_is_configured(busid)) {
         return -USB_ERR_NOTCONN;
     }
 
-    if (g_rndis_tx_data_length > 0) {
-        return -USB_ERR_BUSY;
+    msg_len = USB_ALIGN_UP(sizeof(rndis_data_packet_t) + p->tot_len, RNDIS_PACKET_ALIGN);
+    if (msg_len > rndis->tx_max_size) {
+        return -USB_ERR_RANGE;
     }
 
-    if (p->tot_len > sizeof(g_rndis_tx_buffer)) {
-        p->tot_len = sizeof(g_rndis_tx_buffer);
+    flags = usb_osal_enter_critical_section();
+    fill = rndis->tx_fill;
+    if ((rndis->tx_len[fill] + msg_len) > rndis->tx_max_size) {
+        if (rndis->tx_data_length || rndis->tx_writers[fill]) {
+            /* both buffers are taken */
+            usb_osal_leave_critical_section(flags);
+            return -USB_ERR_BUSY;
+        }
+        rndis_tx_flush(rndis);
+        fill = rndis->tx_fill;
     }
+    offset = rndis->tx_len[fill];
+    rndis->tx_len[fill] += msg_len;
+    rndis->tx_writers[fill]++;
+    usb_osal_leave_critical_section(flags);
 
-    buffer = (uint8_t *)(g_rndis_tx_buffer + sizeof(rndis_data_packet_t));
+    buffer = &rndis->tx_buffer[fill][offset + sizeof(rndis_data_packet_t)];
     for (q = p; q != NULL; q = q->next) {
         usb_memcpy(buffer, q->payload, q->len);
         buffer += q->len;
     }
 
-    hdr = (rndis_data_packet_t *)g_rndis_tx_buffer;
+    hdr = (rndis_data_packet_t *)&rndis->tx_buffer[fill][offset];
 
     memset(hdr, 0, sizeof(rndis_data_packet_t));
     hdr->MessageType = REMOTE_NDIS_PACKET_MSG;
-    hdr->MessageLength = sizeof(rndis_data_packet_t) + p->tot_len;
+    hdr->MessageLength = msg_len;
     hdr->DataOffset = sizeof(rndis_data_packet_t) - sizeof(rndis_generic_msg_t);
     hdr->DataLength = p->tot_len;
 
-    return usbd_rndis_start_write(g_rndis_tx_buffer, sizeof(rndis_data_packet_t) + p->tot_len);
+    flags = usb_osal_enter_critical_section();
+    rndis->tx_writers[fill]--;
+    rndis->eth_state.txok++;
+    /* in ep idle: send now, otherwise bulk in completion sends everything queued so far */
+    if (!rndis->tx_data_length && !rndis->tx_writers[fill] && (fill == rndis->tx_fill)) {
+        rndis_tx_flush(rndis);
+    }
+    usb_osal_leave_critical_section(flags);
+    return 0;
 }
 #endif
-struct usbd_interface *usbd_rndis_init_intf(struct usbd_interface *intf,
+struct usbd_interface *usbd_rndis_init_intf(uint8_t busid, struct usbd_interface *intf,
                                             const uint8_t out_ep,
                                             const uint8_t in_ep,
                                             const uint8_t int_ep, uint8_t mac[6])
 {
-    memcpy(g_usbd_rndis.mac, mac, 6);
-
-    g_usbd_rndis.drv_version = 0x0001;
-    g_usbd_rndis.link_status = NDIS_MEDIA_STATE_DISCONNECTED;
-
-    rndis_ep_data[RNDIS_OUT_EP_IDX].ep_addr = out_ep;
-    rndis_ep_data[RNDIS_OUT_EP_IDX].ep_cb = rndis_bulk_out;
-    rndis_ep_data[RNDIS_IN_EP_IDX].ep_addr = in_ep;
-    rndis_ep_data[RNDIS_IN_EP_IDX].ep_cb = rndis_bulk_in;
-    rndis_ep_data[RNDIS_INT_EP_IDX].ep_addr = int_ep;
-    rndis_ep_data[RNDIS_INT_EP_IDX].ep_cb = rndis_int_in;
-
-    usbd_add_endpoint(0, &rndis_ep_data[RNDIS_OUT_EP_IDX]);
-    usbd_add_endpoint(0, &rndis_ep_data[RNDIS_IN_EP_IDX]);
-    usbd_add_endpoint(0, &rndis_ep_data[RNDIS_INT_EP_IDX]);
+    struct usbd_rndis_priv *rndis;
 
     intf->class_interface_handler = rndis_class_interface_request_handler;
     intf->class_endpoint_handler = NULL;
     intf->vendor_handler = NULL;
     intf->notify_handler = rndis_notify_handler;
 
+    /* the data interface comes with the endpoints of its control interface */
+    if (rndis_get_priv_by_ep(busid, in_ep)) {
+        return intf;
+    }
+
+    rndis = NULL;
+    for (uint8_t i = 0; i < CONFIG_USBDEV_MAX_RNDIS_CLASS; i++) {
+        if (g_usbd_rndis[i].intf == NULL) {
+            rndis = &g_usbd_rndis[i];
+            break;
+        }
+    }
+
+    if (rndis == NULL) {
+        USB_LOG_ERR("No more rndis instance, raise CONFIG_USBDEV_MAX_RNDIS_CLASS\r\n");
+        return NULL;
+    }
+
+    memset(rndis, 0, sizeof(struct usbd_rndis_priv));
+    rndis->busid = busid;
+    rndis->intf = intf;
+    memcpy(rndis->mac, mac, 6);
+
+    rndis->drv_version = 0x0001;
+    rndis->link_status = NDIS_MEDIA_STATE_DISCONNECTED;
+
+    rndis->ep_data[RNDIS_OUT_EP_IDX].ep_addr = out_ep;
+    rndis->ep_data[RNDIS_OUT_EP_IDX].ep_cb = rndis_bulk_out;
+    rndis->ep_data[RNDIS_IN_EP_IDX].ep_addr = in_ep;
+    rndis->ep_data[RNDIS_IN_EP_IDX].ep_cb = rndis_bulk_in;
+    rndis->ep_data[RNDIS_INT_EP_IDX].ep_addr = int_ep;
+    rndis->ep_data[RNDIS_INT_EP_IDX].ep_cb = rndis_int_in;
+
+    usbd_add_endpoint(busid, &rndis->ep_data[RNDIS_OUT_EP_IDX]);
+    usbd_add_endpoint(busid, &rndis->ep_data[RNDIS_IN_EP_IDX]);
+    usbd_add_endpoint(busid, &rndis->ep_data[RNDIS_INT_EP_IDX]);
+
+#ifdef CONFIG_USBDEV_RNDIS_ZERO_COPY
+    for (uint8_t i = 0; i < CONFIG_USBDEV_RNDIS_RX_POOL_NUM; i++) {
+        for (uint8_t j = 0; j < RNDIS_RX_PBUF_NUM; j++) {
+            rndis->zc.rx_pbuf[i][j].rndis = rndis;
+            rndis->zc.rx_pbuf[i][j].index = i;
+        }
+    }
+    rndis->zc.rx_free = 0xffffffffU >> (32 - CONFIG_USBDEV_RNDIS_RX_POOL_NUM);
+    rndis->zc.rx_armed = -1;
+    rndis->zc.rx_parsing = -1;
+#endif
+
     return intf;
 }
 
-int usbd_rndis_set_connect(bool connect)
+int usbd_rndis_set_connect(uint8_t busid, uint8_t intf, bool connect)
 {
-    if (!usb_device_is_configured(0)) {
+    struct usbd_rndis_priv *rndis = rndis_get_priv(busid, intf);
+
+    if (rndis == NULL) {
+        return -USB_ERR_NODEV;
+    }
+
+    if (!usb_device_is_configured(busid)) {
         return -USB_ERR_NOTCONN;
     }
 
-    if(g_usbd_rndis.set_rsp_get)
+    if(rndis->set_rsp_get)
         return -USB_ERR_BUSY;
 
     rndis_indicate_status_t *resp;
 
-    resp = ((rndis_indicate_status_t *)rndis_encapsulated_resp_buffer);
+    resp = ((rndis_indicate_status_t *)rndis->resp_buffer);
     resp->MessageType = REMOTE_NDIS_INDICATE_STATUS_MSG;
     resp->MessageLength = sizeof(rndis_indicate_status_t);
     if(connect) {
         resp->Status = RNDIS_STATUS_MEDIA_CONNECT;
-        g_usbd_rndis.link_status = NDIS_MEDIA_STATE_CONNECTED;
+        rndis->link_status = NDIS_MEDIA_STATE_CONNECTED;
     } else {
         resp->Status = RNDIS_STATUS_MEDIA_DISCONNECT;
-        g_usbd_rndis.link_status = NDIS_MEDIA_STATE_DISCONNECTED;
+        rndis->link_status = NDIS_MEDIA_STATE_DISCONNECTED;
     }
     resp->StatusBufferLength = 0;
     resp->StatusBufferOffset = 0;
 
-    rndis_notify_rsp();
+    rndis_notify_rsp(rndis);
 
     return 0;
 }
 
-__WEAK void usbd_rndis_data_recv_done(uint32_t len)
+__WEAK void usbd_rndis_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len)
 {
+    (void)busid;
+    (void)intf;
     (void)len;
 }
 
-__WEAK void usbd_rndis_data_send_done(uint32_t len)
+__WEAK void usbd_rndis_data_send_done(uint8_t busid, uint8_t intf, uint32_t len)
 {
+    (void)busid;
+    (void)intf;
     (void)len;
 }
\ No newline at end of file
@@ -12,22 +12,23 @@
 extern "C" {
 #endif
 
-/* Init rndis interface driver */
-struct usbd_interface *usbd_rndis_init_intf(struct usbd_interface *intf,
+/* Init rndis interface driver, call it for both interfaces of the function */
+struct usbd_interface *usbd_rndis_init_intf(uint8_t busid, struct usbd_interface *intf,
                                              const uint8_t out_ep,
                                              const uint8_t in_ep,
                                              const uint8_t int_ep, uint8_t mac[6]);
 
-int usbd_rndis_set_connect(bool connect);
+/* Functions below pick the instance by busid and its control interface number */
+int usbd_rndis_set_connect(uint8_t busid, uint8_t intf, bool connect);
 
-void usbd_rndis_data_recv_done(uint32_t len);
-void usbd_rndis_data_send_done(uint32_t len);
-int usbd_rndis_start_write(uint8_t *buf, uint32_t len);
-int usbd_rndis_start_read(uint8_t *buf, uint32_t len);
+void usbd_rndis_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len);
+void usbd_rndis_data_send_done(uint8_t busid, uint8_t intf, uint32_t len);
+int usbd_rndis_start_write(uint8_t busid, uint8_t intf, uint8_t *buf, uint32_t len);
+int usbd_rndis_start_read(uint8_t busid, uint8_t intf, uint8_t *buf, uint32_t len);
 
 #ifdef CONFIG_USBDEV_RNDIS_USING_LWIP
-struct pbuf *usbd_rndis_eth_rx(void);
-int usbd_rndis_eth_tx(struct pbuf *p);
+struct pbuf *usbd_rndis_eth_rx(uint8_t busid, uint8_t intf);
+int usbd_rndis_eth_tx(uint8_t busid, uint8_t intf, struct pbuf *p);
 #endif
 
 #ifdef __cplusplus
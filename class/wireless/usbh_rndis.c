@@ -18,7 +18,12 @@ USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_rndis_buf[512];
 #define CONFIG_USBHOST_RNDIS_ETH_MAX_FRAME_SIZE 1514
 #define CONFIG_USBHOST_RNDIS_ETH_MSG_SIZE       (CONFIG_USBHOST_RNDIS_ETH_MAX_FRAME_SIZE + 44)
 
+#ifdef CONFIG_USBHOST_URB_QUEUE
+static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_rndis_rx_buffer[CONFIG_USBHOST_URB_QUEUE_DEPTH][USB_ALIGN_UP(CONFIG_USBHOST_RNDIS_ETH_MAX_RX_SIZE, CONFIG_USB_ALIGN_SIZE)];
+static usb_osal_sem_t g_rndis_rx_sem;
+#else
 static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_rndis_rx_buffer[USB_ALIGN_UP(CONFIG_USBHOST_RNDIS_ETH_MAX_RX_SIZE, CONFIG_USB_ALIGN_SIZE)];
+#endif
 static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_rndis_tx_buffer[USB_ALIGN_UP(CONFIG_USBHOST_RNDIS_ETH_MAX_TX_SIZE, CONFIG_USB_ALIGN_SIZE)];
 // static USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t g_rndis_inttx_buffer[USB_ALIGN_UP(16, CONFIG_USB_ALIGN_SIZE)];
 
@@ -422,6 +427,15 @@ static int usbh_rndis_disconnect(struct usbh_hubport *hport, uint8_t intf)
     if (rndis_class) {
         if (rndis_class->bulkin) {
             usbh_kill_urb(&rndis_class->bulkin_urb);
+#ifdef CONFIG_USBHOST_URB_QUEUE
+            for (uint8_t i = 0; i < CONFIG_USBHOST_URB_QUEUE_DEPTH; i++) {
+                usbh_kill_urb(&rndis_class->bulkin_queue_urb[i]);
+            }
+            /* killed urbs are given back without callback, wake up rx thread by hand */
+            if (g_rndis_rx_sem) {
+                usb_osal_sem_give(g_rndis_rx_sem);
+            }
+#endif
         }
 
         if (rndis_class->bulkout) {
@@ -444,13 +458,143 @@ static int usbh_rndis_disconnect(struct usbh_hubport *hport, uint8_t intf)
     return ret;
 }
 
-void usbh_rndis_rx_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
+static void usbh_rndis_rx_msg(uint8_t *rx_buffer, uint32_t rx_length)
 {
-    uint32_t g_rndis_rx_length;
-    int ret;
     uint32_t pmg_offset;
     rndis_data_packet_t *pmsg;
     rndis_data_packet_t temp;
+    uint32_t total_len = rx_length;
+
+    pmg_offset = 0;
+    while (rx_length > 0) {
+        USB_LOG_DBG("rxlen:%u\r\n", (unsigned int)rx_length);
+
+        pmsg = (rndis_data_packet_t *)(rx_buffer + pmg_offset);
+
+        /* Not word-aligned case */
+        if (pmg_offset & 0x3) {
+            usb_memcpy(&temp, pmsg, sizeof(rndis_data_packet_t));
+            pmsg = &temp;
+        }
+
+        if (pmsg->MessageType == REMOTE_NDIS_PACKET_MSG) {
+            uint8_t *buf = (uint8_t *)(rx_buffer + pmg_offset + sizeof(rndis_generic_msg_t) + pmsg->DataOffset);
+
+            usbh_rndis_eth_input(buf, pmsg->DataLength);
+            pmg_offset += pmsg->MessageLength;
+            rx_length -= pmsg->MessageLength;
+
+            /* drop the last dummy byte, it is a short packet to tell us we have received a multiple of wMaxPacketSize */
+            if (rx_length < 4) {
+                rx_length = 0;
+            }
+        } else {
+            USB_LOG_ERR("offset:%u,remain:%u,total:%u\r\n", (unsigned int)pmg_offset, (unsigned int)rx_length, (unsigned int)total_len);
+            rx_length = 0;
+            USB_LOG_ERR("Error rndis packet message\r\n");
+        }
+    }
+}
+
+#ifdef CONFIG_USBHOST_URB_QUEUE
+static void usbh_rndis_rx_complete(void *arg, int nbytes)
+{
+    (void)arg;
+    (void)nbytes;
+
+    usb_osal_sem_give(g_rndis_rx_sem);
+}
+
+void usbh_rndis_rx_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
+{
+    struct usbh_urb *urb;
+    uint8_t rx_index;
+    int ret;
+
+    (void)CONFIG_USB_OSAL_THREAD_GET_ARGV;
+
+    USB_LOG_INFO("Create rndis rx thread\r\n");
+
+    if (g_rndis_rx_sem == NULL) {
+        g_rndis_rx_sem = usb_osal_sem_create(0);
+        if (g_rndis_rx_sem == NULL) {
+            goto delete;
+        }
+    }
+    // clang-format off
+find_class:
+    // clang-format on
+    g_rndis_class.connect_status = false;
+    if (usbh_find_class_instance("/dev/rndis") == NULL) {
+        goto delete;
+    }
+
+    while (g_rndis_class.connect_status == false) {
+        ret = usbh_rndis_get_connect_status(&g_rndis_class);
+        if (ret < 0) {
+            usb_osal_msleep(100);
+            goto find_class;
+        }
+        usb_osal_msleep(128);
+    }
+
+    /* every urb receives one whole transfer ended by a short packet */
+    for (uint8_t i = 0; i < CONFIG_USBHOST_URB_QUEUE_DEPTH; i++) {
+        usbh_bulk_urb_fill(&g_rndis_class.bulkin_queue_urb[i], g_rndis_class.hport, g_rndis_class.bulkin, g_rndis_rx_buffer[i], CONFIG_USBHOST_RNDIS_ETH_MAX_RX_SIZE, 0, usbh_rndis_rx_complete, NULL);
+        ret = usbh_submit_urb(&g_rndis_class.bulkin_queue_urb[i]);
+        if (ret < 0) {
+            goto kill_urbs;
+        }
+    }
+
+    rx_index = 0;
+    while (1) {
+        usb_osal_sem_take(g_rndis_rx_sem, USB_OSAL_WAITING_FOREVER);
+
+        urb = &g_rndis_class.bulkin_queue_urb[rx_index];
+        if (urb->errorcode == -USB_ERR_BUSY) {
+            /* stale wakeup, urbs complete in order */
+            continue;
+        }
+
+        if ((g_rndis_class.hport == NULL) || (urb->errorcode < 0)) {
+            goto kill_urbs;
+        }
+
+        if (urb->actual_length % USB_GET_MAXPACKETSIZE(g_rndis_class.bulkin->wMaxPacketSize)) {
+            usbh_rndis_rx_msg(g_rndis_rx_buffer[rx_index], urb->actual_length);
+        } else {
+            USB_LOG_ERR("Rx packet is overflow, please reduce tcp window size or increase CONFIG_USBHOST_RNDIS_ETH_MAX_RX_SIZE\r\n");
+        }
+
+        ret = usbh_submit_urb(urb);
+        if (ret < 0) {
+            goto kill_urbs;
+        }
+        rx_index = (rx_index + 1) % CONFIG_USBHOST_URB_QUEUE_DEPTH;
+    }
+    // clang-format off
+kill_urbs:
+    // clang-format on
+    for (uint8_t i = 0; i < CONFIG_USBHOST_URB_QUEUE_DEPTH; i++) {
+        usbh_kill_urb(&g_rndis_class.bulkin_queue_urb[i]);
+    }
+    goto find_class;
+    // clang-format off
+delete:
+    USB_LOG_INFO("Delete rndis rx thread\r\n");
+    if (g_rndis_rx_sem) {
+        usb_osal_sem_delete(g_rndis_rx_sem);
+        g_rndis_rx_sem = NULL;
+    }
+    usb_osal_thread_delete(NULL);
+    // clang-format on
+}
+#else
+void usbh_rndis_rx_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
+{
+    uint32_t g_rndis_rx_length;
+    int ret;
 #if CONFIG_USBHOST_RNDIS_ETH_MAX_RX_SIZE <= (16 * 1024)
     uint32_t transfer_size = CONFIG_USBHOST_RNDIS_ETH_MAX_RX_SIZE;
 #else
@@ -492,38 +636,8 @@ find_class:
          * Short packet cannot be zero.
         */
         if (g_rndis_rx_length % USB_GET_MAXPACKETSIZE(g_rndis_class.bulkin->wMaxPacketSize)) {
-            pmg_offset = 0;
-
-            uint32_t total_len = g_rndis_rx_length;
-
-            while (g_rndis_rx_length > 0) {
-                USB_LOG_DBG("rxlen:%u\r\n", (unsigned int)g_rndis_rx_length);
-
-                pmsg = (rndis_data_packet_t *)(g_rndis_rx_buffer + pmg_offset);
-
-                /* Not word-aligned case */
-                if (pmg_offset & 0x3) {
-                    usb_memcpy(&temp, pmsg, sizeof(rndis_data_packet_t));
-                    pmsg = &temp;
-                }
-
-                if (pmsg->MessageType == REMOTE_NDIS_PACKET_MSG) {
-                    uint8_t *buf = (uint8_t *)(g_rndis_rx_buffer + pmg_offset + sizeof(rndis_generic_msg_t) + pmsg->DataOffset);
-
-                    usbh_rndis_eth_input(buf, pmsg->DataLength);
-                    pmg_offset += pmsg->MessageLength;
-                    g_rndis_rx_length -= pmsg->MessageLength;
-
-                    /* drop the last dummy byte, it is a short packet to tell us we have received a multiple of wMaxPacketSize */
-                    if (g_rndis_rx_length < 4) {
-                        g_rndis_rx_length = 0;
-                    }
-                } else {
-                    USB_LOG_ERR("offset:%u,remain:%u,total:%u\r\n", (unsigned int)pmg_offset, (unsigned int)g_rndis_rx_length, (unsigned int)total_len);
-                    g_rndis_rx_length = 0;
-                    USB_LOG_ERR("Error rndis packet message\r\n");
-                }
-            }
+            usbh_rndis_rx_msg(g_rndis_rx_buffer, g_rndis_rx_length);
+            g_rndis_rx_length = 0;
         } else {
 #if CONFIG_USBHOST_RNDIS_ETH_MAX_RX_SIZE <= (16 * 1024)
             if (g_rndis_rx_length == CONFIG_USBHOST_RNDIS_ETH_MAX_RX_SIZE) {
@@ -543,6 +657,7 @@ delete:
     usb_osal_thread_delete(NULL);
     // clang-format on
 }
+#endif
 
 uint8_t *usbh_rndis_get_eth_txbuf(void)
 {
@@ -16,6 +16,9 @@ struct usbh_rndis {
     struct usbh_urb bulkin_urb;              /* Bulk IN urb */
     struct usbh_urb bulkout_urb;             /* Bulk OUT urb */
     struct usbh_urb intin_urb;               /* INTR IN urb */
+#ifdef CONFIG_USBHOST_URB_QUEUE
+    struct usbh_urb bulkin_queue_urb[CONFIG_USBHOST_URB_QUEUE_DEPTH]; /* Bulk IN urbs kept in flight */
+#endif
 
     uint8_t ctrl_intf; /* Control interface number */
     uint8_t data_intf; /* Data interface number */
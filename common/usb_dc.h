@@ -136,6 +136,14 @@ int usbd_ep_start_write(uint8_t busid, const uint8_t ep, const uint8_t *data, ui
  */
 int usbd_ep_start_read(uint8_t busid, const uint8_t ep, uint8_t *data, uint32_t data_len);
 
+/**
+ * @brief Called before the endpoints of a configuration are opened, so the port can plan
+ * its endpoint ram for every interface and alternate setting. The default does nothing.
+ *
+ * @param[in]  config_desc  Configuration descriptor followed by its interfaces and endpoints
+ */
+void usbd_config_prepare(uint8_t busid, const uint8_t *config_desc);
+
 /* usb dcd irq callback, called by user */
 
 /**
@@ -28,6 +28,9 @@ struct usbh_iso_frame_packet {
     int errorcode;
 };
 
+/* urb->transfer_flags */
+#define USBH_URB_NAK_POLL (1 << 0) /* interrupt urb keeps polling on nak in hcd instead of completing with -USB_ERR_NAK */
+
 /**
  * @brief USB Urb Configuration.
  *
@@ -93,6 +96,11 @@ int usbh_roothub_control(struct usbh_bus *bus, struct usb_setup_packet *setup, u
  * If timeout is not zero, this function will be in poll transfer mode,
  * otherwise will be in async transfer mode.
  *
+ * With CONFIG_USBHOST_URB_QUEUE, async urbs submitted to a busy bulk or interrupt endpoint
+ * are queued behind the pending ones and completed in order through urb->complete, data toggle
+ * is carried from one urb to the next by hcd. A poll mode urb still needs an idle endpoint,
+ * otherwise -USB_ERR_BUSY is returned.
+ *
  * @param urb Usb request block.
  * @return  On success will return 0, and others indicate fail.
  */
@@ -102,6 +110,8 @@ int usbh_submit_urb(struct usbh_urb *urb);
  * @brief Cancel a transfer request.
  *
  * This function will call When calls usbh_submit_urb and return -USB_ERR_TIMEOUT or -USB_ERR_SHUTDOWN.
+ * With CONFIG_USBHOST_URB_QUEUE, killing any urb of an endpoint cancels all urbs queued on it,
+ * they are given back with -USB_ERR_SHUTDOWN and without calling urb->complete.
  *
  * @param urb Usb request block.
  * @return  On success will return 0, and others indicate fail.
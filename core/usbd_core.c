@@ -414,6 +414,12 @@ static bool usbd_get_descriptor(uint8_t busid, uint16_t type_index, uint8_t **da
 }
 #endif
 
+__WEAK void usbd_config_prepare(uint8_t busid, const uint8_t *config_desc)
+{
+    (void)busid;
+    (void)config_desc;
+}
+
 /**
  * @brief set USB configuration
  *
@@ -454,6 +460,8 @@ static bool usbd_set_configuration(uint8_t busid, uint8_t config_index, uint8_t
                     current_desc_len = 0;
                     desc_len = (p[CONF_DESC_wTotalLength]) |
                                (p[CONF_DESC_wTotalLength + 1] << 8);
+
+                    usbd_config_prepare(busid, p);
                 }
 
                 break;
@@ -1421,6 +1429,14 @@ void usbd_webusb_desc_register(uint8_t busid, struct usb_webusb_descriptor *desc
 
 void usbd_add_interface(uint8_t busid, struct usbd_interface *intf)
 {
+    /* class init failed, keep the interface number but leave it without handlers */
+    if (intf == NULL) {
+        USB_LOG_ERR("Interface %u is not initialized\r\n", g_usbd_core[busid].intf_offset);
+        g_usbd_core[busid].intf[g_usbd_core[busid].intf_offset] = NULL;
+        g_usbd_core[busid].intf_offset++;
+        return;
+    }
+
     intf->intf_num = g_usbd_core[busid].intf_offset;
     g_usbd_core[busid].intf[g_usbd_core[busid].intf_offset] = intf;
     g_usbd_core[busid].intf_offset++;
@@ -708,6 +708,51 @@ int usbh_deinitialize(uint8_t busid)
     return 0;
 }
 
+#ifdef CONFIG_USBHOST_URB_QUEUE
+/* SET_CONFIGURATION, SET_INTERFACE and CLEAR_FEATURE(ENDPOINT_HALT) put the endpoints back to DATA0 */
+static void usbh_reset_ep_toggle(struct usbh_hubport *hport, struct usb_setup_packet *setup)
+{
+    struct usbh_interface *intf;
+    uint32_t mask = 0;
+    size_t flags;
+
+    if ((setup->bmRequestType & USB_REQUEST_TYPE_MASK) != USB_REQUEST_STANDARD) {
+        return;
+    }
+
+    switch (setup->bRequest) {
+        case USB_REQUEST_SET_CONFIGURATION:
+            mask = 0xffffffff;
+            break;
+        case USB_REQUEST_SET_INTERFACE:
+            for (uint8_t i = 0; i < MIN(hport->config.config_desc.bNumInterfaces, CONFIG_USBHOST_MAX_INTERFACES); i++) {
+                intf = &hport->config.intf[i];
+                if (intf->altsetting[0].intf_desc.bInterfaceNumber != (setup->wIndex & 0xff)) {
+                    continue;
+                }
+                for (uint8_t j = 0; j < intf->altsetting_num; j++) {
+                    for (uint8_t k = 0; k < MIN(intf->altsetting[j].intf_desc.bNumEndpoints, CONFIG_USBHOST_MAX_ENDPOINTS); k++) {
+                        mask |= USBH_EP_TOGGLE_MASK(intf->altsetting[j].ep[k].ep_desc.bEndpointAddress);
+                    }
+                }
+            }
+            break;
+        case USB_REQUEST_CLEAR_FEATURE:
+            if (((setup->bmRequestType & USB_REQUEST_RECIPIENT_MASK) == USB_REQUEST_RECIPIENT_ENDPOINT) &&
+                (setup->wValue == USB_FEATURE_ENDPOINT_HALT)) {
+                mask = USBH_EP_TOGGLE_MASK(setup->wIndex & 0xff);
+            }
+            break;
+        default:
+            break;
+    }
+
+    flags = usb_osal_enter_critical_section();
+    hport->ep_toggle &= ~mask;
+    usb_osal_leave_critical_section(flags);
+}
+#endif
+
 int usbh_control_transfer(struct usbh_hubport *hport, struct usb_setup_packet *setup, uint8_t *buffer)
 {
     struct usbh_urb *urb;
@@ -727,6 +772,9 @@ int usbh_control_transfer(struct usbh_hubport *hport, struct usb_setup_packet *s
     ret = usbh_submit_urb(urb);
     if (ret == 0) {
         ret = urb->actual_length;
+#ifdef CONFIG_USBHOST_URB_QUEUE
+        usbh_reset_ep_toggle(hport, setup);
+#endif
     }
 
     usb_osal_mutex_give(hport->mutex);
@@ -785,6 +833,139 @@ int usbh_set_interface(struct usbh_hubport *hport, uint8_t intf, uint8_t altsett
     return usbh_control_transfer(hport, setup, NULL);
 }
 
+static void usbh_int_pipe_complete(void *arg, int nbytes);
+
+static int usbh_int_pipe_submit(struct usbh_int_pipe *pipe)
+{
+    usbh_int_urb_fill(&pipe->urb, pipe->hport, pipe->ep, pipe->buffer + pipe->index * pipe->stride,
+                      pipe->report_size, 0, usbh_int_pipe_complete, pipe);
+    pipe->urb.transfer_flags |= USBH_URB_NAK_POLL;
+    return usbh_submit_urb(&pipe->urb);
+}
+
+static void usbh_int_pipe_stop(struct usbh_int_pipe *pipe, int errorcode)
+{
+    pipe->running = false;
+    USB_LOG_WRN("Int pipe ep 0x%02x stopped, errorcode:%d\r\n", pipe->ep->bEndpointAddress, errorcode);
+    pipe->callback(pipe->arg, NULL, errorcode);
+}
+
+static void usbh_int_pipe_nak_timeout(void *arg)
+{
+    struct usbh_int_pipe *pipe = (struct usbh_int_pipe *)arg;
+    int ret;
+
+    if (!pipe->running) {
+        return;
+    }
+
+    ret = usbh_int_pipe_submit(pipe);
+    if (ret < 0) {
+        usbh_int_pipe_stop(pipe, ret);
+    }
+}
+
+static void usbh_int_pipe_complete(void *arg, int nbytes)
+{
+    struct usbh_int_pipe *pipe = (struct usbh_int_pipe *)arg;
+    uint8_t *report;
+    int ret;
+
+    if (!pipe->running) {
+        return;
+    }
+
+    if (nbytes == -USB_ERR_NAK) {
+        /* hcd does not poll by itself, try again in next interval */
+        usb_osal_timer_start(pipe->nak_timer);
+        return;
+    } else if (nbytes < 0) {
+        usbh_int_pipe_stop(pipe, nbytes);
+        return;
+    }
+
+    if (nbytes > 0) {
+        report = pipe->buffer + pipe->index * pipe->stride;
+        pipe->index = (pipe->index + 1) % pipe->report_num;
+        pipe->callback(pipe->arg, report, nbytes);
+        if (!pipe->running) {
+            return;
+        }
+    }
+
+    ret = usbh_int_pipe_submit(pipe);
+    if (ret < 0) {
+        usbh_int_pipe_stop(pipe, ret);
+    }
+}
+
+int usbh_int_pipe_open(struct usbh_int_pipe *pipe,
+                       struct usbh_hubport *hport,
+                       struct usb_endpoint_descriptor *ep,
+                       uint8_t *buffer,
+                       uint32_t report_size,
+                       uint8_t report_num,
+                       usbh_int_pipe_callback_t callback,
+                       void *arg)
+{
+    uint32_t interval_ms;
+    int ret;
+
+    if (!pipe || !hport || !ep || !buffer || !report_size || !report_num || !callback) {
+        return -USB_ERR_INVAL;
+    }
+
+    if ((USB_GET_ENDPOINT_TYPE(ep->bmAttributes) != USB_ENDPOINT_TYPE_INTERRUPT) || !(ep->bEndpointAddress & 0x80)) {
+        return -USB_ERR_INVAL;
+    }
+
+    memset(pipe, 0, sizeof(struct usbh_int_pipe));
+    pipe->hport = hport;
+    pipe->ep = ep;
+    pipe->buffer = buffer;
+    pipe->report_size = report_size;
+    pipe->stride = USB_ALIGN_UP(report_size, CONFIG_USB_ALIGN_SIZE);
+    pipe->report_num = report_num;
+    pipe->callback = callback;
+    pipe->arg = arg;
+
+    interval_ms = USBH_GET_URB_INTERVAL(ep->bInterval, hport->speed) / 1000;
+    pipe->nak_timer = usb_osal_timer_create("intpipe_tim", interval_ms ? interval_ms : 1, usbh_int_pipe_nak_timeout, pipe, false);
+    if (pipe->nak_timer == NULL) {
+        USB_LOG_ERR("No memory to alloc int pipe timer\r\n");
+        return -USB_ERR_NOMEM;
+    }
+
+    pipe->running = true;
+    ret = usbh_int_pipe_submit(pipe);
+    if (ret < 0) {
+        pipe->running = false;
+        usb_osal_timer_delete(pipe->nak_timer);
+        pipe->nak_timer = NULL;
+        return ret;
+    }
+    return 0;
+}
+
+int usbh_int_pipe_close(struct usbh_int_pipe *pipe)
+{
+    size_t flags;
+
+    if (!pipe || !pipe->nak_timer) {
+        return -USB_ERR_INVAL;
+    }
+
+    flags = usb_osal_enter_critical_section();
+    pipe->running = false;
+    usb_osal_leave_critical_section(flags);
+
+    usb_osal_timer_delete(pipe->nak_timer);
+    pipe->nak_timer = NULL;
+    usbh_kill_urb(&pipe->urb);
+    pipe->urb.transfer_flags &= ~USBH_URB_NAK_POLL;
+    return 0;
+}
+
 static void *usbh_list_all_interface_name(struct usbh_hub *hub, const char *devname)
 {
     struct usbh_hubport *hport;
@@ -119,6 +119,33 @@ struct usbh_hubport {
     struct usb_endpoint_descriptor ep0;
     struct usbh_urb ep0_urb;
     usb_osal_mutex_t mutex;
+#ifdef CONFIG_USBHOST_URB_QUEUE
+    uint32_t ep_toggle; /* data toggle shared by queued urbs, bit n for out ep n, bit n + 16 for in ep n */
+#endif
+};
+
+#ifdef CONFIG_USBHOST_URB_QUEUE
+#define USBH_EP_TOGGLE_MASK(ep_addr) (1UL << (((ep_addr) & 0x0f) + (((ep_addr) & 0x80) ? 16 : 0)))
+#endif
+
+typedef void (*usbh_int_pipe_callback_t)(void *arg, uint8_t *buffer, int nbytes);
+
+/* Buffer size for a ring of num reports of size bytes, every report starts on an aligned address */
+#define USBH_INT_PIPE_BUFSIZE(size, num) (USB_ALIGN_UP(size, CONFIG_USB_ALIGN_SIZE) * (num))
+
+struct usbh_int_pipe {
+    struct usbh_urb urb;
+    struct usbh_hubport *hport;
+    struct usb_endpoint_descriptor *ep;
+    uint8_t *buffer;
+    uint32_t report_size;
+    uint32_t stride;
+    uint8_t report_num;
+    uint8_t index;
+    volatile bool running;
+    struct usb_osal_timer *nak_timer; /* re-poll for hcds that give back naks */
+    usbh_int_pipe_callback_t callback;
+    void *arg;
 };
 
 struct usbh_hub {
@@ -137,9 +164,8 @@ struct usbh_hub {
     struct usbh_hubport *parent;
     struct usbh_bus *bus;
     struct usb_endpoint_descriptor *intin;
-    struct usbh_urb intin_urb;
+    struct usbh_int_pipe intin_pipe;
     uint8_t *int_buffer;
-    struct usb_osal_timer *int_timer;
 };
 
 struct usbh_devaddr_map {
@@ -228,6 +254,24 @@ static inline void usbh_int_urb_fill(struct usbh_urb *urb,
     urb->interval = USBH_GET_URB_INTERVAL(ep->bInterval, hport->speed);
 }
 
+static inline void usbh_iso_urb_fill(struct usbh_urb *urb,
+                                     struct usbh_hubport *hport,
+                                     struct usb_endpoint_descriptor *ep,
+                                     uint32_t num_of_iso_packets,
+                                     usbh_complete_callback_t complete,
+                                     void *arg)
+{
+    urb->hport = hport;
+    urb->ep = ep;
+    urb->setup = NULL;
+    urb->transfer_buffer = NULL;
+    urb->transfer_buffer_length = 0;
+    urb->timeout = 0;
+    urb->num_of_iso_packets = num_of_iso_packets;
+    urb->complete = complete;
+    urb->arg = arg;
+}
+
 extern struct usbh_bus g_usbhost_bus[];
 #ifdef USBH_IRQHandler
 #error USBH_IRQHandler is obsolete, please call USBH_IRQHandler(xxx) in your irq
@@ -274,6 +318,40 @@ int usbh_get_string_desc(struct usbh_hubport *hport, uint8_t index, uint8_t *out
  */
 int usbh_set_interface(struct usbh_hubport *hport, uint8_t intf, uint8_t altsetting);
 
+/**
+ * @brief Open a persistent interrupt in pipe.
+ * The urb is submitted once and given back to the hcd again from its completion, reports are
+ * written round robin into a ring of report_num buffers, so the one passed to callback stays valid
+ * until report_num - 1 further reports arrive. Callback runs in interrupt context, nbytes < 0
+ * means the pipe stopped with this error.
+ *
+ * @param pipe Pipe to open.
+ * @param hport Hub port of the device.
+ * @param ep Interrupt in endpoint.
+ * @param buffer Ring buffer, size is USBH_INT_PIPE_BUFSIZE(report_size, report_num).
+ * @param report_size Max bytes of one report.
+ * @param report_num Buffers in the ring.
+ * @param callback Report callback.
+ * @param arg Callback argument.
+ * @return On success will return 0, and others indicate fail.
+ */
+int usbh_int_pipe_open(struct usbh_int_pipe *pipe,
+                       struct usbh_hubport *hport,
+                       struct usb_endpoint_descriptor *ep,
+                       uint8_t *buffer,
+                       uint32_t report_size,
+                       uint8_t report_num,
+                       usbh_int_pipe_callback_t callback,
+                       void *arg);
+
+/**
+ * @brief Stop a persistent interrupt pipe and kill its urb, not callable from pipe callback.
+ *
+ * @param pipe Pipe to close.
+ * @return On success will return 0, and others indicate fail.
+ */
+int usbh_int_pipe_close(struct usbh_int_pipe *pipe);
+
 int usbh_initialize(uint8_t busid, uintptr_t reg_base);
 int usbh_deinitialize(uint8_t busid);
 void *usbh_find_class_instance(const char *devname);
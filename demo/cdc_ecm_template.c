@@ -203,12 +203,9 @@ static const uint8_t cdc_ecm_descriptor[] = {
 
 const uint8_t mac[6] = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
 
-volatile bool cdc_ecm_tx_done = false;
-
-void usbd_cdc_ecm_data_send_done(uint32_t len)
-{
-    cdc_ecm_tx_done = true; // suggest you to use semaphore in os
-}
+/* the function uses interface 0 of the bus it is registered on */
+static uint8_t cdc_ecm_busid;
+#define CDC_ECM_INTF 0
 
 #ifdef RT_USING_LWIP
 
@@ -251,18 +248,19 @@ static rt_err_t rt_usbd_cdc_ecm_control(rt_device_t dev, int cmd, void *args)
 
 struct pbuf *rt_usbd_cdc_ecm_eth_rx(rt_device_t dev)
 {
-    return usbd_cdc_ecm_eth_rx();
+    return usbd_cdc_ecm_eth_rx(cdc_ecm_busid, CDC_ECM_INTF);
 }
 
 rt_err_t rt_usbd_cdc_ecm_eth_tx(rt_device_t dev, struct pbuf *p)
 {
     int ret;
 
-    cdc_ecm_tx_done = false;
-    ret = usbd_cdc_ecm_eth_tx(p);
+    /* the frame is queued, only wait while the tx queue is full */
+    do {
+        ret = usbd_cdc_ecm_eth_tx(cdc_ecm_busid, CDC_ECM_INTF, p);
+    } while (ret == -USB_ERR_BUSY);
+
     if (ret == 0) {
-        while (!cdc_ecm_tx_done) {
-        }
         return RT_EOK;
     } else
         return -RT_ERROR;
@@ -280,7 +278,7 @@ void cdc_ecm_lwip_init(void)
     dhcpd_start("u0");
 }
 
-void usbd_cdc_ecm_data_recv_done(uint32_t len)
+void usbd_cdc_ecm_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len)
 {
     eth_device_ready(&cdc_ecm_dev);
 }
@@ -353,11 +351,12 @@ err_t linkoutput_fn(struct netif *netif, struct pbuf *p)
 {
     int ret;
 
-    cdc_ecm_tx_done = false;
-    ret = usbd_cdc_ecm_eth_tx(p);
+    /* the frame is queued, only wait while the tx queue is full */
+    do {
+        ret = usbd_cdc_ecm_eth_tx(cdc_ecm_busid, CDC_ECM_INTF, p);
+    } while (ret == -USB_ERR_BUSY);
+
     if (ret == 0) {
-        while (!cdc_ecm_tx_done) {
-        }
         return ERR_OK;
     } else
         return ERR_BUF;
@@ -382,7 +381,7 @@ err_t cdc_ecm_if_input(struct netif *netif)
     err_t err;
     struct pbuf *p;
 
-    p = usbd_cdc_ecm_eth_rx();
+    p = usbd_cdc_ecm_eth_rx(cdc_ecm_busid, CDC_ECM_INTF);
     if (p != NULL) {
         err = netif->input(p, netif);
         if (err != ERR_OK) {
@@ -416,7 +415,7 @@ void cdc_ecm_lwip_init(void)
     }
 }
 
-void usbd_cdc_ecm_data_recv_done(uint32_t len)
+void usbd_cdc_ecm_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len)
 {
 }
 
@@ -461,6 +460,7 @@ struct usbd_interface intf1;
 */
 void cdc_ecm_init(uint8_t busid, uintptr_t reg_base)
 {
+    cdc_ecm_busid = busid;
     cdc_ecm_lwip_init();
 
 #ifdef CONFIG_USBDEV_ADVANCE_DESC
@@ -468,7 +468,7 @@ void cdc_ecm_init(uint8_t busid, uintptr_t reg_base)
 #else
     usbd_desc_register(busid, cdc_ecm_descriptor);
 #endif
-    usbd_add_interface(busid, usbd_cdc_ecm_init_intf(&intf0, CDC_INT_EP, CDC_OUT_EP, CDC_IN_EP));
-    usbd_add_interface(busid, usbd_cdc_ecm_init_intf(&intf1, CDC_INT_EP, CDC_OUT_EP, CDC_IN_EP));
+    usbd_add_interface(busid, usbd_cdc_ecm_init_intf(busid, &intf0, CDC_INT_EP, CDC_OUT_EP, CDC_IN_EP));
+    usbd_add_interface(busid, usbd_cdc_ecm_init_intf(busid, &intf1, CDC_INT_EP, CDC_OUT_EP, CDC_IN_EP));
     usbd_initialize(busid, reg_base, usbd_event_handler);
 }
\ No newline at end of file
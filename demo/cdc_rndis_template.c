@@ -176,12 +176,9 @@ static const uint8_t cdc_rndis_descriptor[] = {
 
 const uint8_t mac[6] = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
 
-volatile bool rndis_tx_done = false;
-
-void usbd_rndis_data_send_done(uint32_t len)
-{
-    rndis_tx_done = true; // suggest you to use semaphore in os
-}
+/* the function uses interface 0 of the bus it is registered on */
+static uint8_t rndis_busid;
+#define RNDIS_INTF 0
 
 #ifdef RT_USING_LWIP
 
@@ -199,6 +196,7 @@ void usbd_rndis_data_send_done(uint32_t len)
 #include <dhcp_server.h>
 
 struct eth_device rndis_dev;
+static struct rt_semaphore rndis_tx_sem;
 
 static rt_err_t rt_usbd_rndis_control(rt_device_t dev, int cmd, void *args)
 {
@@ -224,18 +222,22 @@ static rt_err_t rt_usbd_rndis_control(rt_device_t dev, int cmd, void *args)
 
 struct pbuf *rt_usbd_rndis_eth_rx(rt_device_t dev)
 {
-    return usbd_rndis_eth_rx();
+    return usbd_rndis_eth_rx(rndis_busid, RNDIS_INTF);
 }
 
 rt_err_t rt_usbd_rndis_eth_tx(rt_device_t dev, struct pbuf *p)
 {
     int ret;
 
-    rndis_tx_done = false;
-    ret = usbd_rndis_eth_tx(p);
-    if (ret == 0) {
-        while (!rndis_tx_done) {
+    /* packets are queued into the next transfer, only wait for one to finish when both tx buffers are taken */
+    while (1) {
+        ret = usbd_rndis_eth_tx(rndis_busid, RNDIS_INTF, p);
+        if ((ret != -USB_ERR_BUSY) || (rt_sem_take(&rndis_tx_sem, RT_TICK_PER_SECOND / 10) != RT_EOK)) {
+            break;
         }
+    }
+
+    if (ret == 0) {
         return RT_EOK;
     } else
         return -RT_ERROR;
@@ -247,17 +249,24 @@ void rndis_lwip_init(void)
     rndis_dev.eth_rx = rt_usbd_rndis_eth_rx;
     rndis_dev.eth_tx = rt_usbd_rndis_eth_tx;
 
+    rt_sem_init(&rndis_tx_sem, "rndis_tx", 0, RT_IPC_FLAG_FIFO);
+
     eth_device_init(&rndis_dev, "u0");
 
     eth_device_linkchange(&rndis_dev, RT_TRUE);
     dhcpd_start("u0");
 }
 
-void usbd_rndis_data_recv_done(uint32_t len)
+void usbd_rndis_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len)
 {
     eth_device_ready(&rndis_dev);
 }
 
+void usbd_rndis_data_send_done(uint8_t busid, uint8_t intf, uint32_t len)
+{
+    rt_sem_release(&rndis_tx_sem);
+}
+
 #else
 #include "netif/etharp.h"
 #include "lwip/init.h"
@@ -317,6 +326,7 @@ static bool dns_query_proc(const char *name, ip_addr_t *addr)
 }
 
 static struct netif rndis_netif; //network interface
+static volatile bool rndis_tx_done;
 
 /* Network interface name */
 #define IFNAME0        'E'
@@ -326,11 +336,18 @@ err_t linkoutput_fn(struct netif *netif, struct pbuf *p)
 {
     int ret;
 
-    rndis_tx_done = false;
-    ret = usbd_rndis_eth_tx(p);
-    if (ret == 0) {
-        while (!rndis_tx_done) {
+    /* packets are queued into the next transfer, only wait for one to finish when both tx buffers are taken */
+    while (1) {
+        rndis_tx_done = false;
+        ret = usbd_rndis_eth_tx(rndis_busid, RNDIS_INTF, p);
+        if (ret != -USB_ERR_BUSY) {
+            break;
         }
+        while (!rndis_tx_done && usb_device_is_configured(rndis_busid)) {
+        }
+    }
+
+    if (ret == 0) {
         return ERR_OK;
     } else
         return ERR_BUF;
@@ -355,7 +372,7 @@ err_t rndisif_input(struct netif *netif)
     err_t err;
     struct pbuf *p;
 
-    p = usbd_rndis_eth_rx();
+    p = usbd_rndis_eth_rx(rndis_busid, RNDIS_INTF);
     if (p != NULL) {
         err = netif->input(p, netif);
         if (err != ERR_OK) {
@@ -389,8 +406,13 @@ void rndis_lwip_init(void)
     }
 }
 
-void usbd_rndis_data_recv_done(uint32_t len)
+void usbd_rndis_data_recv_done(uint8_t busid, uint8_t intf, uint32_t len)
+{
+}
+
+void usbd_rndis_data_send_done(uint8_t busid, uint8_t intf, uint32_t len)
 {
+    rndis_tx_done = true;
 }
 
 void rndis_input_poll(void)
@@ -429,6 +451,7 @@ struct usbd_interface intf1;
 
 void cdc_rndis_init(uint8_t busid, uintptr_t reg_base)
 {
+    rndis_busid = busid;
     rndis_lwip_init();
 
 #ifdef CONFIG_USBDEV_ADVANCE_DESC
@@ -436,7 +459,7 @@ void cdc_rndis_init(uint8_t busid, uintptr_t reg_base)
 #else
     usbd_desc_register(busid, cdc_rndis_descriptor);
 #endif
-    usbd_add_interface(busid, usbd_rndis_init_intf(&intf0, CDC_OUT_EP, CDC_IN_EP, CDC_INT_EP, (uint8_t *)mac));
-    usbd_add_interface(busid, usbd_rndis_init_intf(&intf1, CDC_OUT_EP, CDC_IN_EP, CDC_INT_EP, (uint8_t *)mac));
+    usbd_add_interface(busid, usbd_rndis_init_intf(busid, &intf0, CDC_OUT_EP, CDC_IN_EP, CDC_INT_EP, (uint8_t *)mac));
+    usbd_add_interface(busid, usbd_rndis_init_intf(busid, &intf1, CDC_OUT_EP, CDC_IN_EP, CDC_INT_EP, (uint8_t *)mac));
     usbd_initialize(busid, reg_base, usbd_event_handler);
 }
@@ -116,23 +116,23 @@ delete:
 #endif
 
 #if CONFIG_TEST_USBH_HID
-USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t hid_buffer[128];
+#define TEST_USBH_HID_REPORT_SIZE 64
+#define TEST_USBH_HID_REPORT_NUM  4
 
-void usbh_hid_callback(void *arg, int nbytes)
+/* test with only one buffer ring, if you have more hid class, modify by yourself */
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t hid_buffer[USBH_INT_PIPE_BUFSIZE(TEST_USBH_HID_REPORT_SIZE, TEST_USBH_HID_REPORT_NUM)];
+
+void usbh_hid_callback(void *arg, uint8_t *buffer, int nbytes)
 {
-    struct usbh_hid *hid_class = (struct usbh_hid *)arg;
+    (void)arg;
 
     if (nbytes > 0) {
         for (int i = 0; i < nbytes; i++) {
-            USB_LOG_RAW("0x%02x ", hid_buffer[i]);
+            USB_LOG_RAW("0x%02x ", buffer[i]);
         }
         USB_LOG_RAW("nbytes:%d\r\n", (unsigned int)nbytes);
-        usbh_int_urb_fill(&hid_class->intin_urb, hid_class->hport, hid_class->intin, hid_buffer, hid_class->intin->wMaxPacketSize, 0, usbh_hid_callback, hid_class);
-        usbh_submit_urb(&hid_class->intin_urb);
-    } else if (nbytes == -USB_ERR_NAK) { /* only dwc2 should do this */
-        usbh_int_urb_fill(&hid_class->intin_urb, hid_class->hport, hid_class->intin, hid_buffer, hid_class->intin->wMaxPacketSize, 0, usbh_hid_callback, hid_class);
-        usbh_submit_urb(&hid_class->intin_urb);
     } else {
+        USB_LOG_RAW("hid pipe stopped, ret:%d\r\n", nbytes);
     }
 }
 
@@ -140,20 +140,16 @@ static void usbh_hid_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
 {
     int ret;
     struct usbh_hid *hid_class = (struct usbh_hid *)CONFIG_USB_OSAL_THREAD_GET_ARGV;
-    ;
-
-    /* test with only one buffer, if you have more hid class, modify by yourself */
 
-    /* Suggest you to use timer for int transfer and use ep interval */
-    usbh_int_urb_fill(&hid_class->intin_urb, hid_class->hport, hid_class->intin, hid_buffer, hid_class->intin->wMaxPacketSize, 0, usbh_hid_callback, hid_class);
-    ret = usbh_submit_urb(&hid_class->intin_urb);
+    /* pipe stays scheduled and polls at ep interval until hid class disconnects */
+    ret = usbh_int_pipe_open(&hid_class->intin_pipe, hid_class->hport, hid_class->intin, hid_buffer,
+                             MIN(USB_GET_MAXPACKETSIZE(hid_class->intin->wMaxPacketSize), TEST_USBH_HID_REPORT_SIZE),
+                             TEST_USBH_HID_REPORT_NUM, usbh_hid_callback, hid_class);
     if (ret < 0) {
-        goto delete;
+        USB_LOG_RAW("hid pipe open error,ret:%d\r\n", ret);
     }
-    // clang-format off
-delete:
+
     usb_osal_thread_delete(NULL);
-    // clang-format on
 }
 #endif
 
@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usb_osal.h"
+#include "usb_errno.h"
+#include "usb_config.h"
+#include "usb_log.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* Priorities are ignored, all threads run with the default linux policy.
+ * Critical section is one global recursive mutex, so code running under it
+ * (for example a software controller emulating an isr) is serialized.
+ */
+
+struct usb_posix_thread {
+    pthread_t tid;
+    usb_thread_entry_t entry;
+    void *args;
+};
+
+struct usb_posix_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t count;
+};
+
+struct usb_posix_mq {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t max_msgs;
+    uint32_t head;
+    uint32_t count;
+    uintptr_t msgs[];
+};
+
+struct usb_posix_timer {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct timespec deadline;
+    bool running;
+    bool exit;
+    struct usb_osal_timer *timer;
+};
+
+static pthread_mutex_t g_usb_posix_critical;
+static pthread_once_t g_usb_posix_once = PTHREAD_ONCE_INIT;
+
+static void usb_posix_once_init(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&g_usb_posix_critical, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void usb_posix_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void usb_posix_timespec_add(struct timespec *ts, uint32_t ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static void usb_posix_unlock(void *lock)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)lock);
+}
+
+/* A thread deleted while waiting gives the lock back */
+static int usb_posix_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *deadline)
+{
+    int ret;
+
+    pthread_cleanup_push(usb_posix_unlock, lock);
+    if (deadline == NULL) {
+        ret = pthread_cond_wait(cond, lock);
+    } else {
+        ret = pthread_cond_timedwait(cond, lock, deadline);
+    }
+    pthread_cleanup_pop(0);
+    return ret;
+}
+
+static void *usb_posix_thread_entry(void *arg)
+{
+    struct usb_posix_thread *thread = (struct usb_posix_thread *)arg;
+
+    thread->entry(thread->args);
+    return NULL;
+}
+
+usb_osal_thread_t usb_osal_thread_create(const char *name, uint32_t stack_size, uint32_t prio, usb_thread_entry_t entry, void *args)
+{
+    struct usb_posix_thread *thread;
+    pthread_attr_t attr;
+    int ret;
+
+    (void)prio;
+
+    thread = malloc(sizeof(struct usb_posix_thread));
+    if (thread == NULL) {
+        USB_LOG_ERR("Create thread %s failed\r\n", name);
+        while (1) {
+        }
+    }
+
+    thread->entry = entry;
+    thread->args = args;
+
+    pthread_attr_init(&attr);
+    if (stack_size < PTHREAD_STACK_MIN) {
+        stack_size = PTHREAD_STACK_MIN;
+    }
+    pthread_attr_setstacksize(&attr, stack_size);
+    ret = pthread_create(&thread->tid, &attr, usb_posix_thread_entry, thread);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        USB_LOG_ERR("Create thread %s failed\r\n", name);
+        while (1) {
+        }
+    }
+    return (usb_osal_thread_t)thread;
+}
+
+void usb_osal_thread_delete(usb_osal_thread_t thread)
+{
+    struct usb_posix_thread *posix_thread = (struct usb_posix_thread *)thread;
+
+    if (thread == NULL) {
+        pthread_detach(pthread_self());
+        pthread_exit(NULL);
+    }
+
+    if (pthread_equal(posix_thread->tid, pthread_self())) {
+        pthread_detach(posix_thread->tid);
+        free(posix_thread);
+        pthread_exit(NULL);
+    }
+
+    /* like a rtos task delete, the thread is gone on return and its mq or sem can be deleted */
+    pthread_cancel(posix_thread->tid);
+    pthread_join(posix_thread->tid, NULL);
+    free(posix_thread);
+}
+
+void usb_osal_thread_schedule_other(void)
+{
+    sched_yield();
+}
+
+usb_osal_sem_t usb_osal_sem_create(uint32_t initial_count)
+{
+    struct usb_posix_sem *sem;
+
+    sem = malloc(sizeof(struct usb_posix_sem));
+    if (sem == NULL) {
+        USB_LOG_ERR("Create semaphore failed\r\n");
+        while (1) {
+        }
+    }
+
+    pthread_mutex_init(&sem->lock, NULL);
+    usb_posix_cond_init(&sem->cond);
+    sem->count = initial_count;
+    return (usb_osal_sem_t)sem;
+}
+
+void usb_osal_sem_delete(usb_osal_sem_t sem)
+{
+    struct usb_posix_sem *posix_sem = (struct usb_posix_sem *)sem;
+
+    pthread_cond_destroy(&posix_sem->cond);
+    pthread_mutex_destroy(&posix_sem->lock);
+    free(posix_sem);
+}
+
+int usb_osal_sem_take(usb_osal_sem_t sem, uint32_t timeout)
+{
+    struct usb_posix_sem *posix_sem = (struct usb_posix_sem *)sem;
+    struct timespec deadline;
+    int ret = 0;
+
+    if (timeout != USB_OSAL_WAITING_FOREVER) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        usb_posix_timespec_add(&deadline, timeout);
+    }
+
+    pthread_mutex_lock(&posix_sem->lock);
+    while (posix_sem->count == 0) {
+        if (usb_posix_cond_wait(&posix_sem->cond, &posix_sem->lock,
+                                (timeout == USB_OSAL_WAITING_FOREVER) ? NULL : &deadline) == ETIMEDOUT) {
+            ret = -USB_ERR_TIMEOUT;
+            break;
+        }
+    }
+    if (ret == 0) {
+        posix_sem->count--;
+    }
+    pthread_mutex_unlock(&posix_sem->lock);
+    return ret;
+}
+
+int usb_osal_sem_give(usb_osal_sem_t sem)
+{
+    struct usb_posix_sem *posix_sem = (struct usb_posix_sem *)sem;
+
+    pthread_mutex_lock(&posix_sem->lock);
+    posix_sem->count++;
+    pthread_cond_signal(&posix_sem->cond);
+    pthread_mutex_unlock(&posix_sem->lock);
+    return 0;
+}
+
+void usb_osal_sem_reset(usb_osal_sem_t sem)
+{
+    struct usb_posix_sem *posix_sem = (struct usb_posix_sem *)sem;
+
+    pthread_mutex_lock(&posix_sem->lock);
+    posix_sem->count = 0;
+    pthread_mutex_unlock(&posix_sem->lock);
+}
+
+usb_osal_mutex_t usb_osal_mutex_create(void)
+{
+    pthread_mutex_t *mutex;
+
+    mutex = malloc(sizeof(pthread_mutex_t));
+    if (mutex == NULL) {
+        USB_LOG_ERR("Create mutex failed\r\n");
+        while (1) {
+        }
+    }
+    pthread_mutex_init(mutex, NULL);
+    return (usb_osal_mutex_t)mutex;
+}
+
+void usb_osal_mutex_delete(usb_osal_mutex_t mutex)
+{
+    pthread_mutex_destroy((pthread_mutex_t *)mutex);
+    free(mutex);
+}
+
+int usb_osal_mutex_take(usb_osal_mutex_t mutex)
+{
+    return (pthread_mutex_lock((pthread_mutex_t *)mutex) == 0) ? 0 : -USB_ERR_TIMEOUT;
+}
+
+int usb_osal_mutex_give(usb_osal_mutex_t mutex)
+{
+    return (pthread_mutex_unlock((pthread_mutex_t *)mutex) == 0) ? 0 : -USB_ERR_TIMEOUT;
+}
+
+usb_osal_mq_t usb_osal_mq_create(uint32_t max_msgs)
+{
+    struct usb_posix_mq *mq;
+
+    mq = malloc(sizeof(struct usb_posix_mq) + max_msgs * sizeof(uintptr_t));
+    if (mq == NULL) {
+        USB_LOG_ERR("Create mq failed\r\n");
+        while (1) {
+        }
+    }
+
+    pthread_mutex_init(&mq->lock, NULL);
+    usb_posix_cond_init(&mq->cond);
+    mq->max_msgs = max_msgs;
+    mq->head = 0;
+    mq->count = 0;
+    return (usb_osal_mq_t)mq;
+}
+
+void usb_osal_mq_delete(usb_osal_mq_t mq)
+{
+    struct usb_posix_mq *posix_mq = (struct usb_posix_mq *)mq;
+
+    pthread_cond_destroy(&posix_mq->cond);
+    pthread_mutex_destroy(&posix_mq->lock);
+    free(posix_mq);
+}
+
+/* Never blocks, as it may be called from isr context */
+int usb_osal_mq_send(usb_osal_mq_t mq, uintptr_t addr)
+{
+    struct usb_posix_mq *posix_mq = (struct usb_posix_mq *)mq;
+    int ret = 0;
+
+    pthread_mutex_lock(&posix_mq->lock);
+    if (posix_mq->count == posix_mq->max_msgs) {
+        ret = -USB_ERR_TIMEOUT;
+    } else {
+        posix_mq->msgs[(posix_mq->head + posix_mq->count) % posix_mq->max_msgs] = addr;
+        posix_mq->count++;
+        pthread_cond_signal(&posix_mq->cond);
+    }
+    pthread_mutex_unlock(&posix_mq->lock);
+    return ret;
+}
+
+int usb_osal_mq_recv(usb_osal_mq_t mq, uintptr_t *addr, uint32_t timeout)
+{
+    struct usb_posix_mq *posix_mq = (struct usb_posix_mq *)mq;
+    struct timespec deadline;
+    int ret = 0;
+
+    if (timeout != USB_OSAL_WAITING_FOREVER) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        usb_posix_timespec_add(&deadline, timeout);
+    }
+
+    pthread_mutex_lock(&posix_mq->lock);
+    while (posix_mq->count == 0) {
+        if (usb_posix_cond_wait(&posix_mq->cond, &posix_mq->lock,
+                                (timeout == USB_OSAL_WAITING_FOREVER) ? NULL : &deadline) == ETIMEDOUT) {
+            ret = -USB_ERR_TIMEOUT;
+            break;
+        }
+    }
+    if (ret == 0) {
+        *addr = posix_mq->msgs[posix_mq->head];
+        posix_mq->head = (posix_mq->head + 1) % posix_mq->max_msgs;
+        posix_mq->count--;
+    }
+    pthread_mutex_unlock(&posix_mq->lock);
+    return ret;
+}
+
+static void *usb_posix_timer_thread(void *arg)
+{
+    struct usb_posix_timer *posix_timer = (struct usb_posix_timer *)arg;
+    struct usb_osal_timer *timer = posix_timer->timer;
+    struct timespec now;
+
+    pthread_mutex_lock(&posix_timer->lock);
+    while (!posix_timer->exit) {
+        if (!posix_timer->running) {
+            pthread_cond_wait(&posix_timer->cond, &posix_timer->lock);
+            continue;
+        }
+
+        if (pthread_cond_timedwait(&posix_timer->cond, &posix_timer->lock, &posix_timer->deadline) != ETIMEDOUT) {
+            /* started again, stopped or deleted */
+            continue;
+        }
+
+        if (timer->is_period) {
+            usb_posix_timespec_add(&posix_timer->deadline, timer->timeout_ms);
+            /* do not try to catch up after a long stall */
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec > posix_timer->deadline.tv_sec + 1) {
+                posix_timer->deadline = now;
+                usb_posix_timespec_add(&posix_timer->deadline, timer->timeout_ms);
+            }
+        } else {
+            posix_timer->running = false;
+        }
+
+        pthread_mutex_unlock(&posix_timer->lock);
+        timer->handler(timer->argument);
+        pthread_mutex_lock(&posix_timer->lock);
+    }
+    pthread_mutex_unlock(&posix_timer->lock);
+
+    pthread_cond_destroy(&posix_timer->cond);
+    pthread_mutex_destroy(&posix_timer->lock);
+    free(posix_timer);
+    free(timer);
+    return NULL;
+}
+
+struct usb_osal_timer *usb_osal_timer_create(const char *name, uint32_t timeout_ms, usb_timer_handler_t handler, void *argument, bool is_period)
+{
+    struct usb_osal_timer *timer;
+    struct usb_posix_timer *posix_timer;
+    (void)name;
+
+    timer = malloc(sizeof(struct usb_osal_timer));
+    posix_timer = malloc(sizeof(struct usb_posix_timer));
+    if ((timer == NULL) || (posix_timer == NULL)) {
+        USB_LOG_ERR("Create usb_osal_timer failed\r\n");
+        while (1) {
+        }
+    }
+    memset(timer, 0, sizeof(struct usb_osal_timer));
+    memset(posix_timer, 0, sizeof(struct usb_posix_timer));
+
+    timer->handler = handler;
+    timer->argument = argument;
+    timer->is_period = is_period;
+    timer->timeout_ms = timeout_ms;
+    timer->timer = posix_timer;
+
+    posix_timer->timer = timer;
+    pthread_mutex_init(&posix_timer->lock, NULL);
+    usb_posix_cond_init(&posix_timer->cond);
+
+    if (pthread_create(&posix_timer->tid, NULL, usb_posix_timer_thread, posix_timer) != 0) {
+        USB_LOG_ERR("Create timer failed\r\n");
+        while (1) {
+        }
+    }
+    pthread_detach(posix_timer->tid);
+    return timer;
+}
+
+/* Must not be called from the timer handler */
+void usb_osal_timer_delete(struct usb_osal_timer *timer)
+{
+    struct usb_posix_timer *posix_timer = (struct usb_posix_timer *)timer->timer;
+
+    pthread_mutex_lock(&posix_timer->lock);
+    posix_timer->exit = true;
+    pthread_cond_signal(&posix_timer->cond);
+    pthread_mutex_unlock(&posix_timer->lock);
+}
+
+void usb_osal_timer_start(struct usb_osal_timer *timer)
+{
+    struct usb_posix_timer *posix_timer = (struct usb_posix_timer *)timer->timer;
+
+    pthread_mutex_lock(&posix_timer->lock);
+    clock_gettime(CLOCK_MONOTONIC, &posix_timer->deadline);
+    usb_posix_timespec_add(&posix_timer->deadline, timer->timeout_ms);
+    posix_timer->running = true;
+    pthread_cond_signal(&posix_timer->cond);
+    pthread_mutex_unlock(&posix_timer->lock);
+}
+
+void usb_osal_timer_stop(struct usb_osal_timer *timer)
+{
+    struct usb_posix_timer *posix_timer = (struct usb_posix_timer *)timer->timer;
+
+    pthread_mutex_lock(&posix_timer->lock);
+    posix_timer->running = false;
+    pthread_cond_signal(&posix_timer->cond);
+    pthread_mutex_unlock(&posix_timer->lock);
+}
+
+size_t usb_osal_enter_critical_section(void)
+{
+    pthread_once(&g_usb_posix_once, usb_posix_once_init);
+    pthread_mutex_lock(&g_usb_posix_critical);
+    return 1;
+}
+
+void usb_osal_leave_critical_section(size_t flag)
+{
+    (void)flag;
+    pthread_mutex_unlock(&g_usb_posix_critical);
+}
+
+void usb_osal_msleep(uint32_t delay)
+{
+    struct timespec ts;
+
+    ts.tv_sec = delay / 1000;
+    ts.tv_nsec = (long)(delay % 1000) * 1000000L;
+    while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR)) {
+    }
+}
+
+void *usb_osal_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void usb_osal_free(void *ptr)
+{
+    free(ptr);
+}
@@ -30,62 +30,18 @@ int USB_disk_status(void)
 
 int USB_disk_read(BYTE *buff, LBA_t sector, UINT count)
 {
-    int ret;
-    uint8_t *align_buf;
-
-    align_buf = (uint8_t *)buff;
-#ifdef CONFIG_USB_DCACHE_ENABLE
-    if ((uint32_t)buff & (CONFIG_USB_ALIGN_SIZE - 1)) {
-        align_buf = (uint8_t *)aligned_alloc(CONFIG_USB_ALIGN_SIZE, count * active_msc_class->blocksize);
-        if (!align_buf) {
-            printf("msc get align buf failed\r\n");
-            return -USB_ERR_NOMEM;
-        }
-    }
-#endif
-    ret = usbh_msc_scsi_read10(active_msc_class, sector, align_buf, count);
-    if (ret < 0) {
-        ret = RES_ERROR;
-    } else {
-        ret = RES_OK;
-    }
-#ifdef CONFIG_USB_DCACHE_ENABLE
-    if ((uint32_t)buff & (CONFIG_USB_ALIGN_SIZE - 1)) {
-        usb_memcpy(buff, align_buf, count * active_msc_class->blocksize);
-        free(align_buf);
+    if (usbh_msc_cache_read(active_msc_class, sector, (uint8_t *)buff, count) < 0) {
+        return RES_ERROR;
     }
-#endif
-    return ret;
+    return RES_OK;
 }
 
 int USB_disk_write(const BYTE *buff, LBA_t sector, UINT count)
 {
-    int ret;
-    uint8_t *align_buf;
-
-    align_buf = (uint8_t *)buff;
-#ifdef CONFIG_USB_DCACHE_ENABLE
-    if ((uint32_t)buff & (CONFIG_USB_ALIGN_SIZE - 1)) {
-        align_buf = (uint8_t *)aligned_alloc(CONFIG_USB_ALIGN_SIZE, count * active_msc_class->blocksize);
-        if (!align_buf) {
-            printf("msc get align buf failed\r\n");
-            return -USB_ERR_NOMEM;
-        }
-        usb_memcpy(align_buf, buff, count * active_msc_class->blocksize);
+    if (usbh_msc_cache_write(active_msc_class, sector, (const uint8_t *)buff, count) < 0) {
+        return RES_ERROR;
     }
-#endif
-    ret = usbh_msc_scsi_write10(active_msc_class, sector, align_buf, count);
-    if (ret < 0) {
-        ret = RES_ERROR;
-    } else {
-        ret = RES_OK;
-    }
-#ifdef CONFIG_USB_DCACHE_ENABLE
-    if ((uint32_t)buff & (CONFIG_USB_ALIGN_SIZE - 1)) {
-        free(align_buf);
-    }
-#endif
-    return ret;
+    return RES_OK;
 }
 
 int USB_disk_ioctl(BYTE cmd, void *buff)
@@ -94,7 +50,11 @@ int USB_disk_ioctl(BYTE cmd, void *buff)
 
     switch (cmd) {
         case CTRL_SYNC:
-            result = RES_OK;
+            if (usbh_msc_cache_flush(active_msc_class) < 0) {
+                result = RES_ERROR;
+            } else {
+                result = RES_OK;
+            }
             break;
 
         case GET_SECTOR_SIZE:
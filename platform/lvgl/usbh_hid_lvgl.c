@@ -91,8 +91,10 @@ struct usbh_hid_lvgl {
 
 static struct usbh_hid_lvgl g_hid_lvgl;
 
-USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t hid_mouse_buffer[64];
-USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t hid_keyboard_buffer[64];
+#define USBH_HID_LVGL_REPORT_NUM 2
+
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t hid_mouse_buffer[USBH_INT_PIPE_BUFSIZE(64, USBH_HID_LVGL_REPORT_NUM)];
+USB_NOCACHE_RAM_SECTION USB_MEM_ALIGNX uint8_t hid_keyboard_buffer[USBH_INT_PIPE_BUFSIZE(64, USBH_HID_LVGL_REPORT_NUM)];
 
 #if defined(LVGL_VERSION_MAJOR) && (LVGL_VERSION_MAJOR == 9)
 static void usbh_hid_lvgl_read_mouse(lv_indev_t *indev_drv, lv_indev_data_t *data)
@@ -307,25 +309,16 @@ lv_indev_t *usbh_hid_lvgl_add_keyboard(void)
     return indev;
 }
 
-void usbh_hid_mouse_callback(void *arg, int nbytes)
+void usbh_hid_mouse_callback(void *arg, uint8_t *buffer, int nbytes)
 {
-    struct usbh_hid *hid_class = (struct usbh_hid *)arg;
+    (void)arg;
 
     if (nbytes > 0) {
         struct usbh_hid_lvgl *hid_ctx = &g_hid_lvgl;
 
-        hid_ctx->mouse.left_button = hid_mouse_buffer[0];
-        hid_ctx->mouse.x += (int8_t)hid_mouse_buffer[1];
-        hid_ctx->mouse.y += (int8_t)hid_mouse_buffer[2];
-
-        usbh_int_urb_fill(&hid_class->intin_urb, hid_class->hport, hid_class->intin, hid_mouse_buffer, hid_class->intin->wMaxPacketSize, 0,
-                          usbh_hid_mouse_callback, hid_class);
-        usbh_submit_urb(&hid_class->intin_urb);
-    } else if (nbytes == -USB_ERR_NAK) { /* only dwc2 should do this */
-        usbh_int_urb_fill(&hid_class->intin_urb, hid_class->hport, hid_class->intin, hid_mouse_buffer, hid_class->intin->wMaxPacketSize, 0,
-                          usbh_hid_mouse_callback, hid_class);
-        usbh_submit_urb(&hid_class->intin_urb);
-    } else {
+        hid_ctx->mouse.left_button = buffer[0];
+        hid_ctx->mouse.x += (int8_t)buffer[1];
+        hid_ctx->mouse.y += (int8_t)buffer[2];
     }
 }
 
@@ -370,13 +363,13 @@ static char usb_hid_get_keyboard_char(uint8_t key, uint8_t shift)
     return ret_key;
 }
 
-void usbh_hid_keyboard_callback(void *arg, int nbytes)
+void usbh_hid_keyboard_callback(void *arg, uint8_t *buffer, int nbytes)
 {
-    struct usbh_hid *hid_class = (struct usbh_hid *)arg;
+    (void)arg;
 
     if (nbytes > 0) {
         struct usbh_hid_lvgl *hid_ctx = &g_hid_lvgl;
-        struct usb_hid_kbd_report *keyboard = (struct usb_hid_kbd_report *)hid_keyboard_buffer;
+        struct usb_hid_kbd_report *keyboard = (struct usb_hid_kbd_report *)buffer;
 
         for (int i = 0; i < 6; i++) {
             if ((keyboard->key[i] <= HID_KBD_USAGE_MAX) && (keyboard->key[i] > HID_KBD_USAGE_NONE)) {
@@ -419,15 +412,6 @@ void usbh_hid_keyboard_callback(void *arg, int nbytes)
                 hid_ctx->kb.pressed = true;
             }
         }
-
-        usbh_int_urb_fill(&hid_class->intin_urb, hid_class->hport, hid_class->intin, hid_keyboard_buffer, hid_class->intin->wMaxPacketSize, 0,
-                        usbh_hid_keyboard_callback, hid_class);
-        usbh_submit_urb(&hid_class->intin_urb);
-    } else if (nbytes == -USB_ERR_NAK) { /* only dwc2 should do this */
-        usbh_int_urb_fill(&hid_class->intin_urb, hid_class->hport, hid_class->intin, hid_keyboard_buffer, hid_class->intin->wMaxPacketSize, 0,
-                        usbh_hid_keyboard_callback, hid_class);
-        usbh_submit_urb(&hid_class->intin_urb);
-    } else {
     }
 }
 
@@ -438,13 +422,13 @@ void usbh_hid_run(struct usbh_hid *hid_class)
     usbh_hid_set_protocol(hid_class, 0);
 
     if (hid_class->hport->config.intf[hid_class->intf].altsetting[0].intf_desc.bInterfaceProtocol == HID_PROTOCOL_KEYBOARD) {
-        usbh_int_urb_fill(&hid_class->intin_urb, hid_class->hport, hid_class->intin, hid_keyboard_buffer, hid_class->intin->wMaxPacketSize, 0,
-                          usbh_hid_keyboard_callback, hid_class);
-        usbh_submit_urb(&hid_class->intin_urb);
+        usbh_int_pipe_open(&hid_class->intin_pipe, hid_class->hport, hid_class->intin, hid_keyboard_buffer,
+                           MIN(USB_GET_MAXPACKETSIZE(hid_class->intin->wMaxPacketSize), 64), USBH_HID_LVGL_REPORT_NUM,
+                           usbh_hid_keyboard_callback, hid_class);
     } else if (hid_class->hport->config.intf[hid_class->intf].altsetting[0].intf_desc.bInterfaceProtocol == HID_PROTOCOL_MOUSE) {
-        usbh_int_urb_fill(&hid_class->intin_urb, hid_class->hport, hid_class->intin, hid_mouse_buffer, hid_class->intin->wMaxPacketSize, 0,
-                          usbh_hid_mouse_callback, hid_class);
-        usbh_submit_urb(&hid_class->intin_urb);
+        usbh_int_pipe_open(&hid_class->intin_pipe, hid_class->hport, hid_class->intin, hid_mouse_buffer,
+                           MIN(USB_GET_MAXPACKETSIZE(hid_class->intin->wMaxPacketSize), 64), USBH_HID_LVGL_REPORT_NUM,
+                           usbh_hid_mouse_callback, hid_class);
     } else {
     }
 }
@@ -195,14 +195,13 @@ VOID _fx_usbh_msc_driver(FX_MEDIA *media_ptr)
     case FX_DRIVER_READ: {
         msc_class = (struct usbh_msc *)media_ptr->fx_media_driver_info;
 
-        ret = usbh_msc_scsi_read10(msc_class, media_ptr->fx_media_driver_logical_sector + media_ptr->fx_media_hidden_sectors, media_ptr->fx_media_driver_buffer,
-                                   media_ptr->fx_media_driver_sectors);
+        ret = usbh_msc_cache_read(msc_class, media_ptr->fx_media_driver_logical_sector + media_ptr->fx_media_hidden_sectors, media_ptr->fx_media_driver_buffer,
+                                  media_ptr->fx_media_driver_sectors);
 
         if (ret < 0) {
             media_ptr->fx_media_driver_status = FX_IO_ERROR;
             return;
         }
-        printf("read success\r\n");
         /* Successful driver request.  */
         media_ptr->fx_media_driver_status = FX_SUCCESS;
         break;
@@ -211,8 +210,8 @@ VOID _fx_usbh_msc_driver(FX_MEDIA *media_ptr)
     case FX_DRIVER_WRITE: {
         msc_class = (struct usbh_msc *)media_ptr->fx_media_driver_info;
 
-        ret = usbh_msc_scsi_write10(msc_class, media_ptr->fx_media_driver_logical_sector + media_ptr->fx_media_hidden_sectors,
-                                    media_ptr->fx_media_driver_buffer, media_ptr->fx_media_driver_sectors);
+        ret = usbh_msc_cache_write(msc_class, media_ptr->fx_media_driver_logical_sector + media_ptr->fx_media_hidden_sectors,
+                                   media_ptr->fx_media_driver_buffer, media_ptr->fx_media_driver_sectors);
         if (ret < 0) {
             media_ptr->fx_media_driver_status = FX_IO_ERROR;
             return;
@@ -223,6 +222,12 @@ VOID _fx_usbh_msc_driver(FX_MEDIA *media_ptr)
     }
 
     case FX_DRIVER_FLUSH: {
+        msc_class = (struct usbh_msc *)media_ptr->fx_media_driver_info;
+
+        if (usbh_msc_cache_flush(msc_class) < 0) {
+            media_ptr->fx_media_driver_status = FX_IO_ERROR;
+            return;
+        }
         /* Return driver success.  */
         media_ptr->fx_media_driver_status = FX_SUCCESS;
         break;
@@ -254,8 +259,10 @@ VOID _fx_usbh_msc_driver(FX_MEDIA *media_ptr)
     }
 
     case FX_DRIVER_UNINIT: {
-        /* There is nothing to do in this case for the RAM driver.  For actual
-           devices some shutdown processing may be necessary.  */
+        msc_class = (struct usbh_msc *)media_ptr->fx_media_driver_info;
+
+        /* Write back cached sectors before media is released.  */
+        usbh_msc_cache_flush(msc_class);
 
         /* Successful driver request.  */
         media_ptr->fx_media_driver_status = FX_SUCCESS;
@@ -265,7 +272,7 @@ VOID _fx_usbh_msc_driver(FX_MEDIA *media_ptr)
     case FX_DRIVER_BOOT_READ: {
         msc_class = (struct usbh_msc *)media_ptr->fx_media_driver_info;
 
-        ret = usbh_msc_scsi_read10(msc_class, 0, media_ptr->fx_media_driver_buffer, 1);
+        ret = usbh_msc_cache_read(msc_class, 0, media_ptr->fx_media_driver_buffer, 1);
         if (ret < 0) {
             media_ptr->fx_media_driver_status = FX_IO_ERROR;
             return;
@@ -279,7 +286,7 @@ VOID _fx_usbh_msc_driver(FX_MEDIA *media_ptr)
     case FX_DRIVER_BOOT_WRITE: {
         msc_class = (struct usbh_msc *)media_ptr->fx_media_driver_info;
 
-        ret = usbh_msc_scsi_write10(msc_class, 0, media_ptr->fx_media_driver_buffer, 1);
+        ret = usbh_msc_cache_write(msc_class, 0, media_ptr->fx_media_driver_buffer, 1);
         if (ret < 0) {
             media_ptr->fx_media_driver_status = FX_IO_ERROR;
             return;
@@ -36,67 +36,28 @@ static int disk_msc_access_status(struct disk_info *disk)
 static int disk_msc_access_read(struct disk_info *disk, uint8_t *buff,
                                 uint32_t sector, uint32_t count)
 {
-    int ret;
-    uint8_t *align_buf;
-
-    align_buf = (uint8_t *)buff;
-#ifdef CONFIG_DCACHE
-    if ((uint32_t)buff & (CONFIG_USB_ALIGN_SIZE - 1)) {
-        align_buf = (uint8_t *)k_aligned_alloc(CONFIG_USB_ALIGN_SIZE, count * active_msc_class->blocksize);
-        if (!align_buf) {
-            printf("msc get align buf failed\r\n");
-            return -ENOMEM;
-        }
-    }
-#endif
-    if (usbh_msc_scsi_read10(active_msc_class, sector, align_buf, count) < 0) {
-        ret = -EIO;
-    } else {
-        ret = 0;
-    }
-#ifdef CONFIG_DCACHE
-    if ((uint32_t)buff & (CONFIG_USB_ALIGN_SIZE - 1)) {
-        usb_memcpy(buff, align_buf, count * active_msc_class->blocksize);
-        k_free(align_buf);
+    if (usbh_msc_cache_read(active_msc_class, sector, buff, count) < 0) {
+        return -EIO;
     }
-#endif
-    return ret;
+    return 0;
 }
 
 static int disk_msc_access_write(struct disk_info *disk, const uint8_t *buff,
                                  uint32_t sector, uint32_t count)
 {
-    int ret;
-    uint8_t *align_buf;
-
-    align_buf = (uint8_t *)buff;
-#ifdef CONFIG_DCACHE
-    if ((uint32_t)buff & (CONFIG_USB_ALIGN_SIZE - 1)) {
-        align_buf = (uint8_t *)k_aligned_alloc(CONFIG_USB_ALIGN_SIZE, count * active_msc_class->blocksize);
-        if (!align_buf) {
-            printf("msc get align buf failed\r\n");
-            return -ENOMEM;
-        }
-        usb_memcpy(align_buf, buff, count * active_msc_class->blocksize);
-    }
-#endif
-    if (usbh_msc_scsi_write10(active_msc_class, sector, align_buf, count) < 0) {
-        ret = -EIO;
-    } else {
-        ret = 0;
-    }
-#ifdef CONFIG_DCACHE
-    if ((uint32_t)buff & (CONFIG_USB_ALIGN_SIZE - 1)) {
-        k_free(align_buf);
+    if (usbh_msc_cache_write(active_msc_class, sector, buff, count) < 0) {
+        return -EIO;
     }
-#endif
-    return ret;
+    return 0;
 }
 
 static int disk_msc_access_ioctl(struct disk_info *disk, uint8_t cmd, void *buff)
 {
     switch (cmd) {
         case DISK_IOCTL_CTRL_SYNC:
+            if (usbh_msc_cache_flush(active_msc_class) < 0) {
+                return -EIO;
+            }
             break;
         case DISK_IOCTL_GET_SECTOR_COUNT:
             *(uint32_t *)buff = active_msc_class->blocknum;
@@ -110,6 +71,9 @@ static int disk_msc_access_ioctl(struct disk_info *disk, uint8_t cmd, void *buff
         case DISK_IOCTL_CTRL_INIT:
             return disk_msc_access_init(disk);
         case DISK_IOCTL_CTRL_DEINIT:
+            if (usbh_msc_cache_flush(active_msc_class) < 0) {
+                return -EIO;
+            }
             break;
         default:
             return -EINVAL;
@@ -61,6 +61,17 @@
 #define USB_OTG_OUTEP(i) ((DWC2_OUTEndpointTypeDef *)(USBD_BASE + USB_OTG_OUT_ENDPOINT_BASE + ((i)*USB_OTG_EP_REG_SIZE)))
 #define USB_OTG_FIFO(i)  *(__IO uint32_t *)(USBD_BASE + USB_OTG_FIFO_BASE + ((i)*USB_OTG_FIFO_SIZE))
 
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+/* Descriptors in the ring of every endpoint, the last one always carries L */
+#ifndef CONFIG_USB_DWC2_DMA_DESC_NUM
+#define CONFIG_USB_DWC2_DMA_DESC_NUM 8
+#endif
+
+#if (CONFIG_USB_DWC2_DMA_DESC_NUM < 2) || (CONFIG_USB_DWC2_DMA_DESC_NUM > 32)
+#error "CONFIG_USB_DWC2_DMA_DESC_NUM must be 2 ~ 32"
+#endif
+#endif
+
 extern uint32_t SystemCoreClock;
 
 /* Endpoint state */
@@ -71,6 +82,15 @@ struct dwc2_ep_state {
     uint8_t *xfer_buf;
     uint32_t xfer_len;
     uint32_t actual_xfer_len;
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    uint16_t ep_interval; /* iso service interval in (micro)frames */
+    uint16_t iso_frame;   /* frame number of the next queued iso in descriptor */
+    uint8_t desc_head;    /* oldest descriptor not yet reaped */
+    uint8_t desc_tail;    /* next free descriptor */
+    uint8_t desc_count;   /* descriptors queued */
+    uint32_t desc_end;    /* bitmask of descriptors that end a transfer */
+    uint32_t desc_len[CONFIG_USB_DWC2_DMA_DESC_NUM];
+#endif
 };
 
 /* Driver state */
@@ -83,6 +103,14 @@ USB_NOCACHE_RAM_SECTION struct dwc2_udc {
     struct dwc2_ep_state out_ep[16]; /*!< OUT endpoint parameters */
 } g_dwc2_udc[CONFIG_USBDEV_MAX_BUS];
 
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+USB_NOCACHE_RAM_SECTION struct dwc2_ddma {
+    USB_MEM_ALIGNX struct dwc2_dma_desc setup_desc;
+    USB_MEM_ALIGNX struct dwc2_dma_desc in_desc[16][CONFIG_USB_DWC2_DMA_DESC_NUM];
+    USB_MEM_ALIGNX struct dwc2_dma_desc out_desc[16][CONFIG_USB_DWC2_DMA_DESC_NUM];
+} g_dwc2_ddma[CONFIG_USBDEV_MAX_BUS];
+#endif
+
 static inline int dwc2_reset(uint8_t busid)
 {
     volatile uint32_t count = 0U;
@@ -333,6 +361,15 @@ static void dwc2_ep0_start_read_setup(uint8_t busid, uint8_t *psetup)
     USB_OTG_OUTEP(0U)->DOEPTSIZ |= (3U * 8U);
     USB_OTG_OUTEP(0U)->DOEPTSIZ |= USB_OTG_DOEPTSIZ_STUPCNT;
 
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+        g_dwc2_ddma[busid].setup_desc.buf = (uint32_t)psetup;
+        g_dwc2_ddma[busid].setup_desc.status = DWC2_DESC_BS_HOST_READY | DWC2_DESC_L | DWC2_DESC_IOC | 8U;
+        USB_OTG_OUTEP(0U)->DOEPDMA = (uint32_t)&g_dwc2_ddma[busid].setup_desc;
+        USB_OTG_OUTEP(0U)->DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_USBAEP;
+        return;
+    }
+#endif
     if (g_dwc2_udc[busid].user_params.device_dma_enable) {
         USB_OTG_OUTEP(0U)->DOEPDMA = (uint32_t)psetup;
         /* EP enable */
@@ -407,6 +444,275 @@ static void dwc2_tx_fifo_empty_procecss(uint8_t busid, uint8_t ep_idx)
     }
 }
 
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+static inline struct dwc2_dma_desc *dwc2_ddma_ring(uint8_t busid, uint8_t ep)
+{
+    if (USB_EP_DIR_IS_OUT(ep)) {
+        return g_dwc2_ddma[busid].out_desc[USB_EP_GET_IDX(ep)];
+    } else {
+        return g_dwc2_ddma[busid].in_desc[USB_EP_GET_IDX(ep)];
+    }
+}
+
+static inline struct dwc2_ep_state *dwc2_ddma_ep_state(uint8_t busid, uint8_t ep)
+{
+    if (USB_EP_DIR_IS_OUT(ep)) {
+        return &g_dwc2_udc[busid].out_ep[USB_EP_GET_IDX(ep)];
+    } else {
+        return &g_dwc2_udc[busid].in_ep[USB_EP_GET_IDX(ep)];
+    }
+}
+
+static void dwc2_ddma_ring_reset(uint8_t busid, uint8_t ep)
+{
+    struct dwc2_dma_desc *ring = dwc2_ddma_ring(busid, ep);
+    struct dwc2_ep_state *ep_state = dwc2_ddma_ep_state(busid, ep);
+
+    for (uint8_t i = 0; i < CONFIG_USB_DWC2_DMA_DESC_NUM; i++) {
+        ring[i].status = DWC2_DESC_BS_HOST_BUSY;
+        ring[i].buf = 0;
+    }
+    ep_state->desc_head = 0;
+    ep_state->desc_tail = 0;
+    ep_state->desc_count = 0;
+    ep_state->desc_end = 0;
+    ep_state->actual_xfer_len = 0;
+}
+
+/* Point the core at the oldest queued descriptor, it walks forward until it meets
+ * a descriptor that is not ready (bna) or one with L set.
+ */
+static void dwc2_ddma_start(uint8_t busid, uint8_t ep)
+{
+    uint8_t ep_idx = USB_EP_GET_IDX(ep);
+    struct dwc2_ep_state *ep_state = dwc2_ddma_ep_state(busid, ep);
+    struct dwc2_dma_desc *desc = &dwc2_ddma_ring(busid, ep)[ep_state->desc_head];
+
+    if (USB_EP_DIR_IS_OUT(ep)) {
+        USB_OTG_OUTEP(ep_idx)->DOEPDMA = (uint32_t)desc;
+        USB_OTG_OUTEP(ep_idx)->DOEPCTL |= (USB_OTG_DOEPCTL_CNAK | USB_OTG_DOEPCTL_EPENA);
+    } else {
+        USB_OTG_INEP(ep_idx)->DIEPDMA = (uint32_t)desc;
+        USB_OTG_INEP(ep_idx)->DIEPCTL |= (USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_EPENA);
+    }
+}
+
+static inline bool dwc2_ddma_ep_enabled(uint8_t busid, uint8_t ep)
+{
+    uint8_t ep_idx = USB_EP_GET_IDX(ep);
+
+    if (USB_EP_DIR_IS_OUT(ep)) {
+        return (USB_OTG_OUTEP(ep_idx)->DOEPCTL & USB_OTG_DOEPCTL_EPENA) ? true : false;
+    } else {
+        return (USB_OTG_INEP(ep_idx)->DIEPCTL & USB_OTG_DIEPCTL_EPENA) ? true : false;
+    }
+}
+
+static int dwc2_ddma_queue(uint8_t busid, uint8_t ep, const struct usbd_dwc2_sg *sg, uint8_t nents)
+{
+    uint8_t ep_idx = USB_EP_GET_IDX(ep);
+    struct dwc2_ep_state *ep_state = dwc2_ddma_ep_state(busid, ep);
+    struct dwc2_dma_desc *ring = dwc2_ddma_ring(busid, ep);
+    struct dwc2_dma_desc *desc;
+    uint32_t mps = ep_state->ep_mps;
+    uint32_t maxlen, len, chunk, status, first_status = 0;
+    uint8_t *buf;
+    uint8_t first = ep_state->desc_tail;
+    uint8_t need = 0;
+    bool iso = (ep_state->ep_type == USB_ENDPOINT_TYPE_ISOCHRONOUS);
+    size_t flags;
+
+    if (iso) {
+        maxlen = USB_EP_DIR_IS_OUT(ep) ? DWC2_DESC_ISOC_RX_NBYTES_Msk : DWC2_DESC_ISOC_TX_NBYTES_Msk;
+    } else if (ep_idx == 0) {
+        maxlen = mps;
+    } else {
+        maxlen = DWC2_DESC_NBYTES_Msk - (DWC2_DESC_NBYTES_Msk % mps);
+    }
+
+    /* Out, iso and ep0 transfers live in one descriptor, a short packet closes it */
+    if ((nents != 1) && (iso || (ep_idx == 0) || USB_EP_DIR_IS_OUT(ep))) {
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < nents; i++) {
+        len = sg[i].len;
+        if (ep_idx == 0) {
+            len = MIN(len, mps);
+        }
+        if ((len > maxlen) && (iso || USB_EP_DIR_IS_OUT(ep))) {
+            return -1;
+        }
+        /* The core never merges two descriptors into one packet */
+        if ((i != (nents - 1)) && (len % mps)) {
+            return -1;
+        }
+        need += len ? ((len + maxlen - 1) / maxlen) : 1;
+    }
+
+    flags = usb_osal_enter_critical_section();
+
+    if ((ep_state->desc_count + need) > CONFIG_USB_DWC2_DMA_DESC_NUM) {
+        usb_osal_leave_critical_section(flags);
+        return -3;
+    }
+
+    if (iso && USB_EP_DIR_IS_IN(ep) && (ep_state->desc_count == 0) && !dwc2_ddma_ep_enabled(busid, ep)) {
+        ep_state->iso_frame = (((USB_OTG_DEV->DSTS & USB_OTG_DSTS_FNSOF) >> USB_OTG_DSTS_FNSOF_Pos) + ep_state->ep_interval) & 0x3FFFU;
+    }
+
+    for (uint8_t i = 0; i < nents; i++) {
+        buf = (uint8_t *)sg[i].buf;
+        len = (ep_idx == 0) ? MIN(sg[i].len, mps) : sg[i].len;
+        if (!buf) {
+            buf = (uint8_t *)&g_dwc2_udc[busid].setup;
+        }
+
+        if (USB_EP_DIR_IS_OUT(ep)) {
+            usb_dcache_invalidate((uintptr_t)buf, USB_ALIGN_UP(len, CONFIG_USB_ALIGN_SIZE));
+        } else {
+            usb_dcache_clean((uintptr_t)buf, USB_ALIGN_UP(len, CONFIG_USB_ALIGN_SIZE));
+        }
+
+        do {
+            chunk = MIN(len, maxlen);
+            desc = &ring[ep_state->desc_tail];
+            status = DWC2_DESC_BS_HOST_READY | chunk;
+            ep_state->desc_len[ep_state->desc_tail] = chunk;
+            ep_state->desc_end &= ~(1UL << ep_state->desc_tail);
+
+            if ((chunk == len) && (i == (nents - 1))) {
+                status |= DWC2_DESC_IOC;
+                ep_state->desc_end |= (1UL << ep_state->desc_tail);
+                if (USB_EP_DIR_IS_IN(ep) && (chunk % mps)) {
+                    status |= DWC2_DESC_SP;
+                }
+            }
+            if (iso && USB_EP_DIR_IS_IN(ep)) {
+                status |= (((uint32_t)ep_state->iso_frame << DWC2_DESC_ISOC_FRNUM_Pos) & DWC2_DESC_ISOC_FRNUM_Msk);
+                status |= (((chunk ? (chunk + mps - 1) / mps : 1) << DWC2_DESC_ISOC_PID_Pos) & DWC2_DESC_ISOC_PID_Msk);
+                ep_state->iso_frame = (ep_state->iso_frame + ep_state->ep_interval) & 0x3FFFU;
+            }
+            if (ep_state->desc_tail == (CONFIG_USB_DWC2_DMA_DESC_NUM - 1)) {
+                status |= (DWC2_DESC_L | DWC2_DESC_IOC);
+            }
+
+            desc->buf = (uint32_t)buf;
+            if (ep_state->desc_tail == first) {
+                first_status = status;
+            } else {
+                desc->status = status;
+            }
+
+            buf += chunk;
+            len -= chunk;
+            ep_state->desc_tail = (ep_state->desc_tail + 1) % CONFIG_USB_DWC2_DMA_DESC_NUM;
+            ep_state->desc_count++;
+        } while (len);
+    }
+
+    /* Hand the first descriptor over last, so the core never sees half a transfer */
+    ring[first].status = first_status;
+
+    if ((ep_state->desc_count == need) && !dwc2_ddma_ep_enabled(busid, ep)) {
+        dwc2_ddma_start(busid, ep);
+    }
+
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+
+/* Reap every descriptor the core has closed, in ring order */
+static void dwc2_ddma_process(uint8_t busid, uint8_t ep)
+{
+    uint8_t ep_idx = USB_EP_GET_IDX(ep);
+    struct dwc2_ep_state *ep_state = dwc2_ddma_ep_state(busid, ep);
+    struct dwc2_dma_desc *ring = dwc2_ddma_ring(busid, ep);
+    uint32_t status, remain, nbytes;
+    uint8_t *buf;
+    uint8_t idx;
+    bool end;
+
+    while (ep_state->desc_count) {
+        idx = ep_state->desc_head;
+        status = ring[idx].status;
+        if ((status & DWC2_DESC_BS_Msk) != DWC2_DESC_BS_DMA_DONE) {
+            break;
+        }
+
+        if (ep_state->ep_type == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
+            remain = status & (USB_EP_DIR_IS_OUT(ep) ? DWC2_DESC_ISOC_RX_NBYTES_Msk : DWC2_DESC_ISOC_TX_NBYTES_Msk);
+        } else {
+            remain = status & DWC2_DESC_NBYTES_Msk;
+        }
+        nbytes = (remain < ep_state->desc_len[idx]) ? (ep_state->desc_len[idx] - remain) : 0;
+        buf = (uint8_t *)ring[idx].buf;
+        end = (ep_state->desc_end & (1UL << idx)) ? true : false;
+
+        ring[idx].status = DWC2_DESC_BS_HOST_BUSY;
+        ep_state->desc_head = (idx + 1) % CONFIG_USB_DWC2_DMA_DESC_NUM;
+        ep_state->desc_count--;
+
+        ep_state->actual_xfer_len += nbytes;
+        if (!end) {
+            continue;
+        }
+        nbytes = ep_state->actual_xfer_len;
+        ep_state->actual_xfer_len = 0;
+
+        if (USB_EP_DIR_IS_OUT(ep)) {
+            if ((ep_idx == 0) && (status & DWC2_DESC_SR)) {
+                /* Setup overrode the data stage, stup interrupt will deliver it */
+                usb_dcache_invalidate((uintptr_t)buf, USB_ALIGN_UP(8, CONFIG_USB_ALIGN_SIZE));
+                if (buf != (uint8_t *)&g_dwc2_udc[busid].setup) {
+                    memcpy(&g_dwc2_udc[busid].setup, buf, 8);
+                }
+                continue;
+            }
+            usb_dcache_invalidate((uintptr_t)buf, USB_ALIGN_UP(nbytes, CONFIG_USB_ALIGN_SIZE));
+            usbd_event_ep_out_complete_handler(busid, ep_idx, nbytes);
+        } else {
+            usbd_event_ep_in_complete_handler(busid, ep_idx | 0x80, nbytes);
+        }
+
+        if ((ep_idx == 0) && (usbd_get_ep0_next_state(busid) == USBD_EP0_STATE_SETUP)) {
+            dwc2_ep0_start_read_setup(busid, (uint8_t *)&g_dwc2_udc[busid].setup);
+        }
+    }
+
+    /* Stopped at L or bna while more descriptors were queued */
+    if (ep_state->desc_count && !dwc2_ddma_ep_enabled(busid, ep)) {
+        dwc2_ddma_start(busid, ep);
+    }
+}
+#endif
+
+int usbd_dwc2_ep_start_write_sg(uint8_t busid, const uint8_t ep, const struct usbd_dwc2_sg *sg, uint8_t nents)
+{
+    uint8_t ep_idx = USB_EP_GET_IDX(ep);
+
+    if (!sg || !nents) {
+        return -1;
+    }
+
+    if (ep_idx && !(USB_OTG_INEP(ep_idx)->DIEPCTL & USB_OTG_DIEPCTL_MPSIZ)) {
+        return -2;
+    }
+
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+        for (uint8_t i = 0; i < nents; i++) {
+            USB_ASSERT_MSG(!((uint32_t)sg[i].buf % CONFIG_USB_ALIGN_SIZE), "dwc2 data must be %d-byte aligned", CONFIG_USB_ALIGN_SIZE);
+        }
+        return dwc2_ddma_queue(busid, ep | 0x80, sg, nents);
+    }
+#endif
+    if (nents != 1) {
+        return -1;
+    }
+    return usbd_ep_start_write(busid, ep, sg[0].buf, sg[0].len);
+}
+
 /**
   * @brief  dwc2_get_glb_intstatus: return the global USB interrupt status
   * @retval status
@@ -487,6 +793,131 @@ static inline uint32_t dwc2_get_inep_intstatus(uint8_t busid, uint8_t epnum)
     return tmpreg;
 }
 
+#ifdef CONFIG_USB_DWC2_AUTO_FIFO
+/* Size rx fifo and every tx fifo from the endpoints of the configuration being selected.
+ * The biggest alt setting of every endpoint wins, so SET_INTERFACE never needs a new layout.
+ * Every in endpoint gets one (micro)frame worth of packets first, then iso and bulk in
+ * endpoints get more packets while ram is left, bulk in stops at four packets.
+ */
+void usbd_config_prepare(uint8_t busid, const uint8_t *config_desc)
+{
+    struct usb_endpoint_descriptor *ep_desc;
+    const uint8_t *p = config_desc;
+    uint16_t tx_need[16] = { 0 };
+    uint16_t tx_size[16] = { 0 };
+    uint8_t tx_type[16] = { 0 };
+    uint8_t ep_num = g_dwc2_udc[busid].hw_params.num_dev_ep + 1;
+    uint8_t in_max = 0;
+    uint8_t out_eps = 1;
+    uint8_t ep_idx;
+    uint32_t desc_len, offset = 0;
+    uint32_t rx_pkt = 64, rx_size, rx_min, bytes;
+    uint32_t left, used = 0;
+    bool rx_more = false;
+    bool changed = false;
+
+    desc_len = ((struct usb_configuration_descriptor *)config_desc)->wTotalLength;
+
+    while ((offset < desc_len) && p[0]) {
+        if (p[1] == USB_DESCRIPTOR_TYPE_ENDPOINT) {
+            ep_desc = (struct usb_endpoint_descriptor *)p;
+            ep_idx = USB_EP_GET_IDX(ep_desc->bEndpointAddress);
+            bytes = USB_GET_MAXPACKETSIZE(ep_desc->wMaxPacketSize) * (USB_GET_MULT(ep_desc->wMaxPacketSize) + 1);
+
+            if ((ep_idx != 0) && (ep_idx < ep_num)) {
+                if (USB_EP_DIR_IS_IN(ep_desc->bEndpointAddress)) {
+                    tx_need[ep_idx] = MAX(tx_need[ep_idx], (bytes + 3) / 4);
+                    tx_type[ep_idx] = USB_GET_ENDPOINT_TYPE(ep_desc->bmAttributes);
+                    in_max = MAX(in_max, ep_idx);
+                } else {
+                    rx_pkt = MAX(rx_pkt, bytes);
+                    out_eps++;
+                    if (USB_GET_ENDPOINT_TYPE(ep_desc->bmAttributes) != USB_ENDPOINT_TYPE_INTERRUPT) {
+                        rx_more = true;
+                    }
+                }
+            }
+        }
+        offset += p[0];
+        p += p[0];
+    }
+
+    /* (5 * control endpoints + 8) + (largest packet / 4 + 1) + 2 * out endpoints + 1 for global nak */
+    rx_size = (5 + 8) + (rx_pkt / 4 + 1) + 2 * out_eps + 1;
+    if (g_dwc2_udc[busid].user_params.phy_type != DWC2_PHY_TYPE_PARAM_FS) {
+        rx_min = (5 + 8 + 512 / 4 + 1 + 2 * 8 + 1);
+    } else {
+        rx_min = (5 + 8 + 64 / 4 + 1 + 2 * 8 + 1);
+    }
+    rx_size = MAX(rx_size, rx_min);
+
+    tx_size[0] = g_dwc2_udc[busid].user_params.device_tx_fifo_size[0] ? g_dwc2_udc[busid].user_params.device_tx_fifo_size[0] : 16;
+
+    /* Unused fifos below the last used one still need the 16 words minimum */
+    for (uint8_t i = 1; i <= in_max; i++) {
+        tx_size[i] = MAX(tx_need[i], 16);
+    }
+
+    for (uint8_t i = 0; i <= in_max; i++) {
+        used += tx_size[i];
+    }
+    used += rx_size;
+
+    left = g_dwc2_udc[busid].user_params.total_fifo_size;
+    if (g_dwc2_udc[busid].user_params.device_dma_enable) {
+        /* Endpoint info of the dma engine lives on top of fifo ram */
+        left = (left > (4U * ep_num)) ? (left - 4U * ep_num) : 0;
+    }
+
+    if (used > left) {
+        USB_LOG_ERR("dwc2 fifo plan needs %u words but only %u, keep current layout\r\n", (unsigned int)used, (unsigned int)left);
+        return;
+    }
+    left -= used;
+
+    for (uint8_t pkts = 2; pkts <= 4; pkts++) {
+        for (uint8_t i = 1; i <= in_max; i++) {
+            if ((tx_type[i] == USB_ENDPOINT_TYPE_ISOCHRONOUS) && (pkts > 2)) {
+                continue;
+            }
+            if (((tx_type[i] == USB_ENDPOINT_TYPE_ISOCHRONOUS) || (tx_type[i] == USB_ENDPOINT_TYPE_BULK)) &&
+                tx_need[i] && (left >= tx_need[i])) {
+                tx_size[i] += tx_need[i];
+                left -= tx_need[i];
+            }
+        }
+        if ((pkts == 2) && rx_more && (left >= (rx_pkt / 4 + 1))) {
+            rx_size += (rx_pkt / 4 + 1);
+            left -= (rx_pkt / 4 + 1);
+        }
+    }
+
+    if (USB_OTG_GLB->GRXFSIZ != rx_size) {
+        changed = true;
+    }
+    for (uint8_t i = 0; i < ep_num; i++) {
+        if (((i == 0) ? (USB_OTG_GLB->DIEPTXF0_HNPTXFSIZ >> 16) : (USB_OTG_GLB->DIEPTXF[i - 1] >> 16)) != tx_size[i]) {
+            changed = true;
+        }
+    }
+    if (!changed) {
+        return;
+    }
+
+    USB_OTG_GLB->GRXFSIZ = rx_size;
+    g_dwc2_udc[busid].user_params.device_rx_fifo_size = rx_size;
+    for (uint8_t i = 0; i < ep_num; i++) {
+        dwc2_set_txfifo(busid, i, tx_size[i]);
+        g_dwc2_udc[busid].user_params.device_tx_fifo_size[i] = tx_size[i];
+    }
+
+    dwc2_flush_txfifo(busid, 0x10U);
+    dwc2_flush_rxfifo(busid);
+
+    USB_LOG_INFO("dwc2 fifo plan: rx %u words, %u words unused\r\n", (unsigned int)rx_size, (unsigned int)left);
+}
+#endif
+
 int usb_dc_init(uint8_t busid)
 {
     int ret;
@@ -513,6 +944,15 @@ int usb_dc_init(uint8_t busid)
     if (g_dwc2_udc[busid].user_params.total_fifo_size == 0) {
         g_dwc2_udc[busid].user_params.total_fifo_size = g_dwc2_udc[busid].hw_params.total_fifo_size;
     }
+#ifndef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+        USB_LOG_WRN("CONFIG_USB_DWC2_DMA_DESC_ENABLE is not defined, use buffer dma mode\r\n");
+        g_dwc2_udc[busid].user_params.device_dma_desc_enable = false;
+    }
+#endif
+    if (!g_dwc2_udc[busid].user_params.device_dma_enable) {
+        g_dwc2_udc[busid].user_params.device_dma_desc_enable = false;
+    }
 
     USB_LOG_INFO("dwc2 has %d endpoints and dfifo depth(32-bit words) is %d\r\n",
                  g_dwc2_udc[busid].hw_params.num_dev_ep + 1,
@@ -578,6 +1018,12 @@ int usb_dc_init(uint8_t busid)
         USB_ASSERT_MSG(g_dwc2_udc[busid].hw_params.arch == GHWCFG2_INT_DMA_ARCH, "This dwc2 version does not support dma mode, so stop working");
 
         USB_OTG_DEV->DCFG &= ~USB_OTG_DCFG_DESCDMA;
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+        if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+            USB_ASSERT_MSG(g_dwc2_udc[busid].hw_params.dma_desc_enable, "This dwc2 version does not support descriptor dma mode, so stop working");
+            USB_OTG_DEV->DCFG |= USB_OTG_DCFG_DESCDMA;
+        }
+#endif
         USB_OTG_GLB->GAHBCFG &= ~USB_OTG_GAHBCFG_HBSTLEN;
         USB_OTG_GLB->GAHBCFG |= (USB_OTG_GAHBCFG_DMAEN | USB_OTG_GAHBCFG_HBSTLEN_4);
     } else {
@@ -681,6 +1127,11 @@ int usbd_ep_open(uint8_t busid, const struct usb_endpoint_descriptor *ep)
     if (USB_EP_DIR_IS_OUT(ep->bEndpointAddress)) {
         g_dwc2_udc[busid].out_ep[ep_idx].ep_mps = USB_GET_MAXPACKETSIZE(ep->wMaxPacketSize);
         g_dwc2_udc[busid].out_ep[ep_idx].ep_type = USB_GET_ENDPOINT_TYPE(ep->bmAttributes);
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+        if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+            dwc2_ddma_ring_reset(busid, ep->bEndpointAddress);
+        }
+#endif
 
         USB_OTG_DEV->DAINTMSK |= USB_OTG_DAINTMSK_OEPM & (uint32_t)(1UL << (16 + ep_idx));
 
@@ -702,6 +1153,12 @@ int usbd_ep_open(uint8_t busid, const struct usb_endpoint_descriptor *ep)
 
         g_dwc2_udc[busid].in_ep[ep_idx].ep_mps = USB_GET_MAXPACKETSIZE(ep->wMaxPacketSize);
         g_dwc2_udc[busid].in_ep[ep_idx].ep_type = USB_GET_ENDPOINT_TYPE(ep->bmAttributes);
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+        g_dwc2_udc[busid].in_ep[ep_idx].ep_interval = 1U << (MIN(MAX(ep->bInterval, 1U), 16U) - 1U);
+        if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+            dwc2_ddma_ring_reset(busid, ep->bEndpointAddress);
+        }
+#endif
 
         USB_OTG_DEV->DAINTMSK |= USB_OTG_DAINTMSK_IEPM & (uint32_t)(1UL << ep_idx);
 
@@ -741,6 +1198,11 @@ int usbd_ep_close(uint8_t busid, const uint8_t ep)
         USB_OTG_DEV->DEACHMSK &= ~(USB_OTG_DAINTMSK_OEPM & ((uint32_t)(1UL << (ep_idx & 0x07)) << 16));
         USB_OTG_DEV->DAINTMSK &= ~(USB_OTG_DAINTMSK_OEPM & ((uint32_t)(1UL << (ep_idx & 0x07)) << 16));
         USB_OTG_OUTEP(ep_idx)->DOEPCTL = 0;
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+        if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+            dwc2_ddma_ring_reset(busid, ep);
+        }
+#endif
     } else {
         if (USB_OTG_INEP(ep_idx)->DIEPCTL & USB_OTG_DIEPCTL_EPENA) {
             USB_OTG_INEP(ep_idx)->DIEPCTL |= USB_OTG_DIEPCTL_SNAK;
@@ -761,6 +1223,11 @@ int usbd_ep_close(uint8_t busid, const uint8_t ep)
         USB_OTG_DEV->DEACHMSK &= ~(USB_OTG_DAINTMSK_IEPM & (uint32_t)(1UL << (ep_idx & 0x07)));
         USB_OTG_DEV->DAINTMSK &= ~(USB_OTG_DAINTMSK_IEPM & (uint32_t)(1UL << (ep_idx & 0x07)));
         USB_OTG_INEP(ep_idx)->DIEPCTL = 0;
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+        if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+            dwc2_ddma_ring_reset(busid, ep);
+        }
+#endif
     }
     return 0;
 }
@@ -782,6 +1249,11 @@ int usbd_ep_set_stall(uint8_t busid, const uint8_t ep)
     }
 
     if ((ep_idx == 0) && g_dwc2_udc[busid].user_params.device_dma_enable) {
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+        if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+            dwc2_ddma_ring_reset(busid, 0x00);
+        }
+#endif
         usb_dcache_invalidate((uintptr_t)&g_dwc2_udc[busid].setup, USB_ALIGN_UP(8, CONFIG_USB_ALIGN_SIZE));
         dwc2_ep0_start_read_setup(busid, (uint8_t *)&g_dwc2_udc[busid].setup);
     }
@@ -848,6 +1320,13 @@ int usbd_ep_start_write(uint8_t busid, const uint8_t ep, const uint8_t *data, ui
         return -2;
     }
 
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+        struct usbd_dwc2_sg sg = { data, data_len };
+        return dwc2_ddma_queue(busid, ep | 0x80, &sg, 1);
+    }
+#endif
+
     g_dwc2_udc[busid].in_ep[ep_idx].xfer_buf = (uint8_t *)data;
     g_dwc2_udc[busid].in_ep[ep_idx].xfer_len = data_len;
     g_dwc2_udc[busid].in_ep[ep_idx].actual_xfer_len = 0;
@@ -925,6 +1404,13 @@ int usbd_ep_start_read(uint8_t busid, const uint8_t ep, uint8_t *data, uint32_t
         return -2;
     }
 
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+        struct usbd_dwc2_sg sg = { data, data_len };
+        return dwc2_ddma_queue(busid, ep & 0x7f, &sg, 1);
+    }
+#endif
+
     g_dwc2_udc[busid].out_ep[ep_idx].xfer_buf = (uint8_t *)data;
     g_dwc2_udc[busid].out_ep[ep_idx].xfer_len = data_len;
     g_dwc2_udc[busid].out_ep[ep_idx].actual_xfer_len = 0;
@@ -1013,6 +1499,14 @@ void USBD_IRQHandler(uint8_t busid)
                 if ((ep_intr & 0x1U) != 0U) {
                     epint = dwc2_get_outep_intstatus(busid, ep_idx);
 
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+                    if (g_dwc2_udc[busid].user_params.device_dma_desc_enable &&
+                        (epint & (USB_OTG_DOEPINT_XFRC | USB_OTG_DOEPINT_BNA)) &&
+                        !((ep_idx == 0) && (usbd_get_ep0_next_state(busid) == USBD_EP0_STATE_SETUP))) {
+                        dwc2_ddma_process(busid, ep_idx);
+                        epint &= ~USB_OTG_DOEPINT_XFRC;
+                    }
+#endif
                     if ((epint & USB_OTG_DOEPINT_XFRC) == USB_OTG_DOEPINT_XFRC) {
                         if (ep_idx == 0) {
                             if (usbd_get_ep0_next_state(busid) == USBD_EP0_STATE_SETUP) {
@@ -1067,6 +1561,13 @@ process_setup:
                 if ((ep_intr & 0x1U) != 0U) {
                     epint = dwc2_get_inep_intstatus(busid, ep_idx);
 
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+                    if (g_dwc2_udc[busid].user_params.device_dma_desc_enable &&
+                        (epint & (USB_OTG_DIEPINT_XFRC | USB_OTG_DIEPINT_BNA))) {
+                        dwc2_ddma_process(busid, ep_idx | 0x80);
+                        epint &= ~USB_OTG_DIEPINT_XFRC;
+                    }
+#endif
                     if ((epint & USB_OTG_DIEPINT_XFRC) == USB_OTG_DIEPINT_XFRC) {
                         if (ep_idx == 0) {
                             g_dwc2_udc[busid].in_ep[ep_idx].actual_xfer_len = g_dwc2_udc[busid].in_ep[ep_idx].xfer_len - ((USB_OTG_INEP(ep_idx)->DIEPTSIZ) & USB_OTG_DIEPTSIZ_XFRSIZ);
@@ -1131,6 +1632,16 @@ process_setup:
 
             memset(g_dwc2_udc[busid].in_ep, 0, sizeof(struct dwc2_ep_state) * 16);
             memset(g_dwc2_udc[busid].out_ep, 0, sizeof(struct dwc2_ep_state) * 16);
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+            if (g_dwc2_udc[busid].user_params.device_dma_desc_enable) {
+                USB_OTG_DEV->DOEPMSK |= USB_OTG_DOEPMSK_BOIM;
+                USB_OTG_DEV->DIEPMSK |= USB_OTG_DIEPMSK_BIM;
+                for (uint8_t i = 0U; i < (g_dwc2_udc[busid].hw_params.num_dev_ep + 1); i++) {
+                    dwc2_ddma_ring_reset(busid, i);
+                    dwc2_ddma_ring_reset(busid, i | 0x80);
+                }
+            }
+#endif
             usbd_event_reset_handler(busid);
             /* Start reading setup */
             dwc2_ep0_start_read_setup(busid, (uint8_t *)&g_dwc2_udc[busid].setup);
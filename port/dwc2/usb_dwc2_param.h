@@ -361,6 +361,15 @@ static inline void dwc2_get_hwparams(uint32_t reg_base, struct dwc2_hw_params *h
                                    GHWCFG4_SERVICE_INTERVAL_SUPPORTED);
 }
 
+/* One buffer of a gather write, every buffer but the last must be a multiple of mps */
+struct usbd_dwc2_sg {
+    const uint8_t *buf;
+    uint32_t len;
+};
+
+/* Send several buffers as one in transfer, needs descriptor dma for more than one buffer */
+int usbd_dwc2_ep_start_write_sg(uint8_t busid, const uint8_t ep, const struct usbd_dwc2_sg *sg, uint8_t nents);
+
 void dwc2_get_user_params(uint32_t reg_base, struct dwc2_user_params *params);
 void dwc2_get_user_fifo_config(uint32_t reg_base, struct usb_dwc2_user_fifo_config *config);
 
@@ -1549,6 +1549,9 @@ typedef struct
 #define USB_OTG_DOEPINT_OUTPKTERR_Pos            (8U)
 #define USB_OTG_DOEPINT_OUTPKTERR_Msk            (0x1UL << USB_OTG_DOEPINT_OUTPKTERR_Pos) /*!< 0x00000100 */
 #define USB_OTG_DOEPINT_OUTPKTERR                USB_OTG_DOEPINT_OUTPKTERR_Msk   /*!< OUT packet error */
+#define USB_OTG_DOEPINT_BNA_Pos                  (9U)
+#define USB_OTG_DOEPINT_BNA_Msk                  (0x1UL << USB_OTG_DOEPINT_BNA_Pos) /*!< 0x00000200 */
+#define USB_OTG_DOEPINT_BNA                      USB_OTG_DOEPINT_BNA_Msk       /*!< Buffer not available interrupt */
 #define USB_OTG_DOEPINT_BERR_Pos                 (12U)
 #define USB_OTG_DOEPINT_BERR_Msk                 (0x1UL << USB_OTG_DOEPINT_BERR_Pos) /*!< 0x00001000 */
 #define USB_OTG_DOEPINT_BERR                      USB_OTG_DOEPINT_BERR_Msk   /*!< Babble error interrupt */
@@ -1722,6 +1725,34 @@ typedef struct
 #define GRXSTS_PKTSTS_DATA_TOGGLE_ERR          5U
 #define GRXSTS_PKTSTS_CH_HALTED                7U
 
+/* Device dma descriptor quadlet, used when DCFG.DESCDMA is set */
+#define DWC2_DESC_BS_Msk                       (0x3UL << 30)
+#define DWC2_DESC_BS_HOST_READY                (0x0UL << 30)
+#define DWC2_DESC_BS_DMA_BUSY                  (0x1UL << 30)
+#define DWC2_DESC_BS_DMA_DONE                  (0x2UL << 30)
+#define DWC2_DESC_BS_HOST_BUSY                 (0x3UL << 30)
+#define DWC2_DESC_STS_Msk                      (0x3UL << 28)
+#define DWC2_DESC_STS_SUCC                     (0x0UL << 28)
+#define DWC2_DESC_STS_BUFF_FLUSH               (0x1UL << 28)
+#define DWC2_DESC_STS_BUFF_ERR                 (0x3UL << 28)
+#define DWC2_DESC_L                            (0x1UL << 27)
+#define DWC2_DESC_SP                           (0x1UL << 26)
+#define DWC2_DESC_IOC                          (0x1UL << 25)
+#define DWC2_DESC_SR                           (0x1UL << 24)
+#define DWC2_DESC_MTRF                         (0x1UL << 23)
+#define DWC2_DESC_NBYTES_Msk                   (0xFFFFUL)
+#define DWC2_DESC_ISOC_PID_Pos                 (23U)
+#define DWC2_DESC_ISOC_PID_Msk                 (0x3UL << DWC2_DESC_ISOC_PID_Pos)
+#define DWC2_DESC_ISOC_FRNUM_Pos               (12U)
+#define DWC2_DESC_ISOC_FRNUM_Msk               (0x7FFUL << DWC2_DESC_ISOC_FRNUM_Pos)
+#define DWC2_DESC_ISOC_TX_NBYTES_Msk           (0xFFFUL)
+#define DWC2_DESC_ISOC_RX_NBYTES_Msk           (0x7FFUL)
+
+struct dwc2_dma_desc {
+    volatile uint32_t status;
+    volatile uint32_t buf;
+};
+
 #define USB_MASK_INTERRUPT(__INSTANCE__, __INTERRUPT__)     ((__INSTANCE__)->GINTMSK &= ~(__INTERRUPT__))
 #define USB_UNMASK_INTERRUPT(__INSTANCE__, __INTERRUPT__)   ((__INSTANCE__)->GINTMSK |= (__INTERRUPT__))
 #define CLEAR_IN_EP_INTR(__EPNUM__, __INTERRUPT__)          (USBx_INEP(__EPNUM__)->DIEPINT = (__INTERRUPT__))
@@ -55,7 +55,11 @@ const struct dwc2_user_params param_common = {
 #else
     .device_dma_enable = false,
 #endif
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    .device_dma_desc_enable = true,
+#else
     .device_dma_desc_enable = false,
+#endif
     .device_rx_fifo_size = (3016 - 16 - 256 * 8),
     .device_tx_fifo_size = {
         [0] = 16,  // 64 byte
@@ -84,7 +84,11 @@ const struct dwc2_user_params param_pb14_pb15 = {
 #else
     .device_dma_enable = false,
 #endif
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    .device_dma_desc_enable = true,
+#else
     .device_dma_desc_enable = false,
+#endif
     .device_rx_fifo_size = (1012 - 16 - 256 - 128 - 128 - 128 - 128),
     .device_tx_fifo_size = {
         [0] = 16,  // 64 byte
@@ -165,7 +169,11 @@ const struct dwc2_user_params param_pb14_pb15 = {
 #else
     .device_dma_enable = false,
 #endif
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    .device_dma_desc_enable = true,
+#else
     .device_dma_desc_enable = false,
+#endif
     .device_rx_fifo_size = (1006 - 16 - 256 - 128 - 128 - 128 - 128), // 1006/1012
     .device_tx_fifo_size = {
         [0] = 16,  // 64 byte
@@ -249,7 +257,11 @@ const struct dwc2_user_params param_pb14_pb15 = {
 #else
     .device_dma_enable = false,
 #endif
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    .device_dma_desc_enable = true,
+#else
     .device_dma_desc_enable = false,
+#endif
     .device_rx_fifo_size = (1006 - 16 - 256 - 128 - 128 - 128 - 128),
     .device_tx_fifo_size = {
         [0] = 16,  // 64 byte
@@ -297,7 +309,11 @@ const struct dwc2_user_params param_pa11_pa12 = {
 #else
     .device_dma_enable = false,
 #endif
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    .device_dma_desc_enable = true,
+#else
     .device_dma_desc_enable = false,
+#endif
     .device_rx_fifo_size = (952 - 16 - 256 - 128 - 128 - 128 - 128),
     .device_tx_fifo_size = {
         [0] = 16,  // 64 byte
@@ -339,7 +355,11 @@ const struct dwc2_user_params param_pb14_pb15 = {
 #else
     .device_dma_enable = false,
 #endif
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    .device_dma_desc_enable = true,
+#else
     .device_dma_desc_enable = false,
+#endif
     .device_rx_fifo_size = (952 - 16 - 256 - 128 - 128 - 128 - 128),
     .device_tx_fifo_size = {
         [0] = 16,  // 64 byte
@@ -411,7 +431,11 @@ const struct dwc2_user_params param_pb14_pb15 = {
 #else
     .device_dma_enable = false,
 #endif
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    .device_dma_desc_enable = true,
+#else
     .device_dma_desc_enable = false,
+#endif
     .device_rx_fifo_size = (952 - 16 - 256 - 128 - 128 - 128 - 128),
     .device_tx_fifo_size = {
         [0] = 16,  // 64 byte
@@ -514,7 +538,11 @@ const struct dwc2_user_params param_pb14_pb15 = {
 #else
     .device_dma_enable = false,
 #endif
+#ifdef CONFIG_USB_DWC2_DMA_DESC_ENABLE
+    .device_dma_desc_enable = true,
+#else
     .device_dma_desc_enable = false,
+#endif
     .device_rx_fifo_size = (952 - 16 - 256 - 128 - 128 - 128 - 128),
     .device_tx_fifo_size = {
         [0] = 16,  // 64 byte
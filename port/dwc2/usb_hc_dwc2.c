@@ -14,6 +14,21 @@
 #define USB_OTG_HOST    ((DWC2_HostTypeDef *)(bus->hcd.reg_base + USB_OTG_HOST_BASE))
 #define USB_OTG_HC(i)   ((DWC2_HostChannelTypeDef *)(bus->hcd.reg_base + USB_OTG_HOST_CHANNEL_BASE + ((i)*USB_OTG_HOST_CHANNEL_SIZE)))
 
+/* NAKs a bulk in channel takes before it is halted and held off, 0 lets the core retry forever */
+#ifndef CONFIG_USB_DWC2_NAK_RETRY
+#define CONFIG_USB_DWC2_NAK_RETRY 8
+#endif
+
+/* Frames a halted bulk in channel waits before polling again */
+#ifndef CONFIG_USB_DWC2_NAK_HOLDOFF
+#define CONFIG_USB_DWC2_NAK_HOLDOFF 1
+#endif
+
+/* Transaction translators tracked for periodic split bandwidth */
+#ifndef CONFIG_USB_DWC2_TT_NUM
+#define CONFIG_USB_DWC2_TT_NUM 4
+#endif
+
 struct dwc2_chan {
     uint8_t ep0_state;
     uint16_t num_packets;
@@ -24,10 +39,30 @@ struct dwc2_chan {
     bool do_csplit;
     uint8_t hub_addr;
     uint8_t hub_port;
+    uint8_t tt_port; /* hub_port on a multi tt hub, 0 when the hub has one tt */
+    uint8_t csplit_count;
     uint16_t ssplit_frame;
     usb_osal_sem_t waitsem;
     struct usbh_urb *urb;
     uint32_t iso_frame_idx;
+    struct usbh_hubport *hport; /* last endpoint owning this channel */
+    uint8_t ep_addr;
+    uint32_t hcchar;            /* HCCHAR programmed by dwc2_chan_char_init */
+    uint8_t nak_count;
+    bool nak_halt;
+    uint8_t sof_wait; /* DWC2_SOF_WAIT_* */
+    uint16_t next_frame;
+#ifdef CONFIG_USBHOST_URB_QUEUE
+    usb_slist_t urb_queue; /* async urbs waiting for this channel */
+#endif
+};
+
+/* Periodic fs/ls time reserved on one transaction translator in one frame */
+struct dwc2_tt {
+    uint8_t hub_addr;
+    uint8_t hub_port;
+    uint16_t frame;
+    uint16_t used; /* fs bit times */
 };
 
 struct dwc2_hcd {
@@ -37,6 +72,12 @@ struct dwc2_hcd {
     struct dwc2_hw_params hw_params;
     struct dwc2_user_params user_params;
     struct dwc2_chan chan_pool[16];
+    uint32_t frame_clocks;  /* phy clocks per (micro)frame, from HFIR */
+    uint32_t frame_bits;    /* bit times per (micro)frame at root port speed */
+    uint32_t sched_budget;  /* phy clocks periodic transfers may use per (micro)frame */
+    uint32_t sched_used;
+    uint16_t sched_frame;
+    struct dwc2_tt tt[CONFIG_USB_DWC2_TT_NUM];
 } g_dwc2_hcd[CONFIG_USBHOST_MAX_BUS];
 
 #define DWC2_EP0_STATE_SETUP     0
@@ -45,6 +86,15 @@ struct dwc2_hcd {
 #define DWC2_EP0_STATE_INSTATUS  3
 #define DWC2_EP0_STATE_OUTSTATUS 4
 
+#define DWC2_SOF_WAIT_NONE     0
+#define DWC2_SOF_WAIT_START    1 /* program the transfer again from urb */
+#define DWC2_SOF_WAIT_REENABLE 2 /* restart the split transaction */
+
+#define DWC2_FRAME_MASK 0x3FFF
+
+/* usb2.0 11.18.1, 90% of a fs frame in fs bit times */
+#define DWC2_TT_BUDGET 10800
+
 static inline int dwc2_reset(struct usbh_bus *bus)
 {
     volatile uint32_t count = 0U;
@@ -257,6 +307,12 @@ static inline void dwc2_chan_char_init(struct usbh_bus *bus,
         regval |= USB_OTG_HCCHAR_ODDFRM;
     }
 
+    /* halted channel reused by the same endpoint keeps its characteristics */
+    if (g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[ch_num].hcchar == regval) {
+        return;
+    }
+
+    g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[ch_num].hcchar = regval;
     USB_OTG_HC((uint32_t)ch_num)->HCCHAR = regval;
 }
 
@@ -479,24 +535,50 @@ uint32_t dwc2_calc_frame_interval(struct usbh_bus *bus)
     return 1000 * clock - 1;
 }
 
-static int dwc2_chan_alloc(struct usbh_bus *bus)
+static int dwc2_chan_alloc(struct usbh_bus *bus, struct usbh_urb *urb)
 {
+    struct dwc2_chan *chan;
     size_t flags;
-    int chidx;
+    int chidx = -1;
+    int unowned = -1;
 
     flags = usb_osal_enter_critical_section();
-    for (chidx = 0; chidx < g_dwc2_hcd[bus->hcd.hcd_id].hw_params.host_channels; chidx++) {
-        if (!g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[chidx].inuse) {
-            g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[chidx].inuse = true;
-            usb_osal_leave_critical_section(flags);
-
-            g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[chidx].do_ssplit = 0;
-            g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[chidx].do_csplit = 0;
-            return chidx;
+    /* prefer the channel this endpoint used last, then one nobody used, then any free one */
+    for (uint8_t i = 0; i < g_dwc2_hcd[bus->hcd.hcd_id].hw_params.host_channels; i++) {
+        chan = &g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[i];
+        if (chan->inuse) {
+            continue;
+        }
+        if ((chan->hport == urb->hport) && (chan->ep_addr == urb->ep->bEndpointAddress)) {
+            chidx = i;
+            unowned = -1;
+            break;
         }
+        if ((unowned == -1) && (chan->hport == NULL)) {
+            unowned = i;
+        }
+        if (chidx == -1) {
+            chidx = i;
+        }
+    }
+    if (unowned != -1) {
+        chidx = unowned;
     }
+    if (chidx == -1) {
+        usb_osal_leave_critical_section(flags);
+        return -1;
+    }
+
+    chan = &g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[chidx];
+    chan->inuse = true;
+    chan->hport = urb->hport;
+    chan->ep_addr = urb->ep->bEndpointAddress;
     usb_osal_leave_critical_section(flags);
-    return -1;
+
+    chan->do_ssplit = 0;
+    chan->do_csplit = 0;
+    chan->nak_count = 0;
+    return chidx;
 }
 
 static void dwc2_chan_free(struct dwc2_chan *chan)
@@ -508,10 +590,194 @@ static void dwc2_chan_free(struct dwc2_chan *chan)
         chan->urb->hcpriv = NULL;
         chan->urb = NULL;
     }
+    chan->nak_halt = false;
+    chan->sof_wait = DWC2_SOF_WAIT_NONE;
     chan->inuse = false;
     usb_osal_leave_critical_section(flags);
 }
 
+static inline uint16_t dwc2_frame_ticks(struct usbh_bus *bus, uint16_t frames)
+{
+    /* HFNUM counts microframes on a high speed root port */
+    if (usbh_get_port_speed(bus, 0) == USB_SPEED_HIGH) {
+        return frames * 8;
+    }
+    return frames;
+}
+
+static void dwc2_chan_park(struct usbh_bus *bus, struct dwc2_chan *chan, uint8_t wait, uint16_t ticks)
+{
+    chan->next_frame = (usbh_get_frame_number(bus) + ticks) & DWC2_FRAME_MASK;
+    chan->sof_wait = wait;
+    USB_OTG_GLB->GINTMSK |= USB_OTG_GINTMSK_SOFM;
+}
+
+static void dwc2_sched_update(struct usbh_bus *bus, uint32_t hfir, uint8_t speed)
+{
+    struct dwc2_hcd *hcd = &g_dwc2_hcd[bus->hcd.hcd_id];
+
+    hcd->frame_clocks = (hfir & USB_OTG_HFIR_FRIVL) + 1;
+    /* usb2.0 5.6.4, periodic transfers take at most 80% of a microframe or 90% of a frame */
+    if (speed == HPRT0_PRTSPD_HIGH_SPEED) {
+        hcd->frame_bits = 60000;
+        hcd->sched_budget = hcd->frame_clocks * 80 / 100;
+    } else if (speed == HPRT0_PRTSPD_LOW_SPEED) {
+        hcd->frame_bits = 1500;
+        hcd->sched_budget = hcd->frame_clocks * 90 / 100;
+    } else {
+        hcd->frame_bits = 12000;
+        hcd->sched_budget = hcd->frame_clocks * 90 / 100;
+    }
+    hcd->sched_used = 0;
+}
+
+/* Reserve bus time of the next transaction of a periodic urb in current (micro)frame */
+static bool dwc2_periodic_reserve(struct usbh_bus *bus, struct usbh_urb *urb)
+{
+    struct dwc2_hcd *hcd = &g_dwc2_hcd[bus->hcd.hcd_id];
+    uint16_t frame;
+    uint32_t bytes;
+    uint32_t cost;
+
+    if (hcd->sched_budget == 0) {
+        return true;
+    }
+
+    frame = usbh_get_frame_number(bus) & DWC2_FRAME_MASK;
+    if (frame != hcd->sched_frame) {
+        hcd->sched_frame = frame;
+        hcd->sched_used = 0;
+    }
+
+    bytes = USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize);
+    if (urb->hport->speed == USB_SPEED_HIGH) {
+        bytes *= (USB_GET_MULT(urb->ep->wMaxPacketSize) + 1);
+    }
+    if (bytes > urb->transfer_buffer_length) {
+        bytes = urb->transfer_buffer_length;
+    }
+    /* token, handshake and inter packet gaps, usb2.0 5.11.3 */
+    bytes += (hcd->frame_bits == 60000) ? 55 : 13;
+    cost = (bytes * 8 * hcd->frame_clocks) / hcd->frame_bits;
+
+    /* an empty frame always takes one transfer, or a big endpoint would never run */
+    if (hcd->sched_used && ((hcd->sched_used + cost) > hcd->sched_budget)) {
+        return false;
+    }
+    hcd->sched_used += cost;
+    return true;
+}
+
+/* Reserve fs/ls time of the next split transaction on its tt */
+static bool dwc2_tt_reserve(struct usbh_bus *bus, struct dwc2_chan *chan, struct usbh_urb *urb)
+{
+    struct dwc2_hcd *hcd = &g_dwc2_hcd[bus->hcd.hcd_id];
+    struct dwc2_tt *tt = NULL;
+    struct dwc2_tt *stale = NULL;
+    uint16_t frame;
+    uint32_t bytes;
+    uint32_t cost;
+
+    /* start split goes out in the next microframe, tt runs it in the one after */
+    frame = ((usbh_get_frame_number(bus) + 2) & DWC2_FRAME_MASK) >> 3;
+
+    for (uint8_t i = 0; i < CONFIG_USB_DWC2_TT_NUM; i++) {
+        if ((hcd->tt[i].hub_addr == chan->hub_addr) && (hcd->tt[i].hub_port == chan->tt_port)) {
+            tt = &hcd->tt[i];
+            break;
+        }
+        /* an entry without time in this frame can be taken by another tt */
+        if (!stale && ((hcd->tt[i].hub_addr == 0) || (hcd->tt[i].frame != frame) || (hcd->tt[i].used == 0))) {
+            stale = &hcd->tt[i];
+        }
+    }
+    if (!tt) {
+        if (!stale) {
+            return true;
+        }
+        tt = stale;
+        tt->hub_addr = chan->hub_addr;
+        tt->hub_port = chan->tt_port;
+        tt->used = 0;
+    }
+    if (tt->frame != frame) {
+        tt->frame = frame;
+        tt->used = 0;
+    }
+
+    bytes = USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize);
+    if (bytes > urb->transfer_buffer_length) {
+        bytes = urb->transfer_buffer_length;
+    }
+    cost = (bytes + 13) * 8;
+    if (urb->hport->speed == USB_SPEED_LOW) {
+        cost *= 8;
+    }
+
+    if (tt->used && ((tt->used + cost) > DWC2_TT_BUDGET)) {
+        return false;
+    }
+    tt->used += cost;
+    return true;
+}
+
+/* Microframes to wait until a periodic start split may be issued */
+static uint16_t dwc2_split_wait(struct usbh_bus *bus)
+{
+    uint8_t uframe;
+
+    /* start split in microframe 0~4 leaves Y+1~Y+3 for complete splits in the same frame, usb2.0 11.18.4 */
+    uframe = (usbh_get_frame_number(bus) + 1) & 0x7;
+    if (uframe > 4) {
+        return 8 - uframe;
+    }
+    return 0;
+}
+
+static void dwc2_find_tt(struct usbh_hubport *hport, struct dwc2_chan *chan)
+{
+    /* fs/ls device is translated by the nearest hs hub on the way to root */
+    while (!hport->parent->is_roothub && (hport->parent->speed != USB_SPEED_HIGH)) {
+        hport = hport->parent->parent;
+    }
+
+    chan->hub_addr = hport->parent->hub_addr;
+    chan->hub_port = hport->port;
+    chan->tt_port = hport->parent->ismtt ? hport->port : 0;
+}
+
+#ifdef CONFIG_USBHOST_URB_QUEUE
+static inline uint32_t dwc2_ep_toggle_mask(struct usbh_urb *urb)
+{
+    return USBH_EP_TOGGLE_MASK(urb->ep->bEndpointAddress);
+}
+
+static struct dwc2_chan *dwc2_chan_find_busy(struct usbh_bus *bus, struct usbh_urb *urb)
+{
+    struct dwc2_chan *chan;
+
+    for (uint8_t chidx = 0; chidx < g_dwc2_hcd[bus->hcd.hcd_id].hw_params.host_channels; chidx++) {
+        chan = &g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[chidx];
+        if (chan->inuse && chan->urb && (chan->urb->hport == urb->hport) &&
+            (chan->urb->ep->bEndpointAddress == urb->ep->bEndpointAddress)) {
+            return chan;
+        }
+    }
+    return NULL;
+}
+
+static void dwc2_chan_flush_queue(struct dwc2_chan *chan)
+{
+    struct usbh_urb *urb;
+
+    while ((urb = usb_slist_first_entry_or_null(&chan->urb_queue, struct usbh_urb, list)) != NULL) {
+        usb_slist_remove(&chan->urb_queue, &urb->list);
+        urb->errorcode = -USB_ERR_SHUTDOWN;
+        urb->hcpriv = NULL;
+    }
+}
+#endif
+
 static uint16_t dwc2_calculate_packet_num(uint32_t input_size, uint8_t ep_addr, uint16_t ep_mps, uint32_t *output_size)
 {
     uint16_t num_packets;
@@ -650,9 +916,62 @@ static void dwc2_bulk_intr_urb_init(struct usbh_bus *bus, uint8_t chidx, struct
                    USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize),
                    USB_GET_MULT(urb->ep->wMaxPacketSize) + 1,
                    urb->hport->speed);
+
+    chan->nak_count = 0;
+#if CONFIG_USB_DWC2_NAK_RETRY > 0
+    /* dma core retries bulk in naks by itself, count them to stop a device that never answers */
+    if (!chan->do_ssplit && (urb->ep->bEndpointAddress & 0x80) &&
+        (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_BULK)) {
+        USB_OTG_HC(chidx)->HCINTMSK |= USB_OTG_HCINTMSK_NAKM;
+    }
+#endif
     dwc2_chan_transfer(bus, chidx, urb->ep->bEndpointAddress, buffer, chan->xferlen, chan->num_packets, urb->data_toggle == 0 ? HC_PID_DATA0 : HC_PID_DATA1);
 }
 
+static void dwc2_bulk_intr_urb_start(struct usbh_bus *bus, uint8_t chidx, struct usbh_urb *urb)
+{
+    struct dwc2_chan *chan;
+    size_t flags;
+    uint16_t wait = 0;
+
+    chan = &g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[chidx];
+
+    flags = usb_osal_enter_critical_section();
+    if ((USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_INTERRUPT) && chan->do_ssplit) {
+        wait = dwc2_split_wait(bus);
+    }
+
+    if (wait) {
+        dwc2_chan_park(bus, chan, DWC2_SOF_WAIT_START, wait);
+    } else if ((USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_INTERRUPT) &&
+               ((chan->do_ssplit && !dwc2_tt_reserve(bus, chan, urb)) || !dwc2_periodic_reserve(bus, urb))) {
+        /* (micro)frame or tt is full, try again in the next one */
+        dwc2_chan_park(bus, chan, DWC2_SOF_WAIT_START, 1);
+    } else {
+        dwc2_bulk_intr_urb_init(bus, chidx, urb, urb->transfer_buffer + urb->actual_length, urb->transfer_buffer_length);
+    }
+    usb_osal_leave_critical_section(flags);
+}
+
+/* Interrupt pipe urb keeps its channel and polls again in next interval instead of giving back nak */
+static bool dwc2_int_urb_repoll(struct usbh_bus *bus, struct dwc2_chan *chan, struct usbh_urb *urb)
+{
+    uint32_t ticks;
+
+    if (!(urb->transfer_flags & USBH_URB_NAK_POLL) ||
+        (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) != USB_ENDPOINT_TYPE_INTERRUPT)) {
+        return false;
+    }
+
+    if (usbh_get_port_speed(bus, 0) == USB_SPEED_HIGH) {
+        ticks = urb->interval / 125;
+    } else {
+        ticks = urb->interval / 1000;
+    }
+    dwc2_chan_park(bus, chan, DWC2_SOF_WAIT_START, ticks ? ticks : 1);
+    return true;
+}
+
 #if 0
 static void dwc2_iso_urb_init(struct usbh_bus *bus, uint8_t chidx, struct usbh_urb *urb, struct usbh_iso_frame_packet *iso_packet)
 {
@@ -1035,7 +1354,38 @@ int usbh_submit_urb(struct usbh_urb *urb)
         }
     }
 
-    chidx = dwc2_chan_alloc(bus);
+#ifdef CONFIG_USBHOST_URB_QUEUE
+    if ((USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_BULK) ||
+        (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_INTERRUPT)) {
+        /* buffer must be ready before the urb is visible to irq */
+        if (urb->ep->bEndpointAddress & 0x80) {
+            usb_dcache_invalidate((uintptr_t)urb->transfer_buffer, USB_ALIGN_UP(urb->transfer_buffer_length, CONFIG_USB_ALIGN_SIZE));
+        } else {
+            usb_dcache_clean((uintptr_t)urb->transfer_buffer, USB_ALIGN_UP(urb->transfer_buffer_length, CONFIG_USB_ALIGN_SIZE));
+        }
+
+        flags = usb_osal_enter_critical_section();
+        chan = dwc2_chan_find_busy(bus, urb);
+        if (chan) {
+            /* poll mode urb owns chan->waitsem, so it can neither wait behind nor be followed by other urbs */
+            if (urb->timeout || chan->urb->timeout) {
+                usb_osal_leave_critical_section(flags);
+                return -USB_ERR_BUSY;
+            }
+
+            urb->hcpriv = chan;
+            urb->errorcode = -USB_ERR_BUSY;
+            urb->actual_length = 0;
+            usb_slist_add_tail(&chan->urb_queue, &urb->list);
+            usb_osal_leave_critical_section(flags);
+            return 0;
+        }
+        urb->data_toggle = (urb->hport->ep_toggle & dwc2_ep_toggle_mask(urb)) ? 1 : 0;
+        usb_osal_leave_critical_section(flags);
+    }
+#endif
+
+    chidx = dwc2_chan_alloc(bus, urb);
     if (chidx == -1) {
         return -USB_ERR_NOMEM;
     }
@@ -1051,8 +1401,7 @@ int usbh_submit_urb(struct usbh_urb *urb)
         usbh_get_port_speed(bus, 0) == USB_SPEED_HIGH) {
         chan->do_ssplit = 1;
         chan->do_csplit = 0;
-        chan->hub_port = urb->hport->port;
-        chan->hub_addr = urb->hport->parent->hub_addr;
+        dwc2_find_tt(urb->hport, chan);
     }
 
     urb->hcpriv = chan;
@@ -1087,7 +1436,7 @@ int usbh_submit_urb(struct usbh_urb *urb)
             break;
         case USB_ENDPOINT_TYPE_BULK:
         case USB_ENDPOINT_TYPE_INTERRUPT:
-            dwc2_bulk_intr_urb_init(bus, chidx, urb, urb->transfer_buffer, urb->transfer_buffer_length);
+            dwc2_bulk_intr_urb_start(bus, chidx, urb);
             break;
         case USB_ENDPOINT_TYPE_ISOCHRONOUS:
             break;
@@ -1130,6 +1479,16 @@ int usbh_kill_urb(struct usbh_urb *urb)
     chan = (struct dwc2_chan *)urb->hcpriv;
 
     dwc2_halt(bus, chan->chidx);
+    chan->nak_halt = false;
+    chan->sof_wait = DWC2_SOF_WAIT_NONE;
+
+#ifdef CONFIG_USBHOST_URB_QUEUE
+    /* urbs queued on the channel are cancelled together */
+    dwc2_chan_flush_queue(chan);
+    if (chan->urb) {
+        urb = chan->urb;
+    }
+#endif
 
     urb->errorcode = -USB_ERR_SHUTDOWN;
 
@@ -1144,16 +1503,79 @@ int usbh_kill_urb(struct usbh_urb *urb)
     return 0;
 }
 
+static void dwc2_split_ack(struct usbh_bus *bus, struct dwc2_chan *chan)
+{
+    /* start split accepted, give the tt one microframe before the first complete split */
+    chan->do_csplit = 1;
+    chan->csplit_count = 0;
+    chan->ssplit_frame = dwc2_get_full_frame_num(bus);
+    dwc2_chan_enable_csplit(bus, chan->chidx, true);
+    dwc2_chan_park(bus, chan, DWC2_SOF_WAIT_REENABLE, 1);
+}
+
+static void dwc2_split_nyet(struct usbh_bus *bus, struct dwc2_chan *chan, struct usbh_urb *urb)
+{
+    if (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_INTERRUPT) {
+        if (++chan->csplit_count >= 3) {
+            /* complete split window is over, start the transaction again in a later frame */
+            chan->do_csplit = 0;
+            dwc2_chan_enable_csplit(bus, chan->chidx, false);
+            dwc2_chan_park(bus, chan, DWC2_SOF_WAIT_START, 1);
+        } else {
+            /* odd frame bit sends it in the next microframe */
+            dwc2_chan_reenable(bus, chan->chidx);
+        }
+    } else {
+        /* tt has not finished yet, ask again in the next microframe */
+        dwc2_chan_park(bus, chan, DWC2_SOF_WAIT_REENABLE, 1);
+    }
+}
+
+#ifdef CONFIG_USBHOST_URB_QUEUE
+static void dwc2_chan_queue_next(struct dwc2_chan *chan, struct usbh_urb *urb)
+{
+    struct usbh_urb *next_urb;
+
+    next_urb = usb_slist_first_entry_or_null(&chan->urb_queue, struct usbh_urb, list);
+    if (next_urb == NULL) {
+        dwc2_chan_free(chan);
+        return;
+    }
+
+    /* keep the channel and start the next urb before giving back this one */
+    usb_slist_remove(&chan->urb_queue, &next_urb->list);
+    urb->hcpriv = NULL;
+    chan->urb = next_urb;
+    chan->do_csplit = 0;
+    next_urb->data_toggle = urb->data_toggle;
+    dwc2_bulk_intr_urb_start(next_urb->hport->bus, chan->chidx, next_urb);
+}
+#endif
+
 static inline void dwc2_urb_waitup(struct usbh_urb *urb)
 {
     struct dwc2_chan *chan;
 
     chan = (struct dwc2_chan *)urb->hcpriv;
 
+#ifdef CONFIG_USBHOST_URB_QUEUE
+    if (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) != USB_ENDPOINT_TYPE_CONTROL) {
+        if (urb->data_toggle) {
+            urb->hport->ep_toggle |= dwc2_ep_toggle_mask(urb);
+        } else {
+            urb->hport->ep_toggle &= ~dwc2_ep_toggle_mask(urb);
+        }
+    }
+#endif
+
     if (urb->timeout) {
         usb_osal_sem_give(chan->waitsem);
     } else {
+#ifdef CONFIG_USBHOST_URB_QUEUE
+        dwc2_chan_queue_next(chan, urb);
+#else
         dwc2_chan_free(chan);
+#endif
     }
 
     if (urb->complete) {
@@ -1177,6 +1599,19 @@ static void dwc2_inchan_irq_handler(struct usbh_bus *bus, uint8_t ch_num)
     urb = chan->urb;
     //printf("s1:%08x\r\n", chan_intstatus);
 
+#if CONFIG_USB_DWC2_NAK_RETRY > 0
+    if ((chan_intstatus & (USB_OTG_HCINT_NAK | USB_OTG_HCINT_CHH)) == USB_OTG_HCINT_NAK) {
+        USB_OTG_HC(ch_num)->HCINT = USB_OTG_HCINT_NAK;
+        if (++chan->nak_count >= CONFIG_USB_DWC2_NAK_RETRY) {
+            /* stop polling, the channel is parked when it reports halted */
+            USB_OTG_HC(ch_num)->HCINTMSK &= ~USB_OTG_HCINTMSK_NAKM;
+            chan->nak_halt = true;
+            USB_OTG_HC(ch_num)->HCCHAR |= (USB_OTG_HCCHAR_CHDIS | USB_OTG_HCCHAR_CHENA);
+        }
+        return;
+    }
+#endif
+
     if (chan_intstatus & USB_OTG_HCINT_CHH) {
         USB_OTG_HC(ch_num)->HCINT = chan_intstatus;
         if (chan_intstatus & USB_OTG_HCINT_XFRC) {
@@ -1213,7 +1648,7 @@ static void dwc2_inchan_irq_handler(struct usbh_bus *bus, uint8_t ch_num)
             } else if (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
             } else {
                 if (chan->do_ssplit && urb->transfer_buffer_length > 0 && (count == USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize))) {
-                    dwc2_bulk_intr_urb_init(bus, ch_num, urb, urb->transfer_buffer + urb->actual_length, urb->transfer_buffer_length);
+                    dwc2_bulk_intr_urb_start(bus, ch_num, urb);
                 } else {
                     usb_dcache_invalidate((uintptr_t)urb->transfer_buffer, USB_ALIGN_UP(urb->actual_length, CONFIG_USB_ALIGN_SIZE));
                     urb->errorcode = 0;
@@ -1226,18 +1661,44 @@ static void dwc2_inchan_irq_handler(struct usbh_bus *bus, uint8_t ch_num)
         } else if (chan_intstatus & USB_OTG_HCINT_STALL) {
             urb->errorcode = -USB_ERR_STALL;
             dwc2_urb_waitup(urb);
+        } else if (chan->nak_halt) {
+            /* keep what was received before halt and continue after holdoff */
+            uint32_t count = chan->xferlen - (USB_OTG_HC(ch_num)->HCTSIZ & USB_OTG_HCTSIZ_XFRSIZ);
+            uint8_t data_toggle = ((USB_OTG_HC(ch_num)->HCTSIZ & USB_OTG_HCTSIZ_DPID) >> USB_OTG_HCTSIZ_DPID_Pos);
+
+            urb->actual_length += count;
+            urb->transfer_buffer_length -= count;
+            urb->data_toggle = (data_toggle == HC_PID_DATA0) ? 0 : 1;
+
+            chan->nak_halt = false;
+            dwc2_chan_park(bus, chan, DWC2_SOF_WAIT_START, dwc2_frame_ticks(bus, CONFIG_USB_DWC2_NAK_HOLDOFF));
         } else if (chan_intstatus & USB_OTG_HCINT_NAK) {
             if (chan->do_ssplit) {
                 /* restart ssplit transfer */
                 switch (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes)) {
                     case USB_ENDPOINT_TYPE_CONTROL:
+                        chan->do_csplit = 0;
+                        dwc2_chan_enable_csplit(bus, ch_num, false);
+                        dwc2_chan_reenable(bus, ch_num);
+                        break;
                     case USB_ENDPOINT_TYPE_BULK:
                         chan->do_csplit = 0;
                         dwc2_chan_enable_csplit(bus, ch_num, false);
+#if CONFIG_USB_DWC2_NAK_RETRY > 0
+                        if (++chan->nak_count >= CONFIG_USB_DWC2_NAK_RETRY) {
+                            chan->nak_count = 0;
+                            dwc2_chan_park(bus, chan, DWC2_SOF_WAIT_REENABLE, dwc2_frame_ticks(bus, CONFIG_USB_DWC2_NAK_HOLDOFF));
+                            break;
+                        }
+#endif
                         dwc2_chan_reenable(bus, ch_num);
                         break;
                     case USB_ENDPOINT_TYPE_INTERRUPT:
                         dwc2_chan_enable_csplit(bus, ch_num, false);
+                        if (dwc2_int_urb_repoll(bus, chan, urb)) {
+                            chan->do_csplit = 0;
+                            break;
+                        }
                         urb->errorcode = -USB_ERR_NAK;
                         dwc2_urb_waitup(urb);
                         break;
@@ -1245,23 +1706,17 @@ static void dwc2_inchan_irq_handler(struct usbh_bus *bus, uint8_t ch_num)
                     default:
                         break;
                 }
-            } else {
+            } else if (!dwc2_int_urb_repoll(bus, chan, urb)) {
                 urb->errorcode = -USB_ERR_NAK;
                 dwc2_urb_waitup(urb);
             }
         } else if (chan_intstatus & USB_OTG_HCINT_ACK) {
             if (chan->do_ssplit) {
-                /* start ssplit transfer */
-                chan->do_csplit = 1;
-                chan->ssplit_frame = dwc2_get_full_frame_num(bus);
-                dwc2_chan_enable_csplit(bus, ch_num, true);
-                dwc2_chan_reenable(bus, ch_num);
+                dwc2_split_ack(bus, chan);
             }
         } else if (chan_intstatus & USB_OTG_HCINT_NYET) {
             if (chan->do_ssplit) {
-                /* restart csplit transfer */
-                dwc2_chan_enable_csplit(bus, ch_num, true);
-                dwc2_chan_reenable(bus, ch_num);
+                dwc2_split_nyet(bus, chan, urb);
             } else {
                 urb->errorcode = -USB_ERR_NAK;
                 dwc2_urb_waitup(urb);
@@ -1351,7 +1806,7 @@ static void dwc2_outchan_irq_handler(struct usbh_bus *bus, uint8_t ch_num)
             } else if (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
             } else {
                 if (chan->do_ssplit && urb->transfer_buffer_length > 0) {
-                    dwc2_bulk_intr_urb_init(bus, ch_num, urb, urb->transfer_buffer + urb->actual_length, urb->transfer_buffer_length);
+                    dwc2_bulk_intr_urb_start(bus, ch_num, urb);
                 } else {
                     urb->errorcode = 0;
                     dwc2_urb_waitup(urb);
@@ -1388,17 +1843,11 @@ static void dwc2_outchan_irq_handler(struct usbh_bus *bus, uint8_t ch_num)
             }
         } else if (chan_intstatus & USB_OTG_HCINT_ACK) {
             if (chan->do_ssplit) {
-                /* start ssplit transfer */
-                chan->do_csplit = 1;
-                chan->ssplit_frame = dwc2_get_full_frame_num(bus);
-                dwc2_chan_enable_csplit(bus, ch_num, true);
-                dwc2_chan_reenable(bus, ch_num);
+                dwc2_split_ack(bus, chan);
             }
         } else if (chan_intstatus & USB_OTG_HCINT_NYET) {
             if (chan->do_ssplit) {
-                /* restart csplit transfer */
-                dwc2_chan_enable_csplit(bus, ch_num, true);
-                dwc2_chan_reenable(bus, ch_num);
+                dwc2_split_nyet(bus, chan, urb);
             } else {
                 urb->errorcode = -USB_ERR_NAK;
                 dwc2_urb_waitup(urb);
@@ -1450,6 +1899,7 @@ static void dwc2_port_irq_handler(struct usbh_bus *bus)
             regval &= ~USB_OTG_HFIR_FRIVL;
             regval |= dwc2_calc_frame_interval(bus) & USB_OTG_HFIR_FRIVL;
             USB_OTG_HOST->HFIR = regval;
+            dwc2_sched_update(bus, regval, (hprt0 & USB_OTG_HPRT_PSPD) >> USB_OTG_HPRT_PSPD_Pos);
 
             if (g_dwc2_hcd[bus->hcd.hcd_id].user_params.phy_type == DWC2_PHY_TYPE_PARAM_FS) {
                 if ((hprt0 & USB_OTG_HPRT_PSPD) == (HPRT0_PRTSPD_LOW_SPEED << 17)) {
@@ -1481,6 +1931,43 @@ static void dwc2_port_irq_handler(struct usbh_bus *bus)
     USB_OTG_HPRT = hprt0_dup;
 }
 
+static void dwc2_sof_irq_handler(struct usbh_bus *bus)
+{
+    struct dwc2_chan *chan;
+    uint16_t frame;
+    uint8_t wait;
+    bool pending = false;
+
+    frame = usbh_get_frame_number(bus) & DWC2_FRAME_MASK;
+
+    for (uint8_t chidx = 0; chidx < g_dwc2_hcd[bus->hcd.hcd_id].hw_params.host_channels; chidx++) {
+        chan = &g_dwc2_hcd[bus->hcd.hcd_id].chan_pool[chidx];
+        if (!chan->inuse || (chan->sof_wait == DWC2_SOF_WAIT_NONE)) {
+            continue;
+        }
+        /* next_frame is still ahead */
+        if (((frame - chan->next_frame) & DWC2_FRAME_MASK) >= (DWC2_FRAME_MASK >> 1)) {
+            pending = true;
+            continue;
+        }
+
+        wait = chan->sof_wait;
+        chan->sof_wait = DWC2_SOF_WAIT_NONE;
+        if (wait == DWC2_SOF_WAIT_REENABLE) {
+            dwc2_chan_reenable(bus, chidx);
+        } else {
+            dwc2_bulk_intr_urb_start(bus, chidx, chan->urb);
+            if (chan->sof_wait != DWC2_SOF_WAIT_NONE) {
+                pending = true;
+            }
+        }
+    }
+
+    if (!pending) {
+        USB_OTG_GLB->GINTMSK &= ~USB_OTG_GINTMSK_SOFM;
+    }
+}
+
 void USBH_IRQHandler(uint8_t busid)
 {
     uint32_t gint_status, chan_int;
@@ -1504,6 +1991,10 @@ void USBH_IRQHandler(uint8_t busid)
 
             USB_OTG_GLB->GINTSTS = USB_OTG_GINTSTS_DISCINT;
         }
+        if (gint_status & USB_OTG_GINTSTS_SOF) {
+            USB_OTG_GLB->GINTSTS = USB_OTG_GINTSTS_SOF;
+            dwc2_sof_irq_handler(bus);
+        }
         if (gint_status & USB_OTG_GINTSTS_HCINT) {
             chan_int = (USB_OTG_HOST->HAINT & USB_OTG_HOST->HAINTMSK) & 0xFFFFU;
             for (uint8_t i = 0U; i < g_dwc2_hcd[bus->hcd.hcd_id].hw_params.host_channels; i++) {
@@ -292,6 +292,73 @@
 #define ITD_BUFPTR2_MULTI_2     (2 << ITD_BUFPTR2_MULTI_SHIFT) /* Two transactions per micro-frame */
 #define ITD_BUFPTR2_MULTI_3     (3 << ITD_BUFPTR2_MULTI_SHIFT) /* Three transactions per micro-frame */
 
+/* Split Transaction Isochronous Transfer Descriptor (siTD). Paragraph 3.4 */
+
+/* siTD Next Link Pointer. Paragraph 3.4.1 */
+
+#define SITD_NLP_ITD(x)  (((uint32_t)(x) & ~0x1F) | 0x0)
+#define SITD_NLP_QH(x)   (((uint32_t)(x) & ~0x1F) | 0x2)
+#define SITD_NLP_SITD(x) (((uint32_t)(x) & ~0x1F) | 0x4)
+#define SITD_NLP_FSTN(x) (((uint32_t)(x) & ~0x1F) | 0x6)
+
+/* siTD Endpoint Capabilities/Characteristics. Paragraph 3.4.2 */
+
+#define SITD_EPCHAR_DEVADDR_SHIFT (0) /* Bits 0-6: Device Address */
+#define SITD_EPCHAR_DEVADDR_MASK  (0x7f << SITD_EPCHAR_DEVADDR_SHIFT)
+#define SITD_EPCHAR_ENDPT_SHIFT   (8) /* Bits 8-11: Endpoint Number */
+#define SITD_EPCHAR_ENDPT_MASK    (15 << SITD_EPCHAR_ENDPT_SHIFT)
+#define SITD_EPCHAR_HUBADDR_SHIFT (16) /* Bits 16-22: Hub Address */
+#define SITD_EPCHAR_HUBADDR_MASK  (0x7f << SITD_EPCHAR_HUBADDR_SHIFT)
+#define SITD_EPCHAR_PORT_SHIFT    (24) /* Bits 24-30: Port Number */
+#define SITD_EPCHAR_PORT_MASK     (0x7f << SITD_EPCHAR_PORT_SHIFT)
+#define SITD_EPCHAR_DIRIN         (1 << 31) /* Bit 31: Direction 1=IN */
+#define SITD_EPCHAR_DIROUT        (0)       /* Bit 31: Direction 0=OUT */
+
+/* siTD Micro-frame Schedule Control. Paragraph 3.4.2 */
+
+#define SITD_MFSC_SSMASK_SHIFT (0) /* Bits 0-7: Split Start Mask (uFrame S-mask) */
+#define SITD_MFSC_SSMASK_MASK  (0xff << SITD_MFSC_SSMASK_SHIFT)
+#define SITD_MFSC_SSMASK(n)    ((n) << SITD_MFSC_SSMASK_SHIFT)
+#define SITD_MFSC_SCMASK_SHIFT (8) /* Bits 8-15: Split Completion Mask (uFrame C-Mask) */
+#define SITD_MFSC_SCMASK_MASK  (0xff << SITD_MFSC_SCMASK_SHIFT)
+#define SITD_MFSC_SCMASK(n)    ((n) << SITD_MFSC_SCMASK_SHIFT)
+
+/* siTD Transfer Status and Control. Paragraph 3.4.3 */
+
+#define SITD_TSC_STATUS_SHIFT       (0) /* Bits 0-7: Status */
+#define SITD_TSC_STATUS_MASK        (0xff << SITD_TSC_STATUS_SHIFT)
+#define SITD_TSC_STATUS_SPLITXSTATE (1 << 1) /* Bit 1: Split Transaction State */
+#define SITD_TSC_STATUS_MMF         (1 << 2) /* Bit 2: Missed Micro-Frame */
+#define SITD_TSC_STATUS_XACTERR     (1 << 3) /* Bit 3: Transaction Error */
+#define SITD_TSC_STATUS_BABBLE      (1 << 4) /* Bit 4: Babble Detected */
+#define SITD_TSC_STATUS_DBERR       (1 << 5) /* Bit 5: Data Buffer Error */
+#define SITD_TSC_STATUS_ERR         (1 << 6) /* Bit 6: ERR response from TT */
+#define SITD_TSC_STATUS_ACTIVE      (1 << 7) /* Bit 7: Active */
+#define SITD_TSC_STATUS_ERRORS      (0x7c << SITD_TSC_STATUS_SHIFT)
+#define SITD_TSC_CPROG_SHIFT        (8) /* Bits 8-15: uFrame Complete-split Progress Mask */
+#define SITD_TSC_CPROG_MASK         (0xff << SITD_TSC_CPROG_SHIFT)
+#define SITD_TSC_NBYTES_SHIFT       (16) /* Bits 16-25: Total Bytes to Transfer */
+#define SITD_TSC_NBYTES_MASK        (0x3ff << SITD_TSC_NBYTES_SHIFT)
+#define SITD_TSC_PAGE               (1 << 30) /* Bit 30: Page Select */
+#define SITD_TSC_IOC                (1 << 31) /* Bit 31: Interrupt On Complete */
+
+/* siTD Buffer Pointer List. Paragraph 3.4.4 */
+
+#define SITD_BPL0_OFFSET_SHIFT (0) /* Bits 0-11: Current Offset */
+#define SITD_BPL0_OFFSET_MASK  (0xfff << SITD_BPL0_OFFSET_SHIFT)
+#define SITD_BPL1_TCOUNT_SHIFT (0) /* Bits 0-2: Transaction Count */
+#define SITD_BPL1_TCOUNT_MASK  (7 << SITD_BPL1_TCOUNT_SHIFT)
+#define SITD_BPL1_TP_SHIFT     (3) /* Bits 3-4: Transaction Position */
+#define SITD_BPL1_TP_MASK      (3 << SITD_BPL1_TP_SHIFT)
+#define SITD_BPL1_TP_ALL       (0 << SITD_BPL1_TP_SHIFT) /* Entire payload in one start-split */
+#define SITD_BPL1_TP_BEGIN     (1 << SITD_BPL1_TP_SHIFT) /* First start-split of payload */
+#define SITD_BPL1_TP_MID       (2 << SITD_BPL1_TP_SHIFT) /* Middle start-split of payload */
+#define SITD_BPL1_TP_END       (3 << SITD_BPL1_TP_SHIFT) /* Last start-split of payload */
+
+/* siTD Back Link Pointer. Paragraph 3.4.5 */
+
+#define SITD_BLP_END 0x1
+
 /* Registers ****************************************************************/
 
 /* Host Controller Capability Registers.
@@ -21,8 +21,10 @@ USB_NOCACHE_RAM_SECTION struct ehci_qtd_hw ehci_qtd_pool[CONFIG_USBHOST_MAX_BUS]
 
 /* The head of the asynchronous queue */
 USB_NOCACHE_RAM_SECTION struct ehci_qh_hw g_async_qh_head[CONFIG_USBHOST_MAX_BUS];
-/* The head of the periodic queue */
+/* The head of the periodic queue, root of the interrupt tree and polled every frame */
 USB_NOCACHE_RAM_SECTION struct ehci_qh_hw g_periodic_qh_head[CONFIG_USBHOST_MAX_BUS];
+/* Interrupt tree nodes of period 2, 4 ... CONFIG_USB_EHCI_PERIODIC_TREE_SIZE frames */
+USB_NOCACHE_RAM_SECTION struct ehci_qh_hw g_periodic_skel[CONFIG_USBHOST_MAX_BUS][CONFIG_USB_EHCI_PERIODIC_TREE_SIZE * 2 - 2];
 
 /* The frame list */
 USB_NOCACHE_RAM_SECTION uint32_t g_framelist[CONFIG_USBHOST_MAX_BUS][USB_ALIGN_UP(CONFIG_USB_EHCI_FRAME_LIST_SIZE, 1024)] __attribute__((aligned(4096)));
@@ -33,36 +35,38 @@ static struct ehci_qtd_hw *ehci_qtd_alloc(struct usbh_bus *bus)
     size_t flags;
 
     flags = usb_osal_enter_critical_section();
-    for (uint32_t i = 0; i < CONFIG_USB_EHCI_QTD_NUM; i++) {
-        qtd = &ehci_qtd_pool[bus->hcd.hcd_id][i];
-        if (!qtd->inuse) {
-            qtd->inuse = true;
-            usb_osal_leave_critical_section(flags);
-
-            memset(&qtd->hw, 0, sizeof(struct ehci_qtd));
-            qtd->hw.next_qtd = QTD_LIST_END;
-            qtd->hw.alt_next_qtd = QTD_LIST_END;
-            qtd->hw.token = QTD_TOKEN_STATUS_HALTED;
-            qtd->urb = NULL;
-            qtd->bufaddr = 0;
-            qtd->length = 0;
-
-            return qtd;
-        }
+    qtd = g_ehci_hcd[bus->hcd.hcd_id].qtd_free;
+    if (qtd == NULL) {
+        usb_osal_leave_critical_section(flags);
+        return NULL;
     }
+    g_ehci_hcd[bus->hcd.hcd_id].qtd_free = qtd->free_next;
+    qtd->inuse = true;
     usb_osal_leave_critical_section(flags);
-    return NULL;
+
+    memset(&qtd->hw, 0, sizeof(struct ehci_qtd));
+    qtd->hw.next_qtd = QTD_LIST_END;
+    qtd->hw.alt_next_qtd = QTD_LIST_END;
+    qtd->hw.token = QTD_TOKEN_STATUS_HALTED;
+    qtd->urb = NULL;
+    qtd->bufaddr = 0;
+    qtd->length = 0;
+    qtd->free_next = NULL;
+
+    return qtd;
 }
 
 static void ehci_qtd_free(struct usbh_bus *bus, struct ehci_qtd_hw *qtd)
 {
     size_t flags;
 
-    (void)bus;
-
     flags = usb_osal_enter_critical_section();
-    qtd->inuse = false;
-    qtd->urb = NULL;
+    if (qtd->inuse) {
+        qtd->inuse = false;
+        qtd->urb = NULL;
+        qtd->free_next = g_ehci_hcd[bus->hcd.hcd_id].qtd_free;
+        g_ehci_hcd[bus->hcd.hcd_id].qtd_free = qtd;
+    }
     usb_osal_leave_critical_section(flags);
 }
 
@@ -72,25 +76,27 @@ static struct ehci_qh_hw *ehci_qh_alloc(struct usbh_bus *bus)
     size_t flags;
 
     flags = usb_osal_enter_critical_section();
-    for (uint32_t i = 0; i < CONFIG_USB_EHCI_QH_NUM; i++) {
-        qh = &ehci_qh_pool[bus->hcd.hcd_id][i];
-        if (!qh->inuse) {
-            qh->inuse = true;
-            usb_osal_leave_critical_section(flags);
-
-            memset(&qh->hw, 0, sizeof(struct ehci_qh));
-            qh->hw.hlp = QTD_LIST_END;
-            qh->hw.overlay.next_qtd = QTD_LIST_END;
-            qh->hw.overlay.alt_next_qtd = QTD_LIST_END;
-            qh->urb = NULL;
-            qh->first_qtd = QTD_LIST_END;
-            qh->remove_in_iaad = 0;
-
-            return qh;
-        }
+    qh = g_ehci_hcd[bus->hcd.hcd_id].qh_free;
+    if (qh == NULL) {
+        usb_osal_leave_critical_section(flags);
+        return NULL;
     }
+    g_ehci_hcd[bus->hcd.hcd_id].qh_free = qh->free_next;
+    qh->inuse = true;
     usb_osal_leave_critical_section(flags);
-    return NULL;
+
+    memset(&qh->hw, 0, sizeof(struct ehci_qh));
+    qh->hw.hlp = QTD_LIST_END;
+    qh->hw.overlay.next_qtd = QTD_LIST_END;
+    qh->hw.overlay.alt_next_qtd = QTD_LIST_END;
+    qh->urb = NULL;
+    qh->first_qtd = QTD_LIST_END;
+    qh->remove_in_iaad = 0;
+    qh->free_next = NULL;
+    qh->period = 0;
+    qh->tt = NULL;
+
+    return qh;
 }
 
 static void ehci_qh_free(struct usbh_bus *bus, struct ehci_qh_hw *qh)
@@ -110,7 +116,11 @@ static void ehci_qh_free(struct usbh_bus *bus, struct ehci_qh_hw *qh)
         qtd = EHCI_ADDR2QTD(qtd->hw.next_qtd);
     }
 
-    qh->inuse = false;
+    if (qh->inuse) {
+        qh->inuse = false;
+        qh->free_next = g_ehci_hcd[bus->hcd.hcd_id].qh_free;
+        g_ehci_hcd[bus->hcd.hcd_id].qh_free = qh;
+    }
     qh->first_qtd = QTD_LIST_END;
     usb_osal_leave_critical_section(flags);
 }
@@ -137,7 +147,9 @@ static inline void ehci_qh_add_head(struct ehci_qh_hw *head, struct ehci_qh_hw *
     n->hw.hlp = head->hw.hlp;
     usb_ehci_qh_qtd_flush(n);
 
-    usb_dcache_flush((uintptr_t)n->urb->transfer_buffer, USB_ALIGN_UP(n->urb->transfer_buffer_length, CONFIG_USB_ALIGN_SIZE));
+    if (n->urb) {
+        usb_dcache_flush((uintptr_t)n->urb->transfer_buffer, USB_ALIGN_UP(n->urb->transfer_buffer_length, CONFIG_USB_ALIGN_SIZE));
+    }
 
     head->hw.hlp = QH_HLP_QH(n);
 #if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
@@ -161,26 +173,256 @@ static inline void ehci_qh_remove(struct ehci_qh_hw *head, struct ehci_qh_hw *n)
     }
 }
 
-static int ehci_caculate_smask(int binterval)
+/* Periodic micro-frame budget, 80% of 125us, usb2.0 5.6.4 */
+#define EHCI_UFRAME_BUDGET 100
+/* Periodic frame budget on tt, 90% of 1ms */
+#define EHCI_TT_BUDGET 900
+
+static inline struct ehci_qh_hw *ehci_periodic_skel(struct usbh_bus *bus, uint8_t period, uint8_t phase)
 {
-    int order, interval;
+    if (period == 1) {
+        return &g_periodic_qh_head[bus->hcd.hcd_id];
+    }
+    /* nodes of period p start at index p - 2 */
+    return &g_periodic_skel[bus->hcd.hcd_id][period - 2 + phase];
+}
+
+static void ehci_periodic_tree_init(struct usbh_bus *bus)
+{
+    struct ehci_qh_hw *skel;
+
+    /* every node links to the node of half period that shares its frames */
+    for (uint32_t period = 2; period <= CONFIG_USB_EHCI_PERIODIC_TREE_SIZE; period <<= 1) {
+        for (uint32_t phase = 0; phase < period; phase++) {
+            skel = ehci_periodic_skel(bus, period, phase);
+            memset(skel, 0, sizeof(struct ehci_qh_hw));
+            skel->hw.hlp = QH_HLP_QH(ehci_periodic_skel(bus, period / 2, phase % (period / 2)));
+            skel->hw.epchar = QH_EPCAPS_SSMASK(1);
+            skel->hw.overlay.next_qtd = QTD_LIST_END;
+            skel->hw.overlay.alt_next_qtd = QTD_LIST_END;
+            skel->hw.overlay.token = QTD_TOKEN_STATUS_HALTED;
+            skel->first_qtd = QTD_LIST_END;
+#if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
+            usb_dcache_clean((uintptr_t)&skel->hw, CONFIG_USB_EHCI_ALIGN_SIZE);
+#endif
+        }
+    }
 
-    interval = 1;
-    while (binterval > 1) {
-        interval *= 2;
-        binterval--;
+    for (uint32_t i = 0; i < CONFIG_USB_EHCI_FRAME_LIST_SIZE; i++) {
+        g_framelist[bus->hcd.hcd_id][i] = QH_HLP_QH(ehci_periodic_skel(bus, CONFIG_USB_EHCI_PERIODIC_TREE_SIZE, i % CONFIG_USB_EHCI_PERIODIC_TREE_SIZE));
     }
+}
 
-    if (interval < 2) /* interval 1 */
-        return 0xFF;
-    if (interval < 4) /* interval 2 */
-        return 0x55;
-    if (interval < 8) /* interval 4 */
-        return 0x22;
-    for (order = 0; (interval > 1); order++) {
-        interval >>= 1;
+/* Bus time of one transaction in us, usb2.0 5.11.3 with worst case bit stuffing */
+uint32_t ehci_bus_time(uint8_t speed, uint32_t bytes)
+{
+    uint32_t bits = bytes * 8 * 7 / 6;
+
+    if (speed == USB_SPEED_HIGH) {
+        return ((55 * 8 + bits) * 2083 / 1000 + 999) / 1000;
+    } else if (speed == USB_SPEED_LOW) {
+        return 65 + bits * 2 / 3;
+    } else {
+        return 10 + bits / 12;
     }
-    return (0x1 << (order % 8));
+}
+
+struct ehci_tt *ehci_tt_get(struct usbh_bus *bus, struct usbh_hubport *hport)
+{
+    struct ehci_tt *free_tt = NULL;
+    struct usbh_hub *hub;
+    uint8_t port;
+
+    /* fs/ls device is translated by the nearest hs hub, or by the root hub with integrated tt */
+    while (!hport->parent->is_roothub && (hport->parent->speed != USB_SPEED_HIGH)) {
+        hport = hport->parent->parent;
+    }
+    hub = hport->parent;
+    port = (hub->is_roothub || hub->ismtt) ? hport->port : 0;
+
+    for (uint8_t i = 0; i < CONFIG_USB_EHCI_TT_NUM; i++) {
+        struct ehci_tt *tt = &g_ehci_hcd[bus->hcd.hcd_id].tt[i];
+
+        if (tt->users && (tt->hub == hub) && (tt->port == port)) {
+            return tt;
+        }
+        if (!tt->users && !free_tt) {
+            free_tt = tt;
+        }
+    }
+
+    if (free_tt) {
+        memset(free_tt, 0, sizeof(struct ehci_tt));
+        free_tt->hub = hub;
+        free_tt->port = port;
+    }
+    return free_tt;
+}
+
+/*
+ * Choose the phase and micro-frames with the lowest resulting load for an endpoint served every
+ * period frames, and reserve its bus time. mask has s-mask in bits 0~7 and c-mask in bits 8~15,
+ * candidates are mask moved by 0 ~ step - 1 micro-frames. Returns the chosen mask, 0 if nothing fits.
+ */
+uint32_t ehci_periodic_reserve(struct usbh_bus *bus, struct ehci_tt *tt, uint32_t period, uint32_t mask, uint8_t step,
+                               uint32_t hs_us, uint32_t tt_us, uint32_t *phase)
+{
+    struct ehci_hcd *hcd = &g_ehci_hcd[bus->hcd.hcd_id];
+    uint32_t best_mask = 0;
+    uint32_t best_phase = 0;
+    uint32_t best_load = 0xffff;
+    uint32_t load;
+    uint32_t smask;
+    uint32_t cmask;
+    uint32_t try_mask;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+
+    for (uint32_t try_phase = 0; try_phase < period; try_phase++) {
+        for (uint8_t uframe = 0; uframe < step; uframe++) {
+            smask = (mask & QH_EPCAPS_SSMASK_MASK) << uframe;
+            cmask = ((mask & QH_EPCAPS_SCMASK_MASK) >> QH_EPCAPS_SCMASK_SHIFT) << uframe;
+            if ((smask > 0xff) || (cmask > 0xff)) {
+                break;
+            }
+            try_mask = QH_EPCAPS_SSMASK(smask) | QH_EPCAPS_SCMASK(cmask);
+
+            load = 0;
+            for (uint32_t frame = try_phase; frame < CONFIG_USB_EHCI_PERIODIC_TREE_SIZE; frame += period) {
+                for (uint8_t i = 0; i < 8; i++) {
+                    if ((try_mask & ((1 << i) | (1 << (i + 8)))) && ((hcd->uframe_load[frame * 8 + i] + hs_us) > load)) {
+                        load = hcd->uframe_load[frame * 8 + i] + hs_us;
+                    }
+                }
+                if (tt && ((tt->frame_load[frame] + tt_us) > EHCI_TT_BUDGET)) {
+                    load = 0xffff;
+                }
+            }
+
+            if ((load <= EHCI_UFRAME_BUDGET) && (load < best_load)) {
+                best_load = load;
+                best_mask = try_mask;
+                best_phase = try_phase;
+            }
+        }
+    }
+
+    if (best_mask) {
+        for (uint32_t frame = best_phase; frame < CONFIG_USB_EHCI_PERIODIC_TREE_SIZE; frame += period) {
+            for (uint8_t i = 0; i < 8; i++) {
+                if (best_mask & ((1 << i) | (1 << (i + 8)))) {
+                    hcd->uframe_load[frame * 8 + i] += hs_us;
+                }
+            }
+            if (tt) {
+                tt->frame_load[frame] += tt_us;
+            }
+        }
+        if (tt) {
+            tt->users++;
+        }
+        *phase = best_phase;
+    }
+
+    usb_osal_leave_critical_section(flags);
+    return best_mask;
+}
+
+void ehci_periodic_release(struct usbh_bus *bus, struct ehci_tt *tt, uint32_t period, uint32_t phase, uint32_t mask,
+                           uint32_t hs_us, uint32_t tt_us)
+{
+    struct ehci_hcd *hcd = &g_ehci_hcd[bus->hcd.hcd_id];
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    for (uint32_t frame = phase; frame < CONFIG_USB_EHCI_PERIODIC_TREE_SIZE; frame += period) {
+        for (uint8_t i = 0; i < 8; i++) {
+            if (mask & ((1 << i) | (1 << (i + 8)))) {
+                hcd->uframe_load[frame * 8 + i] -= hs_us;
+            }
+        }
+        if (tt) {
+            tt->frame_load[frame] -= tt_us;
+        }
+    }
+    if (tt) {
+        tt->users--;
+    }
+    usb_osal_leave_critical_section(flags);
+}
+
+/* Choose period, phase and s-mask/c-mask of an interrupt qh and reserve its bus time */
+static int ehci_periodic_alloc(struct usbh_bus *bus, struct ehci_qh_hw *qh, struct usbh_urb *urb)
+{
+    struct ehci_tt *tt = NULL;
+    uint32_t interval;
+    uint32_t period;
+    uint32_t phase = 0;
+    uint32_t hs_us;
+    uint32_t tt_us = 0;
+    uint32_t mask;
+    uint8_t step;
+    uint8_t bInterval = urb->ep->bInterval ? urb->ep->bInterval : 1;
+    bool split = (urb->hport->speed != USB_SPEED_HIGH);
+
+    if (!split) {
+        /* hs interval is 2^(bInterval-1) micro-frames */
+        interval = 1UL << ((bInterval > 16 ? 16 : bInterval) - 1);
+        hs_us = ehci_bus_time(USB_SPEED_HIGH, USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize)) * (USB_GET_MULT(urb->ep->wMaxPacketSize) + 1);
+        step = (interval < 8) ? interval : 8;
+        period = (interval < 8) ? 1 : (interval / 8);
+        mask = 0;
+        for (uint8_t i = 0; i < 8; i += step) {
+            mask |= QH_EPCAPS_SSMASK(1 << i);
+        }
+    } else {
+        /* fs/ls interval is in frames, poll at the largest power of 2 not above it */
+        for (period = 1; (period * 2) <= bInterval; period *= 2) {
+        }
+        hs_us = ehci_bus_time(USB_SPEED_HIGH, USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize));
+        tt_us = ehci_bus_time(urb->hport->speed, USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize));
+        /* start split in u, complete splits in u+2~u+4, usb2.0 11.18.4 */
+        step = 4;
+        mask = QH_EPCAPS_SSMASK(0x01) | QH_EPCAPS_SCMASK(0x1c);
+        tt = ehci_tt_get(bus, urb->hport);
+        if (tt == NULL) {
+            USB_LOG_WRN("No free tt slot, fs/ls bandwidth is not checked\r\n");
+        }
+    }
+
+    if (period > CONFIG_USB_EHCI_PERIODIC_TREE_SIZE) {
+        period = CONFIG_USB_EHCI_PERIODIC_TREE_SIZE;
+    }
+
+    mask = ehci_periodic_reserve(bus, tt, period, mask, step, hs_us, tt_us, &phase);
+    if (mask == 0) {
+        USB_LOG_ERR("Periodic bandwidth is not enough for ep 0x%02x\r\n", urb->ep->bEndpointAddress);
+        return -USB_ERR_RANGE;
+    }
+
+    qh->hw.epcap &= ~(QH_EPCAPS_SSMASK_MASK | QH_EPCAPS_SCMASK_MASK);
+    qh->hw.epcap |= mask;
+    qh->period = period;
+    qh->phase = phase;
+    qh->hs_us = hs_us;
+    qh->tt_us = tt_us;
+    qh->tt = tt;
+    return 0;
+}
+
+static void ehci_periodic_free(struct usbh_bus *bus, struct ehci_qh_hw *qh)
+{
+    uint32_t mask = qh->hw.epcap & (QH_EPCAPS_SSMASK_MASK | QH_EPCAPS_SCMASK_MASK);
+
+    ehci_periodic_release(bus, qh->tt, qh->period, qh->phase, mask, qh->hs_us, qh->tt_us);
+    qh->tt = NULL;
+    qh->period = 0;
+}
+
+static inline void ehci_periodic_link(struct usbh_bus *bus, struct ehci_qh_hw *qh)
+{
+    ehci_qh_add_head(ehci_periodic_skel(bus, qh->period, qh->phase), qh);
 }
 
 static void ehci_qh_fill(struct ehci_qh_hw *qh,
@@ -248,11 +490,6 @@ static void ehci_qh_fill(struct ehci_qh_hw *qh,
             epcap |= QH_EPCAPS_HUBADDR(hubaddr);
             epcap |= QH_EPCAPS_PORT(hubport);
 
-            if (ep_type == USB_ENDPOINT_TYPE_INTERRUPT) {
-                epcap |= QH_EPCAPS_SSMASK(2);
-                epcap |= QH_EPCAPS_SCMASK(0x78);
-            }
-
             break;
         case USB_SPEED_HIGH:
             epchar |= QH_EPCHAR_EPS_HIGH;
@@ -263,9 +500,8 @@ static void ehci_qh_fill(struct ehci_qh_hw *qh,
             } else if (ep_type == USB_ENDPOINT_TYPE_BULK) {
                 epcap |= QH_EPCAPS_MULT(EHCI_TUNE_MULT_HS);
             } else {
-                /* only for interrupt ep */
+                /* only for interrupt ep, s-mask is chosen by ehci_periodic_alloc */
                 epcap |= QH_EPCAPS_MULT(ep_mult);
-                epcap |= ehci_caculate_smask(ep_interval);
             }
             break;
 
@@ -423,6 +659,7 @@ static struct ehci_qh_hw *ehci_control_urb_init(struct usbh_bus *bus, struct usb
     return qh;
 }
 
+#ifndef CONFIG_USB_EHCI_QH_CACHE
 static struct ehci_qh_hw *ehci_bulk_urb_init(struct usbh_bus *bus, struct usbh_urb *urb, uint8_t *buffer, uint32_t buflen)
 {
     struct ehci_qh_hw *qh = NULL;
@@ -545,6 +782,12 @@ static struct ehci_qh_hw *ehci_intr_urb_init(struct usbh_bus *bus, struct usbh_u
                  urb->hport->parent->hub_addr,
                  urb->hport->port);
 
+    if (ehci_periodic_alloc(bus, qh, urb) < 0) {
+        ehci_qh_free(bus, qh);
+        urb->errorcode = -USB_ERR_RANGE;
+        return NULL;
+    }
+
     while (1) {
         qtd = ehci_qtd_alloc(bus);
         USB_ASSERT_MSG(qtd, "intr qtd alloc failed");
@@ -606,14 +849,15 @@ static struct ehci_qh_hw *ehci_intr_urb_init(struct usbh_bus *bus, struct usbh_u
 
     qh->urb = urb;
     urb->hcpriv = qh;
-    /* add qh into periodic list */
-    ehci_qh_add_head(&g_periodic_qh_head[bus->hcd.hcd_id], qh);
+    /* add qh into its interrupt tree node */
+    ehci_periodic_link(bus, qh);
 
     EHCI_HCOR->usbcmd |= EHCI_USBCMD_PSEN;
 
     usb_osal_leave_critical_section(flags);
     return qh;
 }
+#endif
 
 static void ehci_urb_waitup(struct usbh_bus *bus, struct usbh_urb *urb)
 {
@@ -638,13 +882,13 @@ static void ehci_urb_waitup(struct usbh_bus *bus, struct usbh_urb *urb)
     }
 }
 
+static void ehci_kill_qh(struct usbh_bus *bus, struct ehci_qh_hw *qhead, struct ehci_qh_hw *qh);
+
 static void ehci_qh_scan_qtds(struct usbh_bus *bus, struct ehci_qh_hw *qhead, struct ehci_qh_hw *qh)
 {
     struct ehci_qtd_hw *qtd;
 
-    (void)bus;
-
-    ehci_qh_remove(qhead, qh);
+    ehci_kill_qh(bus, qhead, qh);
 
     qtd = EHCI_ADDR2QTD(qh->first_qtd);
 
@@ -716,11 +960,463 @@ static void ehci_check_qh(struct usbh_bus *bus, struct ehci_qh_hw *qhead, struct
 
 static void ehci_kill_qh(struct usbh_bus *bus, struct ehci_qh_hw *qhead, struct ehci_qh_hw *qh)
 {
-    (void)bus;
+    if (qh->period) {
+        /* interrupt qh hangs on its tree node, not on qhead */
+        ehci_qh_remove(ehci_periodic_skel(bus, qh->period, qh->phase), qh);
+        ehci_periodic_free(bus, qh);
+        return;
+    }
 
     ehci_qh_remove(qhead, qh);
 }
 
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+static inline bool ehci_qh_is_periodic(struct ehci_qh_hw *qh)
+{
+    return (qh->hw.epcap & QH_EPCAPS_SSMASK_MASK) ? true : false;
+}
+
+static struct ehci_qh_hw *ehci_ep_qh_find(struct usbh_bus *bus, struct usbh_urb *urb, struct ehci_qh_hw *hint)
+{
+    struct ehci_qh_hw *qh = NULL;
+    usb_slist_t *node;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+
+    /* hint is the qh of the previous submit, the list walk is skipped while it is cached for this device and ep */
+    if (hint && hint->inuse && hint->cached &&
+        (hint->hport == urb->hport) && (hint->ep_addr == urb->ep->bEndpointAddress)) {
+        usb_osal_leave_critical_section(flags);
+        return hint;
+    }
+
+    usb_slist_for_each(node, &g_ehci_hcd[bus->hcd.hcd_id].ep_qh_list)
+    {
+        qh = usb_slist_entry(node, struct ehci_qh_hw, list);
+        if ((qh->hport == urb->hport) && (qh->ep_addr == urb->ep->bEndpointAddress)) {
+            break;
+        }
+        qh = NULL;
+    }
+
+    usb_osal_leave_critical_section(flags);
+    return qh;
+}
+
+static void ehci_ep_qh_giveback(struct ehci_qh_hw *qh, struct usbh_urb *urb)
+{
+    if (urb->timeout) {
+        usb_osal_sem_give(qh->waitsem);
+    }
+
+    if (urb->complete) {
+        if (urb->errorcode < 0) {
+            urb->complete(urb->arg, urb->errorcode);
+        } else {
+            urb->complete(urb->arg, urb->actual_length);
+        }
+    }
+}
+
+/* Wait until the controller drops the async qh it may have cached, called with irq locked */
+static int ehci_async_unlink_wait(struct usbh_bus *bus)
+{
+    volatile uint32_t timeout = 0;
+
+    EHCI_HCOR->usbcmd |= EHCI_USBCMD_IAAD;
+    while (!(EHCI_HCOR->usbsts & EHCI_USBSTS_IAA)) {
+        timeout++;
+        if (timeout > 20000) {
+            return -USB_ERR_TIMEOUT;
+        }
+    }
+    EHCI_HCOR->usbsts = EHCI_USBSTS_IAA;
+    return 0;
+}
+
+/* A periodic qh unlinked in this frame can be walked until the frame ends, called with irq locked */
+static int ehci_periodic_unlink_wait(struct usbh_bus *bus)
+{
+    volatile uint32_t timeout = 0;
+    uint32_t frindex;
+
+    if (EHCI_HCOR->usbsts & EHCI_USBSTS_HALTED) {
+        return 0;
+    }
+
+    frindex = EHCI_HCOR->frindex;
+    while (((EHCI_HCOR->frindex - frindex) & EHCI_FRINDEX_MASK) < 8) {
+        timeout++;
+        if (timeout > 200000) {
+            return -USB_ERR_TIMEOUT;
+        }
+    }
+    return 0;
+}
+
+static int ehci_ep_qh_close(struct usbh_bus *bus, struct ehci_qh_hw *qh)
+{
+    struct ehci_qtd_hw *qtd;
+    struct ehci_qtd_hw *next_qtd;
+    struct usbh_urb *urb;
+    bool remove_in_iaad;
+    size_t flags;
+    int ret;
+
+    flags = usb_osal_enter_critical_section();
+
+    remove_in_iaad = !ehci_qh_is_periodic(qh);
+
+    EHCI_HCOR->usbcmd &= ~(EHCI_USBCMD_PSEN | EHCI_USBCMD_ASEN);
+    if (remove_in_iaad) {
+        ehci_kill_qh(bus, &g_async_qh_head[bus->hcd.hcd_id], qh);
+    } else {
+        ehci_kill_qh(bus, &g_periodic_qh_head[bus->hcd.hcd_id], qh);
+    }
+    EHCI_HCOR->usbcmd |= (EHCI_USBCMD_PSEN | EHCI_USBCMD_ASEN);
+
+    /* give back pending urbs, dummy qtd is always the tail */
+    qtd = EHCI_ADDR2QTD(qh->first_qtd);
+    while (qtd) {
+        next_qtd = (qtd == qh->dummy_qtd) ? NULL : EHCI_ADDR2QTD(qtd->hw.next_qtd);
+
+        urb = qtd->urb;
+        if (urb && (urb->errorcode == -USB_ERR_BUSY)) {
+            urb->errorcode = -USB_ERR_SHUTDOWN;
+            urb->hcpriv = NULL;
+            if (urb->timeout) {
+                usb_osal_sem_give(qh->waitsem);
+            }
+        }
+        qtd->urb = NULL;
+        qtd = next_qtd;
+    }
+
+    usb_slist_remove(&g_ehci_hcd[bus->hcd.hcd_id].ep_qh_list, &qh->list);
+    qh->cached = false;
+    qh->hport = NULL;
+
+    if (remove_in_iaad) {
+        ret = ehci_async_unlink_wait(bus);
+    } else {
+        ret = ehci_periodic_unlink_wait(bus);
+    }
+    if (ret < 0) {
+        /* controller may still hold them, leave qh and qtds off the free lists for good */
+        usb_osal_leave_critical_section(flags);
+        USB_LOG_ERR("Timeout to unlink qh of ep 0x%02x, qh is leaked\r\n", qh->ep_addr);
+        return ret;
+    }
+
+    qtd = EHCI_ADDR2QTD(qh->first_qtd);
+    while (qtd) {
+        next_qtd = (qtd == qh->dummy_qtd) ? NULL : EHCI_ADDR2QTD(qtd->hw.next_qtd);
+        ehci_qtd_free(bus, qtd);
+        qtd = next_qtd;
+    }
+    qh->dummy_qtd = NULL;
+    qh->first_qtd = QTD_LIST_END;
+    ehci_qh_free(bus, qh);
+
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+
+static void ehci_ep_qh_reclaim(struct usbh_bus *bus)
+{
+    struct ehci_qh_hw *qh;
+    usb_slist_t *node;
+    usb_slist_t *next;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+
+    /* cached qhs stay linked after their urbs complete, a qh of a detached device
+     * holding only its dummy qtd is unlinked here so the pool can hand it out again
+     */
+    node = g_ehci_hcd[bus->hcd.hcd_id].ep_qh_list.next;
+    while (node) {
+        next = node->next;
+        qh = usb_slist_entry(node, struct ehci_qh_hw, list);
+        if (!qh->hport->connected && (EHCI_ADDR2QTD(qh->first_qtd) == qh->dummy_qtd)) {
+            ehci_ep_qh_close(bus, qh);
+        }
+        node = next;
+    }
+
+    usb_osal_leave_critical_section(flags);
+}
+
+static struct ehci_qh_hw *ehci_ep_qh_open(struct usbh_bus *bus, struct usbh_urb *urb, struct ehci_qh_hw *hint)
+{
+    struct ehci_qh_hw *qh;
+    struct ehci_qtd_hw *dummy_qtd;
+    uint8_t ep_type;
+    size_t flags;
+
+    qh = ehci_ep_qh_find(bus, urb, hint);
+    if (qh) {
+        if ((((qh->hw.epchar & QH_EPCHAR_DEVADDR_MASK) >> QH_EPCHAR_DEVADDR_SHIFT) == urb->hport->dev_addr) &&
+            (((qh->hw.epchar & QH_EPCHAR_MAXPKT_MASK) >> QH_EPCHAR_MAXPKT_SHIFT) == USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize))) {
+            return qh;
+        }
+        /* device was re-addressed or endpoint was reconfigured */
+        ehci_ep_qh_close(bus, qh);
+    }
+
+    qh = ehci_qh_alloc(bus);
+    if (qh == NULL) {
+        ehci_ep_qh_reclaim(bus);
+        qh = ehci_qh_alloc(bus);
+        if (qh == NULL) {
+            return NULL;
+        }
+    }
+
+    dummy_qtd = ehci_qtd_alloc(bus);
+    if (dummy_qtd == NULL) {
+        ehci_qh_free(bus, qh);
+        return NULL;
+    }
+
+    ep_type = USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes);
+
+    ehci_qh_fill(qh,
+                 urb->hport->dev_addr,
+                 urb->ep->bEndpointAddress,
+                 ep_type,
+                 USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize),
+                 (ep_type == USB_ENDPOINT_TYPE_INTERRUPT) ? (USB_GET_MULT(urb->ep->wMaxPacketSize) + 1) : 0,
+                 (ep_type == USB_ENDPOINT_TYPE_INTERRUPT) ? urb->ep->bInterval : 0,
+                 urb->hport->speed,
+                 urb->hport->parent->hub_addr,
+                 urb->hport->port);
+
+    if ((ep_type == USB_ENDPOINT_TYPE_INTERRUPT) && (ehci_periodic_alloc(bus, qh, urb) < 0)) {
+        ehci_qtd_free(bus, dummy_qtd);
+        ehci_qh_free(bus, qh);
+        urb->errorcode = -USB_ERR_RANGE;
+        return NULL;
+    }
+
+    /* qh overlay waits on the dummy qtd until the first urb is queued */
+    qh->hw.overlay.next_qtd = EHCI_PTR2ADDR(dummy_qtd);
+    qh->hw.overlay.alt_next_qtd = QTD_LIST_END;
+    qh->hw.overlay.token = urb->data_toggle ? QTD_TOKEN_TOGGLE : 0;
+
+    qh->first_qtd = EHCI_PTR2ADDR(dummy_qtd);
+    qh->dummy_qtd = dummy_qtd;
+    qh->hport = urb->hport;
+    qh->ep_addr = urb->ep->bEndpointAddress;
+    qh->cached = true;
+
+    flags = usb_osal_enter_critical_section();
+
+    usb_slist_add_head(&g_ehci_hcd[bus->hcd.hcd_id].ep_qh_list, &qh->list);
+
+    if (ep_type == USB_ENDPOINT_TYPE_INTERRUPT) {
+        ehci_periodic_link(bus, qh);
+        EHCI_HCOR->usbcmd |= EHCI_USBCMD_PSEN;
+    } else {
+        ehci_qh_add_head(&g_async_qh_head[bus->hcd.hcd_id], qh);
+        EHCI_HCOR->usbcmd |= EHCI_USBCMD_ASEN;
+    }
+
+    usb_osal_leave_critical_section(flags);
+    return qh;
+}
+
+static int ehci_ep_qh_submit(struct usbh_bus *bus, struct ehci_qh_hw *qh, struct usbh_urb *urb, uint8_t *buffer, uint32_t buflen)
+{
+    struct ehci_qtd_hw *qtd;
+    struct ehci_qtd_hw *first_qtd;
+    struct ehci_qtd_hw *next_qtd;
+    struct ehci_qtd_hw *dummy_qtd;
+    uint32_t first_token = 0;
+    uint32_t xfer_len;
+    uint32_t token;
+    size_t flags;
+
+    /* poll mode urb shares qh->waitsem, so it cannot wait behind other urbs */
+    if (urb->timeout && (EHCI_ADDR2QTD(qh->first_qtd) != qh->dummy_qtd)) {
+        return -USB_ERR_BUSY;
+    }
+
+    /* the current dummy carries the first qtd of this urb, a new dummy becomes the tail */
+    dummy_qtd = ehci_qtd_alloc(bus);
+    if (dummy_qtd == NULL) {
+        return -USB_ERR_NOMEM;
+    }
+
+    first_qtd = qh->dummy_qtd;
+    qtd = first_qtd;
+
+    while (1) {
+        if (buflen > 0x4000) {
+            xfer_len = 0x4000;
+            buflen -= 0x4000;
+        } else {
+            xfer_len = buflen;
+            buflen = 0;
+        }
+
+        if (urb->ep->bEndpointAddress & 0x80) {
+            token = QTD_TOKEN_PID_IN;
+        } else {
+            token = QTD_TOKEN_PID_OUT;
+        }
+
+        token |= QTD_TOKEN_STATUS_ACTIVE |
+                 ((uint32_t)EHCI_TUNE_CERR << QTD_TOKEN_CERR_SHIFT) |
+                 ((uint32_t)xfer_len << QTD_TOKEN_NBYTES_SHIFT);
+
+        if (buflen == 0) {
+            token |= QTD_TOKEN_IOC;
+        }
+
+        if (qtd == first_qtd) {
+            /* controller may be polling the first qtd, activate it at last */
+            first_token = token;
+            token = QTD_TOKEN_STATUS_HALTED;
+        }
+
+        ehci_qtd_fill(qtd, (uintptr_t)buffer, xfer_len, token);
+        qtd->urb = urb;
+        /* short packet skips the rest qtds of this urb */
+        qtd->hw.alt_next_qtd = EHCI_PTR2ADDR(dummy_qtd);
+        buffer += xfer_len;
+
+        if (buflen == 0) {
+            qtd->hw.next_qtd = EHCI_PTR2ADDR(dummy_qtd);
+            break;
+        }
+
+        next_qtd = ehci_qtd_alloc(bus);
+        if (next_qtd == NULL) {
+            while (qtd != first_qtd) {
+                next_qtd = EHCI_ADDR2QTD(first_qtd->hw.next_qtd);
+                first_qtd->hw.next_qtd = next_qtd->hw.next_qtd;
+                ehci_qtd_free(bus, next_qtd);
+                if (next_qtd == qtd) {
+                    break;
+                }
+            }
+            first_qtd->hw.next_qtd = QTD_LIST_END;
+            first_qtd->hw.alt_next_qtd = QTD_LIST_END;
+            first_qtd->urb = NULL;
+            ehci_qtd_free(bus, dummy_qtd);
+            return -USB_ERR_NOMEM;
+        }
+        qtd->hw.next_qtd = EHCI_PTR2ADDR(next_qtd);
+        qtd = next_qtd;
+    }
+
+#if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
+    qtd = first_qtd;
+    while (qtd != dummy_qtd) {
+        usb_dcache_clean((uintptr_t)&qtd->hw, CONFIG_USB_EHCI_ALIGN_SIZE);
+        qtd = EHCI_ADDR2QTD(qtd->hw.next_qtd);
+    }
+    usb_dcache_clean((uintptr_t)&dummy_qtd->hw, CONFIG_USB_EHCI_ALIGN_SIZE);
+#endif
+    usb_dcache_flush((uintptr_t)urb->transfer_buffer, USB_ALIGN_UP(urb->transfer_buffer_length, CONFIG_USB_ALIGN_SIZE));
+
+    flags = usb_osal_enter_critical_section();
+
+    urb->hcpriv = qh;
+    qh->dummy_qtd = dummy_qtd;
+
+    usb_ehci_wmb();
+    first_qtd->hw.token = first_token;
+#if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)&first_qtd->hw, CONFIG_USB_EHCI_ALIGN_SIZE);
+#endif
+
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+
+static void ehci_check_cached_qh(struct usbh_bus *bus, struct ehci_qh_hw *qh)
+{
+    struct ehci_qtd_hw *qtd;
+    struct ehci_qtd_hw *next_qtd;
+    struct usbh_urb *urb;
+    uint32_t token;
+    bool done;
+
+    while (qh->cached && (EHCI_ADDR2QTD(qh->first_qtd) != qh->dummy_qtd)) {
+        qtd = EHCI_ADDR2QTD(qh->first_qtd);
+        urb = qtd->urb;
+        token = 0;
+        done = true;
+
+        /* the head urb is done when all its qtds are retired, or one of them is short or failed */
+        while ((qtd != qh->dummy_qtd) && (qtd->urb == urb)) {
+#if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
+            usb_dcache_invalidate((uintptr_t)&qtd->hw, CONFIG_USB_EHCI_ALIGN_SIZE);
+#endif
+            token = qtd->hw.token;
+
+            if (token & QTD_TOKEN_STATUS_ACTIVE) {
+                done = false;
+                break;
+            }
+            if ((token & QTD_TOKEN_STATUS_ERRORS) || (token & QTD_TOKEN_NBYTES_MASK)) {
+                break;
+            }
+            qtd = EHCI_ADDR2QTD(qtd->hw.next_qtd);
+        }
+
+        if (!done) {
+            return;
+        }
+
+        /* retire all qtds of the head urb, including the skipped ones after a short packet */
+        qtd = EHCI_ADDR2QTD(qh->first_qtd);
+        while ((qtd != qh->dummy_qtd) && (qtd->urb == urb)) {
+            next_qtd = EHCI_ADDR2QTD(qtd->hw.next_qtd);
+            if ((qtd->hw.token & QTD_TOKEN_STATUS_ACTIVE) == 0) {
+                urb->actual_length += (qtd->length - ((qtd->hw.token & QTD_TOKEN_NBYTES_MASK) >> QTD_TOKEN_NBYTES_SHIFT));
+            }
+            ehci_qtd_free(bus, qtd);
+            qtd = next_qtd;
+        }
+        qh->first_qtd = EHCI_PTR2ADDR(qtd);
+
+        if ((token & QTD_TOKEN_STATUS_ERRORS) == 0) {
+            if (token & QTD_TOKEN_TOGGLE) {
+                urb->data_toggle = true;
+            } else {
+                urb->data_toggle = false;
+            }
+            urb->errorcode = 0;
+        } else {
+            if (token & QTD_TOKEN_STATUS_BABBLE) {
+                urb->errorcode = -USB_ERR_BABBLE;
+                urb->data_toggle = 0;
+            } else if (token & QTD_TOKEN_STATUS_HALTED) {
+                urb->errorcode = -USB_ERR_STALL;
+                urb->data_toggle = 0;
+            } else if (token & (QTD_TOKEN_STATUS_DBERR | QTD_TOKEN_STATUS_XACTERR)) {
+                urb->errorcode = -USB_ERR_IO;
+            }
+
+            /* qh is halted, restart it from the next urb with DATA0 */
+            qh->hw.overlay.next_qtd = qh->first_qtd;
+            qh->hw.overlay.alt_next_qtd = QTD_LIST_END;
+            usb_ehci_wmb();
+            qh->hw.overlay.token = 0;
+#if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
+            usb_dcache_clean((uintptr_t)&qh->hw, CONFIG_USB_EHCI_ALIGN_SIZE);
+#endif
+        }
+
+        ehci_ep_qh_giveback(qh, urb);
+    }
+}
+#endif
+
 static int usbh_reset_port(struct usbh_bus *bus, const uint8_t port)
 {
     volatile uint32_t timeout = 0;
@@ -777,6 +1473,9 @@ int usb_hc_init(struct usbh_bus *bus)
     memset(&g_ehci_hcd[bus->hcd.hcd_id], 0, sizeof(struct ehci_hcd));
     memset(ehci_qh_pool[bus->hcd.hcd_id], 0, sizeof(struct ehci_qh_hw) * CONFIG_USB_EHCI_QH_NUM);
     memset(ehci_qtd_pool[bus->hcd.hcd_id], 0, sizeof(struct ehci_qtd_hw) * CONFIG_USB_EHCI_QTD_NUM);
+#ifdef CONFIG_USB_EHCI_ISO
+    ehci_iso_init(bus);
+#endif
 
     for (uint8_t index = 0; index < CONFIG_USB_EHCI_QH_NUM; index++) {
         qh = &ehci_qh_pool[bus->hcd.hcd_id][index];
@@ -799,6 +1498,23 @@ int usb_hc_init(struct usbh_bus *bus)
         qh->waitsem = usb_osal_sem_create(0);
     }
 
+    /* build free lists, so alloc and free are O(1) */
+    for (uint32_t index = CONFIG_USB_EHCI_QH_NUM; index > 0; index--) {
+        qh = &ehci_qh_pool[bus->hcd.hcd_id][index - 1];
+        qh->free_next = g_ehci_hcd[bus->hcd.hcd_id].qh_free;
+        g_ehci_hcd[bus->hcd.hcd_id].qh_free = qh;
+    }
+
+    for (uint32_t index = CONFIG_USB_EHCI_QTD_NUM; index > 0; index--) {
+        qtd = &ehci_qtd_pool[bus->hcd.hcd_id][index - 1];
+        qtd->free_next = g_ehci_hcd[bus->hcd.hcd_id].qtd_free;
+        g_ehci_hcd[bus->hcd.hcd_id].qtd_free = qtd;
+    }
+
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+    usb_slist_init(&g_ehci_hcd[bus->hcd.hcd_id].ep_qh_list);
+#endif
+
     memset(&g_async_qh_head[bus->hcd.hcd_id], 0, sizeof(struct ehci_qh_hw));
     g_async_qh_head[bus->hcd.hcd_id].hw.hlp = QH_HLP_QH(&g_async_qh_head[bus->hcd.hcd_id]);
     g_async_qh_head[bus->hcd.hcd_id].hw.epchar = QH_EPCHAR_H;
@@ -817,9 +1533,7 @@ int usb_hc_init(struct usbh_bus *bus)
     g_periodic_qh_head[bus->hcd.hcd_id].hw.overlay.token = QTD_TOKEN_STATUS_HALTED;
     g_periodic_qh_head[bus->hcd.hcd_id].first_qtd = QTD_LIST_END;
 
-    for (uint32_t i = 0; i < CONFIG_USB_EHCI_FRAME_LIST_SIZE; i++) {
-        g_framelist[bus->hcd.hcd_id][i] = QH_HLP_QH(&g_periodic_qh_head[bus->hcd.hcd_id]);
-    }
+    ehci_periodic_tree_init(bus);
 
 #if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
     usb_dcache_clean((uintptr_t)&g_async_qh_head[bus->hcd.hcd_id].hw, CONFIG_USB_EHCI_ALIGN_SIZE);
@@ -1192,6 +1906,9 @@ int usbh_roothub_control(struct usbh_bus *bus, struct usb_setup_packet *setup, u
 int usbh_submit_urb(struct usbh_urb *urb)
 {
     struct ehci_qh_hw *qh = NULL;
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+    struct ehci_qh_hw *hint;
+#endif
     size_t flags;
     int ret = 0;
     struct usbh_hub *hub;
@@ -1233,6 +1950,10 @@ int usbh_submit_urb(struct usbh_urb *urb)
 
     flags = usb_osal_enter_critical_section();
 
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+    /* remember the endpoint qh used by this urb last time */
+    hint = (struct ehci_qh_hw *)urb->hcpriv;
+#endif
     urb->hcpriv = NULL;
     urb->errorcode = -USB_ERR_BUSY;
     urb->actual_length = 0;
@@ -1246,6 +1967,23 @@ int usbh_submit_urb(struct usbh_urb *urb)
                 return -USB_ERR_NOMEM;
             }
             break;
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+        case USB_ENDPOINT_TYPE_BULK:
+        case USB_ENDPOINT_TYPE_INTERRUPT:
+            qh = ehci_ep_qh_open(bus, urb, hint);
+            if (qh == NULL) {
+                if (urb->errorcode != -USB_ERR_RANGE) {
+                    urb->errorcode = -USB_ERR_NOMEM;
+                }
+                return urb->errorcode;
+            }
+            ret = ehci_ep_qh_submit(bus, qh, urb, urb->transfer_buffer, urb->transfer_buffer_length);
+            if (ret < 0) {
+                urb->errorcode = ret;
+                return ret;
+            }
+            break;
+#else
         case USB_ENDPOINT_TYPE_BULK:
             qh = ehci_bulk_urb_init(bus, urb, urb->transfer_buffer, urb->transfer_buffer_length);
             if (qh == NULL) {
@@ -1255,14 +1993,21 @@ int usbh_submit_urb(struct usbh_urb *urb)
         case USB_ENDPOINT_TYPE_INTERRUPT:
             qh = ehci_intr_urb_init(bus, urb, urb->transfer_buffer, urb->transfer_buffer_length);
             if (qh == NULL) {
-                return -USB_ERR_NOMEM;
+                if (urb->errorcode != -USB_ERR_RANGE) {
+                    urb->errorcode = -USB_ERR_NOMEM;
+                }
+                return urb->errorcode;
             }
             break;
+#endif
         case USB_ENDPOINT_TYPE_ISOCHRONOUS:
 #ifdef CONFIG_USB_EHCI_ISO
-            ret = ehci_iso_urb_init(bus, urb);
+            /* iso urb is always async, completion is reported through urb->complete */
+            return ehci_iso_urb_init(bus, urb);
+#else
+            urb->errorcode = -USB_ERR_NOTSUPP;
+            return -USB_ERR_NOTSUPP;
 #endif
-            break;
         default:
             break;
     }
@@ -1275,6 +2020,12 @@ int usbh_submit_urb(struct usbh_urb *urb)
         }
         urb->timeout = 0;
         ret = urb->errorcode;
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+        /* endpoint qh stays in schedule until the urb is killed */
+        if (qh->cached) {
+            return ret;
+        }
+#endif
         /* we can free qh when waitsem is done */
         ehci_qh_free(bus, qh);
     }
@@ -1304,6 +2055,20 @@ int usbh_kill_urb(struct usbh_urb *urb)
     }
 #endif
 
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+    if ((USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_BULK) ||
+        (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_INTERRUPT)) {
+        qh = (struct ehci_qh_hw *)urb->hcpriv;
+        /* qh may have been released and reused by another endpoint */
+        if (!qh->inuse || !qh->cached || (qh->hport != urb->hport) || (qh->ep_addr != urb->ep->bEndpointAddress)) {
+            urb->hcpriv = NULL;
+            return -USB_ERR_INVAL;
+        }
+        /* killing an urb releases the endpoint qh and all urbs queued on it */
+        return ehci_ep_qh_close(bus, qh);
+    }
+#endif
+
     flags = usb_osal_enter_critical_section();
 
     EHCI_HCOR->usbcmd &= ~(EHCI_USBCMD_PSEN | EHCI_USBCMD_ASEN);
@@ -1318,12 +2083,9 @@ int usbh_kill_urb(struct usbh_urb *urb)
             qh = EHCI_ADDR2QH(qh->hw.hlp);
         }
     } else if (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_INTERRUPT) {
-        qh = EHCI_ADDR2QH(g_periodic_qh_head[bus->hcd.hcd_id].hw.hlp);
-        while (qh) {
-            if (qh->urb == urb) {
-                ehci_kill_qh(bus, &g_periodic_qh_head[bus->hcd.hcd_id], qh);
-            }
-            qh = EHCI_ADDR2QH(qh->hw.hlp);
+        qh = (struct ehci_qh_hw *)urb->hcpriv;
+        if ((qh->urb == urb) && qh->period) {
+            ehci_kill_qh(bus, &g_periodic_qh_head[bus->hcd.hcd_id], qh);
         }
     } else {
 #ifdef CONFIG_USB_EHCI_ISO
@@ -1369,6 +2131,13 @@ static void ehci_scan_async_list(struct usbh_bus *bus)
 
     qh = EHCI_ADDR2QH(g_async_qh_head[bus->hcd.hcd_id].hw.hlp);
     while ((qh != &g_async_qh_head[bus->hcd.hcd_id]) && qh) {
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+        if (qh->cached) {
+            ehci_check_cached_qh(bus, qh);
+            qh = EHCI_ADDR2QH(qh->hw.hlp);
+            continue;
+        }
+#endif
         if (qh->urb) {
             ehci_check_qh(bus, &g_async_qh_head[bus->hcd.hcd_id], qh);
         }
@@ -1380,12 +2149,21 @@ static void ehci_scan_periodic_list(struct usbh_bus *bus)
 {
     struct ehci_qh_hw *qh;
 
-    qh = EHCI_ADDR2QH(g_periodic_qh_head[bus->hcd.hcd_id].hw.hlp);
-    while (qh) {
+    /* interrupt qhs are spread over the tree, find them in the pool */
+    for (uint8_t index = 0; index < CONFIG_USB_EHCI_QH_NUM; index++) {
+        qh = &ehci_qh_pool[bus->hcd.hcd_id][index];
+        if (!qh->inuse || !qh->period) {
+            continue;
+        }
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+        if (qh->cached) {
+            ehci_check_cached_qh(bus, qh);
+            continue;
+        }
+#endif
         if (qh->urb) {
             ehci_check_qh(bus, &g_periodic_qh_head[bus->hcd.hcd_id], qh);
         }
-        qh = EHCI_ADDR2QH(qh->hw.hlp);
     }
 }
 
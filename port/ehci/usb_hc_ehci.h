@@ -25,11 +25,29 @@
 #define CONFIG_USB_EHCI_QTD_NUM (CONFIG_USB_EHCI_QH_NUM * 3)
 #endif
 #ifndef CONFIG_USB_EHCI_ITD_NUM
-#define CONFIG_USB_EHCI_ITD_NUM 5
+#define CONFIG_USB_EHCI_ITD_NUM 16
 #endif
 #ifndef CONFIG_USB_EHCI_ISO_NUM
 #define CONFIG_USB_EHCI_ISO_NUM 4
 #endif
+/* Longest interrupt poll period in frames, longer bInterval is polled at this period */
+#ifndef CONFIG_USB_EHCI_PERIODIC_TREE_SIZE
+#define CONFIG_USB_EHCI_PERIODIC_TREE_SIZE 8
+#endif
+/* Transaction translators tracked for fs/ls interrupt bandwidth */
+#ifndef CONFIG_USB_EHCI_TT_NUM
+#define CONFIG_USB_EHCI_TT_NUM 4
+#endif
+
+#if (CONFIG_USB_EHCI_PERIODIC_TREE_SIZE < 2) || (CONFIG_USB_EHCI_PERIODIC_TREE_SIZE > 128) || \
+    (CONFIG_USB_EHCI_PERIODIC_TREE_SIZE & (CONFIG_USB_EHCI_PERIODIC_TREE_SIZE - 1))
+#error CONFIG_USB_EHCI_PERIODIC_TREE_SIZE must be a power of 2 between 2 and 128
+#endif
+
+/* urb queueing is built on the per-endpoint qh */
+#if defined(CONFIG_USBHOST_URB_QUEUE) && !defined(CONFIG_USB_EHCI_QH_CACHE)
+#define CONFIG_USB_EHCI_QH_CACHE
+#endif
 
 #if CONFIG_USB_ALIGN_SIZE <= 32
 #define CONFIG_USB_EHCI_ALIGN_SIZE 32
@@ -39,6 +57,11 @@
 #error "CONFIG_USB_ALIGN_SIZE must be 32 or 64"
 #endif
 
+#ifndef usb_ehci_wmb
+/* make qtd contents visible to the controller before setting the active bit */
+#define usb_ehci_wmb() __asm volatile("" ::: "memory")
+#endif
+
 #if CONFIG_USB_EHCI_QTD_NUM < 9
 #error CONFIG_USB_EHCI_QTD_NUM is too small, recommand CONFIG_USB_EHCI_QH_NUM * 3
 #endif
@@ -52,6 +75,7 @@ struct ehci_qtd_hw {
     struct usbh_urb *urb;
     uintptr_t bufaddr;
     uint32_t length;
+    struct ehci_qtd_hw *free_next;
 } __attribute__((aligned(CONFIG_USB_EHCI_ALIGN_SIZE)));
 
 struct ehci_qh_hw {
@@ -64,37 +88,92 @@ struct ehci_qh_hw {
     struct usbh_urb *urb;
     usb_osal_sem_t waitsem;
     uint8_t remove_in_iaad;
+    struct ehci_qh_hw *free_next;
+    uint8_t period;    /* poll period in frames, 0 when qh is not in periodic tree */
+    uint8_t phase;     /* first frame polled in the period */
+    uint8_t hs_us;     /* hs bus time reserved in every scheduled micro-frame */
+    uint16_t tt_us;    /* fs/ls bus time reserved on tt in every polled frame */
+    struct ehci_tt *tt;
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+    usb_slist_t list; /* node in opened endpoint list */
+    bool cached;      /* qh is owned by one endpoint and stays in schedule */
+    uint8_t ep_addr;
+    struct usbh_hubport *hport;
+    struct ehci_qtd_hw *dummy_qtd; /* inactive tail qtd, becomes the head of next urb */
+#endif
 } __attribute__((aligned(CONFIG_USB_EHCI_ALIGN_SIZE)));
 
 struct ehci_itd_hw {
-    struct ehci_itd hw;
+    union {
+        struct ehci_itd itd;   /* high speed endpoint */
+        struct ehci_sitd sitd; /* full speed endpoint behind tt */
+    } hw;
     struct usbh_urb *urb;
-    uint16_t start_frame;
-    uint8_t mf_unmask;
-    uint8_t mf_valid;
-    uint32_t pkt_idx[8];
-    bool dir_in;
+    uint16_t frame;      /* frame list slot this descriptor is linked in */
+    uint8_t mf_mask;     /* micro-frames used by itd, bit n for tscl[n] */
+    uint8_t page_num;    /* buffer pages used by itd */
+    bool last;           /* last descriptor of urb */
+    uint32_t pkt_idx[8]; /* iso packet index of each micro-frame, sitd uses pkt_idx[0] */
 } __attribute__((aligned(CONFIG_USB_EHCI_ALIGN_SIZE)));
 
 struct ehci_iso_hw {
-    struct ehci_itd_hw itd_pool[CONFIG_USB_EHCI_ITD_NUM];
-    uint32_t itd_num;
+    struct ehci_itd_hw itd_pool[CONFIG_USB_EHCI_ITD_NUM]; /* used as a ring in schedule order */
+    uint32_t itd_head;                                     /* oldest descriptor not released */
+    uint32_t itd_num;                                      /* descriptors not released */
+    uint32_t itd_done;                                     /* descriptors completed but their frame may still be cached */
+    uint32_t next_uframe;                                  /* where next urb continues the stream */
+    uint16_t interval;                                     /* in micro-frames */
+    uint16_t mps;
+    uint8_t mult;
+    uint8_t ep_addr;
+    bool split;
+    bool inuse;
+    struct usbh_hubport *hport;
+    uint8_t period;     /* frames between reserved slots, capped to the periodic tree */
+    uint8_t phase;      /* stream only starts in frames with (frame % period) == phase */
+    uint8_t uframe;     /* first micro-frame used in those frames */
+    uint16_t mask;      /* micro-frames reserved, s-mask in bits 0~7 and c-mask in bits 8~15 */
+    uint8_t hs_us;      /* hs bus time reserved in every micro-frame of mask */
+    uint16_t tt_us;     /* fs bus time reserved on tt in every reserved frame */
+    struct ehci_tt *tt;
+};
+
+/* Transaction translator of a hs hub (one per port on a multi tt hub) */
+struct ehci_tt {
+    struct usbh_hub *hub;
+    uint8_t port;
+    uint8_t users;
+    uint16_t frame_load[CONFIG_USB_EHCI_PERIODIC_TREE_SIZE]; /* fs us */
 };
 
 struct ehci_hcd {
-    bool ehci_iso_used[CONFIG_USB_EHCI_ISO_NUM];
     bool ppc;      /* Port Power Control */
     bool has_tt;   /* if use tt instead of Companion Controller */
     uint8_t n_cc;  /* Number of Companion Controller */
     uint8_t n_pcc; /* Number of ports supported per companion host controller */
     uint8_t n_ports;
     uint8_t hcor_offset;
+    struct ehci_qh_hw *qh_free;
+    struct ehci_qtd_hw *qtd_free;
+#ifdef CONFIG_USB_EHCI_QH_CACHE
+    usb_slist_t ep_qh_list;
+#endif
+    uint8_t uframe_load[CONFIG_USB_EHCI_PERIODIC_TREE_SIZE * 8]; /* hs us of interrupt qh and iso stream per micro-frame */
+    struct ehci_tt tt[CONFIG_USB_EHCI_TT_NUM];
 };
 
 extern struct ehci_hcd g_ehci_hcd[CONFIG_USBHOST_MAX_BUS];
 extern uint32_t g_framelist[CONFIG_USBHOST_MAX_BUS][USB_ALIGN_UP(CONFIG_USB_EHCI_FRAME_LIST_SIZE, 1024)];
 extern uint8_t usbh_get_port_speed(struct usbh_bus *bus, const uint8_t port);
 
+uint32_t ehci_bus_time(uint8_t speed, uint32_t bytes);
+struct ehci_tt *ehci_tt_get(struct usbh_bus *bus, struct usbh_hubport *hport);
+uint32_t ehci_periodic_reserve(struct usbh_bus *bus, struct ehci_tt *tt, uint32_t period, uint32_t mask, uint8_t step,
+                               uint32_t hs_us, uint32_t tt_us, uint32_t *phase);
+void ehci_periodic_release(struct usbh_bus *bus, struct ehci_tt *tt, uint32_t period, uint32_t phase, uint32_t mask,
+                           uint32_t hs_us, uint32_t tt_us);
+
+void ehci_iso_init(struct usbh_bus *bus);
 int ehci_iso_urb_init(struct usbh_bus *bus, struct usbh_urb *urb);
 void ehci_kill_iso_urb(struct usbh_bus *bus, struct usbh_urb *urb);
 void ehci_scan_isochronous_list(struct usbh_bus *bus);
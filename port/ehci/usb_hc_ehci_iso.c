@@ -0,0 +1,656 @@
+/*
+ * Copyright (c) 2024, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usb_hc_ehci.h"
+
+#ifdef CONFIG_USB_EHCI_ISO
+
+#undef USB_DBG_TAG
+#define USB_DBG_TAG "ehci_iso"
+#include "usb_log.h"
+
+#define EHCI_ISO_UFRAME_MASK ((CONFIG_USB_EHCI_FRAME_LIST_SIZE << 3) - 1)
+/* keep every stream within a small window of the frame list so that wrap around is unambiguous */
+#define EHCI_ISO_MAX_INTERVAL (32 << 3)
+
+#define EHCI_LINK_TYPE_MASK (0x6)
+#define EHCI_LINK_TYPE_ITD  (0x0)
+#define EHCI_LINK_TYPE_SITD (0x4)
+
+USB_NOCACHE_RAM_SECTION struct ehci_iso_hw ehci_iso_pool[CONFIG_USBHOST_MAX_BUS][CONFIG_USB_EHCI_ISO_NUM];
+
+static inline uint32_t ehci_iso_get_uframe(struct usbh_bus *bus)
+{
+    return EHCI_HCOR->frindex & EHCI_ISO_UFRAME_MASK;
+}
+
+/* how far ahead of frindex a descriptor must be linked, depends on isochronous scheduling threshold */
+static uint32_t ehci_iso_get_slop(struct usbh_bus *bus)
+{
+    uint32_t ist;
+
+    ist = (EHCI_HCCR->hccparams & EHCI_HCCPARAMS_IST_MASK) >> EHCI_HCCPARAMS_IST_SHIFT;
+    if (ist & 0x08) {
+        return ((ist & 0x07) << 3) + 16;
+    } else {
+        return (ist & 0x07) + 16;
+    }
+}
+
+static inline void ehci_iso_desc_clean(struct ehci_itd_hw *desc)
+{
+#if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)&desc->hw, USB_ALIGN_UP(sizeof(desc->hw), CONFIG_USB_EHCI_ALIGN_SIZE));
+#else
+    (void)desc;
+#endif
+}
+
+static inline void ehci_iso_desc_invalidate(struct ehci_itd_hw *desc)
+{
+#if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_invalidate((uintptr_t)&desc->hw, USB_ALIGN_UP(sizeof(desc->hw), CONFIG_USB_EHCI_ALIGN_SIZE));
+#else
+    (void)desc;
+#endif
+}
+
+static inline void ehci_iso_framelist_clean(uint32_t *link)
+{
+#if defined(CONFIG_USB_EHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)link & ~(CONFIG_USB_EHCI_ALIGN_SIZE - 1), CONFIG_USB_EHCI_ALIGN_SIZE);
+#else
+    (void)link;
+#endif
+}
+
+static void ehci_iso_link(struct usbh_bus *bus, struct ehci_iso_hw *iso, struct ehci_itd_hw *desc)
+{
+    uint32_t *link = &g_framelist[bus->hcd.hcd_id][desc->frame];
+
+    /* iso descriptors are inserted before the interrupt qhs of this frame */
+    desc->hw.itd.nlp = *link;
+    ehci_iso_desc_clean(desc);
+    usb_ehci_wmb();
+
+    if (iso->split) {
+        *link = SITD_NLP_SITD(desc);
+    } else {
+        *link = ITD_NLP_ITD(desc);
+    }
+    ehci_iso_framelist_clean(link);
+}
+
+static void ehci_iso_unlink(struct usbh_bus *bus, struct ehci_itd_hw *desc)
+{
+    uint32_t *link = &g_framelist[bus->hcd.hcd_id][desc->frame];
+    struct ehci_itd_hw *next;
+
+    /* itd and sitd both keep next link pointer in the first word */
+    while (!(*link & QH_HLP_END) &&
+           (((*link & EHCI_LINK_TYPE_MASK) == EHCI_LINK_TYPE_ITD) || ((*link & EHCI_LINK_TYPE_MASK) == EHCI_LINK_TYPE_SITD))) {
+        next = EHCI_ADDR2ITD(*link);
+        if (next == desc) {
+            *link = desc->hw.itd.nlp;
+            ehci_iso_framelist_clean(link);
+            return;
+        }
+        link = &next->hw.itd.nlp;
+    }
+}
+
+static struct ehci_iso_hw *ehci_iso_find(struct usbh_bus *bus, struct usbh_urb *urb)
+{
+    struct ehci_iso_hw *iso;
+
+    /* urb->hcpriv keeps the stream of its last submit, it must be in this bus's pool and still own the ep */
+    iso = (struct ehci_iso_hw *)urb->hcpriv;
+    if (iso && (iso >= &ehci_iso_pool[bus->hcd.hcd_id][0]) && (iso < &ehci_iso_pool[bus->hcd.hcd_id][CONFIG_USB_EHCI_ISO_NUM]) &&
+        iso->inuse && (iso->hport == urb->hport) && (iso->ep_addr == urb->ep->bEndpointAddress)) {
+        return iso;
+    }
+
+    for (uint8_t i = 0; i < CONFIG_USB_EHCI_ISO_NUM; i++) {
+        iso = &ehci_iso_pool[bus->hcd.hcd_id][i];
+        if (iso->inuse && (iso->hport == urb->hport) && (iso->ep_addr == urb->ep->bEndpointAddress)) {
+            return iso;
+        }
+    }
+    return NULL;
+}
+
+/* Reserve micro-frames of the stream in the periodic budget, shared with interrupt qhs */
+static int ehci_iso_reserve(struct usbh_bus *bus, struct ehci_iso_hw *iso)
+{
+    uint32_t period;
+    uint32_t phase = 0;
+    uint32_t mask;
+    uint8_t step;
+
+    iso->tt = NULL;
+    iso->tt_us = 0;
+    if (iso->split) {
+        /* sitd always starts at micro-frame 0, see ehci_sitd_fill() */
+        period = iso->interval >> 3;
+        step = 1;
+        iso->hs_us = ehci_bus_time(USB_SPEED_HIGH, MIN(iso->mps, 188));
+        iso->tt_us = ehci_bus_time(USB_SPEED_FULL, iso->mps);
+        if (iso->ep_addr & 0x80) {
+            mask = QH_EPCAPS_SSMASK(0x01) | QH_EPCAPS_SCMASK(0xfc);
+        } else {
+            mask = QH_EPCAPS_SSMASK((1 << ((iso->mps + 187) / 188)) - 1);
+        }
+        iso->tt = ehci_tt_get(bus, iso->hport);
+        if (iso->tt == NULL) {
+            USB_LOG_WRN("No free tt slot, fs bandwidth is not checked\r\n");
+        }
+    } else {
+        period = (iso->interval < 8) ? 1 : (iso->interval >> 3);
+        step = (iso->interval < 8) ? iso->interval : 8;
+        iso->hs_us = ehci_bus_time(USB_SPEED_HIGH, iso->mps) * iso->mult;
+        mask = 0;
+        for (uint8_t i = 0; i < 8; i += step) {
+            mask |= QH_EPCAPS_SSMASK(1 << i);
+        }
+    }
+
+    if (period > CONFIG_USB_EHCI_PERIODIC_TREE_SIZE) {
+        period = CONFIG_USB_EHCI_PERIODIC_TREE_SIZE;
+    }
+
+    mask = ehci_periodic_reserve(bus, iso->tt, period, mask, step, iso->hs_us, iso->tt_us, &phase);
+    if (mask == 0) {
+        USB_LOG_ERR("Periodic bandwidth is not enough for iso ep 0x%02x\r\n", iso->ep_addr);
+        return -USB_ERR_RANGE;
+    }
+
+    iso->period = period;
+    iso->phase = phase;
+    iso->mask = mask;
+    for (iso->uframe = 0; !(mask & (1 << iso->uframe)); iso->uframe++) {
+    }
+    return 0;
+}
+
+/* Give back the bandwidth and the pool slot of a stream */
+static void ehci_iso_close(struct usbh_bus *bus, struct ehci_iso_hw *iso)
+{
+    ehci_periodic_release(bus, iso->tt, iso->period, iso->phase, iso->mask, iso->hs_us, iso->tt_us);
+    iso->tt = NULL;
+    iso->hport = NULL;
+    iso->inuse = false;
+}
+
+static struct ehci_iso_hw *ehci_iso_alloc(struct usbh_bus *bus, struct usbh_urb *urb, int *ret)
+{
+    struct ehci_iso_hw *iso = NULL;
+    uint16_t interval;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    for (uint8_t i = 0; i < CONFIG_USB_EHCI_ISO_NUM; i++) {
+        /* a stream of a detached device with every itd retired is closed, its bandwidth goes back too */
+        if (ehci_iso_pool[bus->hcd.hcd_id][i].inuse && !ehci_iso_pool[bus->hcd.hcd_id][i].hport->connected &&
+            (ehci_iso_pool[bus->hcd.hcd_id][i].itd_num == ehci_iso_pool[bus->hcd.hcd_id][i].itd_done)) {
+            ehci_iso_close(bus, &ehci_iso_pool[bus->hcd.hcd_id][i]);
+        }
+        if (!ehci_iso_pool[bus->hcd.hcd_id][i].inuse) {
+            iso = &ehci_iso_pool[bus->hcd.hcd_id][i];
+            iso->inuse = true;
+            break;
+        }
+    }
+    usb_osal_leave_critical_section(flags);
+
+    if (iso == NULL) {
+        *ret = -USB_ERR_NOMEM;
+        return NULL;
+    }
+
+    iso->itd_head = 0;
+    iso->itd_num = 0;
+    iso->itd_done = 0;
+    iso->next_uframe = 0;
+    iso->hport = urb->hport;
+    iso->ep_addr = urb->ep->bEndpointAddress;
+    iso->mps = USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize);
+    iso->mult = USB_GET_MULT(urb->ep->wMaxPacketSize) + 1;
+    iso->split = (urb->hport->speed != USB_SPEED_HIGH) ? true : false;
+
+    /* bInterval of iso endpoint is 2^(bInterval - 1) in micro-frames for hs, in frames for fs */
+    interval = 1 << (MIN(MAX(urb->ep->bInterval, 1), 16) - 1);
+    if (iso->split) {
+        interval = (interval > (EHCI_ISO_MAX_INTERVAL >> 3)) ? EHCI_ISO_MAX_INTERVAL : (interval << 3);
+    } else {
+        interval = MIN(interval, EHCI_ISO_MAX_INTERVAL);
+    }
+    iso->interval = interval;
+
+    for (uint32_t i = 0; i < CONFIG_USB_EHCI_ITD_NUM; i++) {
+        memset(&iso->itd_pool[i], 0, sizeof(struct ehci_itd_hw));
+    }
+
+    *ret = ehci_iso_reserve(bus, iso);
+    if (*ret < 0) {
+        iso->hport = NULL;
+        iso->inuse = false;
+        return NULL;
+    }
+    return iso;
+}
+
+/* descriptors completed in current frame may still be cached by controller, so release them one frame later */
+static void ehci_iso_release(struct usbh_bus *bus, struct ehci_iso_hw *iso, uint32_t uframe)
+{
+    struct ehci_itd_hw *desc;
+
+    while (iso->itd_done) {
+        desc = &iso->itd_pool[iso->itd_head];
+        if (((uframe - ((uint32_t)desc->frame << 3)) & EHCI_ISO_UFRAME_MASK) < 16) {
+            break;
+        }
+        desc->urb = NULL;
+        iso->itd_head = (iso->itd_head + 1) % CONFIG_USB_EHCI_ITD_NUM;
+        iso->itd_num--;
+        iso->itd_done--;
+    }
+}
+
+static int ehci_itd_page(struct ehci_itd_hw *itd, uintptr_t addr, uint32_t len)
+{
+    uint32_t first_page = (uint32_t)addr & ~0xfff;
+    uint32_t last_page = (uint32_t)(addr + (len ? (len - 1) : 0)) & ~0xfff;
+    int pg;
+
+    if (itd->page_num && ((itd->hw.itd.bpl[itd->page_num - 1] & ~0xfff) == first_page)) {
+        pg = itd->page_num - 1;
+    } else {
+        if (itd->page_num >= 7) {
+            return -USB_ERR_RANGE;
+        }
+        pg = itd->page_num++;
+        itd->hw.itd.bpl[pg] |= first_page;
+    }
+
+    /* transaction crossing a page boundary continues on next page pointer */
+    if (last_page != first_page) {
+        if (itd->page_num >= 7) {
+            return -USB_ERR_RANGE;
+        }
+        itd->hw.itd.bpl[itd->page_num++] |= last_page;
+    }
+    return pg;
+}
+
+static void ehci_itd_init(struct ehci_iso_hw *iso, struct ehci_itd_hw *itd, struct usbh_urb *urb, uint16_t frame)
+{
+    memset(&itd->hw, 0, sizeof(itd->hw));
+
+    itd->urb = urb;
+    itd->frame = frame;
+    itd->mf_mask = 0;
+    itd->page_num = 0;
+    itd->last = false;
+
+    itd->hw.itd.nlp = QH_HLP_END;
+    itd->hw.itd.bpl[0] = ((uint32_t)(iso->ep_addr & 0x0f) << ITD_BUFPTR0_ENDPT_SHIFT) |
+                         ((uint32_t)urb->hport->dev_addr << ITD_BUFPTR0_DEVADDR_SHIFT);
+    itd->hw.itd.bpl[1] = ((uint32_t)iso->mps << ITD_BUFPTR1_MAXPKT_SHIFT) |
+                         ((iso->ep_addr & 0x80) ? ITD_BUFPTR1_DIRIN : ITD_BUFPTR1_DIROUT);
+    itd->hw.itd.bpl[2] = ((uint32_t)iso->mult << ITD_BUFPTR2_MULTI_SHIFT);
+}
+
+static int ehci_itd_fill(struct ehci_itd_hw *itd, uint8_t mf, uint32_t pkt_idx, struct usbh_iso_frame_packet *iso_packet)
+{
+    uintptr_t addr = (uintptr_t)iso_packet->transfer_buffer;
+    int pg;
+
+    pg = ehci_itd_page(itd, addr, iso_packet->transfer_buffer_length);
+    if (pg < 0) {
+        return pg;
+    }
+
+    itd->hw.itd.tscl[mf] = ITD_TSCL_STATUS_ACTIVE |
+                           ((iso_packet->transfer_buffer_length << ITD_TSCL_LENGTH_SHIFT) & ITD_TSCL_LENGTH_MASK) |
+                           ((uint32_t)pg << ITD_TSCL_PG_SHIFT) |
+                           ((uint32_t)addr & ITD_TSCL_XOFFS_MASK);
+    itd->mf_mask |= (1 << mf);
+    itd->pkt_idx[mf] = pkt_idx;
+    return 0;
+}
+
+static void ehci_sitd_fill(struct ehci_iso_hw *iso, struct ehci_itd_hw *sitd, struct usbh_urb *urb, uint16_t frame, uint32_t pkt_idx)
+{
+    struct usbh_iso_frame_packet *iso_packet = &urb->iso_packet[pkt_idx];
+    uintptr_t addr = (uintptr_t)iso_packet->transfer_buffer;
+    uint32_t len = iso_packet->transfer_buffer_length;
+    uint32_t tcount;
+
+    memset(&sitd->hw, 0, sizeof(sitd->hw));
+
+    sitd->urb = urb;
+    sitd->frame = frame;
+    sitd->mf_mask = 0;
+    sitd->page_num = 0;
+    sitd->last = false;
+    sitd->pkt_idx[0] = pkt_idx;
+
+    sitd->hw.sitd.nlp = QH_HLP_END;
+    sitd->hw.sitd.epchar = ((uint32_t)urb->hport->dev_addr << SITD_EPCHAR_DEVADDR_SHIFT) |
+                           ((uint32_t)(iso->ep_addr & 0x0f) << SITD_EPCHAR_ENDPT_SHIFT) |
+                           ((uint32_t)urb->hport->parent->hub_addr << SITD_EPCHAR_HUBADDR_SHIFT) |
+                           ((uint32_t)urb->hport->port << SITD_EPCHAR_PORT_SHIFT) |
+                           ((iso->ep_addr & 0x80) ? SITD_EPCHAR_DIRIN : SITD_EPCHAR_DIROUT);
+
+    /* one start split carries at most 188 bytes of full speed payload */
+    tcount = (len + 187) / 188;
+    if (tcount == 0) {
+        tcount = 1;
+    }
+
+    if (iso->ep_addr & 0x80) {
+        /* start split in uframe 0, complete splits in uframe 2~7 */
+        sitd->hw.sitd.mfsc = SITD_MFSC_SSMASK(0x01) | SITD_MFSC_SCMASK(0xfc);
+        sitd->hw.sitd.bpl[1] = ((uint32_t)addr + 0x1000) & ~0xfff;
+    } else {
+        sitd->hw.sitd.mfsc = SITD_MFSC_SSMASK((1 << tcount) - 1);
+        sitd->hw.sitd.bpl[1] = (((uint32_t)addr + 0x1000) & ~0xfff) |
+                               ((tcount == 1) ? SITD_BPL1_TP_ALL : SITD_BPL1_TP_BEGIN) |
+                               (tcount << SITD_BPL1_TCOUNT_SHIFT);
+    }
+
+    sitd->hw.sitd.tsc = SITD_TSC_STATUS_ACTIVE | ((len << SITD_TSC_NBYTES_SHIFT) & SITD_TSC_NBYTES_MASK);
+    sitd->hw.sitd.bpl[0] = (uint32_t)addr;
+    sitd->hw.sitd.blp = SITD_BLP_END;
+}
+
+static bool ehci_iso_desc_is_done(struct ehci_iso_hw *iso, struct ehci_itd_hw *desc, uint32_t uframe)
+{
+    uint32_t frame_end;
+
+    ehci_iso_desc_invalidate(desc);
+
+    if (iso->split) {
+        if ((desc->hw.sitd.tsc & SITD_TSC_STATUS_ACTIVE) == 0) {
+            return true;
+        }
+    } else {
+        bool active = false;
+
+        for (uint8_t mf = 0; mf < 8; mf++) {
+            if ((desc->mf_mask & (1 << mf)) && (desc->hw.itd.tscl[mf] & ITD_TSCL_STATUS_ACTIVE)) {
+                active = true;
+                break;
+            }
+        }
+        if (!active) {
+            return true;
+        }
+    }
+
+    /* frame is over and some transactions are never executed, linked too late or missed */
+    frame_end = (((uint32_t)desc->frame + 2) << 3) & EHCI_ISO_UFRAME_MASK;
+    return (((uframe - frame_end) & EHCI_ISO_UFRAME_MASK) < ((EHCI_ISO_UFRAME_MASK + 1) >> 1)) ? true : false;
+}
+
+static void ehci_iso_desc_complete(struct ehci_iso_hw *iso, struct ehci_itd_hw *desc)
+{
+    struct usbh_iso_frame_packet *iso_packet;
+    struct usbh_urb *urb = desc->urb;
+    uint32_t status;
+
+    if (iso->split) {
+        iso_packet = &urb->iso_packet[desc->pkt_idx[0]];
+        status = desc->hw.sitd.tsc;
+
+        if (status & SITD_TSC_STATUS_ACTIVE) {
+            iso_packet->actual_length = 0;
+            iso_packet->errorcode = -USB_ERR_TIMEOUT;
+        } else {
+            iso_packet->actual_length = iso_packet->transfer_buffer_length - ((status & SITD_TSC_NBYTES_MASK) >> SITD_TSC_NBYTES_SHIFT);
+            if (status & SITD_TSC_STATUS_BABBLE) {
+                iso_packet->errorcode = -USB_ERR_BABBLE;
+            } else if (status & (SITD_TSC_STATUS_ERR | SITD_TSC_STATUS_XACTERR | SITD_TSC_STATUS_DBERR | SITD_TSC_STATUS_MMF)) {
+                iso_packet->errorcode = -USB_ERR_IO;
+            } else {
+                iso_packet->errorcode = 0;
+            }
+        }
+        urb->actual_length += iso_packet->actual_length;
+        return;
+    }
+
+    for (uint8_t mf = 0; mf < 8; mf++) {
+        if ((desc->mf_mask & (1 << mf)) == 0) {
+            continue;
+        }
+
+        iso_packet = &urb->iso_packet[desc->pkt_idx[mf]];
+        status = desc->hw.itd.tscl[mf];
+
+        if (status & ITD_TSCL_STATUS_ACTIVE) {
+            iso_packet->actual_length = 0;
+            iso_packet->errorcode = -USB_ERR_TIMEOUT;
+        } else {
+            /* controller writes back received length for in, keeps it for out */
+            iso_packet->actual_length = (status & ITD_TSCL_LENGTH_MASK) >> ITD_TSCL_LENGTH_SHIFT;
+            if (status & ITD_TSCL_STATUS_BABBLE) {
+                iso_packet->errorcode = -USB_ERR_BABBLE;
+            } else if (status & (ITD_TSCL_STATUS_XACTERR | ITD_TSCL_STATUS_DBERROR)) {
+                iso_packet->errorcode = -USB_ERR_IO;
+            } else {
+                iso_packet->errorcode = 0;
+            }
+        }
+        urb->actual_length += iso_packet->actual_length;
+    }
+}
+
+static void ehci_iso_urb_giveback(struct ehci_iso_hw *iso, struct usbh_urb *urb)
+{
+    if (iso->ep_addr & 0x80) {
+        for (uint32_t i = 0; i < urb->num_of_iso_packets; i++) {
+            usb_dcache_invalidate((uintptr_t)urb->iso_packet[i].transfer_buffer, USB_ALIGN_UP(urb->iso_packet[i].actual_length, CONFIG_USB_ALIGN_SIZE));
+        }
+    }
+
+    /* per packet status is in iso_packet[], urb itself always succeeds */
+    urb->errorcode = 0;
+
+    if (urb->complete) {
+        urb->complete(urb->arg, urb->actual_length);
+    }
+}
+
+void ehci_iso_init(struct usbh_bus *bus)
+{
+    memset(ehci_iso_pool[bus->hcd.hcd_id], 0, sizeof(struct ehci_iso_hw) * CONFIG_USB_EHCI_ISO_NUM);
+}
+
+int ehci_iso_urb_init(struct usbh_bus *bus, struct usbh_urb *urb)
+{
+    struct ehci_iso_hw *iso;
+    struct ehci_itd_hw *desc = NULL;
+    uint32_t first_idx;
+    uint32_t desc_num = 0;
+    uint32_t start_uframe;
+    uint32_t uframe;
+    uint32_t now;
+    uint32_t slop;
+    uint16_t frame;
+    uint8_t last_mf = 0;
+    size_t flags;
+    int ret;
+
+    if ((urb->num_of_iso_packets == 0) || urb->timeout) {
+        /* iso urb is always async, completion is reported through urb->complete */
+        ret = -USB_ERR_INVAL;
+        goto errout;
+    }
+
+    iso = ehci_iso_find(bus, urb);
+    if (iso == NULL) {
+        iso = ehci_iso_alloc(bus, urb, &ret);
+        if (iso == NULL) {
+            goto errout;
+        }
+    }
+
+    for (uint32_t i = 0; i < urb->num_of_iso_packets; i++) {
+        if (urb->iso_packet[i].transfer_buffer_length > (iso->split ? MIN(iso->mps, 1023) : (uint32_t)(iso->mps * iso->mult))) {
+            ret = -USB_ERR_RANGE;
+            goto errout;
+        }
+        urb->iso_packet[i].actual_length = 0;
+        urb->iso_packet[i].errorcode = -USB_ERR_BUSY;
+        usb_dcache_flush((uintptr_t)urb->iso_packet[i].transfer_buffer, USB_ALIGN_UP(urb->iso_packet[i].transfer_buffer_length, CONFIG_USB_ALIGN_SIZE));
+    }
+
+    now = ehci_iso_get_uframe(bus);
+    slop = ehci_iso_get_slop(bus);
+
+    flags = usb_osal_enter_critical_section();
+    ehci_iso_release(bus, iso, now);
+    first_idx = (iso->itd_head + iso->itd_num) % CONFIG_USB_EHCI_ITD_NUM;
+
+    /* continue right after the previous urb, restart after scheduling threshold if stream is idle or late */
+    if ((iso->itd_num == iso->itd_done) ||
+        (((iso->next_uframe - now) & EHCI_ISO_UFRAME_MASK) < slop) ||
+        (((iso->next_uframe - now) & EHCI_ISO_UFRAME_MASK) >= ((EHCI_ISO_UFRAME_MASK + 1) >> 1))) {
+        /* restart only in the frames and micro-frame reserved by ehci_iso_reserve() */
+        start_uframe = (now + slop + 7) >> 3;
+        start_uframe += (iso->phase - start_uframe) & (iso->period - 1);
+        start_uframe = ((start_uframe << 3) + iso->uframe) & EHCI_ISO_UFRAME_MASK;
+    } else {
+        start_uframe = iso->next_uframe;
+    }
+    usb_osal_leave_critical_section(flags);
+
+    uframe = start_uframe;
+    for (uint32_t i = 0; i < urb->num_of_iso_packets; i++) {
+        frame = (uframe >> 3) & (CONFIG_USB_EHCI_FRAME_LIST_SIZE - 1);
+
+        if ((desc == NULL) || iso->split || (desc->frame != frame)) {
+            if ((iso->itd_num + desc_num) >= CONFIG_USB_EHCI_ITD_NUM) {
+                ret = -USB_ERR_NOMEM;
+                goto errout;
+            }
+            desc = &iso->itd_pool[(first_idx + desc_num) % CONFIG_USB_EHCI_ITD_NUM];
+            desc_num++;
+
+            if (iso->split) {
+                ehci_sitd_fill(iso, desc, urb, frame, i);
+            } else {
+                ehci_itd_init(iso, desc, urb, frame);
+            }
+        }
+
+        if (!iso->split) {
+            last_mf = uframe & 0x07;
+            ret = ehci_itd_fill(desc, last_mf, i, &urb->iso_packet[i]);
+            if (ret < 0) {
+                USB_LOG_ERR("iso packets of one frame use more than 7 pages\r\n");
+                goto errout;
+            }
+        }
+
+        uframe = (uframe + iso->interval) & EHCI_ISO_UFRAME_MASK;
+    }
+
+    desc->last = true;
+    if (iso->split) {
+        desc->hw.sitd.tsc |= SITD_TSC_IOC;
+    } else {
+        desc->hw.itd.tscl[last_mf] |= ITD_TSCL_IOC;
+    }
+
+    urb->start_frame = start_uframe >> 3;
+    urb->actual_length = 0;
+
+    flags = usb_osal_enter_critical_section();
+
+    urb->hcpriv = iso;
+    for (uint32_t i = 0; i < desc_num; i++) {
+        ehci_iso_link(bus, iso, &iso->itd_pool[(first_idx + i) % CONFIG_USB_EHCI_ITD_NUM]);
+    }
+    iso->itd_num += desc_num;
+    iso->next_uframe = uframe;
+
+    usb_osal_leave_critical_section(flags);
+    return 0;
+
+errout:
+    urb->errorcode = ret;
+    return ret;
+}
+
+void ehci_kill_iso_urb(struct usbh_bus *bus, struct usbh_urb *urb)
+{
+    struct ehci_iso_hw *iso;
+    struct ehci_itd_hw *desc;
+    uint32_t idx;
+
+    iso = ehci_iso_find(bus, urb);
+    if (iso == NULL) {
+        urb->hcpriv = NULL;
+        return;
+    }
+
+    /* killing an urb closes the stream and cancels all urbs queued on it */
+    for (uint32_t i = iso->itd_done; i < iso->itd_num; i++) {
+        idx = (iso->itd_head + i) % CONFIG_USB_EHCI_ITD_NUM;
+        desc = &iso->itd_pool[idx];
+
+        ehci_iso_unlink(bus, desc);
+        if (desc->urb && (desc->urb->errorcode == -USB_ERR_BUSY)) {
+            desc->urb->errorcode = -USB_ERR_SHUTDOWN;
+            desc->urb->hcpriv = NULL;
+        }
+        desc->urb = NULL;
+    }
+
+    urb->errorcode = -USB_ERR_SHUTDOWN;
+    urb->hcpriv = NULL;
+    iso->itd_num = 0;
+    iso->itd_done = 0;
+    ehci_iso_close(bus, iso);
+}
+
+void ehci_scan_isochronous_list(struct usbh_bus *bus)
+{
+    struct ehci_iso_hw *iso;
+    struct ehci_itd_hw *desc;
+    struct usbh_urb *urb;
+    uint32_t uframe;
+
+    uframe = ehci_iso_get_uframe(bus);
+
+    for (uint8_t i = 0; i < CONFIG_USB_EHCI_ISO_NUM; i++) {
+        iso = &ehci_iso_pool[bus->hcd.hcd_id][i];
+        if (!iso->inuse) {
+            continue;
+        }
+
+        ehci_iso_release(bus, iso, uframe);
+
+        /* descriptors retire in schedule order, so urbs complete in submit order */
+        while (iso->inuse && (iso->itd_done < iso->itd_num)) {
+            desc = &iso->itd_pool[(iso->itd_head + iso->itd_done) % CONFIG_USB_EHCI_ITD_NUM];
+            if (!ehci_iso_desc_is_done(iso, desc, uframe)) {
+                break;
+            }
+
+            ehci_iso_unlink(bus, desc);
+            ehci_iso_desc_complete(iso, desc);
+            iso->itd_done++;
+
+            urb = desc->urb;
+            if (desc->last) {
+                ehci_iso_urb_giveback(iso, urb);
+            }
+        }
+    }
+}
+#endif
@@ -17,9 +17,11 @@ struct kinetis_ep_state {
     uint8_t ep_type;    /* Endpoint type */
     uint8_t ep_stalled; /* Endpoint stall flag */
     uint8_t ep_enable;  /* Endpoint enable */
-    bool ep_odd;        /* Endpoint odd */
+    bool ep_odd;        /* Next bd to arm, even and odd bds are used in turn */
+    uint8_t bd_armed;   /* Bds handed to SIE, bit0 even, bit1 odd */
     uint8_t *xfer_buf;
     uint32_t xfer_len;
+    uint32_t queued_len; /* Bytes already handed to bds */
     uint32_t actual_xfer_len;
 };
 
@@ -33,35 +35,67 @@ struct kinetis_udc {
 USB_NOCACHE_RAM_SECTION __attribute__((aligned(512))) kinetis_bd_table_t g_kinetis_bdt[CONFIG_USBDEV_MAX_BUS];
 USB_NOCACHE_RAM_SECTION __attribute__((aligned(32))) uint8_t setup_packet[CONFIG_USBDEV_MAX_BUS][8];
 
-static int kinetis_start_transfer(uint8_t busid, uint8_t ep, uint8_t *buffer, uint16_t buflen)
+static inline struct kinetis_ep_state *kinetis_get_ep_state(uint8_t busid, uint8_t ep)
 {
-    uint8_t ep_idx = USB_EP_GET_IDX(ep);
-    uint8_t dir;
-    uint8_t odd;
-    uint16_t ep_mps;
-    kinetis_bd_t *bd;
-    kinetis_bd_t *next;
-
     if (USB_EP_DIR_IS_OUT(ep)) {
-        dir = 0;
-        odd = g_kinetis_udc[busid].out_ep[ep_idx].ep_odd;
-        ep_mps = g_kinetis_udc[busid].out_ep[ep_idx].ep_mps;
+        return &g_kinetis_udc[busid].out_ep[USB_EP_GET_IDX(ep)];
     } else {
-        dir = 1;
-        odd = g_kinetis_udc[busid].in_ep[ep_idx].ep_odd;
-        ep_mps = g_kinetis_udc[busid].in_ep[ep_idx].ep_mps;
+        return &g_kinetis_udc[busid].in_ep[USB_EP_GET_IDX(ep)];
     }
+}
 
-    bd = &g_kinetis_bdt[busid].table[ep_idx][dir][odd];
+/* Fill the next bd with one packet of the transfer, own bit is left to the caller */
+static kinetis_bd_t *kinetis_prepare_bd(uint8_t busid, uint8_t ep)
+{
+    struct kinetis_ep_state *ep_state = kinetis_get_ep_state(busid, ep);
+    uint8_t odd = ep_state->ep_odd;
+    kinetis_bd_t *bd;
+
+    if (ep_state->bd_armed & (1 << odd)) {
+        return NULL;
+    }
+
+    bd = &g_kinetis_bdt[busid].table[USB_EP_GET_IDX(ep)][USB_EP_DIR_IS_IN(ep) ? 1 : 0][odd];
+    bd->bc = MIN(ep_state->xfer_len - ep_state->queued_len, ep_state->ep_mps);
+    bd->addr = (uint32_t)(ep_state->xfer_buf + ep_state->queued_len);
 
-    if (bd->own) {
+    ep_state->queued_len += bd->bc;
+    ep_state->bd_armed |= (1 << odd);
+    ep_state->ep_odd = odd ^ 1;
+    return bd;
+}
+
+/* Arm the first packet, and for multi-packet in transfers the second one on the other bd
+ * so SIE always has the next packet ready. Out and ep0 use one bd at a time, as the host
+ * may end an out transfer with a short packet and the next packet is not ours.
+ */
+static int kinetis_start_transfer(uint8_t busid, uint8_t ep, uint8_t *buffer, uint32_t buflen)
+{
+    struct kinetis_ep_state *ep_state = kinetis_get_ep_state(busid, ep);
+    kinetis_bd_t *bd;
+    kinetis_bd_t *next = NULL;
+
+    bd = &g_kinetis_bdt[busid].table[USB_EP_GET_IDX(ep)][USB_EP_DIR_IS_IN(ep) ? 1 : 0][ep_state->ep_odd];
+    if (ep_state->bd_armed || bd->own) {
         USB_LOG_INFO("ep%02x is busy\r\n", ep);
         return -1;
     }
 
-    bd->bc = buflen >= ep_mps ? ep_mps : buflen;
-    bd->addr = (uint32_t)buffer;
+    ep_state->xfer_buf = buffer;
+    ep_state->xfer_len = buflen;
+    ep_state->queued_len = 0;
+    ep_state->actual_xfer_len = 0;
+
+    bd = kinetis_prepare_bd(busid, ep);
+    if ((USB_EP_GET_IDX(ep) != 0) && USB_EP_DIR_IS_IN(ep) && (ep_state->queued_len < ep_state->xfer_len)) {
+        next = kinetis_prepare_bd(busid, ep);
+    }
+
+    /* SIE takes the bds in order, interrupt may arm the first bd again before we get to the second */
     bd->own = 1;
+    if (next) {
+        next->own = 1;
+    }
     return 0;
 }
 
@@ -209,9 +243,11 @@ int usbd_ep_close(uint8_t busid, const uint8_t ep)
 
     if (USB_EP_DIR_IS_OUT(ep)) {
         g_kinetis_udc[busid].out_ep[ep_idx].ep_enable = false;
+        g_kinetis_udc[busid].out_ep[ep_idx].bd_armed = 0;
         dir = 0;
     } else {
         g_kinetis_udc[busid].in_ep[ep_idx].ep_enable = false;
+        g_kinetis_udc[busid].in_ep[ep_idx].bd_armed = 0;
         dir = 1;
     }
 
@@ -313,11 +349,7 @@ int usbd_ep_start_write(uint8_t busid, const uint8_t ep, const uint8_t *data,
         return -2;
     }
 
-    g_kinetis_udc[busid].in_ep[ep_idx].xfer_buf = (uint8_t *)data;
-    g_kinetis_udc[busid].in_ep[ep_idx].xfer_len = data_len;
-    g_kinetis_udc[busid].in_ep[ep_idx].actual_xfer_len = 0;
-
-    return kinetis_start_transfer(busid, ep, (uint8_t *)data, MIN(data_len, g_kinetis_udc[busid].in_ep[ep_idx].ep_mps));
+    return kinetis_start_transfer(busid, ep, (uint8_t *)data, data_len);
 }
 
 int usbd_ep_start_read(uint8_t busid, const uint8_t ep, uint8_t *data,
@@ -332,11 +364,7 @@ int usbd_ep_start_read(uint8_t busid, const uint8_t ep, uint8_t *data,
         return -2;
     }
 
-    g_kinetis_udc[busid].out_ep[ep_idx].xfer_buf = (uint8_t *)data;
-    g_kinetis_udc[busid].out_ep[ep_idx].xfer_len = data_len;
-    g_kinetis_udc[busid].out_ep[ep_idx].actual_xfer_len = 0;
-
-    return kinetis_start_transfer(busid, ep, (uint8_t *)data, MIN(data_len, g_kinetis_udc[busid].out_ep[ep_idx].ep_mps));
+    return kinetis_start_transfer(busid, ep, data, data_len);
 }
 
 void USBD_IRQHandler(uint8_t busid)
@@ -350,6 +378,7 @@ void USBD_IRQHandler(uint8_t busid)
     uint8_t is = USB_OTG_DEV->ISTAT;
     uint8_t mask = USB_OTG_DEV->INTEN;
     kinetis_bd_t *bd;
+    struct kinetis_ep_state *ep_state;
 
     USB_OTG_DEV->ISTAT = is & ~mask;
     is &= mask;
@@ -406,6 +435,7 @@ void USBD_IRQHandler(uint8_t busid)
         odd = (s & USB_STAT_ODD_MASK) >> USB_STAT_ODD_SHIFT;
 
         bd = &g_kinetis_bdt[busid].table[ep_idx][dir][odd];
+        ep_state = dir ? &g_kinetis_udc[busid].in_ep[ep_idx] : &g_kinetis_udc[busid].out_ep[ep_idx];
 
         pid = bd->tok_pid;
         bc = bd->bc;
@@ -415,11 +445,7 @@ void USBD_IRQHandler(uint8_t busid)
         bd->ninc = 0;
         bd->keep = 0;
 
-        if (dir) {
-            g_kinetis_udc[busid].in_ep[ep_idx].ep_odd = odd ^ 1;
-        } else {
-            g_kinetis_udc[busid].out_ep[ep_idx].ep_odd = odd ^ 1;
-        }
+        ep_state->bd_armed &= ~(1 << odd);
 
         if (pid == USB_TOKEN_PID_SETUP) {
             USB_OTG_DEV->CTL &= ~USB_CTL_TXSUSPENDTOKENBUSY_MASK;
@@ -427,27 +453,25 @@ void USBD_IRQHandler(uint8_t busid)
             return;
         }
 
+        ep_state->actual_xfer_len += bc;
+
         if (dir) {
-            g_kinetis_udc[busid].in_ep[ep_idx].xfer_buf += bc;
-            g_kinetis_udc[busid].in_ep[ep_idx].xfer_len -= bc;
-            g_kinetis_udc[busid].in_ep[ep_idx].actual_xfer_len += bc;
-
-            if (g_kinetis_udc[busid].in_ep[ep_idx].xfer_len == 0) {
-                usbd_event_ep_in_complete_handler(busid, ep_idx | 0x80, g_kinetis_udc[busid].in_ep[ep_idx].actual_xfer_len);
-            } else {
-                kinetis_start_transfer(busid, ep_idx | 0x80, g_kinetis_udc[busid].in_ep[ep_idx].xfer_buf,
-                                       MIN(g_kinetis_udc[busid].in_ep[ep_idx].xfer_len, g_kinetis_udc[busid].in_ep[ep_idx].ep_mps));
+            if (ep_state->actual_xfer_len >= ep_state->xfer_len) {
+                usbd_event_ep_in_complete_handler(busid, ep_idx | 0x80, ep_state->actual_xfer_len);
+            } else if (ep_state->queued_len < ep_state->xfer_len) {
+                bd = kinetis_prepare_bd(busid, ep_idx | 0x80);
+                if (bd) {
+                    bd->own = 1;
+                }
             }
         } else {
-            g_kinetis_udc[busid].out_ep[ep_idx].xfer_buf += bc;
-            g_kinetis_udc[busid].out_ep[ep_idx].xfer_len -= bc;
-            g_kinetis_udc[busid].out_ep[ep_idx].actual_xfer_len += bc;
-
-            if ((bc < g_kinetis_udc[busid].out_ep[ep_idx].ep_mps) || (g_kinetis_udc[busid].out_ep[ep_idx].xfer_len == 0)) {
-                usbd_event_ep_out_complete_handler(busid, ep_idx, g_kinetis_udc[busid].out_ep[ep_idx].actual_xfer_len);
-            } else {
-                kinetis_start_transfer(busid, ep_idx, g_kinetis_udc[busid].out_ep[ep_idx].xfer_buf,
-                                       MIN(g_kinetis_udc[busid].out_ep[ep_idx].xfer_len, g_kinetis_udc[busid].out_ep[ep_idx].ep_mps));
+            if ((bc < ep_state->ep_mps) || (ep_state->actual_xfer_len >= ep_state->xfer_len)) {
+                usbd_event_ep_out_complete_handler(busid, ep_idx, ep_state->actual_xfer_len);
+            } else if (ep_state->queued_len < ep_state->xfer_len) {
+                bd = kinetis_prepare_bd(busid, ep_idx);
+                if (bd) {
+                    bd->own = 1;
+                }
             }
         }
 
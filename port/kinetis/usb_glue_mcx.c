@@ -4,10 +4,15 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "usbd_core.h"
+#include "usbh_core.h"
 #include "fsl_common.h"
 #include "usb_kinetis_reg.h"
 
-#define USB_OTG_DEV ((KINETIS_MCX_TypeDef *)g_usbdev_bus[busid].reg_base)
+#define USB_OTG_DEV  ((KINETIS_MCX_TypeDef *)g_usbdev_bus[busid].reg_base)
+#define USB_OTG_HOST ((KINETIS_MCX_TypeDef *)bus->hcd.reg_base)
+
+/* one controller, the irq goes to whichever stack owns it */
+static bool g_kinetis_host_mode;
 
 #if defined(MCXC444_H_)
 #define USBD_IRQ USB0_IRQHandler
@@ -43,16 +48,25 @@ void USB_ClockInit(void)
 #error "Unsupported MCU with Kinetis IP"
 #endif
 
-void USBD_IRQ(void)
+__WEAK void USBD_IRQHandler(uint8_t busid)
 {
-    extern void USBD_IRQHandler(uint8_t busid);
-    USBD_IRQHandler(0);
 }
 
-void usb_dc_low_level_init(uint8_t busid)
+__WEAK void USBH_IRQHandler(uint8_t busid)
 {
-    USB_ClockInit();
+}
+
+void USBD_IRQ(void)
+{
+    if (g_kinetis_host_mode) {
+        USBH_IRQHandler(0);
+    } else {
+        USBD_IRQHandler(0);
+    }
+}
 
+static void usb_kinetis_irq_enable(void)
+{
     uint8_t irqNumber;
 
     uint8_t usbDeviceKhciIrq[] = USB_IRQS;
@@ -61,6 +75,23 @@ void usb_dc_low_level_init(uint8_t busid)
     /* Install isr, set priority, and enable IRQ. */
     NVIC_SetPriority((IRQn_Type)irqNumber, 3);
     EnableIRQ((IRQn_Type)irqNumber);
+}
+
+static void usb_kinetis_irq_disable(void)
+{
+#if defined(MCXN947_CM33_CORE0_H_)
+    DisableIRQ((IRQn_Type)USB0_FS_IRQn);
+#else
+    DisableIRQ((IRQn_Type)USB0_IRQn);
+#endif
+}
+
+void usb_dc_low_level_init(uint8_t busid)
+{
+    USB_ClockInit();
+
+    g_kinetis_host_mode = false;
+    usb_kinetis_irq_enable();
 
     USB_OTG_DEV->USBTRC0 |= USB_USBTRC0_USBRESET_MASK;
     while (USB_OTG_DEV->USBTRC0 & USB_USBTRC0_USBRESET_MASK);
@@ -73,11 +104,30 @@ void usb_dc_low_level_init(uint8_t busid)
 void usb_dc_low_level_deinit(uint8_t busid)
 {
     USB_OTG_DEV->CONTROL &= ~USB_CONTROL_DPPULLUPNONOTG_MASK;
-    #if defined(MCXN947_CM33_CORE0_H_)
-        DisableIRQ((IRQn_Type)USB0_FS_IRQn);
-    #else
-        DisableIRQ((IRQn_Type)USB0_IRQn);
-    #endif
+    usb_kinetis_irq_disable();
+}
+
+void usb_hc_low_level_init(struct usbh_bus *bus)
+{
+    USB_ClockInit();
+
+    g_kinetis_host_mode = true;
+    usb_kinetis_irq_enable();
+
+    USB_OTG_HOST->USBTRC0 |= USB_USBTRC0_USBRESET_MASK;
+    while (USB_OTG_HOST->USBTRC0 & USB_USBTRC0_USBRESET_MASK);
+
+    USB_OTG_HOST->USBTRC0 |= USB_USBTRC0_VREGIN_STS(1); /* software must set this bit to 1 */
+    USB_OTG_HOST->CONTROL &= ~USB_CONTROL_DPPULLUPNONOTG_MASK;
+    /* enable d+/d- pull-downs for host */
+    USB_OTG_HOST->USBCTRL = USB_USBCTRL_PDE_MASK;
+}
+
+void usb_hc_low_level_deinit(struct usbh_bus *bus)
+{
+    USB_OTG_HOST->USBCTRL = USB_USBCTRL_SUSP_MASK;
+    usb_kinetis_irq_disable();
+    g_kinetis_host_mode = false;
 }
 
 void usbd_kinetis_delay_ms(uint8_t ms)
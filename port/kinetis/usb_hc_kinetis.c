@@ -1 +1,839 @@
-TODO
\ No newline at end of file
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usbh_core.h"
+#include "usbh_hub.h"
+#include "usb_kinetis_reg.h"
+
+#define USB_OTG_HOST ((KINETIS_TypeDef *)bus->hcd.reg_base)
+
+/* Urbs queued at the same time, control urbs included */
+#ifndef CONFIG_USB_KINETIS_PIPE_NUM
+#define CONFIG_USB_KINETIS_PIPE_NUM 8
+#endif
+
+/* Frames a control/bulk pipe waits after NAK before the next token */
+#ifndef CONFIG_USB_KINETIS_NAK_HOLDOFF
+#define CONFIG_USB_KINETIS_NAK_HOLDOFF 1
+#endif
+
+/* Bus timeouts and crc errors in a row before the urb fails */
+#define KINETIS_MAX_ERROR_COUNT 3
+
+/* No token is started this many byte times before sof, room for a 64 byte packet */
+#define KINETIS_SOF_THRESHOLD 74
+
+typedef enum {
+    KINETIS_EP0_STATE_SETUP = 0x0, /**< SETUP DATA */
+    KINETIS_EP0_STATE_IN_DATA,     /**< IN DATA */
+    KINETIS_EP0_STATE_OUT_DATA,    /**< OUT DATA */
+    KINETIS_EP0_STATE_IN_STATUS,   /**< IN status */
+    KINETIS_EP0_STATE_OUT_STATUS,  /**< OUT status */
+} kinetis_ep0_state_t;
+
+struct kinetis_pipe {
+    bool inuse;
+    bool zombie; /* freed while its token is on the bus, token done releases it */
+    uint8_t ep0_state;
+    uint8_t ep_type;
+    uint8_t ep_addr;
+    uint16_t ep_mps;
+    uint8_t interval;    /* frames between polls of interrupt pipe */
+    uint8_t err_count;
+    uint16_t next_frame; /* not scheduled before this frame */
+    usb_osal_sem_t waitsem;
+    struct usbh_urb *urb;
+};
+
+struct kinetis_hcd {
+    volatile bool port_csc;
+    volatile bool port_pec;
+    volatile bool port_pe;
+    volatile bool port_connected;
+    uint8_t port_speed;
+    uint16_t frame;                   /* sof counter */
+    uint8_t tx_odd;                   /* bd used by SIE for the next out/setup token */
+    uint8_t rx_odd;                   /* bd used by SIE for the next in token */
+    uint8_t rr_index;                 /* round robin start for control/bulk pipes */
+    struct kinetis_pipe *active;      /* pipe whose token is on the bus */
+    struct kinetis_pipe *rx_prearmed; /* pipe whose next in packet waits in the other rx bd */
+    struct kinetis_pipe pipe_pool[CONFIG_USB_KINETIS_PIPE_NUM];
+} g_kinetis_hcd[CONFIG_USBHOST_MAX_BUS];
+
+USB_NOCACHE_RAM_SECTION __attribute__((aligned(512))) static kinetis_bd_table_t g_kinetis_host_bdt[CONFIG_USBHOST_MAX_BUS];
+
+__WEAK void usb_hc_low_level_init(struct usbh_bus *bus)
+{
+}
+
+__WEAK void usb_hc_low_level_deinit(struct usbh_bus *bus)
+{
+}
+
+static struct kinetis_pipe *kinetis_pipe_alloc(struct usbh_bus *bus)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    for (uint8_t i = 0; i < CONFIG_USB_KINETIS_PIPE_NUM; i++) {
+        if (!hcd->pipe_pool[i].inuse) {
+            hcd->pipe_pool[i].inuse = true;
+            usb_osal_leave_critical_section(flags);
+            return &hcd->pipe_pool[i];
+        }
+    }
+    usb_osal_leave_critical_section(flags);
+    return NULL;
+}
+
+/* Called with critical section held */
+static void kinetis_pipe_free(struct kinetis_hcd *hcd, struct kinetis_pipe *pipe)
+{
+    pipe->urb = NULL;
+    if (hcd->rx_prearmed == pipe) {
+        hcd->rx_prearmed = NULL;
+    }
+    if (hcd->active == pipe) {
+        pipe->zombie = true;
+    } else {
+        pipe->inuse = false;
+    }
+}
+
+static void kinetis_arm_bd(struct usbh_bus *bus, uint8_t tx, uint8_t odd, uint8_t *buffer, uint32_t len, uint8_t toggle)
+{
+    kinetis_bd_t *bd = &g_kinetis_host_bdt[bus->hcd.hcd_id].table[0][tx][odd];
+    kinetis_bd_t head = { 0 };
+
+    head.bc = len;
+    head.data = toggle;
+    head.dts = 1;
+    head.own = 1;
+
+    bd->addr = (uint32_t)(uintptr_t)buffer;
+    bd->head = head.head;
+}
+
+/* Send one token for pipe, SIE must be idle */
+static void kinetis_pipe_start(struct usbh_bus *bus, struct kinetis_pipe *pipe)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+    struct usbh_urb *urb = pipe->urb;
+    uint8_t *buffer = urb->transfer_buffer + urb->actual_length;
+    uint32_t len = urb->transfer_buffer_length - urb->actual_length;
+    uint8_t toggle = urb->data_toggle;
+    uint8_t pid;
+    uint8_t tx;
+    uint8_t odd;
+    uint8_t regval;
+
+    if (pipe->ep_type == USB_ENDPOINT_TYPE_CONTROL) {
+        switch (pipe->ep0_state) {
+            case KINETIS_EP0_STATE_SETUP:
+                pid = USB_TOKEN_PID_SETUP;
+                buffer = (uint8_t *)urb->setup;
+                len = 8;
+                toggle = 0;
+                break;
+            case KINETIS_EP0_STATE_IN_DATA:
+                pid = USB_TOKEN_PID_IN;
+                break;
+            case KINETIS_EP0_STATE_OUT_DATA:
+                pid = USB_TOKEN_PID_OUT;
+                break;
+            case KINETIS_EP0_STATE_IN_STATUS:
+                pid = USB_TOKEN_PID_IN;
+                len = 0;
+                toggle = 1;
+                break;
+            default:
+                pid = USB_TOKEN_PID_OUT;
+                len = 0;
+                toggle = 1;
+                break;
+        }
+    } else {
+        pid = USB_EP_DIR_IS_IN(pipe->ep_addr) ? USB_TOKEN_PID_IN : USB_TOKEN_PID_OUT;
+    }
+
+    if (len > pipe->ep_mps) {
+        len = pipe->ep_mps;
+    }
+
+    regval = USB_ENDPT_EPTXEN_MASK | USB_ENDPT_EPRXEN_MASK | USB_ENDPT_RETRYDIS_MASK;
+    if (pipe->ep_type != USB_ENDPOINT_TYPE_ISOCHRONOUS) {
+        regval |= USB_ENDPT_EPHSHK_MASK;
+    }
+    /* low speed device on roothub needs no preamble */
+    if (hcd->port_speed == USB_SPEED_LOW) {
+        regval |= USB_ENDPT_HOSTWOHUB_MASK;
+    }
+    USB_OTG_HOST->ENDPOINT[0].ENDPT = regval;
+    USB_OTG_HOST->ADDR = urb->hport->dev_addr | ((urb->hport->speed == USB_SPEED_LOW) ? USB_ADDR_LSEN_MASK : 0);
+
+    tx = (pid == USB_TOKEN_PID_IN) ? 0 : 1;
+    odd = tx ? hcd->tx_odd : hcd->rx_odd;
+    kinetis_arm_bd(bus, tx, odd, buffer, len, toggle);
+
+    hcd->active = pipe;
+    USB_OTG_HOST->TOKEN = (pid << USB_TOKEN_TOKENPID_SHIFT) | USB_EP_GET_IDX(pipe->ep_addr);
+
+    /* while this packet is on the bus, the next bulk in packet goes to the other bd */
+    hcd->rx_prearmed = NULL;
+    if ((pipe->ep_type == USB_ENDPOINT_TYPE_BULK) && !tx && (len == pipe->ep_mps) &&
+        (urb->actual_length + len < urb->transfer_buffer_length)) {
+        kinetis_arm_bd(bus, 0, odd ^ 1, buffer + len,
+                       MIN(urb->transfer_buffer_length - urb->actual_length - len, pipe->ep_mps), toggle ^ 1);
+        hcd->rx_prearmed = pipe;
+    }
+}
+
+static bool kinetis_pipe_ready(struct kinetis_hcd *hcd, struct kinetis_pipe *pipe)
+{
+    return pipe->inuse && pipe->urb && ((int16_t)(hcd->frame - pipe->next_frame) >= 0);
+}
+
+static bool kinetis_periodic_due(struct kinetis_hcd *hcd)
+{
+    for (uint8_t i = 0; i < CONFIG_USB_KINETIS_PIPE_NUM; i++) {
+        if ((hcd->pipe_pool[i].ep_type == USB_ENDPOINT_TYPE_INTERRUPT) && kinetis_pipe_ready(hcd, &hcd->pipe_pool[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Start the next token when SIE is idle: interrupt pipes due for poll first,
+ * then control/bulk pipes in turn. Called with critical section held.
+ */
+static void kinetis_schedule(struct usbh_bus *bus)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+    struct kinetis_pipe *pipe;
+    struct kinetis_pipe *next = NULL;
+
+    if (hcd->active || !hcd->port_pe) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < CONFIG_USB_KINETIS_PIPE_NUM; i++) {
+        pipe = &hcd->pipe_pool[(hcd->rr_index + i) % CONFIG_USB_KINETIS_PIPE_NUM];
+        if (!kinetis_pipe_ready(hcd, pipe)) {
+            continue;
+        }
+        if (pipe->ep_type == USB_ENDPOINT_TYPE_INTERRUPT) {
+            next = pipe;
+            break;
+        }
+        if (next == NULL) {
+            next = pipe;
+        }
+    }
+
+    if (next) {
+        hcd->rr_index = ((next - hcd->pipe_pool) + 1) % CONFIG_USB_KINETIS_PIPE_NUM;
+        kinetis_pipe_start(bus, next);
+    }
+}
+
+static void kinetis_urb_giveback(struct usbh_bus *bus, struct kinetis_pipe *pipe, int errorcode)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+    struct usbh_urb *urb = pipe->urb;
+
+    urb->hcpriv = NULL;
+    urb->errorcode = errorcode;
+
+    if (urb->timeout) {
+        /* submitter frees the pipe after waking up */
+        pipe->urb = NULL;
+        usb_osal_sem_give(pipe->waitsem);
+    } else {
+        kinetis_pipe_free(hcd, pipe);
+    }
+
+    if (urb->complete) {
+        if (urb->errorcode < 0) {
+            urb->complete(urb->arg, urb->errorcode);
+        } else {
+            urb->complete(urb->arg, urb->actual_length);
+        }
+    }
+}
+
+/* Move pipe on after an acked packet of bc bytes */
+static void kinetis_pipe_advance(struct usbh_bus *bus, struct kinetis_pipe *pipe, uint16_t bc)
+{
+    struct usbh_urb *urb = pipe->urb;
+    uint32_t len;
+
+    if (pipe->ep_type == USB_ENDPOINT_TYPE_CONTROL) {
+        len = MIN(urb->transfer_buffer_length, urb->setup->wLength);
+
+        switch (pipe->ep0_state) {
+            case KINETIS_EP0_STATE_SETUP:
+                urb->data_toggle = 1;
+                if (len == 0) {
+                    pipe->ep0_state = KINETIS_EP0_STATE_IN_STATUS;
+                } else if (urb->setup->bmRequestType & 0x80) {
+                    pipe->ep0_state = KINETIS_EP0_STATE_IN_DATA;
+                } else {
+                    pipe->ep0_state = KINETIS_EP0_STATE_OUT_DATA;
+                }
+                break;
+            case KINETIS_EP0_STATE_IN_DATA:
+                urb->actual_length += bc;
+                urb->data_toggle ^= 1;
+                if ((bc < pipe->ep_mps) || (urb->actual_length >= len)) {
+                    pipe->ep0_state = KINETIS_EP0_STATE_OUT_STATUS;
+                }
+                break;
+            case KINETIS_EP0_STATE_OUT_DATA:
+                urb->actual_length += bc;
+                urb->data_toggle ^= 1;
+                if (urb->actual_length >= len) {
+                    pipe->ep0_state = KINETIS_EP0_STATE_IN_STATUS;
+                }
+                break;
+            default:
+                kinetis_urb_giveback(bus, pipe, 0);
+                break;
+        }
+    } else {
+        urb->actual_length += bc;
+        urb->data_toggle ^= 1;
+        if ((USB_EP_DIR_IS_IN(pipe->ep_addr) && (bc < pipe->ep_mps)) ||
+            (urb->actual_length >= urb->transfer_buffer_length)) {
+            kinetis_urb_giveback(bus, pipe, 0);
+        } else if (pipe->ep_type == USB_ENDPOINT_TYPE_INTERRUPT) {
+            /* one packet per poll interval */
+            pipe->next_frame = g_kinetis_hcd[bus->hcd.hcd_id].frame + pipe->interval;
+        }
+    }
+}
+
+static void kinetis_handle_token_done(struct usbh_bus *bus)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+    struct kinetis_pipe *pipe;
+    struct usbh_urb *urb;
+    kinetis_bd_t *bd;
+    uint8_t stat;
+    uint8_t tx;
+    uint8_t odd;
+    uint8_t pid;
+    uint16_t bc;
+    uint32_t remain;
+
+    stat = USB_OTG_HOST->STAT;
+    USB_OTG_HOST->ISTAT = USB_ISTAT_TOKDNE_MASK; /* must be cleared after get STAT */
+
+    tx = (stat & USB_STAT_TX_MASK) >> USB_STAT_TX_SHIFT;
+    odd = (stat & USB_STAT_ODD_MASK) >> USB_STAT_ODD_SHIFT;
+    bd = &g_kinetis_host_bdt[bus->hcd.hcd_id].table[0][tx][odd];
+
+    pid = bd->tok_pid;
+    bc = bd->bc;
+
+    if (tx) {
+        hcd->tx_odd = odd ^ 1;
+    } else {
+        hcd->rx_odd = odd ^ 1;
+    }
+
+    pipe = hcd->active;
+    hcd->active = NULL;
+
+    if (pipe == NULL) {
+        kinetis_schedule(bus);
+        return;
+    }
+    if (pipe->zombie) {
+        pipe->zombie = false;
+        pipe->inuse = false;
+    }
+    urb = pipe->urb;
+    if (urb == NULL) {
+        kinetis_schedule(bus);
+        return;
+    }
+
+    switch (pid) {
+        case USB_TOKEN_PID_DATA0:
+        case USB_TOKEN_PID_DATA1:
+            /* device resent a packet we have already acked */
+            if ((pid == USB_TOKEN_PID_DATA1) != (bd->data == 1)) {
+                break;
+            }
+            /* fall through */
+        case USB_TOKEN_PID_ACK:
+            pipe->err_count = 0;
+
+            /* next bulk in packet is armed already, send its token before the bookkeeping */
+            if ((hcd->rx_prearmed == pipe) && (bc == pipe->ep_mps) && !kinetis_periodic_due(hcd)) {
+                hcd->active = pipe;
+                USB_OTG_HOST->TOKEN = (USB_TOKEN_PID_IN << USB_TOKEN_TOKENPID_SHIFT) | USB_EP_GET_IDX(pipe->ep_addr);
+
+                urb->actual_length += bc;
+                urb->data_toggle ^= 1;
+
+                /* refill the bd just returned with the packet after the one on the bus */
+                hcd->rx_prearmed = NULL;
+                remain = urb->transfer_buffer_length - urb->actual_length;
+                if (remain > pipe->ep_mps) {
+                    kinetis_arm_bd(bus, 0, odd, urb->transfer_buffer + urb->actual_length + pipe->ep_mps,
+                                   MIN(remain - pipe->ep_mps, pipe->ep_mps), urb->data_toggle ^ 1);
+                    hcd->rx_prearmed = pipe;
+                }
+                return;
+            }
+
+            kinetis_pipe_advance(bus, pipe, bc);
+            break;
+        case USB_TOKEN_PID_NAK:
+            /* interrupt pipe waits for its next poll, others are throttled */
+            if (pipe->ep_type == USB_ENDPOINT_TYPE_INTERRUPT) {
+                pipe->next_frame = hcd->frame + pipe->interval;
+            } else {
+                pipe->next_frame = hcd->frame + CONFIG_USB_KINETIS_NAK_HOLDOFF;
+            }
+            break;
+        case USB_TOKEN_PID_STALL:
+            kinetis_urb_giveback(bus, pipe, -USB_ERR_STALL);
+            break;
+        default:
+            if (++pipe->err_count >= KINETIS_MAX_ERROR_COUNT) {
+                kinetis_urb_giveback(bus, pipe, -USB_ERR_IO);
+            } else {
+                pipe->next_frame = hcd->frame + 1;
+            }
+            break;
+    }
+
+    kinetis_schedule(bus);
+}
+
+int usb_hc_init(struct usbh_bus *bus)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+
+    memset(hcd, 0, sizeof(struct kinetis_hcd));
+
+    for (uint8_t i = 0; i < CONFIG_USB_KINETIS_PIPE_NUM; i++) {
+        hcd->pipe_pool[i].waitsem = usb_osal_sem_create(0);
+        if (hcd->pipe_pool[i].waitsem == NULL) {
+            USB_LOG_ERR("Failed to create waitsem\r\n");
+            return -USB_ERR_NOMEM;
+        }
+    }
+
+    usb_hc_low_level_init(bus);
+
+    memset(&g_kinetis_host_bdt[bus->hcd.hcd_id], 0, sizeof(kinetis_bd_table_t));
+
+    USB_OTG_HOST->BDTPAGE1 = (uint8_t)((uintptr_t)&g_kinetis_host_bdt[bus->hcd.hcd_id] >> 8);
+    USB_OTG_HOST->BDTPAGE2 = (uint8_t)((uintptr_t)&g_kinetis_host_bdt[bus->hcd.hcd_id] >> 16);
+    USB_OTG_HOST->BDTPAGE3 = (uint8_t)((uintptr_t)&g_kinetis_host_bdt[bus->hcd.hcd_id] >> 24);
+
+    USB_OTG_HOST->CTL = USB_CTL_ODDRST_MASK;
+    USB_OTG_HOST->CTL = USB_CTL_HOSTMODEEN_MASK;
+    USB_OTG_HOST->ADDR = 0;
+    USB_OTG_HOST->SOFTHLD = KINETIS_SOF_THRESHOLD;
+    USB_OTG_HOST->ENDPOINT[0].ENDPT = USB_ENDPT_EPHSHK_MASK | USB_ENDPT_EPTXEN_MASK | USB_ENDPT_EPRXEN_MASK | USB_ENDPT_RETRYDIS_MASK;
+    for (uint8_t i = 1; i < 16; i++) {
+        USB_OTG_HOST->ENDPOINT[i].ENDPT = 0;
+    }
+
+    USB_OTG_HOST->ERREN = 0xff;
+    USB_OTG_HOST->ERRSTAT = 0xff;
+    USB_OTG_HOST->ISTAT = 0xff;
+    USB_OTG_HOST->INTEN = USB_INTEN_ATTACHEN_MASK | USB_INTEN_TOKDNEEN_MASK |
+                          USB_INTEN_SOFTOKEN_MASK | USB_INTEN_ERROREN_MASK |
+                          USB_INTEN_STALLEN_MASK;
+    return 0;
+}
+
+int usb_hc_deinit(struct usbh_bus *bus)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+
+    USB_OTG_HOST->INTEN = 0;
+    USB_OTG_HOST->CTL = 0;
+    USB_OTG_HOST->ISTAT = 0xff;
+
+    for (uint8_t i = 0; i < CONFIG_USB_KINETIS_PIPE_NUM; i++) {
+        if (hcd->pipe_pool[i].waitsem) {
+            usb_osal_sem_delete(hcd->pipe_pool[i].waitsem);
+        }
+    }
+
+    usb_hc_low_level_deinit(bus);
+    return 0;
+}
+
+uint16_t usbh_get_frame_number(struct usbh_bus *bus)
+{
+    return (USB_OTG_HOST->FRMNUML | ((uint16_t)USB_OTG_HOST->FRMNUMH << 8)) & 0x7ff;
+}
+
+static void kinetis_port_reset(struct usbh_bus *bus)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+    size_t flags;
+
+    /* our own reset looks like a detach, keep it masked */
+    flags = usb_osal_enter_critical_section();
+    USB_OTG_HOST->INTEN &= ~USB_INTEN_USBRSTEN_MASK;
+    USB_OTG_HOST->CTL &= ~USB_CTL_USBENSOFEN_MASK;
+    hcd->port_pe = false;
+    usb_osal_leave_critical_section(flags);
+
+    USB_OTG_HOST->CTL |= USB_CTL_RESET_MASK;
+    usb_osal_msleep(30);
+    USB_OTG_HOST->CTL &= ~USB_CTL_RESET_MASK;
+
+    flags = usb_osal_enter_critical_section();
+    USB_OTG_HOST->ISTAT = USB_ISTAT_USBRST_MASK;
+    USB_OTG_HOST->CTL |= USB_CTL_ODDRST_MASK;
+    USB_OTG_HOST->CTL &= ~USB_CTL_ODDRST_MASK;
+    hcd->tx_odd = 0;
+    hcd->rx_odd = 0;
+    if (hcd->port_connected) {
+        USB_OTG_HOST->CTL |= USB_CTL_USBENSOFEN_MASK;
+        USB_OTG_HOST->INTEN |= USB_INTEN_USBRSTEN_MASK;
+        hcd->port_pe = true;
+    }
+    usb_osal_leave_critical_section(flags);
+
+    /* device needs some sofs before the first token */
+    usb_osal_msleep(10);
+}
+
+int usbh_roothub_control(struct usbh_bus *bus, struct usb_setup_packet *setup, uint8_t *buf)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+    uint8_t nports;
+    uint8_t port;
+    uint32_t status;
+
+    nports = CONFIG_USBHOST_MAX_RHPORTS;
+    port = setup->wIndex;
+    if (setup->bmRequestType & USB_REQUEST_RECIPIENT_DEVICE) {
+        switch (setup->bRequest) {
+            case HUB_REQUEST_CLEAR_FEATURE:
+                switch (setup->wValue) {
+                    case HUB_FEATURE_HUB_C_LOCALPOWER:
+                        break;
+                    case HUB_FEATURE_HUB_C_OVERCURRENT:
+                        break;
+                    default:
+                        return -USB_ERR_INVAL;
+                }
+                break;
+            case HUB_REQUEST_SET_FEATURE:
+                switch (setup->wValue) {
+                    case HUB_FEATURE_HUB_C_LOCALPOWER:
+                        break;
+                    case HUB_FEATURE_HUB_C_OVERCURRENT:
+                        break;
+                    default:
+                        return -USB_ERR_INVAL;
+                }
+                break;
+            case HUB_REQUEST_GET_DESCRIPTOR:
+                break;
+            case HUB_REQUEST_GET_STATUS:
+                memset(buf, 0, 4);
+                break;
+            default:
+                break;
+        }
+    } else if (setup->bmRequestType & USB_REQUEST_RECIPIENT_OTHER) {
+        switch (setup->bRequest) {
+            case HUB_REQUEST_CLEAR_FEATURE:
+                if (!port || port > nports) {
+                    return -USB_ERR_INVAL;
+                }
+
+                switch (setup->wValue) {
+                    case HUB_PORT_FEATURE_ENABLE:
+                        USB_OTG_HOST->CTL &= ~USB_CTL_USBENSOFEN_MASK;
+                        hcd->port_pe = false;
+                        break;
+                    case HUB_PORT_FEATURE_SUSPEND:
+                    case HUB_PORT_FEATURE_C_SUSPEND:
+                        break;
+                    case HUB_PORT_FEATURE_POWER:
+                        break;
+                    case HUB_PORT_FEATURE_C_CONNECTION:
+                        hcd->port_csc = false;
+                        break;
+                    case HUB_PORT_FEATURE_C_ENABLE:
+                        hcd->port_pec = false;
+                        break;
+                    case HUB_PORT_FEATURE_C_OVER_CURREN:
+                        break;
+                    case HUB_PORT_FEATURE_C_RESET:
+                        break;
+                    default:
+                        return -USB_ERR_INVAL;
+                }
+                break;
+            case HUB_REQUEST_SET_FEATURE:
+                if (!port || port > nports) {
+                    return -USB_ERR_INVAL;
+                }
+
+                switch (setup->wValue) {
+                    case HUB_PORT_FEATURE_SUSPEND:
+                        break;
+                    case HUB_PORT_FEATURE_POWER:
+                        break;
+                    case HUB_PORT_FEATURE_RESET:
+                        kinetis_port_reset(bus);
+                        break;
+
+                    default:
+                        return -USB_ERR_INVAL;
+                }
+                break;
+            case HUB_REQUEST_GET_STATUS:
+                if (!port || port > nports) {
+                    return -USB_ERR_INVAL;
+                }
+
+                status = 0;
+                if (hcd->port_csc) {
+                    status |= (1 << HUB_PORT_FEATURE_C_CONNECTION);
+                }
+                if (hcd->port_pec) {
+                    status |= (1 << HUB_PORT_FEATURE_C_ENABLE);
+                }
+
+                if (hcd->port_connected) {
+                    status |= (1 << HUB_PORT_FEATURE_CONNECTION);
+                    if (hcd->port_speed == USB_SPEED_LOW) {
+                        status |= (1 << HUB_PORT_FEATURE_LOWSPEED);
+                    }
+                }
+                if (hcd->port_pe) {
+                    status |= (1 << HUB_PORT_FEATURE_ENABLE);
+                }
+
+                status |= (1 << HUB_PORT_FEATURE_POWER);
+                memcpy(buf, &status, 4);
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+int usbh_submit_urb(struct usbh_urb *urb)
+{
+    struct kinetis_hcd *hcd;
+    struct kinetis_pipe *pipe;
+    struct usbh_bus *bus;
+    size_t flags;
+    int ret = 0;
+
+    if (!urb || !urb->hport || !urb->ep || !urb->hport->bus) {
+        return -USB_ERR_INVAL;
+    }
+
+    bus = urb->hport->bus;
+    hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+
+    if (!urb->hport->connected || !hcd->port_connected) {
+        return -USB_ERR_NOTCONN;
+    }
+
+    if (urb->errorcode == -USB_ERR_BUSY) {
+        return -USB_ERR_BUSY;
+    }
+
+    if (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
+        return -USB_ERR_NOTSUPP;
+    }
+
+    pipe = kinetis_pipe_alloc(bus);
+    if (pipe == NULL) {
+        return -USB_ERR_NOMEM;
+    }
+    usb_osal_sem_reset(pipe->waitsem);
+
+    pipe->zombie = false;
+    pipe->ep0_state = KINETIS_EP0_STATE_SETUP;
+    pipe->ep_type = USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes);
+    pipe->ep_addr = urb->ep->bEndpointAddress;
+    pipe->ep_mps = USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize);
+    pipe->interval = urb->ep->bInterval ? urb->ep->bInterval : 1;
+    pipe->err_count = 0;
+
+    flags = usb_osal_enter_critical_section();
+
+    pipe->next_frame = hcd->frame;
+    pipe->urb = urb;
+
+    urb->hcpriv = pipe;
+    urb->errorcode = -USB_ERR_BUSY;
+    urb->actual_length = 0;
+
+    kinetis_schedule(bus);
+
+    usb_osal_leave_critical_section(flags);
+
+    if (urb->timeout > 0) {
+        /* wait until timeout or sem give */
+        ret = usb_osal_sem_take(pipe->waitsem, urb->timeout);
+
+        flags = usb_osal_enter_critical_section();
+        if (urb->hcpriv == pipe) {
+            /* still on the schedule, timed out */
+            urb->hcpriv = NULL;
+            urb->errorcode = -USB_ERR_SHUTDOWN;
+        } else {
+            ret = urb->errorcode;
+        }
+        /* sync urb pipe is always freed here */
+        kinetis_pipe_free(hcd, pipe);
+        usb_osal_leave_critical_section(flags);
+
+        urb->timeout = 0;
+    }
+    return ret;
+}
+
+int usbh_kill_urb(struct usbh_urb *urb)
+{
+    struct kinetis_hcd *hcd;
+    struct kinetis_pipe *pipe;
+    struct usbh_bus *bus;
+    size_t flags;
+
+    if (!urb || !urb->hport || !urb->hport->bus) {
+        return -USB_ERR_INVAL;
+    }
+
+    bus = urb->hport->bus;
+    hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+
+    flags = usb_osal_enter_critical_section();
+
+    pipe = (struct kinetis_pipe *)urb->hcpriv;
+    if (pipe == NULL) {
+        usb_osal_leave_critical_section(flags);
+        return -USB_ERR_INVAL;
+    }
+
+    urb->hcpriv = NULL;
+    urb->errorcode = -USB_ERR_SHUTDOWN;
+
+    if (urb->timeout) {
+        pipe->urb = NULL;
+        usb_osal_sem_give(pipe->waitsem);
+    } else {
+        kinetis_pipe_free(hcd, pipe);
+    }
+
+    usb_osal_leave_critical_section(flags);
+
+    return 0;
+}
+
+static void kinetis_port_disconnect(struct usbh_bus *bus)
+{
+    struct kinetis_hcd *hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+    struct kinetis_pipe *pipe;
+
+    USB_OTG_HOST->CTL &= ~USB_CTL_USBENSOFEN_MASK;
+    USB_OTG_HOST->ADDR = 0;
+
+    hcd->port_connected = false;
+    hcd->port_pe = false;
+    hcd->port_csc = true;
+    hcd->port_pec = true;
+    hcd->active = NULL;
+    hcd->rx_prearmed = NULL;
+
+    for (uint8_t i = 0; i < CONFIG_USB_KINETIS_PIPE_NUM; i++) {
+        pipe = &hcd->pipe_pool[i];
+        if (pipe->zombie) {
+            pipe->zombie = false;
+            pipe->inuse = false;
+        }
+        if (pipe->inuse && pipe->urb) {
+            kinetis_urb_giveback(bus, pipe, -USB_ERR_NOTCONN);
+        }
+    }
+}
+
+void USBH_IRQHandler(uint8_t busid)
+{
+    struct usbh_bus *bus;
+    struct kinetis_hcd *hcd;
+    uint8_t is;
+
+    bus = &g_usbhost_bus[busid];
+    hcd = &g_kinetis_hcd[bus->hcd.hcd_id];
+
+    is = USB_OTG_HOST->ISTAT & USB_OTG_HOST->INTEN;
+
+    if (is & USB_ISTAT_ATTACH_MASK) {
+        USB_OTG_HOST->ISTAT = USB_ISTAT_ATTACH_MASK;
+
+        /* j state is d+ high on full speed and d- high on low speed */
+        hcd->port_speed = (USB_OTG_HOST->CTL & USB_CTL_JSTATE_MASK) ? USB_SPEED_FULL : USB_SPEED_LOW;
+        hcd->port_connected = true;
+        hcd->port_csc = true;
+
+        /* in host mode usb reset interrupt means detach */
+        USB_OTG_HOST->INTEN &= ~USB_INTEN_ATTACHEN_MASK;
+        USB_OTG_HOST->ISTAT = USB_ISTAT_USBRST_MASK;
+        USB_OTG_HOST->INTEN |= USB_INTEN_USBRSTEN_MASK;
+
+        bus->hcd.roothub.int_buffer[0] = (1 << 1);
+        usbh_hub_thread_wakeup(&bus->hcd.roothub);
+    }
+
+    if (is & USB_ISTAT_USBRST_MASK) {
+        USB_OTG_HOST->ISTAT = USB_ISTAT_USBRST_MASK;
+
+        kinetis_port_disconnect(bus);
+
+        USB_OTG_HOST->INTEN &= ~USB_INTEN_USBRSTEN_MASK;
+        USB_OTG_HOST->ISTAT = USB_ISTAT_ATTACH_MASK;
+        USB_OTG_HOST->INTEN |= USB_INTEN_ATTACHEN_MASK;
+
+        bus->hcd.roothub.int_buffer[0] = (1 << 1);
+        usbh_hub_thread_wakeup(&bus->hcd.roothub);
+    }
+
+    if (is & USB_ISTAT_ERROR_MASK) {
+        USB_OTG_HOST->ERRSTAT = USB_OTG_HOST->ERRSTAT;
+        USB_OTG_HOST->ISTAT = USB_ISTAT_ERROR_MASK;
+    }
+
+    if (is & USB_ISTAT_STALL_MASK) {
+        USB_OTG_HOST->ISTAT = USB_ISTAT_STALL_MASK;
+    }
+
+    if (is & USB_ISTAT_TOKDNE_MASK) {
+        kinetis_handle_token_done(bus);
+    }
+
+    if (is & USB_ISTAT_SOFTOK_MASK) {
+        USB_OTG_HOST->ISTAT = USB_ISTAT_SOFTOK_MASK;
+        hcd->frame++;
+        /* pipes held off by nak or poll interval get their turn */
+        kinetis_schedule(bus);
+    }
+
+    if (is & (USB_ISTAT_SLEEP_MASK | USB_ISTAT_RESUME_MASK)) {
+        USB_OTG_HOST->ISTAT = is & (USB_ISTAT_SLEEP_MASK | USB_ISTAT_RESUME_MASK);
+    }
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usbd_core.h"
+#include "usb_loopback.h"
+
+__WEAK void usb_dc_low_level_init(uint8_t busid)
+{
+    (void)busid;
+}
+
+__WEAK void usb_dc_low_level_deinit(uint8_t busid)
+{
+    (void)busid;
+}
+
+int usb_dc_init(uint8_t busid)
+{
+    struct usb_loopback_link *link;
+    size_t flags;
+
+    if (busid >= CONFIG_USB_LOOPBACK_MAX_LINK) {
+        return -USB_ERR_RANGE;
+    }
+
+    link = &g_loopback_link[busid];
+
+    usb_dc_low_level_init(busid);
+    usb_loopback_init();
+
+    flags = usb_osal_enter_critical_section();
+    link->dev_addr = 0;
+    memset(link->in_ep, 0, sizeof(link->in_ep));
+    memset(link->out_ep, 0, sizeof(link->out_ep));
+    /* pull up, host sees a connect */
+    usb_loopback_attach(busid, true);
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+
+int usb_dc_deinit(uint8_t busid)
+{
+    size_t flags;
+
+    if (busid >= CONFIG_USB_LOOPBACK_MAX_LINK) {
+        return -USB_ERR_RANGE;
+    }
+
+    flags = usb_osal_enter_critical_section();
+    usb_loopback_attach(busid, false);
+    usb_osal_leave_critical_section(flags);
+
+    usb_dc_low_level_deinit(busid);
+    return 0;
+}
+
+int usbd_set_address(uint8_t busid, const uint8_t addr)
+{
+    g_loopback_link[busid].dev_addr = addr;
+    return 0;
+}
+
+int usbd_set_remote_wakeup(uint8_t busid)
+{
+    (void)busid;
+    return -USB_ERR_NOTSUPP;
+}
+
+uint8_t usbd_get_port_speed(uint8_t busid)
+{
+    (void)busid;
+    return CONFIG_USB_LOOPBACK_SPEED;
+}
+
+int usbd_ep_open(uint8_t busid, const struct usb_endpoint_descriptor *ep)
+{
+    struct usb_loopback_ep *dev_ep;
+    uint8_t ep_idx = USB_EP_GET_IDX(ep->bEndpointAddress);
+    size_t flags;
+
+    if (USB_EP_DIR_IS_OUT(ep->bEndpointAddress)) {
+        dev_ep = &g_loopback_link[busid].out_ep[ep_idx];
+    } else {
+        dev_ep = &g_loopback_link[busid].in_ep[ep_idx];
+    }
+
+    flags = usb_osal_enter_critical_section();
+    dev_ep->ep_mps = USB_GET_MAXPACKETSIZE(ep->wMaxPacketSize);
+    dev_ep->ep_type = USB_GET_ENDPOINT_TYPE(ep->bmAttributes);
+    dev_ep->ep_mult = USB_GET_MULT(ep->wMaxPacketSize);
+    dev_ep->ep_enable = true;
+    dev_ep->ep_stalled = false;
+    dev_ep->xfer_busy = false;
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+
+int usbd_ep_close(uint8_t busid, const uint8_t ep)
+{
+    struct usb_loopback_ep *dev_ep;
+    size_t flags;
+
+    if (USB_EP_DIR_IS_OUT(ep)) {
+        dev_ep = &g_loopback_link[busid].out_ep[USB_EP_GET_IDX(ep)];
+    } else {
+        dev_ep = &g_loopback_link[busid].in_ep[USB_EP_GET_IDX(ep)];
+    }
+
+    flags = usb_osal_enter_critical_section();
+    dev_ep->ep_enable = false;
+    dev_ep->xfer_busy = false;
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+
+int usbd_ep_set_stall(uint8_t busid, const uint8_t ep)
+{
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    if (USB_EP_DIR_IS_OUT(ep)) {
+        g_loopback_link[busid].out_ep[USB_EP_GET_IDX(ep)].ep_stalled = true;
+    } else {
+        g_loopback_link[busid].in_ep[USB_EP_GET_IDX(ep)].ep_stalled = true;
+    }
+    usb_osal_leave_critical_section(flags);
+
+    usb_loopback_kick();
+    return 0;
+}
+
+int usbd_ep_clear_stall(uint8_t busid, const uint8_t ep)
+{
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    if (USB_EP_DIR_IS_OUT(ep)) {
+        g_loopback_link[busid].out_ep[USB_EP_GET_IDX(ep)].ep_stalled = false;
+    } else {
+        g_loopback_link[busid].in_ep[USB_EP_GET_IDX(ep)].ep_stalled = false;
+    }
+    usb_osal_leave_critical_section(flags);
+
+    usb_loopback_kick();
+    return 0;
+}
+
+int usbd_ep_is_stalled(uint8_t busid, const uint8_t ep, uint8_t *stalled)
+{
+    if (USB_EP_DIR_IS_OUT(ep)) {
+        *stalled = g_loopback_link[busid].out_ep[USB_EP_GET_IDX(ep)].ep_stalled;
+    } else {
+        *stalled = g_loopback_link[busid].in_ep[USB_EP_GET_IDX(ep)].ep_stalled;
+    }
+    return 0;
+}
+
+int usbd_ep_start_write(uint8_t busid, const uint8_t ep, const uint8_t *data, uint32_t data_len)
+{
+    struct usb_loopback_ep *dev_ep = &g_loopback_link[busid].in_ep[USB_EP_GET_IDX(ep)];
+    size_t flags;
+
+    if (!data && data_len) {
+        return -USB_ERR_INVAL;
+    }
+    if (!dev_ep->ep_enable) {
+        return -USB_ERR_NODEV;
+    }
+
+    flags = usb_osal_enter_critical_section();
+    dev_ep->xfer_buf = (uint8_t *)data;
+    dev_ep->xfer_len = data_len;
+    dev_ep->actual_xfer_len = 0;
+    dev_ep->xfer_busy = true;
+    usb_osal_leave_critical_section(flags);
+
+    usb_loopback_kick();
+    return 0;
+}
+
+int usbd_ep_start_read(uint8_t busid, const uint8_t ep, uint8_t *data, uint32_t data_len)
+{
+    struct usb_loopback_ep *dev_ep = &g_loopback_link[busid].out_ep[USB_EP_GET_IDX(ep)];
+    size_t flags;
+
+    if (!data && data_len) {
+        return -USB_ERR_INVAL;
+    }
+    if (!dev_ep->ep_enable) {
+        return -USB_ERR_NODEV;
+    }
+
+    flags = usb_osal_enter_critical_section();
+    dev_ep->xfer_buf = data;
+    dev_ep->xfer_len = data_len;
+    dev_ep->actual_xfer_len = 0;
+    dev_ep->xfer_busy = true;
+    usb_osal_leave_critical_section(flags);
+
+    usb_loopback_kick();
+    return 0;
+}
+
+/* Device and host events of one link are handled together in USBH_IRQHandler */
+void USBD_IRQHandler(uint8_t busid)
+{
+    USBH_IRQHandler(busid);
+}
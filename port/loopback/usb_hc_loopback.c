@@ -0,0 +1,775 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usbh_core.h"
+#include "usbh_hub.h"
+#include "usb_loopback.h"
+
+#define LOOPBACK_EP0_STATE_SETUP     0
+#define LOOPBACK_EP0_STATE_INDATA    1
+#define LOOPBACK_EP0_STATE_OUTDATA   2
+#define LOOPBACK_EP0_STATE_INSTATUS  3
+#define LOOPBACK_EP0_STATE_OUTSTATUS 4
+
+/* Bound the work done in one interrupt when both sides keep re-arming from callbacks */
+#define LOOPBACK_IRQ_MAX_LOOPS 64
+
+struct usb_loopback_link g_loopback_link[CONFIG_USB_LOOPBACK_MAX_LINK];
+
+static struct usb_loopback_irq {
+    bool inited;
+    usb_osal_sem_t irq_sem;
+    usb_osal_thread_t irq_thread;
+    struct usb_osal_timer *sof_timer;
+} g_loopback_irq;
+
+/* set whenever a packet or a stage moves, callbacks may have armed an endpoint already visited */
+static bool g_loopback_progress;
+
+static void usb_loopback_irq_thread(CONFIG_USB_OSAL_THREAD_SET_ARGV)
+{
+    size_t flags;
+
+    while (1) {
+        usb_osal_sem_take(g_loopback_irq.irq_sem, USB_OSAL_WAITING_FOREVER);
+
+        flags = usb_osal_enter_critical_section();
+        for (uint8_t busid = 0; busid < CONFIG_USB_LOOPBACK_MAX_LINK; busid++) {
+            USBH_IRQHandler(busid);
+        }
+        usb_osal_leave_critical_section(flags);
+    }
+}
+
+static void usb_loopback_sof_timeout(void *argument)
+{
+    size_t flags;
+
+    (void)argument;
+
+    flags = usb_osal_enter_critical_section();
+    for (uint8_t busid = 0; busid < CONFIG_USB_LOOPBACK_MAX_LINK; busid++) {
+        if (g_loopback_link[busid].port_pe) {
+            g_loopback_link[busid].sof_pending++;
+        }
+    }
+    usb_osal_leave_critical_section(flags);
+
+    usb_loopback_kick();
+}
+
+void usb_loopback_init(void)
+{
+    struct usb_loopback_link *link;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    if (g_loopback_irq.inited) {
+        usb_osal_leave_critical_section(flags);
+        return;
+    }
+    g_loopback_irq.inited = true;
+
+    for (uint8_t busid = 0; busid < CONFIG_USB_LOOPBACK_MAX_LINK; busid++) {
+        link = &g_loopback_link[busid];
+
+        link->ctrl_pipe.waitsem = usb_osal_sem_create(0);
+        usb_slist_init(&link->ctrl_pipe.urb_queue);
+        for (uint8_t i = 0; i < 16; i++) {
+            link->in_pipe[i].waitsem = usb_osal_sem_create(0);
+            usb_slist_init(&link->in_pipe[i].urb_queue);
+            link->out_pipe[i].waitsem = usb_osal_sem_create(0);
+            usb_slist_init(&link->out_pipe[i].urb_queue);
+        }
+    }
+
+    g_loopback_irq.irq_sem = usb_osal_sem_create(0);
+    g_loopback_irq.irq_thread = usb_osal_thread_create("usb_loopback", CONFIG_USB_LOOPBACK_STACKSIZE, CONFIG_USB_LOOPBACK_PRIO, usb_loopback_irq_thread, NULL);
+    g_loopback_irq.sof_timer = usb_osal_timer_create("usb_loopback_sof", 1, usb_loopback_sof_timeout, NULL, true);
+    usb_osal_leave_critical_section(flags);
+
+    usb_osal_timer_start(g_loopback_irq.sof_timer);
+}
+
+void usb_loopback_kick(void)
+{
+    if (g_loopback_irq.inited) {
+        usb_osal_sem_give(g_loopback_irq.irq_sem);
+    }
+}
+
+static void usb_loopback_urb_waitup(struct usb_loopback_pipe *pipe, struct usbh_urb *urb, int errorcode)
+{
+    usb_slist_remove(&pipe->urb_queue, &urb->list);
+    pipe->iso_frame_idx = 0;
+    urb->hcpriv = NULL;
+    urb->errorcode = errorcode;
+    g_loopback_progress = true;
+
+    if (urb->timeout) {
+        usb_osal_sem_give(pipe->waitsem);
+    }
+
+    if (urb->complete) {
+        if (urb->errorcode < 0) {
+            urb->complete(urb->arg, urb->errorcode);
+        } else {
+            urb->complete(urb->arg, urb->actual_length);
+        }
+    }
+}
+
+static void usb_loopback_pipe_abort(struct usb_loopback_pipe *pipe, int errorcode)
+{
+    struct usbh_urb *urb;
+
+    while ((urb = usb_slist_first_entry_or_null(&pipe->urb_queue, struct usbh_urb, list)) != NULL) {
+        usb_loopback_urb_waitup(pipe, urb, errorcode);
+    }
+}
+
+void usb_loopback_attach(uint8_t busid, bool attached)
+{
+    struct usb_loopback_link *link = &g_loopback_link[busid];
+    struct usbh_bus *bus = link->bus;
+
+    link->dev_attached = attached;
+    if (!attached) {
+        link->port_pe = false;
+        usb_loopback_pipe_abort(&link->ctrl_pipe, -USB_ERR_NOTCONN);
+        for (uint8_t i = 0; i < 16; i++) {
+            usb_loopback_pipe_abort(&link->in_pipe[i], -USB_ERR_NOTCONN);
+            usb_loopback_pipe_abort(&link->out_pipe[i], -USB_ERR_NOTCONN);
+        }
+    }
+
+    if (bus) {
+        link->port_csc = true;
+        link->port_pec = true;
+        bus->hcd.roothub.int_buffer[0] = (1 << 1);
+        usbh_hub_thread_wakeup(&bus->hcd.roothub);
+    }
+}
+
+static void usb_loopback_port_reset(uint8_t busid)
+{
+    struct usb_loopback_link *link = &g_loopback_link[busid];
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    if (link->dev_attached) {
+        link->port_pe = true;
+        link->ep0_state = LOOPBACK_EP0_STATE_SETUP;
+        usbd_event_reset_handler(busid);
+    }
+    usb_osal_leave_critical_section(flags);
+}
+
+/* Move packets from urb to device until the urb is done, return false while device naks.
+ * hdr_len bytes of urb->actual_length are not in transfer_buffer, the setup packet of a control urb.
+ */
+static bool usb_loopback_xfer_out(uint8_t busid, struct usbh_urb *urb, uint32_t hdr_len, struct usb_loopback_ep *dev_ep, uint8_t ep)
+{
+    uint32_t offset;
+    uint32_t len;
+    uint32_t copy_len;
+
+    do {
+        if (!dev_ep->xfer_busy) {
+            return false;
+        }
+
+        offset = urb->actual_length - hdr_len;
+        len = MIN(dev_ep->ep_mps, urb->transfer_buffer_length - offset);
+        /* overflow is dropped silently, like a device with a short buffer */
+        copy_len = MIN(len, dev_ep->xfer_len - dev_ep->actual_xfer_len);
+        if (copy_len) {
+            memcpy(dev_ep->xfer_buf + dev_ep->actual_xfer_len, urb->transfer_buffer + offset, copy_len);
+        }
+        urb->actual_length += len;
+        dev_ep->actual_xfer_len += copy_len;
+        g_loopback_progress = true;
+
+        if ((len < dev_ep->ep_mps) || (dev_ep->actual_xfer_len == dev_ep->xfer_len)) {
+            dev_ep->xfer_busy = false;
+            usbd_event_ep_out_complete_handler(busid, ep, dev_ep->actual_xfer_len);
+        }
+    } while ((urb->actual_length - hdr_len) < urb->transfer_buffer_length);
+
+    return true;
+}
+
+/* Move packets from device to urb until a short packet or the urb is full, return false while device naks */
+static bool usb_loopback_xfer_in(uint8_t busid, struct usbh_urb *urb, uint32_t hdr_len, struct usb_loopback_ep *dev_ep, uint8_t ep, int *errorcode)
+{
+    uint32_t offset;
+    uint32_t len;
+    uint32_t copy_len;
+
+    *errorcode = 0;
+    do {
+        if (!dev_ep->xfer_busy) {
+            return false;
+        }
+
+        offset = urb->actual_length - hdr_len;
+        len = MIN(dev_ep->ep_mps, dev_ep->xfer_len - dev_ep->actual_xfer_len);
+        copy_len = MIN(len, urb->transfer_buffer_length - offset);
+        if (copy_len) {
+            memcpy(urb->transfer_buffer + offset, dev_ep->xfer_buf + dev_ep->actual_xfer_len, copy_len);
+        }
+        urb->actual_length += copy_len;
+        dev_ep->actual_xfer_len += len;
+        g_loopback_progress = true;
+
+        if (dev_ep->actual_xfer_len == dev_ep->xfer_len) {
+            dev_ep->xfer_busy = false;
+            usbd_event_ep_in_complete_handler(busid, ep, dev_ep->actual_xfer_len);
+        }
+
+        if (copy_len < len) {
+            *errorcode = -USB_ERR_BABBLE;
+            return true;
+        }
+    } while ((len == dev_ep->ep_mps) && ((urb->actual_length - hdr_len) < urb->transfer_buffer_length));
+
+    return true;
+}
+
+static void usb_loopback_ep0_handler(uint8_t busid)
+{
+    struct usb_loopback_link *link = &g_loopback_link[busid];
+    struct usb_loopback_pipe *pipe = &link->ctrl_pipe;
+    struct usbh_urb *urb;
+    int errorcode;
+
+    urb = usb_slist_first_entry_or_null(&pipe->urb_queue, struct usbh_urb, list);
+    if (urb == NULL) {
+        return;
+    }
+
+    if (link->ep0_state == LOOPBACK_EP0_STATE_SETUP) {
+        /* nobody answers at this address */
+        if (urb->hport->dev_addr != link->dev_addr) {
+            usb_loopback_urb_waitup(pipe, urb, -USB_ERR_IO);
+            return;
+        }
+
+        /* setup clears ep0 halt and any pending stage */
+        link->in_ep[0].ep_stalled = false;
+        link->out_ep[0].ep_stalled = false;
+        link->in_ep[0].xfer_busy = false;
+        link->out_ep[0].xfer_busy = false;
+
+        if (urb->setup->wLength == 0) {
+            link->ep0_state = LOOPBACK_EP0_STATE_INSTATUS;
+        } else if (urb->setup->bmRequestType & 0x80) {
+            link->ep0_state = LOOPBACK_EP0_STATE_INDATA;
+        } else {
+            link->ep0_state = LOOPBACK_EP0_STATE_OUTDATA;
+        }
+
+        memcpy(&link->setup, urb->setup, 8);
+        /* like ehci, dwc2 and musb, a control urb counts its setup packet */
+        urb->actual_length += 8;
+        g_loopback_progress = true;
+        usbd_event_ep0_setup_complete_handler(busid, (uint8_t *)&link->setup);
+        return;
+    }
+
+    if (link->in_ep[0].ep_stalled || link->out_ep[0].ep_stalled) {
+        link->ep0_state = LOOPBACK_EP0_STATE_SETUP;
+        usb_loopback_urb_waitup(pipe, urb, -USB_ERR_STALL);
+        return;
+    }
+
+    switch (link->ep0_state) {
+        case LOOPBACK_EP0_STATE_INDATA:
+            if (!usb_loopback_xfer_in(busid, urb, 8, &link->in_ep[0], USB_CONTROL_IN_EP0, &errorcode)) {
+                return;
+            }
+            if (errorcode < 0) {
+                link->ep0_state = LOOPBACK_EP0_STATE_SETUP;
+                usb_loopback_urb_waitup(pipe, urb, errorcode);
+                return;
+            }
+            link->ep0_state = LOOPBACK_EP0_STATE_OUTSTATUS;
+            return;
+        case LOOPBACK_EP0_STATE_OUTDATA:
+            if (!usb_loopback_xfer_out(busid, urb, 8, &link->out_ep[0], USB_CONTROL_OUT_EP0)) {
+                return;
+            }
+            link->ep0_state = LOOPBACK_EP0_STATE_INSTATUS;
+            return;
+        case LOOPBACK_EP0_STATE_OUTSTATUS:
+            if (!link->out_ep[0].xfer_busy) {
+                return;
+            }
+            link->out_ep[0].xfer_busy = false;
+            usbd_event_ep_out_complete_handler(busid, USB_CONTROL_OUT_EP0, 0);
+            link->ep0_state = LOOPBACK_EP0_STATE_SETUP;
+            usb_loopback_urb_waitup(pipe, urb, 0);
+            return;
+        case LOOPBACK_EP0_STATE_INSTATUS:
+            if (!link->in_ep[0].xfer_busy) {
+                return;
+            }
+            link->in_ep[0].xfer_busy = false;
+            usbd_event_ep_in_complete_handler(busid, USB_CONTROL_IN_EP0, 0);
+            link->ep0_state = LOOPBACK_EP0_STATE_SETUP;
+            usb_loopback_urb_waitup(pipe, urb, 0);
+            return;
+        default:
+            break;
+    }
+}
+
+static void usb_loopback_bulk_intr_handler(uint8_t busid, uint8_t ep)
+{
+    struct usb_loopback_link *link = &g_loopback_link[busid];
+    struct usb_loopback_pipe *pipe;
+    struct usb_loopback_ep *dev_ep;
+    struct usbh_urb *urb;
+    int errorcode = 0;
+
+    if (ep & 0x80) {
+        pipe = &link->in_pipe[ep & 0x0f];
+        dev_ep = &link->in_ep[ep & 0x0f];
+    } else {
+        pipe = &link->out_pipe[ep & 0x0f];
+        dev_ep = &link->out_ep[ep & 0x0f];
+    }
+
+    urb = usb_slist_first_entry_or_null(&pipe->urb_queue, struct usbh_urb, list);
+    if ((urb == NULL) || (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS)) {
+        return;
+    }
+
+    if (!dev_ep->ep_enable) {
+        return;
+    }
+
+    if (dev_ep->ep_stalled) {
+        usb_loopback_urb_waitup(pipe, urb, -USB_ERR_STALL);
+        return;
+    }
+
+    if (ep & 0x80) {
+        if (!usb_loopback_xfer_in(busid, urb, 0, dev_ep, ep, &errorcode)) {
+            return;
+        }
+    } else {
+        if (!usb_loopback_xfer_out(busid, urb, 0, dev_ep, ep)) {
+            return;
+        }
+    }
+
+    usb_loopback_urb_waitup(pipe, urb, errorcode);
+    return;
+}
+
+/* One packet per (micro)frame whatever bInterval says */
+static void usb_loopback_iso_handler(uint8_t busid, uint8_t ep)
+{
+    struct usb_loopback_link *link = &g_loopback_link[busid];
+    struct usb_loopback_pipe *pipe;
+    struct usb_loopback_ep *dev_ep;
+    struct usbh_iso_frame_packet *iso_packet;
+    struct usbh_urb *urb;
+    uint32_t len;
+    uint8_t npackets;
+
+    if (ep & 0x80) {
+        pipe = &link->in_pipe[ep & 0x0f];
+        dev_ep = &link->in_ep[ep & 0x0f];
+    } else {
+        pipe = &link->out_pipe[ep & 0x0f];
+        dev_ep = &link->out_ep[ep & 0x0f];
+    }
+
+    npackets = (CONFIG_USB_LOOPBACK_SPEED == USB_SPEED_HIGH) ? 8 : 1;
+
+    while (npackets--) {
+        urb = usb_slist_first_entry_or_null(&pipe->urb_queue, struct usbh_urb, list);
+        if ((urb == NULL) || (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) != USB_ENDPOINT_TYPE_ISOCHRONOUS)) {
+            return;
+        }
+
+        iso_packet = &urb->iso_packet[pipe->iso_frame_idx];
+        len = 0;
+
+        if (dev_ep->ep_enable && dev_ep->xfer_busy) {
+            if (ep & 0x80) {
+                len = MIN(dev_ep->xfer_len - dev_ep->actual_xfer_len, dev_ep->ep_mps * (dev_ep->ep_mult + 1));
+                len = MIN(len, iso_packet->transfer_buffer_length);
+                if (len) {
+                    memcpy(iso_packet->transfer_buffer, dev_ep->xfer_buf + dev_ep->actual_xfer_len, len);
+                }
+                dev_ep->actual_xfer_len += len;
+                if (dev_ep->actual_xfer_len == dev_ep->xfer_len) {
+                    dev_ep->xfer_busy = false;
+                    usbd_event_ep_in_complete_handler(busid, ep, dev_ep->actual_xfer_len);
+                }
+            } else {
+                len = MIN(iso_packet->transfer_buffer_length, dev_ep->xfer_len);
+                if (len) {
+                    memcpy(dev_ep->xfer_buf, iso_packet->transfer_buffer, len);
+                }
+                dev_ep->actual_xfer_len = len;
+                dev_ep->xfer_busy = false;
+                usbd_event_ep_out_complete_handler(busid, ep, len);
+            }
+        }
+
+        /* nothing armed on device, the packet is lost */
+        iso_packet->actual_length = len;
+        iso_packet->errorcode = 0;
+        urb->actual_length += len;
+
+        pipe->iso_frame_idx++;
+        if (pipe->iso_frame_idx == urb->num_of_iso_packets) {
+            usb_loopback_urb_waitup(pipe, urb, 0);
+        }
+    }
+}
+
+int usb_hc_init(struct usbh_bus *bus)
+{
+    struct usb_loopback_link *link;
+    size_t flags;
+
+    if (bus->busid >= CONFIG_USB_LOOPBACK_MAX_LINK) {
+        return -USB_ERR_RANGE;
+    }
+
+    link = &g_loopback_link[bus->busid];
+
+    usb_loopback_init();
+
+    flags = usb_osal_enter_critical_section();
+    link->bus = bus;
+    link->port_pe = false;
+    link->ep0_state = LOOPBACK_EP0_STATE_SETUP;
+    link->sof_pending = 0;
+    link->frame_number = 0;
+    /* device was plugged before host started */
+    if (link->dev_attached) {
+        link->port_csc = true;
+        bus->hcd.roothub.int_buffer[0] = (1 << 1);
+        usbh_hub_thread_wakeup(&bus->hcd.roothub);
+    }
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+
+int usb_hc_deinit(struct usbh_bus *bus)
+{
+    struct usb_loopback_link *link = &g_loopback_link[bus->busid];
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    link->port_pe = false;
+    usb_loopback_pipe_abort(&link->ctrl_pipe, -USB_ERR_SHUTDOWN);
+    for (uint8_t i = 0; i < 16; i++) {
+        usb_loopback_pipe_abort(&link->in_pipe[i], -USB_ERR_SHUTDOWN);
+        usb_loopback_pipe_abort(&link->out_pipe[i], -USB_ERR_SHUTDOWN);
+    }
+    link->bus = NULL;
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+
+uint16_t usbh_get_frame_number(struct usbh_bus *bus)
+{
+    return g_loopback_link[bus->busid].frame_number;
+}
+
+int usbh_roothub_control(struct usbh_bus *bus, struct usb_setup_packet *setup, uint8_t *buf)
+{
+    struct usb_loopback_link *link = &g_loopback_link[bus->busid];
+    uint8_t nports;
+    uint8_t port;
+    uint32_t status;
+
+    nports = 1;
+    port = setup->wIndex;
+    if (setup->bmRequestType & USB_REQUEST_RECIPIENT_DEVICE) {
+        switch (setup->bRequest) {
+            case HUB_REQUEST_CLEAR_FEATURE:
+                switch (setup->wValue) {
+                    case HUB_FEATURE_HUB_C_LOCALPOWER:
+                        break;
+                    case HUB_FEATURE_HUB_C_OVERCURRENT:
+                        break;
+                    default:
+                        return -USB_ERR_INVAL;
+                }
+                break;
+            case HUB_REQUEST_SET_FEATURE:
+                switch (setup->wValue) {
+                    case HUB_FEATURE_HUB_C_LOCALPOWER:
+                        break;
+                    case HUB_FEATURE_HUB_C_OVERCURRENT:
+                        break;
+                    default:
+                        return -USB_ERR_INVAL;
+                }
+                break;
+            case HUB_REQUEST_GET_DESCRIPTOR:
+                break;
+            case HUB_REQUEST_GET_STATUS:
+                memset(buf, 0, 4);
+                break;
+            default:
+                break;
+        }
+    } else if (setup->bmRequestType & USB_REQUEST_RECIPIENT_OTHER) {
+        switch (setup->bRequest) {
+            case HUB_REQUEST_CLEAR_FEATURE:
+                if (!port || port > nports) {
+                    return -USB_ERR_INVAL;
+                }
+
+                switch (setup->wValue) {
+                    case HUB_PORT_FEATURE_ENABLE:
+                        link->port_pe = false;
+                        break;
+                    case HUB_PORT_FEATURE_SUSPEND:
+                    case HUB_PORT_FEATURE_C_SUSPEND:
+                        break;
+                    case HUB_PORT_FEATURE_POWER:
+                        break;
+                    case HUB_PORT_FEATURE_C_CONNECTION:
+                        link->port_csc = false;
+                        break;
+                    case HUB_PORT_FEATURE_C_ENABLE:
+                        link->port_pec = false;
+                        break;
+                    case HUB_PORT_FEATURE_C_OVER_CURREN:
+                        break;
+                    case HUB_PORT_FEATURE_C_RESET:
+                        break;
+                    default:
+                        return -USB_ERR_INVAL;
+                }
+                break;
+            case HUB_REQUEST_SET_FEATURE:
+                if (!port || port > nports) {
+                    return -USB_ERR_INVAL;
+                }
+
+                switch (setup->wValue) {
+                    case HUB_PORT_FEATURE_SUSPEND:
+                        break;
+                    case HUB_PORT_FEATURE_POWER:
+                        break;
+                    case HUB_PORT_FEATURE_RESET:
+                        usb_loopback_port_reset(bus->busid);
+                        break;
+
+                    default:
+                        return -USB_ERR_INVAL;
+                }
+                break;
+            case HUB_REQUEST_GET_STATUS:
+                if (!port || port > nports) {
+                    return -USB_ERR_INVAL;
+                }
+
+                status = 0;
+                if (link->port_csc) {
+                    status |= (1 << HUB_PORT_FEATURE_C_CONNECTION);
+                }
+                if (link->port_pec) {
+                    status |= (1 << HUB_PORT_FEATURE_C_ENABLE);
+                }
+
+                if (link->dev_attached) {
+                    status |= (1 << HUB_PORT_FEATURE_CONNECTION);
+                    if (link->port_pe) {
+                        status |= (1 << HUB_PORT_FEATURE_ENABLE);
+                    }
+                    if (CONFIG_USB_LOOPBACK_SPEED == USB_SPEED_LOW) {
+                        status |= (1 << HUB_PORT_FEATURE_LOWSPEED);
+                    } else if (CONFIG_USB_LOOPBACK_SPEED == USB_SPEED_HIGH) {
+                        status |= (1 << HUB_PORT_FEATURE_HIGHSPEED);
+                    }
+                }
+
+                status |= (1 << HUB_PORT_FEATURE_POWER);
+                memcpy(buf, &status, 4);
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+int usbh_submit_urb(struct usbh_urb *urb)
+{
+    struct usb_loopback_link *link;
+    struct usb_loopback_pipe *pipe;
+    struct usbh_bus *bus;
+    uint8_t ep_idx;
+    size_t flags;
+    int ret = 0;
+
+    if (!urb || !urb->hport || !urb->ep || !urb->hport->bus) {
+        return -USB_ERR_INVAL;
+    }
+
+    if (!urb->hport->connected) {
+        return -USB_ERR_NOTCONN;
+    }
+
+    if (urb->errorcode == -USB_ERR_BUSY) {
+        return -USB_ERR_BUSY;
+    }
+
+    bus = urb->hport->bus;
+    link = &g_loopback_link[bus->busid];
+    ep_idx = urb->ep->bEndpointAddress & 0x0f;
+
+    if (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_CONTROL) {
+        pipe = &link->ctrl_pipe;
+    } else if (urb->ep->bEndpointAddress & 0x80) {
+        pipe = &link->in_pipe[ep_idx];
+    } else {
+        pipe = &link->out_pipe[ep_idx];
+    }
+
+    flags = usb_osal_enter_critical_section();
+
+    if (!link->port_pe) {
+        usb_osal_leave_critical_section(flags);
+        return -USB_ERR_NOTCONN;
+    }
+
+    if (!usb_slist_isempty(&pipe->urb_queue)) {
+#ifdef CONFIG_USBHOST_URB_QUEUE
+        struct usbh_urb *head = usb_slist_first_entry(&pipe->urb_queue, struct usbh_urb, list);
+
+        /* poll mode urb owns pipe->waitsem, so it can neither wait behind nor be followed by other urbs */
+        if (urb->timeout || head->timeout ||
+            (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_CONTROL) ||
+            (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS)) {
+            usb_osal_leave_critical_section(flags);
+            return -USB_ERR_BUSY;
+        }
+#else
+        usb_osal_leave_critical_section(flags);
+        return -USB_ERR_BUSY;
+#endif
+    } else {
+        pipe->iso_frame_idx = 0;
+        if (pipe == &link->ctrl_pipe) {
+            link->ep0_state = LOOPBACK_EP0_STATE_SETUP;
+        }
+    }
+
+    urb->hcpriv = pipe;
+    urb->errorcode = -USB_ERR_BUSY;
+    urb->actual_length = 0;
+    if (urb->timeout > 0) {
+        usb_osal_sem_reset(pipe->waitsem);
+    }
+    usb_slist_add_tail(&pipe->urb_queue, &urb->list);
+
+    usb_osal_leave_critical_section(flags);
+
+    usb_loopback_kick();
+
+    if (urb->timeout > 0) {
+        /* wait until timeout or sem give */
+        ret = usb_osal_sem_take(pipe->waitsem, urb->timeout);
+        if (ret < 0) {
+            goto errout_timeout;
+        }
+        urb->timeout = 0;
+        ret = urb->errorcode;
+    }
+    return ret;
+errout_timeout:
+    urb->timeout = 0;
+    usbh_kill_urb(urb);
+    return ret;
+}
+
+int usbh_kill_urb(struct usbh_urb *urb)
+{
+    struct usb_loopback_link *link;
+    struct usb_loopback_pipe *pipe;
+    struct usbh_urb *cur;
+    size_t flags;
+
+    if (!urb || !urb->hcpriv || !urb->hport->bus) {
+        return -USB_ERR_INVAL;
+    }
+
+    link = &g_loopback_link[urb->hport->bus->busid];
+
+    flags = usb_osal_enter_critical_section();
+
+    pipe = (struct usb_loopback_pipe *)urb->hcpriv;
+    if (pipe == NULL) {
+        usb_osal_leave_critical_section(flags);
+        return -USB_ERR_INVAL;
+    }
+
+    if (pipe == &link->ctrl_pipe) {
+        link->ep0_state = LOOPBACK_EP0_STATE_SETUP;
+    }
+
+    /* urbs queued on the pipe are cancelled together */
+    while ((cur = usb_slist_first_entry_or_null(&pipe->urb_queue, struct usbh_urb, list)) != NULL) {
+        usb_slist_remove(&pipe->urb_queue, &cur->list);
+        cur->hcpriv = NULL;
+        cur->errorcode = -USB_ERR_SHUTDOWN;
+        if (cur->timeout) {
+            usb_osal_sem_give(pipe->waitsem);
+        }
+    }
+    pipe->iso_frame_idx = 0;
+
+    usb_osal_leave_critical_section(flags);
+    return 0;
+}
+
+void USBH_IRQHandler(uint8_t busid)
+{
+    struct usb_loopback_link *link = &g_loopback_link[busid];
+    uint32_t loops = 0;
+
+    if (!link->dev_attached || !link->port_pe) {
+        return;
+    }
+
+    while (link->sof_pending) {
+        link->sof_pending--;
+        link->frame_number = (link->frame_number + 1) & 0x7ff;
+#ifdef CONFIG_USBDEV_SOF_ENABLE
+        usbd_event_sof_handler(busid);
+#endif
+        for (uint8_t i = 1; i < 16; i++) {
+            usb_loopback_iso_handler(busid, i | 0x80);
+            usb_loopback_iso_handler(busid, i);
+        }
+    }
+
+    do {
+        g_loopback_progress = false;
+        usb_loopback_ep0_handler(busid);
+        for (uint8_t i = 1; i < 16; i++) {
+            usb_loopback_bulk_intr_handler(busid, i | 0x80);
+            usb_loopback_bulk_intr_handler(busid, i);
+        }
+        if (++loops == LOOPBACK_IRQ_MAX_LOOPS) {
+            /* let other threads in, come back later */
+            usb_loopback_kick();
+            break;
+        }
+    } while (g_loopback_progress);
+}
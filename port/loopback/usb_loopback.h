@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef USB_LOOPBACK_H
+#define USB_LOOPBACK_H
+
+#include "usb_config.h"
+#include "usb_util.h"
+#include "usb_def.h"
+#include "usb_list.h"
+#include "usb_osal.h"
+#include "usb_dc.h"
+#include "usb_hc.h"
+
+/* Device bus n is plugged into the only roothub port of host bus n */
+#ifndef CONFIG_USB_LOOPBACK_MAX_LINK
+#define CONFIG_USB_LOOPBACK_MAX_LINK 1
+#endif
+
+#ifndef CONFIG_USB_LOOPBACK_SPEED
+#define CONFIG_USB_LOOPBACK_SPEED USB_SPEED_HIGH
+#endif
+
+/* Thread that plays the role of the controller interrupt */
+#ifndef CONFIG_USB_LOOPBACK_PRIO
+#define CONFIG_USB_LOOPBACK_PRIO 0
+#endif
+
+#ifndef CONFIG_USB_LOOPBACK_STACKSIZE
+#define CONFIG_USB_LOOPBACK_STACKSIZE 4096
+#endif
+
+/* Device endpoint state */
+struct usb_loopback_ep {
+    uint16_t ep_mps;    /* Endpoint max packet size */
+    uint8_t ep_type;    /* Endpoint type */
+    uint8_t ep_mult;    /* Additional transactions per microframe */
+    bool ep_enable;     /* Endpoint open flag */
+    bool ep_stalled;    /* Endpoint stall flag */
+    bool xfer_busy;     /* start_read/start_write is pending */
+    uint8_t *xfer_buf;
+    uint32_t xfer_len;
+    uint32_t actual_xfer_len;
+};
+
+/* Host endpoint state, the head of urb_queue is the urb in progress */
+struct usb_loopback_pipe {
+    usb_osal_sem_t waitsem;
+    usb_slist_t urb_queue;
+    uint32_t iso_frame_idx;
+};
+
+struct usb_loopback_link {
+    /* device side */
+    bool dev_attached;
+    volatile uint8_t dev_addr;
+    struct usb_loopback_ep in_ep[16];
+    struct usb_loopback_ep out_ep[16];
+    /* host side */
+    struct usbh_bus *bus;
+    bool port_csc;
+    bool port_pec;
+    bool port_pe;
+    uint8_t ep0_state;
+    struct usb_setup_packet setup;
+    struct usb_loopback_pipe ctrl_pipe;
+    struct usb_loopback_pipe in_pipe[16];
+    struct usb_loopback_pipe out_pipe[16];
+    uint32_t sof_pending;
+    uint16_t frame_number;
+};
+
+extern struct usb_loopback_link g_loopback_link[CONFIG_USB_LOOPBACK_MAX_LINK];
+
+/* Start the controller thread and sof timer once */
+void usb_loopback_init(void);
+/* Raise the controller interrupt */
+void usb_loopback_kick(void);
+/* Device pulls up or releases the line, called in critical section */
+void usb_loopback_attach(uint8_t busid, bool attached);
+
+#endif /* USB_LOOPBACK_H */
@@ -7,6 +7,10 @@
 #include "usbh_hub.h"
 #include "usb_musb_reg.h"
 
+#ifdef CONFIG_USBHOST_URB_QUEUE
+#error "musb hcd has one fifo per endpoint and cannot queue urbs, please disable CONFIG_USBHOST_URB_QUEUE"
+#endif
+
 #define HWREG(x) \
     (*((volatile uint32_t *)(x)))
 #define HWREGH(x) \
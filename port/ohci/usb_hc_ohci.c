@@ -18,20 +18,784 @@
 struct ohci_hcd g_ohci_hcd[CONFIG_USBHOST_MAX_BUS];
 
 USB_NOCACHE_RAM_SECTION struct ohci_ed_hw g_ohci_ed_pool[CONFIG_USBHOST_MAX_BUS][CONFIG_USB_OHCI_ED_NUM];
+USB_NOCACHE_RAM_SECTION struct ohci_td_hw g_ohci_td_pool[CONFIG_USBHOST_MAX_BUS][CONFIG_USB_OHCI_ED_NUM * CONFIG_USB_OHCI_TD_NUM];
 USB_NOCACHE_RAM_SECTION struct ohci_hcca ohci_hcca[CONFIG_USBHOST_MAX_BUS];
 
+/* Periodic tree, node (interval, branch) is g_ohci_int_ed[interval - 1 + branch] and it is
+ * visited in every frame whose number modulo interval equals branch.
+ */
+USB_NOCACHE_RAM_SECTION struct ohci_ed g_ohci_int_ed[CONFIG_USBHOST_MAX_BUS][OHCI_INT_ED_NUM] __attribute__((aligned(16)));
+
+static struct ohci_td_hw *ohci_td_alloc(struct usbh_bus *bus)
+{
+    struct ohci_td_hw *td;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    td = g_ohci_hcd[bus->hcd.hcd_id].td_free;
+    if (td == NULL) {
+        usb_osal_leave_critical_section(flags);
+        return NULL;
+    }
+    g_ohci_hcd[bus->hcd.hcd_id].td_free = td->free_next;
+    td->inuse = true;
+    usb_osal_leave_critical_section(flags);
+
+    memset(&td->hw, 0, sizeof(struct ohci_gtd));
+    td->urb = NULL;
+    td->next_td = NULL;
+    td->done_next = NULL;
+    td->free_next = NULL;
+    td->last = false;
+    td->buf_start = 0;
+    td->length = 0;
+
+    return td;
+}
+
+static void ohci_td_free(struct usbh_bus *bus, struct ohci_td_hw *td)
+{
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    if (td->inuse) {
+        td->inuse = false;
+        td->urb = NULL;
+        td->free_next = g_ohci_hcd[bus->hcd.hcd_id].td_free;
+        g_ohci_hcd[bus->hcd.hcd_id].td_free = td;
+    }
+    usb_osal_leave_critical_section(flags);
+}
+
+static struct ohci_ed_hw *ohci_ed_alloc(struct usbh_bus *bus)
+{
+    struct ohci_ed_hw *ed;
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    ed = g_ohci_hcd[bus->hcd.hcd_id].ed_free;
+    if (ed == NULL) {
+        usb_osal_leave_critical_section(flags);
+        return NULL;
+    }
+    g_ohci_hcd[bus->hcd.hcd_id].ed_free = ed->free_next;
+    ed->inuse = true;
+    usb_osal_leave_critical_section(flags);
+
+    memset(&ed->hw, 0, sizeof(struct ohci_ed));
+    ed->head_td = NULL;
+    ed->dummy_td = NULL;
+    ed->free_next = NULL;
+    ed->hport = NULL;
+    ed->int_interval = 0;
+    ed->int_branch = 0;
+
+    return ed;
+}
+
+static void ohci_ed_free(struct usbh_bus *bus, struct ohci_ed_hw *ed)
+{
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    if (ed->inuse) {
+        ed->inuse = false;
+        ed->hport = NULL;
+        ed->free_next = g_ohci_hcd[bus->hcd.hcd_id].ed_free;
+        g_ohci_hcd[bus->hcd.hcd_id].ed_free = ed;
+    }
+    usb_osal_leave_critical_section(flags);
+}
+
+/* Wait for the controller to move on to the next frame, so it drops any ed it has cached.
+ * Reached from usbh_submit_urb in irq context, so poll instead of sleeping.
+ */
+static int ohci_wait_sof(struct usbh_bus *bus)
+{
+    volatile uint32_t timeout = 0;
+
+    if ((OHCI_HCOR->hccontrol & OHCI_CTRL_HCFS_MASK) != OHCI_CTRL_HCFS_OPER) {
+        return 0;
+    }
+
+    OHCI_HCOR->hcintsts = OHCI_INT_SF;
+    while (!(OHCI_HCOR->hcintsts & OHCI_INT_SF)) {
+        timeout++;
+        if (timeout > 1000000) {
+            return -USB_ERR_TIMEOUT;
+        }
+    }
+    return 0;
+}
+
+static void ohci_int_tree_init(struct usbh_bus *bus)
+{
+    struct ohci_ed *node;
+    uint32_t interval;
+    uint32_t branch;
+
+    memset(g_ohci_int_ed[bus->hcd.hcd_id], 0, sizeof(struct ohci_ed) * OHCI_INT_ED_NUM);
+
+    for (interval = 1; interval <= HCCA_INTTBL_WSIZE; interval <<= 1) {
+        for (branch = 0; branch < interval; branch++) {
+            node = &g_ohci_int_ed[bus->hcd.hcd_id][interval - 1 + branch];
+            node->ctrl = ED_CONTROL_SKIP;
+            if (interval > 1) {
+                node->nexted = OHCI_PTR2ADDR(&g_ohci_int_ed[bus->hcd.hcd_id][(interval >> 1) - 1 + (branch % (interval >> 1))]);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < HCCA_INTTBL_WSIZE; i++) {
+        ohci_hcca[bus->hcd.hcd_id].inttbl[i] = OHCI_PTR2ADDR(&g_ohci_int_ed[bus->hcd.hcd_id][HCCA_INTTBL_WSIZE - 1 + i]);
+    }
+
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)g_ohci_int_ed[bus->hcd.hcd_id], USB_ALIGN_UP(sizeof(struct ohci_ed) * OHCI_INT_ED_NUM, CONFIG_USB_ALIGN_SIZE));
+    usb_dcache_clean((uintptr_t)&ohci_hcca[bus->hcd.hcd_id], sizeof(struct ohci_hcca));
+#endif
+}
+
+static void ohci_int_ed_link(struct usbh_bus *bus, struct ohci_ed_hw *ed, uint8_t binterval)
+{
+    struct ohci_hcd *hcd = &g_ohci_hcd[bus->hcd.hcd_id];
+    struct ohci_ed *node;
+    uint32_t interval;
+    uint32_t load;
+    uint32_t best_load = UINT32_MAX;
+    uint32_t best_branch = 0;
+    uint16_t mps;
+
+    interval = HCCA_INTTBL_WSIZE;
+    while ((interval > 1) && (interval > binterval)) {
+        interval >>= 1;
+    }
+
+    /* pick the branch whose busiest frame is the least loaded */
+    for (uint32_t branch = 0; branch < interval; branch++) {
+        load = 0;
+        for (uint32_t frame = branch; frame < HCCA_INTTBL_WSIZE; frame += interval) {
+            if (hcd->frame_load[frame] > load) {
+                load = hcd->frame_load[frame];
+            }
+        }
+        if (load < best_load) {
+            best_load = load;
+            best_branch = branch;
+        }
+    }
+
+    mps = (ed->hw.ctrl & ED_CONTROL_MPS_MASK) >> ED_CONTROL_MPS_SHIFT;
+    for (uint32_t frame = best_branch; frame < HCCA_INTTBL_WSIZE; frame += interval) {
+        hcd->frame_load[frame] += mps;
+    }
+
+    ed->int_interval = interval;
+    ed->int_branch = best_branch;
+
+    node = &g_ohci_int_ed[bus->hcd.hcd_id][interval - 1 + best_branch];
+    ed->hw.nexted = node->nexted;
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)&ed->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+    usb_ohci_wmb();
+    node->nexted = OHCI_PTR2ADDR(ed);
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)node, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+}
+
+static void ohci_int_ed_unlink(struct usbh_bus *bus, struct ohci_ed_hw *ed)
+{
+    struct ohci_hcd *hcd = &g_ohci_hcd[bus->hcd.hcd_id];
+    struct ohci_ed *prev;
+    uint16_t mps;
+
+    prev = &g_ohci_int_ed[bus->hcd.hcd_id][ed->int_interval - 1 + ed->int_branch];
+    while (prev && (OHCI_PTR2ADDR(prev->nexted) != OHCI_PTR2ADDR(ed))) {
+        prev = (struct ohci_ed *)(uintptr_t)OHCI_PTR2ADDR(prev->nexted);
+    }
+    if (prev) {
+        prev->nexted = ed->hw.nexted;
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+        usb_dcache_clean((uintptr_t)prev, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+    }
+
+    mps = (ed->hw.ctrl & ED_CONTROL_MPS_MASK) >> ED_CONTROL_MPS_SHIFT;
+    for (uint32_t frame = ed->int_branch; frame < HCCA_INTTBL_WSIZE; frame += ed->int_interval) {
+        hcd->frame_load[frame] -= mps;
+    }
+}
+
+static void ohci_async_ed_link(struct usbh_bus *bus, struct ohci_ed_hw *ed)
+{
+    volatile uint32_t *head;
+
+    if (ed->ed_type == USB_ENDPOINT_TYPE_CONTROL) {
+        head = &OHCI_HCOR->hccontrolheaded;
+    } else {
+        head = &OHCI_HCOR->hcbulkheaded;
+    }
+
+    /* controller reloads the head register only at the end of the list */
+    ed->hw.nexted = *head;
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)&ed->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+    usb_ohci_wmb();
+    *head = OHCI_PTR2ADDR(ed);
+}
+
+static uint32_t ohci_async_list_enable(struct ohci_ed_hw *ed)
+{
+    return (ed->ed_type == USB_ENDPOINT_TYPE_CONTROL) ? OHCI_CTRL_CLE : OHCI_CTRL_BLE;
+}
+
+/* List must have been disabled for a frame */
+static void ohci_async_ed_unlink(struct usbh_bus *bus, struct ohci_ed_hw *ed)
+{
+    volatile uint32_t *head;
+    volatile uint32_t *current;
+    struct ohci_ed *prev;
+
+    if (ed->ed_type == USB_ENDPOINT_TYPE_CONTROL) {
+        head = &OHCI_HCOR->hccontrolheaded;
+        current = &OHCI_HCOR->hccontrolcurrented;
+    } else {
+        head = &OHCI_HCOR->hcbulkheaded;
+        current = &OHCI_HCOR->hcbulkcurrented;
+    }
+
+    if (OHCI_PTR2ADDR(*head) == OHCI_PTR2ADDR(ed)) {
+        *head = ed->hw.nexted;
+    } else {
+        prev = (struct ohci_ed *)(uintptr_t)OHCI_PTR2ADDR(*head);
+        while (prev && (OHCI_PTR2ADDR(prev->nexted) != OHCI_PTR2ADDR(ed))) {
+            prev = (struct ohci_ed *)(uintptr_t)OHCI_PTR2ADDR(prev->nexted);
+        }
+        if (prev) {
+            prev->nexted = ed->hw.nexted;
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+            usb_dcache_clean((uintptr_t)prev, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+        }
+    }
+
+    if (OHCI_PTR2ADDR(*current) == OHCI_PTR2ADDR(ed)) {
+        *current = 0;
+    }
+}
+
+static uint32_t ohci_ed_ctrl(struct usbh_urb *urb)
+{
+    uint32_t ctrl;
+
+    ctrl = ((uint32_t)urb->hport->dev_addr << ED_CONTROL_FA_SHIFT) |
+           ((uint32_t)USB_EP_GET_IDX(urb->ep->bEndpointAddress) << ED_CONTROL_EN_SHIFT) |
+           ((uint32_t)USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize) << ED_CONTROL_MPS_SHIFT);
+
+    if (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes) == USB_ENDPOINT_TYPE_CONTROL) {
+        ctrl |= ED_CONTROL_D_TD1;
+    } else if (urb->ep->bEndpointAddress & 0x80) {
+        ctrl |= ED_CONTROL_D_IN;
+    } else {
+        ctrl |= ED_CONTROL_D_OUT;
+    }
+
+    if (urb->hport->speed == USB_SPEED_LOW) {
+        ctrl |= ED_CONTROL_SPPED_LOW;
+    }
+    return ctrl;
+}
+
+static void ohci_urb_giveback(struct ohci_ed_hw *ed, struct usbh_urb *urb)
+{
+    if (urb->timeout) {
+        usb_osal_sem_give(ed->waitsem);
+    }
+
+    if (urb->complete) {
+        if (urb->errorcode < 0) {
+            urb->complete(urb->arg, urb->errorcode);
+        } else {
+            urb->complete(urb->arg, urb->actual_length);
+        }
+    }
+}
+
+static void ohci_ed_restart(struct usbh_bus *bus, struct ohci_ed_hw *ed)
+{
+    if (ed->ed_type == USB_ENDPOINT_TYPE_CONTROL) {
+        OHCI_HCOR->hccmdsts = OHCI_CMDST_CLF;
+    } else if (ed->ed_type == USB_ENDPOINT_TYPE_BULK) {
+        OHCI_HCOR->hccmdsts = OHCI_CMDST_BLF;
+    }
+}
+
+static void ohci_td_retire(struct usbh_bus *bus, struct ohci_td_hw *td)
+{
+    struct ohci_ed_hw *ed;
+    struct ohci_td_hw *next_td;
+    struct usbh_urb *urb;
+    uint32_t cc;
+    uint32_t carry;
+    bool last;
+
+    urb = td->urb;
+    if (!td->inuse || (urb == NULL)) {
+        return;
+    }
+    ed = (struct ohci_ed_hw *)urb->hcpriv;
+
+    cc = (td->hw.ctrl & GTD_STATUS_CC_MASK) >> GTD_STATUS_CC_SHIFT;
+    if (td->length && ((cc == TD_CC_NOERROR) || (cc == TD_CC_DATAUNDERRUN))) {
+        /* cbp is zero when the whole buffer was transferred */
+        urb->actual_length += td->hw.cbp ? (td->hw.cbp - td->buf_start) : td->length;
+    }
+
+    last = td->last;
+    ed->head_td = td->next_td;
+    ohci_td_free(bus, td);
+
+    if (cc == TD_CC_NOERROR) {
+        if (!last) {
+            return;
+        }
+        urb->errorcode = 0;
+    } else if ((cc == TD_CC_DATAUNDERRUN) && !last && (ed->ed_type == USB_ENDPOINT_TYPE_CONTROL)) {
+        /* short control read before the last data td, skip to the status td */
+        next_td = ed->head_td;
+        while ((next_td != ed->dummy_td) && (next_td->urb == urb) && !next_td->last) {
+            td = next_td;
+            next_td = td->next_td;
+            ohci_td_free(bus, td);
+        }
+        ed->head_td = next_td;
+
+        /* status td carries its own DATA1 toggle, just clear the halt */
+        usb_ohci_wmb();
+        ed->hw.headp = OHCI_PTR2ADDR(next_td);
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+        usb_dcache_clean((uintptr_t)&ed->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+        ohci_ed_restart(bus, ed);
+        return;
+    } else {
+        /* ed is halted, drop the rest tds of this urb and go on with the next urb */
+        next_td = ed->head_td;
+        while ((next_td != ed->dummy_td) && (next_td->urb == urb)) {
+            td = next_td;
+            next_td = td->next_td;
+            ohci_td_free(bus, td);
+        }
+        ed->head_td = next_td;
+
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+        usb_dcache_invalidate((uintptr_t)&ed->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+        carry = ed->hw.headp & ED_HEADP_C;
+        if (cc == TD_CC_DATAUNDERRUN) {
+            /* short packet in the middle of the urb */
+            urb->errorcode = 0;
+        } else if (cc == TD_CC_STALL) {
+            urb->errorcode = -USB_ERR_STALL;
+            carry = 0;
+        } else if (cc == TD_CC_DATAOVERRUN) {
+            urb->errorcode = -USB_ERR_BABBLE;
+            carry = 0;
+        } else {
+            urb->errorcode = -USB_ERR_IO;
+            carry = 0;
+        }
+
+        usb_ohci_wmb();
+        ed->hw.headp = OHCI_PTR2ADDR(next_td) | carry;
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+        usb_dcache_clean((uintptr_t)&ed->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+        if (next_td != ed->dummy_td) {
+            ohci_ed_restart(bus, ed);
+        }
+    }
+
+    urb->data_toggle = (ed->hw.headp & ED_HEADP_C) ? true : false;
+    ohci_urb_giveback(ed, urb);
+}
+
+static void ohci_scan_done_queue(struct usbh_bus *bus)
+{
+    struct ohci_td_hw *td;
+    struct ohci_td_hw *next_td;
+    struct ohci_td_hw *done = NULL;
+
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_invalidate((uintptr_t)&ohci_hcca[bus->hcd.hcd_id], sizeof(struct ohci_hcca));
+#endif
+    td = OHCI_ADDR2TD(ohci_hcca[bus->hcd.hcd_id].donehead & HCCA_DONEHEAD_MASK);
+    ohci_hcca[bus->hcd.hcd_id].donehead = 0;
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)&ohci_hcca[bus->hcd.hcd_id], sizeof(struct ohci_hcca));
+#endif
+    /* controller may write the next done head once WDH is cleared */
+    OHCI_HCOR->hcintsts = OHCI_INT_WDH;
+
+    /* done queue is linked newest first, reverse it into retire order */
+    while (td) {
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+        usb_dcache_invalidate((uintptr_t)&td->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+        next_td = OHCI_ADDR2TD(td->hw.nexttd);
+        td->done_next = done;
+        done = td;
+        td = next_td;
+    }
+
+    while (done) {
+        next_td = done->done_next;
+        ohci_td_retire(bus, done);
+        done = next_td;
+    }
+}
+
+static int ohci_ed_close(struct usbh_bus *bus, struct ohci_ed_hw *ed)
+{
+    struct ohci_td_hw *td;
+    struct ohci_td_hw *next_td;
+    struct usbh_urb *urb;
+    size_t flags;
+    int ret;
+
+    /* ed leaves the schedule once the controller has passed a frame boundary */
+    flags = usb_osal_enter_critical_section();
+    ed->hw.ctrl |= ED_CONTROL_SKIP;
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)&ed->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+    if (ed->ed_type == USB_ENDPOINT_TYPE_INTERRUPT) {
+        ohci_int_ed_unlink(bus, ed);
+    } else {
+        OHCI_HCOR->hccontrol &= ~ohci_async_list_enable(ed);
+    }
+    usb_osal_leave_critical_section(flags);
+
+    ret = ohci_wait_sof(bus);
+
+    flags = usb_osal_enter_critical_section();
+    if (ed->ed_type != USB_ENDPOINT_TYPE_INTERRUPT) {
+        if (ret == 0) {
+            ohci_async_ed_unlink(bus, ed);
+        }
+        OHCI_HCOR->hccontrol |= ohci_async_list_enable(ed);
+        ohci_ed_restart(bus, ed);
+    }
+    usb_osal_leave_critical_section(flags);
+
+    /* tds retired before the ed left the schedule may still wait in the controller,
+     * they are written to the done queue at the next sof.
+     */
+    if (ret == 0) {
+        ret = ohci_wait_sof(bus);
+    }
+
+    flags = usb_osal_enter_critical_section();
+    if (OHCI_HCOR->hcintsts & OHCI_INT_WDH) {
+        ohci_scan_done_queue(bus);
+    }
+
+    /* give back pending urbs, dummy td is always the tail */
+    td = ed->head_td;
+    while (td) {
+        next_td = (td == ed->dummy_td) ? NULL : td->next_td;
+
+        urb = td->urb;
+        if (urb && (urb->errorcode == -USB_ERR_BUSY)) {
+            urb->errorcode = -USB_ERR_SHUTDOWN;
+            urb->hcpriv = NULL;
+            if (urb->timeout) {
+                usb_osal_sem_give(ed->waitsem);
+            }
+        }
+        if (ret < 0) {
+            td->urb = NULL;
+        } else {
+            ohci_td_free(bus, td);
+        }
+        td = next_td;
+    }
+
+    if (ret < 0) {
+        /* controller may still hold them, leave skipped ed and tds off the free lists for good */
+        ed->hport = NULL;
+        usb_osal_leave_critical_section(flags);
+        USB_LOG_ERR("Timeout to unlink ed of ep 0x%02x, ed is leaked\r\n", ed->ep_addr);
+        return ret;
+    }
+
+    ed->head_td = NULL;
+    ed->dummy_td = NULL;
+    ohci_ed_free(bus, ed);
+
+    usb_osal_leave_critical_section(flags);
+    return ret;
+}
+
+static struct ohci_ed_hw *ohci_ed_find(struct usbh_bus *bus, struct usbh_urb *urb, struct ohci_ed_hw *hint)
+{
+    struct ohci_ed_hw *ed;
+
+    /* hint is the ed of the previous submit, valid while it still belongs to the same device and ep */
+    if (hint && hint->inuse && (hint->hport == urb->hport) && (hint->ep_addr == urb->ep->bEndpointAddress)) {
+        return hint;
+    }
+
+    for (uint32_t index = 0; index < CONFIG_USB_OHCI_ED_NUM; index++) {
+        ed = &g_ohci_ed_pool[bus->hcd.hcd_id][index];
+        if (ed->inuse && (ed->hport == urb->hport) && (ed->ep_addr == urb->ep->bEndpointAddress)) {
+            return ed;
+        }
+    }
+    return NULL;
+}
+
+static void ohci_ed_reclaim(struct usbh_bus *bus)
+{
+    struct ohci_ed_hw *ed;
+
+    /* ed pool is empty, close the eds of detached devices whose only td left is the dummy */
+    for (uint32_t index = 0; index < CONFIG_USB_OHCI_ED_NUM; index++) {
+        ed = &g_ohci_ed_pool[bus->hcd.hcd_id][index];
+        if (ed->inuse && ed->hport && !ed->hport->connected && (ed->head_td == ed->dummy_td)) {
+            ohci_ed_close(bus, ed);
+        }
+    }
+}
+
+static struct ohci_ed_hw *ohci_ed_open(struct usbh_bus *bus, struct usbh_urb *urb, struct ohci_ed_hw *hint)
+{
+    struct ohci_ed_hw *ed;
+    struct ohci_td_hw *dummy_td;
+    uint32_t ctrl;
+    size_t flags;
+
+    ctrl = ohci_ed_ctrl(urb);
+
+    ed = ohci_ed_find(bus, urb, hint);
+    if (ed) {
+        if ((ed->hw.ctrl & ~ED_CONTROL_SKIP) == ctrl) {
+            return ed;
+        }
+        /* device was re-addressed or endpoint was reconfigured */
+        ohci_ed_close(bus, ed);
+    }
+
+    ed = ohci_ed_alloc(bus);
+    if (ed == NULL) {
+        ohci_ed_reclaim(bus);
+        ed = ohci_ed_alloc(bus);
+        if (ed == NULL) {
+            return NULL;
+        }
+    }
+
+    dummy_td = ohci_td_alloc(bus);
+    if (dummy_td == NULL) {
+        ohci_ed_free(bus, ed);
+        return NULL;
+    }
+
+    /* empty when headp equals tailp, toggle carry starts from urb */
+    ed->hw.ctrl = ctrl;
+    ed->hw.tailp = OHCI_PTR2ADDR(dummy_td);
+    ed->hw.headp = OHCI_PTR2ADDR(dummy_td) | (urb->data_toggle ? ED_HEADP_C : 0);
+    ed->head_td = dummy_td;
+    ed->dummy_td = dummy_td;
+    ed->hport = urb->hport;
+    ed->ep_addr = urb->ep->bEndpointAddress;
+    ed->ed_type = USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes);
+
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)&dummy_td->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+
+    flags = usb_osal_enter_critical_section();
+    if (ed->ed_type == USB_ENDPOINT_TYPE_INTERRUPT) {
+        ohci_int_ed_link(bus, ed, urb->ep->bInterval);
+    } else {
+        ohci_async_ed_link(bus, ed);
+    }
+    usb_osal_leave_critical_section(flags);
+
+    return ed;
+}
+
+/* Fill td and chain a fresh td behind it, the fresh one is returned */
+static struct ohci_td_hw *ohci_td_append(struct usbh_bus *bus, struct ohci_td_hw *td, struct usbh_urb *urb,
+                                         uint32_t ctrl, uint8_t *buffer, uint32_t buflen)
+{
+    struct ohci_td_hw *next_td;
+
+    next_td = ohci_td_alloc(bus);
+    if (next_td == NULL) {
+        return NULL;
+    }
+
+    td->hw.ctrl = ctrl | ((uint32_t)TD_CC_NOTACCESSED << GTD_STATUS_CC_SHIFT);
+    if (buflen) {
+        td->hw.cbp = (uint32_t)(uintptr_t)buffer;
+        td->hw.be = (uint32_t)(uintptr_t)buffer + buflen - 1;
+    } else {
+        td->hw.cbp = 0;
+        td->hw.be = 0;
+    }
+    td->hw.nexttd = OHCI_PTR2ADDR(next_td);
+    td->buf_start = td->hw.cbp;
+    td->length = buflen;
+    td->urb = urb;
+    td->next_td = next_td;
+    td->last = false;
+
+    return next_td;
+}
+
+static int ohci_ed_submit(struct usbh_bus *bus, struct ohci_ed_hw *ed, struct usbh_urb *urb)
+{
+    struct ohci_td_hw *first_td;
+    struct ohci_td_hw *last_td;
+    struct ohci_td_hw *td;
+    struct ohci_td_hw *next_td;
+    uint8_t *buffer;
+    uint32_t buflen;
+    uint32_t xfer_len;
+    uint32_t ctrl;
+    uint16_t mps;
+    bool dir_in;
+    size_t flags;
+
+    /* poll mode urb shares ed->waitsem, so it cannot wait behind other urbs */
+    if (urb->timeout && (ed->head_td != ed->dummy_td)) {
+        return -USB_ERR_BUSY;
+    }
+
+    /* the current dummy carries the first td of this urb, the last fresh td becomes the tail */
+    first_td = ed->dummy_td;
+    td = first_td;
+    last_td = NULL;
+    buffer = urb->transfer_buffer;
+    buflen = urb->transfer_buffer_length;
+    mps = USB_GET_MAXPACKETSIZE(urb->ep->wMaxPacketSize);
+
+    if (ed->ed_type == USB_ENDPOINT_TYPE_CONTROL) {
+        dir_in = (urb->setup->bmRequestType & 0x80) ? true : false;
+
+        next_td = ohci_td_append(bus, td, urb, GTD_STATUS_DP_SETUP | GTD_STATUS_T_DATA0, (uint8_t *)urb->setup, 8);
+        if (next_td == NULL) {
+            goto errout_nomem;
+        }
+        /* setup bytes count in actual_length, like ehci and dwc2 */
+        td = next_td;
+
+        ctrl = (dir_in ? (GTD_STATUS_DP_IN | GTD_STATUS_R) : GTD_STATUS_DP_OUT) | GTD_STATUS_T_DATA1;
+    } else {
+        dir_in = (urb->ep->bEndpointAddress & 0x80) ? true : false;
+
+        ctrl = (dir_in ? GTD_STATUS_DP_IN : GTD_STATUS_DP_OUT) | GTD_STATUS_T_TOGGLE;
+    }
+
+    if ((ed->ed_type != USB_ENDPOINT_TYPE_CONTROL) || buflen) {
+        do {
+            /* one td covers at most two 4k pages */
+            xfer_len = 0x2000 - ((uintptr_t)buffer & 0xfff);
+            if (buflen > xfer_len) {
+                xfer_len -= (xfer_len % mps);
+            } else {
+                xfer_len = buflen;
+            }
+
+            /* only the last td of an in urb accepts a short packet, an earlier one halts the ed */
+            if (dir_in && (xfer_len == buflen)) {
+                ctrl |= GTD_STATUS_R;
+            } else {
+                ctrl &= ~GTD_STATUS_R;
+            }
+
+            next_td = ohci_td_append(bus, td, urb, ctrl, buffer, xfer_len);
+            if (next_td == NULL) {
+                goto errout_nomem;
+            }
+            last_td = td;
+            td = next_td;
+            buffer += xfer_len;
+            buflen -= xfer_len;
+
+            /* following tds take the toggle carried by the ed */
+            ctrl = (ctrl & ~GTD_STATUS_T_MASK) | GTD_STATUS_T_TOGGLE;
+        } while (buflen > 0);
+    }
+
+    if (ed->ed_type == USB_ENDPOINT_TYPE_CONTROL) {
+        ctrl = (dir_in ? GTD_STATUS_DP_OUT : GTD_STATUS_DP_IN) | GTD_STATUS_T_DATA1;
+        next_td = ohci_td_append(bus, td, urb, ctrl, NULL, 0);
+        if (next_td == NULL) {
+            goto errout_nomem;
+        }
+        last_td = td;
+        td = next_td;
+    }
+
+    last_td->last = true;
+
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    for (next_td = first_td; next_td; next_td = next_td->next_td) {
+        usb_dcache_clean((uintptr_t)&next_td->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+    }
+#endif
+    if (urb->setup) {
+        usb_dcache_clean((uintptr_t)urb->setup, USB_ALIGN_UP(8, CONFIG_USB_ALIGN_SIZE));
+    }
+    usb_dcache_flush((uintptr_t)urb->transfer_buffer, USB_ALIGN_UP(urb->transfer_buffer_length, CONFIG_USB_ALIGN_SIZE));
+
+    flags = usb_osal_enter_critical_section();
+
+    urb->hcpriv = ed;
+    ed->dummy_td = td;
+
+    /* moving tailp hands the tds over to the controller */
+    usb_ohci_wmb();
+    ed->hw.tailp = OHCI_PTR2ADDR(td);
+#if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE)
+    usb_dcache_clean((uintptr_t)&ed->hw, CONFIG_USB_OHCI_ALIGN_SIZE);
+#endif
+    ohci_ed_restart(bus, ed);
+
+    usb_osal_leave_critical_section(flags);
+    return 0;
+
+errout_nomem:
+    td = first_td->next_td;
+    while (td) {
+        next_td = td->next_td;
+        ohci_td_free(bus, td);
+        td = next_td;
+    }
+    memset(&first_td->hw, 0, sizeof(struct ohci_gtd));
+    first_td->urb = NULL;
+    first_td->next_td = NULL;
+    first_td->length = 0;
+    return -USB_ERR_NOMEM;
+}
+
 int ohci_init(struct usbh_bus *bus)
 {
     volatile uint32_t timeout = 0;
     uint32_t regval;
     struct ohci_ed_hw *ed;
+    struct ohci_td_hw *td;
 
     memset(&g_ohci_hcd[bus->hcd.hcd_id], 0, sizeof(struct ohci_hcd));
     memset(g_ohci_ed_pool[bus->hcd.hcd_id], 0, sizeof(struct ohci_ed_hw) * CONFIG_USB_OHCI_ED_NUM);
-
-    for (uint32_t i = 0; i < 32; i++) {
-        ohci_hcca[bus->hcd.hcd_id].inttbl[i] = 0;
-    }
+    memset(g_ohci_td_pool[bus->hcd.hcd_id], 0, sizeof(struct ohci_td_hw) * CONFIG_USB_OHCI_ED_NUM * CONFIG_USB_OHCI_TD_NUM);
+    memset(&ohci_hcca[bus->hcd.hcd_id], 0, sizeof(struct ohci_hcca));
 
     for (uint8_t index = 0; index < CONFIG_USB_OHCI_ED_NUM; index++) {
         ed = &g_ohci_ed_pool[bus->hcd.hcd_id][index];
@@ -39,19 +803,31 @@ int ohci_init(struct usbh_bus *bus)
             USB_LOG_ERR("struct ohci_ed_hw is not align 32\r\n");
             return -USB_ERR_INVAL;
         }
-        for (uint8_t i = 0; i < CONFIG_USB_OHCI_TD_NUM; i++) {
-            if ((uint32_t)&ed->td_pool[i] % 32) {
-                USB_LOG_ERR("struct ohci_td_hw is not align 32\r\n");
-                return -USB_ERR_INVAL;
-            }
+    }
+
+    for (uint32_t index = 0; index < CONFIG_USB_OHCI_ED_NUM * CONFIG_USB_OHCI_TD_NUM; index++) {
+        td = &g_ohci_td_pool[bus->hcd.hcd_id][index];
+        if ((uint32_t)&td->hw % 32) {
+            USB_LOG_ERR("struct ohci_td_hw is not align 32\r\n");
+            return -USB_ERR_INVAL;
         }
     }
 
-    for (uint8_t index = 0; index < CONFIG_USB_OHCI_ED_NUM; index++) {
-        ed = &g_ohci_ed_pool[bus->hcd.hcd_id][index];
+    for (uint8_t index = CONFIG_USB_OHCI_ED_NUM; index > 0; index--) {
+        ed = &g_ohci_ed_pool[bus->hcd.hcd_id][index - 1];
         ed->waitsem = usb_osal_sem_create(0);
+        ed->free_next = g_ohci_hcd[bus->hcd.hcd_id].ed_free;
+        g_ohci_hcd[bus->hcd.hcd_id].ed_free = ed;
     }
 
+    for (uint32_t index = CONFIG_USB_OHCI_ED_NUM * CONFIG_USB_OHCI_TD_NUM; index > 0; index--) {
+        td = &g_ohci_td_pool[bus->hcd.hcd_id][index - 1];
+        td->free_next = g_ohci_hcd[bus->hcd.hcd_id].td_free;
+        g_ohci_hcd[bus->hcd.hcd_id].td_free = td;
+    }
+
+    ohci_int_tree_init(bus);
+
     USB_LOG_INFO("OHCI hcrevision:0x%02x\r\n", (unsigned int)OHCI_HCOR->hcrevision);
 
     OHCI_HCOR->hcintdis = OHCI_INT_MIE;
@@ -84,7 +860,7 @@ int ohci_init(struct usbh_bus *bus)
     regval &= ~OHCI_CTRL_HCFS_MASK;
     regval |= OHCI_CTRL_HCFS_OPER;
     regval |= OHCI_CTRL_CBSR;
-    regval |= OHCI_CTRL_CLE;
+    regval |= (OHCI_CTRL_PLE | OHCI_CTRL_CLE | OHCI_CTRL_BLE);
     OHCI_HCOR->hccontrol = regval;
 
     g_ohci_hcd[bus->hcd.hcd_id].n_ports = OHCI_HCOR->hcrhdescriptora & OHCI_RHDESCA_NDP_MASK;
@@ -267,12 +1043,105 @@ int ohci_roothub_control(struct usbh_bus *bus, struct usb_setup_packet *setup, u
 
 int ohci_submit_urb(struct usbh_urb *urb)
 {
-    return -USB_ERR_NOTSUPP;
+    struct ohci_ed_hw *ed = NULL;
+    struct ohci_ed_hw *hint;
+    size_t flags;
+    int ret = 0;
+    struct usbh_hub *hub;
+    struct usbh_hubport *hport;
+    struct usbh_bus *bus;
+
+    if (!urb || !urb->hport || !urb->ep || !urb->hport->bus) {
+        return -USB_ERR_INVAL;
+    }
+
+#ifdef CONFIG_USB_DCACHE_ENABLE
+    USB_ASSERT_MSG(!((uintptr_t)urb->setup % CONFIG_USB_ALIGN_SIZE) &&
+                       !((uintptr_t)urb->transfer_buffer % CONFIG_USB_ALIGN_SIZE),
+                   "urb->setup or urb->transfer_buffer is not aligned %d", CONFIG_USB_ALIGN_SIZE);
+#endif
+    bus = urb->hport->bus;
+
+    /* find active hubport in roothub */
+    hport = urb->hport;
+    hub = urb->hport->parent;
+    while (!hub->is_roothub) {
+        hport = hub->parent;
+        hub = hub->parent->parent;
+    }
+
+    if (!urb->hport->connected || !(OHCI_HCOR->hcrhportsts[hport->port - 1] & OHCI_RHPORTST_CCS)) {
+        return -USB_ERR_NOTCONN;
+    }
+
+    if (urb->errorcode == -USB_ERR_BUSY) {
+        return -USB_ERR_BUSY;
+    }
+
+    flags = usb_osal_enter_critical_section();
+
+    /* remember the endpoint ed used by this urb last time */
+    hint = (struct ohci_ed_hw *)urb->hcpriv;
+    urb->hcpriv = NULL;
+    urb->errorcode = -USB_ERR_BUSY;
+    urb->actual_length = 0;
+
+    usb_osal_leave_critical_section(flags);
+
+    switch (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes)) {
+        case USB_ENDPOINT_TYPE_CONTROL:
+        case USB_ENDPOINT_TYPE_BULK:
+        case USB_ENDPOINT_TYPE_INTERRUPT:
+            ed = ohci_ed_open(bus, urb, hint);
+            if (ed == NULL) {
+                urb->errorcode = -USB_ERR_NOMEM;
+                return -USB_ERR_NOMEM;
+            }
+            ret = ohci_ed_submit(bus, ed, urb);
+            if (ret < 0) {
+                urb->errorcode = ret;
+                return ret;
+            }
+            break;
+        case USB_ENDPOINT_TYPE_ISOCHRONOUS:
+        default:
+            urb->errorcode = -USB_ERR_NOTSUPP;
+            return -USB_ERR_NOTSUPP;
+    }
+
+    if (urb->timeout > 0) {
+        /* wait until timeout or sem give */
+        ret = usb_osal_sem_take(ed->waitsem, urb->timeout);
+        if (ret < 0) {
+            goto errout_timeout;
+        }
+        urb->timeout = 0;
+        ret = urb->errorcode;
+    }
+    return ret;
+errout_timeout:
+    urb->timeout = 0;
+    ohci_kill_urb(urb);
+    return ret;
 }
 
 int ohci_kill_urb(struct usbh_urb *urb)
 {
-    return -USB_ERR_NOTSUPP;
+    struct ohci_ed_hw *ed;
+
+    if (!urb || !urb->hport || !urb->hcpriv || !urb->hport->bus) {
+        return -USB_ERR_INVAL;
+    }
+
+    ed = (struct ohci_ed_hw *)urb->hcpriv;
+    /* ed may have been released and reused by another endpoint */
+    if (!ed->inuse || (ed->hport != urb->hport) || (ed->ep_addr != urb->ep->bEndpointAddress)) {
+        urb->hcpriv = NULL;
+        return -USB_ERR_INVAL;
+    }
+
+    /* killing an urb releases the endpoint ed and all urbs queued on it */
+    return ohci_ed_close(urb->hport->bus, ed);
 }
 
 void OHCI_IRQHandler(uint8_t busid)
@@ -303,7 +1172,7 @@ void OHCI_IRQHandler(uint8_t busid)
         }
     }
     if (usbsts & OHCI_INT_WDH) {
-        OHCI_HCOR->hcintsts = OHCI_INT_WDH;
+        ohci_scan_done_queue(bus);
     }
 }
 
@@ -19,6 +19,7 @@
 #ifndef CONFIG_USB_OHCI_ED_NUM
 #define CONFIG_USB_OHCI_ED_NUM 10
 #endif
+/* Average tds per ed, all eds of one bus share CONFIG_USB_OHCI_ED_NUM * CONFIG_USB_OHCI_TD_NUM tds */
 #ifndef CONFIG_USB_OHCI_TD_NUM
 #define CONFIG_USB_OHCI_TD_NUM 3
 #endif
@@ -31,7 +32,14 @@
 #error "CONFIG_USB_ALIGN_SIZE must be 32 or 64"
 #endif
 
-struct ohci_ed_hw;
+#ifndef usb_ohci_wmb
+/* Make descriptor writes visible to controller before handing them over */
+#define usb_ohci_wmb() __asm volatile("" ::: "memory")
+#endif
+
+/* Static eds of the periodic tree, one level for each 1/2/4/8/16/32ms interval */
+#define OHCI_INT_ED_NUM 63
+
 struct ohci_td_hw {
     struct ohci_gtd hw;
 #if defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE) && (CONFIG_USB_ALIGN_SIZE == 32)
@@ -40,7 +48,11 @@ struct ohci_td_hw {
     uint8_t pad[48];
 #endif
     struct usbh_urb *urb;
-    bool dir_in;
+    struct ohci_td_hw *next_td;   /* hw.nexttd is reused by the done queue */
+    struct ohci_td_hw *done_next; /* done queue in retire order */
+    struct ohci_td_hw *free_next;
+    bool inuse;
+    bool last;                    /* last td of the urb */
     uint32_t buf_start;
     uint32_t length;
 } __attribute__((aligned(CONFIG_USB_OHCI_ALIGN_SIZE))); /* min is 16bytes, we use CONFIG_USB_OHCI_ALIGN_SIZE for cacheline */
@@ -52,14 +64,22 @@ struct ohci_ed_hw {
 #elif defined(CONFIG_USB_OHCI_DESC_DCACHE_ENABLE) && (CONFIG_USB_ALIGN_SIZE == 64)
     uint8_t pad[48];
 #endif
-    struct ohci_td_hw td_pool[CONFIG_USB_OHCI_TD_NUM];
-    uint32_t td_count;
+    struct ohci_td_hw *head_td;  /* oldest td not retired yet */
+    struct ohci_td_hw *dummy_td; /* tail td, the controller never touches it */
+    struct ohci_ed_hw *free_next;
+    struct usbh_hubport *hport;
+    uint8_t ep_addr;
     uint8_t ed_type;
+    uint8_t int_interval;
+    uint8_t int_branch;
+    bool inuse;
     usb_osal_sem_t waitsem;
 } __attribute__((aligned(CONFIG_USB_OHCI_ALIGN_SIZE))); /* min is 16bytes, we use CONFIG_USB_OHCI_ALIGN_SIZE for cacheline */
 
 struct ohci_hcd {
-    bool ohci_ed_used[CONFIG_USB_OHCI_ED_NUM];
+    struct ohci_ed_hw *ed_free;
+    struct ohci_td_hw *td_free;
+    uint16_t frame_load[HCCA_INTTBL_WSIZE]; /* interrupt bytes scheduled in each frame */
     uint8_t n_ports;
 };
 
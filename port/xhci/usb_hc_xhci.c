@@ -0,0 +1,1864 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usb_hc_xhci.h"
+
+/* One trb never crosses a 64KB boundary */
+#define XHCI_TRB_MAX_BUFFER (0x10000)
+
+struct xhci_hcd g_xhci_hcd[CONFIG_USBHOST_MAX_BUS];
+
+__WEAK void usb_hc_low_level_init(struct usbh_bus *bus)
+{
+    (void)bus;
+}
+
+__WEAK void usb_hc_low_level_deinit(struct usbh_bus *bus)
+{
+    (void)bus;
+}
+
+__WEAK void *xhci_mem_malloc(size_t align, size_t size)
+{
+    uintptr_t raw;
+    uintptr_t addr;
+
+    raw = (uintptr_t)usb_osal_malloc(size + align + sizeof(void *));
+    if (raw == 0) {
+        return NULL;
+    }
+
+    /* keep the raw pointer just below the aligned block for xhci_mem_free */
+    addr = (raw + sizeof(void *) + align - 1) & ~((uintptr_t)align - 1);
+    ((void **)addr)[-1] = (void *)raw;
+    return (void *)addr;
+}
+
+__WEAK void xhci_mem_free(void *ptr)
+{
+    if (ptr) {
+        usb_osal_free(((void **)ptr)[-1]);
+    }
+}
+
+__WEAK void xhci_dcache_sync(void *ptr, size_t len, uint32_t flags)
+{
+    (void)ptr;
+    (void)len;
+
+    if (flags & XHCI_DCACHE_FLUSH) {
+        usb_dcache_clean((uintptr_t)ptr, len);
+    }
+    if (flags & XHCI_DCACHE_INVALIDATE) {
+        usb_dcache_invalidate((uintptr_t)ptr, len);
+    }
+}
+
+static void *xhci_dma_alloc(size_t align, size_t size)
+{
+    void *ptr = xhci_mem_malloc(align, size);
+
+    if (ptr) {
+        memset(ptr, 0, size);
+        xhci_dcache_sync(ptr, size, XHCI_DCACHE_FLUSH);
+    }
+    return ptr;
+}
+
+static inline void xhci_write64(volatile uint32_t *lo, volatile uint32_t *hi, uint64_t val)
+{
+    *lo = (uint32_t)val;
+    *hi = (uint32_t)(val >> 32);
+}
+
+static int xhci_handshake(volatile uint32_t *reg, uint32_t mask, uint32_t val, uint32_t timeout_ms)
+{
+    while ((*reg & mask) != val) {
+        if (timeout_ms-- == 0) {
+            return -USB_ERR_TIMEOUT;
+        }
+        usb_osal_msleep(1);
+    }
+    return 0;
+}
+
+/* Ring management **********************************************************/
+
+static int xhci_ring_alloc(struct xhci_ring *ring, uint32_t num)
+{
+    struct xhci_trb *link;
+
+    /* aligned to its own size, a segment never crosses a 64KB boundary */
+    ring->trbs = xhci_mem_malloc(num * sizeof(struct xhci_trb), num * sizeof(struct xhci_trb));
+    if (ring->trbs == NULL) {
+        return -USB_ERR_NOMEM;
+    }
+    memset(ring->trbs, 0, num * sizeof(struct xhci_trb));
+
+    ring->num = num;
+    ring->enqueue = 0;
+    ring->dequeue = 0;
+    ring->free = num - 1;
+    ring->cycle = 1;
+
+    link = &ring->trbs[num - 1];
+    link->param_lo = (uint32_t)XHCI_PTR2ADDR(ring->trbs);
+    link->param_hi = (uint32_t)(XHCI_PTR2ADDR(ring->trbs) >> 32);
+    link->control = XHCI_TRB_TYPE(XHCI_TRB_TYPE_LINK) | XHCI_TRB_TC;
+
+    xhci_dcache_sync(ring->trbs, num * sizeof(struct xhci_trb), XHCI_DCACHE_FLUSH);
+    return 0;
+}
+
+static void xhci_ring_free(struct xhci_ring *ring)
+{
+    if (ring->trbs) {
+        xhci_mem_free(ring->trbs);
+        ring->trbs = NULL;
+    }
+}
+
+static inline uint64_t xhci_ring_deq_addr(struct xhci_ring *ring, uint32_t index, uint8_t cycle)
+{
+    return XHCI_PTR2ADDR(&ring->trbs[index]) | cycle;
+}
+
+/* Write one trb at enqueue pointer. The first trb of a td is written with the
+ * cycle bit inverted and handed over by xhci_ring_commit() once the whole td is built.
+ */
+static struct xhci_trb *xhci_ring_push(struct xhci_ring *ring, uint64_t param, uint32_t status, uint32_t control, bool hold)
+{
+    struct xhci_trb *trb;
+    struct xhci_trb *link;
+
+    trb = &ring->trbs[ring->enqueue];
+    trb->param_lo = (uint32_t)param;
+    trb->param_hi = (uint32_t)(param >> 32);
+    trb->status = status;
+    usb_xhci_wmb();
+    trb->control = control | (hold ? (ring->cycle ^ 1) : ring->cycle);
+    xhci_dcache_sync(trb, sizeof(struct xhci_trb), XHCI_DCACHE_FLUSH);
+
+    ring->enqueue++;
+    ring->free--;
+    if (ring->enqueue == (ring->num - 1)) {
+        link = &ring->trbs[ring->num - 1];
+        /* link trb inside a td keeps the chain */
+        link->control = XHCI_TRB_TYPE(XHCI_TRB_TYPE_LINK) | XHCI_TRB_TC | (control & XHCI_TRB_CH) | ring->cycle;
+        xhci_dcache_sync(link, sizeof(struct xhci_trb), XHCI_DCACHE_FLUSH);
+        ring->enqueue = 0;
+        ring->cycle ^= 1;
+    }
+    return trb;
+}
+
+static void xhci_ring_commit(struct xhci_trb *first)
+{
+    usb_xhci_wmb();
+    first->control ^= XHCI_TRB_C;
+    xhci_dcache_sync(first, sizeof(struct xhci_trb), XHCI_DCACHE_FLUSH);
+    usb_xhci_wmb();
+}
+
+/* Command ring *************************************************************/
+
+/* Called with critical section held */
+static int xhci_cmd_post(struct usbh_bus *bus, struct xhci_cmd *cmd)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    struct xhci_ring *ring = &hcd->cmd_ring;
+
+    if (ring->free == 0) {
+        return -USB_ERR_BUSY;
+    }
+
+    cmd->done = false;
+    hcd->cmd_pending[ring->enqueue] = cmd;
+    xhci_ring_push(ring, ((uint64_t)cmd->trb.param_hi << 32) | cmd->trb.param_lo, cmd->trb.status, cmd->trb.control, false);
+    usb_xhci_wmb();
+    XHCI_DBAR[0] = 0;
+    return 0;
+}
+
+/* Issue one command and wait for its completion event. Caller holds cmd_mutex,
+ * returns the completion code or a negative error.
+ */
+static int xhci_cmd_sync(struct usbh_bus *bus, uint32_t control, uint64_t param, struct xhci_trb *event)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    struct xhci_cmd *cmd = &hcd->sync_cmd;
+    size_t flags;
+    int ret;
+
+    usb_osal_sem_reset(cmd->waitsem);
+    cmd->trb.param_lo = (uint32_t)param;
+    cmd->trb.param_hi = (uint32_t)(param >> 32);
+    cmd->trb.status = 0;
+    cmd->trb.control = control;
+    cmd->complete = NULL;
+
+    flags = usb_osal_enter_critical_section();
+    ret = xhci_cmd_post(bus, cmd);
+    usb_osal_leave_critical_section(flags);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = usb_osal_sem_take(cmd->waitsem, CONFIG_USB_XHCI_CMD_TIMEOUT);
+    if (ret < 0) {
+        /* forget it, a late completion event is dropped */
+        flags = usb_osal_enter_critical_section();
+        for (uint32_t i = 0; i < CONFIG_USB_XHCI_CMD_RING_SIZE; i++) {
+            if (hcd->cmd_pending[i] == cmd) {
+                hcd->cmd_pending[i] = NULL;
+            }
+        }
+        usb_osal_leave_critical_section(flags);
+        USB_LOG_ERR("xhci command %u timeout\r\n", (unsigned int)XHCI_TRB_GET_TYPE(control));
+        return ret;
+    }
+
+    if (event) {
+        *event = cmd->event;
+    }
+    return XHCI_EVT_GET_CC(cmd->event.status);
+}
+
+static void xhci_cmd_forget(struct xhci_hcd *hcd, struct xhci_cmd *cmd)
+{
+    for (uint32_t i = 0; i < CONFIG_USB_XHCI_CMD_RING_SIZE; i++) {
+        if (hcd->cmd_pending[i] == cmd) {
+            hcd->cmd_pending[i] = NULL;
+        }
+    }
+}
+
+static int xhci_cc2errorcode(uint8_t cc)
+{
+    switch (cc) {
+        case XHCI_CC_SUCCESS:
+        case XHCI_CC_SHORT_PACKET:
+            return 0;
+        case XHCI_CC_STALL:
+            return -USB_ERR_STALL;
+        case XHCI_CC_BABBLE:
+            return -USB_ERR_BABBLE;
+        case XHCI_CC_RESOURCE:
+        case XHCI_CC_BANDWIDTH:
+        case XHCI_CC_NO_SLOTS:
+            return -USB_ERR_NOMEM;
+        case XHCI_CC_SLOT_NOT_ENABLED:
+        case XHCI_CC_EP_NOT_ENABLED:
+            return -USB_ERR_NODEV;
+        default:
+            return -USB_ERR_IO;
+    }
+}
+
+/* Contexts *****************************************************************/
+
+static inline void *xhci_in_ctx(struct xhci_hcd *hcd, struct xhci_slot *slot, uint8_t index)
+{
+    /* index 0 is input control context, 1 slot context, dci + 1 endpoint context */
+    return (uint8_t *)slot->in_ctx + index * hcd->ctx_size;
+}
+
+static inline struct xhci_ep_ctx *xhci_out_ep_ctx(struct xhci_hcd *hcd, struct xhci_slot *slot, uint8_t dci)
+{
+    return (struct xhci_ep_ctx *)((uint8_t *)slot->out_ctx + dci * hcd->ctx_size);
+}
+
+static inline uint8_t xhci_ep_dci(uint8_t ep_addr)
+{
+    if (USB_EP_GET_IDX(ep_addr) == 0) {
+        return 1;
+    }
+    return USB_EP_GET_IDX(ep_addr) * 2 + (USB_EP_DIR_IS_IN(ep_addr) ? 1 : 0);
+}
+
+static uint8_t xhci_ep_state(struct xhci_hcd *hcd, struct xhci_slot *slot, uint8_t dci)
+{
+    struct xhci_ep_ctx *ctx = xhci_out_ep_ctx(hcd, slot, dci);
+
+    xhci_dcache_sync(ctx, hcd->ctx_size, XHCI_DCACHE_INVALIDATE);
+    return ctx->info0 & XHCI_EP_CTX0_STATE_MASK;
+}
+
+static uint8_t xhci_slot_speed(uint8_t speed)
+{
+    switch (speed) {
+        case USB_SPEED_LOW:
+            return XHCI_PORT_SPEED_LOW;
+        case USB_SPEED_FULL:
+            return XHCI_PORT_SPEED_FULL;
+        case USB_SPEED_HIGH:
+            return XHCI_PORT_SPEED_HIGH;
+        case USB_SPEED_SUPER_PLUS:
+            return XHCI_PORT_SPEED_SUPER_PLUS;
+        default:
+            return XHCI_PORT_SPEED_SUPER;
+    }
+}
+
+static void xhci_slot_ctx_fill(struct xhci_hcd *hcd, struct xhci_slot *slot)
+{
+    struct xhci_slot_ctx *ctx = xhci_in_ctx(hcd, slot, 1);
+    struct usbh_hubport *hport = slot->hport;
+    struct usbh_hubport *p;
+    uint32_t route = 0;
+    uint8_t tt_slot = 0;
+    uint8_t tt_port = 0;
+    bool tt_mtt = false;
+    uint8_t entries = 1;
+
+    memset(ctx, 0, hcd->ctx_size);
+
+    /* route string holds one port number per tier below roothub, tier 1 in bits 0-3 */
+    p = hport;
+    while (!p->parent->is_roothub) {
+        route = (route << 4) | ((p->port > 15) ? 15 : p->port);
+        /* low/full speed device is served by the nearest high speed hub tt */
+        if ((tt_slot == 0) && (hport->speed < USB_SPEED_HIGH) && (p->parent->speed == USB_SPEED_HIGH)) {
+            tt_slot = p->parent->parent->slot_id;
+            tt_port = p->port;
+            tt_mtt = p->parent->ismtt;
+        }
+        p = p->parent->parent;
+    }
+
+    for (uint8_t dci = 31; dci > 1; dci--) {
+        if (slot->eps[dci]) {
+            entries = dci;
+            break;
+        }
+    }
+
+    ctx->info[0] = (route & XHCI_SLOT_CTX0_ROUTE_MASK) |
+                   ((uint32_t)xhci_slot_speed(hport->speed) << XHCI_SLOT_CTX0_SPEED_SHIFT) |
+                   ((uint32_t)entries << XHCI_SLOT_CTX0_ENTRIES_SHIFT);
+    ctx->info[1] = (uint32_t)p->port << XHCI_SLOT_CTX1_RHPORT_SHIFT;
+    ctx->info[2] = ((uint32_t)tt_slot << XHCI_SLOT_CTX2_TTSLOT_SHIFT) | ((uint32_t)tt_port << XHCI_SLOT_CTX2_TTPORT_SHIFT);
+    if (tt_mtt) {
+        ctx->info[0] |= XHCI_SLOT_CTX0_MTT;
+    }
+
+    if (slot->is_hub && hport->self) {
+        ctx->info[0] |= XHCI_SLOT_CTX0_HUB;
+        ctx->info[1] |= (uint32_t)hport->self->nports << XHCI_SLOT_CTX1_NPORTS_SHIFT;
+        if (hport->speed == USB_SPEED_HIGH) {
+            if (hport->self->ismtt) {
+                ctx->info[0] |= XHCI_SLOT_CTX0_MTT;
+            }
+            ctx->info[2] |= (uint32_t)hport->self->tt_think << XHCI_SLOT_CTX2_TTT_SHIFT;
+        }
+    }
+}
+
+static uint8_t xhci_ep_interval(struct xhci_endpoint *ep, uint8_t speed)
+{
+    uint8_t interval = 0;
+    uint32_t frames;
+
+    if (ep->ep_type == USB_ENDPOINT_TYPE_CONTROL || ep->ep_type == USB_ENDPOINT_TYPE_BULK) {
+        return 0;
+    }
+
+    if (speed >= USB_SPEED_HIGH || ep->ep_type == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
+        /* 2^(bInterval - 1) (micro)frames */
+        interval = ep->ep_interval ? (ep->ep_interval - 1) : 0;
+        if (speed < USB_SPEED_HIGH) {
+            interval += 3;
+        }
+    } else {
+        /* bInterval frames, rounded down to a power of two in 125us units */
+        frames = ep->ep_interval ? ep->ep_interval * 8 : 8;
+        while (frames > 1) {
+            frames >>= 1;
+            interval++;
+        }
+        if (interval < 3) {
+            interval = 3;
+        }
+        if (interval > 10) {
+            interval = 10;
+        }
+    }
+
+    return (interval > 15) ? 15 : interval;
+}
+
+static void xhci_ep_ctx_fill(struct xhci_hcd *hcd, struct xhci_slot *slot, struct xhci_endpoint *ep)
+{
+    struct xhci_ep_ctx *ctx = xhci_in_ctx(hcd, slot, ep->dci + 1);
+    bool in = (ep->dci & 0x01) ? true : false;
+    uint8_t type;
+    uint8_t burst = 0;
+    uint32_t avg_len;
+    uint32_t esit = 0;
+
+    memset(ctx, 0, hcd->ctx_size);
+
+    switch (ep->ep_type) {
+        case USB_ENDPOINT_TYPE_CONTROL:
+            type = XHCI_EP_TYPE_CONTROL;
+            avg_len = 8;
+            break;
+        case USB_ENDPOINT_TYPE_BULK:
+            type = in ? XHCI_EP_TYPE_BULK_IN : XHCI_EP_TYPE_BULK_OUT;
+            avg_len = 3072;
+            break;
+        case USB_ENDPOINT_TYPE_INTERRUPT:
+            type = in ? XHCI_EP_TYPE_INTR_IN : XHCI_EP_TYPE_INTR_OUT;
+            avg_len = ep->ep_mps;
+            break;
+        default:
+            type = in ? XHCI_EP_TYPE_ISOCH_IN : XHCI_EP_TYPE_ISOCH_OUT;
+            avg_len = ep->ep_mps;
+            break;
+    }
+
+    if (ep->ep_type == USB_ENDPOINT_TYPE_INTERRUPT || ep->ep_type == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
+        if (slot->hport->speed == USB_SPEED_HIGH) {
+            burst = ep->ep_mult;
+        }
+        esit = (uint32_t)ep->ep_mps * (burst + 1);
+    }
+
+    ctx->info0 = ((uint32_t)xhci_ep_interval(ep, slot->hport->speed) << XHCI_EP_CTX0_INTERVAL_SHIFT) |
+                 ((esit >> 16) << XHCI_EP_CTX0_ESITHI_SHIFT);
+    ctx->info1 = ((ep->ep_type == USB_ENDPOINT_TYPE_ISOCHRONOUS ? 0 : 3) << XHCI_EP_CTX1_CERR_SHIFT) |
+                 ((uint32_t)type << XHCI_EP_CTX1_TYPE_SHIFT) |
+                 ((uint32_t)burst << XHCI_EP_CTX1_BURST_SHIFT) |
+                 ((uint32_t)ep->ep_mps << XHCI_EP_CTX1_MPS_SHIFT);
+    ctx->deq_lo = (uint32_t)xhci_ring_deq_addr(&ep->ring, ep->ring.enqueue, ep->ring.cycle);
+    ctx->deq_hi = (uint32_t)(xhci_ring_deq_addr(&ep->ring, ep->ring.enqueue, ep->ring.cycle) >> 32);
+    ctx->info4 = (avg_len << XHCI_EP_CTX4_AVGLEN_SHIFT) | ((esit & 0xffff) << XHCI_EP_CTX4_ESITLO_SHIFT);
+}
+
+static void xhci_in_ctx_prepare(struct xhci_hcd *hcd, struct xhci_slot *slot, uint32_t drop, uint32_t add)
+{
+    struct xhci_input_ctrl_ctx *ctrl = xhci_in_ctx(hcd, slot, 0);
+
+    memset(ctrl, 0, hcd->ctx_size);
+    ctrl->drop_flags = drop;
+    ctrl->add_flags = add;
+
+    xhci_slot_ctx_fill(hcd, slot);
+    for (uint8_t dci = 1; dci < 32; dci++) {
+        if ((add & (1U << dci)) && slot->eps[dci]) {
+            xhci_ep_ctx_fill(hcd, slot, slot->eps[dci]);
+        }
+    }
+    xhci_dcache_sync(slot->in_ctx, 33 * hcd->ctx_size, XHCI_DCACHE_FLUSH);
+}
+
+/* Endpoints ****************************************************************/
+
+static struct xhci_endpoint *xhci_ep_alloc(struct xhci_slot *slot, uint8_t slot_id, struct usb_endpoint_descriptor *desc)
+{
+    struct xhci_endpoint *ep;
+
+    ep = usb_osal_malloc(sizeof(struct xhci_endpoint));
+    if (ep == NULL) {
+        return NULL;
+    }
+    memset(ep, 0, sizeof(struct xhci_endpoint));
+
+    if (xhci_ring_alloc(&ep->ring, CONFIG_USB_XHCI_RING_SIZE) < 0) {
+        usb_osal_free(ep);
+        return NULL;
+    }
+
+    ep->waitsem = usb_osal_sem_create(0);
+    if (ep->waitsem == NULL) {
+        xhci_ring_free(&ep->ring);
+        usb_osal_free(ep);
+        return NULL;
+    }
+
+    ep->hport = slot->hport;
+    ep->slot_id = slot_id;
+    ep->dci = xhci_ep_dci(desc->bEndpointAddress);
+    ep->ep_type = USB_GET_ENDPOINT_TYPE(desc->bmAttributes);
+    ep->ep_interval = desc->bInterval;
+    ep->ep_mps = USB_GET_MAXPACKETSIZE(desc->wMaxPacketSize);
+    ep->ep_mult = USB_GET_MULT(desc->wMaxPacketSize);
+    return ep;
+}
+
+static void xhci_ep_free(struct xhci_endpoint *ep)
+{
+    usb_osal_sem_delete(ep->waitsem);
+    xhci_ring_free(&ep->ring);
+    usb_osal_free(ep);
+}
+
+static bool xhci_ep_match(struct xhci_endpoint *ep, struct usb_endpoint_descriptor *desc)
+{
+    if (ep->ep_type == USB_ENDPOINT_TYPE_CONTROL) {
+        return true;
+    }
+    return (ep->ep_type == USB_GET_ENDPOINT_TYPE(desc->bmAttributes)) &&
+           (ep->ep_mps == USB_GET_MAXPACKETSIZE(desc->wMaxPacketSize)) &&
+           (ep->ep_mult == USB_GET_MULT(desc->wMaxPacketSize)) &&
+           (ep->ep_interval == desc->bInterval);
+}
+
+/* Called with critical section held, hands back every urb still on the ring */
+static void xhci_ep_flush(struct xhci_hcd *hcd, struct xhci_endpoint *ep)
+{
+    struct xhci_td *td;
+    struct usbh_urb *urb;
+
+    while (ep->td_count) {
+        td = &ep->tds[ep->td_head];
+        urb = td->urb;
+        ep->ring.free += td->ntrbs;
+        td->urb = NULL;
+        ep->td_head = (ep->td_head + 1) % CONFIG_USB_XHCI_TD_NUM;
+        ep->td_count--;
+
+        if (urb) {
+            urb->hcpriv = NULL;
+            urb->errorcode = -USB_ERR_SHUTDOWN;
+            if (urb->timeout) {
+                usb_osal_sem_give(ep->waitsem);
+            }
+        }
+    }
+    xhci_cmd_forget(hcd, &ep->recover_cmd);
+    ep->halted = false;
+}
+
+/* Slots ********************************************************************/
+
+static struct xhci_slot *xhci_slot_get(struct xhci_hcd *hcd, struct usbh_hubport *hport)
+{
+    struct xhci_slot *slot;
+
+    if ((hport->slot_id == 0) || (hport->slot_id > hcd->max_slots)) {
+        return NULL;
+    }
+    slot = &hcd->slots[hport->slot_id];
+    if (slot->hport != hport) {
+        return NULL;
+    }
+    return slot;
+}
+
+/* Issue configure endpoint with the eps added to or removed from slot->eps, caller holds cmd_mutex */
+static int xhci_slot_configure(struct usbh_bus *bus, struct xhci_slot *slot, uint32_t drop, uint32_t add)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    uint8_t slot_id = slot - hcd->slots;
+    int ret;
+
+    xhci_in_ctx_prepare(hcd, slot, drop, add | 0x01);
+    ret = xhci_cmd_sync(bus, XHCI_TRB_TYPE(XHCI_TRB_TYPE_CONFIGURE_EP) | XHCI_TRB_SLOT(slot_id), XHCI_PTR2ADDR(slot->in_ctx), NULL);
+    if (ret < 0) {
+        return ret;
+    }
+    if (ret != XHCI_CC_SUCCESS) {
+        USB_LOG_ERR("Configure endpoint fail, slot %u, cc %d\r\n", slot_id, ret);
+        return xhci_cc2errorcode(ret);
+    }
+    return 0;
+}
+
+/* Remove the endpoints in mask from slot, they are freed after configure endpoint is done */
+static void xhci_slot_detach_eps(struct usbh_bus *bus, struct xhci_slot *slot, uint32_t mask, struct xhci_endpoint **list)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    size_t flags;
+
+    flags = usb_osal_enter_critical_section();
+    for (uint8_t dci = 1; dci < 32; dci++) {
+        if ((mask & (1U << dci)) && slot->eps[dci]) {
+            xhci_ep_flush(hcd, slot->eps[dci]);
+            list[dci] = slot->eps[dci];
+            slot->eps[dci] = NULL;
+        }
+    }
+    usb_osal_leave_critical_section(flags);
+}
+
+static void xhci_slot_release(struct usbh_bus *bus, struct xhci_slot *slot)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    struct xhci_endpoint *eps[32] = { 0 };
+    uint8_t slot_id = slot - hcd->slots;
+    size_t flags;
+
+    xhci_cmd_sync(bus, XHCI_TRB_TYPE(XHCI_TRB_TYPE_DISABLE_SLOT) | XHCI_TRB_SLOT(slot_id), 0, NULL);
+
+    xhci_slot_detach_eps(bus, slot, 0xfffffffe, eps);
+
+    flags = usb_osal_enter_critical_section();
+    hcd->dcbaa[slot_id] = 0;
+    xhci_dcache_sync(&hcd->dcbaa[slot_id], sizeof(uint64_t), XHCI_DCACHE_FLUSH);
+    if (slot->hport && (slot->hport->slot_id == slot_id)) {
+        slot->hport->slot_id = 0;
+    }
+    slot->hport = NULL;
+    usb_osal_leave_critical_section(flags);
+
+    for (uint8_t dci = 1; dci < 32; dci++) {
+        if (eps[dci]) {
+            xhci_ep_free(eps[dci]);
+        }
+    }
+    xhci_mem_free(slot->in_ctx);
+    xhci_mem_free(slot->out_ctx);
+    memset(slot, 0, sizeof(struct xhci_slot));
+}
+
+/* Enable a slot for the device and address it with BSR set, so requests to
+ * address 0 still work until the stack sends SET_ADDRESS.
+ */
+static int xhci_slot_create(struct usbh_bus *bus, struct usbh_hubport *hport)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    struct xhci_slot *slot;
+    struct xhci_trb event;
+    uint8_t slot_id;
+    int ret;
+
+    ret = xhci_cmd_sync(bus, XHCI_TRB_TYPE(XHCI_TRB_TYPE_ENABLE_SLOT), 0, &event);
+    if (ret < 0) {
+        return ret;
+    }
+    if (ret != XHCI_CC_SUCCESS) {
+        USB_LOG_ERR("Enable slot fail, cc %d\r\n", ret);
+        return xhci_cc2errorcode(ret);
+    }
+
+    slot_id = XHCI_TRB_GET_SLOT(event.control);
+    if ((slot_id == 0) || (slot_id > hcd->max_slots)) {
+        return -USB_ERR_RANGE;
+    }
+
+    slot = &hcd->slots[slot_id];
+    memset(slot, 0, sizeof(struct xhci_slot));
+    slot->hport = hport;
+    hport->slot_id = slot_id;
+
+    slot->out_ctx = xhci_dma_alloc(64, 32 * hcd->ctx_size);
+    slot->in_ctx = xhci_dma_alloc(64, 33 * hcd->ctx_size);
+    slot->eps[1] = slot->out_ctx && slot->in_ctx ? xhci_ep_alloc(slot, slot_id, &hport->ep0) : NULL;
+    if (slot->eps[1] == NULL) {
+        xhci_slot_release(bus, slot);
+        return -USB_ERR_NOMEM;
+    }
+
+    hcd->dcbaa[slot_id] = XHCI_PTR2ADDR(slot->out_ctx);
+    xhci_dcache_sync(&hcd->dcbaa[slot_id], sizeof(uint64_t), XHCI_DCACHE_FLUSH);
+
+    xhci_in_ctx_prepare(hcd, slot, 0, 0x03);
+    ret = xhci_cmd_sync(bus, XHCI_TRB_TYPE(XHCI_TRB_TYPE_ADDRESS_DEVICE) | XHCI_TRB_BSR | XHCI_TRB_SLOT(slot_id),
+                        XHCI_PTR2ADDR(slot->in_ctx), NULL);
+    if (ret != XHCI_CC_SUCCESS) {
+        USB_LOG_ERR("Address device fail, slot %u, cc %d\r\n", slot_id, ret);
+        xhci_slot_release(bus, slot);
+        return (ret < 0) ? ret : xhci_cc2errorcode(ret);
+    }
+
+    USB_LOG_DBG("Enable slot %u, route 0x%05x\r\n", slot_id,
+                (unsigned int)(((struct xhci_slot_ctx *)xhci_in_ctx(hcd, slot, 1))->info[0] & XHCI_SLOT_CTX0_ROUTE_MASK));
+    return 0;
+}
+
+/* Configure all endpoints of interface alternate setting, or of every interface when intf is 0xff */
+static int xhci_slot_set_altsetting(struct usbh_bus *bus, struct xhci_slot *slot, uint8_t intf, uint8_t altsetting)
+{
+    struct usbh_hubport *hport = slot->hport;
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    struct xhci_endpoint *dropped[32] = { 0 };
+    struct usbh_interface_altsetting *alt;
+    struct usb_endpoint_descriptor *desc;
+    uint32_t drop = 0;
+    uint32_t add = 0;
+    uint8_t dci;
+    int ret;
+
+    for (uint8_t i = 0; i < hport->config.config_desc.bNumInterfaces && i < CONFIG_USBHOST_MAX_INTERFACES; i++) {
+        if ((intf != 0xff) && (i != intf)) {
+            continue;
+        }
+        /* drop endpoints of every alternate setting */
+        for (uint8_t j = 0; j < hport->config.intf[i].altsetting_num && j < CONFIG_USBHOST_MAX_INTF_ALTSETTINGS; j++) {
+            alt = &hport->config.intf[i].altsetting[j];
+            for (uint8_t k = 0; k < alt->intf_desc.bNumEndpoints && k < CONFIG_USBHOST_MAX_ENDPOINTS; k++) {
+                dci = xhci_ep_dci(alt->ep[k].ep_desc.bEndpointAddress);
+                if ((dci > 1) && slot->eps[dci]) {
+                    drop |= (1U << dci);
+                }
+            }
+        }
+    }
+    xhci_slot_detach_eps(bus, slot, drop, dropped);
+
+    for (uint8_t i = 0; i < hport->config.config_desc.bNumInterfaces && i < CONFIG_USBHOST_MAX_INTERFACES; i++) {
+        if ((intf != 0xff) && (i != intf)) {
+            continue;
+        }
+        if (altsetting >= hport->config.intf[i].altsetting_num) {
+            continue;
+        }
+        alt = &hport->config.intf[i].altsetting[(intf == 0xff) ? 0 : altsetting];
+        for (uint8_t k = 0; k < alt->intf_desc.bNumEndpoints && k < CONFIG_USBHOST_MAX_ENDPOINTS; k++) {
+            desc = &alt->ep[k].ep_desc;
+            dci = xhci_ep_dci(desc->bEndpointAddress);
+            if ((dci < 2) || (add & (1U << dci)) ||
+                (USB_GET_ENDPOINT_TYPE(desc->bmAttributes) == USB_ENDPOINT_TYPE_ISOCHRONOUS)) {
+                continue;
+            }
+            slot->eps[dci] = xhci_ep_alloc(slot, slot - hcd->slots, desc);
+            if (slot->eps[dci]) {
+                add |= (1U << dci);
+            }
+        }
+    }
+
+    if (!drop && !add) {
+        return 0;
+    }
+
+    ret = xhci_slot_configure(bus, slot, drop, add);
+    if (ret < 0) {
+        xhci_slot_detach_eps(bus, slot, add, dropped);
+    }
+
+    for (dci = 2; dci < 32; dci++) {
+        if (dropped[dci]) {
+            xhci_ep_free(dropped[dci]);
+        }
+    }
+    return ret;
+}
+
+/* Get or create the endpoint for a non control urb, caller holds cmd_mutex */
+static int xhci_ep_open(struct usbh_bus *bus, struct xhci_slot *slot, struct usb_endpoint_descriptor *desc)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    struct xhci_endpoint *dropped[32] = { 0 };
+    uint8_t dci = xhci_ep_dci(desc->bEndpointAddress);
+    uint32_t drop = 0;
+    int ret;
+
+    if (slot->eps[dci] && xhci_ep_match(slot->eps[dci], desc)) {
+        return 0;
+    }
+    if (slot->eps[dci]) {
+        drop = (1U << dci);
+        xhci_slot_detach_eps(bus, slot, drop, dropped);
+    }
+
+    slot->eps[dci] = xhci_ep_alloc(slot, slot - hcd->slots, desc);
+    if (slot->eps[dci] == NULL) {
+        ret = -USB_ERR_NOMEM;
+    } else {
+        ret = xhci_slot_configure(bus, slot, drop, (1U << dci));
+        if (ret < 0) {
+            xhci_slot_detach_eps(bus, slot, (1U << dci), dropped);
+        }
+    }
+
+    if (dropped[dci]) {
+        xhci_ep_free(dropped[dci]);
+    }
+    return ret;
+}
+
+/* Stop endpoint and give back every urb on it, caller holds cmd_mutex */
+static void xhci_ep_stop(struct usbh_bus *bus, struct xhci_slot *slot, struct xhci_endpoint *ep)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    uint8_t slot_id = ep->slot_id;
+    uint64_t deq;
+    size_t flags;
+    int ret;
+
+    /* let error recovery started in interrupt finish first */
+    for (uint32_t i = 0; ep->halted && (i < 100); i++) {
+        usb_osal_msleep(1);
+    }
+
+    ret = xhci_cmd_sync(bus, XHCI_TRB_TYPE(XHCI_TRB_TYPE_STOP_EP) | XHCI_TRB_SLOT(slot_id) | XHCI_TRB_EPID(ep->dci), 0, NULL);
+    if ((ret == XHCI_CC_CONTEXT_STATE) && (xhci_ep_state(hcd, slot, ep->dci) == XHCI_EP_STATE_HALTED)) {
+        xhci_cmd_sync(bus, XHCI_TRB_TYPE(XHCI_TRB_TYPE_RESET_EP) | XHCI_TRB_SLOT(slot_id) | XHCI_TRB_EPID(ep->dci), 0, NULL);
+    }
+
+    flags = usb_osal_enter_critical_section();
+    xhci_ep_flush(hcd, ep);
+    /* hold the doorbell until the new dequeue pointer is set */
+    ep->halted = true;
+    deq = xhci_ring_deq_addr(&ep->ring, ep->ring.enqueue, ep->ring.cycle);
+    usb_osal_leave_critical_section(flags);
+
+    xhci_cmd_sync(bus, XHCI_TRB_TYPE(XHCI_TRB_TYPE_SET_TR_DEQUEUE) | XHCI_TRB_SLOT(slot_id) | XHCI_TRB_EPID(ep->dci), deq, NULL);
+
+    flags = usb_osal_enter_critical_section();
+    ep->halted = false;
+    if (ep->td_count) {
+        XHCI_DBAR[slot_id] = ep->dci;
+    }
+    usb_osal_leave_critical_section(flags);
+}
+
+/* Error recovery from interrupt: reset endpoint, move dequeue past the failed td, restart */
+
+static void xhci_recover_dequeue_done(struct usbh_bus *bus, struct xhci_cmd *cmd)
+{
+    struct xhci_endpoint *ep = (struct xhci_endpoint *)cmd->arg;
+
+    ep->halted = false;
+    if (ep->td_count) {
+        XHCI_DBAR[ep->slot_id] = ep->dci;
+    }
+}
+
+static void xhci_recover_reset_done(struct usbh_bus *bus, struct xhci_cmd *cmd)
+{
+    struct xhci_endpoint *ep = (struct xhci_endpoint *)cmd->arg;
+    uint64_t deq;
+
+    if (ep->td_count) {
+        deq = xhci_ring_deq_addr(&ep->ring, ep->tds[ep->td_head].start, ep->tds[ep->td_head].start_cycle);
+    } else {
+        deq = xhci_ring_deq_addr(&ep->ring, ep->ring.enqueue, ep->ring.cycle);
+    }
+
+    cmd->trb.param_lo = (uint32_t)deq;
+    cmd->trb.param_hi = (uint32_t)(deq >> 32);
+    cmd->trb.control = XHCI_TRB_TYPE(XHCI_TRB_TYPE_SET_TR_DEQUEUE) | XHCI_TRB_SLOT(ep->slot_id) | XHCI_TRB_EPID(ep->dci);
+    cmd->complete = xhci_recover_dequeue_done;
+    if (xhci_cmd_post(bus, cmd) < 0) {
+        USB_LOG_ERR("Command ring full, slot %u ep %u stays halted\r\n", ep->slot_id, ep->dci);
+    }
+}
+
+static void xhci_ep_recover(struct usbh_bus *bus, struct xhci_endpoint *ep)
+{
+    struct xhci_cmd *cmd = &ep->recover_cmd;
+
+    if (ep->halted) {
+        return;
+    }
+    ep->halted = true;
+
+    cmd->trb.param_lo = 0;
+    cmd->trb.param_hi = 0;
+    cmd->trb.status = 0;
+    cmd->trb.control = XHCI_TRB_TYPE(XHCI_TRB_TYPE_RESET_EP) | XHCI_TRB_SLOT(ep->slot_id) | XHCI_TRB_EPID(ep->dci);
+    cmd->complete = xhci_recover_reset_done;
+    cmd->arg = ep;
+    if (xhci_cmd_post(bus, cmd) < 0) {
+        USB_LOG_ERR("Command ring full, slot %u ep %u stays halted\r\n", ep->slot_id, ep->dci);
+    }
+}
+
+/* Transfers ****************************************************************/
+
+static uint32_t xhci_data_trbs(uintptr_t addr, uint32_t len)
+{
+    uint32_t num = 0;
+    uint32_t chunk;
+
+    if (len == 0) {
+        return 1;
+    }
+
+    while (len) {
+        chunk = XHCI_TRB_MAX_BUFFER - (addr & (XHCI_TRB_MAX_BUFFER - 1));
+        if (chunk > len) {
+            chunk = len;
+        }
+        addr += chunk;
+        len -= chunk;
+        num++;
+    }
+    return num;
+}
+
+/* Chained data trbs, the first one is of type and carries dir, the rest are normal trbs */
+static void xhci_push_data(struct xhci_ring *ring, uint32_t type, uint32_t dir, uint8_t *buffer, uint32_t len, uint16_t mps, struct xhci_trb **first)
+{
+    uintptr_t addr = (uintptr_t)buffer;
+    uint32_t remain = len;
+    uint32_t chunk;
+    uint32_t tdsize;
+    struct xhci_trb *trb;
+
+    do {
+        chunk = XHCI_TRB_MAX_BUFFER - (addr & (XHCI_TRB_MAX_BUFFER - 1));
+        if (chunk > remain) {
+            chunk = remain;
+        }
+        remain -= chunk;
+        tdsize = (remain + mps - 1) / mps;
+        if (tdsize > 31) {
+            tdsize = 31;
+        }
+
+        trb = xhci_ring_push(ring, addr ? XHCI_PTR2ADDR(addr) : 0,
+                             chunk | (tdsize << XHCI_TRB_TDSIZE_SHIFT),
+                             XHCI_TRB_TYPE(type) | dir | XHCI_TRB_CH, *first == NULL);
+        if (*first == NULL) {
+            *first = trb;
+        }
+        type = XHCI_TRB_TYPE_NORMAL;
+        dir = 0;
+        addr += chunk;
+    } while (remain);
+}
+
+/* Queue one urb as a td, called with critical section held.
+ *
+ * Every td ends with an event data trb whose parameter is the td itself, the
+ * completion event reports the bytes moved by the td, short packets included.
+ * Control tds put another event data trb after the data stage to catch its length.
+ */
+static int xhci_td_queue(struct usbh_bus *bus, struct xhci_endpoint *ep, struct usbh_urb *urb)
+{
+    struct xhci_td *td;
+    struct xhci_trb *first = NULL;
+    uint32_t ntrbs;
+    uint32_t len = urb->transfer_buffer_length;
+    bool in;
+    uint64_t setup;
+
+    (void)bus;
+
+    if (ep->td_count >= CONFIG_USB_XHCI_TD_NUM) {
+        return -USB_ERR_BUSY;
+    }
+
+    if (ep->ep_type == USB_ENDPOINT_TYPE_CONTROL) {
+        len = len < urb->setup->wLength ? len : urb->setup->wLength;
+        ntrbs = len ? xhci_data_trbs((uintptr_t)urb->transfer_buffer, len) + 4 : 3;
+    } else {
+        ntrbs = xhci_data_trbs((uintptr_t)urb->transfer_buffer, len) + 1;
+    }
+    if (ntrbs > ep->ring.free) {
+        return -USB_ERR_BUSY;
+    }
+
+    td = &ep->tds[(ep->td_head + ep->td_count) % CONFIG_USB_XHCI_TD_NUM];
+    td->urb = urb;
+    td->start = ep->ring.enqueue;
+    td->start_cycle = ep->ring.cycle;
+    td->ntrbs = ntrbs;
+
+    if (ep->ep_type == USB_ENDPOINT_TYPE_CONTROL) {
+        in = (urb->setup->bmRequestType & USB_REQUEST_DIR_MASK) == USB_REQUEST_DIR_IN;
+
+        memcpy(&setup, urb->setup, 8);
+        first = xhci_ring_push(&ep->ring, setup, 8,
+                               XHCI_TRB_TYPE(XHCI_TRB_TYPE_SETUP) | XHCI_TRB_IDT |
+                                   (len ? (in ? XHCI_TRB_TRT_IN : XHCI_TRB_TRT_OUT) : XHCI_TRB_TRT_NODATA),
+                               true);
+        if (len) {
+            if (in) {
+                xhci_dcache_sync(urb->transfer_buffer, len, XHCI_DCACHE_FLUSH | XHCI_DCACHE_INVALIDATE);
+            } else {
+                xhci_dcache_sync(urb->transfer_buffer, len, XHCI_DCACHE_FLUSH);
+            }
+            xhci_push_data(&ep->ring, XHCI_TRB_TYPE_DATA, in ? XHCI_TRB_DIR_IN : 0, urb->transfer_buffer, len, ep->ep_mps, &first);
+            xhci_ring_push(&ep->ring, (uintptr_t)td | 1, 0, XHCI_TRB_TYPE(XHCI_TRB_TYPE_EVENT_DATA) | XHCI_TRB_IOC, false);
+        }
+        xhci_ring_push(&ep->ring, 0, 0, XHCI_TRB_TYPE(XHCI_TRB_TYPE_STATUS) | XHCI_TRB_CH | ((len && in) ? 0 : XHCI_TRB_DIR_IN), false);
+    } else {
+        in = (ep->dci & 0x01) ? true : false;
+        if (in) {
+            xhci_dcache_sync(urb->transfer_buffer, len, XHCI_DCACHE_FLUSH | XHCI_DCACHE_INVALIDATE);
+        } else {
+            xhci_dcache_sync(urb->transfer_buffer, len, XHCI_DCACHE_FLUSH);
+        }
+        xhci_push_data(&ep->ring, XHCI_TRB_TYPE_NORMAL, 0, urb->transfer_buffer, len, ep->ep_mps, &first);
+    }
+    xhci_ring_push(&ep->ring, (uintptr_t)td, 0, XHCI_TRB_TYPE(XHCI_TRB_TYPE_EVENT_DATA) | XHCI_TRB_IOC, false);
+
+    ep->td_count++;
+    xhci_ring_commit(first);
+
+    if (!ep->halted) {
+        XHCI_DBAR[ep->slot_id] = ep->dci;
+    }
+    return 0;
+}
+
+static void xhci_td_giveback(struct xhci_endpoint *ep, int errorcode)
+{
+    struct xhci_td *td = &ep->tds[ep->td_head];
+    struct usbh_urb *urb = td->urb;
+
+    ep->ring.free += td->ntrbs;
+    td->urb = NULL;
+    ep->td_head = (ep->td_head + 1) % CONFIG_USB_XHCI_TD_NUM;
+    ep->td_count--;
+
+    if (urb == NULL) {
+        return;
+    }
+
+    if (urb->actual_length && (ep->ep_type == USB_ENDPOINT_TYPE_CONTROL ?
+                                   ((urb->setup->bmRequestType & USB_REQUEST_DIR_MASK) == USB_REQUEST_DIR_IN) :
+                                   (ep->dci & 0x01))) {
+        xhci_dcache_sync(urb->transfer_buffer, urb->actual_length, XHCI_DCACHE_INVALIDATE);
+    }
+
+    urb->hcpriv = NULL;
+    urb->errorcode = errorcode;
+
+    if (urb->timeout) {
+        usb_osal_sem_give(ep->waitsem);
+    }
+
+    if (urb->complete) {
+        if (urb->errorcode < 0) {
+            urb->complete(urb->arg, urb->errorcode);
+        } else {
+            urb->complete(urb->arg, urb->actual_length);
+        }
+    }
+}
+
+static void xhci_handle_transfer_event(struct usbh_bus *bus, struct xhci_trb *event)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    uint8_t slot_id = XHCI_TRB_GET_SLOT(event->control);
+    uint8_t dci = XHCI_TRB_GET_EPID(event->control);
+    uint8_t cc = XHCI_EVT_GET_CC(event->status);
+    struct xhci_slot *slot;
+    struct xhci_endpoint *ep;
+    struct xhci_td *td;
+    uintptr_t param;
+
+    if ((slot_id == 0) || (slot_id > hcd->max_slots) || (dci == 0) || (dci > 31)) {
+        return;
+    }
+    slot = &hcd->slots[slot_id];
+    ep = slot->eps[dci];
+    if (!slot->hport || !ep || !ep->td_count) {
+        return;
+    }
+
+    /* stop endpoint reports where it stopped, kill handles the tds */
+    if ((cc == XHCI_CC_STOPPED) || (cc == XHCI_CC_STOPPED_LEN_INVALID) || (cc == XHCI_CC_STOPPED_SHORT_PACKET)) {
+        return;
+    }
+
+    td = &ep->tds[ep->td_head];
+
+    if (event->control & XHCI_EVT_ED) {
+        param = (uintptr_t)(((uint64_t)event->param_hi << 32) | event->param_lo);
+        if ((param & ~(uintptr_t)1) != (uintptr_t)td) {
+            return;
+        }
+        if (td->urb) {
+            if (param & 1) {
+                /* end of control data stage */
+                td->urb->actual_length = event->status & XHCI_EVT_LEN_MASK;
+            } else if (ep->ep_type != USB_ENDPOINT_TYPE_CONTROL) {
+                td->urb->actual_length = event->status & XHCI_EVT_LEN_MASK;
+            }
+        }
+        if ((cc == XHCI_CC_SUCCESS) || (cc == XHCI_CC_SHORT_PACKET)) {
+            if (!(param & 1)) {
+                xhci_td_giveback(ep, 0);
+            }
+            return;
+        }
+    } else if ((cc == XHCI_CC_SUCCESS) || (cc == XHCI_CC_SHORT_PACKET)) {
+        return;
+    }
+
+    /* transfer trb failed, the rest of the td is skipped by recovery */
+    xhci_td_giveback(ep, xhci_cc2errorcode(cc));
+    if (xhci_ep_state(hcd, slot, dci) == XHCI_EP_STATE_HALTED) {
+        xhci_ep_recover(bus, ep);
+    }
+}
+
+static void xhci_handle_command_event(struct usbh_bus *bus, struct xhci_trb *event)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    uint64_t addr = ((uint64_t)event->param_hi << 32) | event->param_lo;
+    uint64_t base = XHCI_PTR2ADDR(hcd->cmd_ring.trbs);
+    struct xhci_cmd *cmd;
+    uint32_t index;
+
+    if ((addr < base) || (addr >= base + CONFIG_USB_XHCI_CMD_RING_SIZE * sizeof(struct xhci_trb))) {
+        return;
+    }
+
+    index = (uint32_t)((addr - base) / sizeof(struct xhci_trb));
+    cmd = hcd->cmd_pending[index];
+    hcd->cmd_pending[index] = NULL;
+    hcd->cmd_ring.free++;
+
+    if (cmd) {
+        cmd->event = *event;
+        cmd->done = true;
+        if (cmd->complete) {
+            cmd->complete(bus, cmd);
+        } else if (cmd->waitsem) {
+            usb_osal_sem_give(cmd->waitsem);
+        }
+    }
+}
+
+/* Controller ***************************************************************/
+
+static volatile uint32_t *xhci_find_xcap(struct usbh_bus *bus, volatile uint32_t *start, uint8_t id)
+{
+    volatile uint32_t *cap;
+    uint32_t offset;
+
+    if (start == NULL) {
+        offset = (XHCI_HCCR->hccparams1 & XHCI_HCCPARAMS1_XECP_MASK) >> XHCI_HCCPARAMS1_XECP_SHIFT;
+        if (offset == 0) {
+            return NULL;
+        }
+        cap = (volatile uint32_t *)XHCI_HCCR + offset;
+    } else {
+        offset = (*start & XHCI_XCAP_NEXT_MASK) >> XHCI_XCAP_NEXT_SHIFT;
+        if (offset == 0) {
+            return NULL;
+        }
+        cap = start + offset;
+    }
+
+    while (1) {
+        if (((*cap & XHCI_XCAP_ID_MASK) >> XHCI_XCAP_ID_SHIFT) == id) {
+            return cap;
+        }
+        offset = (*cap & XHCI_XCAP_NEXT_MASK) >> XHCI_XCAP_NEXT_SHIFT;
+        if (offset == 0) {
+            return NULL;
+        }
+        cap += offset;
+    }
+}
+
+/* Take the controller from firmware and stop its smi */
+static void xhci_bios_handoff(struct usbh_bus *bus)
+{
+    volatile uint32_t *cap = xhci_find_xcap(bus, NULL, XHCI_XCAP_ID_LEGACY);
+
+    if (cap == NULL) {
+        return;
+    }
+
+    if (cap[0] & XHCI_USBLEGSUP_BIOS_OWNED) {
+        cap[0] |= XHCI_USBLEGSUP_OS_OWNED;
+        if (xhci_handshake(&cap[0], XHCI_USBLEGSUP_BIOS_OWNED, 0, 1000) < 0) {
+            USB_LOG_WRN("xHCI BIOS handoff timeout\r\n");
+            cap[0] &= ~XHCI_USBLEGSUP_BIOS_OWNED;
+        }
+    }
+    cap[1] = (cap[1] & XHCI_USBLEGCTLSTS_DISABLE_SMI) | XHCI_USBLEGCTLSTS_SMI_EVENTS;
+}
+
+static void xhci_protocol_init(struct usbh_bus *bus)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    volatile uint32_t *cap = NULL;
+    uint8_t major, offset, count;
+
+    while ((cap = xhci_find_xcap(bus, cap, XHCI_XCAP_ID_PROTOCOL)) != NULL) {
+        major = cap[0] >> XHCI_PROTOCOL_MAJOR_SHIFT;
+        offset = (cap[2] >> XHCI_PROTOCOL_PORT_OFFSET_SHIFT) & 0xff;
+        count = (cap[2] >> XHCI_PROTOCOL_PORT_COUNT_SHIFT) & 0xff;
+        for (uint16_t port = offset; port < offset + count; port++) {
+            if (port && (port <= hcd->n_ports)) {
+                hcd->port_major[port - 1] = major;
+            }
+        }
+    }
+}
+
+static bool xhci_port_is_usb3(struct usbh_bus *bus, uint8_t port)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+
+    if (hcd->port_major[port - 1]) {
+        return hcd->port_major[port - 1] >= 3;
+    }
+    return ((XHCI_HCOR->port[port - 1].portsc & XHCI_PORTSC_SPEED_MASK) >> XHCI_PORTSC_SPEED_SHIFT) >= XHCI_PORT_SPEED_SUPER;
+}
+
+static void xhci_free_all(struct xhci_hcd *hcd)
+{
+    if (hcd->scratchpad_bufs) {
+        for (uint32_t i = 0; i < hcd->scratchpad_num; i++) {
+            xhci_mem_free(hcd->scratchpad_bufs[i]);
+        }
+        usb_osal_free(hcd->scratchpad_bufs);
+    }
+    xhci_mem_free(hcd->scratchpad_array);
+    xhci_mem_free(hcd->dcbaa);
+    xhci_mem_free(hcd->erst);
+    xhci_mem_free(hcd->event_trbs);
+    xhci_ring_free(&hcd->cmd_ring);
+    if (hcd->sync_cmd.waitsem) {
+        usb_osal_sem_delete(hcd->sync_cmd.waitsem);
+    }
+    if (hcd->cmd_mutex) {
+        usb_osal_mutex_delete(hcd->cmd_mutex);
+    }
+    memset(hcd, 0, sizeof(struct xhci_hcd));
+}
+
+int usb_hc_init(struct usbh_bus *bus)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    struct xhci_intr_regs *ir;
+    uint32_t regval;
+
+    memset(hcd, 0, sizeof(struct xhci_hcd));
+
+    usb_hc_low_level_init(bus);
+
+    USB_LOG_INFO("xHCI HCIVERSION:%04x\r\n", XHCI_HCCR->hciversion);
+
+    xhci_bios_handoff(bus);
+
+    XHCI_HCOR->usbcmd &= ~XHCI_USBCMD_RS;
+    if (xhci_handshake(&XHCI_HCOR->usbsts, XHCI_USBSTS_HCH, XHCI_USBSTS_HCH, 100) < 0) {
+        USB_LOG_ERR("xHCI halt timeout\r\n");
+        return -USB_ERR_TIMEOUT;
+    }
+
+    XHCI_HCOR->usbcmd = XHCI_USBCMD_HCRST;
+    if ((xhci_handshake(&XHCI_HCOR->usbcmd, XHCI_USBCMD_HCRST, 0, 1000) < 0) ||
+        (xhci_handshake(&XHCI_HCOR->usbsts, XHCI_USBSTS_CNR, 0, 1000) < 0)) {
+        USB_LOG_ERR("xHCI reset timeout\r\n");
+        return -USB_ERR_TIMEOUT;
+    }
+
+    regval = XHCI_HCCR->hcsparams1;
+    hcd->max_slots = (regval & XHCI_HCSPARAMS1_MAXSLOTS_MASK) >> XHCI_HCSPARAMS1_MAXSLOTS_SHIFT;
+    if (hcd->max_slots > CONFIG_USB_XHCI_MAX_SLOTS) {
+        hcd->max_slots = CONFIG_USB_XHCI_MAX_SLOTS;
+    }
+    hcd->n_ports = (regval & XHCI_HCSPARAMS1_MAXPORTS_MASK) >> XHCI_HCSPARAMS1_MAXPORTS_SHIFT;
+    if (hcd->n_ports > CONFIG_USBHOST_MAX_RHPORTS) {
+        hcd->n_ports = CONFIG_USBHOST_MAX_RHPORTS;
+    }
+    hcd->ac64 = (XHCI_HCCR->hccparams1 & XHCI_HCCPARAMS1_AC64) ? true : false;
+    hcd->ctx_size = (XHCI_HCCR->hccparams1 & XHCI_HCCPARAMS1_CSZ) ? 64 : 32;
+    hcd->page_size = (XHCI_HCOR->pagesize & 0xffff) << 12;
+
+    USB_LOG_INFO("xHCI slots:%u, ports:%u, context size:%u\r\n", hcd->max_slots, hcd->n_ports, hcd->ctx_size);
+
+    hcd->cmd_mutex = usb_osal_mutex_create();
+    hcd->sync_cmd.waitsem = usb_osal_sem_create(0);
+    if (!hcd->cmd_mutex || !hcd->sync_cmd.waitsem) {
+        goto errout_nomem;
+    }
+
+    XHCI_HCOR->config = (XHCI_HCOR->config & ~XHCI_CONFIG_MAXSLOTSEN_MASK) | hcd->max_slots;
+
+    hcd->dcbaa = xhci_dma_alloc(64, (hcd->max_slots + 1) * sizeof(uint64_t));
+    if (hcd->dcbaa == NULL) {
+        goto errout_nomem;
+    }
+
+    regval = XHCI_HCCR->hcsparams2;
+    hcd->scratchpad_num = (((regval & XHCI_HCSPARAMS2_SPBHI_MASK) >> XHCI_HCSPARAMS2_SPBHI_SHIFT) << 5) |
+                          ((regval & XHCI_HCSPARAMS2_SPBLO_MASK) >> XHCI_HCSPARAMS2_SPBLO_SHIFT);
+    if (hcd->scratchpad_num) {
+        hcd->scratchpad_array = xhci_dma_alloc(64, hcd->scratchpad_num * sizeof(uint64_t));
+        hcd->scratchpad_bufs = usb_osal_malloc(hcd->scratchpad_num * sizeof(void *));
+        if (!hcd->scratchpad_array || !hcd->scratchpad_bufs) {
+            goto errout_nomem;
+        }
+        memset(hcd->scratchpad_bufs, 0, hcd->scratchpad_num * sizeof(void *));
+        for (uint32_t i = 0; i < hcd->scratchpad_num; i++) {
+            hcd->scratchpad_bufs[i] = xhci_dma_alloc(hcd->page_size, hcd->page_size);
+            if (hcd->scratchpad_bufs[i] == NULL) {
+                goto errout_nomem;
+            }
+            hcd->scratchpad_array[i] = XHCI_PTR2ADDR(hcd->scratchpad_bufs[i]);
+        }
+        xhci_dcache_sync(hcd->scratchpad_array, hcd->scratchpad_num * sizeof(uint64_t), XHCI_DCACHE_FLUSH);
+        hcd->dcbaa[0] = XHCI_PTR2ADDR(hcd->scratchpad_array);
+        xhci_dcache_sync(hcd->dcbaa, sizeof(uint64_t), XHCI_DCACHE_FLUSH);
+    }
+    xhci_write64(&XHCI_HCOR->dcbaap_lo, &XHCI_HCOR->dcbaap_hi, XHCI_PTR2ADDR(hcd->dcbaa));
+
+    if (xhci_ring_alloc(&hcd->cmd_ring, CONFIG_USB_XHCI_CMD_RING_SIZE) < 0) {
+        goto errout_nomem;
+    }
+    xhci_write64(&XHCI_HCOR->crcr_lo, &XHCI_HCOR->crcr_hi, XHCI_PTR2ADDR(hcd->cmd_ring.trbs) | XHCI_CRCR_RCS);
+
+    /* one segment event ring on interrupter 0 */
+    hcd->event_trbs = xhci_dma_alloc(64, CONFIG_USB_XHCI_EVENT_RING_SIZE * sizeof(struct xhci_trb));
+    hcd->erst = xhci_dma_alloc(64, sizeof(struct xhci_erst_entry));
+    if (!hcd->event_trbs || !hcd->erst) {
+        goto errout_nomem;
+    }
+    hcd->event_dequeue = 0;
+    hcd->event_cycle = 1;
+    hcd->erst->base_lo = (uint32_t)XHCI_PTR2ADDR(hcd->event_trbs);
+    hcd->erst->base_hi = (uint32_t)(XHCI_PTR2ADDR(hcd->event_trbs) >> 32);
+    hcd->erst->size = CONFIG_USB_XHCI_EVENT_RING_SIZE;
+    xhci_dcache_sync(hcd->erst, sizeof(struct xhci_erst_entry), XHCI_DCACHE_FLUSH);
+
+    ir = &XHCI_HCRR->ir[0];
+    ir->erstsz = 1;
+    xhci_write64(&ir->erdp_lo, &ir->erdp_hi, XHCI_PTR2ADDR(hcd->event_trbs));
+    xhci_write64(&ir->erstba_lo, &ir->erstba_hi, XHCI_PTR2ADDR(hcd->erst));
+    ir->imod = (CONFIG_USB_XHCI_IMOD_INTERVAL << XHCI_IMOD_IMODI_SHIFT) & XHCI_IMOD_IMODI_MASK;
+    ir->iman = XHCI_IMAN_IE | XHCI_IMAN_IP;
+
+    xhci_protocol_init(bus);
+
+    XHCI_HCOR->usbsts = XHCI_USBSTS_EINT | XHCI_USBSTS_PCD | XHCI_USBSTS_HSE;
+    XHCI_HCOR->usbcmd |= (XHCI_USBCMD_INTE | XHCI_USBCMD_HSEE | XHCI_USBCMD_RS);
+    if (xhci_handshake(&XHCI_HCOR->usbsts, XHCI_USBSTS_HCH, 0, 100) < 0) {
+        USB_LOG_ERR("xHCI run timeout\r\n");
+        return -USB_ERR_TIMEOUT;
+    }
+
+    if (XHCI_HCCR->hccparams1 & XHCI_HCCPARAMS1_PPC) {
+        for (uint8_t port = 0; port < hcd->n_ports; port++) {
+            regval = XHCI_HCOR->port[port].portsc;
+            XHCI_HCOR->port[port].portsc = (regval & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_PP;
+        }
+    }
+    return 0;
+
+errout_nomem:
+    USB_LOG_ERR("xHCI no memory\r\n");
+    xhci_free_all(hcd);
+    return -USB_ERR_NOMEM;
+}
+
+int usb_hc_deinit(struct usbh_bus *bus)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    volatile uint32_t timeout = 0;
+
+    XHCI_HCOR->usbcmd &= ~(XHCI_USBCMD_RS | XHCI_USBCMD_INTE);
+    while (!(XHCI_HCOR->usbsts & XHCI_USBSTS_HCH)) {
+        if (++timeout > 1000000) {
+            break;
+        }
+    }
+    XHCI_HCRR->ir[0].iman = XHCI_IMAN_IP;
+
+    for (uint8_t port = 0; port < hcd->n_ports; port++) {
+        XHCI_HCOR->port[port].portsc = XHCI_HCOR->port[port].portsc & XHCI_PORTSC_PRESERVE_MASK & ~XHCI_PORTSC_PP;
+    }
+
+    for (uint8_t slot_id = 1; slot_id <= hcd->max_slots; slot_id++) {
+        struct xhci_slot *slot = &hcd->slots[slot_id];
+
+        for (uint8_t dci = 1; dci < 32; dci++) {
+            if (slot->eps[dci]) {
+                xhci_ep_flush(hcd, slot->eps[dci]);
+                xhci_ep_free(slot->eps[dci]);
+            }
+        }
+        if (slot->hport) {
+            slot->hport->slot_id = 0;
+        }
+        xhci_mem_free(slot->in_ctx);
+        xhci_mem_free(slot->out_ctx);
+    }
+    xhci_free_all(hcd);
+
+    usb_hc_low_level_deinit(bus);
+    return 0;
+}
+
+uint16_t usbh_get_frame_number(struct usbh_bus *bus)
+{
+    return (XHCI_HCRR->mfindex >> 3) & 0x7ff;
+}
+
+static int xhci_reset_port(struct usbh_bus *bus, uint8_t port)
+{
+    volatile uint32_t *portsc = &XHCI_HCOR->port[port - 1].portsc;
+    int ret;
+
+    *portsc = (*portsc & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_PR;
+    ret = xhci_handshake(portsc, XHCI_PORTSC_PRC, XHCI_PORTSC_PRC, 500);
+    if (ret < 0) {
+        USB_LOG_ERR("Port %u reset timeout\r\n", port);
+    }
+    return ret;
+}
+
+int usbh_roothub_control(struct usbh_bus *bus, struct usb_setup_packet *setup, uint8_t *buf)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    volatile uint32_t *portsc;
+    uint8_t nports;
+    uint8_t port;
+    uint32_t temp, status;
+
+    nports = hcd->n_ports;
+
+    port = setup->wIndex;
+
+    if (setup->bmRequestType & USB_REQUEST_RECIPIENT_DEVICE) {
+        switch (setup->bRequest) {
+            case HUB_REQUEST_CLEAR_FEATURE:
+                switch (setup->wValue) {
+                    case HUB_FEATURE_HUB_C_LOCALPOWER:
+                        break;
+                    case HUB_FEATURE_HUB_C_OVERCURRENT:
+                        break;
+                    default:
+                        return -USB_ERR_NOTSUPP;
+                }
+                break;
+            case HUB_REQUEST_SET_FEATURE:
+                switch (setup->wValue) {
+                    case HUB_FEATURE_HUB_C_LOCALPOWER:
+                        break;
+                    case HUB_FEATURE_HUB_C_OVERCURRENT:
+                        break;
+                    default:
+                        return -USB_ERR_NOTSUPP;
+                }
+                break;
+            case HUB_REQUEST_SET_HUB_DEPTH:
+                /* roothub is tier 0, route strings start below it */
+                break;
+            case HUB_REQUEST_GET_DESCRIPTOR:
+                break;
+            case HUB_REQUEST_GET_STATUS:
+                memset(buf, 0, 4);
+                break;
+            default:
+                break;
+        }
+    } else if (setup->bmRequestType & USB_REQUEST_RECIPIENT_OTHER) {
+        if (!port || port > nports) {
+            return -USB_ERR_INVAL;
+        }
+        portsc = &XHCI_HCOR->port[port - 1].portsc;
+        temp = *portsc;
+
+        switch (setup->bRequest) {
+            case HUB_REQUEST_CLEAR_FEATURE:
+                switch (setup->wValue) {
+                    case HUB_PORT_FEATURE_ENABLE:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_PED;
+                        break;
+                    case HUB_PORT_FEATURE_SUSPEND:
+                        if (!xhci_port_is_usb3(bus, port)) {
+                            *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_LWS |
+                                      (XHCI_PORTSC_PLS_RESUME << XHCI_PORTSC_PLS_SHIFT);
+                            usb_osal_msleep(20);
+                        }
+                        *portsc = (*portsc & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_LWS |
+                                  (XHCI_PORTSC_PLS_U0 << XHCI_PORTSC_PLS_SHIFT);
+                        break;
+                    case HUB_PORT_FEATURE_C_SUSPEND:
+                    case HUB_PORT_FEATURE_C_LINK_STATE:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_PLC;
+                        break;
+                    case HUB_PORT_FEATURE_POWER:
+                        *portsc = temp & XHCI_PORTSC_PRESERVE_MASK & ~XHCI_PORTSC_PP;
+                        break;
+                    case HUB_PORT_FEATURE_C_CONNECTION:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_CSC;
+                        break;
+                    case HUB_PORT_FEATURE_C_ENABLE:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_PEC;
+                        break;
+                    case HUB_PORT_FEATURE_C_OVER_CURREN:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_OCC;
+                        break;
+                    case HUB_PORT_FEATURE_C_RESET:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_PRC;
+                        break;
+                    case HUB_PORT_FEATURE_C_BH_RESET:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_WRC;
+                        break;
+                    case HUB_PORT_FEATURE_C_CONFIG_ERR:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_CEC;
+                        break;
+                    default:
+                        return -USB_ERR_NOTSUPP;
+                }
+                break;
+            case HUB_REQUEST_SET_FEATURE:
+                switch (setup->wValue) {
+                    case HUB_PORT_FEATURE_SUSPEND:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_LWS |
+                                  (XHCI_PORTSC_PLS_U3 << XHCI_PORTSC_PLS_SHIFT);
+                        break;
+                    case HUB_PORT_FEATURE_POWER:
+                        *portsc = (temp & XHCI_PORTSC_PRESERVE_MASK) | XHCI_PORTSC_PP;
+                        break;
+                    case HUB_PORT_FEATURE_RESET:
+                        return xhci_reset_port(bus, port);
+                    default:
+                        return -USB_ERR_NOTSUPP;
+                }
+                break;
+            case HUB_REQUEST_GET_STATUS:
+                status = 0;
+                if (temp & XHCI_PORTSC_CCS) {
+                    status |= HUB_PORT_STATUS_CONNECTION;
+                }
+                if (temp & XHCI_PORTSC_PED) {
+                    status |= HUB_PORT_STATUS_ENABLE;
+                }
+                if (temp & XHCI_PORTSC_OCA) {
+                    status |= HUB_PORT_STATUS_OVERCURRENT;
+                }
+                if (temp & XHCI_PORTSC_PR) {
+                    status |= HUB_PORT_STATUS_RESET;
+                }
+
+                /* link state bits are left out, hub driver tells ss ports by POWER_SS alone */
+                if (xhci_port_is_usb3(bus, port)) {
+                    if ((temp & XHCI_PORTSC_PP) || !(XHCI_HCCR->hccparams1 & XHCI_HCCPARAMS1_PPC)) {
+                        status |= HUB_PORT_STATUS_POWER_SS;
+                    }
+                    if (temp & XHCI_PORTSC_WRC) {
+                        status |= (HUB_PORT_STATUS_C_BH_RESET << 16);
+                    }
+                    if (temp & XHCI_PORTSC_PLC) {
+                        status |= (HUB_PORT_STATUS_C_PORTLINK << 16);
+                    }
+                    if (temp & XHCI_PORTSC_CEC) {
+                        status |= (HUB_PORT_STATUS_C_CONFIGERR << 16);
+                    }
+                } else {
+                    if ((temp & XHCI_PORTSC_PP) || !(XHCI_HCCR->hccparams1 & XHCI_HCCPARAMS1_PPC)) {
+                        status |= HUB_PORT_STATUS_POWER;
+                    }
+                    if (((temp & XHCI_PORTSC_PLS_MASK) >> XHCI_PORTSC_PLS_SHIFT) == XHCI_PORTSC_PLS_U3) {
+                        status |= HUB_PORT_STATUS_SUSPEND;
+                    }
+                    if (temp & XHCI_PORTSC_PED) {
+                        switch ((temp & XHCI_PORTSC_SPEED_MASK) >> XHCI_PORTSC_SPEED_SHIFT) {
+                            case XHCI_PORT_SPEED_LOW:
+                                status |= HUB_PORT_STATUS_LOW_SPEED;
+                                break;
+                            case XHCI_PORT_SPEED_HIGH:
+                                status |= HUB_PORT_STATUS_HIGH_SPEED;
+                                break;
+                            default:
+                                break;
+                        }
+                    }
+                    if (temp & XHCI_PORTSC_PEC) {
+                        status |= (HUB_PORT_STATUS_C_ENABLE << 16);
+                    }
+                    if ((temp & XHCI_PORTSC_PLC) &&
+                        (((temp & XHCI_PORTSC_PLS_MASK) >> XHCI_PORTSC_PLS_SHIFT) == XHCI_PORTSC_PLS_U0)) {
+                        status |= (HUB_PORT_STATUS_C_SUSPEND << 16);
+                    }
+                }
+
+                if (temp & XHCI_PORTSC_CSC) {
+                    status |= (HUB_PORT_STATUS_C_CONNECTION << 16);
+                }
+                if (temp & XHCI_PORTSC_OCC) {
+                    status |= (HUB_PORT_STATUS_C_OVERCURRENT << 16);
+                }
+                if (temp & XHCI_PORTSC_PRC) {
+                    status |= (HUB_PORT_STATUS_C_RESET << 16);
+                }
+                memcpy(buf, &status, 4);
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+/* Slot setup that needs commands, done for control transfers in thread context.
+ * Returns 1 when the request was handled by the controller itself.
+ */
+static int xhci_control_prepare(struct usbh_bus *bus, struct usbh_urb *urb)
+{
+    struct xhci_hcd *hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+    struct usbh_hubport *hport = urb->hport;
+    struct usb_setup_packet *setup = urb->setup;
+    struct xhci_slot *slot;
+    struct xhci_endpoint *ep0;
+    uint8_t slot_id;
+    int ret;
+
+    slot = xhci_slot_get(hcd, hport);
+    /* port was reset and enumeration starts over */
+    if (slot && slot->addressed && (hport->dev_addr == 0)) {
+        xhci_slot_release(bus, slot);
+        slot = NULL;
+    }
+    if (slot == NULL) {
+        ret = xhci_slot_create(bus, hport);
+        if (ret < 0) {
+            return ret;
+        }
+        slot = xhci_slot_get(hcd, hport);
+    }
+    slot_id = slot - hcd->slots;
+    ep0 = slot->eps[1];
+
+    if (ep0->ep_mps != USB_GET_MAXPACKETSIZE(hport->ep0.wMaxPacketSize)) {
+        ep0->ep_mps = USB_GET_MAXPACKETSIZE(hport->ep0.wMaxPacketSize);
+        xhci_in_ctx_prepare(hcd, slot, 0, 0x02);
+        ret = xhci_cmd_sync(bus, XHCI_TRB_TYPE(XHCI_TRB_TYPE_EVALUATE_CTX) | XHCI_TRB_SLOT(slot_id), XHCI_PTR2ADDR(slot->in_ctx), NULL);
+        if (ret != XHCI_CC_SUCCESS) {
+            return (ret < 0) ? ret : xhci_cc2errorcode(ret);
+        }
+    }
+
+    /* hub descriptor is known now, the slot must be a hub before children are addressed */
+    if (hport->self && !slot->is_hub && hport->self->nports) {
+        slot->is_hub = true;
+        ret = xhci_slot_configure(bus, slot, 0, 0);
+        if (ret < 0) {
+            slot->is_hub = false;
+            return ret;
+        }
+    }
+
+    if ((setup->bmRequestType & USB_REQUEST_TYPE_MASK) != USB_REQUEST_STANDARD) {
+        return 0;
+    }
+
+    switch (setup->bRequest) {
+        case USB_REQUEST_SET_ADDRESS:
+            /* controller picks the address and sends SET_ADDRESS itself */
+            xhci_in_ctx_prepare(hcd, slot, 0, 0x03);
+            ret = xhci_cmd_sync(bus, XHCI_TRB_TYPE(XHCI_TRB_TYPE_ADDRESS_DEVICE) | XHCI_TRB_SLOT(slot_id), XHCI_PTR2ADDR(slot->in_ctx), NULL);
+            if (ret != XHCI_CC_SUCCESS) {
+                return (ret < 0) ? ret : xhci_cc2errorcode(ret);
+            }
+            slot->addressed = true;
+            return 1;
+        case USB_REQUEST_SET_CONFIGURATION:
+            if ((setup->bmRequestType & USB_REQUEST_RECIPIENT_MASK) == USB_REQUEST_RECIPIENT_DEVICE) {
+                return xhci_slot_set_altsetting(bus, slot, 0xff, 0);
+            }
+            break;
+        case USB_REQUEST_SET_INTERFACE:
+            if ((setup->bmRequestType & USB_REQUEST_RECIPIENT_MASK) == USB_REQUEST_RECIPIENT_INTERFACE) {
+                return xhci_slot_set_altsetting(bus, slot, setup->wIndex, setup->wValue);
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+int usbh_submit_urb(struct usbh_urb *urb)
+{
+    struct xhci_hcd *hcd;
+    struct xhci_slot *slot;
+    struct xhci_endpoint *ep = NULL;
+    struct usbh_bus *bus;
+    size_t flags;
+    int ret = 0;
+
+    if (!urb || !urb->hport || !urb->ep || !urb->hport->bus) {
+        return -USB_ERR_INVAL;
+    }
+
+#ifdef CONFIG_USB_DCACHE_ENABLE
+    USB_ASSERT_MSG(!((uintptr_t)urb->setup % CONFIG_USB_ALIGN_SIZE) &&
+                       !((uintptr_t)urb->transfer_buffer % CONFIG_USB_ALIGN_SIZE),
+                   "urb->setup or urb->transfer_buffer is not aligned %d", CONFIG_USB_ALIGN_SIZE);
+#endif
+    bus = urb->hport->bus;
+    hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+
+    if (!urb->hport->connected) {
+        return -USB_ERR_NOTCONN;
+    }
+
+    switch (USB_GET_ENDPOINT_TYPE(urb->ep->bmAttributes)) {
+        case USB_ENDPOINT_TYPE_CONTROL:
+            if (!urb->setup) {
+                return -USB_ERR_INVAL;
+            }
+            usb_osal_mutex_take(hcd->cmd_mutex);
+            ret = xhci_control_prepare(bus, urb);
+            usb_osal_mutex_give(hcd->cmd_mutex);
+            if (ret != 0) {
+                urb->actual_length = 0;
+                urb->errorcode = (ret < 0) ? ret : 0;
+                if (!urb->timeout && urb->complete) {
+                    urb->complete(urb->arg, urb->errorcode);
+                }
+                return urb->errorcode;
+            }
+            slot = xhci_slot_get(hcd, urb->hport);
+            ep = slot->eps[1];
+            break;
+        case USB_ENDPOINT_TYPE_BULK:
+        case USB_ENDPOINT_TYPE_INTERRUPT:
+            slot = xhci_slot_get(hcd, urb->hport);
+            if (slot == NULL) {
+                return -USB_ERR_NODEV;
+            }
+            ep = slot->eps[xhci_ep_dci(urb->ep->bEndpointAddress)];
+            /* endpoints are configured on SET_CONFIGURATION/SET_INTERFACE, others are added here */
+            if (!ep || !xhci_ep_match(ep, urb->ep)) {
+                usb_osal_mutex_take(hcd->cmd_mutex);
+                ret = xhci_ep_open(bus, slot, urb->ep);
+                usb_osal_mutex_give(hcd->cmd_mutex);
+                if (ret < 0) {
+                    return ret;
+                }
+                ep = slot->eps[xhci_ep_dci(urb->ep->bEndpointAddress)];
+            }
+            break;
+        case USB_ENDPOINT_TYPE_ISOCHRONOUS:
+            urb->errorcode = -USB_ERR_NOTSUPP;
+            return -USB_ERR_NOTSUPP;
+        default:
+            return -USB_ERR_INVAL;
+    }
+
+    urb->hcpriv = ep;
+    urb->actual_length = 0;
+    urb->errorcode = -USB_ERR_BUSY;
+
+    flags = usb_osal_enter_critical_section();
+    ret = xhci_td_queue(bus, ep, urb);
+    usb_osal_leave_critical_section(flags);
+    if (ret < 0) {
+        urb->hcpriv = NULL;
+        urb->errorcode = ret;
+        return ret;
+    }
+
+    if (urb->timeout > 0) {
+        /* wait until timeout or sem give */
+        ret = usb_osal_sem_take(ep->waitsem, urb->timeout);
+        if (ret < 0) {
+            goto errout_timeout;
+        }
+        urb->timeout = 0;
+        ret = urb->errorcode;
+    }
+    return ret;
+errout_timeout:
+    urb->timeout = 0;
+    usbh_kill_urb(urb);
+    return ret;
+}
+
+int usbh_kill_urb(struct usbh_urb *urb)
+{
+    struct xhci_hcd *hcd;
+    struct xhci_slot *slot;
+    struct xhci_endpoint *ep;
+    struct usbh_hubport *hport;
+    struct usbh_bus *bus;
+
+    if (!urb || !urb->hport || !urb->hport->bus) {
+        return -USB_ERR_INVAL;
+    }
+
+    hport = urb->hport;
+    bus = hport->bus;
+    hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+
+    /* usbh_hubport_release() kills ep0 urb once the device is gone, the slot goes with it */
+    if (!hport->connected && (urb == &hport->ep0_urb)) {
+        usb_osal_mutex_take(hcd->cmd_mutex);
+        slot = xhci_slot_get(hcd, hport);
+        if (slot) {
+            xhci_slot_release(bus, slot);
+        }
+        usb_osal_mutex_give(hcd->cmd_mutex);
+        return 0;
+    }
+
+    if (!urb->hcpriv) {
+        return -USB_ERR_INVAL;
+    }
+
+    usb_osal_mutex_take(hcd->cmd_mutex);
+    slot = xhci_slot_get(hcd, hport);
+    ep = slot ? slot->eps[xhci_ep_dci(urb->ep->bEndpointAddress)] : NULL;
+    /* endpoint may have been released with its slot */
+    if (!ep || (ep != urb->hcpriv)) {
+        urb->hcpriv = NULL;
+        usb_osal_mutex_give(hcd->cmd_mutex);
+        return -USB_ERR_INVAL;
+    }
+    /* killing an urb stops the endpoint and gives back all urbs queued on it */
+    xhci_ep_stop(bus, slot, ep);
+    usb_osal_mutex_give(hcd->cmd_mutex);
+    return 0;
+}
+
+void USBH_IRQHandler(uint8_t busid)
+{
+    struct usbh_bus *bus;
+    struct xhci_hcd *hcd;
+    struct xhci_trb *event;
+    struct xhci_trb evt;
+    uint32_t usbsts;
+    uint8_t port;
+
+    bus = &g_usbhost_bus[busid];
+    hcd = &g_xhci_hcd[bus->hcd.hcd_id];
+
+    usbsts = XHCI_HCOR->usbsts;
+    XHCI_HCOR->usbsts = usbsts & (XHCI_USBSTS_EINT | XHCI_USBSTS_PCD | XHCI_USBSTS_HSE);
+    XHCI_HCRR->ir[0].iman = XHCI_IMAN_IE | XHCI_IMAN_IP;
+
+    if (usbsts & XHCI_USBSTS_HSE) {
+        USB_LOG_ERR("xHCI host system error\r\n");
+    }
+
+    if (hcd->event_trbs == NULL) {
+        return;
+    }
+
+    /* drain every event, then move ERDP once so moderation covers the whole batch */
+    while (1) {
+        event = &hcd->event_trbs[hcd->event_dequeue];
+        xhci_dcache_sync(event, sizeof(struct xhci_trb), XHCI_DCACHE_INVALIDATE);
+        if ((event->control & XHCI_TRB_C) != hcd->event_cycle) {
+            break;
+        }
+        evt = *event;
+
+        switch (XHCI_TRB_GET_TYPE(evt.control)) {
+            case XHCI_TRB_TYPE_TRANSFER_EVENT:
+                xhci_handle_transfer_event(bus, &evt);
+                break;
+            case XHCI_TRB_TYPE_COMMAND_EVENT:
+                xhci_handle_command_event(bus, &evt);
+                break;
+            case XHCI_TRB_TYPE_PORT_EVENT:
+                port = evt.param_lo >> XHCI_EVT_PORT_SHIFT;
+                if (port && (port <= hcd->n_ports)) {
+                    bus->hcd.roothub.int_buffer[port / 8] |= (1 << (port % 8));
+                    usbh_hub_thread_wakeup(&bus->hcd.roothub);
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (++hcd->event_dequeue == CONFIG_USB_XHCI_EVENT_RING_SIZE) {
+            hcd->event_dequeue = 0;
+            hcd->event_cycle ^= 1;
+        }
+    }
+
+    xhci_write64(&XHCI_HCRR->ir[0].erdp_lo, &XHCI_HCRR->ir[0].erdp_hi,
+                 XHCI_PTR2ADDR(&hcd->event_trbs[hcd->event_dequeue]) | XHCI_ERDP_EHB);
+}
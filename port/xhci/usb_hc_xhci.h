@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _USB_XHCI_PRIV_H
+#define _USB_XHCI_PRIV_H
+
+#include "usbh_core.h"
+#include "usbh_hub.h"
+#include "usb_xhci_reg.h"
+
+#define XHCI_HCCR ((struct xhci_hccr *)(uintptr_t)(bus->hcd.reg_base + CONFIG_USB_XHCI_HCCR_OFFSET))
+#define XHCI_HCOR ((struct xhci_hcor *)((uintptr_t)XHCI_HCCR + XHCI_HCCR->caplength))
+#define XHCI_HCRR ((struct xhci_hcrr *)((uintptr_t)XHCI_HCCR + (XHCI_HCCR->rtsoff & XHCI_RTSOFF_MASK)))
+#define XHCI_DBAR ((volatile uint32_t *)((uintptr_t)XHCI_HCCR + (XHCI_HCCR->dboff & XHCI_DBOFF_MASK)))
+
+#define XHCI_PTR2ADDR(x) ((uint64_t)usb_ramaddr2phyaddr((uintptr_t)(x)))
+#define XHCI_ADDR2PTR(x) ((void *)usb_phyaddr2ramaddr((uintptr_t)(x)))
+
+#ifndef CONFIG_USB_XHCI_HCCR_OFFSET
+#define CONFIG_USB_XHCI_HCCR_OFFSET (0x0)
+#endif
+
+/* Device slots enabled in the controller, also bounded by HCSPARAMS1.MaxSlots */
+#ifndef CONFIG_USB_XHCI_MAX_SLOTS
+#define CONFIG_USB_XHCI_MAX_SLOTS 16
+#endif
+
+/* Trbs in every transfer ring segment, including the link trb, must be a power of two */
+#ifndef CONFIG_USB_XHCI_RING_SIZE
+#define CONFIG_USB_XHCI_RING_SIZE 256
+#endif
+
+/* Urbs in flight on one endpoint */
+#ifndef CONFIG_USB_XHCI_TD_NUM
+#define CONFIG_USB_XHCI_TD_NUM 16
+#endif
+
+#ifndef CONFIG_USB_XHCI_CMD_RING_SIZE
+#define CONFIG_USB_XHCI_CMD_RING_SIZE 64
+#endif
+
+#ifndef CONFIG_USB_XHCI_EVENT_RING_SIZE
+#define CONFIG_USB_XHCI_EVENT_RING_SIZE 256
+#endif
+
+/* Minimum gap between two interrupts in 250ns, 160 is 40us, 0 disables moderation */
+#ifndef CONFIG_USB_XHCI_IMOD_INTERVAL
+#define CONFIG_USB_XHCI_IMOD_INTERVAL 160
+#endif
+
+#ifndef CONFIG_USB_XHCI_CMD_TIMEOUT
+#define CONFIG_USB_XHCI_CMD_TIMEOUT 5000
+#endif
+
+#ifndef XHCI_DCACHE_FLUSH
+#define XHCI_DCACHE_FLUSH (1 << 0)
+#endif
+
+#ifndef XHCI_DCACHE_INVALIDATE
+#define XHCI_DCACHE_INVALIDATE (1 << 1)
+#endif
+
+#ifndef usb_xhci_wmb
+/* Make trb and context writes visible to controller before ringing doorbell */
+#define usb_xhci_wmb() __asm volatile("" ::: "memory")
+#endif
+
+/* Producer ring, the last trb is a link back to the first one */
+struct xhci_ring {
+    struct xhci_trb *trbs;
+    uint32_t num;
+    uint32_t enqueue;
+    uint32_t dequeue;
+    uint32_t free; /* trbs left for the producer, link trb excluded */
+    uint8_t cycle;
+};
+
+/* One urb queued on a transfer ring */
+struct xhci_td {
+    struct usbh_urb *urb;
+    uint32_t start;     /* ring index of the first trb */
+    uint8_t start_cycle;
+    uint16_t ntrbs;     /* trbs used, link trbs excluded */
+};
+
+struct xhci_cmd;
+typedef void (*xhci_cmd_complete_t)(struct usbh_bus *bus, struct xhci_cmd *cmd);
+
+struct xhci_cmd {
+    struct xhci_trb trb;
+    struct xhci_trb event;
+    volatile bool done;
+    usb_osal_sem_t waitsem;      /* sync command */
+    xhci_cmd_complete_t complete; /* async command, called in interrupt */
+    void *arg;
+};
+
+struct xhci_endpoint {
+    struct xhci_ring ring;
+    struct usbh_hubport *hport;
+    uint8_t slot_id;
+    uint8_t dci;        /* device context index, ep num * 2 + dir */
+    uint8_t ep_type;    /* USB_ENDPOINT_TYPE_* */
+    uint8_t ep_interval;
+    uint16_t ep_mps;
+    uint8_t ep_mult;
+    volatile bool halted; /* reset endpoint and set dequeue in progress */
+    struct xhci_td tds[CONFIG_USB_XHCI_TD_NUM];
+    uint8_t td_head;
+    uint8_t td_count;
+    usb_osal_sem_t waitsem;
+    struct xhci_cmd recover_cmd;
+};
+
+struct xhci_slot {
+    struct usbh_hubport *hport;
+    void *out_ctx; /* device context owned by controller */
+    void *in_ctx;  /* input context */
+    struct xhci_endpoint *eps[32];
+    bool addressed;
+    bool is_hub;
+};
+
+struct xhci_hcd {
+    bool ac64;
+    uint8_t ctx_size;
+    uint8_t max_slots;
+    uint8_t n_ports;
+    uint32_t page_size;
+    uint64_t *dcbaa;
+    uint64_t *scratchpad_array;
+    void **scratchpad_bufs;
+    uint32_t scratchpad_num;
+    struct xhci_ring cmd_ring;
+    struct xhci_cmd *cmd_pending[CONFIG_USB_XHCI_CMD_RING_SIZE];
+    struct xhci_cmd sync_cmd;
+    usb_osal_mutex_t cmd_mutex;
+    struct xhci_trb *event_trbs;
+    uint32_t event_dequeue;
+    uint8_t event_cycle;
+    struct xhci_erst_entry *erst;
+    uint8_t port_major[CONFIG_USBHOST_MAX_RHPORTS]; /* 2 or 3 from supported protocol capability */
+    struct xhci_slot slots[CONFIG_USB_XHCI_MAX_SLOTS + 1];
+};
+
+void *xhci_mem_malloc(size_t align, size_t size);
+void xhci_mem_free(void *ptr);
+void xhci_dcache_sync(void *ptr, size_t len, uint32_t flags);
+
+#endif
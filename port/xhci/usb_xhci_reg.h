@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _USB_XHCI_REG_H
+#define _USB_XHCI_REG_H
+
+/* Register and data structure layout from the eXtensible Host Controller Interface
+ * specification revision 1.2, section numbers are given in the comments.
+ */
+
+/* Host Controller Capability Registers. Paragraph 5.3 **********************/
+
+/* Structural Parameters 1. Paragraph 5.3.3 */
+
+#define XHCI_HCSPARAMS1_MAXSLOTS_SHIFT (0)  /* Bits 0-7: Number of Device Slots */
+#define XHCI_HCSPARAMS1_MAXSLOTS_MASK  (0xff << XHCI_HCSPARAMS1_MAXSLOTS_SHIFT)
+#define XHCI_HCSPARAMS1_MAXINTRS_SHIFT (8)  /* Bits 8-18: Number of Interrupters */
+#define XHCI_HCSPARAMS1_MAXINTRS_MASK  (0x7ff << XHCI_HCSPARAMS1_MAXINTRS_SHIFT)
+#define XHCI_HCSPARAMS1_MAXPORTS_SHIFT (24) /* Bits 24-31: Number of Ports */
+#define XHCI_HCSPARAMS1_MAXPORTS_MASK  (0xffU << XHCI_HCSPARAMS1_MAXPORTS_SHIFT)
+
+/* Structural Parameters 2. Paragraph 5.3.4 */
+
+#define XHCI_HCSPARAMS2_ERSTMAX_SHIFT (4)  /* Bits 4-7: Event Ring Segment Table Max */
+#define XHCI_HCSPARAMS2_ERSTMAX_MASK  (0xf << XHCI_HCSPARAMS2_ERSTMAX_SHIFT)
+#define XHCI_HCSPARAMS2_SPBHI_SHIFT   (21) /* Bits 21-25: Max Scratchpad Buffers Hi */
+#define XHCI_HCSPARAMS2_SPBHI_MASK    (0x1f << XHCI_HCSPARAMS2_SPBHI_SHIFT)
+#define XHCI_HCSPARAMS2_SPR           (1 << 26) /* Bit 26: Scratchpad Restore */
+#define XHCI_HCSPARAMS2_SPBLO_SHIFT   (27) /* Bits 27-31: Max Scratchpad Buffers Lo */
+#define XHCI_HCSPARAMS2_SPBLO_MASK    (0x1fU << XHCI_HCSPARAMS2_SPBLO_SHIFT)
+
+/* Capability Parameters 1. Paragraph 5.3.6 */
+
+#define XHCI_HCCPARAMS1_AC64       (1 << 0) /* Bit 0: 64-bit Addressing Capability */
+#define XHCI_HCCPARAMS1_BNC        (1 << 1) /* Bit 1: BW Negotiation Capability */
+#define XHCI_HCCPARAMS1_CSZ        (1 << 2) /* Bit 2: Context Size, 64 bytes when set */
+#define XHCI_HCCPARAMS1_PPC        (1 << 3) /* Bit 3: Port Power Control */
+#define XHCI_HCCPARAMS1_XECP_SHIFT (16)     /* Bits 16-31: Extended Capabilities Pointer, in dwords */
+#define XHCI_HCCPARAMS1_XECP_MASK  (0xffffU << XHCI_HCCPARAMS1_XECP_SHIFT)
+
+#define XHCI_DBOFF_MASK  (~0x3U)  /* Doorbell Offset. Paragraph 5.3.7 */
+#define XHCI_RTSOFF_MASK (~0x1fU) /* Runtime Register Space Offset. Paragraph 5.3.8 */
+
+/* Host Controller Operational Registers. Paragraph 5.4 *********************/
+
+/* USB Command. Paragraph 5.4.1 */
+
+#define XHCI_USBCMD_RS    (1 << 0)  /* Bit 0: Run/Stop */
+#define XHCI_USBCMD_HCRST (1 << 1)  /* Bit 1: Host Controller Reset */
+#define XHCI_USBCMD_INTE  (1 << 2)  /* Bit 2: Interrupter Enable */
+#define XHCI_USBCMD_HSEE  (1 << 3)  /* Bit 3: Host System Error Enable */
+#define XHCI_USBCMD_EWE   (1 << 10) /* Bit 10: Enable Wrap Event */
+
+/* USB Status. Paragraph 5.4.2 */
+
+#define XHCI_USBSTS_HCH  (1 << 0)  /* Bit 0: HCHalted */
+#define XHCI_USBSTS_HSE  (1 << 2)  /* Bit 2: Host System Error */
+#define XHCI_USBSTS_EINT (1 << 3)  /* Bit 3: Event Interrupt */
+#define XHCI_USBSTS_PCD  (1 << 4)  /* Bit 4: Port Change Detect */
+#define XHCI_USBSTS_CNR  (1 << 11) /* Bit 11: Controller Not Ready */
+#define XHCI_USBSTS_HCE  (1 << 12) /* Bit 12: Host Controller Error */
+
+/* Command Ring Control. Paragraph 5.4.5 */
+
+#define XHCI_CRCR_RCS (1 << 0) /* Bit 0: Ring Cycle State */
+#define XHCI_CRCR_CS  (1 << 1) /* Bit 1: Command Stop */
+#define XHCI_CRCR_CA  (1 << 2) /* Bit 2: Command Abort */
+#define XHCI_CRCR_CRR (1 << 3) /* Bit 3: Command Ring Running */
+
+/* Configure. Paragraph 5.4.7 */
+
+#define XHCI_CONFIG_MAXSLOTSEN_MASK (0xff) /* Bits 0-7: Max Device Slots Enabled */
+
+/* Port Status and Control. Paragraph 5.4.8 */
+
+#define XHCI_PORTSC_CCS        (1 << 0)  /* Bit 0: Current Connect Status */
+#define XHCI_PORTSC_PED        (1 << 1)  /* Bit 1: Port Enabled/Disabled, write 1 to disable */
+#define XHCI_PORTSC_OCA        (1 << 3)  /* Bit 3: Over-current Active */
+#define XHCI_PORTSC_PR         (1 << 4)  /* Bit 4: Port Reset */
+#define XHCI_PORTSC_PLS_SHIFT  (5)       /* Bits 5-8: Port Link State */
+#define XHCI_PORTSC_PLS_MASK   (0xf << XHCI_PORTSC_PLS_SHIFT)
+#define XHCI_PORTSC_PP         (1 << 9)  /* Bit 9: Port Power */
+#define XHCI_PORTSC_SPEED_SHIFT (10)     /* Bits 10-13: Port Speed */
+#define XHCI_PORTSC_SPEED_MASK (0xf << XHCI_PORTSC_SPEED_SHIFT)
+#define XHCI_PORTSC_PIC_SHIFT  (14)      /* Bits 14-15: Port Indicator Control */
+#define XHCI_PORTSC_PIC_MASK   (0x3 << XHCI_PORTSC_PIC_SHIFT)
+#define XHCI_PORTSC_LWS        (1 << 16) /* Bit 16: Port Link State Write Strobe */
+#define XHCI_PORTSC_CSC        (1 << 17) /* Bit 17: Connect Status Change */
+#define XHCI_PORTSC_PEC        (1 << 18) /* Bit 18: Port Enabled/Disabled Change */
+#define XHCI_PORTSC_WRC        (1 << 19) /* Bit 19: Warm Port Reset Change */
+#define XHCI_PORTSC_OCC        (1 << 20) /* Bit 20: Over-current Change */
+#define XHCI_PORTSC_PRC        (1 << 21) /* Bit 21: Port Reset Change */
+#define XHCI_PORTSC_PLC        (1 << 22) /* Bit 22: Port Link State Change */
+#define XHCI_PORTSC_CEC        (1 << 23) /* Bit 23: Port Config Error Change */
+#define XHCI_PORTSC_CAS        (1 << 24) /* Bit 24: Cold Attach Status */
+#define XHCI_PORTSC_WCE        (1 << 25) /* Bit 25: Wake on Connect Enable */
+#define XHCI_PORTSC_WDE        (1 << 26) /* Bit 26: Wake on Disconnect Enable */
+#define XHCI_PORTSC_WOE        (1 << 27) /* Bit 27: Wake on Over-current Enable */
+#define XHCI_PORTSC_DR         (1 << 30) /* Bit 30: Device Removable */
+#define XHCI_PORTSC_WPR        (1U << 31) /* Bit 31: Warm Port Reset */
+
+/* All RW1C change bits */
+#define XHCI_PORTSC_CHANGE_MASK (XHCI_PORTSC_CSC | XHCI_PORTSC_PEC | XHCI_PORTSC_WRC | XHCI_PORTSC_OCC | \
+                                 XHCI_PORTSC_PRC | XHCI_PORTSC_PLC | XHCI_PORTSC_CEC)
+/* Bits that keep their value when written back, PED and change bits are RW1C */
+#define XHCI_PORTSC_PRESERVE_MASK (XHCI_PORTSC_PP | XHCI_PORTSC_PIC_MASK | XHCI_PORTSC_WCE | \
+                                   XHCI_PORTSC_WDE | XHCI_PORTSC_WOE)
+
+#define XHCI_PORTSC_PLS_U0       (0)
+#define XHCI_PORTSC_PLS_U3       (3)
+#define XHCI_PORTSC_PLS_DISABLED (4)
+#define XHCI_PORTSC_PLS_RXDETECT (5)
+#define XHCI_PORTSC_PLS_POLLING  (7)
+#define XHCI_PORTSC_PLS_RESUME   (15)
+
+/* Default protocol speed ids. Paragraph 7.2.2.1.1 */
+
+#define XHCI_PORT_SPEED_FULL       (1)
+#define XHCI_PORT_SPEED_LOW        (2)
+#define XHCI_PORT_SPEED_HIGH       (3)
+#define XHCI_PORT_SPEED_SUPER      (4)
+#define XHCI_PORT_SPEED_SUPER_PLUS (5)
+
+/* Host Controller Runtime Registers. Paragraph 5.5 *************************/
+
+/* Interrupter Management. Paragraph 5.5.2.1 */
+
+#define XHCI_IMAN_IP (1 << 0) /* Bit 0: Interrupt Pending, RW1C */
+#define XHCI_IMAN_IE (1 << 1) /* Bit 1: Interrupt Enable */
+
+/* Interrupter Moderation. Paragraph 5.5.2.2 */
+
+#define XHCI_IMOD_IMODI_SHIFT (0)  /* Bits 0-15: Interval in 250ns */
+#define XHCI_IMOD_IMODI_MASK  (0xffff << XHCI_IMOD_IMODI_SHIFT)
+#define XHCI_IMOD_IMODC_SHIFT (16) /* Bits 16-31: Counter */
+#define XHCI_IMOD_IMODC_MASK  (0xffffU << XHCI_IMOD_IMODC_SHIFT)
+
+/* Event Ring Dequeue Pointer. Paragraph 5.5.2.3.3 */
+
+#define XHCI_ERDP_DESI_MASK (0x7)    /* Bits 0-2: Dequeue ERST Segment Index */
+#define XHCI_ERDP_EHB       (1 << 3) /* Bit 3: Event Handler Busy, RW1C */
+
+/* Extended Capabilities. Paragraph 7 ***************************************/
+
+#define XHCI_XCAP_ID_SHIFT   (0) /* Bits 0-7: Capability ID */
+#define XHCI_XCAP_ID_MASK    (0xff << XHCI_XCAP_ID_SHIFT)
+#define XHCI_XCAP_NEXT_SHIFT (8) /* Bits 8-15: Next Capability Pointer, in dwords */
+#define XHCI_XCAP_NEXT_MASK  (0xff << XHCI_XCAP_NEXT_SHIFT)
+
+#define XHCI_XCAP_ID_LEGACY   (1)
+#define XHCI_XCAP_ID_PROTOCOL (2)
+
+/* USB Legacy Support. Paragraph 7.1 */
+
+#define XHCI_USBLEGSUP_BIOS_OWNED (1 << 16)
+#define XHCI_USBLEGSUP_OS_OWNED   (1 << 24)
+#define XHCI_USBLEGCTLSTS_DISABLE_SMI ((0x7 << 1) | (0xff << 5) | (0x7 << 17)) /* Reserved bits kept, SMI enables cleared */
+#define XHCI_USBLEGCTLSTS_SMI_EVENTS  (0x7U << 29) /* RW1C SMI event bits */
+
+/* Supported Protocol. Paragraph 7.2 */
+
+#define XHCI_PROTOCOL_MAJOR_SHIFT  (24) /* Bits 24-31 of dword 0: Major Revision */
+#define XHCI_PROTOCOL_PORT_OFFSET_SHIFT (0) /* Bits 0-7 of dword 2: Compatible Port Offset */
+#define XHCI_PROTOCOL_PORT_COUNT_SHIFT  (8) /* Bits 8-15 of dword 2: Compatible Port Count */
+
+/* Transfer Request Block. Paragraph 6.4 ************************************/
+
+/* TRB status */
+
+#define XHCI_TRB_LEN_SHIFT    (0)  /* Bits 0-16: TRB Transfer Length */
+#define XHCI_TRB_LEN_MASK     (0x1ffff << XHCI_TRB_LEN_SHIFT)
+#define XHCI_TRB_TDSIZE_SHIFT (17) /* Bits 17-21: TD Size, packets left after this TRB */
+#define XHCI_TRB_TDSIZE_MASK  (0x1f << XHCI_TRB_TDSIZE_SHIFT)
+#define XHCI_TRB_INTR_SHIFT   (22) /* Bits 22-31: Interrupter Target */
+
+/* TRB control */
+
+#define XHCI_TRB_C           (1 << 0)  /* Bit 0: Cycle bit */
+#define XHCI_TRB_TC          (1 << 1)  /* Bit 1: Toggle Cycle, link trb only */
+#define XHCI_TRB_ENT         (1 << 1)  /* Bit 1: Evaluate Next TRB */
+#define XHCI_TRB_ISP         (1 << 2)  /* Bit 2: Interrupt-on Short Packet */
+#define XHCI_TRB_NS          (1 << 3)  /* Bit 3: No Snoop */
+#define XHCI_TRB_CH          (1 << 4)  /* Bit 4: Chain bit */
+#define XHCI_TRB_IOC         (1 << 5)  /* Bit 5: Interrupt On Completion */
+#define XHCI_TRB_IDT         (1 << 6)  /* Bit 6: Immediate Data */
+#define XHCI_TRB_BEI         (1 << 9)  /* Bit 9: Block Event Interrupt */
+#define XHCI_TRB_BSR         (1 << 9)  /* Bit 9: Block Set Address Request, address device command */
+#define XHCI_TRB_DC          (1 << 9)  /* Bit 9: Deconfigure, configure endpoint command */
+#define XHCI_TRB_TSP         (1 << 9)  /* Bit 9: Transfer State Preserve, reset endpoint command */
+#define XHCI_TRB_TYPE_SHIFT  (10)      /* Bits 10-15: TRB Type */
+#define XHCI_TRB_TYPE_MASK   (0x3f << XHCI_TRB_TYPE_SHIFT)
+#define XHCI_TRB_DIR_IN      (1 << 16) /* Bit 16: Data stage direction */
+#define XHCI_TRB_TRT_SHIFT   (16)      /* Bits 16-17: Setup stage Transfer Type */
+#define XHCI_TRB_TRT_NODATA  (0 << XHCI_TRB_TRT_SHIFT)
+#define XHCI_TRB_TRT_OUT     (2 << XHCI_TRB_TRT_SHIFT)
+#define XHCI_TRB_TRT_IN      (3 << XHCI_TRB_TRT_SHIFT)
+#define XHCI_TRB_EPID_SHIFT  (16)      /* Bits 16-20: Endpoint ID */
+#define XHCI_TRB_EPID_MASK   (0x1f << XHCI_TRB_EPID_SHIFT)
+#define XHCI_TRB_SLOT_SHIFT  (24)      /* Bits 24-31: Slot ID */
+#define XHCI_TRB_SLOT_MASK   (0xffU << XHCI_TRB_SLOT_SHIFT)
+
+#define XHCI_TRB_TYPE(x)     (((x) << XHCI_TRB_TYPE_SHIFT) & XHCI_TRB_TYPE_MASK)
+#define XHCI_TRB_GET_TYPE(x) (((x) & XHCI_TRB_TYPE_MASK) >> XHCI_TRB_TYPE_SHIFT)
+#define XHCI_TRB_EPID(x)     (((x) << XHCI_TRB_EPID_SHIFT) & XHCI_TRB_EPID_MASK)
+#define XHCI_TRB_GET_EPID(x) (((x) & XHCI_TRB_EPID_MASK) >> XHCI_TRB_EPID_SHIFT)
+#define XHCI_TRB_SLOT(x)     (((uint32_t)(x) << XHCI_TRB_SLOT_SHIFT) & XHCI_TRB_SLOT_MASK)
+#define XHCI_TRB_GET_SLOT(x) (((x) & XHCI_TRB_SLOT_MASK) >> XHCI_TRB_SLOT_SHIFT)
+
+/* Event TRB status */
+
+#define XHCI_EVT_LEN_MASK   (0xffffff) /* Bits 0-23: residue, or EDTLA for event data */
+#define XHCI_EVT_CC_SHIFT   (24)       /* Bits 24-31: Completion Code */
+#define XHCI_EVT_GET_CC(x)  (((x) >> XHCI_EVT_CC_SHIFT) & 0xff)
+#define XHCI_EVT_ED         (1 << 2)   /* Bit 2 of control: Event Data */
+#define XHCI_EVT_PORT_SHIFT (24)       /* Bits 24-31 of parameter: Port ID */
+
+/* TRB types. Paragraph 6.4.6 */
+
+#define XHCI_TRB_TYPE_NORMAL          (1)
+#define XHCI_TRB_TYPE_SETUP           (2)
+#define XHCI_TRB_TYPE_DATA            (3)
+#define XHCI_TRB_TYPE_STATUS          (4)
+#define XHCI_TRB_TYPE_ISOCH           (5)
+#define XHCI_TRB_TYPE_LINK            (6)
+#define XHCI_TRB_TYPE_EVENT_DATA      (7)
+#define XHCI_TRB_TYPE_NOOP            (8)
+#define XHCI_TRB_TYPE_ENABLE_SLOT     (9)
+#define XHCI_TRB_TYPE_DISABLE_SLOT    (10)
+#define XHCI_TRB_TYPE_ADDRESS_DEVICE  (11)
+#define XHCI_TRB_TYPE_CONFIGURE_EP    (12)
+#define XHCI_TRB_TYPE_EVALUATE_CTX    (13)
+#define XHCI_TRB_TYPE_RESET_EP        (14)
+#define XHCI_TRB_TYPE_STOP_EP         (15)
+#define XHCI_TRB_TYPE_SET_TR_DEQUEUE  (16)
+#define XHCI_TRB_TYPE_RESET_DEVICE    (17)
+#define XHCI_TRB_TYPE_NOOP_CMD        (23)
+#define XHCI_TRB_TYPE_TRANSFER_EVENT  (32)
+#define XHCI_TRB_TYPE_COMMAND_EVENT   (33)
+#define XHCI_TRB_TYPE_PORT_EVENT      (34)
+#define XHCI_TRB_TYPE_HOST_EVENT      (37)
+#define XHCI_TRB_TYPE_MFINDEX_EVENT   (39)
+
+/* Completion codes. Paragraph 6.4.5 */
+
+#define XHCI_CC_SUCCESS              (1)
+#define XHCI_CC_DATA_BUFFER          (2)
+#define XHCI_CC_BABBLE               (3)
+#define XHCI_CC_USB_TRANSACTION      (4)
+#define XHCI_CC_TRB                  (5)
+#define XHCI_CC_STALL                (6)
+#define XHCI_CC_RESOURCE             (7)
+#define XHCI_CC_BANDWIDTH            (8)
+#define XHCI_CC_NO_SLOTS             (9)
+#define XHCI_CC_SLOT_NOT_ENABLED     (11)
+#define XHCI_CC_EP_NOT_ENABLED       (12)
+#define XHCI_CC_SHORT_PACKET         (13)
+#define XHCI_CC_RING_UNDERRUN        (14)
+#define XHCI_CC_RING_OVERRUN         (15)
+#define XHCI_CC_PARAMETER            (17)
+#define XHCI_CC_CONTEXT_STATE        (19)
+#define XHCI_CC_EVENT_RING_FULL      (21)
+#define XHCI_CC_MISSED_SERVICE       (23)
+#define XHCI_CC_CMD_RING_STOPPED     (24)
+#define XHCI_CC_CMD_ABORTED          (25)
+#define XHCI_CC_STOPPED              (26)
+#define XHCI_CC_STOPPED_LEN_INVALID  (27)
+#define XHCI_CC_STOPPED_SHORT_PACKET (28)
+
+/* Contexts. Paragraph 6.2 **************************************************/
+
+/* Slot Context. Paragraph 6.2.2 */
+
+#define XHCI_SLOT_CTX0_ROUTE_MASK    (0xfffff)   /* Bits 0-19: Route String */
+#define XHCI_SLOT_CTX0_SPEED_SHIFT   (20)        /* Bits 20-23: Speed */
+#define XHCI_SLOT_CTX0_MTT           (1 << 25)   /* Bit 25: Multi-TT */
+#define XHCI_SLOT_CTX0_HUB           (1 << 26)   /* Bit 26: Hub */
+#define XHCI_SLOT_CTX0_ENTRIES_SHIFT (27)        /* Bits 27-31: Context Entries */
+#define XHCI_SLOT_CTX0_ENTRIES_MASK  (0x1fU << XHCI_SLOT_CTX0_ENTRIES_SHIFT)
+#define XHCI_SLOT_CTX1_RHPORT_SHIFT  (16)        /* Bits 16-23: Root Hub Port Number */
+#define XHCI_SLOT_CTX1_NPORTS_SHIFT  (24)        /* Bits 24-31: Number of Ports */
+#define XHCI_SLOT_CTX2_TTSLOT_SHIFT  (0)         /* Bits 0-7: Parent Hub Slot ID */
+#define XHCI_SLOT_CTX2_TTPORT_SHIFT  (8)         /* Bits 8-15: Parent Port Number */
+#define XHCI_SLOT_CTX2_TTT_SHIFT     (16)        /* Bits 16-17: TT Think Time */
+#define XHCI_SLOT_CTX3_ADDR_MASK     (0xff)      /* Bits 0-7: USB Device Address */
+#define XHCI_SLOT_CTX3_STATE_SHIFT   (27)        /* Bits 27-31: Slot State */
+
+/* Endpoint Context. Paragraph 6.2.3 */
+
+#define XHCI_EP_CTX0_STATE_MASK      (0x7)       /* Bits 0-2: Endpoint State */
+#define XHCI_EP_CTX0_MULT_SHIFT      (8)         /* Bits 8-9: Mult */
+#define XHCI_EP_CTX0_INTERVAL_SHIFT  (16)        /* Bits 16-23: Interval, 125us * 2^Interval */
+#define XHCI_EP_CTX0_ESITHI_SHIFT    (24)        /* Bits 24-31: Max ESIT Payload Hi */
+#define XHCI_EP_CTX1_CERR_SHIFT      (1)         /* Bits 1-2: Error Count */
+#define XHCI_EP_CTX1_TYPE_SHIFT      (3)         /* Bits 3-5: EP Type */
+#define XHCI_EP_CTX1_BURST_SHIFT     (8)         /* Bits 8-15: Max Burst Size */
+#define XHCI_EP_CTX1_MPS_SHIFT       (16)        /* Bits 16-31: Max Packet Size */
+#define XHCI_EP_CTX2_DCS             (1 << 0)    /* Bit 0 of dequeue pointer: Dequeue Cycle State */
+#define XHCI_EP_CTX4_AVGLEN_SHIFT    (0)         /* Bits 0-15: Average TRB Length */
+#define XHCI_EP_CTX4_ESITLO_SHIFT    (16)        /* Bits 16-31: Max ESIT Payload Lo */
+
+#define XHCI_EP_STATE_DISABLED (0)
+#define XHCI_EP_STATE_RUNNING  (1)
+#define XHCI_EP_STATE_HALTED   (2)
+#define XHCI_EP_STATE_STOPPED  (3)
+#define XHCI_EP_STATE_ERROR    (4)
+
+#define XHCI_EP_TYPE_ISOCH_OUT (1)
+#define XHCI_EP_TYPE_BULK_OUT  (2)
+#define XHCI_EP_TYPE_INTR_OUT  (3)
+#define XHCI_EP_TYPE_CONTROL   (4)
+#define XHCI_EP_TYPE_ISOCH_IN  (5)
+#define XHCI_EP_TYPE_BULK_IN   (6)
+#define XHCI_EP_TYPE_INTR_IN   (7)
+
+/* Register layout **********************************************************/
+
+/* Host Controller Capability Registers. Paragraph 5.3 */
+
+struct xhci_hccr {
+    volatile uint8_t caplength;   /* 0x00: Capability Register Length */
+    volatile uint8_t reserved;    /* 0x01: reserved */
+    volatile uint16_t hciversion; /* 0x02: Interface Version Number */
+    volatile uint32_t hcsparams1; /* 0x04: Structural Parameters 1 */
+    volatile uint32_t hcsparams2; /* 0x08: Structural Parameters 2 */
+    volatile uint32_t hcsparams3; /* 0x0c: Structural Parameters 3 */
+    volatile uint32_t hccparams1; /* 0x10: Capability Parameters 1 */
+    volatile uint32_t dboff;      /* 0x14: Doorbell Offset */
+    volatile uint32_t rtsoff;     /* 0x18: Runtime Register Space Offset */
+    volatile uint32_t hccparams2; /* 0x1c: Capability Parameters 2 */
+};
+
+/* Port Register Set. Paragraph 5.4.8 */
+
+struct xhci_port_regs {
+    volatile uint32_t portsc;    /* 0x00: Port Status and Control */
+    volatile uint32_t portpmsc;  /* 0x04: Port Power Management Status and Control */
+    volatile uint32_t portli;    /* 0x08: Port Link Info */
+    volatile uint32_t porthlpmc; /* 0x0c: Port Hardware LPM Control */
+};
+
+/* Host Controller Operational Registers. Paragraph 5.4
+ * This register block is positioned at an offset of 'caplength' from the
+ * beginning of the Host Controller Capability Registers.
+ */
+
+struct xhci_hcor {
+    volatile uint32_t usbcmd;    /* 0x00: USB Command */
+    volatile uint32_t usbsts;    /* 0x04: USB Status */
+    volatile uint32_t pagesize;  /* 0x08: Page Size */
+    uint32_t reserved0[2];
+    volatile uint32_t dnctrl;    /* 0x14: Device Notification Control */
+    volatile uint32_t crcr_lo;   /* 0x18: Command Ring Control */
+    volatile uint32_t crcr_hi;
+    uint32_t reserved1[4];
+    volatile uint32_t dcbaap_lo; /* 0x30: Device Context Base Address Array Pointer */
+    volatile uint32_t dcbaap_hi;
+    volatile uint32_t config;    /* 0x38: Configure */
+    uint32_t reserved2[241];
+    struct xhci_port_regs port[255]; /* 0x400: Port Register Sets */
+};
+
+/* Interrupter Register Set. Paragraph 5.5.2 */
+
+struct xhci_intr_regs {
+    volatile uint32_t iman;     /* 0x00: Interrupter Management */
+    volatile uint32_t imod;     /* 0x04: Interrupter Moderation */
+    volatile uint32_t erstsz;   /* 0x08: Event Ring Segment Table Size */
+    uint32_t reserved;
+    volatile uint32_t erstba_lo; /* 0x10: Event Ring Segment Table Base Address */
+    volatile uint32_t erstba_hi;
+    volatile uint32_t erdp_lo;   /* 0x18: Event Ring Dequeue Pointer */
+    volatile uint32_t erdp_hi;
+};
+
+/* Host Controller Runtime Registers. Paragraph 5.5 */
+
+struct xhci_hcrr {
+    volatile uint32_t mfindex; /* 0x00: Microframe Index */
+    uint32_t reserved[7];
+    struct xhci_intr_regs ir[1024]; /* 0x20: Interrupter Register Sets */
+};
+
+/* Data Structures **********************************************************/
+
+/* Transfer/Command/Event TRB. Paragraph 6.4 */
+
+struct xhci_trb {
+    uint32_t param_lo;
+    uint32_t param_hi;
+    uint32_t status;
+    uint32_t control;
+};
+
+/* Event Ring Segment Table Entry. Paragraph 6.5 */
+
+struct xhci_erst_entry {
+    uint32_t base_lo;
+    uint32_t base_hi;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+/* Slot, endpoint and input control contexts are 32 or 64 bytes depending on
+ * HCCPARAMS1.CSZ, only the first 32 bytes are used.
+ */
+
+struct xhci_slot_ctx {
+    uint32_t info[4];
+    uint32_t reserved[4];
+};
+
+struct xhci_ep_ctx {
+    uint32_t info0;
+    uint32_t info1;
+    uint32_t deq_lo;
+    uint32_t deq_hi;
+    uint32_t info4;
+    uint32_t reserved[3];
+};
+
+struct xhci_input_ctrl_ctx {
+    uint32_t drop_flags;
+    uint32_t add_flags;
+    uint32_t reserved[6];
+};
+
+#endif /* _USB_XHCI_REG_H */
@@ -0,0 +1,11 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef TEST_LWIP_NETIF_H
+#define TEST_LWIP_NETIF_H
+
+#include "lwip/pbuf.h"
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef TEST_LWIP_PBUF_H
+#define TEST_LWIP_PBUF_H
+
+/* Just the pbuf api the network classes use without zero copy, see ../pbuf.c */
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int8_t err_t;
+
+#define ERR_OK  0
+#define ERR_MEM -1
+#define ERR_BUF -2
+
+typedef enum {
+    PBUF_RAW
+} pbuf_layer;
+
+typedef enum {
+    PBUF_RAM,
+    PBUF_POOL
+} pbuf_type;
+
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    uint16_t tot_len;
+    uint16_t len;
+};
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, uint16_t length, pbuf_type type);
+err_t pbuf_take(struct pbuf *buf, const void *dataptr, uint16_t len);
+uint8_t pbuf_free(struct pbuf *p);
+
+#endif
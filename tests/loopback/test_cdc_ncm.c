@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usbd_core.h"
+#include "usbd_cdc_ncm.h"
+#include "usbh_core.h"
+#include "usbh_cdc_ncm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CDC_IN_EP  0x81
+#define CDC_OUT_EP 0x02
+#define CDC_INT_EP 0x83
+
+#define USB_CONFIG_SIZE (9 + CDC_NCM_DESCRIPTOR_LEN)
+
+#define TEST_ETH_MIN_LEN 60
+#define TEST_ETH_MAX_LEN 1514
+#define TEST_FRAMES      1000
+
+static const uint8_t device_descriptor[] = {
+    USB_DEVICE_DESCRIPTOR_INIT(USB_2_0, 0xEF, 0x02, 0x01, 0xFFFF, 0xFFFF, 0x0100, 0x01)
+};
+
+static const uint8_t config_descriptor[] = {
+    USB_CONFIG_DESCRIPTOR_INIT(USB_CONFIG_SIZE, 0x02, 0x01, USB_CONFIG_BUS_POWERED, 100),
+    CDC_NCM_DESCRIPTOR_INIT(0x00, CDC_INT_EP, CDC_OUT_EP, CDC_IN_EP, 512, 0, TEST_ETH_MAX_LEN, 0, 0, 4)
+};
+
+static const uint8_t device_quality_descriptor[] = {
+    0x0a, USB_DESCRIPTOR_TYPE_DEVICE_QUALIFIER, 0x00, 0x02, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00
+};
+
+static const char *string_descriptors[] = {
+    (const char[]){ 0x09, 0x04 }, /* Langid */
+    "CherryUSB",                  /* Manufacturer */
+    "CherryUSB CDC NCM TEST",     /* Product */
+    "2025000001",                 /* Serial Number */
+    "aabbccddeeff",               /* MAC address */
+};
+
+static const uint8_t *device_descriptor_callback(uint8_t speed)
+{
+    return device_descriptor;
+}
+
+static const uint8_t *config_descriptor_callback(uint8_t speed)
+{
+    return config_descriptor;
+}
+
+static const uint8_t *device_quality_descriptor_callback(uint8_t speed)
+{
+    return device_quality_descriptor;
+}
+
+static const char *string_descriptor_callback(uint8_t speed, uint8_t index)
+{
+    if (index > 4) {
+        return NULL;
+    }
+    return string_descriptors[index];
+}
+
+static const struct usb_descriptor cdc_ncm_descriptor = {
+    .device_descriptor_callback = device_descriptor_callback,
+    .config_descriptor_callback = config_descriptor_callback,
+    .device_quality_descriptor_callback = device_quality_descriptor_callback,
+    .string_descriptor_callback = string_descriptor_callback
+};
+
+static struct usbd_interface intf0;
+static struct usbd_interface intf1;
+
+static struct usbh_cdc_ncm *volatile g_cdc_ncm;
+
+static uint16_t g_frame_len[TEST_FRAMES];
+static volatile uint32_t g_host_rx_count;
+static volatile uint32_t g_host_rx_err;
+static volatile uint32_t g_device_ntbs;
+
+static void usbd_event_handler(uint8_t busid, uint8_t event)
+{
+    (void)busid;
+    (void)event;
+}
+
+void usbh_cdc_ncm_run(struct usbh_cdc_ncm *cdc_ncm_class)
+{
+    g_cdc_ncm = cdc_ncm_class;
+    usb_osal_thread_create("usbh_cdc_ncm_rx", 4096, CONFIG_USBHOST_PSC_PRIO + 1, usbh_cdc_ncm_rx_thread, NULL);
+}
+
+void usbh_cdc_ncm_stop(struct usbh_cdc_ncm *cdc_ncm_class)
+{
+    (void)cdc_ncm_class;
+    g_cdc_ncm = NULL;
+}
+
+void usbd_cdc_ncm_data_send_done(uint8_t busid, uint8_t intf, uint32_t len)
+{
+    (void)busid;
+    (void)intf;
+    (void)len;
+    g_device_ntbs++;
+}
+
+/* first two bytes carry the frame number, the rest is derived from it */
+static void test_fill(uint8_t *buf, uint32_t len, uint32_t seq)
+{
+    buf[0] = seq & 0xff;
+    buf[1] = seq >> 8;
+    for (uint32_t i = 2; i < len; i++) {
+        buf[i] = (uint8_t)(seq * 7 + i);
+    }
+}
+
+static bool test_check(const uint8_t *buf, uint32_t len, uint32_t seq)
+{
+    if ((buf[0] != (seq & 0xff)) || (buf[1] != ((seq >> 8) & 0xff))) {
+        return false;
+    }
+    for (uint32_t i = 2; i < len; i++) {
+        if (buf[i] != (uint8_t)(seq * 7 + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void usbh_cdc_ncm_eth_input(uint8_t *buf, uint32_t buflen)
+{
+    uint32_t seq = g_host_rx_count;
+
+    if ((seq >= TEST_FRAMES) || (buflen != g_frame_len[seq]) || !test_check(buf, buflen, seq)) {
+        printf("host rx frame %u bad, len %u\r\n", seq, buflen);
+        g_host_rx_err++;
+    }
+    g_host_rx_count++;
+}
+
+static bool test_wait(bool connected)
+{
+    for (uint32_t i = 0; i < 500; i++) {
+        if ((g_cdc_ncm != NULL) == connected) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+static struct pbuf *test_device_rx(void)
+{
+    struct pbuf *p;
+
+    for (uint32_t i = 0; i < 10000; i++) {
+        p = usbd_cdc_ncm_eth_rx(0, 0);
+        if (p) {
+            return p;
+        }
+        usleep(100);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    static uint8_t frame[TEST_ETH_MAX_LEN];
+    struct pbuf *p;
+    uint32_t len;
+    uint32_t offset;
+    int ret;
+
+    usbd_desc_register(0, &cdc_ncm_descriptor);
+    usbd_add_interface(0, usbd_cdc_ncm_init_intf(0, &intf0, CDC_INT_EP, CDC_OUT_EP, CDC_IN_EP));
+    usbd_add_interface(0, usbd_cdc_ncm_init_intf(0, &intf1, CDC_INT_EP, CDC_OUT_EP, CDC_IN_EP));
+    usbd_initialize(0, 0, usbd_event_handler);
+    usbh_initialize(0, 0);
+
+    if (!test_wait(true)) {
+        printf("FAIL: cdc ncm not connected\r\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; (i < 500) && !g_cdc_ncm->connect_status; i++) {
+        usleep(10000);
+    }
+    if (!g_cdc_ncm->connect_status) {
+        printf("FAIL: no network connection\r\n");
+        return 1;
+    }
+
+    /* device to host, frames queued while an ntb is on the bus share the next one */
+    srand(1);
+    for (uint32_t seq = 0; seq < TEST_FRAMES; seq++) {
+        len = TEST_ETH_MIN_LEN + rand() % (TEST_ETH_MAX_LEN - TEST_ETH_MIN_LEN + 1);
+        g_frame_len[seq] = len;
+        test_fill(frame, len, seq);
+
+        p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+        pbuf_take(p, frame, len);
+        while ((ret = usbd_cdc_ncm_eth_tx(0, 0, p)) == -USB_ERR_BUSY) {
+            usleep(100);
+        }
+        pbuf_free(p);
+        if (ret < 0) {
+            printf("FAIL: frame %u device tx %d\r\n", seq, ret);
+            return 1;
+        }
+    }
+
+    for (uint32_t i = 0; (i < 500) && (g_host_rx_count < TEST_FRAMES); i++) {
+        usleep(10000);
+    }
+    printf("device to host: %u/%u frames in %u ntbs\r\n", g_host_rx_count, TEST_FRAMES, g_device_ntbs);
+    if ((g_host_rx_count != TEST_FRAMES) || g_host_rx_err) {
+        printf("FAIL: device to host\r\n");
+        return 1;
+    }
+
+    /* host to device */
+    for (uint32_t seq = 0; seq < TEST_FRAMES; seq++) {
+        len = TEST_ETH_MIN_LEN + rand() % (TEST_ETH_MAX_LEN - TEST_ETH_MIN_LEN + 1);
+        test_fill(usbh_cdc_ncm_get_eth_txbuf(), len, seq);
+        ret = usbh_cdc_ncm_eth_output(len);
+        if (ret < 0) {
+            printf("FAIL: frame %u host tx %d\r\n", seq, ret);
+            return 1;
+        }
+
+        p = test_device_rx();
+        if ((p == NULL) || (p->tot_len != len)) {
+            printf("FAIL: frame %u device rx len %d\r\n", seq, p ? p->tot_len : -1);
+            return 1;
+        }
+
+        offset = 0;
+        for (struct pbuf *q = p; q != NULL; q = q->next) {
+            memcpy(&frame[offset], q->payload, q->len);
+            offset += q->len;
+        }
+        pbuf_free(p);
+        if (!test_check(frame, len, seq)) {
+            printf("FAIL: frame %u device rx data mismatch\r\n", seq);
+            return 1;
+        }
+    }
+    printf("host to device: %u frames\r\n", TEST_FRAMES);
+
+    usbd_deinitialize(0);
+    if (!test_wait(false)) {
+        printf("FAIL: cdc ncm not disconnected\r\n");
+        return 1;
+    }
+
+    printf("PASS\r\n");
+    return 0;
+}
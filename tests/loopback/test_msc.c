@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "usbd_core.h"
+#include "usbd_msc.h"
+#include "usbh_core.h"
+#include "usbh_msc.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* demo/msc_ram_template.c keeps 10 sectors of 512 bytes */
+#define TEST_SECTORS    10
+#define TEST_BLOCK_SIZE 512
+#define TEST_LOOPS      200
+
+extern void msc_ram_init(uint8_t busid, uintptr_t reg_base);
+
+static struct usbh_msc *volatile g_msc;
+
+static USB_MEM_ALIGNX uint8_t g_wbuf[TEST_SECTORS * TEST_BLOCK_SIZE];
+static USB_MEM_ALIGNX uint8_t g_rbuf[TEST_SECTORS * TEST_BLOCK_SIZE];
+
+void usbh_msc_run(struct usbh_msc *msc_class)
+{
+    g_msc = msc_class;
+}
+
+void usbh_msc_stop(struct usbh_msc *msc_class)
+{
+    (void)msc_class;
+    g_msc = NULL;
+}
+
+#ifdef CONFIG_USBDEV_MSC_POLLING
+static void *test_msc_polling(void *arg)
+{
+    (void)arg;
+
+    while (1) {
+        usbd_msc_polling(0);
+        usleep(100);
+    }
+    return NULL;
+}
+#endif
+
+static bool test_wait(bool connected)
+{
+    for (uint32_t i = 0; i < 500; i++) {
+        if ((g_msc != NULL) == connected) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+int main(void)
+{
+    uint32_t sector;
+    uint32_t count;
+    int ret;
+
+#ifdef CONFIG_USBDEV_MSC_POLLING
+    pthread_t poll_thread;
+
+    pthread_create(&poll_thread, NULL, test_msc_polling, NULL);
+#endif
+
+    msc_ram_init(0, 0);
+    usbh_initialize(0, 0);
+
+    if (!test_wait(true)) {
+        printf("FAIL: msc not connected\r\n");
+        return 1;
+    }
+
+    ret = usbh_msc_scsi_init(g_msc);
+    if (ret < 0) {
+        printf("FAIL: scsi init %d\r\n", ret);
+        return 1;
+    }
+
+    /* writes after reads, so a data out command follows every data in command */
+    srand(1);
+    for (uint32_t loop = 0; loop < TEST_LOOPS; loop++) {
+        sector = rand() % TEST_SECTORS;
+        count = 1 + rand() % (TEST_SECTORS - sector);
+
+        for (uint32_t i = 0; i < count * TEST_BLOCK_SIZE; i++) {
+            g_wbuf[i] = rand();
+        }
+
+        ret = usbh_msc_scsi_write10(g_msc, sector, g_wbuf, count);
+        if (ret < 0) {
+            printf("FAIL: loop %u write10 %d\r\n", loop, ret);
+            return 1;
+        }
+
+        memset(g_rbuf, 0, sizeof(g_rbuf));
+        ret = usbh_msc_scsi_read10(g_msc, sector, g_rbuf, count);
+        if (ret < 0) {
+            printf("FAIL: loop %u read10 %d\r\n", loop, ret);
+            return 1;
+        }
+
+        if (memcmp(g_wbuf, g_rbuf, count * TEST_BLOCK_SIZE)) {
+            printf("FAIL: loop %u data mismatch, sector %u count %u\r\n", loop, sector, count);
+            return 1;
+        }
+    }
+
+    usbd_deinitialize(0);
+    if (!test_wait(false)) {
+        printf("FAIL: msc not disconnected\r\n");
+        return 1;
+    }
+
+    printf("PASS\r\n");
+    return 0;
+}
@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2025, sakumisu
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef TEST_USB_CONFIG_H
+#define TEST_USB_CONFIG_H
+
+/* Template defaults on the loopback controller, tests add their options on the command line */
+#define CONFIG_USB_HS
+
+#include "cherryusb_config_template.h"
+
+#endif